@@ -0,0 +1,455 @@
+/*
+ * Throughput benchmarks for every upb parser and serializer, run over the
+ * google_message{1,2}.dat corpus.
+ *
+ * Each benchmark processes one whole message per iteration with a fresh
+ * upb_env, and is run twice:
+ *
+ * - "warm": the same input is processed back-to-back until at least
+ *   kMinWarmSeconds have elapsed, so code, tables and input all stay in cache.
+ * - "cold": before every iteration we stream through a buffer much larger
+ *   than the last-level cache, so each message starts with cold caches.
+ *
+ * The benchmarks are:
+ *
+ * - upb_decode / upb_encode: to and from a upb_msg, using the msgfactory's
+ *   layout for the message.
+ * - upb_encode_plan: upb_encode_withplan() with the layout compiled once up
+ *   front, which produces the same bytes as upb_encode.
+ * - pbdecoder_vm / pbdecoder_jit: the handlers-based decoder, parsing into
+ *   handlers that have nothing registered, so we measure only the decoder.
+ *   The JIT is only run when it was built (make WITH_JIT=yes).
+ * - json_parser: likewise, on the JSON that upb_json_printer produces for the
+ *   message.
+ * - pb_encoder: the VM decoder feeding upb_pb_encoder.  The upb_msg visitor
+ *   can't yet drive the encoder with strings, submessages or repeated fields,
+ *   so subtract pbdecoder_vm to get the encoder's own cost.
+ *
+ * Results go to stdout as tab-separated values, one row per
+ * (benchmark, message, cache) triple, preceded by a header row.  The
+ * allocation columns count the blocks the environment's arena requested from
+ * the heap (and their total size), which is what a caller would see from
+ * their allocator.  Anything that is not a result goes to stderr, so the
+ * output can be fed directly to a regression checker.
+ *
+ * Usage: benchmark <google_messages.proto.pb> [<data dir>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+#include "tests/test_util.h"
+#include "upb/bindings/stdc++/string.h"
+#include "upb/decode.h"
+#include "upb/encode.h"
+#include "upb/json/parser.h"
+#include "upb/json/printer.h"
+#include "upb/msg.h"
+#include "upb/pb/decoder.h"
+#include "upb/pb/encoder.h"
+#include "upb/pb/glue.h"
+
+static const double kMinWarmSeconds = 0.5;
+static const int kColdIterations = 50;
+static const size_t kFlushBytes = 64 * 1024 * 1024;
+
+/* counting_alloc *************************************************************/
+
+/* Forwards to upb_alloc_global, counting every allocation and reallocation. */
+typedef struct {
+  upb_alloc alloc;
+  size_t count;
+  size_t bytes;
+} counting_alloc;
+
+static void *counting_allocfunc(upb_alloc *alloc, void *ptr, size_t oldsize,
+                                size_t size) {
+  counting_alloc *a = (counting_alloc*)alloc;
+  if (size > 0) {
+    a->count++;
+    a->bytes += size;
+  }
+  return upb_realloc(&upb_alloc_global, ptr, oldsize, size);
+}
+
+static void counting_alloc_init(counting_alloc *a) {
+  a->alloc.func = &counting_allocfunc;
+  a->count = 0;
+  a->bytes = 0;
+}
+
+/* Per-message state shared by all benchmarks *********************************/
+
+typedef struct {
+  const char *name;
+  const upb_msgdef *md;
+  const upb_msglayout *layout;
+  const upb_msglayout_msginit_v1 *init;
+  const upb_handlers *null_handlers;
+  const upb_handlers *encoder_handlers;
+  const upb_pbdecodermethod *vm_method;
+  const upb_pbdecodermethod *jit_method;
+  const upb_pbdecodermethod *encoder_method;
+  const upb_json_parsermethod *json_method;
+  upb_encodeplan *plan;
+
+  /* Inputs: the serialized protobuf, its JSON equivalent, and a message
+   * already parsed from it for upb_encode() to serialize. */
+  std::string pb;
+  std::string json;
+  upb_env msg_env;
+  upb_msg *msg;
+
+  /* Output buffer for the serializers that write to a upb_bytessink. */
+  std::string out;
+} benchmark_input;
+
+typedef bool benchmark_func(benchmark_input *in, upb_env *env);
+
+static upb_msg *newmsg(benchmark_input *in, upb_env *env) {
+  return upb_msg_new(in->layout, upb_arena_alloc(upb_env_arena(env)));
+}
+
+static bool run_pbdecoder(benchmark_input *in, upb_env *env,
+                          const upb_pbdecodermethod *method) {
+  upb_sink sink;
+  upb_pbdecoder *d;
+  upb_sink_reset(&sink, in->null_handlers, NULL);
+  d = upb_pbdecoder_create(env, method, &sink);
+  return upb_bufsrc_putbuf(in->pb.data(), in->pb.size(),
+                           upb_pbdecoder_input(d));
+}
+
+/* Benchmarks *****************************************************************/
+
+static bool bench_upb_decode(benchmark_input *in, upb_env *env) {
+  return upb_decode(upb_stringview_make(in->pb.data(), in->pb.size()),
+                    newmsg(in, env), in->init, env);
+}
+
+static bool bench_upb_validate(benchmark_input *in, upb_env *env) {
+  UPB_UNUSED(env);
+  return upb_validate(upb_stringview_make(in->pb.data(), in->pb.size()),
+                      in->init, NULL);
+}
+
+static bool bench_pbdecoder_vm(benchmark_input *in, upb_env *env) {
+  return run_pbdecoder(in, env, in->vm_method);
+}
+
+static bool bench_pbdecoder_jit(benchmark_input *in, upb_env *env) {
+  return run_pbdecoder(in, env, in->jit_method);
+}
+
+static bool bench_json_parser(benchmark_input *in, upb_env *env) {
+  upb_sink sink;
+  upb_json_parser *p;
+  upb_sink_reset(&sink, in->null_handlers, NULL);
+  p = upb_json_parser_create(env, in->json_method, &sink);
+  return upb_bufsrc_putbuf(in->json.data(), in->json.size(),
+                           upb_json_parser_input(p));
+}
+
+static bool bench_pb_encoder(benchmark_input *in, upb_env *env) {
+  upb::StringSink string_sink(&in->out);
+  upb_pb_encoder *e =
+      upb_pb_encoder_create(env, in->encoder_handlers, string_sink.input());
+  upb_pbdecoder *d =
+      upb_pbdecoder_create(env, in->encoder_method, upb_pb_encoder_input(e));
+  return upb_bufsrc_putbuf(in->pb.data(), in->pb.size(),
+                           upb_pbdecoder_input(d)) &&
+         in->out == in->pb;
+}
+
+static bool bench_upb_encode(benchmark_input *in, upb_env *env) {
+  size_t size;
+  return upb_encode(in->msg, in->init, env, &size) != NULL;
+}
+
+static bool bench_upb_encode_plan(benchmark_input *in, upb_env *env) {
+  size_t size;
+  return upb_encode_withplan(in->msg, in->plan, env, &size) != NULL;
+}
+
+/* Runner *********************************************************************/
+
+static char *flush_buf;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Evicts everything we have touched from the data caches. */
+static void flush_caches() {
+  size_t i;
+  for (i = 0; i < kFlushBytes; i += 64) {
+    flush_buf[i]++;
+  }
+}
+
+/* Runs one iteration, accumulating its allocations into |a|. */
+static bool run_once(benchmark_func *func, benchmark_input *in,
+                     counting_alloc *a) {
+  upb_env env;
+  bool ok;
+  upb_env_init2(&env, NULL, 0, &a->alloc);
+  ok = func(in, &env);
+  upb_env_uninit(&env);
+  return ok;
+}
+
+static void report(const char *bench, const benchmark_input *in,
+                   const char *cache, long iters, size_t bytes_per_iter,
+                   double seconds, const counting_alloc *a) {
+  printf("%s\t%s\t%s\t%ld\t%lu\t%.2f\t%.1f\t%.2f\t%.1f\n", bench, in->name,
+         cache, iters, (unsigned long)bytes_per_iter,
+         bytes_per_iter * iters / seconds / (1024 * 1024),
+         seconds * 1e9 / iters, (double)a->count / iters,
+         (double)a->bytes / iters);
+  fflush(stdout);
+}
+
+static bool run_benchmark(const char *bench, benchmark_func *func,
+                          benchmark_input *in, size_t bytes_per_iter) {
+  counting_alloc a;
+  double start, elapsed;
+  long iters, batch;
+  int i;
+
+  /* Warm up, and check that the benchmark actually works. */
+  counting_alloc_init(&a);
+  if (!run_once(func, in, &a)) {
+    fprintf(stderr, "%s failed on %s\n", bench, in->name);
+    return false;
+  }
+
+  counting_alloc_init(&a);
+  iters = 0;
+  batch = 1;
+  start = now();
+  do {
+    long j;
+    for (j = 0; j < batch; j++) {
+      run_once(func, in, &a);
+    }
+    iters += batch;
+    batch *= 2;
+    elapsed = now() - start;
+  } while (elapsed < kMinWarmSeconds);
+  report(bench, in, "warm", iters, bytes_per_iter, elapsed, &a);
+
+  counting_alloc_init(&a);
+  elapsed = 0;
+  for (i = 0; i < kColdIterations; i++) {
+    flush_caches();
+    start = now();
+    run_once(func, in, &a);
+    elapsed += now() - start;
+  }
+  report(bench, in, "cold", kColdIterations, bytes_per_iter, elapsed, &a);
+  return true;
+}
+
+/* Setup **********************************************************************/
+
+static void register_nothing(const void *closure, upb_handlers *h) {
+  UPB_UNUSED(closure);
+  UPB_UNUSED(h);
+}
+
+static upb_symtab *load_symtab(const char *filename) {
+  upb_symtab *s = upb_symtab_new();
+  upb::Status status;
+  size_t len;
+  char *data = upb_readfile(filename, &len);
+  upb_filedef **files, **files_ptr;
+  bool ok = true;
+
+  if (!data) {
+    fprintf(stderr, "Couldn't read %s\n", filename);
+    exit(1);
+  }
+
+  files = upb_loaddescriptor(data, len, &files, &status);
+  free(data);
+  if (!files) {
+    fprintf(stderr, "Couldn't load %s: %s\n", filename,
+            upb_status_errmsg(&status));
+    exit(1);
+  }
+
+  for (files_ptr = files; *files_ptr; files_ptr++) {
+    ok = ok && upb_symtab_addfile(s, *files_ptr, &status);
+    upb_filedef_unref(*files_ptr, &files);
+  }
+  upb_gfree(files);
+
+  if (!ok) {
+    fprintf(stderr, "Couldn't add %s: %s\n", filename,
+            upb_status_errmsg(&status));
+    exit(1);
+  }
+
+  return s;
+}
+
+/* Serializes in->pb to JSON with the printer, for the JSON parser to read. */
+static bool make_json(benchmark_input *in) {
+  upb_env env;
+  const upb_handlers *h = upb_json_printer_newhandlers(in->md, false, &h);
+  upb::pb::DecoderMethodOptions opts(h);
+  const upb_pbdecodermethod *m = upb_pbdecodermethod_new(&opts, &m);
+  upb::StringSink string_sink(&in->json);
+  upb_json_printer *printer;
+  upb_pbdecoder *d;
+  bool ok;
+
+  upb_env_init(&env);
+  printer = upb_json_printer_create(&env, h, string_sink.input());
+  d = upb_pbdecoder_create(&env, m, upb_json_printer_input(printer));
+  ok = upb_bufsrc_putbuf(in->pb.data(), in->pb.size(), upb_pbdecoder_input(d));
+  upb_env_uninit(&env);
+  upb_pbdecodermethod_unref(m, &m);
+  upb_handlers_unref(h, &h);
+  return ok;
+}
+
+static bool setup_input(benchmark_input *in, const char *name,
+                        const char *msgname, const char *filename,
+                        upb_symtab *symtab, upb_msgfactory *factory,
+                        upb_pbcodecache *vm_cache,
+                        upb_pbcodecache *jit_cache) {
+  size_t len;
+  char *data = upb_readfile(filename, &len);
+
+  /* Initialized first so that free_input() is always safe to call. */
+  upb_env_init(&in->msg_env);
+  in->null_handlers = NULL;
+  in->encoder_handlers = NULL;
+  in->json_method = NULL;
+  in->plan = NULL;
+
+  if (!data) {
+    fprintf(stderr, "Couldn't read %s\n", filename);
+    return false;
+  }
+  in->pb.assign(data, len);
+  free(data);
+
+  in->name = name;
+  in->md = upb_symtab_lookupmsg(symtab, msgname);
+  if (!in->md) {
+    fprintf(stderr, "No message %s in descriptor\n", msgname);
+    return false;
+  }
+
+  in->layout = upb_msgfactory_getlayout(factory, in->md);
+  /* A upb_msglayout begins with the msginit it was built from. */
+  in->init = (const upb_msglayout_msginit_v1*)in->layout;
+  in->null_handlers =
+      upb_handlers_newfrozen(in->md, in, &register_nothing, NULL);
+  in->encoder_handlers = upb_pb_encoder_newhandlers(in->md, in);
+  in->json_method = upb_json_parsermethod_new(in->md, in);
+  in->plan = upb_encodeplan_new(in->init, &upb_alloc_global);
+
+  {
+    upb::pb::DecoderMethodOptions opts(in->null_handlers);
+    upb::pb::DecoderMethodOptions encoder_opts(in->encoder_handlers);
+    in->vm_method = upb_pbcodecache_getdecodermethod(vm_cache, &opts);
+    in->jit_method = upb_pbcodecache_getdecodermethod(jit_cache, &opts);
+    in->encoder_method =
+        upb_pbcodecache_getdecodermethod(vm_cache, &encoder_opts);
+  }
+
+  in->msg = newmsg(in, &in->msg_env);
+  if (!upb_decode(upb_stringview_make(in->pb.data(), in->pb.size()), in->msg,
+                  in->init, &in->msg_env)) {
+    fprintf(stderr, "Couldn't parse %s\n", filename);
+    return false;
+  }
+
+  if (!make_json(in)) {
+    fprintf(stderr, "Couldn't convert %s to JSON\n", filename);
+    return false;
+  }
+
+  return true;
+}
+
+static void free_input(benchmark_input *in) {
+  upb_env_uninit(&in->msg_env);
+  if (in->plan) upb_encodeplan_free(in->plan);
+  if (in->json_method) upb_json_parsermethod_unref(in->json_method, in);
+  if (in->encoder_handlers) upb_handlers_unref(in->encoder_handlers, in);
+  if (in->null_handlers) upb_handlers_unref(in->null_handlers, in);
+}
+
+static bool run_benchmarks(benchmark_input *in) {
+  bool ok = true;
+  size_t pb_size = in->pb.size();
+  size_t json_size = in->json.size();
+
+  ok &= run_benchmark("upb_decode", &bench_upb_decode, in, pb_size);
+  ok &= run_benchmark("upb_validate", &bench_upb_validate, in, pb_size);
+  ok &= run_benchmark("pbdecoder_vm", &bench_pbdecoder_vm, in, pb_size);
+  if (upb_pbdecodermethod_isnative(in->jit_method)) {
+    ok &= run_benchmark("pbdecoder_jit", &bench_pbdecoder_jit, in, pb_size);
+  } else {
+    fprintf(stderr, "pbdecoder_jit: skipped, build with WITH_JIT=yes\n");
+  }
+  ok &= run_benchmark("json_parser", &bench_json_parser, in, json_size);
+  ok &= run_benchmark("pb_encoder", &bench_pb_encoder, in, pb_size);
+  ok &= run_benchmark("upb_encode", &bench_upb_encode, in, pb_size);
+  ok &= run_benchmark("upb_encode_plan", &bench_upb_encode_plan, in, pb_size);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  static const struct {
+    const char *name;
+    const char *msgname;
+    const char *filename;
+  } inputs[] = {
+    {"google_message1", "benchmarks.SpeedMessage1", "google_message1.dat"},
+    {"google_message2", "benchmarks.SpeedMessage2", "google_message2.dat"},
+  };
+  const char *datadir = argc > 2 ? argv[2] : "tests";
+  upb_symtab *symtab;
+  upb_msgfactory *factory;
+  upb::pb::CodeCache vm_cache, jit_cache;
+  bool ok = true;
+  size_t i;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <google_messages.proto.pb> [<data dir>]\n",
+            argv[0]);
+    return 1;
+  }
+
+  symtab = load_symtab(argv[1]);
+  factory = upb_msgfactory_new(symtab);
+  upb_pbcodecache_setallowjit(&vm_cache, false);
+  flush_buf = (char*)calloc(kFlushBytes, 1);
+
+  printf("benchmark\tmessage\tcache\titerations\tbytes\tmb_per_s\t"
+         "ns_per_msg\tallocs_per_msg\talloc_bytes_per_msg\n");
+
+  for (i = 0; ok && i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    benchmark_input in;
+    std::string filename = std::string(datadir) + "/" + inputs[i].filename;
+    ok = setup_input(&in, inputs[i].name, inputs[i].msgname, filename.c_str(),
+                     symtab, factory, &vm_cache, &jit_cache) &&
+         run_benchmarks(&in);
+    free_input(&in);
+  }
+
+  free(flush_buf);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(symtab);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,546 @@
+/*
+ * Head-to-head benchmarks of upb against Google's protobuf library (proto2),
+ * run over the google_message{1,2}.dat corpus and any corpora given on the
+ * command line.
+ *
+ * tests/bindings/googlepb/test_vs_proto2.cc checks that the two parse the
+ * same results; this measures how fast they do it.  Each benchmark processes
+ * one whole message per iteration, back-to-back until at least
+ * kMinSeconds have elapsed, with a fresh upb_env or proto2 Arena each time.
+ * The benchmarks are:
+ *
+ * - parse: upb_decode() into a upb_msg ("upb_table"), the pbdecoder VM and
+ *   JIT ("upb_vm", "upb_jit") into handlers that have nothing registered, and
+ *   proto2's ParseFromArray() into a message on the arena.  The VM and JIT
+ *   don't build a message, so they measure the decoder alone.  The JIT is
+ *   only run when it was built (make WITH_JIT=yes).
+ * - serialize: upb_encode() of a parsed upb_msg, and proto2's
+ *   SerializeToArray() of a parsed message into a preallocated buffer.
+ * - json_roundtrip: protobuf to JSON and back.  For upb this is
+ *   upb_json_transcoder, binary to JSON to binary.  For proto2 it is
+ *   MessageToJsonString() of a parsed message, then JsonStringToMessage().
+ *
+ * proto2 uses generated code for a message type when this binary has it, as
+ * it does for the google_messages; otherwise it uses DynamicMessage and the
+ * library column says "proto2_dynamic".
+ *
+ * Every benchmark runs in a child process of its own, so its peak RSS can be
+ * measured.  peak_rss_kb is the child's peak, including everything it
+ * inherited; rss_growth_kb is how much of that the benchmark itself added.
+ * The allocation columns count every heap allocation, both from upb's
+ * allocator and from operator new.
+ *
+ * Results go to stdout as tab-separated values, one row per (library,
+ * benchmark, message) triple, preceded by a header row, as for
+ * benchmarks/benchmark.  Anything that is not a result goes to stderr.
+ *
+ * Usage: benchmark_vs_proto2 <google_messages.proto.pb> [<data dir>
+ *          [<descriptor set> <message type> <file>]...]
+ *
+ * Each extra corpus is one serialized message of the given fully-qualified
+ * type, which must be in the given descriptor set (protoc -o
+ * --include_imports).
+ */
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/descriptor.pb.h>
+#include <google/protobuf/dynamic_message.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/util/json_util.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "tests/test_util.h"
+#include "upb/bindings/stdc++/string.h"
+#include "upb/decode.h"
+#include "upb/encode.h"
+#include "upb/json/transcode.h"
+#include "upb/msg.h"
+#include "upb/pb/decoder.h"
+#include "upb/pb/glue.h"
+
+namespace gpb = google::protobuf;
+
+static const double kMinSeconds = 0.5;
+
+/* Allocation counting ********************************************************/
+
+static size_t alloc_count;
+static size_t alloc_bytes;
+
+void *operator new(size_t size) {
+  void *ret = malloc(size ? size : 1);
+  if (!ret) throw std::bad_alloc();
+  alloc_count++;
+  alloc_bytes += size;
+  return ret;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *ptr) throw() { free(ptr); }
+void operator delete[](void *ptr) throw() { free(ptr); }
+void operator delete(void *ptr, size_t size) throw() {
+  UPB_UNUSED(size);
+  free(ptr);
+}
+void operator delete[](void *ptr, size_t size) throw() {
+  UPB_UNUSED(size);
+  free(ptr);
+}
+
+/* Forwards to upb_alloc_global, counting every allocation and reallocation. */
+static void *counting_allocfunc(upb_alloc *alloc, void *ptr, size_t oldsize,
+                                size_t size) {
+  UPB_UNUSED(alloc);
+  if (size > 0) {
+    alloc_count++;
+    alloc_bytes += size;
+  }
+  return upb_realloc(&upb_alloc_global, ptr, oldsize, size);
+}
+
+static upb_alloc counting_alloc;
+
+/* Per-message state shared by all benchmarks *********************************/
+
+typedef struct {
+  std::string name;
+  const upb_msgdef *md;
+  const upb_msglayout *layout;
+  const upb_msglayout_msginit_v1 *init;
+  const upb_handlers *null_handlers;
+  const upb_pbdecodermethod *vm_method;
+  const upb_pbdecodermethod *jit_method;
+  upb_json_transcoder *transcoder;
+
+  /* The proto2 type, and whether it is a DynamicMessage. */
+  const gpb::Message *prototype;
+  bool dynamic;
+
+  /* Inputs: the serialized protobuf, and messages already parsed from it for
+   * the serializers. */
+  std::string pb;
+  upb_env msg_env;
+  upb_msg *msg;
+  gpb::Message *proto2_msg;
+
+  /* Output buffers. */
+  std::string out;
+  std::string json;
+  std::vector<char> serialized;
+} benchmark_input;
+
+typedef bool benchmark_func(benchmark_input *in, upb_env *env);
+
+/* upb benchmarks *************************************************************/
+
+static bool run_pbdecoder(benchmark_input *in, upb_env *env,
+                          const upb_pbdecodermethod *method) {
+  upb_sink sink;
+  upb_pbdecoder *d;
+  upb_sink_reset(&sink, in->null_handlers, NULL);
+  d = upb_pbdecoder_create(env, method, &sink);
+  return upb_bufsrc_putbuf(in->pb.data(), in->pb.size(),
+                           upb_pbdecoder_input(d));
+}
+
+static bool bench_upb_table_parse(benchmark_input *in, upb_env *env) {
+  upb_msg *msg = upb_msg_new(in->layout, upb_arena_alloc(upb_env_arena(env)));
+  return upb_decode(upb_stringview_make(in->pb.data(), in->pb.size()), msg,
+                    in->init, env);
+}
+
+static bool bench_upb_vm_parse(benchmark_input *in, upb_env *env) {
+  return run_pbdecoder(in, env, in->vm_method);
+}
+
+static bool bench_upb_jit_parse(benchmark_input *in, upb_env *env) {
+  return run_pbdecoder(in, env, in->jit_method);
+}
+
+static bool bench_upb_serialize(benchmark_input *in, upb_env *env) {
+  size_t size;
+  return upb_encode(in->msg, in->init, env, &size) != NULL;
+}
+
+static bool bench_upb_json_roundtrip(benchmark_input *in, upb_env *env) {
+  upb::StringSink json_sink(&in->json);
+  upb::StringSink out_sink(&in->out);
+  return upb_bufsrc_putbuf(in->pb.data(), in->pb.size(),
+                           upb_json_transcoder_pbinput(in->transcoder, env,
+                                                       json_sink.input())) &&
+         upb_bufsrc_putbuf(in->json.data(), in->json.size(),
+                           upb_json_transcoder_jsoninput(in->transcoder, env,
+                                                         out_sink.input()));
+}
+
+/* proto2 benchmarks **********************************************************/
+
+static bool bench_proto2_parse(benchmark_input *in, upb_env *env) {
+  gpb::Arena arena;
+  gpb::Message *msg = in->prototype->New(&arena);
+  UPB_UNUSED(env);
+  return msg->ParseFromArray(in->pb.data(), in->pb.size());
+}
+
+static bool bench_proto2_serialize(benchmark_input *in, upb_env *env) {
+  UPB_UNUSED(env);
+  return in->proto2_msg->SerializeToArray(&in->serialized[0],
+                                          in->serialized.size());
+}
+
+static bool bench_proto2_json_roundtrip(benchmark_input *in, upb_env *env) {
+  gpb::Arena arena;
+  gpb::Message *msg = in->prototype->New(&arena);
+  UPB_UNUSED(env);
+  in->json.clear();
+  return gpb::util::MessageToJsonString(*in->proto2_msg, &in->json).ok() &&
+         gpb::util::JsonStringToMessage(in->json, msg).ok();
+}
+
+/* Runner *********************************************************************/
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_rss_kb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static bool run_once(benchmark_func *func, benchmark_input *in) {
+  upb_env env;
+  bool ok;
+  upb_env_init2(&env, NULL, 0, &counting_alloc);
+  ok = func(in, &env);
+  upb_env_uninit(&env);
+  return ok;
+}
+
+/* Runs the benchmark to completion.  Called in the child process. */
+static bool run_child(const char *library, const char *bench,
+                      benchmark_func *func, benchmark_input *in) {
+  long start_rss = peak_rss_kb();
+  double start, elapsed;
+  long iters, batch;
+
+  /* Warm up, and check that the benchmark actually works. */
+  if (!run_once(func, in)) {
+    fprintf(stderr, "%s %s failed on %s\n", library, bench, in->name.c_str());
+    return false;
+  }
+
+  alloc_count = 0;
+  alloc_bytes = 0;
+  iters = 0;
+  batch = 1;
+  start = now();
+  do {
+    long j;
+    for (j = 0; j < batch; j++) {
+      run_once(func, in);
+    }
+    iters += batch;
+    batch *= 2;
+    elapsed = now() - start;
+  } while (elapsed < kMinSeconds);
+
+  printf("%s\t%s\t%s\t%ld\t%lu\t%.2f\t%.1f\t%.2f\t%.1f\t%ld\t%ld\n", library,
+         bench, in->name.c_str(), iters, (unsigned long)in->pb.size(),
+         in->pb.size() * iters / elapsed / (1024 * 1024),
+         elapsed * 1e9 / iters, (double)alloc_count / iters,
+         (double)alloc_bytes / iters, peak_rss_kb(),
+         peak_rss_kb() - start_rss);
+  fflush(stdout);
+  return true;
+}
+
+static bool run_benchmark(const char *library, const char *bench,
+                          benchmark_func *func, benchmark_input *in) {
+  pid_t pid;
+  int status;
+
+  fflush(stdout);
+  fflush(stderr);
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  } else if (pid == 0) {
+    _exit(run_child(library, bench, func, in) ? 0 : 1);
+  }
+
+  return waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+/* Setup **********************************************************************/
+
+static void register_nothing(const void *closure, upb_handlers *h) {
+  UPB_UNUSED(closure);
+  UPB_UNUSED(h);
+}
+
+static bool read_file(const char *filename, std::string *out) {
+  size_t len;
+  char *data = upb_readfile(filename, &len);
+  if (!data) {
+    fprintf(stderr, "Couldn't read %s\n", filename);
+    return false;
+  }
+  out->assign(data, len);
+  free(data);
+  return true;
+}
+
+/* The upb and proto2 views of one descriptor set. */
+typedef struct {
+  upb_symtab *symtab;
+  upb_msgfactory *factory;
+  gpb::DescriptorPool *pool;
+  gpb::DynamicMessageFactory *dynamic_factory;
+} benchmark_types;
+
+static bool load_types(benchmark_types *t, const char *filename) {
+  upb::Status status;
+  std::string data;
+  gpb::FileDescriptorSet set;
+  upb_filedef **files, **files_ptr;
+  bool ok = true;
+  int i;
+
+  t->symtab = upb_symtab_new();
+  t->factory = upb_msgfactory_new(t->symtab);
+  t->pool = new gpb::DescriptorPool();
+  t->dynamic_factory = new gpb::DynamicMessageFactory(t->pool);
+
+  if (!read_file(filename, &data)) {
+    return false;
+  }
+
+  files = upb_loaddescriptor(data.data(), data.size(), &files, &status);
+  if (!files) {
+    fprintf(stderr, "Couldn't load %s: %s\n", filename,
+            upb_status_errmsg(&status));
+    return false;
+  }
+  for (files_ptr = files; *files_ptr; files_ptr++) {
+    ok = ok && upb_symtab_addfile(t->symtab, *files_ptr, &status);
+    upb_filedef_unref(*files_ptr, &files);
+  }
+  upb_gfree(files);
+  if (!ok) {
+    fprintf(stderr, "Couldn't add %s: %s\n", filename,
+            upb_status_errmsg(&status));
+    return false;
+  }
+
+  if (!set.ParseFromString(data)) {
+    fprintf(stderr, "Couldn't parse %s\n", filename);
+    return false;
+  }
+  for (i = 0; i < set.file_size(); i++) {
+    if (!t->pool->BuildFile(set.file(i))) {
+      fprintf(stderr, "Couldn't build %s from %s\n",
+              set.file(i).name().c_str(), filename);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void free_types(benchmark_types *t) {
+  delete t->dynamic_factory;
+  delete t->pool;
+  upb_msgfactory_free(t->factory);
+  upb_symtab_free(t->symtab);
+}
+
+/* Checks that upb and proto2 parse the input to the same message, since
+ * comparing the speed of different results would mean nothing.  upb_encode()
+ * doesn't write fields in the same order, so its output is parsed back with
+ * proto2 to compare. */
+static bool check_same(benchmark_input *in) {
+  upb_env env;
+  size_t size;
+  char *upb_out;
+  gpb::Message *reparsed = in->prototype->New();
+  bool ok;
+
+  upb_env_init(&env);
+  upb_out = upb_encode(in->msg, in->init, &env, &size);
+  ok = upb_out && reparsed->ParseFromArray(upb_out, size) &&
+       reparsed->SerializeAsString() == in->proto2_msg->SerializeAsString();
+  upb_env_uninit(&env);
+  delete reparsed;
+  return ok;
+}
+
+static bool setup_input(benchmark_input *in, const std::string &name,
+                        const char *msgname, const char *filename,
+                        benchmark_types *types, upb_pbcodecache *vm_cache,
+                        upb_pbcodecache *jit_cache) {
+  const gpb::Descriptor *d;
+
+  /* Initialized first so that free_input() is always safe to call. */
+  upb_env_init(&in->msg_env);
+  in->null_handlers = NULL;
+  in->transcoder = NULL;
+  in->proto2_msg = NULL;
+
+  in->name = name;
+  if (!read_file(filename, &in->pb)) {
+    return false;
+  }
+
+  in->md = upb_symtab_lookupmsg(types->symtab, msgname);
+  if (!in->md) {
+    fprintf(stderr, "No message %s in descriptor\n", msgname);
+    return false;
+  }
+
+  in->layout = upb_msgfactory_getlayout(types->factory, in->md);
+  /* A upb_msglayout begins with the msginit it was built from. */
+  in->init = (const upb_msglayout_msginit_v1*)in->layout;
+  in->null_handlers =
+      upb_handlers_newfrozen(in->md, in, &register_nothing, NULL);
+  in->transcoder = upb_json_transcoder_new(in->md, false);
+
+  {
+    upb::pb::DecoderMethodOptions opts(in->null_handlers);
+    in->vm_method = upb_pbcodecache_getdecodermethod(vm_cache, &opts);
+    in->jit_method = upb_pbcodecache_getdecodermethod(jit_cache, &opts);
+  }
+
+  in->msg = upb_msg_new(in->layout, upb_arena_alloc(upb_env_arena(
+                                        &in->msg_env)));
+  if (!upb_decode(upb_stringview_make(in->pb.data(), in->pb.size()), in->msg,
+                  in->init, &in->msg_env)) {
+    fprintf(stderr, "upb couldn't parse %s\n", filename);
+    return false;
+  }
+
+  d = gpb::DescriptorPool::generated_pool()->FindMessageTypeByName(msgname);
+  in->dynamic = d == NULL;
+  if (d) {
+    in->prototype = gpb::MessageFactory::generated_factory()->GetPrototype(d);
+  } else {
+    d = types->pool->FindMessageTypeByName(msgname);
+    in->prototype = types->dynamic_factory->GetPrototype(d);
+  }
+
+  in->proto2_msg = in->prototype->New();
+  if (!in->proto2_msg->ParseFromString(in->pb)) {
+    fprintf(stderr, "proto2 couldn't parse %s\n", filename);
+    return false;
+  }
+  in->serialized.resize(UPB_MAX(in->proto2_msg->ByteSizeLong(), 1));
+
+  if (!check_same(in)) {
+    fprintf(stderr, "upb and proto2 disagree about %s\n", filename);
+    return false;
+  }
+
+  return true;
+}
+
+static void free_input(benchmark_input *in) {
+  delete in->proto2_msg;
+  upb_env_uninit(&in->msg_env);
+  if (in->transcoder) upb_json_transcoder_free(in->transcoder);
+  if (in->null_handlers) upb_handlers_unref(in->null_handlers, in);
+}
+
+static bool run_benchmarks(benchmark_input *in) {
+  const char *proto2 = in->dynamic ? "proto2_dynamic" : "proto2";
+  bool ok = true;
+
+  ok &= run_benchmark("upb_table", "parse", &bench_upb_table_parse, in);
+  ok &= run_benchmark("upb_vm", "parse", &bench_upb_vm_parse, in);
+  if (upb_pbdecodermethod_isnative(in->jit_method)) {
+    ok &= run_benchmark("upb_jit", "parse", &bench_upb_jit_parse, in);
+  } else {
+    fprintf(stderr, "upb_jit: skipped, build with WITH_JIT=yes\n");
+  }
+  ok &= run_benchmark(proto2, "parse", &bench_proto2_parse, in);
+
+  ok &= run_benchmark("upb_table", "serialize", &bench_upb_serialize, in);
+  ok &= run_benchmark(proto2, "serialize", &bench_proto2_serialize, in);
+
+  ok &= run_benchmark("upb", "json_roundtrip", &bench_upb_json_roundtrip, in);
+  ok &= run_benchmark(proto2, "json_roundtrip", &bench_proto2_json_roundtrip,
+                      in);
+  return ok;
+}
+
+static bool run_corpus(const char *descriptor_file, const char *msgname,
+                       const char *filename, const std::string &name) {
+  benchmark_types types;
+  benchmark_input in;
+  upb::pb::CodeCache vm_cache, jit_cache;
+  bool ok;
+
+  upb_pbcodecache_setallowjit(&vm_cache, false);
+  ok = load_types(&types, descriptor_file) &&
+       setup_input(&in, name, msgname, filename, &types, &vm_cache,
+                   &jit_cache) &&
+       run_benchmarks(&in);
+  free_input(&in);
+  free_types(&types);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  static const struct {
+    const char *name;
+    const char *msgname;
+    const char *filename;
+  } inputs[] = {
+    {"google_message1", "benchmarks.SpeedMessage1", "google_message1.dat"},
+    {"google_message2", "benchmarks.SpeedMessage2", "google_message2.dat"},
+  };
+  const char *datadir = argc > 2 ? argv[2] : "tests";
+  bool ok = true;
+  size_t i;
+  int j;
+
+  if (argc < 2 || (argc > 3 && (argc - 3) % 3 != 0)) {
+    fprintf(stderr,
+            "Usage: %s <google_messages.proto.pb> [<data dir> "
+            "[<descriptor set> <message type> <file>]...]\n",
+            argv[0]);
+    return 1;
+  }
+
+  counting_alloc.func = &counting_allocfunc;
+
+  printf("library\tbenchmark\tmessage\titerations\tbytes\tmb_per_s\t"
+         "ns_per_msg\tallocs_per_msg\talloc_bytes_per_msg\tpeak_rss_kb\t"
+         "rss_growth_kb\n");
+
+  for (i = 0; ok && i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    std::string filename = std::string(datadir) + "/" + inputs[i].filename;
+    ok = run_corpus(argv[1], inputs[i].msgname, filename.c_str(),
+                    inputs[i].name);
+  }
+
+  for (j = 3; ok && j + 2 < argc; j += 3) {
+    ok = run_corpus(argv[j], argv[j + 1], argv[j + 2], argv[j + 2]);
+  }
+
+  gpb::ShutdownProtobufLibrary();
+  return ok ? 0 : 1;
+}
@@ -696,6 +696,32 @@ function test_msg_submsg()
   assert_error_match("msg expected", function() msg.submsg = print end)
 end
 
+function test_map_msgclass()
+  local map
+  do
+    local symtab = upb.SymbolTable{
+      upb.MessageDef{full_name = "SubMessage"}
+    }
+    local factory = upb.MessageFactory(symtab)
+    local SubMessage = factory:get_message_class("SubMessage")
+    map = upb.Map(upb.TYPE_INT32, SubMessage)
+
+    -- Key 0 must not clobber the map's reference to its value class.
+    map[0] = SubMessage()
+    map[0] = nil
+  end
+  collectgarbage()
+
+  local symtab = upb.SymbolTable{
+    upb.MessageDef{full_name = "OtherMessage"}
+  }
+  local factory = upb.MessageFactory(symtab)
+  local OtherMessage = factory:get_message_class("OtherMessage")
+  assert_error_match("expected 'SubMessage'", function()
+    map[1] = OtherMessage()
+  end)
+end
+
 -- Lua 5.1 and 5.2 have slightly different semantics for how a finalizer
 -- can be defined in Lua.
 if _VERSION >= 'Lua 5.2' then
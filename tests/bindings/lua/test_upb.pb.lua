@@ -82,6 +82,55 @@ function test_parse_string()
   assert_equal("Hello", msg.str)
 end
 
+function test_parse_lazy()
+  local symtab = upb.SymbolTable{
+    upb.MessageDef{full_name = "TestMessage", fields = {
+      upb.FieldDef{name = "i32_array", number = 1, type = upb.TYPE_INT32,
+                   label = upb.LABEL_REPEATED},
+      upb.FieldDef{name = "str_array", number = 2, type = upb.TYPE_STRING,
+                   label = upb.LABEL_REPEATED},
+      upb.FieldDef{name = "submsg", number = 3, type = upb.TYPE_MESSAGE,
+                   subdef_name = ".SubMessage"},
+      upb.FieldDef{name = "submsg_array", number = 4, type = upb.TYPE_MESSAGE,
+                   subdef_name = ".SubMessage", label = upb.LABEL_REPEATED},
+      }
+    },
+    upb.MessageDef{full_name = "SubMessage", fields = {
+      upb.FieldDef{name = "i32", number = 1, type = upb.TYPE_INT32},
+      }
+    }
+  }
+
+  local factory = upb.MessageFactory(symtab);
+  local TestMessage = factory:get_message_class("TestMessage")
+
+  local binary_pb = "\008\001\008\002\018\001a\018\002bc\026\002\008\007"
+      .. "\034\002\008\008\034\002\008\009"
+  local decoder = pb.MakeStringToMessageDecoder(TestMessage)
+  local msg = decoder(binary_pb)
+  collectgarbage()  -- wrappers must keep the parsed data alive.
+
+  -- Wrappers are created on first access, then the same object is returned.
+  local submsg_array = msg.submsg_array
+  assert_equal(submsg_array, msg.submsg_array)
+  assert_equal(msg.submsg, msg.submsg)
+  assert_equal(submsg_array[1], submsg_array[1])
+
+  msg = nil
+  collectgarbage()
+  assert_equal(2, #submsg_array)
+  assert_equal(8, submsg_array[1].i32)
+  assert_equal(9, submsg_array[2].i32)
+
+  msg = decoder(binary_pb)
+  assert_equal(2, #msg.i32_array)
+  assert_equal(1, msg.i32_array[1])
+  assert_equal(2, msg.i32_array[2])
+  assert_equal("a", msg.str_array[1])
+  assert_equal("bc", msg.str_array[2])
+  assert_equal(7, msg.submsg.i32)
+end
+
 
 local stats = lunit.main()
 
@@ -0,0 +1,248 @@
+/*
+** Tests of upb_filesrc and upb_filesink: every method must deliver exactly
+** the file's bytes.
+*/
+
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include "tests/test_util.h"
+#include "upb/bindings/posix/io.h"
+#include "tests/upb_test.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *filename = "upb/descriptor/descriptor.pb";
+static char *expected;
+static size_t expected_len;
+
+/* Reads through |fd| into a fresh bufsink and checks the data from |ofs|. */
+static void check_fd(int fd, size_t ofs, const upb_filesrc_opts *opts) {
+  upb_env env;
+  upb_bufsink *sink;
+  upb_status status = UPB_STATUS_INIT;
+  const char *data;
+  size_t len;
+
+  upb_env_init(&env);
+  sink = upb_bufsink_new(&env);
+  ASSERT_STATUS(upb_filesrc_putfd(fd, upb_bufsink_sink(sink), opts, &status),
+                &status);
+  data = upb_bufsink_getdata(sink, &len);
+  ASSERT(len == expected_len - ofs);
+  ASSERT(memcmp(data, expected + ofs, len) == 0);
+
+  /* Everything was read. */
+  ASSERT(read(fd, &len, 1) == 0);
+  upb_bufsink_free(sink);
+  upb_env_uninit(&env);
+}
+
+static void check_method(upb_filesrc_method method, size_t block_size,
+                         unsigned int queue_depth) {
+  upb_filesrc_opts opts = UPB_FILESRC_OPTS_INITIALIZER;
+  int fd;
+  int pipefd[2];
+
+  opts.method = method;
+  opts.block_size = block_size;
+  opts.queue_depth = queue_depth;
+
+  fd = open(filename, O_RDONLY);
+  ASSERT(fd >= 0);
+  check_fd(fd, 0, &opts);
+
+  /* From the middle of the file, which isn't on a page boundary. */
+  ASSERT(lseek(fd, 10, SEEK_SET) == 10);
+  check_fd(fd, 10, &opts);
+
+  /* At EOF there is nothing left. */
+  check_fd(fd, expected_len, &opts);
+  close(fd);
+
+  /* A pipe can't be mapped or read at offsets, so this falls back to read().
+   * The file is small enough to fit in the pipe's buffer. */
+  ASSERT(pipe(pipefd) == 0);
+  ASSERT(write(pipefd[1], expected, expected_len) == (ssize_t)expected_len);
+  close(pipefd[1]);
+  check_fd(pipefd[0], 0, &opts);
+  close(pipefd[0]);
+}
+
+static size_t reject(void *c, const void *hd, const char *buf, size_t n,
+                     const upb_bufhandle *handle) {
+  UPB_UNUSED(c);
+  UPB_UNUSED(hd);
+  UPB_UNUSED(buf);
+  UPB_UNUSED(handle);
+  return n / 2;
+}
+
+static void test_errors() {
+  upb_byteshandler handler;
+  upb_bytessink sink;
+  upb_filesrc_opts opts = UPB_FILESRC_OPTS_INITIALIZER;
+  upb_status status = UPB_STATUS_INIT;
+
+  upb_byteshandler_init(&handler);
+  upb_byteshandler_setstring(&handler, reject, NULL);
+  upb_bytessink_reset(&sink, &handler, NULL);
+
+  ASSERT(!upb_filesrc_putfile("does/not/exist", &sink, NULL, &status));
+  ASSERT(!upb_ok(&status));
+
+  for (opts.method = UPB_FILESRC_READ; opts.method <= UPB_FILESRC_URING;
+       opts.method++) {
+    upb_status_clear(&status);
+    ASSERT(!upb_filesrc_putfile(filename, &sink, &opts, &status));
+    ASSERT(!upb_ok(&status));
+  }
+}
+
+/* upb_filesink *************************************************************/
+
+typedef struct {
+  char *buf;
+  size_t len;
+  int writes;
+  int iovs;
+  bool fail;
+} writer;
+
+static bool write_iov(void *closure, const struct iovec *iov, int iovcnt,
+                      upb_status *status) {
+  writer *w = closure;
+  int i;
+
+  if (w->fail) {
+    upb_status_seterrmsg(status, "injected failure");
+    return false;
+  }
+
+  w->writes++;
+  w->iovs += iovcnt;
+  for (i = 0; i < iovcnt; i++) {
+    ASSERT(w->len + iov[i].iov_len <= expected_len);
+    memcpy(w->buf + w->len, iov[i].iov_base, iov[i].iov_len);
+    w->len += iov[i].iov_len;
+  }
+  return true;
+}
+
+static void put(upb_bytessink *sink, void *subc, const char *buf, size_t len) {
+  upb_bufhandle handle;
+  upb_bufhandle_init(&handle);
+  ASSERT(upb_bytessink_putbuf(sink, subc, buf, len, &handle) == len);
+  upb_bufhandle_uninit(&handle);
+}
+
+/* Writes the expected data into |sink| as a mix of tiny buffers, a buffer lent
+ * by getbuf, and one big buffer. */
+static void put_expected(upb_bytessink *sink) {
+  void *subc;
+  size_t ofs = 0;
+  size_t n = 1;
+  size_t size;
+  char *buf;
+
+  ASSERT(upb_bytessink_start(sink, 0, &subc));
+
+  while (ofs < 1000) {
+    put(sink, subc, expected + ofs, n);
+    ofs += n;
+    n = n % 7 + 1;
+  }
+
+  buf = upb_bytessink_getbuf(sink, subc, 100, &size);
+  ASSERT(buf && size >= 100);
+  memcpy(buf, expected + ofs, 100);
+  put(sink, subc, buf, 100);
+  ofs += 100;
+
+  put(sink, subc, expected + ofs, expected_len - ofs);
+  ASSERT(upb_bytessink_end(sink));
+}
+
+static void test_filesink_writer() {
+  upb_env env;
+  upb_filesink *sink;
+  writer w;
+
+  w.buf = malloc(expected_len);
+  w.len = 0;
+  w.writes = 0;
+  w.iovs = 0;
+  w.fail = false;
+
+  upb_env_init(&env);
+  sink = upb_filesink_newwriter(&env, write_iov, &w);
+  put_expected(upb_filesink_sink(sink));
+
+  /* The small buffers were gathered up and written along with the big one. */
+  ASSERT(w.writes == 1);
+  ASSERT(w.iovs == 2);
+  ASSERT(w.len == expected_len);
+  ASSERT(memcmp(w.buf, expected, expected_len) == 0);
+  ASSERT(upb_ok(upb_filesink_status(sink)));
+
+  /* A failed write is sticky. */
+  w.fail = true;
+  ASSERT(upb_filesink_flush(sink));  /* Nothing to write. */
+  put(upb_filesink_sink(sink), sink, expected, 10);
+  ASSERT(!upb_filesink_flush(sink));
+  ASSERT(!upb_ok(upb_filesink_status(sink)));
+  w.fail = false;
+  ASSERT(!upb_filesink_flush(sink));
+
+  upb_filesink_free(sink);
+  upb_env_uninit(&env);
+  free(w.buf);
+}
+
+static void test_filesink_fd() {
+  upb_env env;
+  upb_filesink *sink;
+  int pipefd[2];
+  char *buf = malloc(expected_len + 1);
+  size_t len = 0;
+  ssize_t n;
+
+  /* The file is small enough to fit in the pipe's buffer. */
+  ASSERT(pipe(pipefd) == 0);
+  upb_env_init(&env);
+  sink = upb_filesink_new(&env, pipefd[1]);
+  put_expected(upb_filesink_sink(sink));
+  upb_filesink_free(sink);
+  upb_env_uninit(&env);
+  close(pipefd[1]);
+
+  while ((n = read(pipefd[0], buf + len, expected_len + 1 - len)) > 0) {
+    len += n;
+  }
+  close(pipefd[0]);
+
+  ASSERT(len == expected_len);
+  ASSERT(memcmp(buf, expected, expected_len) == 0);
+  free(buf);
+}
+
+int run_tests(int argc, char *argv[]) {
+  UPB_UNUSED(argc);
+  UPB_UNUSED(argv);
+  expected = upb_readfile(filename, &expected_len);
+  ASSERT(expected && expected_len > 4096);
+
+  check_method(UPB_FILESRC_READ, 0, 0);
+  check_method(UPB_FILESRC_READ, 7, 0);
+  check_method(UPB_FILESRC_MMAP, 0, 0);
+  check_method(UPB_FILESRC_URING, 0, 0);
+  check_method(UPB_FILESRC_URING, 1000, 3);
+  check_method(UPB_FILESRC_URING, 4096, 1);
+  test_errors();
+  test_filesink_writer();
+  test_filesink_fd();
+
+  free(expected);
+  return 0;
+}
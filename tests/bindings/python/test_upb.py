@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+#
+# Tests for the Python upb extension.
+
+import unittest
+import upb
+
+def get_descriptor():
+  with open("upb/descriptor/descriptor.pb", "rb") as f:
+    return f.read()
+
+def load_pool():
+  return upb.DescriptorPool(get_descriptor())
+
+class TestPythonExtension(unittest.TestCase):
+  def test_parsedescriptor(self):
+    pool = load_pool()
+    cls = pool.message_class("google.protobuf.FileDescriptorSet")
+    self.assertEqual(cls.full_name, "google.protobuf.FileDescriptorSet")
+    self.assertIs(cls, pool.message_class("google.protobuf.FileDescriptorSet"))
+
+    msg = cls.FromString(get_descriptor())
+    self.assertEqual(len(msg.file), 1)
+    f = msg.file[0]
+    self.assertIs(f, msg.file[0])
+    self.assertEqual(f.package, "google.protobuf")
+    self.assertTrue(f.name.endswith("descriptor.proto"))
+    self.assertIsNone(f.source_code_info)
+    self.assertEqual(len(f.service), 0)
+
+    names = [f.message_type[i].name for i in range(len(f.message_type))]
+    self.assertIn("FileDescriptorSet", names)
+    self.assertIn("FieldDescriptorProto", names)
+    self.assertIsInstance(f.message_type[0].name, str)
+
+    # The message and its wrappers stay valid without the input or the class.
+    del msg, cls, pool
+    self.assertEqual(f.package, "google.protobuf")
+
+  def test_roundtrip(self):
+    data = get_descriptor()
+    cls = load_pool().message_class("google.protobuf.FileDescriptorSet")
+
+    # upb may order fields differently from protoc, so compare what the
+    # output parses to, and check that upb's own output round-trips exactly.
+    serialized = cls.FromString(data).SerializeToString()
+    self.assertEqual(len(serialized), len(data))
+    msg = cls.FromString(serialized)
+    self.assertEqual(msg.file[0].package, "google.protobuf")
+    self.assertEqual(len(msg.file[0].message_type),
+                     len(cls.FromString(data).file[0].message_type))
+    self.assertEqual(msg.SerializeToString(), serialized)
+
+    # Any buffer works.
+    msg = cls.FromString(memoryview(bytearray(serialized)))
+    self.assertEqual(msg.SerializeToString(), serialized)
+    self.assertEqual(cls.FromString(b"").SerializeToString(), b"")
+
+  def test_setfields(self):
+    pool = load_pool()
+    cls = pool.message_class("google.protobuf.FieldDescriptorProto")
+    msg = cls()
+    self.assertEqual(msg.number, 0)
+    msg.name = "foo"
+    msg.number = 5
+    msg.oneof_index = -1
+    self.assertEqual(msg.name, "foo")
+    self.assertEqual(msg.number, 5)
+
+    msg2 = cls.FromString(msg.SerializeToString())
+    self.assertEqual(msg2.name, "foo")
+    self.assertEqual(msg2.number, 5)
+    self.assertEqual(msg2.oneof_index, -1)
+
+    del msg.name
+    self.assertEqual(cls.FromString(msg.SerializeToString()).name, "")
+
+    self.assertRaises(TypeError, setattr, msg, "number", "five")
+    self.assertRaises(ValueError, setattr, msg, "number", 1 << 40)
+    self.assertRaises(AttributeError, setattr, msg, "options", None)
+    self.assertRaises(AttributeError, getattr, msg, "no_such_field")
+
+  def test_errors(self):
+    pool = load_pool()
+    self.assertRaises(KeyError, pool.message_class, "google.protobuf.Nope")
+    self.assertRaises(ValueError, upb.DescriptorPool, b"\x0a\x05junk!")
+
+    cls = pool.message_class("google.protobuf.FileDescriptorSet")
+    self.assertRaises(upb.DecodeError, cls.FromString, b"\x0a\x05ab")
+    self.assertRaises(TypeError, cls.FromString, "not a buffer")
+
+if __name__ == '__main__':
+  unittest.main()
@@ -59,4 +59,65 @@ class TestRubyExtension < Test::Unit::TestCase
     assert_equal(5, field2.number)
     assert_equal(true, field2.options.packed)
   end
+
+  def test_lazyaccess
+    symtab = load_descriptor
+    file_descriptor_set =
+        Upb.get_message_class(symtab.lookup("google.protobuf.FileDescriptorSet"))
+    msg = file_descriptor_set.parse(get_descriptor())
+
+    # Wrappers are created on first access, then cached.
+    assert_same(msg.file, msg.file)
+    file = msg.file[0]
+    assert_same(file, msg.file[0])
+    assert_same(file, msg.file[-1])
+    assert_nil(msg.file[1])
+    assert_equal(1, msg.file.size)
+    assert_equal("google.protobuf", file.package)
+    assert_equal(Encoding::UTF_8, file.package.encoding)
+    assert_nil(file.source_code_info)
+    assert_equal(0, file.service.size)
+    assert(file.message_type.map { |m| m.name }.include?("DescriptorProto"))
+
+    # Parsing aliases a frozen copy, so changing the input changes nothing.
+    data = get_descriptor()
+    msg2 = file_descriptor_set.parse(data)
+    data.replace("x" * data.size)
+    assert_equal("google.protobuf", msg2.file[0].package)
+
+    # upb's own output round-trips exactly.
+    serialized = Upb::Message.serialize(msg)
+    assert_equal(get_descriptor().size, serialized.size)
+    assert_equal(serialized,
+                 Upb::Message.serialize(file_descriptor_set.parse(serialized)))
+  end
+
+  def test_setfields
+    symtab = load_descriptor
+    field_descriptor_proto =
+        Upb.get_message_class(symtab.lookup("google.protobuf.FieldDescriptorProto"))
+    field_options =
+        Upb.get_message_class(symtab.lookup("google.protobuf.FieldOptions"))
+
+    # Within one SymbolTable a submessage is shared, not copied.
+    field = field_descriptor_proto.new
+    options = field_options.new
+    field.options = options
+    assert_same(options, field.options)
+    options.packed = true
+    assert_equal(true, field_descriptor_proto.parse(
+        Upb::Message.serialize(field)).options.packed)
+
+    field.name = "foo"
+    field.name = nil
+    assert_equal("",
+        field_descriptor_proto.parse(Upb::Message.serialize(field)).name)
+
+    assert_raise(RangeError) { field.number = 1 << 40 }
+    assert_raise(TypeError) { field.options = field }
+    assert_raise(ArgumentError) { field.no_such_field }
+    assert_raise(RuntimeError) {
+      field_descriptor_proto.parse("\x0a\x05ab")
+    }
+  end
 end
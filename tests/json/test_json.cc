@@ -7,11 +7,15 @@
 #include "tests/test_util.h"
 #include "tests/upb_test.h"
 #include "upb/handlers.h"
+#include "upb/json/base64.int.h"
 #include "upb/json/parser.h"
 #include "upb/json/printer.h"
+#include "upb/json/transcode.h"
+#include "upb/trace.h"
 #include "upb/upb.h"
 
 #include <string>
+#include <vector>
 
 // Macros for readability in test case list: allows us to give TEST("...") /
 // EXPECT("...") pairs.
@@ -53,6 +57,36 @@ static TestCase kTestRoundtripMessages[] = {
          "\"\uFFFF\"]}"),
     EXPECT_SAME
   },
+  // Test escapes inside and across long runs of plain characters.
+  {
+    TEST("{\"optionalString\":\"0123456789abcde\\\"0123456789abcdef\\\\"
+         "0123456789\uFFFF0123456789abcdef\\u001f\\n\\u0001x"
+         "0123456789abcdefghijklmnopqrstuvwxyz\\t\"}"),
+    EXPECT_SAME
+  },
+  // Test long runs of string content, which the parser skips in bulk.
+  {
+    TEST("{\n  \"optionalString\": \"The quick brown fox jumps over the lazy"
+         " dog, again and again and again.\",\n  \"repeatedString\": ["
+         "\"0123456789abcdef0123456789abcdef\\\\0123456789abcdef\"]\n}"),
+    EXPECT("{\"optionalString\":\"The quick brown fox jumps over the lazy dog,"
+           " again and again and again.\",\"repeatedString\":["
+           "\"0123456789abcdef0123456789abcdef\\\\0123456789abcdef\"]}")
+  },
+  // Test integer limits, and numbers that need more than the fast path.
+  {
+    TEST("{\"repeatedInt64\":[0,-1,9223372036854775807,"
+         "-9223372036854775808],"
+         "\"repeatedUint32\":[4294967295],"
+         "\"repeatedUint64\":[18446744073709551615]}"),
+    EXPECT_SAME
+  },
+  {
+    TEST("{\"optionalInt32\":-2147483648,\"repeatedInt64\":[\"-5\",1e3,2.0],"
+         "\"repeatedUint32\":[\"7\",1E1]}"),
+    EXPECT("{\"optionalInt32\":-2147483648,\"repeatedInt64\":[-5,1000,2],"
+           "\"repeatedUint32\":[7,10]}")
+  },
   // Test enum symbolic names.
   {
     // The common case: parse and print the symbolic name.
@@ -70,6 +104,11 @@ static TestCase kTestRoundtripMessages[] = {
     TEST("{\"optionalEnum\":1}"),
     EXPECT("{\"optionalEnum\":\"B\"}")
   },
+  {
+    // Just either side of the enum's values, and each of them.
+    TEST("{\"repeatedEnum\":[-1,\"A\",\"B\",\"C\",3,-2147483648]}"),
+    EXPECT_SAME
+  },
   // UTF-8 tests: escapes -> literal UTF8 in output.
   {
     // Note double escape on \uXXXX: we want the escape to be processed by the
@@ -240,11 +279,514 @@ void test_json_roundtrip() {
   }
 }
 
+int array_calls;
+
+bool append_int32(std::vector<int32_t>* vec, int32_t val) {
+  vec->push_back(val);
+  return true;
+}
+
+bool append_int32_array(std::vector<int32_t>* vec, const void* vals,
+                        size_t n) {
+  const int32_t* v = static_cast<const int32_t*>(vals);
+  vec->insert(vec->end(), v, v + n);
+  array_calls++;
+  return true;
+}
+
+// Checks that a long array of ints is delivered to an array handler, in
+// order, however the input is split.
+void test_json_array() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::upb::test::json::TestMessage::get());
+  const upb::FieldDef* f = md->FindFieldByName("repeated_int32");
+  upb::reffed_ptr<upb::Handlers> h(upb::Handlers::New(md.get()));
+  ASSERT(h->SetInt32Handler(f, UpbMakeHandler(append_int32)));
+  ASSERT(h->SetArrayHandler(f, UpbMakeHandler(append_int32_array)));
+  ASSERT(h->Freeze(NULL));
+  const upb::Handlers* handlers = h.get();
+  upb::reffed_ptr<const upb::json::ParserMethod> parser_method(
+      upb::json::ParserMethod::New(md.get()));
+
+  std::string json = "{\"repeatedInt32\":[";
+  for (int i = 0; i < 100; i++) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%s%d", i ? "," : "", i - 50);
+    json += buf;
+  }
+  json += "]}";
+
+  for (size_t seam = 0; seam < json.size(); seam++) {
+    VerboseParserEnvironment env(verbose);
+    std::vector<int32_t> values;
+    upb::Sink sink(handlers, &values);
+    upb::json::Parser* parser =
+        upb::json::Parser::Create(env.env(), parser_method.get(), &sink);
+    env.ResetBytesSink(parser->input());
+    env.Reset(json.c_str(), json.size(), false, false);
+    array_calls = 0;
+
+    bool ok = env.Start() &&
+              env.ParseBuffer(seam) &&
+              env.ParseBuffer(-1) &&
+              env.End();
+
+    ASSERT(ok);
+    ASSERT(array_calls > 1);
+    ASSERT(values.size() == 100);
+    for (int i = 0; i < 100; i++) {
+      ASSERT(values[i] == i - 50);
+    }
+  }
+}
+
+bool record_int32(std::string* out, const uint32_t* num, int32_t val) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%u:%d,", (unsigned)*num, (int)val);
+  out->append(buf);
+  return true;
+}
+
+static void add_int32_field(upb::MessageDef* md, const char* name,
+                            uint32_t num) {
+  upb::reffed_ptr<upb::FieldDef> f = upb::FieldDef::New();
+  ASSERT(f->set_name(name, NULL));
+  ASSERT(f->set_number(num, NULL));
+  f->set_descriptor_type(UPB_DESCRIPTOR_TYPE_INT32);
+  ASSERT(md->AddField(f.get(), NULL));
+}
+
+// Parses |json| into a "number:value," list of the fields it set, or returns
+// false if the parse failed as |expect_error|.
+static bool parse_names(const upb::json::ParserMethod* method,
+                        const upb::Handlers* h, const std::string& json,
+                        size_t seam, bool expect_error, std::string* out) {
+  VerboseParserEnvironment env(verbose);
+  upb::Sink sink(h, out);
+  upb::json::Parser* parser =
+      upb::json::Parser::Create(env.env(), method, &sink);
+  out->clear();
+  env.ResetBytesSink(parser->input());
+  env.Reset(json.c_str(), json.size(), false, expect_error);
+  bool ok = env.Start() &&
+            env.ParseBuffer(seam) &&
+            env.ParseBuffer(-1) &&
+            env.End();
+  ASSERT(env.CheckConsistency());
+  return ok;
+}
+
+// Member names are looked up in the frozen name table, under both the JSON
+// and the proto name, however the name is split across buffers.
+void test_json_names() {
+  upb::reffed_ptr<upb::MessageDef> md(upb::MessageDef::New());
+  ASSERT(md->set_full_name("NameTest", NULL));
+  for (uint32_t i = 1; i <= 40; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "f_%u", (unsigned)i);
+    add_int32_field(md.get(), name, i);
+  }
+  // Both get the JSON name "fooBar", which goes to the lower-numbered field;
+  // the other is only reachable by its proto name, and that is taken too.
+  add_int32_field(md.get(), "foo_bar", 41);
+  add_int32_field(md.get(), "fooBar", 42);
+  ASSERT(md->Freeze(NULL));
+
+  upb::reffed_ptr<upb::Handlers> h(upb::Handlers::New(md.get()));
+  for (uint32_t i = 1; i <= 42; i++) {
+    ASSERT(h->SetInt32Handler(md->FindFieldByNumber(i),
+                              UpbBind(record_int32, new uint32_t(i))));
+  }
+  ASSERT(h->Freeze(NULL));
+  upb::reffed_ptr<const upb::json::ParserMethod> method(
+      upb::json::ParserMethod::New(md.get()));
+  ASSERT(method.get());
+
+  const std::string json =
+      "{\"f1\":1,\"f_40\":2,\"f17\":3,\"f_1\":4,\"fooBar\":5,"
+      "\"foo_bar\":6}";
+  const char* bad[] = {"{\"f\":1}", "{\"f0\":1}", "{\"f400\":1}",
+                       "{\"f_1_\":1}", "{\"fooba\":1}"};
+  std::string out;
+
+  for (size_t seam = 0; seam < json.size(); seam++) {
+    ASSERT(parse_names(method.get(), h.get(), json, seam, false, &out));
+    ASSERT(out == "1:1,40:2,17:3,1:4,41:5,41:6,");
+  }
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    ASSERT(!parse_names(method.get(), h.get(), bad[i], 0, true, &out));
+    ASSERT(out.empty());
+  }
+}
+
+static void no_handlers(const void* closure, upb_handlers* h) {
+  UPB_UNUSED(closure);
+  UPB_UNUSED(h);
+}
+
+// Parses in two buffers with counters attached.
+void test_json_stats() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::upb::test::json::TestMessage::get());
+  upb::reffed_ptr<const upb::json::ParserMethod> parser_method(
+      upb::json::ParserMethod::New(md.get()));
+  upb::reffed_ptr<const upb::Handlers> handlers(upb::Handlers::NewFrozen(
+      md.get(), no_handlers, NULL));
+  std::string json =
+      "{\"optionalInt32\":1,\"repeatedInt32\":[1,2],"
+      "\"optionalMsg\":{\"foo\":3}}";
+
+  VerboseParserEnvironment env(verbose);
+  int closure;
+  upb::Sink sink(handlers.get(), &closure);
+  upb::json::Parser* parser =
+      upb::json::Parser::Create(env.env(), parser_method.get(), &sink);
+  upb_decstats stats;
+  upb_decstats_clear(&stats);
+  parser->set_stats(&stats);
+  env.ResetBytesSink(parser->input());
+  env.Reset(json.c_str(), json.size(), false, false);
+
+  bool ok = env.Start() &&
+            env.ParseBuffer(json.size() / 2) &&
+            env.ParseBuffer(-1) &&
+            env.End();
+  ASSERT(ok);
+  ASSERT(stats.bytes == json.size());
+  ASSERT(stats.suspends == 2);
+  ASSERT(stats.resumes == 1);
+  ASSERT(stats.fields == 4);
+  ASSERT(stats.dispatch_lookups == 4);
+  ASSERT(stats.unknown_fields == 0);
+  ASSERT(stats.max_depth == 1);
+}
+
+// Parses once through a tee into two printers, which must each produce
+// exactly what they would have produced on their own.
+void test_json_tee() {
+  const char* input = kTestRoundtripMessagesPreserve[0].input;
+  const char* camelcase = kTestRoundtripMessages[1].expected;
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::upb::test::json::TestMessage::get());
+  upb::reffed_ptr<const upb::Handlers> camel_handlers(
+      upb::json::Printer::NewHandlers(md.get(), false));
+  upb::reffed_ptr<const upb::Handlers> preserve_handlers(
+      upb::json::Printer::NewHandlers(md.get(), true));
+  const upb::Handlers* tee_handlers = upb_tee_newhandlers(md.get(),
+                                                          &tee_handlers);
+  upb::reffed_ptr<const upb::json::ParserMethod> parser_method(
+      upb::json::ParserMethod::New(md.get()));
+
+  for (size_t seam = 0; seam < strlen(input); seam++) {
+    VerboseParserEnvironment env(verbose);
+    StringSink camel_sink;
+    StringSink preserve_sink;
+    upb::json::Printer* camel = upb::json::Printer::Create(
+        env.env(), camel_handlers.get(), camel_sink.Sink());
+    upb::json::Printer* preserve = upb::json::Printer::Create(
+        env.env(), preserve_handlers.get(), preserve_sink.Sink());
+    upb::Sink* outputs[] = {camel->input(), preserve->input()};
+    upb_tee* tee = upb_tee_create(env.env(), tee_handlers, outputs, 2);
+    upb::json::Parser* parser = upb::json::Parser::Create(
+        env.env(), parser_method.get(), upb_tee_input(tee));
+    env.ResetBytesSink(parser->input());
+    env.Reset(input, strlen(input), false, false);
+
+    bool ok = env.Start() &&
+              env.ParseBuffer(seam) &&
+              env.ParseBuffer(-1) &&
+              env.End();
+
+    ASSERT(ok);
+    ASSERT(camel_sink.Data() == camelcase);
+    ASSERT(preserve_sink.Data() == input);
+  }
+
+  upb_handlers_unref(tee_handlers, &tee_handlers);
+}
+
+// Transcodes every roundtrip case JSON -> binary -> JSON and checks that the
+// binary -> JSON leg produces the expected text however its input is split.
+void test_json_transcode() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::upb::test::json::TestMessage::get());
+  upb_json_transcoder* t = upb_json_transcoder_new(md.get(), false);
+  ASSERT(t);
+  ASSERT(upb_json_transcoder_msgdef(t) == md.get());
+
+  for (const TestCase* test_case = kTestRoundtripMessages;
+       test_case->input != NULL; test_case++) {
+    const char *expected =
+        (test_case->expected == EXPECT_SAME) ?
+        test_case->input :
+        test_case->expected;
+
+    VerboseParserEnvironment json_env(verbose);
+    StringSink pb_sink;
+    json_env.ResetBytesSink(
+        upb_json_transcoder_jsoninput(t, json_env.env(), pb_sink.Sink()));
+    json_env.Reset(test_case->input, strlen(test_case->input), false, false);
+    ASSERT(json_env.Start() && json_env.ParseBuffer(-1) && json_env.End());
+    const std::string& pb = pb_sink.Data();
+
+    for (size_t seam = 0; seam <= pb.size(); seam++) {
+      VerboseParserEnvironment pb_env(verbose);
+      StringSink json_sink;
+      pb_env.ResetBytesSink(
+          upb_json_transcoder_pbinput(t, pb_env.env(), json_sink.Sink()));
+      pb_env.Reset(pb.data(), pb.size(), false, false);
+
+      bool ok = pb_env.Start() &&
+                pb_env.ParseBuffer(seam) &&
+                pb_env.ParseBuffer(-1) &&
+                pb_env.End();
+
+      ASSERT(ok);
+      if (json_sink.Data() != expected) {
+        fprintf(stderr,
+                "JSON transcode roundtrip result differs:\n"
+                "Original:\n%s\nTranscoded:\n%s\n",
+                test_case->input, json_sink.Data().c_str());
+        abort();
+      }
+    }
+  }
+
+  upb_json_transcoder_free(t);
+}
+
 extern "C" {
+static std::string base64(const std::string& data, bool websafe = false) {
+  const char* kAlphabet =
+      websafe ?
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_" :
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string ret;
+  for (size_t i = 0; i < data.size(); i += 3) {
+    uint32_t val = (unsigned char)data[i] << 16;
+    if (i + 1 < data.size()) val |= (unsigned char)data[i + 1] << 8;
+    if (i + 2 < data.size()) val |= (unsigned char)data[i + 2];
+    ret += kAlphabet[val >> 18];
+    ret += kAlphabet[(val >> 12) & 63];
+    ret += i + 1 < data.size() ? kAlphabet[(val >> 6) & 63] : '=';
+    ret += i + 2 < data.size() ? kAlphabet[val & 63] : '=';
+  }
+  return ret;
+}
+
+// Parses {"optionalBytes": ...} to binary, with a seam at |seam|.
+static bool parse_json(const upb_json_transcoder* t, const std::string& json,
+                       size_t seam, bool expect_error, std::string* pb) {
+  VerboseParserEnvironment env(verbose);
+  StringSink pb_sink;
+  env.ResetBytesSink(
+      upb_json_transcoder_jsoninput(t, env.env(), pb_sink.Sink()));
+  env.Reset(json.c_str(), json.size(), false, expect_error);
+  bool ok = env.Start() &&
+            env.ParseBuffer(UPB_MIN(seam, json.size())) &&
+            env.ParseBuffer(-1) &&
+            env.End();
+  ASSERT(env.CheckConsistency());
+  *pb = pb_sink.Data();
+  return ok;
+}
+
+static bool parse_bytes(const upb_json_transcoder* t, const std::string& b64,
+                        size_t seam, bool expect_error, std::string* pb) {
+  return parse_json(t, "{\"optionalBytes\":\"" + b64 + "\"}", seam,
+                    expect_error, pb);
+}
+
+// Prints the binary |pb| as JSON.
+static std::string print_pb(const upb_json_transcoder* t,
+                            const std::string& pb) {
+  VerboseParserEnvironment env(verbose);
+  StringSink json_sink;
+  env.ResetBytesSink(
+      upb_json_transcoder_pbinput(t, env.env(), json_sink.Sink()));
+  env.Reset(pb.data(), pb.size(), false, false);
+  ASSERT(env.Start() && env.ParseBuffer(-1) && env.End());
+  return json_sink.Data();
+}
+
+// Bytes values are decoded as they stream in, whatever the seams.
+void test_json_bytes() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::upb::test::json::TestMessage::get());
+  upb_json_transcoder* t = upb_json_transcoder_new(md.get(), false);
+  ASSERT(t);
+
+  for (size_t len = 0; len < 4; len++) {
+    std::string data;
+    for (size_t i = 0; i < 1000 + len; i++) data += (char)(i * 7);
+    std::string b64 = base64(data);
+    std::string want = "\x32";
+    want += (char)((data.size() & 0x7f) | 0x80);
+    want += (char)(data.size() >> 7);
+    want += data;
+
+    for (size_t seam = 0; seam < b64.size() + 20; seam += 7) {
+      std::string pb;
+      ASSERT(parse_bytes(t, b64, seam, false, &pb));
+      ASSERT(pb == want);
+      ASSERT(parse_bytes(t, base64(data, true), seam, false, &pb));
+      ASSERT(pb == want);
+    }
+
+    ASSERT(print_pb(t, want) == "{\"optionalBytes\":\"" + b64 + "\"}");
+  }
+
+  // Larger than the printer's buffer.
+  std::string data(40000, 'x');
+  std::string pb;
+  ASSERT(parse_bytes(t, base64(data), 0, false, &pb));
+  ASSERT(print_pb(t, pb) == "{\"optionalBytes\":\"" + base64(data) + "\"}");
+
+  const char* bad[] = {"QUJD=", "QUI", "QQ==QUJD", "QQ=A", "QU!D", NULL};
+  for (const char** b64 = bad; *b64; b64++) {
+    for (size_t seam = 0; seam < strlen(*b64) + 20; seam++) {
+      std::string pb;
+      ASSERT(!parse_bytes(t, *b64, seam, true, &pb));
+    }
+  }
+
+  upb_json_transcoder_free(t);
+}
+
+// String values must be valid UTF-8, wherever the seams fall.
+void test_json_utf8() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::upb::test::json::TestMessage::get());
+  upb_json_transcoder* t = upb_json_transcoder_new(md.get(), false);
+  ASSERT(t);
+
+  const char* good[] = {"caf\xc3\xa9 \xe2\x82\xac\xf0\x9f\x98\x80",
+                        "\xe2\x82\xac\\n\xe2\x82\xac", "\\u00e9", NULL};
+  const char* bad[] = {"\xc0\x80", "\xed\xa0\x80", "a\xe2\x82",
+                       "\xe2\x82\\n", "\xe2\x82\\u0041", "\xff", NULL};
+
+  for (const char** str = good; *str; str++) {
+    std::string json = std::string("{\"optionalString\":\"") + *str + "\"}";
+    for (size_t seam = 0; seam <= json.size(); seam++) {
+      std::string pb;
+      ASSERT(parse_json(t, json, seam, false, &pb));
+    }
+  }
+
+  for (const char** str = bad; *str; str++) {
+    std::string json = std::string("{\"optionalString\":\"") + *str + "\"}";
+    for (size_t seam = 0; seam <= json.size(); seam++) {
+      std::string pb;
+      ASSERT(!parse_json(t, json, seam, true, &pb));
+      ASSERT(!parse_json(t, "{\"repeatedString\":[\"x\",\"" +
+                                std::string(*str) + "\"]}",
+                         seam, true, &pb));
+    }
+  }
+
+  upb_json_transcoder_free(t);
+}
+
+// The vector kernels agree with the reference encoding at every length and
+// alignment, and the decoder stops at the quartet of the first bad character.
+void test_json_base64() {
+  std::string data;
+  for (size_t i = 0; i < 300; i++) data += (char)(i * 131 + (i >> 3));
+
+  for (size_t off = 0; off < 4; off++) {
+    for (size_t len = 0; off + len <= data.size(); len++) {
+      std::string in = data.substr(off, len);
+      std::vector<char> out(UPB_BASE64_ENCLEN(len) + 1);
+      std::vector<char> dec(len + 3);
+      for (int websafe = 0; websafe < 2; websafe++) {
+        size_t n = upb_base64_encode(&out[0], in.data(), len, websafe);
+        std::string b64 = base64(in, websafe);
+        ASSERT(std::string(&out[0], n) == b64);
+
+        size_t whole = len / 3 * 4;
+        ASSERT(upb_base64_decode(&dec[0], b64.data(), whole) == whole);
+        ASSERT(std::string(&dec[0], len / 3 * 3) == in.substr(0, len / 3 * 3));
+        if (len % 3) {
+          ASSERT(upb_base64_decode(&dec[0], b64.data(), b64.size()) == whole);
+        }
+      }
+    }
+  }
+
+  std::string b64 = base64(data);
+  std::vector<char> dec(data.size());
+  for (int ch = 0; ch < 256; ch++) {
+    if (upb_base64_values[ch] >= 0) continue;
+    for (size_t pos = 0; pos < 100; pos++) {
+      std::string bad = b64.substr(0, 100);
+      bad[pos] = (char)ch;
+      ASSERT(upb_base64_decode(&dec[0], bad.data(), 100) == pos / 4 * 4);
+    }
+  }
+}
+
+static void record_trace(void* ud, const upb_traceevent* ev) {
+  static_cast<std::vector<upb_traceevent>*>(ud)->push_back(*ev);
+}
+
+// Binary -> JSON traces the decoder's message around the printer's.
+void test_json_trace() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::upb::test::json::TestMessage::get());
+  upb_json_transcoder* t = upb_json_transcoder_new(md.get(), false);
+  ASSERT(t);
+
+  VerboseParserEnvironment json_env(verbose);
+  StringSink pb_sink;
+  const char* input = kTestRoundtripMessages[0].input;
+  json_env.ResetBytesSink(
+      upb_json_transcoder_jsoninput(t, json_env.env(), pb_sink.Sink()));
+  json_env.Reset(input, strlen(input), false, false);
+  ASSERT(json_env.Start() && json_env.ParseBuffer(-1) && json_env.End());
+  const std::string& pb = pb_sink.Data();
+
+  std::vector<upb_traceevent> events;
+  bool tracing = upb_settrace(record_trace, &events);
+  VerboseParserEnvironment pb_env(verbose);
+  StringSink json_sink;
+  pb_env.ResetBytesSink(
+      upb_json_transcoder_pbinput(t, pb_env.env(), json_sink.Sink()));
+  pb_env.Reset(pb.data(), pb.size(), false, false);
+  ASSERT(pb_env.Start() && pb_env.ParseBuffer(-1) && pb_env.End());
+  upb_settrace(NULL, NULL);
+
+  if (tracing) {
+    ASSERT(events.size() == 4);
+    ASSERT(events[0].source == UPB_TRACE_PBDECODER && !events[0].end);
+    ASSERT(events[1].source == UPB_TRACE_JSONPRINTER && !events[1].end);
+    ASSERT(events[2].source == UPB_TRACE_JSONPRINTER && events[2].end);
+    ASSERT(events[2].ok && events[2].bytes == json_sink.Data().size());
+    ASSERT(events[3].source == UPB_TRACE_PBDECODER && events[3].end);
+    ASSERT(events[3].ok && events[3].bytes == pb.size());
+    for (size_t i = 0; i < events.size(); i++) {
+      ASSERT(events[i].md == md.get() && events[i].layout == NULL);
+      ASSERT(i == 0 || events[i].time_ns >= events[i - 1].time_ns);
+    }
+  } else {
+    ASSERT(events.empty());
+  }
+
+  upb_json_transcoder_free(t);
+}
+
 int run_tests(int argc, char *argv[]) {
   UPB_UNUSED(argc);
   UPB_UNUSED(argv);
   test_json_roundtrip();
+  test_json_array();
+  test_json_names();
+  test_json_stats();
+  test_json_tee();
+  test_json_transcode();
+  test_json_bytes();
+  test_json_base64();
+  test_json_utf8();
+  test_json_trace();
   return 0;
 }
 }
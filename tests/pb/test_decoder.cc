@@ -28,6 +28,7 @@
 #endif
 
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -236,6 +237,7 @@ string badlen_submsg(int err, uint32_t fn, const string& buf) {
 
 int closures[MAX_NESTING];
 string output;
+int array_calls;
 
 void indentbuf(string *buf, int depth) {
   buf->append(2 * depth, ' ');
@@ -341,6 +343,26 @@ bool endmsg(int* depth, upb_status* status) {
   return true;
 }
 
+// Array handlers print one line per value, just like the value handlers.
+#define ARRAY_HANDLER(member, ctype)                                    \
+  bool array_##member(int* depth, const uint32_t* num, const void* vals, \
+                      size_t n) {                                       \
+    const ctype* v = static_cast<const ctype*>(vals);                   \
+    array_calls++;                                                      \
+    for (size_t i = 0; i < n; i++) {                                    \
+      if (!value_##member(depth, num, v[i])) return false;              \
+    }                                                                   \
+    return true;                                                        \
+  }
+
+ARRAY_HANDLER(uint32, uint32_t)
+ARRAY_HANDLER(uint64, uint64_t)
+ARRAY_HANDLER(int32,  int32_t)
+ARRAY_HANDLER(int64,  int64_t)
+ARRAY_HANDLER(float,  float)
+ARRAY_HANDLER(double, double)
+ARRAY_HANDLER(bool,   bool)
+
 void free_uint32(void *val) {
   uint32_t *u32 = static_cast<uint32_t*>(val);
   delete u32;
@@ -1274,6 +1296,256 @@ upb::reffed_ptr<const upb::pb::DecoderMethod> method =
   }
 }
 
+void test_codecache() {
+  upb::reffed_ptr<const upb::Handlers> h = NewHandlers(test_mode);
+  upb::pb::DecoderMethodOptions opts(h.get());
+  upb::pb::CodeCache cache;
+  const upb::pb::DecoderMethod* m = cache.GetDecoderMethod(opts);
+
+  // Methods are reused, and the options can't change after the first one.
+  ASSERT(cache.GetDecoderMethod(opts) == m);
+  ASSERT(!cache.set_defer_jit(true));
+  ASSERT(cache.CompilePending() == 0);
+
+#ifdef UPB_USE_JIT_X64
+  {
+    upb::pb::CodeCache deferred;
+    ASSERT(deferred.set_defer_jit(true));
+    const upb::pb::DecoderMethod* interpreted = deferred.GetDecoderMethod(opts);
+    ASSERT(!interpreted->is_native());
+    ASSERT(deferred.GetDecoderMethod(opts) == interpreted);
+    ASSERT(deferred.CompilePending() == 1);
+    ASSERT(deferred.CompilePending() == 0);
+
+    // Swapped for native code, while the interpreted method stays valid for
+    // anyone still using it.
+    m = deferred.GetDecoderMethod(opts);
+    ASSERT(m != interpreted && m->is_native());
+    ASSERT(!interpreted->is_native());
+    ASSERT(m->dest_handlers() == h.get());
+    ASSERT(interpreted->dest_handlers() == h.get());
+  }
+
+  {
+    // Two methods with the same shape, so the same amount of machine code.
+    upb::reffed_ptr<const upb::Handlers> h2 = NewHandlers(test_mode);
+    upb::pb::DecoderMethodOptions opts2(h2.get());
+    size_t size = cache.jit_bytes();
+    ASSERT(size > 0);
+    ASSERT(cache.jit_limit() == (size_t)-1);
+    ASSERT(!cache.set_jit_limit(size));
+
+    // Only one fits.
+    upb::pb::CodeCache limited;
+    ASSERT(limited.set_jit_limit(size));
+    ASSERT(limited.GetDecoderMethod(opts)->is_native());
+    ASSERT(!limited.GetDecoderMethod(opts2)->is_native());
+    ASSERT(limited.jit_bytes() == size);
+
+    // Deferred, the one that is looked up more gets it, whichever came first.
+    upb::pb::CodeCache hot;
+    ASSERT(hot.set_defer_jit(true) && hot.set_jit_limit(size));
+    ASSERT(!hot.GetDecoderMethod(opts)->is_native());
+    ASSERT(!hot.GetDecoderMethod(opts2)->is_native());
+    ASSERT(!hot.GetDecoderMethod(opts2)->is_native());
+    ASSERT(hot.CompilePending() == 1);
+    ASSERT(hot.CompilePending() == 0);
+    ASSERT(hot.GetDecoderMethod(opts2)->is_native());
+    ASSERT(!hot.GetDecoderMethod(opts)->is_native());
+    ASSERT(hot.jit_bytes() == size);
+
+    upb::pb::CodeCache none;
+    ASSERT(none.set_jit_limit(0));
+    ASSERT(!none.GetDecoderMethod(opts)->is_native());
+    ASSERT(none.jit_bytes() == 0);
+  }
+#else
+  ASSERT(cache.jit_bytes() == 0);
+#endif
+
+  // A submessage's handlers share the method compiled in their parent's
+  // group, unless the parent is still waiting for the JIT.
+  upb::reffed_ptr<const upb::MessageDef> md(NewMessageDef());
+  upb::reffed_ptr<upb::Handlers> parent(upb::Handlers::New(md.get()));
+  upb::reffed_ptr<upb::Handlers> sub(upb::Handlers::New(md.get()));
+  doreg<int32_t, value_int32>(parent.get(), UPB_DESCRIPTOR_TYPE_INT32);
+  doreg<int32_t, value_int32>(sub.get(), UPB_DESCRIPTOR_TYPE_INT32);
+  ASSERT(parent->SetSubHandlers(
+      md->FindFieldByNumber(UPB_DESCRIPTOR_TYPE_MESSAGE), sub.get()));
+  upb::Handlers* to_freeze[] = {parent.get(), sub.get()};
+  ASSERT(upb::Handlers::Freeze(to_freeze, 2, NULL));
+  upb::pb::DecoderMethodOptions parent_opts(parent.get());
+  upb::pb::DecoderMethodOptions sub_opts(sub.get());
+
+  {
+    upb::pb::CodeCache shared;
+    ASSERT(shared.GetDecoderMethod(parent_opts)->dest_handlers() ==
+           parent.get());
+    size_t size = shared.jit_bytes();
+    m = shared.GetDecoderMethod(sub_opts);
+    ASSERT(m->dest_handlers() == sub.get());
+    ASSERT(shared.GetDecoderMethod(sub_opts) == m);
+    ASSERT(shared.jit_bytes() == size);
+
+    // Different options need a group of their own.
+    sub_opts.set_lazy(true);
+    ASSERT(shared.GetDecoderMethod(sub_opts)->dest_handlers() == sub.get());
+#ifdef UPB_USE_JIT_X64
+    ASSERT(shared.jit_bytes() > size);
+#endif
+    sub_opts.set_lazy(false);
+  }
+
+#ifdef UPB_USE_JIT_X64
+  {
+    upb::pb::CodeCache deferred;
+    ASSERT(deferred.set_defer_jit(true));
+    ASSERT(!deferred.GetDecoderMethod(parent_opts)->is_native());
+    ASSERT(!deferred.GetDecoderMethod(sub_opts)->is_native());
+    ASSERT(deferred.CompilePending() == 2);
+    ASSERT(deferred.GetDecoderMethod(sub_opts)->is_native());
+
+    // Once the parent is native, its submessage method is shared.
+    upb::pb::CodeCache later;
+    ASSERT(later.set_defer_jit(true));
+    ASSERT(!later.GetDecoderMethod(parent_opts)->is_native());
+    ASSERT(later.CompilePending() == 1);
+    size_t size = later.jit_bytes();
+    ASSERT(later.GetDecoderMethod(sub_opts)->is_native());
+    ASSERT(later.CompilePending() == 0);
+    ASSERT(later.jit_bytes() == size);
+  }
+#endif
+}
+
+struct CodeCacheJob {
+  upb::pb::CodeCache* cache;
+  const upb::pb::DecoderMethodOptions* opts;
+  pthread_barrier_t* start;
+  const upb::pb::DecoderMethod* method;
+};
+
+static void* CodeCacheThread(void* ud) {
+  CodeCacheJob* job = static_cast<CodeCacheJob*>(ud);
+  pthread_barrier_wait(job->start);
+  job->method = job->cache->GetDecoderMethod(*job->opts);
+  return NULL;
+}
+
+// Threads racing to look up a submessage's method all take a ref on the
+// group it shares with its parent, and all but one drop it again.  That is
+// only safe because the group is frozen, which makes its refcount atomic.
+void test_codecache_threads() {
+  const int kThreads = 4;
+  upb::reffed_ptr<const upb::MessageDef> md(NewMessageDef());
+  upb::reffed_ptr<upb::Handlers> parent(upb::Handlers::New(md.get()));
+  upb::reffed_ptr<upb::Handlers> sub(upb::Handlers::New(md.get()));
+  doreg<int32_t, value_int32>(parent.get(), UPB_DESCRIPTOR_TYPE_INT32);
+  doreg<int32_t, value_int32>(sub.get(), UPB_DESCRIPTOR_TYPE_INT32);
+  ASSERT(parent->SetSubHandlers(
+      md->FindFieldByNumber(UPB_DESCRIPTOR_TYPE_MESSAGE), sub.get()));
+  upb::Handlers* to_freeze[] = {parent.get(), sub.get()};
+  ASSERT(upb::Handlers::Freeze(to_freeze, 2, NULL));
+  upb::pb::DecoderMethodOptions parent_opts(parent.get());
+  upb::pb::DecoderMethodOptions sub_opts(sub.get());
+
+  for (int round = 0; round < 200; round++) {
+    upb::pb::CodeCache* cache = new upb::pb::CodeCache();
+    CodeCacheJob jobs[kThreads];
+    pthread_t threads[kThreads];
+    pthread_barrier_t start;
+
+    ASSERT(cache->GetDecoderMethod(parent_opts)->IsFrozen());
+    ASSERT(pthread_barrier_init(&start, NULL, kThreads) == 0);
+    for (int i = 0; i < kThreads; i++) {
+      jobs[i].cache = cache;
+      jobs[i].opts = &sub_opts;
+      jobs[i].start = &start;
+      jobs[i].method = NULL;
+      ASSERT(pthread_create(&threads[i], NULL, CodeCacheThread,
+                            &jobs[i]) == 0);
+    }
+    for (int i = 0; i < kThreads; i++) {
+      ASSERT(pthread_join(threads[i], NULL) == 0);
+    }
+    ASSERT(pthread_barrier_destroy(&start) == 0);
+
+    // Whoever lost the race got the winner's method.
+    const upb::pb::DecoderMethod* m = cache->GetDecoderMethod(sub_opts);
+    ASSERT(m->dest_handlers() == sub.get() && m->IsFrozen());
+    for (int i = 0; i < kThreads; i++) {
+      ASSERT(jobs[i].method == m);
+    }
+    delete cache;
+  }
+}
+
+void run_stream_decoder(const string& stream, const string* expected_output,
+                        uint64_t records) {
+  VerboseParserEnvironment env(filter_hash != 0);
+  upb::Sink sink(global_handlers, &closures[0]);
+  upb::pb::StreamDecoder *decoder =
+      upb::pb::StreamDecoder::Create(env.env(), global_method, &sink);
+  ASSERT(decoder);
+  env.ResetBytesSink(decoder->input());
+  // Like run_decoder(), but the empty stream still gets one run.
+  for (size_t i = 0; i < UPB_MAX(stream.size(), 1); i++) {
+    for (size_t j = i; j < UPB_MAX(UPB_MIN(stream.size(), i + 5), i + 1);
+         j++) {
+      env.Reset(stream.c_str(), stream.size(), true, expected_output == NULL);
+      if (test_mode != COUNT_ONLY) {
+        output.clear();
+        bool ok = env.Start() &&
+                  env.ParseBuffer(i) &&
+                  env.ParseBuffer(j - i) &&
+                  env.ParseBuffer(-1) &&
+                  env.End();
+        ASSERT(env.CheckConsistency());
+        if (expected_output) {
+          ASSERT(ok);
+          ASSERT(decoder->count() == records);
+          if (test_mode == ALL_HANDLERS) {
+            ASSERT(output == *expected_output);
+          }
+        } else {
+          ASSERT(!ok);
+        }
+      }
+      (*count)++;
+    }
+  }
+}
+
+void test_stream() {
+  string int32_33 = cat( tag(UPB_DESCRIPTOR_TYPE_INT32, UPB_WIRE_TYPE_VARINT),
+                         varint(33) );
+  string long_record;
+  for (int i = 0; i < 10; i++) {
+    long_record += thirty_byte_nop;
+  }
+  long_record += int32_33;
+
+  // The long record needs a two-byte length, and the empty one must still
+  // produce a message.
+  string expected = cat( LINE("<") LINE("5:33") LINE(">"),
+                         LINE("<") LINE(">"),
+                         LINE("<") LINE("5:33") LINE(">") );
+  run_stream_decoder(cat( delim(int32_33), delim(""), delim(long_record) ),
+                     &expected, 3);
+  run_stream_decoder("", &empty, 0);
+
+  // Truncated record, and truncated length.
+  run_stream_decoder(cat( delim(int32_33), varint(5), "ab" ), NULL, 0);
+  run_stream_decoder(cat( delim(int32_33), "\x80" ), NULL, 0);
+
+  // A field may not run past the end of its record into the next one.
+  run_stream_decoder(
+      cat( delim(cat( tag(UPB_DESCRIPTOR_TYPE_STRING, UPB_WIRE_TYPE_DELIMITED),
+                      varint(5), "abc" )),
+           delim(int32_33) ),
+      NULL, 0);
+}
+
 void run_tests(bool use_jit) {
   upb::reffed_ptr<const upb::pb::DecoderMethod> method;
   upb::reffed_ptr<const upb::Handlers> handlers;
@@ -1290,6 +1562,323 @@ void run_tests(bool use_jit) {
   test_valid();
 
   test_emptyhandlers(use_jit);
+  test_stream();
+}
+
+upb::reffed_ptr<const upb::pb::DecoderMethod> NewProfiledMethod(
+    const upb::Handlers* dest_handlers, upb::pb::DecoderProfile* profile,
+    bool record) {
+  upb::pb::CodeCache cache;
+  upb::pb::DecoderMethodOptions opts(dest_handlers);
+  opts.set_profile(profile, record);
+  return cache.GetDecoderMethod(opts);
+}
+
+void run_profiled_tests() {
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method;
+  upb::reffed_ptr<const upb::Handlers> handlers = NewHandlers(test_mode);
+  upb::pb::DecoderProfile* profile = upb::pb::DecoderProfile::New();
+  global_handlers = handlers.get();
+
+  // Recording methods are always interpreted.
+  method = NewProfiledMethod(handlers.get(), profile, true);
+  global_method = method.get();
+  ASSERT(!global_method->is_native());
+  test_valid();
+  ASSERT(test_mode == COUNT_ONLY || profile->count() > 0);
+
+  // Fields are laid out in a different order, but must parse the same.
+  method = NewProfiledMethod(handlers.get(), profile, false);
+  global_method = method.get();
+  test_valid();
+
+  upb::pb::DecoderProfile::Free(profile);
+}
+
+upb::reffed_ptr<const upb::pb::DecoderMethod> NewProjectionMethod(
+    const upb::Handlers* dest_handlers) {
+  upb::pb::CodeCache cache;
+  upb::pb::DecoderMethodOptions opts(dest_handlers);
+  opts.set_projection(true);
+  return cache.GetDecoderMethod(opts);
+}
+
+void run_projection_tests() {
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method;
+  upb::reffed_ptr<const upb::Handlers> handlers = NewHandlers(test_mode);
+  global_handlers = handlers.get();
+
+  // Only NOP_FIELD (or, without handlers, everything) is skipped, which must
+  // not change the output.
+  method = NewProjectionMethod(handlers.get());
+  global_method = method.get();
+  ASSERT(!global_method->is_native());
+  test_valid();
+
+  // Now only f_int32 has a handler.  f_message has subhandlers, but they have
+  // no handlers of their own, so its contents are skipped without being
+  // parsed at all (which is why the bad varint inside it goes unnoticed).
+  upb::reffed_ptr<const upb::MessageDef> md(NewMessageDef());
+  upb::reffed_ptr<upb::Handlers> h(upb::Handlers::New(md.get()));
+  upb::reffed_ptr<upb::Handlers> sub(upb::Handlers::New(md.get()));
+  doreg<int32_t, value_int32>(h.get(), UPB_DESCRIPTOR_TYPE_INT32);
+  ASSERT(h->SetSubHandlers(md->FindFieldByNumber(UPB_DESCRIPTOR_TYPE_MESSAGE),
+                           sub.get()));
+  upb::Handlers* to_freeze[] = {h.get(), sub.get()};
+  ASSERT(upb::Handlers::Freeze(to_freeze, 2, NULL));
+
+  method = NewProjectionMethod(h.get());
+  global_handlers = h.get();
+  global_method = method.get();
+
+  string expected = LINE("5:33");
+  string bad_varint = cat( tag(UPB_DESCRIPTOR_TYPE_INT32,
+                               UPB_WIRE_TYPE_VARINT),
+                           string(11, '\x80') );
+  run_decoder(
+      cat( tag(UPB_DESCRIPTOR_TYPE_DOUBLE, UPB_WIRE_TYPE_64BIT), dbl(1),
+           tag(UPB_DESCRIPTOR_TYPE_FLOAT, UPB_WIRE_TYPE_32BIT), flt(2),
+           tag(rep_fn(UPB_DESCRIPTOR_TYPE_UINT64), UPB_WIRE_TYPE_DELIMITED),
+           delim(cat( varint(3), varint(4) )),
+           tag(rep_fn(UPB_DESCRIPTOR_TYPE_UINT64), UPB_WIRE_TYPE_VARINT),
+           varint(5) ) +
+      cat( tag(UPB_DESCRIPTOR_TYPE_STRING, UPB_WIRE_TYPE_DELIMITED),
+           delim("abc"),
+           submsg(UPB_DESCRIPTOR_TYPE_MESSAGE, bad_varint),
+           tag(UPB_DESCRIPTOR_TYPE_INT32, UPB_WIRE_TYPE_VARINT), varint(33) ),
+      &expected);
+
+  // But a skipped field still can't run past the end of the input.
+  run_decoder(
+      cat( tag(UPB_DESCRIPTOR_TYPE_STRING, UPB_WIRE_TYPE_DELIMITED),
+           varint(5), "abc" ),
+      NULL);
+
+  // A field mask keeps only the named fields, at any depth.
+  const char* paths[] = {"f_int32", "f_message.f_double"};
+  const upb::Handlers* masked =
+      upb_handlers_newmasked(handlers.get(), paths, 2, &masked, NULL);
+  ASSERT(masked);
+  method = NewProjectionMethod(masked);
+  global_handlers = masked;
+  global_method = method.get();
+
+  expected = LINE("<")
+             LINE("5:33")
+             LINE("11:{")
+             LINE("  <")
+             LINE("  1:2")
+             LINE("  >")
+             LINE("}")
+             LINE(">");
+  run_decoder(
+      cat( tag(UPB_DESCRIPTOR_TYPE_DOUBLE, UPB_WIRE_TYPE_64BIT), dbl(1),
+           tag(UPB_DESCRIPTOR_TYPE_INT32, UPB_WIRE_TYPE_VARINT), varint(33),
+           submsg(UPB_DESCRIPTOR_TYPE_MESSAGE,
+                  cat( tag(UPB_DESCRIPTOR_TYPE_DOUBLE, UPB_WIRE_TYPE_64BIT),
+                       dbl(2),
+                       tag(UPB_DESCRIPTOR_TYPE_FLOAT, UPB_WIRE_TYPE_32BIT),
+                       flt(3) )),
+           tag(UPB_DESCRIPTOR_TYPE_FLOAT, UPB_WIRE_TYPE_32BIT), flt(4) ),
+      &expected);
+  upb_handlers_unref(masked, &masked);
+
+  upb::Status status;
+  const char* bad_paths[] = {"f_int32.f_double"};
+  ASSERT(!upb_handlers_newmasked(handlers.get(), bad_paths, 1, &masked,
+                                 &status));
+  ASSERT(!status.ok());
+}
+
+template <class T, bool F(int*, const uint32_t*, T),
+          bool A(int*, const uint32_t*, const void*, size_t)>
+void regarray(upb::Handlers* h, upb_descriptortype_t type, bool value) {
+  uint32_t num = rep_fn(type);
+  const upb::FieldDef* f = h->message_def()->FindFieldByNumber(num);
+  ASSERT(f);
+  if (value) ASSERT(h->SetValueHandler<T>(f, UpbBindT(F, new uint32_t(num))));
+  ASSERT(h->SetArrayHandler(f, UpbBind(A, new uint32_t(num))));
+  regseq(h, f, num);
+}
+
+upb::reffed_ptr<const upb::Handlers> NewProto3Handlers(TestMode mode) {
+  upb::reffed_ptr<upb::MessageDef> md = upb::MessageDef::New();
+  md->set_full_name("DecoderTest3", NULL);
+  ASSERT(md->set_syntax(UPB_SYNTAX_PROTO3));
+  AddFieldsForType(UPB_DESCRIPTOR_TYPE_STRING, "string", md.get());
+  AddFieldsForType(UPB_DESCRIPTOR_TYPE_BYTES, "bytes", md.get());
+  ASSERT(md->Freeze(NULL));
+
+  upb::reffed_ptr<upb::Handlers> h(upb::Handlers::New(md.get()));
+  if (mode == ALL_HANDLERS) {
+    h->SetStartMessageHandler(UpbMakeHandler(startmsg));
+    h->SetEndMessageHandler(UpbMakeHandler(endmsg));
+    reg_str(h.get(), UPB_DESCRIPTOR_TYPE_STRING);
+    reg_str(h.get(), UPB_DESCRIPTOR_TYPE_BYTES);
+    reg_str(h.get(), rep_fn(UPB_DESCRIPTOR_TYPE_STRING));
+  }
+  ASSERT(h->Freeze(NULL));
+  return h;
+}
+
+upb::reffed_ptr<const upb::pb::DecoderMethod> NewUTF8Method(
+    const upb::Handlers* dest_handlers) {
+  upb::pb::CodeCache cache;
+  upb::pb::DecoderMethodOptions opts(dest_handlers);
+  opts.set_validate_utf8(true);
+  return cache.GetDecoderMethod(opts);
+}
+
+void run_utf8_tests() {
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method;
+  upb::reffed_ptr<const upb::Handlers> handlers = NewProto3Handlers(test_mode);
+  global_handlers = handlers.get();
+  method = NewUTF8Method(handlers.get());
+  global_method = method.get();
+  ASSERT(!global_method->is_native());
+
+  // The euro sign is split across buffers at every point in turn.
+  string euro = "a\xe2\x82\xac";
+  string expected = LINE("<")
+                    LINE("9:(4)\"a\xe2\x82\xac")
+                    LINE("9:\"")
+                    LINE(">");
+  run_decoder(cat( tag(UPB_DESCRIPTOR_TYPE_STRING, UPB_WIRE_TYPE_DELIMITED),
+                   delim(euro) ),
+              &expected);
+
+  const char* bad[] = {"\xc0\x80", "\xed\xa0\x80", "a\xe2\x82", "\xe2\x82" "a",
+                       "\xf4\x90\x80\x80", "\xff"};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    run_decoder(cat( tag(UPB_DESCRIPTOR_TYPE_STRING, UPB_WIRE_TYPE_DELIMITED),
+                     delim(bad[i]) ),
+                NULL);
+    run_decoder(cat( tag(rep_fn(UPB_DESCRIPTOR_TYPE_STRING),
+                         UPB_WIRE_TYPE_DELIMITED),
+                     delim(euro),
+                     tag(rep_fn(UPB_DESCRIPTOR_TYPE_STRING),
+                         UPB_WIRE_TYPE_DELIMITED),
+                     delim(bad[i]) ),
+                NULL);
+  }
+
+  // Bytes fields may hold anything.
+  expected = LINE("<")
+             LINE("12:(2)\"\xc0\x80")
+             LINE("12:\"")
+             LINE(">");
+  run_decoder(cat( tag(UPB_DESCRIPTOR_TYPE_BYTES, UPB_WIRE_TYPE_DELIMITED),
+                   delim("\xc0\x80") ),
+              &expected);
+
+  // So may the string fields of proto2 messages.
+  handlers = NewHandlers(test_mode);
+  global_handlers = handlers.get();
+  method = NewUTF8Method(handlers.get());
+  global_method = method.get();
+  expected = LINE("<")
+             LINE("9:(2)\"\xc0\x80")
+             LINE("9:\"")
+             LINE(">");
+  run_decoder(cat( tag(UPB_DESCRIPTOR_TYPE_STRING, UPB_WIRE_TYPE_DELIMITED),
+                   delim("\xc0\x80") ),
+              &expected);
+}
+
+upb::reffed_ptr<const upb::Handlers> NewArrayHandlers(bool value) {
+  upb::reffed_ptr<upb::Handlers> h(upb::Handlers::New(NewMessageDef().get()));
+  h->SetStartMessageHandler(UpbMakeHandler(startmsg));
+  h->SetEndMessageHandler(UpbMakeHandler(endmsg));
+  regarray<double, value_double, array_double>(
+      h.get(), UPB_DESCRIPTOR_TYPE_DOUBLE, value);
+  regarray<float, value_float, array_float>(
+      h.get(), UPB_DESCRIPTOR_TYPE_FLOAT, value);
+  regarray<int64_t, value_int64, array_int64>(
+      h.get(), UPB_DESCRIPTOR_TYPE_INT64, value);
+  regarray<uint64_t, value_uint64, array_uint64>(
+      h.get(), UPB_DESCRIPTOR_TYPE_UINT64, value);
+  regarray<int32_t, value_int32, array_int32>(
+      h.get(), UPB_DESCRIPTOR_TYPE_INT32, value);
+  regarray<uint64_t, value_uint64, array_uint64>(
+      h.get(), UPB_DESCRIPTOR_TYPE_FIXED64, value);
+  regarray<uint32_t, value_uint32, array_uint32>(
+      h.get(), UPB_DESCRIPTOR_TYPE_FIXED32, value);
+  regarray<bool, value_bool, array_bool>(
+      h.get(), UPB_DESCRIPTOR_TYPE_BOOL, value);
+  regarray<uint32_t, value_uint32, array_uint32>(
+      h.get(), UPB_DESCRIPTOR_TYPE_UINT32, value);
+  regarray<int32_t, value_int32, array_int32>(
+      h.get(), UPB_DESCRIPTOR_TYPE_ENUM, value);
+  regarray<int32_t, value_int32, array_int32>(
+      h.get(), UPB_DESCRIPTOR_TYPE_SFIXED32, value);
+  regarray<int64_t, value_int64, array_int64>(
+      h.get(), UPB_DESCRIPTOR_TYPE_SFIXED64, value);
+  regarray<int32_t, value_int32, array_int32>(
+      h.get(), UPB_DESCRIPTOR_TYPE_SINT32, value);
+  regarray<int64_t, value_int64, array_int64>(
+      h.get(), UPB_DESCRIPTOR_TYPE_SINT64, value);
+  ASSERT(h->Freeze(NULL));
+  return h;
+}
+
+// Parses 70 copies of "enc" (which must print as "val"), both packed and
+// unpacked.  That is more than the decoder batches into a single array call.
+void test_array_for_type(upb_descriptortype_t type, const string& enc,
+                         const char* val, bool has_value_handler) {
+  uint32_t fn = rep_fn(type);
+  int wire_type = upb_decoder_types[type].native_wire_type;
+  string packed;
+  string unpacked;
+  string expected = LINE("<") + num2string(fn) + LINE(":[");
+  for (int i = 0; i < 70; i++) {
+    packed += enc;
+    unpacked += cat( tag(fn, wire_type), enc );
+    expected += "  " + num2string(fn) + ":" + val + "\n";
+  }
+  expected += LINE("]") LINE(">");
+
+  // Packed values go through the array handler whether or not there is a
+  // value handler; unpacked ones only use it when there isn't one.
+  array_calls = 0;
+  run_decoder(cat( tag(fn, UPB_WIRE_TYPE_DELIMITED), delim(packed) ),
+              &expected);
+  ASSERT(array_calls > 0);
+
+  array_calls = 0;
+  run_decoder(unpacked, &expected);
+  ASSERT(has_value_handler == (array_calls == 0));
+}
+
+void run_array_tests(bool use_jit) {
+  if (test_mode != ALL_HANDLERS) return;
+
+  for (int i = 0; i < 2; i++) {
+    bool value = (i == 0);
+    upb::reffed_ptr<const upb::Handlers> handlers = NewArrayHandlers(value);
+    upb::reffed_ptr<const upb::pb::DecoderMethod> method =
+        NewMethod(handlers.get(), use_jit);
+    // The JIT leaves groups with array handlers to the bytecode VM.
+    ASSERT(!method->is_native());
+    global_handlers = handlers.get();
+    global_method = method.get();
+
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_DOUBLE, dbl(-66), "-66", value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_FLOAT, flt(33), "33", value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_INT64, varint(-66), "-66", value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_UINT64, varint(33), "33", value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_INT32, varint(-66), "-66", value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_FIXED64, uint64(33), "33", value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_FIXED32, uint32(33), "33", value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_BOOL, varint(1), "true", value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_UINT32, varint(33), "33", value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_ENUM, varint(33), "33", value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_SFIXED32, uint32(-66), "-66",
+                        value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_SFIXED64, uint64(-66), "-66",
+                        value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_SINT32, zz32(-66), "-66", value);
+    test_array_for_type(UPB_DESCRIPTOR_TYPE_SINT64, zz64(-66), "-66", value);
+  }
 }
 
 void run_test_suite() {
@@ -1297,6 +1886,15 @@ void run_test_suite() {
   run_tests(false);
 #ifdef UPB_USE_JIT_X64
   run_tests(true);
+#endif
+  run_profiled_tests();
+  run_projection_tests();
+  run_utf8_tests();
+  test_codecache();
+  test_codecache_threads();
+  run_array_tests(false);
+#ifdef UPB_USE_JIT_X64
+  run_array_tests(true);
 #endif
 }
 
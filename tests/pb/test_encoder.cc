@@ -6,6 +6,8 @@
 #include "upb/pb/decoder.h"
 #include "upb/pb/encoder.h"
 #include "upb/pb/glue.h"
+#include "upb/pb/textparser.h"
+#include "upb/pb/textprinter.h"
 
 std::string read_string(const char *filename) {
   size_t len;
@@ -40,11 +42,268 @@ void test_pb_roundtrip() {
   ASSERT(input == output);
 }
 
+// Decodes in two buffers with counters attached.
+void test_pb_stats() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::google::protobuf::FileDescriptorSet::get());
+  upb::reffed_ptr<const upb::Handlers> encoder_handlers(
+      upb::pb::Encoder::NewHandlers(md.get()));
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method(
+      upb::pb::DecoderMethod::New(
+          upb::pb::DecoderMethodOptions(encoder_handlers.get())));
+
+  upb::InlinedEnvironment<512> env;
+  std::string input = read_string("upb/descriptor/descriptor.pb");
+  std::string output;
+  upb::StringSink string_sink(&output);
+  upb::pb::Encoder* encoder =
+      upb::pb::Encoder::Create(&env, encoder_handlers.get(),
+                               string_sink.input());
+  upb::pb::Decoder* decoder =
+      upb::pb::Decoder::Create(&env, method.get(), encoder->input());
+  upb_decstats stats;
+  upb_decstats_clear(&stats);
+  ASSERT(decoder->stats() == NULL);
+  decoder->set_stats(&stats);
+
+  upb::BytesSink* sink = decoder->input();
+  void* subc;
+  size_t half = input.size() / 2;
+  ASSERT(sink->Start(input.size(), &subc));
+  ASSERT(sink->PutBuffer(subc, input.data(), half, NULL) == half);
+  ASSERT(sink->PutBuffer(subc, input.data() + half, input.size() - half,
+                         NULL) == input.size() - half);
+  ASSERT(sink->End());
+  ASSERT(input == output);
+
+  ASSERT(stats.bytes == input.size());
+  ASSERT(stats.suspends >= 1);
+  ASSERT(stats.resumes == 1);
+  ASSERT(stats.unknown_fields == 0);
+  if (!method->is_native()) {
+    ASSERT(stats.fields > 0);
+    ASSERT(stats.tag_hits > 0 && stats.dispatch_lookups > 0);
+    ASSERT(stats.max_depth > 1);
+  }
+}
+
+// The same, but into a sink that lends the encoder its buffer.
+void test_pb_roundtrip_getbuf() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::google::protobuf::FileDescriptorSet::get());
+  upb::reffed_ptr<const upb::Handlers> encoder_handlers(
+      upb::pb::Encoder::NewHandlers(md.get()));
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method(
+      upb::pb::DecoderMethod::New(
+          upb::pb::DecoderMethodOptions(encoder_handlers.get())));
+
+  upb::InlinedEnvironment<512> env;
+  std::string input = read_string("upb/descriptor/descriptor.pb");
+  upb_bufsink *bufsink = upb_bufsink_new(&env);
+  size_t len;
+  void *subc;
+  ASSERT(upb_bufsink_sink(bufsink)->GetBuffer(bufsink, 1, &len) != NULL);
+
+  upb::pb::Encoder* encoder =
+      upb::pb::Encoder::Create(&env, encoder_handlers.get(),
+                               upb_bufsink_sink(bufsink));
+  upb::pb::Decoder* decoder =
+      upb::pb::Decoder::Create(&env, method.get(), encoder->input());
+  bool ok = upb::BufferSource::PutBuffer(input, decoder->input());
+  ASSERT(ok);
+  const char *data = upb_bufsink_getdata(bufsink, &len);
+  ASSERT(input == std::string(data, len));
+
+  // Encoding again reuses the sink.
+  ok = upb::BufferSource::PutBuffer(input, decoder->input());
+  ASSERT(ok);
+  data = upb_bufsink_getdata(bufsink, &len);
+  ASSERT(input == std::string(data, len));
+
+  // Without a putbuf, a borrowed region is not part of the output.
+  ASSERT(upb_bufsink_sink(bufsink)->Start(0, &subc));
+  ASSERT(upb_bufsink_sink(bufsink)->GetBuffer(subc, 100, &len) != NULL);
+  ASSERT(len >= 100);
+  upb_bufsink_getdata(bufsink, &len);
+  ASSERT(len == 0);
+  upb_bufsink_free(bufsink);
+}
+
+// With fixed-width lengths the encoding is longer, but decodes to the same
+// message.
+void test_pb_roundtrip_fixed_lengths() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::google::protobuf::FileDescriptorSet::get());
+  upb::reffed_ptr<const upb::Handlers> encoder_handlers(
+      upb::pb::Encoder::NewHandlers(md.get()));
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method(
+      upb::pb::DecoderMethod::New(
+          upb::pb::DecoderMethodOptions(encoder_handlers.get())));
+
+  upb::InlinedEnvironment<512> env;
+  std::string input = read_string("upb/descriptor/descriptor.pb");
+  std::string fixed;
+  std::string output;
+  upb::StringSink fixed_sink(&fixed);
+  upb::StringSink string_sink(&output);
+
+  upb::pb::Encoder* encoder =
+      upb::pb::Encoder::Create(&env, encoder_handlers.get(),
+                               fixed_sink.input());
+  ASSERT(!encoder->fixed_lengths());
+  encoder->set_fixed_lengths(true);
+  upb::pb::Decoder* decoder =
+      upb::pb::Decoder::Create(&env, method.get(), encoder->input());
+  bool ok = upb::BufferSource::PutBuffer(input, decoder->input());
+  ASSERT(ok);
+  ASSERT(fixed.size() > input.size());
+
+  encoder = upb::pb::Encoder::Create(&env, encoder_handlers.get(),
+                                     string_sink.input());
+  decoder = upb::pb::Decoder::Create(&env, method.get(), encoder->input());
+  ok = upb::BufferSource::PutBuffer(fixed, decoder->input());
+  ASSERT(ok);
+  ASSERT(input == output);
+}
+
+// Binary -> text -> binary reproduces the input.
+void test_text_roundtrip() {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::google::protobuf::FileDescriptorSet::get());
+  upb::reffed_ptr<const upb::Handlers> printer_handlers(
+      upb::pb::TextPrinter::NewHandlers(md.get()));
+  upb::reffed_ptr<const upb::pb::DecoderMethod> method(
+      upb::pb::DecoderMethod::New(
+          upb::pb::DecoderMethodOptions(printer_handlers.get())));
+  upb::reffed_ptr<const upb::Handlers> encoder_handlers(
+      upb::pb::Encoder::NewHandlers(md.get()));
+  upb::reffed_ptr<const upb::pb::TextParserMethod> parser_method(
+      upb::pb::TextParserMethod::New(md.get()));
+
+  upb::InlinedEnvironment<512> env;
+  std::string input = read_string("upb/descriptor/descriptor.pb");
+  std::string text;
+  std::string output;
+  upb::StringSink text_sink(&text);
+  upb::StringSink string_sink(&output);
+
+  upb::pb::TextPrinter* printer = upb::pb::TextPrinter::Create(
+      &env, printer_handlers.get(), text_sink.input());
+  upb::pb::Decoder* decoder =
+      upb::pb::Decoder::Create(&env, method.get(), printer->input());
+  bool ok = upb::BufferSource::PutBuffer(input, decoder->input());
+  ASSERT(ok);
+  ASSERT(text.find("package: \"google.protobuf\"") !=
+         std::string::npos);
+
+  upb::pb::Encoder* encoder = upb::pb::Encoder::Create(
+      &env, encoder_handlers.get(), string_sink.input());
+  upb::pb::TextParser* parser =
+      upb::pb::TextParser::Create(&env, parser_method.get(), encoder->input());
+  ok = upb::BufferSource::PutBuffer(text, parser->input());
+  ASSERT(ok);
+  ASSERT(input == output);
+
+  // The same text in single-line mode.
+  text.clear();
+  output.clear();
+  printer = upb::pb::TextPrinter::Create(&env, printer_handlers.get(),
+                                         text_sink.input());
+  printer->SetSingleLineMode(true);
+  decoder = upb::pb::Decoder::Create(&env, method.get(), printer->input());
+  ok = upb::BufferSource::PutBuffer(input, decoder->input());
+  ASSERT(ok);
+  ASSERT(text.find('\n') == std::string::npos);
+  ok = upb::BufferSource::PutBuffer(text, parser->input());
+  ASSERT(ok);
+  ASSERT(input == output);
+}
+
+// Parses "text" as a FileDescriptorSet and prints it back in canonical form,
+// or returns "ERROR" if it does not parse.
+std::string canonical_text(const std::string& text) {
+  upb::reffed_ptr<const upb::MessageDef> md(
+      upbdefs::google::protobuf::FileDescriptorSet::get());
+  upb::reffed_ptr<const upb::Handlers> printer_handlers(
+      upb::pb::TextPrinter::NewHandlers(md.get()));
+  upb::reffed_ptr<const upb::pb::TextParserMethod> parser_method(
+      upb::pb::TextParserMethod::New(md.get()));
+
+  upb::InlinedEnvironment<512> env;
+  std::string output;
+  upb::StringSink string_sink(&output);
+  upb::pb::TextPrinter* printer = upb::pb::TextPrinter::Create(
+      &env, printer_handlers.get(), string_sink.input());
+  printer->SetSingleLineMode(true);
+  upb::pb::TextParser* parser =
+      upb::pb::TextParser::Create(&env, parser_method.get(), printer->input());
+  if (!upb::BufferSource::PutBuffer(text, parser->input())) {
+    return "ERROR";
+  }
+  return output;
+}
+
+void test_text_parse() {
+  // Comments, separators, '<>' brackets, adjacent strings and escapes.
+  ASSERT(canonical_text(
+             "# A comment.\n"
+             "file <\n"
+             "  name: 'a' \"b\\n\\x41\\101\\u00e9\";  # Another.\n"
+             "  package: \"p\",\n"
+             "  message_type { name: \"M\" }\n"
+             ">\n") ==
+         "file { name: \"ab\\nAA\303\251\" package: \"p\" "
+         "message_type { name: \"M\" } } ");
+
+  // Repeated fields in list form, enums by name or number, and integers in
+  // hex and octal.
+  ASSERT(canonical_text(
+             "file {\n"
+             "  dependency: [\"x\", \"y\"]\n"
+             "  public_dependency: [0x10, 010, -0]\n"
+             "  message_type: [{name: \"A\"}, {name: \"B\"}]\n"
+             "  message_type {\n"
+             "    field { label: LABEL_REPEATED type: 5 number: 7 }\n"
+             "  }\n"
+             "  options { java_multiple_files: true optimize_for: SPEED }\n"
+             "}\n") ==
+         "file { dependency: \"x\" dependency: \"y\" "
+         "public_dependency: 16 public_dependency: 8 public_dependency: 0 "
+         "message_type { name: \"A\" } message_type { name: \"B\" } "
+         "message_type { field { label: LABEL_REPEATED type: TYPE_INT32 "
+         "number: 7 } } "
+         "options { java_multiple_files: true optimize_for: SPEED } } ");
+
+  // Enum numbers just either side of the enum's values are printed as numbers.
+  ASSERT(canonical_text(
+             "file { message_type { field { label: 0 } field { label: 1 } "
+             "field { label: 3 } field { label: 4 } field { label: -1 } } }") ==
+         "file { message_type { field { label: 0 } "
+         "field { label: LABEL_OPTIONAL } field { label: LABEL_REPEATED } "
+         "field { label: 4 } field { label: -1 } } } ");
+
+  ASSERT(canonical_text("") == "");
+  ASSERT(canonical_text("file { name: \"a\" ") == "ERROR");
+  ASSERT(canonical_text("file { nonexistent: 1 }") == "ERROR");
+  ASSERT(canonical_text("file { name: 5 }") == "ERROR");
+  ASSERT(canonical_text("file { public_dependency: 2147483648 }") == "ERROR");
+  ASSERT(canonical_text("file { public_dependency: -2147483648 }") != "ERROR");
+  ASSERT(canonical_text("file { message_type { field { label: 1.5 } } }") ==
+         "ERROR");
+  ASSERT(canonical_text("file { name: \"a }") == "ERROR");
+  ASSERT(canonical_text("[ext]: 1") == "ERROR");
+}
+
 extern "C" {
 int run_tests(int argc, char *argv[]) {
   UPB_UNUSED(argc);
   UPB_UNUSED(argv);
   test_pb_roundtrip();
+  test_pb_stats();
+  test_pb_roundtrip_getbuf();
+  test_pb_roundtrip_fixed_lengths();
+  test_text_roundtrip();
+  test_text_parse();
   return 0;
 }
 }
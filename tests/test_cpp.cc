@@ -3,7 +3,10 @@
  * Tests for C++ wrappers.
  */
 
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <fstream>
@@ -11,7 +14,10 @@
 #include <set>
 #include <sstream>
 
+#include "upb/decode.h"
 #include "upb/def.h"
+#include "upb/encode.h"
+#include "upb/descriptor/descriptor.upb.h"
 #include "upb/descriptor/reader.h"
 #include "upb/handlers.h"
 #include "upb/pb/decoder.h"
@@ -1103,6 +1109,83 @@ class IntIncrementer {
 };
 
 
+struct ArrayTester {
+  ArrayTester() : count(0) {}
+
+  size_t count;
+
+  static void VoidHandler(ArrayTester* t, const void* vals, size_t n) {
+    UPB_UNUSED(vals);
+    t->count += n;
+  }
+
+  static bool BoolHandler(ArrayTester* t, const void* vals, size_t n) {
+    UPB_UNUSED(vals);
+    t->count += n;
+    return true;
+  }
+
+  void VoidMethod(const int* hd, const void* vals, size_t n) {
+    UPB_UNUSED(vals);
+    count += n * *hd;
+  }
+};
+
+bool IsAlwaysOk(upb::Handlers* h, const upb::FieldDef* f,
+                upb::Handlers::Type type) {
+  upb::Handlers::Selector sel;
+  upb::HandlerAttributes attr;
+  ASSERT(upb::Handlers::GetSelector(f, type, &sel));
+  ASSERT(h->GetAttributes(sel, &attr));
+  return attr.always_ok();
+}
+
+// Handlers returning void are flagged always_ok, and the wrapper that
+// supplies the return value is generated for array handlers too.
+void TestAlwaysOk() {
+  upb::reffed_ptr<upb::MessageDef> md(upb::MessageDef::New());
+  upb::reffed_ptr<upb::FieldDef> f1(upb::FieldDef::New());
+  upb::reffed_ptr<upb::FieldDef> f2(upb::FieldDef::New());
+  upb::reffed_ptr<upb::FieldDef> f3(upb::FieldDef::New());
+  upb::FieldDef* fields[] = {f1.get(), f2.get(), f3.get()};
+  for (int i = 0; i < 3; i++) {
+    char name[] = "f0";
+    name[1] += i;
+    fields[i]->set_type(UPB_TYPE_INT32);
+    fields[i]->set_label(UPB_LABEL_REPEATED);
+    ASSERT(fields[i]->set_name(name, NULL));
+    ASSERT(fields[i]->set_number(i + 1, NULL));
+    ASSERT(md->AddField(fields[i], NULL));
+  }
+  ASSERT(md->Freeze(NULL));
+
+  upb::reffed_ptr<upb::Handlers> h(upb::Handlers::New(md.get()));
+  ASSERT(h->SetInt32Handler(
+      f1.get(), UpbMakeHandler(&DoNothingInt32Handler<ArrayTester>)));
+  ASSERT(h->SetArrayHandler(f1.get(),
+                            UpbMakeHandler(&ArrayTester::VoidHandler)));
+  ASSERT(h->SetArrayHandler(f2.get(),
+                            UpbMakeHandler(&ArrayTester::BoolHandler)));
+  ASSERT(h->SetArrayHandler(
+      f3.get(), UpbBind(&ArrayTester::VoidMethod, new int(10))));
+
+  ASSERT(IsAlwaysOk(h.get(), f1.get(), UPB_HANDLER_INT32));
+  ASSERT(IsAlwaysOk(h.get(), f1.get(), UPB_HANDLER_ARRAY));
+  ASSERT(!IsAlwaysOk(h.get(), f2.get(), UPB_HANDLER_ARRAY));
+  ASSERT(IsAlwaysOk(h.get(), f3.get(), UPB_HANDLER_ARRAY));
+  ASSERT(h->Freeze(NULL));
+
+  ArrayTester tester;
+  upb::Sink sink(h.get(), &tester);
+  upb::Handlers::Selector sel;
+  int32_t vals[3] = {1, 2, 3};
+  ASSERT(upb::Handlers::GetSelector(f1.get(), UPB_HANDLER_ARRAY, &sel));
+  ASSERT(sink.PutArray(sel, vals, 3));
+  ASSERT(upb::Handlers::GetSelector(f3.get(), UPB_HANDLER_ARRAY, &sel));
+  ASSERT(sink.PutArray(sel, vals, 2));
+  ASSERT(tester.count == 23);
+}
+
 void TestHandlerDataDestruction() {
   upb::reffed_ptr<upb::MessageDef> md(upb::MessageDef::New());
   upb::reffed_ptr<upb::FieldDef> f(upb::FieldDef::New());
@@ -1220,6 +1303,1020 @@ void TestOneofs() {
   ASSERT(!status.ok());
 }
 
+static void NoCleanup(void* ud) { UPB_UNUSED(ud); }
+
+void TestArenaStats() {
+  upb::Arena arena;
+  upb_arenastats stats;
+  upb::Allocator* a = arena.allocator();
+
+  arena.SetMaxBlockSize(1024);
+  arena.SetMemLimit(2048);
+  ASSERT(upb_malloc(a, 16));
+  ASSERT(arena.AddCleanup(NoCleanup, NULL));
+  // Doesn't fit the first block, so retires it with its unused tail.
+  void* p = upb_malloc(a, 400);
+  ASSERT(p);
+  ASSERT(upb_realloc(a, p, 400, 800));
+
+  arena.GetStats(&stats);
+  ASSERT(stats.blocks == arena.BlockCount());
+  ASSERT(stats.blocks >= 2);
+  ASSERT(stats.bytes_used == arena.BytesAllocated());
+  ASSERT(stats.bytes_reserved >= stats.bytes_used + stats.tail_waste);
+  ASSERT(stats.largest_block <= stats.bytes_reserved);
+  ASSERT(stats.tail_waste > 0);
+  ASSERT(stats.realloc_waste == 400);
+  ASSERT(stats.cleanups == 1);
+  ASSERT(stats.limit_failures == 0);
+
+  // A block big enough for this would break the limit.
+  ASSERT(upb_malloc(a, 4096) == NULL);
+  arena.GetStats(&stats);
+  ASSERT(stats.limit_failures == 1);
+  ASSERT(stats.bytes_reserved <= 2048);
+
+  // Growing the newest allocation extends it in place.
+  arena.SetMemLimit(0);
+  p = upb_malloc(a, 16);
+  ASSERT(p);
+  ASSERT(upb_realloc(a, p, 16, 64) == p);
+  ASSERT(upb_realloc(a, p, 64, 32) == p);
+  ASSERT(upb_malloc(a, 16) == static_cast<char*>(p) + 32);
+  ASSERT(upb_realloc(a, p, 32, 48) != p);
+  arena.GetStats(&stats);
+  ASSERT(stats.realloc_waste == 400 + 32);
+
+  upb::Environment env;
+  env.SetMemLimit(512);
+  ASSERT(upb_env_malloc(&env, 256));
+  ASSERT(upb_env_malloc(&env, 1024) == NULL);
+}
+
+static void CountCleanup(void* ud) { (*static_cast<int*>(ud))++; }
+
+void TestArenaReset() {
+  char buf[1024];
+  int count = 0;
+
+  {
+    upb::Arena arena(buf, sizeof(buf), NULL);
+    upb::Allocator* a = arena.allocator();
+    size_t start = arena.BytesAllocated();
+    char* p = static_cast<char*>(upb_malloc(a, 100));
+    ASSERT(p >= buf && p < buf + sizeof(buf));
+    ASSERT(arena.AddCleanup(CountCleanup, &count));
+    ASSERT(arena.AddCleanup(CountCleanup, &count));
+    ASSERT(arena.BytesAllocated() > start);
+
+    arena.Reset();
+    ASSERT(count == 2);
+    ASSERT(arena.BytesAllocated() == start);
+    ASSERT(arena.BlockCount() == 1);
+
+    // The initial block is reused from the start.
+    ASSERT(upb_malloc(a, 100) == p);
+
+    // The arena still grows past it, and then keeps the bigger heap block.
+    ASSERT(arena.AddCleanup(CountCleanup, &count));
+    char* q = static_cast<char*>(upb_malloc(a, 4096));
+    ASSERT(q && (q < buf || q >= buf + sizeof(buf)));
+    memset(q, 0x55, 4096);
+    arena.Reset();
+    ASSERT(count == 3);
+    ASSERT(arena.BytesAllocated() == start);
+    ASSERT(arena.BlockCount() == 1);
+    ASSERT(upb_malloc(a, 4096) == q);
+    ASSERT(arena.BlockCount() == 1);
+
+    // Cleanups that already ran don't run again.
+    arena.Reset();
+    ASSERT(count == 3);
+    ASSERT(arena.AddCleanup(CountCleanup, &count));
+  }
+  ASSERT(count == 4);
+
+  upb::InlinedEnvironment<512> env;
+  upb::Status status;
+  size_t start = upb_env_bytesallocated(&env);
+  ASSERT(upb_env_malloc(&env, 64));
+  ASSERT(upb_env_addcleanup(&env, CountCleanup, &count));
+  status.SetErrorMessage("error");
+  env.ReportError(&status);
+  ASSERT(!env.ok());
+
+  env.Reset();
+  ASSERT(env.ok());
+  ASSERT(count == 5);
+  ASSERT(upb_env_bytesallocated(&env) == start);
+  char* p = static_cast<char*>(upb_env_malloc(&env, 64));
+  ASSERT(p);
+  memset(p, 0x55, 64);
+  ASSERT(upb_env_bytesallocated(&env) > start);
+}
+
+// Allocates a string from |arena| and adds a cleanup that counts into |count|.
+static char* FuseTestAlloc(upb::Arena* arena, int* count) {
+  char* p = static_cast<char*>(upb_malloc(arena->allocator(), 8));
+  ASSERT(p);
+  strcpy(p, "fused");
+  ASSERT(arena->AddCleanup(CountCleanup, count));
+  return p;
+}
+
+void TestArenaFuse() {
+  for (int order = 0; order < 2; order++) {
+    int count = 0;
+    upb::Arena* a = new upb::Arena();
+    upb::Arena* b = new upb::Arena();
+    char* pa = FuseTestAlloc(a, &count);
+    char* pb = FuseTestAlloc(b, &count);
+
+    ASSERT(a->Fuse(b));
+    // Fusing again, either way round or with itself, changes nothing.
+    ASSERT(a->Fuse(b));
+    ASSERT(b->Fuse(a));
+    ASSERT(a->Fuse(a));
+    FuseTestAlloc(b, &count);
+
+    // Whichever is freed first, the memory of both outlives it.
+    delete (order ? b : a);
+    ASSERT(count == 0);
+    ASSERT(strcmp(pa, "fused") == 0 && strcmp(pb, "fused") == 0);
+    delete (order ? a : b);
+    ASSERT(count == 3);
+  }
+
+  // Fusing is transitive, and fusing two arenas of one set is a no-op.
+  {
+    int count = 0;
+    upb::Arena* a = new upb::Arena();
+    upb::Arena* b = new upb::Arena();
+    upb::Arena* c = new upb::Arena();
+    char* pc = FuseTestAlloc(c, &count);
+    FuseTestAlloc(a, &count);
+    ASSERT(a->Fuse(b));
+    ASSERT(c->Fuse(b));
+    ASSERT(a->Fuse(c));
+    delete c;
+    delete a;
+    ASSERT(count == 0);
+    ASSERT(strcmp(pc, "fused") == 0);
+    delete b;
+    ASSERT(count == 2);
+  }
+
+  // An arena fused only with itself behaves as if it were not fused.
+  {
+    int count = 0;
+    upb::Arena* a = new upb::Arena();
+    ASSERT(a->Fuse(a));
+    FuseTestAlloc(a, &count);
+    ASSERT(a->Fuse(a));
+    delete a;
+    ASSERT(count == 1);
+  }
+
+  // Memory we don't own can't be kept alive.
+  {
+    char buf[256];
+    upb::Arena a(buf, sizeof(buf), NULL);
+    upb::Arena b;
+    ASSERT(!a.Fuse(&b));
+    ASSERT(!b.Fuse(&a));
+  }
+}
+
+struct ConcurrentArenaJob {
+  upb::ConcurrentArena* shared;
+  int id;
+  bool ok;
+  int cleanups;
+  char* allocs[1000];
+};
+
+// Allocates 1000 strings from a local arena on the shared one, stamped with
+// the job's id, to be checked after all threads are done.  ASSERT() isn't
+// thread-safe, so failures are only recorded here.
+static void* ConcurrentArenaThread(void* ud) {
+  ConcurrentArenaJob* job = static_cast<ConcurrentArenaJob*>(ud);
+  upb::Arena local(NULL, 0, job->shared->block_allocator());
+  local.SetMaxBlockSize(1024);
+  job->ok = true;
+  for (int i = 0; i < 1000; i++) {
+    char* p = static_cast<char*>(upb_malloc(local.allocator(), 40));
+    if (!p) {
+      job->ok = false;
+      return NULL;
+    }
+    memset(p, 'a' + job->id, 40);
+    job->allocs[i] = p;
+  }
+  if (local.BytesAllocated() != 1000 * 48 ||
+      !job->shared->AddCleanup(CountCleanup, &job->cleanups)) {
+    job->ok = false;
+  }
+  return NULL;
+}
+
+void TestConcurrentArena() {
+  const int kThreads = 4;
+  ConcurrentArenaJob jobs[kThreads];
+  pthread_t threads[kThreads];
+  upb::ConcurrentArena* shared = new upb::ConcurrentArena();
+
+  for (int i = 0; i < kThreads; i++) {
+    jobs[i].shared = shared;
+    jobs[i].id = i;
+    jobs[i].cleanups = 0;
+    ASSERT(pthread_create(&threads[i], NULL, ConcurrentArenaThread,
+                          &jobs[i]) == 0);
+  }
+  for (int i = 0; i < kThreads; i++) {
+    ASSERT(pthread_join(threads[i], NULL) == 0);
+  }
+
+  // The local arenas are gone, but their memory lives on, untouched by the
+  // other threads.
+  for (int i = 0; i < kThreads; i++) {
+    ASSERT(jobs[i].ok);
+    ASSERT(jobs[i].cleanups == 0);
+    for (int j = 0; j < 1000; j++) {
+      for (int k = 0; k < 40; k++) {
+        ASSERT(jobs[i].allocs[j][k] == 'a' + i);
+      }
+    }
+  }
+
+  delete shared;
+  for (int i = 0; i < kThreads; i++) {
+    ASSERT(jobs[i].cleanups == 1);
+  }
+
+  // One thread: local cleanups run with the local arena, shared ones with
+  // the shared arena.
+  int local_count = 0;
+  int shared_count = 0;
+  shared = new upb::ConcurrentArena(&upb_alloc_global);
+  {
+    upb::Arena local(NULL, 0, shared->block_allocator());
+    size_t start = local.BytesAllocated();
+    ASSERT(upb_malloc(local.allocator(), 100));
+    ASSERT(upb_malloc(local.allocator(), 20000));
+    ASSERT(local.BytesAllocated() == start + 112 + 20000);
+    ASSERT(local.AddCleanup(CountCleanup, &local_count));
+    ASSERT(shared->AddCleanup(CountCleanup, &shared_count));
+    ASSERT(shared->AddCleanup(CountCleanup, &shared_count));
+  }
+  ASSERT(local_count == 1);
+  ASSERT(shared_count == 0);
+  delete shared;
+  ASSERT(local_count == 1);
+  ASSERT(shared_count == 2);
+}
+
+void TestArenaBlockSizes() {
+  upb::Arena arena(NULL, 0, &upb_alloc_hugepage);
+  upb_arenastats stats;
+  upb::Allocator* a = arena.allocator();
+  size_t reserved = 0;
+  size_t last_block = 0;
+  size_t blocks = 0;
+
+  arena.SetNextBlockSize(64);
+  arena.SetMaxBlockSize(1024);
+
+  // Each new block is twice the last one, until it reaches the max.
+  while (arena.BlockCount() < 8) {
+    char* p = static_cast<char*>(upb_malloc(a, 48));
+    ASSERT(p);
+    memset(p, 0x55, 48);
+    if (arena.BlockCount() == blocks) continue;
+
+    arena.GetStats(&stats);
+    size_t block = stats.bytes_reserved - reserved;
+    if (blocks == 0) {
+      ASSERT(block == 64 + UPB_ARENA_BLOCK_OVERHEAD);
+    } else if (last_block < 1024) {
+      ASSERT(block == UPB_MIN(last_block * 2, 1024) + UPB_ARENA_BLOCK_OVERHEAD);
+    } else {
+      ASSERT(block == last_block);
+    }
+    ASSERT(stats.largest_block == block);
+    reserved = stats.bytes_reserved;
+    last_block = block;
+    blocks = arena.BlockCount();
+  }
+  ASSERT(last_block == 1024 + UPB_ARENA_BLOCK_OVERHEAD);
+
+  // Bigger allocations still get a block of their own.
+  char* big = static_cast<char*>(upb_malloc(a, 4096));
+  ASSERT(big);
+  memset(big, 0x55, 4096);
+  arena.GetStats(&stats);
+  ASSERT(stats.largest_block == 4096 + UPB_ARENA_BLOCK_OVERHEAD);
+
+  // Full-sized blocks fill a huge page exactly.
+  upb::Arena huge(NULL, 0, &upb_alloc_hugepage);
+  huge.SetMaxBlockSize(UPB_ARENA_HUGEPAGE_MAXBLOCKSIZE);
+  huge.SetNextBlockSize(UPB_ARENA_HUGEPAGE_MAXBLOCKSIZE);
+  char* p = static_cast<char*>(upb_malloc(huge.allocator(), 1000));
+  ASSERT(p);
+  memset(p, 0x55, 1000);
+  huge.GetStats(&stats);
+  ASSERT(stats.largest_block == UPB_HUGEPAGE_SIZE - UPB_HUGEPAGE_OVERHEAD);
+
+  // The allocator itself, on both sides of its mmap() threshold.  Realloc
+  // keeps the contents either way.
+  p = static_cast<char*>(upb_malloc(&upb_alloc_hugepage, 100));
+  ASSERT(p);
+  ASSERT(reinterpret_cast<uintptr_t>(p) % UPB_HUGEPAGE_OVERHEAD == 0);
+  memset(p, 'x', 100);
+  p = static_cast<char*>(
+      upb_realloc(&upb_alloc_hugepage, p, 100, UPB_HUGEPAGE_SIZE));
+  ASSERT(p);
+  ASSERT(reinterpret_cast<uintptr_t>(p) % UPB_HUGEPAGE_OVERHEAD == 0);
+  ASSERT(p[0] == 'x' && p[99] == 'x');
+#ifdef __linux__
+  // Mapped blocks start on a huge page boundary, or the kernel can't back
+  // them with huge pages.
+  ASSERT((reinterpret_cast<uintptr_t>(p) - UPB_HUGEPAGE_OVERHEAD) %
+         UPB_HUGEPAGE_SIZE == 0);
+#endif
+  memset(p, 'y', UPB_HUGEPAGE_SIZE);
+  p = static_cast<char*>(
+      upb_realloc(&upb_alloc_hugepage, p, UPB_HUGEPAGE_SIZE, 10));
+  ASSERT(p);
+  ASSERT(p[0] == 'y' && p[9] == 'y');
+  upb_free(&upb_alloc_hugepage, p);
+
+  // Sizes that would overflow once the header is added are refused.
+  ASSERT(!upb_malloc(&upb_alloc_hugepage, (size_t)-1));
+  ASSERT(!upb_malloc(&upb_alloc_hugepage, (size_t)-1 - UPB_HUGEPAGE_SIZE));
+}
+
+static void TestMessageViews() {
+  std::ifstream file_in("upb/descriptor/descriptor.pb", std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(file_in)),
+                   (std::istreambuf_iterator<char>()));
+  ASSERT(!data.empty());
+
+  upb::Owned<google::protobuf::FileDescriptorSetView> set;
+  ASSERT(set->file().empty());
+  ASSERT(set.Parse(upb::StringView(data.data(), data.size())));
+  ASSERT(set->file().size() == 1);
+
+  google::protobuf::FileDescriptorProtoView file = set->file()[0];
+  ASSERT(file.has_name());
+  ASSERT(file.name().ToString() == "upb/descriptor/descriptor.proto");
+  ASSERT(file.package().ToString() == "google.protobuf");
+  ASSERT(file.dependency().empty());
+  ASSERT(!file.has_source_code_info());
+  ASSERT(file.ptr() == set->file()[0].ptr());
+
+  // The views read the same fields the C accessors do.
+  upb_stringview name = google_protobuf_FileDescriptorProto_name(file.ptr());
+  ASSERT(file.name().data() == name.data);
+  ASSERT(file.name().size() == name.size);
+
+  size_t found = 0;
+  upb::MessageArrayView<google::protobuf::DescriptorProtoView> msgs =
+      file.message_type();
+  ASSERT(msgs.size() > 10);
+  for (upb::MessageArrayView<google::protobuf::DescriptorProtoView>::iterator
+           it = msgs.begin(); it != msgs.end(); ++it) {
+    if ((*it).name().ToString() != "FieldDescriptorProto") continue;
+    found++;
+    ASSERT((*it).field().size() == 10);
+    ASSERT((*it).field()[0].name().ToString() == "name");
+    ASSERT((*it).field()[0].number() == 1);
+    ASSERT((*it).field()[0].label() ==
+           google_protobuf_FieldDescriptorProto_LABEL_OPTIONAL);
+    ASSERT((*it).enum_type().size() == 2);
+  }
+  ASSERT(found == 1);
+
+#if __cplusplus >= 201703L
+  std::string_view package = file.package();
+  ASSERT(package == "google.protobuf");
+#endif
+
+  // Mutable views write through to the message.
+  set.mutable_view().file()[0].set_package(upb::StringView("foo.bar", 7));
+  ASSERT(file.package().ToString() == "foo.bar");
+  ASSERT(file.has_package());
+
+  google::protobuf::FileOptionsMutView options(
+      google::protobuf::FileOptionsView::New(set.env()));
+  options.set_java_package(upb::StringView("com.example", 11));
+  ASSERT(file.has_options());
+  ASSERT(file.options().java_package().ToString() == "com.google.protobuf");
+  set.mutable_view().file()[0].set_options(options);
+  ASSERT(file.has_options());
+  ASSERT(file.options().java_package().ToString() == "com.example");
+  ASSERT(file.options().ptr() == options.ptr());
+
+  // Serializing and reparsing keeps the changes.
+  size_t len;
+  char *buf = set.Serialize(&len);
+  ASSERT(buf);
+  upb::Owned<google::protobuf::FileDescriptorSetView> set2;
+  ASSERT(set2.Parse(upb::StringView(buf, len)));
+  ASSERT(set2->file()[0].package().ToString() == "foo.bar");
+  ASSERT(set2->file()[0].options().java_package().ToString() ==
+         "com.example");
+  ASSERT(set2->file()[0].message_type().size() == msgs.size());
+
+  // A failed parse leaves an empty message.
+  ASSERT(!set2.Parse(upb::StringView("\x0a\x05", 2)));
+  ASSERT(set2->file().empty());
+
+#ifdef UPB_CXX11
+  upb::Owned<google::protobuf::FileDescriptorSetView> moved(std::move(set));
+  ASSERT(moved->file()[0].package().ToString() == "foo.bar");
+#endif
+}
+
+static void TestDecodeIov() {
+  std::ifstream file_in("upb/descriptor/descriptor.pb", std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(file_in)),
+                   (std::istreambuf_iterator<char>()));
+  const upb_msglayout_msginit_v1 *l = &google_protobuf_FileDescriptorSet_msginit;
+  const size_t seg_sizes[] = {1, 2, 3, 5, 7, 16, 100, 1000, 1 << 20};
+  upb::Environment env;
+  upb_decodeopts opts = UPB_DECODEOPTS_INITIALIZER;
+  upb_decstats want_stats;
+  size_t want_len;
+  upb_stringview buf = upb_stringview_make(data.data(), data.size());
+
+  upb_decstats_clear(&want_stats);
+  opts.stats = &want_stats;
+  google_protobuf_FileDescriptorSet *want =
+      google_protobuf_FileDescriptorSet_new(&env);
+  ASSERT(upb_decode2(buf, want, l, &env, &opts));
+  char *want_out = upb_encode(want, l, &env, &want_len);
+  ASSERT(want_out);
+
+  for (size_t i = 0; i < sizeof(seg_sizes) / sizeof(seg_sizes[0]); i++) {
+    size_t seg_size = seg_sizes[i];
+    std::vector<upb_stringview> segs;
+    upb_decstats stats;
+    size_t len;
+
+    // Each segment is a separate allocation, so that reading past one would
+    // show up under ASAN.
+    std::vector<std::string> copies;
+    for (size_t ofs = 0; ofs < data.size(); ofs += seg_size) {
+      copies.push_back(data.substr(ofs, seg_size));
+      copies.push_back(std::string());
+    }
+    for (size_t j = 0; j < copies.size(); j++) {
+      segs.push_back(
+          upb_stringview_make(copies[j].data(), copies[j].size()));
+    }
+
+    upb_decstats_clear(&stats);
+    opts.stats = &stats;
+    google_protobuf_FileDescriptorSet *msg =
+        google_protobuf_FileDescriptorSet_new(&env);
+    ASSERT(upb_decode_iov(&segs[0], segs.size(), msg, l, &env, &opts));
+    char *out = upb_encode(msg, l, &env, &len);
+    ASSERT(out && len == want_len && memcmp(out, want_out, len) == 0);
+    ASSERT(stats.bytes == want_stats.bytes);
+    ASSERT(stats.fields == want_stats.fields);
+    ASSERT(stats.unknown_fields == want_stats.unknown_fields);
+    ASSERT(stats.max_depth == want_stats.max_depth);
+
+    // A string that doesn't straddle a boundary points into its segment.
+    upb::StringView name =
+        google::protobuf::FileDescriptorSetView(msg).file()[0].name();
+    if (seg_size >= 100) {
+      ASSERT(name.data() == copies[0].data() + 5);
+    }
+    ASSERT(name.ToString() == "upb/descriptor/descriptor.proto");
+
+    // Truncated input fails.
+    segs.back() = upb_stringview_make(NULL, 0);
+    segs[segs.size() - 2].size--;
+    msg = google_protobuf_FileDescriptorSet_new(&env);
+    ASSERT(!upb_decode_iov(&segs[0], segs.size(), msg, l, &env, NULL));
+  }
+
+  // Segments are copied into one buffer for UPB_DECODE_COPY.
+  {
+    upb_stringview segs[2];
+    size_t len;
+    segs[0] = upb_stringview_make(data.data(), 10);
+    segs[1] = upb_stringview_make(data.data() + 10, data.size() - 10);
+    opts.stats = NULL;
+    opts.string_mode = UPB_DECODE_COPY;
+    google_protobuf_FileDescriptorSet *msg =
+        google_protobuf_FileDescriptorSet_new(&env);
+    ASSERT(upb_decode_iov(segs, 2, msg, l, &env, &opts));
+    char *out = upb_encode(msg, l, &env, &len);
+    ASSERT(out && len == want_len && memcmp(out, want_out, len) == 0);
+  }
+}
+
+// The messages in descriptor.upb.c, by full name.
+struct GeneratedMessage {
+  const char* name;
+  const upb_msglayout_msginit_v1* init;
+};
+
+static const GeneratedMessage kGeneratedMessages[] = {
+  {"google.protobuf.FileDescriptorSet",
+   &google_protobuf_FileDescriptorSet_msginit},
+  {"google.protobuf.FileDescriptorProto",
+   &google_protobuf_FileDescriptorProto_msginit},
+  {"google.protobuf.DescriptorProto",
+   &google_protobuf_DescriptorProto_msginit},
+  {"google.protobuf.DescriptorProto.ExtensionRange",
+   &google_protobuf_DescriptorProto_ExtensionRange_msginit},
+  {"google.protobuf.DescriptorProto.ReservedRange",
+   &google_protobuf_DescriptorProto_ReservedRange_msginit},
+  {"google.protobuf.FieldDescriptorProto",
+   &google_protobuf_FieldDescriptorProto_msginit},
+  {"google.protobuf.OneofDescriptorProto",
+   &google_protobuf_OneofDescriptorProto_msginit},
+  {"google.protobuf.EnumDescriptorProto",
+   &google_protobuf_EnumDescriptorProto_msginit},
+  {"google.protobuf.EnumValueDescriptorProto",
+   &google_protobuf_EnumValueDescriptorProto_msginit},
+  {"google.protobuf.ServiceDescriptorProto",
+   &google_protobuf_ServiceDescriptorProto_msginit},
+  {"google.protobuf.MethodDescriptorProto",
+   &google_protobuf_MethodDescriptorProto_msginit},
+  {"google.protobuf.FileOptions",
+   &google_protobuf_FileOptions_msginit},
+  {"google.protobuf.MessageOptions",
+   &google_protobuf_MessageOptions_msginit},
+  {"google.protobuf.FieldOptions",
+   &google_protobuf_FieldOptions_msginit},
+  {"google.protobuf.EnumOptions",
+   &google_protobuf_EnumOptions_msginit},
+  {"google.protobuf.EnumValueOptions",
+   &google_protobuf_EnumValueOptions_msginit},
+  {"google.protobuf.ServiceOptions",
+   &google_protobuf_ServiceOptions_msginit},
+  {"google.protobuf.MethodOptions",
+   &google_protobuf_MethodOptions_msginit},
+  {"google.protobuf.UninterpretedOption",
+   &google_protobuf_UninterpretedOption_msginit},
+  {"google.protobuf.UninterpretedOption.NamePart",
+   &google_protobuf_UninterpretedOption_NamePart_msginit},
+  {"google.protobuf.SourceCodeInfo",
+   &google_protobuf_SourceCodeInfo_msginit},
+  {"google.protobuf.SourceCodeInfo.Location",
+   &google_protobuf_SourceCodeInfo_Location_msginit},
+};
+
+static const size_t kGeneratedMessageCount =
+    sizeof(kGeneratedMessages) / sizeof(kGeneratedMessages[0]);
+
+static const upb_msglayout_msginit_v1* FindGeneratedInit(const char* name) {
+  for (size_t i = 0; i < kGeneratedMessageCount; i++) {
+    if (strcmp(kGeneratedMessages[i].name, name) == 0) {
+      return kGeneratedMessages[i].init;
+    }
+  }
+  return NULL;
+}
+
+// Loads the defs for descriptor.proto, which the generated code was built
+// from.
+static upb::SymbolTable* LoadDescriptorProto() {
+  std::ifstream file_in("upb/descriptor/descriptor.pb", std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(file_in)),
+                   (std::istreambuf_iterator<char>()));
+  upb::Status status;
+  std::vector<upb::reffed_ptr<upb::FileDef> > files;
+  ASSERT(upb::LoadDescriptor(data, &status, &files));
+  upb::SymbolTable* s = upb::SymbolTable::New();
+  for (size_t i = 0; i < files.size(); i++) {
+    ASSERT(s->AddFile(files[i].get(), &status));
+  }
+  return s;
+}
+
+// The generated msginits agree with descriptor.proto, and their lookup and
+// presence tables are the ones upb_msglayout_frominit_v1() would build.
+static void TestGeneratedTables() {
+  upb::SymbolTable* s = LoadDescriptorProto();
+  size_t msg_count = 0;
+
+  upb_symtab_iter it;
+  for (upb_symtab_begin(&it, s, UPB_DEF_MSG); !upb_symtab_done(&it);
+       upb_symtab_next(&it)) {
+    msg_count++;
+  }
+  ASSERT(msg_count == kGeneratedMessageCount);
+
+  for (size_t i = 0; i < kGeneratedMessageCount; i++) {
+    const upb_msglayout_msginit_v1* init = kGeneratedMessages[i].init;
+    const upb::MessageDef* md = s->LookupMessage(kGeneratedMessages[i].name);
+    ASSERT(md);
+    ASSERT(init->field_count == md->field_count());
+    ASSERT(init->oneof_count == md->oneof_count());
+    ASSERT(init->is_proto2 == (md->syntax() == UPB_SYNTAX_PROTO2));
+
+    std::set<uint16_t> hasbits;
+    for (uint16_t j = 0; j < init->field_count; j++) {
+      const upb_msglayout_fieldinit_v1* field = &init->fields[j];
+      const upb::FieldDef* f = md->FindFieldByNumber(field->number);
+      ASSERT(f);
+      ASSERT(j == 0 || field->number > init->fields[j - 1].number);
+      ASSERT(field->offset < init->size);
+      ASSERT(field->type == f->descriptor_type());
+      ASSERT(field->label == f->label());
+      ASSERT((field->oneof_index != UPB_NOT_IN_ONEOF) ==
+             (f->containing_oneof() != NULL));
+      if (f->IsSubMessage()) {
+        ASSERT(field->submsg_index != UPB_NO_SUBMSG);
+        ASSERT(init->submsgs[field->submsg_index] ==
+               FindGeneratedInit(f->message_subdef()->full_name()));
+      } else {
+        ASSERT(field->submsg_index == UPB_NO_SUBMSG);
+      }
+      if (init->is_proto2 && !f->IsSequence() && !f->containing_oneof()) {
+        ASSERT(field->hasbit < init->hasbit_bytes * 8);
+        AssertInsert(&hasbits, field->hasbit);
+      } else {
+        ASSERT(field->hasbit == UPB_NO_HASBIT);
+      }
+    }
+
+    upb_msglayout_msginit_v1 bare = *init;
+    bare.field_lookup = NULL;
+    bare.dense_below = 0;
+    bare.hasbit_fields = NULL;
+    bare.check_fields = NULL;
+    upb_msglayout* l = upb_msglayout_frominit_v1(&bare, &upb_alloc_global);
+    ASSERT(l);
+    const upb_msglayout_msginit_v1* built =
+        reinterpret_cast<const upb_msglayout_msginit_v1*>(l);
+    ASSERT(built->dense_below == init->dense_below);
+    ASSERT(memcmp(built->field_lookup, init->field_lookup,
+                  init->dense_below * sizeof(uint16_t)) == 0);
+    ASSERT(built->hasbit_bytes == init->hasbit_bytes);
+    ASSERT((built->hasbit_fields == NULL) == (init->hasbit_fields == NULL));
+    if (init->hasbit_fields) {
+      ASSERT(memcmp(built->hasbit_fields, init->hasbit_fields,
+                    init->hasbit_bytes * 8 * sizeof(uint16_t)) == 0);
+    }
+    ASSERT((built->check_fields == NULL) == (init->check_fields == NULL));
+    if (init->check_fields) {
+      ASSERT(memcmp(built->check_fields, init->check_fields,
+                    (init->field_count + 63) / 64 * sizeof(uint64_t)) == 0);
+    }
+    upb_msglayout_uninit_v1(l, &upb_alloc_global);
+  }
+
+  upb::SymbolTable::Free(s);
+}
+
+// A value to store through a generated setter.
+template <class T> static T SampleValue(T*) { return static_cast<T>(1); }
+template <class T> static T* SampleValue(T**) {
+  static char c;
+  return reinterpret_cast<T*>(&c);
+}
+static upb_stringview SampleValue(upb_stringview*) {
+  return upb_stringview_make("x", 1);
+}
+
+typedef std::set<std::pair<const upb_msglayout_msginit_v1*, uint32_t> >
+    AccessorSet;
+
+// Checks the accessors for one field of a generated struct against the
+// field's msginit and def: the member is at the msginit's offset, the setter
+// stores the value and sets exactly the field's hasbit, and the getter and
+// has_*() function read them back.
+template <class M, class T>
+static void CheckAccessors(upb::SymbolTable* s, AccessorSet* seen,
+                           const char* msgname, const char* name,
+                           const upb_msglayout_msginit_v1* init,
+                           size_t struct_size, size_t ofs,
+                           void (*set)(M*, T), T (*get)(const M*),
+                           bool (*has)(const M*)) {
+  std::string full = std::string("google.protobuf.") + msgname;
+  for (size_t i = 0; i < full.size(); i++) {
+    if (full[i] == '_') full[i] = '.';
+  }
+  const upb::MessageDef* md = s->LookupMessage(full.c_str());
+  ASSERT(md);
+  ASSERT(init == FindGeneratedInit(full.c_str()));
+  ASSERT(struct_size == init->size);
+  const upb::FieldDef* f = md->FindFieldByName(name);
+  ASSERT(f);
+  ASSERT((has == NULL) == f->IsSequence());
+  AssertInsert(seen, std::make_pair(init, f->number()));
+
+  const upb_msglayout_fieldinit_v1* field = NULL;
+  for (uint16_t i = 0; i < init->field_count; i++) {
+    if (init->fields[i].number == f->number()) field = &init->fields[i];
+  }
+  ASSERT(field);
+  ASSERT(field->offset == ofs);
+  ASSERT(ofs + sizeof(T) <= init->size);
+
+  char* mem = static_cast<char*>(calloc(1, init->size));
+  ASSERT(mem);
+  M* msg = reinterpret_cast<M*>(mem);
+  T value = SampleValue(static_cast<T*>(NULL));
+  if (has) ASSERT(!has(msg));
+  set(msg, value);
+  ASSERT(memcmp(mem + field->offset, &value, sizeof(T)) == 0);
+  T got = get(msg);
+  ASSERT(memcmp(&got, &value, sizeof(T)) == 0);
+  if (has) ASSERT(has(msg));
+  for (uint32_t i = 0; i < init->hasbit_bytes; i++) {
+    uint8_t bits = 0;
+    if (field->hasbit != UPB_NO_HASBIT && field->hasbit / 8 == i) {
+      bits = 1 << (field->hasbit % 8);
+    }
+    ASSERT((uint8_t)mem[i] == bits);
+  }
+  free(mem);
+}
+
+#define CHECK_ACCESSORS(msg, field, has)                                  \
+  CheckAccessors(s, &seen, #msg, #field, &google_protobuf_##msg##_msginit, \
+                 UPB_ALIGNED_SIZEOF(google_protobuf_##msg),               \
+                 offsetof(google_protobuf_##msg, field),                  \
+                 google_protobuf_##msg##_set_##field,                     \
+                 google_protobuf_##msg##_##field, has)
+#define CHECK_SINGULAR(msg, field) \
+  CHECK_ACCESSORS(msg, field, google_protobuf_##msg##_has_##field)
+#define CHECK_REPEATED(msg, field) \
+  CHECK_ACCESSORS(msg, field,      \
+                  static_cast<bool (*)(const google_protobuf_##msg*)>(NULL))
+
+// The inline accessors in descriptor.upb.h use the members and hasbits that
+// the generated msginits describe, for every field of every message.
+static void TestGeneratedAccessors() {
+  upb::SymbolTable* s = LoadDescriptorProto();
+  AccessorSet seen;
+  size_t field_count = 0;
+
+  for (size_t i = 0; i < kGeneratedMessageCount; i++) {
+    field_count += kGeneratedMessages[i].init->field_count;
+  }
+  CHECK_REPEATED(FileDescriptorSet, file);
+
+  CHECK_SINGULAR(FileDescriptorProto, name);
+  CHECK_SINGULAR(FileDescriptorProto, package);
+  CHECK_SINGULAR(FileDescriptorProto, syntax);
+  CHECK_SINGULAR(FileDescriptorProto, options);
+  CHECK_SINGULAR(FileDescriptorProto, source_code_info);
+  CHECK_REPEATED(FileDescriptorProto, dependency);
+  CHECK_REPEATED(FileDescriptorProto, message_type);
+  CHECK_REPEATED(FileDescriptorProto, enum_type);
+  CHECK_REPEATED(FileDescriptorProto, service);
+  CHECK_REPEATED(FileDescriptorProto, extension);
+  CHECK_REPEATED(FileDescriptorProto, public_dependency);
+  CHECK_REPEATED(FileDescriptorProto, weak_dependency);
+
+  CHECK_SINGULAR(DescriptorProto, name);
+  CHECK_SINGULAR(DescriptorProto, options);
+  CHECK_REPEATED(DescriptorProto, field);
+  CHECK_REPEATED(DescriptorProto, nested_type);
+  CHECK_REPEATED(DescriptorProto, enum_type);
+  CHECK_REPEATED(DescriptorProto, extension_range);
+  CHECK_REPEATED(DescriptorProto, extension);
+  CHECK_REPEATED(DescriptorProto, oneof_decl);
+  CHECK_REPEATED(DescriptorProto, reserved_range);
+  CHECK_REPEATED(DescriptorProto, reserved_name);
+
+  CHECK_SINGULAR(DescriptorProto_ExtensionRange, start);
+  CHECK_SINGULAR(DescriptorProto_ExtensionRange, end);
+
+  CHECK_SINGULAR(DescriptorProto_ReservedRange, start);
+  CHECK_SINGULAR(DescriptorProto_ReservedRange, end);
+
+  CHECK_SINGULAR(FieldDescriptorProto, label);
+  CHECK_SINGULAR(FieldDescriptorProto, type);
+  CHECK_SINGULAR(FieldDescriptorProto, number);
+  CHECK_SINGULAR(FieldDescriptorProto, oneof_index);
+  CHECK_SINGULAR(FieldDescriptorProto, name);
+  CHECK_SINGULAR(FieldDescriptorProto, extendee);
+  CHECK_SINGULAR(FieldDescriptorProto, type_name);
+  CHECK_SINGULAR(FieldDescriptorProto, default_value);
+  CHECK_SINGULAR(FieldDescriptorProto, json_name);
+  CHECK_SINGULAR(FieldDescriptorProto, options);
+
+  CHECK_SINGULAR(OneofDescriptorProto, name);
+
+  CHECK_SINGULAR(EnumDescriptorProto, name);
+  CHECK_SINGULAR(EnumDescriptorProto, options);
+  CHECK_REPEATED(EnumDescriptorProto, value);
+
+  CHECK_SINGULAR(EnumValueDescriptorProto, number);
+  CHECK_SINGULAR(EnumValueDescriptorProto, name);
+  CHECK_SINGULAR(EnumValueDescriptorProto, options);
+
+  CHECK_SINGULAR(ServiceDescriptorProto, name);
+  CHECK_SINGULAR(ServiceDescriptorProto, options);
+  CHECK_REPEATED(ServiceDescriptorProto, method);
+
+  CHECK_SINGULAR(MethodDescriptorProto, client_streaming);
+  CHECK_SINGULAR(MethodDescriptorProto, server_streaming);
+  CHECK_SINGULAR(MethodDescriptorProto, name);
+  CHECK_SINGULAR(MethodDescriptorProto, input_type);
+  CHECK_SINGULAR(MethodDescriptorProto, output_type);
+  CHECK_SINGULAR(MethodDescriptorProto, options);
+
+  CHECK_SINGULAR(FileOptions, optimize_for);
+  CHECK_SINGULAR(FileOptions, java_multiple_files);
+  CHECK_SINGULAR(FileOptions, cc_generic_services);
+  CHECK_SINGULAR(FileOptions, java_generic_services);
+  CHECK_SINGULAR(FileOptions, py_generic_services);
+  CHECK_SINGULAR(FileOptions, java_generate_equals_and_hash);
+  CHECK_SINGULAR(FileOptions, deprecated);
+  CHECK_SINGULAR(FileOptions, java_string_check_utf8);
+  CHECK_SINGULAR(FileOptions, cc_enable_arenas);
+  CHECK_SINGULAR(FileOptions, javanano_use_deprecated_package);
+  CHECK_SINGULAR(FileOptions, java_package);
+  CHECK_SINGULAR(FileOptions, java_outer_classname);
+  CHECK_SINGULAR(FileOptions, go_package);
+  CHECK_SINGULAR(FileOptions, objc_class_prefix);
+  CHECK_SINGULAR(FileOptions, csharp_namespace);
+  CHECK_SINGULAR(FileOptions, php_class_prefix);
+  CHECK_SINGULAR(FileOptions, php_namespace);
+  CHECK_REPEATED(FileOptions, uninterpreted_option);
+
+  CHECK_SINGULAR(MessageOptions, message_set_wire_format);
+  CHECK_SINGULAR(MessageOptions, no_standard_descriptor_accessor);
+  CHECK_SINGULAR(MessageOptions, deprecated);
+  CHECK_SINGULAR(MessageOptions, map_entry);
+  CHECK_REPEATED(MessageOptions, uninterpreted_option);
+
+  CHECK_SINGULAR(FieldOptions, ctype);
+  CHECK_SINGULAR(FieldOptions, jstype);
+  CHECK_SINGULAR(FieldOptions, packed);
+  CHECK_SINGULAR(FieldOptions, deprecated);
+  CHECK_SINGULAR(FieldOptions, lazy);
+  CHECK_SINGULAR(FieldOptions, weak);
+  CHECK_REPEATED(FieldOptions, uninterpreted_option);
+
+  CHECK_SINGULAR(EnumOptions, allow_alias);
+  CHECK_SINGULAR(EnumOptions, deprecated);
+  CHECK_REPEATED(EnumOptions, uninterpreted_option);
+
+  CHECK_SINGULAR(EnumValueOptions, deprecated);
+  CHECK_REPEATED(EnumValueOptions, uninterpreted_option);
+
+  CHECK_SINGULAR(ServiceOptions, deprecated);
+  CHECK_REPEATED(ServiceOptions, uninterpreted_option);
+
+  CHECK_SINGULAR(MethodOptions, deprecated);
+  CHECK_REPEATED(MethodOptions, uninterpreted_option);
+
+  CHECK_SINGULAR(UninterpretedOption, positive_int_value);
+  CHECK_SINGULAR(UninterpretedOption, negative_int_value);
+  CHECK_SINGULAR(UninterpretedOption, double_value);
+  CHECK_SINGULAR(UninterpretedOption, identifier_value);
+  CHECK_SINGULAR(UninterpretedOption, string_value);
+  CHECK_SINGULAR(UninterpretedOption, aggregate_value);
+  CHECK_REPEATED(UninterpretedOption, name);
+
+  CHECK_SINGULAR(UninterpretedOption_NamePart, is_extension);
+  CHECK_SINGULAR(UninterpretedOption_NamePart, name_part);
+
+  CHECK_REPEATED(SourceCodeInfo, location);
+
+  CHECK_SINGULAR(SourceCodeInfo_Location, leading_comments);
+  CHECK_SINGULAR(SourceCodeInfo_Location, trailing_comments);
+  CHECK_REPEATED(SourceCodeInfo_Location, path);
+  CHECK_REPEATED(SourceCodeInfo_Location, span);
+  CHECK_REPEATED(SourceCodeInfo_Location, leading_detached_comments);
+
+  ASSERT(seen.size() == field_count);
+  upb::SymbolTable::Free(s);
+}
+
+#undef CHECK_REPEATED
+#undef CHECK_SINGULAR
+#undef CHECK_ACCESSORS
+
+// Checks one enum read through the views against its def.
+static void CheckEnumView(upb::SymbolTable* s, const std::string& scope,
+                          google::protobuf::EnumDescriptorProtoView e,
+                          size_t* enum_count) {
+  std::string full = scope + "." + e.name().ToString();
+  const upb_enumdef* ed = upb_symtab_lookupenum(s, full.c_str());
+  ASSERT(ed);
+  (*enum_count)++;
+  ASSERT(e.value().size() == (size_t)upb_enumdef_numvals(ed));
+  for (size_t i = 0; i < e.value().size(); i++) {
+    google::protobuf::EnumValueDescriptorProtoView v = e.value()[i];
+    int32_t num;
+    ASSERT(upb_enumdef_ntoiz(ed, v.name().ToString().c_str(), &num));
+    ASSERT(num == v.number());
+  }
+}
+
+// Checks one message read through the views against its def, then its
+// nested messages and enums.
+static void CheckMessageView(upb::SymbolTable* s, const std::string& scope,
+                             google::protobuf::DescriptorProtoView m,
+                             size_t* msg_count, size_t* enum_count) {
+  std::string full = scope + "." + m.name().ToString();
+  const upb::MessageDef* md = s->LookupMessage(full.c_str());
+  ASSERT(md);
+  (*msg_count)++;
+
+  // The array views see the same elements as the C accessors.
+  const upb_array* arr = google_protobuf_DescriptorProto_field(m.ptr());
+  ASSERT(m.field().size() == (arr ? upb_array_size(arr) : 0));
+  for (size_t i = 0; i < m.field().size(); i++) {
+    ASSERT(m.field()[i].ptr() ==
+           static_cast<google_protobuf_FieldDescriptorProto* const*>(
+               upb_array_data(arr))[i]);
+  }
+
+  ASSERT(m.field().size() == (size_t)md->field_count());
+  ASSERT(m.oneof_decl().size() == (size_t)md->oneof_count());
+  for (size_t i = 0; i < m.field().size(); i++) {
+    google::protobuf::FieldDescriptorProtoView fv = m.field()[i];
+    const upb_fielddef* f = md->FindFieldByNumber(fv.number());
+    ASSERT(f);
+    ASSERT(fv.name().ToString() == upb_fielddef_name(f));
+    ASSERT(fv.label() == (int)upb_fielddef_label(f));
+    ASSERT(fv.type() == (int)upb_fielddef_descriptortype(f));
+    if (upb_fielddef_issubmsg(f)) {
+      ASSERT(fv.type_name().ToString() ==
+             std::string(".") +
+                 upb_msgdef_fullname(upb_fielddef_msgsubdef(f)));
+    } else if (upb_fielddef_type(f) == UPB_TYPE_ENUM) {
+      ASSERT(fv.type_name().ToString() ==
+             std::string(".") +
+                 upb_enumdef_fullname(upb_fielddef_enumsubdef(f)));
+    } else {
+      ASSERT(!fv.has_type_name());
+    }
+    const upb_oneofdef* o = upb_fielddef_containingoneof(f);
+    ASSERT(fv.has_oneof_index() == (o != NULL));
+    if (o) {
+      ASSERT(m.oneof_decl()[fv.oneof_index()].name().ToString() ==
+             upb_oneofdef_name(o));
+    }
+  }
+
+  for (size_t i = 0; i < m.nested_type().size(); i++) {
+    CheckMessageView(s, full, m.nested_type()[i], msg_count, enum_count);
+  }
+  for (size_t i = 0; i < m.enum_type().size(); i++) {
+    CheckEnumView(s, full, m.enum_type()[i], enum_count);
+  }
+}
+
+// Every message, field and enum of descriptor.pb read through the views
+// matches the defs loaded from it.
+static void TestGeneratedViews() {
+  std::ifstream file_in("upb/descriptor/descriptor.pb", std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(file_in)),
+                   (std::istreambuf_iterator<char>()));
+  upb::SymbolTable* s = LoadDescriptorProto();
+  size_t msg_count = 0;
+  size_t enum_count = 0;
+
+  // A view is just the message pointer.
+  ASSERT(sizeof(google::protobuf::DescriptorProtoView) == sizeof(void*));
+  ASSERT(sizeof(google::protobuf::DescriptorProtoMutView) == sizeof(void*));
+
+  upb::Owned<google::protobuf::FileDescriptorSetView> set;
+  ASSERT(set.Parse(upb::StringView(data.data(), data.size())));
+  ASSERT(set->file().size() == 1);
+  google::protobuf::FileDescriptorProtoView file = set->file()[0];
+  for (size_t i = 0; i < file.message_type().size(); i++) {
+    CheckMessageView(s, file.package().ToString(), file.message_type()[i],
+                     &msg_count, &enum_count);
+  }
+  for (size_t i = 0; i < file.enum_type().size(); i++) {
+    CheckEnumView(s, file.package().ToString(), file.enum_type()[i],
+                  &enum_count);
+  }
+  ASSERT(file.service().empty());
+  ASSERT(file.extension().empty());
+
+  size_t want_msgs = 0;
+  size_t want_enums = 0;
+  upb_symtab_iter it;
+  for (upb_symtab_begin(&it, s, UPB_DEF_MSG); !upb_symtab_done(&it);
+       upb_symtab_next(&it)) {
+    want_msgs++;
+  }
+  for (upb_symtab_begin(&it, s, UPB_DEF_ENUM); !upb_symtab_done(&it);
+       upb_symtab_next(&it)) {
+    want_enums++;
+  }
+  ASSERT(msg_count == want_msgs);
+  ASSERT(enum_count == want_enums);
+
+  upb::SymbolTable::Free(s);
+}
+
 extern "C" {
 
 int run_tests(int argc, char *argv[]) {
@@ -1274,10 +2371,30 @@ int run_tests(int argc, char *argv[]) {
 
   TestMismatchedTypes();
 
+  TestAlwaysOk();
+
   TestHandlerDataDestruction();
 
   TestOneofs();
 
+  TestArenaStats();
+
+  TestArenaBlockSizes();
+
+  TestArenaReset();
+
+  TestArenaFuse();
+
+  TestConcurrentArena();
+
+  TestMessageViews();
+
+  TestDecodeIov();
+
+  TestGeneratedTables();
+  TestGeneratedAccessors();
+  TestGeneratedViews();
+
   return 0;
 }
 
@@ -5,6 +5,7 @@
 
 #include "tests/test_util.h"
 #include "upb/def.h"
+#include "upb/descriptor/descriptor.upbdefs.h"
 #include "upb/pb/glue.h"
 #include "upb_test.h"
 #include <stdlib.h>
@@ -67,6 +68,240 @@ static upb_symtab *load_test_proto() {
   return s;
 }
 
+static void test_addfiles() {
+  upb_symtab *s = upb_symtab_new();
+  upb_status status = UPB_STATUS_INIT;
+  upb_filedef *file1 = upb_filedef_new(&file1);
+  upb_filedef *file2 = upb_filedef_new(&file2);
+  upb_msgdef *m1 = upb_msgdef_new(&m1);
+  upb_msgdef *m2 = upb_msgdef_new(&m2);
+  upb_fielddef *f = upb_fielddef_new(&f);
+  upb_filedef *files[2];
+  const upb_msgdef *m;
+  bool ok;
+
+  /* file2 depends on file1, but is listed first in the batch. */
+  ASSERT(upb_filedef_setname(file1, "file1.proto", NULL));
+  ASSERT(upb_filedef_setname(file2, "file2.proto", NULL));
+  ASSERT(upb_msgdef_setfullname(m1, "M1", NULL));
+  ASSERT(upb_msgdef_setfullname(m2, "M2", NULL));
+  upb_fielddef_settype(f, UPB_TYPE_MESSAGE);
+  ASSERT(upb_fielddef_setnumber(f, 1, NULL));
+  ASSERT(upb_fielddef_setname(f, "m1", NULL));
+  ASSERT(upb_fielddef_setsubdefname(f, ".M1", NULL));
+  ASSERT(upb_msgdef_addfield(m2, f, &f, NULL));
+  ASSERT(upb_filedef_addmsg(file1, m1, &m1, NULL));
+  ASSERT(upb_filedef_addmsg(file2, m2, &m2, NULL));
+  ASSERT(upb_filedef_adddep(file2, file1));
+  files[0] = file2;
+  files[1] = file1;
+
+  ASSERT(upb_symtab_addfiles(s, files, 2, &status));
+  ASSERT(upb_filedef_isfrozen(file1));
+  ASSERT(upb_filedef_isfrozen(file2));
+
+  m = upb_symtab_lookupmsg(s, "M2");
+  ASSERT(m);
+  m = upb_downcast_msgdef(upb_fielddef_subdef(upb_msgdef_itof(m, 1)));
+  ok = m == upb_symtab_lookupmsg(s, "M1");
+  ASSERT(ok);
+
+  upb_filedef_unref(file1, &file1);
+  upb_filedef_unref(file2, &file2);
+  upb_symtab_free(s);
+}
+
+static void check_samefields(const upb_msgdef *m, const upb_msgdef *m2) {
+  upb_msg_field_iter i;
+  ASSERT(upb_msgdef_numfields(m) == upb_msgdef_numfields(m2));
+  ASSERT(upb_msgdef_numoneofs(m) == upb_msgdef_numoneofs(m2));
+  ASSERT(upb_msgdef_mapentry(m) == upb_msgdef_mapentry(m2));
+  ASSERT(upb_msgdef_extendable(m) == upb_msgdef_extendable(m2));
+  ASSERT(upb_msgdef_syntax(m) == upb_msgdef_syntax(m2));
+
+  for (upb_msg_field_begin(&i, m); !upb_msg_field_done(&i);
+       upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    const upb_fielddef *f2 = upb_msgdef_itof(m2, upb_fielddef_number(f));
+    bool ok;
+    ASSERT(f2);
+    ok = strcmp(upb_fielddef_name(f), upb_fielddef_name(f2)) == 0;
+    ASSERT(ok);
+    ASSERT(upb_fielddef_descriptortype(f) == upb_fielddef_descriptortype(f2));
+    ASSERT(upb_fielddef_label(f) == upb_fielddef_label(f2));
+    ASSERT(upb_fielddef_packed(f) == upb_fielddef_packed(f2));
+    ASSERT(upb_fielddef_lazy(f) == upb_fielddef_lazy(f2));
+    ASSERT(upb_fielddef_hassubdef(f) == upb_fielddef_hassubdef(f2));
+    if (upb_fielddef_hassubdef(f)) {
+      ok = strcmp(upb_def_fullname(upb_fielddef_subdef(f)),
+                  upb_def_fullname(upb_fielddef_subdef(f2))) == 0;
+      ASSERT(ok);
+    }
+    ASSERT(!upb_fielddef_containingoneof(f) ==
+           !upb_fielddef_containingoneof(f2));
+    if (upb_fielddef_containingoneof(f)) {
+      ok = strcmp(upb_oneofdef_name(upb_fielddef_containingoneof(f)),
+                  upb_oneofdef_name(upb_fielddef_containingoneof(f2))) == 0;
+      ASSERT(ok);
+    }
+    switch (upb_fielddef_type(f)) {
+      case UPB_TYPE_STRING:
+      case UPB_TYPE_BYTES: {
+        size_t len, len2;
+        const char *str = upb_fielddef_defaultstr(f, &len);
+        const char *str2 = upb_fielddef_defaultstr(f2, &len2);
+        ASSERT(len == len2 && memcmp(str, str2, len) == 0);
+        break;
+      }
+      case UPB_TYPE_DOUBLE:
+        ASSERT(upb_fielddef_defaultdouble(f) == upb_fielddef_defaultdouble(f2));
+        break;
+      case UPB_TYPE_FLOAT:
+        ASSERT(upb_fielddef_defaultfloat(f) == upb_fielddef_defaultfloat(f2));
+        break;
+      case UPB_TYPE_INT64:
+        ASSERT(upb_fielddef_defaultint64(f) == upb_fielddef_defaultint64(f2));
+        break;
+      case UPB_TYPE_UINT64:
+        ASSERT(upb_fielddef_defaultuint64(f) == upb_fielddef_defaultuint64(f2));
+        break;
+      case UPB_TYPE_INT32:
+      case UPB_TYPE_ENUM:
+        ASSERT(upb_fielddef_defaultint32(f) == upb_fielddef_defaultint32(f2));
+        break;
+      case UPB_TYPE_UINT32:
+        ASSERT(upb_fielddef_defaultuint32(f) == upb_fielddef_defaultuint32(f2));
+        break;
+      case UPB_TYPE_BOOL:
+        ASSERT(upb_fielddef_defaultbool(f) == upb_fielddef_defaultbool(f2));
+        break;
+      case UPB_TYPE_MESSAGE:
+        break;
+    }
+  }
+}
+
+static void test_snapshot() {
+  upb_symtab *s = load_test_proto();
+  upb_symtab *s2 = upb_symtab_new();
+  upb_status status = UPB_STATUS_INIT;
+  upb_symtab_iter i;
+  size_t size;
+  int count = 0;
+  char *buf = upb_symtab_snapshot(s, &upb_alloc_global, &size);
+  ASSERT(buf);
+
+  /* Truncated or mangled snapshots are rejected. */
+  ASSERT(!upb_symtab_addsnapshot(s2, buf, size - 1, &status));
+  upb_status_clear(&status);
+  buf[0] ^= 1;
+  ASSERT(!upb_symtab_addsnapshot(s2, buf, size, &status));
+  upb_status_clear(&status);
+  buf[0] ^= 1;
+
+  ASSERT(upb_symtab_addsnapshot(s2, buf, size, &status));
+  upb_gfree(buf);
+
+  for (upb_symtab_begin(&i, s, UPB_DEF_ANY); !upb_symtab_done(&i);
+       upb_symtab_next(&i)) {
+    const upb_def *def = upb_symtab_iter_def(&i);
+    const upb_def *def2 = upb_symtab_lookup(s2, upb_def_fullname(def));
+    ASSERT(def2);
+    ASSERT(upb_def_isfrozen(def2));
+    ASSERT(upb_def_type(def) == upb_def_type(def2));
+    if (upb_dyncast_msgdef(def)) {
+      check_samefields(upb_dyncast_msgdef(def), upb_dyncast_msgdef(def2));
+    } else if (upb_dyncast_enumdef(def)) {
+      const upb_enumdef *e = upb_dyncast_enumdef(def);
+      const upb_enumdef *e2 = upb_dyncast_enumdef(def2);
+      upb_enum_iter j;
+      ASSERT(upb_enumdef_numvals(e) == upb_enumdef_numvals(e2));
+      ASSERT(upb_enumdef_default(e) == upb_enumdef_default(e2));
+      for (upb_enum_begin(&j, e); !upb_enum_done(&j); upb_enum_next(&j)) {
+        int32_t num;
+        ASSERT(upb_enumdef_ntoiz(e2, upb_enum_iter_name(&j), &num));
+        ASSERT(num == upb_enum_iter_number(&j));
+      }
+    }
+    count++;
+  }
+  ASSERT(count > 0);
+
+  upb_symtab_free(s);
+  upb_symtab_free(s2);
+}
+
+static void test_lazy() {
+  upb_symtab *s = upb_symtab_new();
+  upb_status status = UPB_STATUS_INIT;
+  upb_symtab_iter i;
+  size_t len;
+  char *data = upb_readfile(descriptor_file, &len);
+  const upb_msgdef *m;
+  const upb_def *def;
+  bool ok;
+  ASSERT(data);
+
+  ASSERT(upb_symtab_addlazy(s, data, len, &status));
+  /* Indexing the same file twice is harmless. */
+  ASSERT(upb_symtab_addlazy(s, data, len, &status));
+
+  /* Nothing is built until it is looked up. */
+  upb_symtab_begin(&i, s, UPB_DEF_ANY);
+  ASSERT(upb_symtab_done(&i));
+  ASSERT(!upb_symtab_lookup(s, "NoSuchSymbol"));
+
+  m = upb_symtab_lookupmsg(s, "A");
+  ASSERT(m);
+  ASSERT(upb_msgdef_isfrozen(m));
+  def = upb_fielddef_subdef(upb_msgdef_itof(m, 1));
+  ok = def == upb_symtab_lookup(s, "B");
+  ASSERT(ok);
+  ok = def == upb_symtab_resolve(s, "A", ".B");
+  ASSERT(ok);
+
+  upb_symtab_begin(&i, s, UPB_DEF_ANY);
+  ASSERT(!upb_symtab_done(&i));
+
+  upb_symtab_free(s);
+  free(data);
+}
+
+/* Names nested inside messages must be qualified with the package and every
+ * enclosing message. */
+static void test_nested_names() {
+  upb_symtab *s = upb_symtab_new();
+  upb_status status = UPB_STATUS_INIT;
+  upb_filedef **files;
+  const upb_msgdef *m;
+  const upb_enumdef *e;
+  size_t len, i;
+  char *data = upb_readfile("upb/descriptor/descriptor.pb", &len);
+  ASSERT(data);
+
+  files = upb_loaddescriptor(data, len, &files, &status);
+  ASSERT(files);
+  for (i = 0; files[i]; i++) {
+    ASSERT(upb_symtab_addfile(s, files[i], &status));
+    upb_filedef_unref(files[i], &files);
+  }
+  upb_gfree(files);
+  free(data);
+
+  m = upb_symtab_lookupmsg(s, "google.protobuf.DescriptorProto.ExtensionRange");
+  ASSERT(m);
+  ASSERT(strcmp(upb_msgdef_fullname(m),
+                "google.protobuf.DescriptorProto.ExtensionRange") == 0);
+  e = upb_symtab_lookupenum(s, "google.protobuf.FieldDescriptorProto.Type");
+  ASSERT(e);
+  m = upb_symtab_lookupmsg(s, "google.protobuf.SourceCodeInfo.Location");
+  ASSERT(m);
+  ASSERT(!upb_symtab_lookupmsg(s, "ExtensionRange"));
+  ASSERT(!upb_symtab_lookupmsg(s, "DescriptorProto.ExtensionRange"));
+
+  upb_symtab_free(s);
+}
+
 static void test_cycles() {
   bool ok;
   upb_symtab *s = load_test_proto();
@@ -327,6 +562,85 @@ static void test_partial_freeze() {
   upb_msgdef_unref(m3, &m3);
 }
 
+static void test_refbatch() {
+  upb_refbatch batch;
+  upb_msgdef *m1 = upb_msgdef_newnamed("M1", &m1);
+  upb_msgdef *m2 = upb_msgdef_newnamed("M2", &m2);
+  upb_msgdef *m3 = upb_msgdef_newnamed("M3", &m3);
+  upb_def *defs[2];
+  bool ok;
+  int i;
+  defs[0] = upb_msgdef_upcast_mutable(m1);
+  defs[1] = upb_msgdef_upcast_mutable(m2);
+  ASSERT(upb_def_freeze(defs, 2, NULL));
+
+  /* More refs than fit in one batch, so the batch must flush itself. */
+  upb_refbatch_init(&batch);
+  for (i = 0; i < UPB_REFBATCH_SIZE + 8; i++) {
+    upb_msgdef_ref(m1, UPB_UNTRACKED_REF);
+    upb_msgdef_ref(m2, UPB_UNTRACKED_REF);
+  }
+  for (i = 0; i < UPB_REFBATCH_SIZE + 8; i++) {
+    upb_refbatch_unref(&batch, upb_msgdef_upcast2(m1), UPB_UNTRACKED_REF);
+    upb_refbatch_unref(&batch, upb_msgdef_upcast2(m2), UPB_UNTRACKED_REF);
+  }
+
+  /* Mutable objects are not deferred, so this frees m3 immediately. */
+  upb_refbatch_unref(&batch, upb_msgdef_upcast2(m3), &m3);
+
+  /* The last refs are deferred until the flush below. */
+  upb_refbatch_unref(&batch, upb_msgdef_upcast2(m1), &m1);
+  upb_refbatch_unref(&batch, upb_msgdef_upcast2(m2), &m2);
+  ok = strcmp("M1", upb_msgdef_fullname(m1)) == 0;
+  ASSERT(ok);
+
+  /* If the test leaked no memory, this freed m1 and m2. */
+  upb_refbatch_flush(&batch);
+}
+
+static void test_immortal() {
+  const upb_msgdef *d = upbdefs_google_protobuf_DescriptorProto_get(&d);
+  upb_msgdef *m1 = upb_msgdef_newnamed("M1", &m1);
+  upb_msgdef *m2 = upb_msgdef_newnamed("M2", &m2);
+  upb_fielddef *f = upb_fielddef_new(&f);
+  upb_def *defs[2];
+  bool ok;
+  defs[0] = upb_msgdef_upcast_mutable(m1);
+  defs[1] = upb_msgdef_upcast_mutable(m2);
+
+  /* Compiled-in defs are immortal. */
+  ASSERT(upb_refcounted_isimmortal(upb_msgdef_upcast2(d)));
+  ASSERT(upb_refcounted_makeimmortal(upb_msgdef_upcast2(d)));
+  upb_msgdef_unref(d, &d);
+
+  /* Put M1 and M2 in one group with a cycle, so both must be converted. */
+  upb_fielddef_settype(f, UPB_TYPE_MESSAGE);
+  ASSERT(upb_fielddef_setnumber(f, 1, NULL));
+  ASSERT(upb_fielddef_setname(f, "m2", NULL));
+  ASSERT(upb_fielddef_setmsgsubdef(f, m2, NULL));
+  ASSERT(upb_msgdef_addfield(m1, f, &f, NULL));
+  f = upb_fielddef_new(&f);
+  upb_fielddef_settype(f, UPB_TYPE_MESSAGE);
+  ASSERT(upb_fielddef_setnumber(f, 1, NULL));
+  ASSERT(upb_fielddef_setname(f, "m1", NULL));
+  ASSERT(upb_fielddef_setmsgsubdef(f, m1, NULL));
+  ASSERT(upb_msgdef_addfield(m2, f, &f, NULL));
+
+  ASSERT(!upb_refcounted_makeimmortal(upb_msgdef_upcast2(m1)));
+  ASSERT(upb_def_freeze(defs, 2, NULL));
+  ASSERT(!upb_refcounted_isimmortal(upb_msgdef_upcast2(m1)));
+  ASSERT(upb_refcounted_makeimmortal(upb_msgdef_upcast2(m1)));
+  ASSERT(upb_refcounted_isimmortal(upb_msgdef_upcast2(m1)));
+  ASSERT(upb_refcounted_isimmortal(upb_msgdef_upcast2(m2)));
+
+  /* Dropping the last refs does not free them.  They are deliberately leaked
+   * for the rest of the process. */
+  upb_msgdef_unref(m1, &m1);
+  upb_msgdef_unref(m2, &m2);
+  ok = strcmp("M2", upb_msgdef_fullname(m2)) == 0;
+  ASSERT(ok);
+}
+
 static void test_descriptor_flags() {
   upb_msgdef *m = upb_msgdef_new(&m);
   upb_status s = UPB_STATUS_INIT;
@@ -431,6 +745,7 @@ static void test_oneofs() {
   upb_oneofdef_unref(o, &o);
 }
 
+
 int run_tests(int argc, char *argv[]) {
   if (argc < 2) {
     fprintf(stderr, "Usage: test_def <test.proto.pb>\n");
@@ -438,6 +753,10 @@ int run_tests(int argc, char *argv[]) {
   }
   descriptor_file = argv[1];
   test_empty_symtab();
+  test_addfiles();
+  test_snapshot();
+  test_lazy();
+  test_nested_names();
   test_cycles();
   test_symbol_resolution();
   test_fielddef();
@@ -445,6 +764,8 @@ int run_tests(int argc, char *argv[]) {
   test_replacement_fails();
   test_freeze_free();
   test_partial_freeze();
+  test_refbatch();
+  test_immortal();
   test_noreftracking();
   test_descriptor_flags();
   test_mapentry_check();
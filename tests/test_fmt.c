@@ -0,0 +1,111 @@
+/*
+** Tests of the number formatting in upb/fmt.int.h.
+*/
+
+#include "upb/fmt.int.h"
+#include "upb_test.h"
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK_FMT(func, val, expected)   \
+  do {                                   \
+    char buf[UPB_FMT_BUFSIZE];           \
+    size_t len = func(val, buf);         \
+    if (strcmp(buf, expected) != 0) {    \
+      fprintf(stderr, "got %s\n", buf);  \
+    }                                    \
+    ASSERT(strcmp(buf, expected) == 0);  \
+    ASSERT(len == strlen(expected));     \
+  } while (0)
+
+static void test_double() {
+  CHECK_FMT(upb_fmt_double, 0.0, "0");
+  CHECK_FMT(upb_fmt_double, -0.0, "-0");
+  CHECK_FMT(upb_fmt_double, 1.0, "1");
+  CHECK_FMT(upb_fmt_double, -1.5, "-1.5");
+  CHECK_FMT(upb_fmt_double, 0.1, "0.1");
+  CHECK_FMT(upb_fmt_double, 0.3, "0.3");
+  CHECK_FMT(upb_fmt_double, 0.1 + 0.2, "0.30000000000000004");
+  CHECK_FMT(upb_fmt_double, 1.0 / 3, "0.3333333333333333");
+  CHECK_FMT(upb_fmt_double, 123456.789, "123456.789");
+  CHECK_FMT(upb_fmt_double, 0.0001, "0.0001");
+  CHECK_FMT(upb_fmt_double, 0.00001, "1e-05");
+  CHECK_FMT(upb_fmt_double, 1e16, "10000000000000000");
+  CHECK_FMT(upb_fmt_double, 1e17, "1e+17");
+  CHECK_FMT(upb_fmt_double, 1.5e300, "1.5e+300");
+  CHECK_FMT(upb_fmt_double, 9007199254740993.0, "9007199254740992");
+  CHECK_FMT(upb_fmt_double, DBL_MAX, "1.7976931348623157e+308");
+  CHECK_FMT(upb_fmt_double, DBL_MIN, "2.2250738585072014e-308");
+  CHECK_FMT(upb_fmt_double, 5e-324, "5e-324");
+  CHECK_FMT(upb_fmt_double, 1.0 / 0.0, "inf");
+  CHECK_FMT(upb_fmt_double, -1.0 / 0.0, "-inf");
+}
+
+static void test_float() {
+  CHECK_FMT(upb_fmt_float, 0.0f, "0");
+  CHECK_FMT(upb_fmt_float, 0.1f, "0.1");
+  CHECK_FMT(upb_fmt_float, 1.2345678f, "1.2345678");
+  CHECK_FMT(upb_fmt_float, 16777216.0f, "16777216");
+  CHECK_FMT(upb_fmt_float, 1e9f, "1e+09");
+  CHECK_FMT(upb_fmt_float, FLT_MAX, "3.4028235e+38");
+  CHECK_FMT(upb_fmt_float, FLT_MIN, "1.1754944e-38");
+  CHECK_FMT(upb_fmt_float, 1e-45f, "1e-45");
+}
+
+static void test_int() {
+  CHECK_FMT(upb_fmt_int64, 0, "0");
+  CHECK_FMT(upb_fmt_int64, 7, "7");
+  CHECK_FMT(upb_fmt_int64, -42, "-42");
+  CHECK_FMT(upb_fmt_int64, 1234567890, "1234567890");
+  CHECK_FMT(upb_fmt_int64, INT64_MAX, "9223372036854775807");
+  CHECK_FMT(upb_fmt_int64, INT64_MIN, "-9223372036854775808");
+  CHECK_FMT(upb_fmt_uint64, 100, "100");
+  CHECK_FMT(upb_fmt_uint64, UINT64_MAX, "18446744073709551615");
+}
+
+/* Every finite double must parse back to itself, and one digit less must not
+ * be enough.  Random bits are nearly always printed in scientific notation,
+ * where the digits are easy to count. */
+static void test_roundtrip() {
+  uint64_t state = 88172645463325252ULL;
+  int i;
+
+  for (i = 0; i < 100000; i++) {
+    char buf[UPB_FMT_BUFSIZE];
+    char shorter[UPB_FMT_BUFSIZE];
+    double val;
+    int digits = 0;
+    const char *p;
+
+    /* xorshift64 */
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    memcpy(&val, &state, sizeof(val));
+    if (val != val || val - val != 0) continue;
+
+    upb_fmt_double(val, buf);
+    ASSERT(strtod(buf, NULL) == val);
+
+    if (!strchr(buf, 'e')) continue;
+    for (p = buf; *p != 'e'; p++) {
+      if (*p >= '0' && *p <= '9') digits++;
+    }
+    if (digits > 1) {
+      _upb_snprintf(shorter, sizeof(shorter), "%.*e", digits - 2, val);
+      ASSERT(strtod(shorter, NULL) != val);
+    }
+  }
+}
+
+int run_tests(int argc, char *argv[]) {
+  UPB_UNUSED(argc);
+  UPB_UNUSED(argv);
+  test_double();
+  test_float();
+  test_int();
+  test_roundtrip();
+  return 0;
+}
@@ -33,9 +33,92 @@ static void test_error() {
   upb_handlers_unref(h, &h);
 }
 
+static bool setnumber(void *c, const void *hd, int32_t val) {
+  UPB_UNUSED(c);
+  UPB_UNUSED(hd);
+  UPB_UNUSED(val);
+  return true;
+}
+
+static void *startstr(void *c, const void *hd, size_t size_hint) {
+  UPB_UNUSED(hd);
+  UPB_UNUSED(size_hint);
+  return c;
+}
+
+static void test_store() {
+  const upb_msgdef *m = upbdefs_google_protobuf_FieldDescriptorProto_get(&m);
+  upb_handlers *h = upb_handlers_new(m, &h);
+  const upb_fielddef *number =
+      upbdefs_google_protobuf_FieldDescriptorProto_f_number(m);
+  const upb_fielddef *name =
+      upbdefs_google_protobuf_FieldDescriptorProto_f_name(m);
+  upb_handlerattr attr = UPB_HANDLERATTR_INITIALIZER;
+  upb_handlerattr got = UPB_HANDLERATTR_INITIALIZER;
+  upb_selector_t sel;
+  size_t offset;
+  int32_t hasbit;
+
+  ASSERT(!upb_handlerattr_store(&attr, &offset, &hasbit));
+  upb_handlerattr_setstore(&attr, 8, 3);
+
+  /* A store only makes sense for primitive values. */
+  upb_handlers_setstartstr(h, name, &startstr, &attr);
+  ASSERT(!upb_ok(upb_handlers_status(h)));
+  upb_handlers_clearerr(h);
+
+  ASSERT(upb_handlers_setint32(h, number, &setnumber, &attr));
+  ASSERT(upb_handlers_getselector(number, UPB_HANDLER_INT32, &sel));
+  ASSERT(upb_handlers_getattr(h, sel, &got));
+  ASSERT(upb_handlerattr_store(&got, &offset, &hasbit));
+  ASSERT(offset == 8);
+  ASSERT(hasbit == 3);
+
+  upb_msgdef_unref(m, &m);
+  upb_handlers_unref(h, &h);
+}
+
+static int handlers_built;
+
+static void sethandlers(const void *closure, upb_handlers *h) {
+  UPB_UNUSED(closure);
+  upb_handlers_setstartmsg(h, &startmsg, NULL);
+  handlers_built++;
+}
+
+static void test_handlercache() {
+  const upb_msgdef *m = upbdefs_google_protobuf_DescriptorProto_get(&m);
+  const upb_msgdef *fm = upbdefs_google_protobuf_FieldDescriptorProto_get(&fm);
+  const upb_fielddef *field =
+      upbdefs_google_protobuf_DescriptorProto_f_field(m);
+  upb_handlercache *c = upb_handlercache_new(&sethandlers, NULL);
+  const upb_handlers *h;
+  int built;
+
+  handlers_built = 0;
+  h = upb_handlercache_get(c, m);
+  ASSERT(h);
+  ASSERT(upb_handlers_isfrozen(h));
+  ASSERT(upb_handlers_msgdef(h) == m);
+  built = handlers_built;
+  ASSERT(built > 1);
+
+  /* Neither the same message nor one of its submessages is built again. */
+  ASSERT(upb_handlercache_get(c, m) == h);
+  ASSERT(upb_handlercache_get(c, fm) ==
+         upb_handlers_getsubhandlers(h, field));
+  ASSERT(handlers_built == built);
+
+  upb_handlercache_free(c);
+  upb_msgdef_unref(fm, &fm);
+  upb_msgdef_unref(m, &m);
+}
+
 int run_tests(int argc, char *argv[]) {
   UPB_UNUSED(argc);
   UPB_UNUSED(argv);
   test_error();
+  test_store();
+  test_handlercache();
   return 0;
 }
@@ -0,0 +1,1883 @@
+/*
+** Tests of upb_msg, upb_decode() and upb_encode(), on the layouts that a
+** upb_msgfactory builds from defs.
+*/
+
+#include "tests/test_util.h"
+#include "upb/decode.h"
+#include "upb/def.h"
+#include "upb/encode.h"
+#include "upb/msg.h"
+#include "upb/pb/decoder.h"
+#include "upb/pb/encoder.h"
+#include "upb/pb/glue.h"
+#include "upb/trace.h"
+#include "upb_test.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DESCRIPTOR_PB "upb/descriptor/descriptor.pb"
+
+const char *descriptor_file;
+
+/* Loads the defs from the serialized FileDescriptorSet |filename|. */
+static upb_symtab *load_proto(const char *filename) {
+  upb_symtab *s = upb_symtab_new();
+  upb_status status = UPB_STATUS_INIT;
+  size_t len, i;
+  char *data = upb_readfile(filename, &len);
+  upb_filedef **files;
+  ASSERT(s);
+  ASSERT(data);
+  files = upb_loaddescriptor(data, len, &files, &status);
+  ASSERT(files);
+  free(data);
+
+  for (i = 0; files[i]; i++) {
+    ASSERT(upb_symtab_addfile(s, files[i], &status));
+    upb_filedef_unref(files[i], &files);
+  }
+  upb_gfree(files);
+
+  return s;
+}
+
+/* The layout of message |name| from |factory|'s symtab. */
+static const upb_msglayout *getlayout(upb_msgfactory *factory,
+                                      const char *name) {
+  const upb_msgdef *m =
+      upb_symtab_lookupmsg(upb_msgfactory_symtab(factory), name);
+  ASSERT(m);
+  return upb_msgfactory_getlayout(factory, m);
+}
+
+/* Checks that upb_encode(), an encode plan and upb_encode_size() all agree
+ * that |msg| encodes as |want|. */
+static void checkencode(const upb_msg *msg, const upb_msglayout *layout,
+                        upb_env *env, const char *want, size_t want_len) {
+  const upb_msglayout_msginit_v1 *l = (const upb_msglayout_msginit_v1*)layout;
+  upb_encodeplan *plan = upb_encodeplan_new(l, &upb_alloc_global);
+  size_t len;
+  char *out = upb_encode(msg, l, env, &len);
+  ASSERT(out && len == want_len && memcmp(out, want, len) == 0);
+  ASSERT(upb_encode_size(msg, l) == want_len);
+
+  ASSERT(plan);
+  out = upb_encode_withplan(msg, plan, env, &len);
+  ASSERT(out && len == want_len && memcmp(out, want, len) == 0);
+  upb_encodeplan_free(plan);
+}
+
+#define CHECKENCODE(msg, layout, want) \
+    checkencode(msg, layout, &env, want, sizeof(want) - 1)
+
+typedef struct {
+  upb_traceevent ev[4];
+  int count;
+} traces;
+
+static void record_trace(void *ud, const upb_traceevent *ev) {
+  traces *t = ud;
+  if (t->count < 4) t->ev[t->count] = *ev;
+  t->count++;
+}
+
+/* Layouts loaded straight from the descriptor must match the ones the
+ * msgfactory builds from defs. */
+static void test_layouts() {
+  const char *names[] = {"A", "C", "Extendable", "SimplePrimitives",
+                         "SimplePrimitives.Nested"};
+  /* u32: 1, str: "abc", oneof_int32: 5 */
+  const char pb[] = "\x15\x01\x00\x00\x00" "\x4a\x03" "abc" "\x50\x05";
+  const char pb2[] =
+      "\x15\x01\x00\x00\x00" "\x4a\x03" "abc" "\x50\x05" "\x78\x01";
+  upb_decodeopts opts = UPB_DECODEOPTS_INITIALIZER;
+  upb_decstats stats;
+  traces t;
+  bool tracing;
+  upb_symtab *s = load_proto(descriptor_file);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  upb_status status = UPB_STATUS_INIT;
+  upb_layoutset *set;
+  upb_env env;
+  const upb_msglayout_msginit_v1 *l;
+  void *msg;
+  char *out;
+  size_t len, i;
+  int j;
+  char *data = upb_readfile(descriptor_file, &len);
+  ASSERT(data);
+
+  set = upb_loadlayouts(data, len, &status);
+  ASSERT(set);
+  free(data);
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    const upb_msglayout_msginit_v1 *want =
+        (const upb_msglayout_msginit_v1*)getlayout(factory, names[i]);
+    l = upb_layoutset_lookup(set, names[i]);
+    ASSERT(l);
+    ASSERT(l->size == want->size);
+    ASSERT(l->field_count == want->field_count);
+    ASSERT(l->oneof_count == want->oneof_count);
+    ASSERT(l->is_proto2 == want->is_proto2);
+    ASSERT(l->extendable == want->extendable);
+    ASSERT(l->extendable == !strcmp(names[i], "Extendable"));
+    ASSERT(l->hasbit_bytes == want->hasbit_bytes);
+    for (j = 0; j < l->field_count; j++) {
+      ASSERT(l->fields[j].number == want->fields[j].number);
+      ASSERT(l->fields[j].offset == want->fields[j].offset);
+      ASSERT(l->fields[j].hasbit == want->fields[j].hasbit);
+      ASSERT(l->fields[j].oneof_index == want->fields[j].oneof_index);
+      ASSERT(l->fields[j].type == want->fields[j].type);
+      ASSERT(l->fields[j].label == want->fields[j].label);
+    }
+    for (j = 0; j < l->oneof_count; j++) {
+      ASSERT(l->oneofs[j].case_offset == want->oneofs[j].case_offset);
+      ASSERT(l->oneofs[j].data_offset == want->oneofs[j].data_offset);
+    }
+  }
+
+  l = upb_layoutset_lookup(set, "A");
+  ASSERT(l->submsgs[l->fields[0].submsg_index] ==
+         upb_layoutset_lookup(set, "B"));
+  ASSERT(!upb_layoutset_lookup(set, "NoSuchMessage"));
+
+  /* The layouts are all that upb_decode() and upb_encode() need. */
+  upb_env_init(&env);
+  l = upb_layoutset_lookup(set, "SimplePrimitives");
+  msg = upb_msg_new((const upb_msglayout*)l,
+                    upb_arena_alloc(upb_env_arena(&env)));
+  t.count = 0;
+  tracing = upb_settrace(record_trace, &t);
+  ASSERT(upb_decode(upb_stringview_make(pb, sizeof(pb) - 1), msg, l, &env));
+  out = upb_encode(msg, l, &env, &len);
+  ASSERT(out && len == sizeof(pb) - 1 && memcmp(out, pb, len) == 0);
+  upb_settrace(NULL, NULL);
+
+  if (tracing) {
+    ASSERT(t.count == 4);
+    ASSERT(t.ev[0].source == UPB_TRACE_DECODE && !t.ev[0].end);
+    ASSERT(t.ev[1].source == UPB_TRACE_DECODE && t.ev[1].end && t.ev[1].ok);
+    ASSERT(t.ev[1].layout == l && t.ev[1].bytes == len);
+    ASSERT(t.ev[1].time_ns >= t.ev[0].time_ns);
+    ASSERT(t.ev[2].source == UPB_TRACE_ENCODE && !t.ev[2].end);
+    ASSERT(t.ev[3].source == UPB_TRACE_ENCODE && t.ev[3].end && t.ev[3].ok);
+    ASSERT(t.ev[3].bytes == len && !t.ev[3].md);
+  } else {
+    ASSERT(t.count == 0);
+  }
+
+  /* The same input plus an unknown field 15, counted. */
+  upb_decstats_clear(&stats);
+  opts.stats = &stats;
+  msg = upb_msg_new((const upb_msglayout*)l,
+                    upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(upb_decode2(upb_stringview_make(pb2, sizeof(pb2) - 1), msg, l, &env,
+                     &opts));
+  ASSERT(stats.bytes == sizeof(pb2) - 1);
+  ASSERT(stats.fields == 3);
+  ASSERT(stats.unknown_fields == 1);
+  ASSERT(stats.tag_hits + stats.dispatch_lookups == 4);
+  ASSERT(stats.suspends == 0 && stats.max_depth == 0);
+  upb_env_uninit(&env);
+
+  ASSERT(!upb_loadlayouts("\x0a\x05x", 3, &status));
+
+  upb_layoutset_free(set);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(s);
+}
+
+static const char array_strs[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+/* The |i|th test value for an array of |type|. */
+static upb_msgval arrayval(upb_fieldtype_t type, size_t i) {
+  switch (type) {
+    case UPB_TYPE_BOOL: return upb_msgval_bool(i % 3 == 0);
+    case UPB_TYPE_INT32: return upb_msgval_int32(-(int32_t)i * 3);
+    case UPB_TYPE_INT64: return upb_msgval_int64((int64_t)i << 40);
+    case UPB_TYPE_DOUBLE: return upb_msgval_double(i * 0.5);
+    case UPB_TYPE_STRING: return upb_msgval_makestr(array_strs + i % 30, i % 7);
+    default: return upb_msgval_msg((const upb_msg*)(array_strs + i % 30));
+  }
+}
+
+static bool arrayvaleq(upb_fieldtype_t type, upb_msgval v, size_t i) {
+  upb_msgval want = arrayval(type, i);
+  switch (type) {
+    case UPB_TYPE_BOOL: return v.b == want.b;
+    case UPB_TYPE_INT32: return v.i32 == want.i32;
+    case UPB_TYPE_INT64: return v.i64 == want.i64;
+    case UPB_TYPE_DOUBLE: return v.dbl == want.dbl;
+    case UPB_TYPE_STRING:
+      return v.str.data == want.str.data && v.str.size == want.str.size;
+    default: return v.msg == want.msg;
+  }
+}
+
+static bool isinline(const upb_array *arr) {
+  const char *data = upb_array_data(arr);
+  return data >= (const char*)arr &&
+         data < (const char*)arr + upb_array_sizeof(upb_array_type(arr));
+}
+
+/* Appends to an array of |type| across the move out of its inline storage,
+ * and reserves room in one both before and after the move. */
+static void checkarray(upb_fieldtype_t type, upb_alloc *a) {
+  upb_array *arr = upb_array_new(type, a);
+  const void *data;
+  size_t i, j;
+  size_t inline_size = 0;
+
+  /* Starts inline, with room for at least one element. */
+  ASSERT(arr && isinline(arr) && upb_array_size(arr) == 0);
+  for (i = 0; i < 40; i++) {
+    ASSERT(upb_array_set(arr, i, arrayval(type, i)));
+    ASSERT(upb_array_size(arr) == i + 1);
+    if (isinline(arr)) {
+      ASSERT(inline_size == i);
+      inline_size++;
+    }
+    for (j = 0; j <= i; j++) {
+      ASSERT(arrayvaleq(type, upb_array_get(arr, j), j));
+    }
+  }
+  ASSERT(inline_size >= (type == UPB_TYPE_BOOL || type == UPB_TYPE_INT32 ?
+                         2 : 1));
+  ASSERT(!isinline(arr));
+
+  /* Overwriting doesn't move anything. */
+  data = upb_array_data(arr);
+  ASSERT(upb_array_set(arr, 0, arrayval(type, 1)));
+  ASSERT(arrayvaleq(type, upb_array_get(arr, 0), 1));
+  ASSERT(upb_array_data(arr) == data);
+  upb_array_free(arr);
+
+  /* Reserving what fits inline keeps it there. */
+  arr = upb_array_new(type, a);
+  ASSERT(arr);
+  ASSERT(upb_array_reserve(arr, inline_size));
+  ASSERT(isinline(arr));
+  for (i = 0; i < inline_size; i++) {
+    ASSERT(upb_array_set(arr, i, arrayval(type, i)));
+  }
+  ASSERT(isinline(arr));
+
+  /* Reserving more moves the elements out, once. */
+  ASSERT(upb_array_reserve(arr, 100));
+  ASSERT(!isinline(arr));
+  data = upb_array_data(arr);
+  for (i = 0; i < inline_size; i++) {
+    ASSERT(arrayvaleq(type, upb_array_get(arr, i), i));
+  }
+  for (i = inline_size; i < 100; i++) {
+    ASSERT(upb_array_set(arr, i, arrayval(type, i)));
+  }
+  ASSERT(upb_array_data(arr) == data);
+  ASSERT(upb_array_reserve(arr, 50) && upb_array_data(arr) == data);
+
+  /* And growing the heap storage keeps them too. */
+  ASSERT(upb_array_reserve(arr, 1000));
+  for (i = 0; i < 100; i++) {
+    ASSERT(arrayvaleq(type, upb_array_get(arr, i), i));
+  }
+  upb_array_free(arr);
+}
+
+static void test_array_storage() {
+  static const upb_fieldtype_t types[] = {
+    UPB_TYPE_BOOL, UPB_TYPE_INT32, UPB_TYPE_INT64, UPB_TYPE_DOUBLE,
+    UPB_TYPE_STRING, UPB_TYPE_MESSAGE
+  };
+  upb_arena arena;
+  size_t i;
+  upb_arena_init(&arena);
+
+  for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    checkarray(types[i], &upb_alloc_global);
+    checkarray(types[i], upb_arena_alloc(&arena));
+  }
+
+  upb_arena_uninit(&arena);
+}
+
+static upb_msg *decodecopy(const char *pb, size_t len,
+                           const upb_msglayout *l, bool lazy, upb_env *env) {
+  upb_decodeopts opts = UPB_DECODEOPTS_INITIALIZER;
+  upb_msg *msg = upb_msg_new(l, upb_arena_alloc(upb_env_arena(env)));
+  /* A copy of the input, so the strings of messages don't share memory. */
+  char *buf = upb_env_malloc(env, len);
+  ASSERT(msg && (buf || len == 0));
+  memcpy(buf, pb, len);
+  opts.lazy = lazy;
+  ASSERT(upb_decode2(upb_stringview_make(buf, len), msg,
+                     (const upb_msglayout_msginit_v1*)l, env, &opts));
+  return msg;
+}
+
+#define DECODE(pb, layout, lazy) \
+    decodecopy(pb, sizeof(pb) - 1, layout, lazy, &env)
+
+static void test_msg_equal() {
+  /* u32: 1, str: "abc", oneof_int32: 5, in two orders. */
+  const char pb[] = "\x15\x01\x00\x00\x00" "\x4a\x03" "abc" "\x50\x05";
+  const char reordered[] = "\x50\x05" "\x4a\x03" "abc" "\x15\x01\x00\x00\x00";
+  const char otherstr[] = "\x15\x01\x00\x00\x00" "\x4a\x03" "abd" "\x50\x05";
+  const char otherlen[] = "\x15\x01\x00\x00\x00" "\x4a\x02" "ab" "\x50\x05";
+  /* oneof_string: "\x05" instead of oneof_int32: 5. */
+  const char otheroneof[] =
+      "\x15\x01\x00\x00\x00" "\x4a\x03" "abc" "\x5a\x01\x05";
+  /* u32 set to its default, which still counts as set. */
+  const char zero[] = "\x15\x00\x00\x00\x00" "\x4a\x03" "abc" "\x50\x05";
+  const char nou32[] = "\x4a\x03" "abc" "\x50\x05";
+  /* With unknown fields 15 and 16. */
+  const char unknown[] =
+      "\x15\x01\x00\x00\x00" "\x4a\x03" "abc" "\x50\x05" "\x78\x01"
+      "\x80\x01\x02";
+  const char unknown_apart[] =
+      "\x78\x01" "\x15\x01\x00\x00\x00" "\x4a\x03" "abc" "\x80\x01\x02"
+      "\x50\x05";
+  /* A { b { c { b { } } } } and A { b { c { } } } */
+  const char nested[] = "\x0a\x06\x12\x04\x12\x02\x12\x00";
+  const char nested2[] = "\x0a\x04\x12\x02\x12\x00";
+  upb_symtab *s = load_proto(descriptor_file);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  const upb_msglayout *l;
+  upb_env env;
+  upb_msg *msg;
+  upb_msg *copy;
+  upb_env_init(&env);
+
+  l = getlayout(factory, "SimplePrimitives");
+  msg = DECODE(pb, l, false);
+  ASSERT(upb_msg_equal(msg, msg, l));
+  ASSERT(upb_msg_equal(msg, DECODE(pb, l, false), l));
+  ASSERT(upb_msg_hash(msg, l) == upb_msg_hash(DECODE(pb, l, false), l));
+  ASSERT(upb_msg_equal(msg, DECODE(reordered, l, false), l));
+  ASSERT(upb_msg_hash(msg, l) == upb_msg_hash(DECODE(reordered, l, false), l));
+  ASSERT(!upb_msg_equal(msg, DECODE(otherstr, l, false), l));
+  ASSERT(!upb_msg_equal(msg, DECODE(otherlen, l, false), l));
+  ASSERT(!upb_msg_equal(msg, DECODE(otheroneof, l, false), l));
+  ASSERT(!upb_msg_equal(msg, DECODE(zero, l, false), l));
+  ASSERT(!upb_msg_equal(DECODE(zero, l, false), DECODE(nou32, l, false), l));
+  ASSERT(upb_msg_hash(msg, l) != upb_msg_hash(DECODE(otherstr, l, false), l));
+  ASSERT(upb_msg_hash(DECODE(zero, l, false), l) !=
+         upb_msg_hash(DECODE(nou32, l, false), l));
+
+  /* Unknown fields count, however they are split up. */
+  ASSERT(!upb_msg_equal(msg, DECODE(unknown, l, false), l));
+  ASSERT(upb_msg_equal(DECODE(unknown, l, false),
+                       DECODE(unknown_apart, l, false), l));
+  ASSERT(upb_msg_hash(DECODE(unknown, l, false), l) ==
+         upb_msg_hash(DECODE(unknown_apart, l, false), l));
+
+  /* Copies are equal, whether or not they share strings. */
+  copy = upb_msg_copy(msg, l, true, upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(upb_msg_equal(msg, copy, l));
+  copy = upb_msg_copy(msg, l, false, upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(upb_msg_equal(msg, copy, l));
+  ASSERT(upb_msg_hash(msg, l) == upb_msg_hash(copy, l));
+  upb_msg_set(copy, 1, upb_msgval_uint32(2), l);
+  ASSERT(!upb_msg_equal(msg, copy, l));
+
+  /* Submessages compare by contents, whether or not they were parsed
+   * lazily. */
+  l = getlayout(factory, "A");
+  msg = DECODE(nested, l, false);
+  ASSERT(upb_msg_equal(msg, DECODE(nested, l, false), l));
+  ASSERT(upb_msg_equal(msg, DECODE(nested, l, true), l));
+  ASSERT(upb_msg_equal(DECODE(nested, l, true), DECODE(nested, l, true), l));
+  ASSERT(upb_msg_hash(msg, l) == upb_msg_hash(DECODE(nested, l, true), l));
+  ASSERT(!upb_msg_equal(msg, DECODE(nested2, l, false), l));
+  ASSERT(!upb_msg_equal(DECODE(nested, l, true), DECODE(nested2, l, true), l));
+  ASSERT(upb_msg_hash(msg, l) != upb_msg_hash(DECODE(nested2, l, false), l));
+  copy = upb_msg_new(l, upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(!upb_msg_equal(msg, copy, l));
+  ASSERT(upb_msg_equal(copy, DECODE("", l, false), l));
+
+  upb_env_uninit(&env);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(s);
+}
+
+#undef DECODE
+
+#define DECODE(pb, layout) \
+    decodecopy(pb, sizeof(pb) - 1, layout, false, &env)
+
+static void test_msg_clear() {
+  /* FileDescriptorProto { name: "a", message_type { name: "M", field {
+   * name: "x" } }, message_type { name: "N" }, options { java_package: "p" }
+   * } with unknown field 15. */
+  const char pb[] =
+      "\x0a\x01" "a" "\x22\x08\x0a\x01" "M" "\x12\x03\x0a\x01" "x"
+      "\x22\x03\x0a\x01" "N" "\x42\x03\x0a\x01" "p" "\x78\x01";
+  const char smaller[] = "\x22\x03\x0a\x01" "O" "\x42\x03\x0a\x01" "q";
+  const char bigger[] =
+      "\x22\x03\x0a\x01" "P" "\x22\x03\x0a\x01" "Q" "\x22\x03\x0a\x01" "R";
+  upb_symtab *s = load_proto(DESCRIPTOR_PB);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  const upb_msgdef *m;
+  const upb_msglayout *l;
+  int name, message_type, options;
+  upb_decodeopts opts = UPB_DECODEOPTS_INITIALIZER;
+  upb_env env;
+  upb_msg *msg;
+  const upb_array *types;
+  const upb_msg *type0;
+  const upb_msg *type1;
+  const upb_msg *opts_msg;
+  size_t bytes;
+  upb_env_init(&env);
+  m = upb_symtab_lookupmsg(s, "google.protobuf.FileDescriptorProto");
+  l = upb_msgfactory_getlayout(factory, m);
+  name = upb_fielddef_index(upb_msgdef_ntofz(m, "name"));
+  message_type = upb_fielddef_index(upb_msgdef_ntofz(m, "message_type"));
+  options = upb_fielddef_index(upb_msgdef_ntofz(m, "options"));
+
+  msg = DECODE(pb, l);
+  types = upb_msgval_getarr(upb_msg_get(msg, message_type, l));
+  type0 = upb_msgval_getmsg(upb_array_get(types, 0));
+  type1 = upb_msgval_getmsg(upb_array_get(types, 1));
+  opts_msg = upb_msgval_getmsg(upb_msg_get(msg, options, l));
+
+  /* Nothing is left set, but the submessage and array are still there. */
+  upb_msg_clear(msg, l);
+  ASSERT(!upb_msg_has(msg, name, l) && !upb_msg_has(msg, options, l));
+  ASSERT(upb_msgval_getmsg(upb_msg_get(msg, options, l)) == opts_msg);
+  ASSERT(upb_msgval_getarr(upb_msg_get(msg, message_type, l)) == types);
+  ASSERT(upb_array_size(types) == 0);
+  ASSERT(upb_msg_equal(msg, DECODE("", l), l));
+  ASSERT(upb_encode_size(msg, (const upb_msglayout_msginit_v1*)l) == 0);
+
+  /* Decoding something no bigger allocates nothing. */
+  bytes = upb_arena_bytesallocated(upb_env_arena(&env));
+  ASSERT(upb_decode2(upb_stringview_make(smaller, sizeof(smaller) - 1), msg,
+                     (const upb_msglayout_msginit_v1*)l, &env, &opts));
+  ASSERT(upb_arena_bytesallocated(upb_env_arena(&env)) == bytes);
+  ASSERT(upb_msgval_getmsg(upb_array_get(types, 0)) == type0);
+  ASSERT(upb_msgval_getmsg(upb_msg_get(msg, options, l)) == opts_msg);
+  ASSERT(upb_msg_has(msg, options, l) && !upb_msg_has(msg, name, l));
+  ASSERT(upb_msg_equal(msg, DECODE(smaller, l), l));
+
+  /* Something bigger reuses what there is and allocates the rest. */
+  upb_msg_clear(msg, l);
+  ASSERT(upb_decode2(upb_stringview_make(bigger, sizeof(bigger) - 1), msg,
+                     (const upb_msglayout_msginit_v1*)l, &env, &opts));
+  ASSERT(upb_array_size(types) == 3);
+  ASSERT(upb_msgval_getmsg(upb_array_get(types, 0)) == type0);
+  ASSERT(upb_msgval_getmsg(upb_array_get(types, 1)) == type1);
+  ASSERT(!upb_msg_has(msg, options, l));
+  ASSERT(upb_msg_equal(msg, DECODE(bigger, l), l));
+  ASSERT(upb_encode_size(msg, (const upb_msglayout_msginit_v1*)l) ==
+         sizeof(bigger) - 1);
+
+  upb_env_uninit(&env);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(s);
+}
+
+#undef DECODE
+
+/* Merges |from_pb| into a message decoded from |to_pb|, both ways of
+ * sharing strings, and checks it against the decode of both concatenated.
+ * |shares| says whether the result keeps any of |from_pb|'s strings. */
+static void checkmerge(const char *to_pb, size_t to_len, const char *from_pb,
+                       size_t from_len, bool shares, const upb_msglayout *l,
+                       upb_env *env) {
+  const upb_msglayout_msginit_v1 *ml = (const upb_msglayout_msginit_v1*)l;
+  char *concat = upb_env_malloc(env, to_len + from_len + 1);
+  upb_msg *want;
+  int share;
+  ASSERT(concat);
+  memcpy(concat, to_pb, to_len);
+  memcpy(concat + to_len, from_pb, from_len);
+  want = decodecopy(concat, to_len + from_len, l, false, env);
+
+  for (share = 0; share < 2; share++) {
+    upb_msg *to = decodecopy(to_pb, to_len, l, false, env);
+    upb_msg *from = upb_msg_new(l, upb_arena_alloc(upb_env_arena(env)));
+    char *buf = upb_env_malloc(env, from_len + 1);
+    ASSERT(from && buf);
+    memcpy(buf, from_pb, from_len);
+    ASSERT(upb_decode(upb_stringview_make(buf, from_len), from, ml, env));
+
+    ASSERT(upb_msg_merge(to, from, l, share));
+    ASSERT(upb_msg_equal(to, want, l));
+    ASSERT(upb_encode_size(to, ml) == upb_encode_size(want, ml));
+
+    /* Only a shared string sees the source change. */
+    memset(buf, 'z', from_len);
+    ASSERT(upb_msg_equal(to, want, l) == !(share && shares));
+  }
+}
+
+#define CHECKMERGE(to, from, shares, layout) \
+    checkmerge(to, sizeof(to) - 1, from, sizeof(from) - 1, shares, layout, \
+               &env)
+
+static void test_msg_merge() {
+  /* FileDescriptorProto { name: "a", dependency: "a", message_type {
+   * name: "M" }, options { java_package: "p" } } with unknown field 15. */
+  const char file[] =
+      "\x0a\x01" "a" "\x1a\x01" "a" "\x22\x03\x0a\x01" "M"
+      "\x42\x03\x0a\x01" "p" "\x78\x01";
+  /* Repeated fields and unknown fields are appended, the name overwritten
+   * and options merged: { name: "b", dependency: "b", dependency: "c",
+   * message_type { name: "N" }, options { java_outer_classname: "q" } }
+   * with unknown field 15. */
+  const char more[] =
+      "\x0a\x01" "b" "\x1a\x01" "b" "\x1a\x01" "c" "\x22\x03\x0a\x01" "N"
+      "\x42\x03\x42\x01" "q" "\x78\x02";
+  /* Only options { java_package: "r" }, overwriting the submessage's
+   * field. */
+  const char options[] = "\x42\x03\x0a\x01" "r";
+  /* SimplePrimitives: str: "s", oneof_int32: 5, oneof_bytes: "x". */
+  const char prims[] = "\x4a\x01" "s" "\x50\x05" "\x72\x01" "x";
+  /* oneof_string: "abc", oneof_int64: 9, switching both cases. */
+  const char switched[] = "\x5a\x03" "abc" "\x68\x09";
+  /* oneof_int32: 7, switching back without strings. */
+  const char back[] = "\x50\x07";
+  upb_symtab *s = load_proto(DESCRIPTOR_PB);
+  upb_symtab *ts = load_proto(descriptor_file);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  upb_msgfactory *tfactory = upb_msgfactory_new(ts);
+  const upb_msglayout *l =
+      getlayout(factory, "google.protobuf.FileDescriptorProto");
+  const upb_msglayout *pl = getlayout(tfactory, "SimplePrimitives");
+  upb_env env;
+  upb_env_init(&env);
+
+  CHECKMERGE(file, more, true, l);
+  CHECKMERGE(more, file, true, l);
+  CHECKMERGE(file, options, true, l);
+  CHECKMERGE("", file, true, l);
+  CHECKMERGE(file, "", false, l);
+
+  CHECKMERGE(prims, switched, true, pl);
+  CHECKMERGE(switched, prims, true, pl);
+  CHECKMERGE(switched, back, false, pl);
+  CHECKMERGE(prims, prims, true, pl);
+
+  upb_env_uninit(&env);
+  upb_msgfactory_free(tfactory);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(ts);
+  upb_symtab_free(s);
+}
+
+#undef CHECKMERGE
+
+static void test_msg_freeze() {
+  /* FileDescriptorProto { name: "a", dependency: "d1", dependency: "d2",
+   * message_type { name: "M", field { name: "x" } }, message_type {
+   * name: "N" }, options { java_package: "p" } }. */
+  const char pb[] =
+      "\x0a\x01" "a" "\x1a\x02" "d1" "\x1a\x02" "d2"
+      "\x22\x08\x0a\x01" "M" "\x12\x03\x0a\x01" "x"
+      "\x22\x03\x0a\x01" "N" "\x42\x03\x0a\x01" "p";
+  upb_symtab *s = load_proto(DESCRIPTOR_PB);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  const upb_msgdef *m;
+  const upb_msglayout *l;
+  const upb_msglayout *typel;
+  const upb_msglayout *fieldl;
+  const upb_msglayout *optionsl;
+  upb_env env;
+  upb_msg *msg;
+  const upb_msg *root;
+  const upb_msg *type;
+  upb_stringview str;
+  char input[sizeof(pb) - 1];
+  char *frozen;
+  char *moved;
+  size_t size;
+  int lazy;
+  int name, dependency, message_type, options;
+  int type_name, type_field, field_name, java_package;
+  upb_env_init(&env);
+  m = upb_symtab_lookupmsg(s, "google.protobuf.FileDescriptorProto");
+  l = upb_msgfactory_getlayout(factory, m);
+  typel = getlayout(factory, "google.protobuf.DescriptorProto");
+  fieldl = getlayout(factory, "google.protobuf.FieldDescriptorProto");
+  optionsl = getlayout(factory, "google.protobuf.FileOptions");
+  name = upb_fielddef_index(upb_msgdef_ntofz(m, "name"));
+  dependency = upb_fielddef_index(upb_msgdef_ntofz(m, "dependency"));
+  message_type = upb_fielddef_index(upb_msgdef_ntofz(m, "message_type"));
+  options = upb_fielddef_index(upb_msgdef_ntofz(m, "options"));
+  type_name = upb_fielddef_index(upb_msgdef_ntofz(
+      upb_symtab_lookupmsg(s, "google.protobuf.DescriptorProto"), "name"));
+  type_field = upb_fielddef_index(upb_msgdef_ntofz(
+      upb_symtab_lookupmsg(s, "google.protobuf.DescriptorProto"), "field"));
+  field_name = upb_fielddef_index(upb_msgdef_ntofz(
+      upb_symtab_lookupmsg(s, "google.protobuf.FieldDescriptorProto"),
+      "name"));
+  java_package = upb_fielddef_index(upb_msgdef_ntofz(
+      upb_symtab_lookupmsg(s, "google.protobuf.FileOptions"),
+      "java_package"));
+
+  for (lazy = 0; lazy < 2; lazy++) {
+    upb_decodeopts opts = UPB_DECODEOPTS_INITIALIZER;
+    memcpy(input, pb, sizeof(input));
+    opts.lazy = lazy;
+    msg = upb_msg_new(l, upb_arena_alloc(upb_env_arena(&env)));
+    ASSERT(upb_decode2(upb_stringview_make(input, sizeof(input)), msg,
+                       (const upb_msglayout_msginit_v1*)l, &env, &opts));
+    frozen = upb_msg_freeze(msg, l, &env, &size);
+    ASSERT(frozen);
+
+    /* Nothing points back into the message or the input, or to where the
+     * buffer was. */
+    moved = malloc(size);
+    ASSERT(moved);
+    memcpy(moved, frozen, size);
+    memset(frozen, 0xff, size);
+    memset(input, 0, sizeof(input));
+    upb_msg_clear(msg, l);
+
+    ASSERT(!upb_frozen_root(moved, size - 1, l));
+    ASSERT(!upb_frozen_root(moved, size, typel));
+    root = upb_frozen_root(moved, size, l);
+    ASSERT(root);
+
+    ASSERT(upb_msg_has(root, name, l));
+    str = upb_msgval_getstr(upb_frozen_get(root, name, l));
+    ASSERT(str.size == 1 && memcmp(str.data, "a", 1) == 0);
+    ASSERT(upb_frozen_arraysize(root, dependency, l) == 2);
+    str = upb_msgval_getstr(upb_frozen_getelem(root, dependency, 1, l));
+    ASSERT(str.size == 2 && memcmp(str.data, "d2", 2) == 0);
+
+    ASSERT(upb_frozen_arraysize(root, message_type, l) == 2);
+    type = upb_msgval_getmsg(upb_frozen_getelem(root, message_type, 0, l));
+    str = upb_msgval_getstr(upb_frozen_get(type, type_name, typel));
+    ASSERT(str.size == 1 && memcmp(str.data, "M", 1) == 0);
+    ASSERT(upb_frozen_arraysize(type, type_field, typel) == 1);
+    str = upb_msgval_getstr(upb_frozen_get(
+        upb_msgval_getmsg(upb_frozen_getelem(type, type_field, 0, typel)),
+        field_name, fieldl));
+    ASSERT(str.size == 1 && memcmp(str.data, "x", 1) == 0);
+    type = upb_msgval_getmsg(upb_frozen_getelem(root, message_type, 1, l));
+    ASSERT(upb_frozen_arraysize(type, type_field, typel) == 0);
+
+    ASSERT(upb_msg_has(root, options, l));
+    str = upb_msgval_getstr(upb_frozen_get(
+        upb_msgval_getmsg(upb_frozen_get(root, options, l)),
+        java_package, optionsl));
+    ASSERT(str.size == 1 && memcmp(str.data, "p", 1) == 0);
+    free(moved);
+
+    /* A cleared submessage is still there, but not frozen. */
+    frozen = upb_msg_freeze(msg, l, &env, &size);
+    root = upb_frozen_root(frozen, size, l);
+    ASSERT(root);
+    ASSERT(!upb_msg_has(root, options, l));
+    ASSERT(!upb_msgval_getmsg(upb_frozen_get(root, options, l)));
+    ASSERT(upb_frozen_arraysize(root, message_type, l) == 0);
+  }
+
+  upb_env_uninit(&env);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(s);
+}
+
+/* A frozen msgfactory answers every lookup from what freezing created, and its
+ * merge handlers merge repeated submessages like upb_decode() does. */
+static void test_msgfactory_freeze() {
+  /* C { a { b { c { } } } b { b { } } e { e { } } a { b { b { } } } } */
+  const char pb[] =
+      "\x0a\x04\x0a\x02\x12\x00" "\x12\x02\x0a\x00" "\x22\x02\x0a\x00"
+      "\x0a\x04\x0a\x02\x0a\x00";
+  /* C { a { b { b { } c { } } } b { b { } } e { e { } } } */
+  const char merged[] =
+      "\x0a\x06\x0a\x04\x0a\x00\x12\x00" "\x12\x02\x0a\x00" "\x22\x02\x0a\x00";
+  upb_symtab *s = load_proto(descriptor_file);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  const upb_msgdef *m = upb_symtab_lookupmsg(s, "C");
+  const upb_msglayout *l = upb_msgfactory_getlayout(factory, m);
+  const upb_handlers *h;
+  const upb_pbdecodermethod *method;
+  upb_pbdecodermethodopts opts;
+  upb_pbdecoder *decoder;
+  upb_symtab_iter i;
+  upb_sink sink;
+  upb_env env;
+  upb_msg *msg;
+
+  ASSERT(!upb_msgfactory_isfrozen(factory));
+  ASSERT(upb_msgfactory_freeze(factory));
+  ASSERT(upb_msgfactory_isfrozen(factory));
+  ASSERT(upb_msgfactory_freeze(factory));
+
+  /* What was created before freezing is kept. */
+  ASSERT(upb_msgfactory_getlayout(factory, m) == l);
+
+  for (upb_symtab_begin(&i, s, UPB_DEF_MSG); !upb_symtab_done(&i);
+       upb_symtab_next(&i)) {
+    const upb_msgdef *md = upb_dyncast_msgdef(upb_symtab_iter_def(&i));
+    if (upb_msgdef_mapentry(md)) continue;
+    ASSERT(upb_msgfactory_getlayout(factory, md));
+    h = upb_msgfactory_getmergehandlers(factory, md);
+    ASSERT(h);
+    ASSERT(upb_msgfactory_getmergehandlers(factory, md) == h);
+    ASSERT(upb_msgfactory_getvisitorplan(factory, h));
+  }
+
+  h = upb_msgfactory_getmergehandlers(factory, m);
+  upb_pbdecodermethodopts_init(&opts, h);
+  method = upb_pbdecodermethod_new(&opts, &method);
+  ASSERT(method);
+
+  upb_env_init(&env);
+  msg = upb_msg_new(l, upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(msg);
+  upb_sink_reset(&sink, h, msg);
+  decoder = upb_pbdecoder_create(&env, method, &sink);
+  ASSERT(decoder);
+  ASSERT(upb_bufsrc_putbuf(pb, sizeof(pb) - 1, upb_pbdecoder_input(decoder)));
+  ASSERT(upb_msg_equal(msg,
+                       decodecopy(pb, sizeof(pb) - 1, l, false, &env), l));
+  ASSERT(upb_msg_equal(msg,
+                       decodecopy(merged, sizeof(merged) - 1, l, false, &env),
+                       l));
+
+  upb_env_uninit(&env);
+  upb_pbdecodermethod_unref(method, &method);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(s);
+}
+
+/* Decodes |pb| into a new message with upb_decodeopts.cache. */
+static upb_msg *decodecached(const char *pb, size_t len,
+                             const upb_msglayout *l, bool lazy,
+                             upb_env *env) {
+  upb_decodeopts opts = UPB_DECODEOPTS_INITIALIZER;
+  upb_msg *msg = upb_msg_new(l, upb_arena_alloc(upb_env_arena(env)));
+  opts.cache = true;
+  opts.lazy = lazy;
+  ASSERT(upb_decode2(upb_stringview_make(pb, len), msg,
+                     (const upb_msglayout_msginit_v1*)l, env, &opts));
+  return msg;
+}
+
+static upb_msg *getsubmsg(const upb_msg *msg, int field_index,
+                          const upb_msglayout *l) {
+  upb_msg *sub = (upb_msg*)upb_msgval_getmsg(upb_msg_get(msg, field_index, l));
+  ASSERT(sub);
+  return sub;
+}
+
+static void test_cached_encode() {
+  /* C { d: D { e: E {}, a: A {} }, b: B { c: C {}, b: B {} } }, with every
+   * message's fields out of order, so only the input bytes themselves come
+   * out the same. */
+  const char pb[] =
+      "\x1a\x04" "\x1a\x00" "\x0a\x00" "\x12\x04" "\x12\x00" "\x0a\x00";
+  /* After D.e.e is set, C and D are encoded again, but B still isn't. */
+  const char changed[] =
+      "\x12\x04" "\x12\x00" "\x0a\x00"
+      "\x1a\x06" "\x0a\x00" "\x1a\x02" "\x0a\x00";
+  /* And finally B too. */
+  const char canonical[] =
+      "\x12\x04" "\x0a\x00" "\x12\x00"
+      "\x1a\x06" "\x0a\x00" "\x1a\x02" "\x0a\x00";
+  upb_symtab *s = load_proto(descriptor_file);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  const upb_msglayout *c = getlayout(factory, "C");
+  const upb_msglayout *d = getlayout(factory, "D");
+  const upb_msglayout *el = getlayout(factory, "E");
+  upb_env env;
+  upb_alloc *a;
+  upb_msg *msg;
+  upb_msg *e;
+  int lazy;
+  upb_env_init(&env);
+  a = upb_arena_alloc(upb_env_arena(&env));
+
+  for (lazy = 0; lazy < 2; lazy++) {
+    msg = decodecached(pb, sizeof(pb) - 1, c, lazy, &env);
+    CHECKENCODE(msg, c, pb);
+
+    /* Reading doesn't change anything, even if it parses lazy fields. */
+    e = getsubmsg(getsubmsg(msg, 2, c), 2, d);
+    CHECKENCODE(msg, c, pb);
+
+    upb_msg_set(e, 0, upb_msgval_msg(upb_msg_new(el, a)), el);
+    CHECKENCODE(msg, c, changed);
+
+    upb_msg_markdirty(getsubmsg(msg, 1, c));
+    CHECKENCODE(msg, c, canonical);
+  }
+
+  /* A second occurrence of a submessage is merged into the first, so the
+   * submessage has no span of its own:
+   * C { b: B { c: C {} }, b: B { b: B {} } }. */
+  msg = decodecached("\x12\x02\x12\x00\x12\x02\x0a\x00", 8, c, false,
+                     &env);
+  CHECKENCODE(msg, c, "\x12\x02\x12\x00\x12\x02\x0a\x00");
+  upb_msg_markdirty(msg);
+  CHECKENCODE(msg, c, "\x12\x04\x0a\x00\x12\x00");
+
+  /* Messages decoded without the option have no spans. */
+  msg = upb_msg_new(c, a);
+  ASSERT(upb_decode(upb_stringview_make(pb, sizeof(pb) - 1), msg,
+                    (const upb_msglayout_msginit_v1*)c, &env));
+  upb_msg_markdirty(msg);
+  CHECKENCODE(msg, c,
+              "\x12\x04\x0a\x00\x12\x00\x1a\x04\x0a\x00\x1a\x00");
+
+  upb_env_uninit(&env);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(s);
+}
+
+static void test_packed_encode() {
+  /* FileDescriptorProto { public_dependency: [0, 1, 127, 128, 16384,
+   * 2147483647] }, unpacked on the way in and packed on the way out, with
+   * every varint length from 1 to 5 bytes. */
+  const char pb[] =
+      "\x50\x00" "\x50\x01" "\x50\x7f" "\x50\x80\x01" "\x50\x80\x80\x01"
+      "\x50\xff\xff\xff\xff\x07";
+  const char packed[] =
+      "\x52\x0d" "\x00" "\x01" "\x7f" "\x80\x01" "\x80\x80\x01"
+      "\xff\xff\xff\xff\x07";
+  upb_symtab *s = load_proto(DESCRIPTOR_PB);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  const upb_msglayout *l =
+      getlayout(factory, "google.protobuf.FileDescriptorProto");
+  upb_env env;
+  upb_msg *msg;
+  char buf[sizeof(packed) - 1];
+  size_t len;
+  upb_env_init(&env);
+
+  msg = upb_msg_new(l, upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(upb_decode(upb_stringview_make(pb, sizeof(pb) - 1), msg,
+                    (const upb_msglayout_msginit_v1*)l, &env));
+  CHECKENCODE(msg, l, packed);
+
+  /* A buffer of exactly the right size is enough. */
+  ASSERT(upb_encode_into(msg, (const upb_msglayout_msginit_v1*)l, buf,
+                         sizeof(buf), &len));
+  ASSERT(len == sizeof(buf) && memcmp(buf, packed, len) == 0);
+  ASSERT(!upb_encode_into(msg, (const upb_msglayout_msginit_v1*)l, buf,
+                          sizeof(buf) - 1, &len));
+
+  upb_env_uninit(&env);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(s);
+}
+
+static void checkplan(const upb_msg *msg, const upb_msglayout_msginit_v1 *l,
+                      upb_env *env) {
+  size_t len;
+  char *out = upb_encode(msg, l, env, &len);
+  ASSERT(out && len > 0);
+  checkencode(msg, (const upb_msglayout*)l, env, out, len);
+}
+
+/* Adds an optional field to |m|.  Groups are of type Big, |m| itself. */
+static void addfield(upb_msgdef *m, const char *name, uint32_t number,
+                     upb_descriptortype_t type) {
+  upb_fielddef *f = upb_fielddef_new(&f);
+  ASSERT(upb_fielddef_setname(f, name, NULL));
+  ASSERT(upb_fielddef_setnumber(f, number, NULL));
+  upb_fielddef_setlabel(f, UPB_LABEL_OPTIONAL);
+  upb_fielddef_setdescriptortype(f, type);
+  if (type == UPB_DESCRIPTOR_TYPE_GROUP) {
+    ASSERT(upb_fielddef_setsubdefname(f, ".Big", NULL));
+  }
+  ASSERT(upb_msgdef_addfield(m, f, &f, NULL));
+}
+
+static void test_encode_plan() {
+  /* SimplePrimitives with every field set: fixed64, fixed32, double, float,
+   * sint64 -2, sint32 -1, bool, string, and one member of each oneof. */
+  const char pb[] =
+      "\x09\x01\x02\x03\x04\x05\x06\x07\x08" "\x15\x01\x02\x03\x04"
+      "\x19\x00\x00\x00\x00\x00\x00\xf0\x3f" "\x2d\x00\x00\x80\x3f"
+      "\x30\x03" "\x38\x01" "\x40\x01" "\x4a\x02hi" "\x5a\x01x"
+      "\x68\xff\x01";
+  /* Big { Group { i: 2 } str: "hi" i: 1 }, in upb_encode()'s field order,
+   * with field numbers of 2^28 and up, whose tags need all 32 bits. */
+  const char big[] =
+      "\x8b\x80\x80\x80\x08" "\xf8\xff\xff\xff\x0f\x02"
+      "\x8c\x80\x80\x80\x08"
+      "\x82\x80\x80\x80\x08\x02" "hi"
+      "\xf8\xff\xff\xff\x0f\x01";
+  upb_symtab *s = load_proto(descriptor_file);
+  upb_symtab *ds = load_proto(DESCRIPTOR_PB);
+  upb_symtab *bs = upb_symtab_new();
+  upb_msgfactory *bfactory;
+  upb_msgdef *bigdef = upb_msgdef_new(&bigdef);
+  upb_status status = UPB_STATUS_INIT;
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  upb_msgfactory *dfactory = upb_msgfactory_new(ds);
+  const upb_msglayout *l;
+  upb_env env;
+  upb_msg *msg;
+  size_t len;
+  char *data = upb_readfile(DESCRIPTOR_PB, &len);
+  ASSERT(data);
+  upb_env_init(&env);
+
+  l = getlayout(factory, "SimplePrimitives");
+  msg = upb_msg_new(l, upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(upb_decode(upb_stringview_make(pb, sizeof(pb) - 1), msg,
+                    (const upb_msglayout_msginit_v1*)l, &env));
+  checkplan(msg, (const upb_msglayout_msginit_v1*)l, &env);
+
+  ASSERT(upb_msgdef_setfullname(bigdef, "Big", NULL));
+  addfield(bigdef, "i", UPB_MAX_FIELDNUMBER, UPB_DESCRIPTOR_TYPE_INT32);
+  addfield(bigdef, "str", 1 << 28, UPB_DESCRIPTOR_TYPE_STRING);
+  addfield(bigdef, "group", (1 << 28) + 1, UPB_DESCRIPTOR_TYPE_GROUP);
+  ASSERT(upb_symtab_add(bs, (upb_def**)&bigdef, 1, NULL, &status));
+  upb_msgdef_unref(bigdef, &bigdef);
+  bfactory = upb_msgfactory_new(bs);
+  l = getlayout(bfactory, "Big");
+  msg = upb_msg_new(l, upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(upb_decode(upb_stringview_make(big, sizeof(big) - 1), msg,
+                    (const upb_msglayout_msginit_v1*)l, &env));
+  CHECKENCODE(msg, l, big);
+
+  /* The descriptor for descriptor.proto, as a FileDescriptorSet: nested and
+   * repeated submessages, strings, enums and bools, all through one plan. */
+  l = getlayout(dfactory, "google.protobuf.FileDescriptorSet");
+  msg = upb_msg_new(l, upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(upb_decode(upb_stringview_make(data, len), msg,
+                    (const upb_msglayout_msginit_v1*)l, &env));
+  checkplan(msg, (const upb_msglayout_msginit_v1*)l, &env);
+
+  upb_env_uninit(&env);
+  free(data);
+  upb_msgfactory_free(bfactory);
+  upb_msgfactory_free(dfactory);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(bs);
+  upb_symtab_free(ds);
+  upb_symtab_free(s);
+}
+
+/* Returns the first file of a serialized FileDescriptorSet, which for
+ * descriptor.pb is descriptor.proto itself. */
+static const char *firstfile(const char *data, size_t len, size_t *file_len) {
+  size_t i;
+  *file_len = 0;
+  ASSERT(len > 0 && data[0] == '\x0a');
+  for (i = 1; data[i] & 0x80; i++) {
+    *file_len |= (size_t)(data[i] & 0x7f) << (7 * (i - 1));
+  }
+  *file_len |= (size_t)data[i] << (7 * (i - 1));
+  ASSERT(i + 1 + *file_len <= len);
+  return data + i + 1;
+}
+
+/* Encodes |msg| split on |field_number| into at most |n| ranges, the ranges
+ * last one first, and checks the output against upb_encode(). */
+static void checksplit(const upb_msg *msg, const upb_msglayout_msginit_v1 *l,
+                       uint32_t field_number, size_t n, upb_env *env) {
+  upb_encoderange ranges[16];
+  size_t len, split_len, i;
+  size_t max = n;
+  size_t range_bytes = 0;
+  char *out = upb_encode(msg, l, env, &len);
+  char *split_out = upb_encode_split(msg, l, env, field_number, ranges, &n,
+                                     &split_len);
+  ASSERT(out && split_out && split_len == len);
+  ASSERT(n <= max);
+
+  for (i = n; i > 0; i--) {
+    const upb_encoderange *r = &ranges[i - 1];
+    ASSERT(r->out >= split_out && r->out + r->size <= split_out + len);
+    if (i < n) {
+      ASSERT(r->out + r->size == ranges[i].out);
+      ASSERT(r->first + r->count == ranges[i].first);
+    }
+    ASSERT(upb_encode_range(r, msg, l));
+    range_bytes += r->size;
+  }
+
+  ASSERT(range_bytes < len || n == 0);
+  ASSERT(memcmp(split_out, out, len) == 0);
+}
+
+static void test_encode_split() {
+  upb_symtab *s = load_proto(DESCRIPTOR_PB);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  const upb_msglayout_msginit_v1 *l = (const upb_msglayout_msginit_v1*)
+      getlayout(factory, "google.protobuf.FileDescriptorProto");
+  upb_encoderange ranges[4];
+  upb_env env;
+  upb_msg *msg;
+  size_t len, n;
+  size_t file_len;
+  const char *file;
+  char *data = upb_readfile(DESCRIPTOR_PB, &len);
+  ASSERT(data);
+  upb_env_init(&env);
+
+  /* descriptor.proto's message_type (4) has fields on both sides of it. */
+  file = firstfile(data, len, &file_len);
+
+  msg = upb_msg_new((const upb_msglayout*)l,
+                    upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(upb_decode(upb_stringview_make(file, file_len), msg, l, &env));
+
+  checksplit(msg, l, 4, 1, &env);
+  checksplit(msg, l, 4, 2, &env);
+  checksplit(msg, l, 4, 3, &env);
+  checksplit(msg, l, 4, 16, &env);
+
+  /* No services: encoded whole. */
+  checksplit(msg, l, 6, 4, &env);
+
+  /* Not repeated submessage fields. */
+  n = 4;
+  ASSERT(!upb_encode_split(msg, l, &env, 1, ranges, &n, &len) && n == 0);
+  n = 4;
+  ASSERT(!upb_encode_split(msg, l, &env, 99, ranges, &n, &len) && n == 0);
+
+  upb_env_uninit(&env);
+  free(data);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(s);
+}
+
+/* Encodes |msg|, decoded from |in| without copying its strings, as segments
+ * and checks that they add up to upb_encode()'s output.  Returns how many of
+ * them were referenced in place, pointing into |in|. */
+static size_t checksegments(const upb_msg *msg,
+                            const upb_msglayout_msginit_v1 *l,
+                            size_t threshold, upb_stringview in,
+                            upb_env *env) {
+  size_t len, count, i;
+  size_t ofs = 0;
+  size_t referenced = 0;
+  char *out = upb_encode(msg, l, env, &len);
+  upb_stringview *segs = upb_encode_segments(msg, l, threshold, env, &count);
+  ASSERT(out && segs);
+
+  for (i = 0; i < count; i++) {
+    ASSERT(ofs + segs[i].size <= len);
+    ASSERT(memcmp(segs[i].data, out + ofs, segs[i].size) == 0);
+    ofs += segs[i].size;
+    if (segs[i].data >= in.data && segs[i].data < in.data + in.size) {
+      ASSERT(segs[i].size >= UPB_MAX(threshold, 1));
+      referenced++;
+    }
+  }
+
+  ASSERT(ofs == len);
+  return referenced;
+}
+
+static void test_encode_segments() {
+  /* SimplePrimitives { u32, str: 300 bytes, oneof_bytes: 5 bytes, i32 },
+   * so the large string has a two-byte length prefix. */
+  const char head[] = "\x15\x01\x02\x03\x04" "\x4a\xac\x02";
+  const char tail[] = "\x72\x05" "small" "\x38\x01";
+  char pb[sizeof(head) - 1 + 300 + sizeof(tail) - 1];
+  upb_symtab *s = load_proto(descriptor_file);
+  upb_symtab *ds = load_proto(DESCRIPTOR_PB);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  upb_msgfactory *dfactory = upb_msgfactory_new(ds);
+  const upb_msgdef *m = upb_symtab_lookupmsg(s, "SimplePrimitives");
+  const upb_msglayout *l = upb_msgfactory_getlayout(factory, m);
+  const upb_msglayout_msginit_v1 *ml = (const upb_msglayout_msginit_v1*)l;
+  upb_stringview in = upb_stringview_make(pb, sizeof(pb));
+  upb_stringview str;
+  upb_stringview *segs;
+  upb_env env;
+  upb_msg *msg;
+  size_t len, count, i;
+  char *data = upb_readfile(DESCRIPTOR_PB, &len);
+  ASSERT(data);
+  upb_env_init(&env);
+
+  memcpy(pb, head, sizeof(head) - 1);
+  memset(pb + sizeof(head) - 1, 'x', 300);
+  memcpy(pb + sizeof(head) - 1 + 300, tail, sizeof(tail) - 1);
+  msg = upb_msg_new(l, upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(upb_decode(in, msg, ml, &env));
+
+  /* 0 and 1 both reference every string, however short. */
+  ASSERT(checksegments(msg, ml, 0, in, &env) == 2);
+  ASSERT(checksegments(msg, ml, 1, in, &env) == 2);
+  ASSERT(checksegments(msg, ml, 5, in, &env) == 2);
+  ASSERT(checksegments(msg, ml, 6, in, &env) == 1);
+  ASSERT(checksegments(msg, ml, 300, in, &env) == 1);
+  ASSERT(checksegments(msg, ml, 301, in, &env) == 0);
+  ASSERT(checksegments(msg, ml, (size_t)-1, in, &env) == 0);
+
+  /* The large string's segment is the message's own data. */
+  str = upb_msgval_getstr(
+      upb_msg_get(msg, upb_fielddef_index(upb_msgdef_ntofz(m, "str")), l));
+  segs = upb_encode_segments(msg, ml, 100, &env, &count);
+  ASSERT(segs);
+  for (i = 0; i < count; i++) {
+    if (segs[i].size == 300) break;
+  }
+  ASSERT(i < count && segs[i].data == str.data);
+
+  /* No strings long enough: a single segment. */
+  segs = upb_encode_segments(msg, ml, (size_t)-1, &env, &count);
+  ASSERT(segs && count == 1 && segs[0].size == sizeof(pb));
+
+  /* descriptor.proto's descriptor: many strings of all lengths, at every
+   * depth of nesting. */
+  ml = (const upb_msglayout_msginit_v1*)getlayout(
+      dfactory, "google.protobuf.FileDescriptorSet");
+  msg = upb_msg_new((const upb_msglayout*)ml,
+                    upb_arena_alloc(upb_env_arena(&env)));
+  in = upb_stringview_make(data, len);
+  ASSERT(upb_decode(in, msg, ml, &env));
+  ASSERT(checksegments(msg, ml, 1, in, &env) > 0);
+  ASSERT(checksegments(msg, ml, 8, in, &env) > 0);
+  ASSERT(checksegments(msg, ml, 24, in, &env) > 0);
+  ASSERT(checksegments(msg, ml, (size_t)-1, in, &env) == 0);
+
+  upb_env_uninit(&env);
+  free(data);
+  upb_msgfactory_free(dfactory);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(ds);
+  upb_symtab_free(s);
+}
+
+/* Decodes |len| bytes of |pb| split on |field_number| into at most |n|
+ * ranges, the last one first, and checks that it succeeds exactly when
+ * upb_decode() does, with an equal message. */
+static void checkdecodesplit(const char *pb, size_t len,
+                             const upb_msglayout *l, uint32_t field_number,
+                             size_t n, upb_env *env) {
+  upb_decoderange ranges[16];
+  upb_alloc *a = upb_arena_alloc(upb_env_arena(env));
+  upb_msg *want = upb_msg_new(l, a);
+  upb_msg *msg = upb_msg_new(l, a);
+  const upb_msglayout_msginit_v1 *ml = (const upb_msglayout_msginit_v1*)l;
+  bool ok = upb_decode(upb_stringview_make(pb, len), want, ml, env);
+  size_t max = n;
+  size_t i;
+
+  ASSERT(want && msg);
+  if (!upb_decode_split(upb_stringview_make(pb, len), msg, ml, env, NULL,
+                        field_number, ranges, &n)) {
+    ASSERT(!ok);
+    return;
+  }
+  ASSERT(n <= max);
+
+  for (i = n; i > 0; i--) {
+    const upb_decoderange *r = &ranges[i - 1];
+    ASSERT(r->begin >= pb && r->begin < r->end && r->end <= pb + len);
+    ASSERT(r->count > 0);
+    if (i < n) {
+      ASSERT(r->end <= ranges[i].begin);
+      ASSERT(r->first + r->count == ranges[i].first);
+    }
+    if (!upb_decode_range(r, msg, ml, a)) {
+      ASSERT(!ok);
+      return;
+    }
+  }
+
+  ASSERT(ok);
+  ASSERT(upb_msg_equal(msg, want, l));
+}
+
+static void test_decode_split() {
+  upb_symtab *s = load_proto(DESCRIPTOR_PB);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  const upb_msglayout *l =
+      getlayout(factory, "google.protobuf.FileDescriptorProto");
+  upb_decoderange ranges[4];
+  upb_env env;
+  upb_msg *msg;
+  size_t len, file_len, n, i;
+  const char *file;
+  char *data = upb_readfile(DESCRIPTOR_PB, &len);
+  ASSERT(data);
+  upb_env_init(&env);
+  file = firstfile(data, len, &file_len);
+
+  /* Every number of ranges, up to more than there are records. */
+  for (n = 1; n <= 16; n++) {
+    checkdecodesplit(file, file_len, l, 4, n, &env);
+  }
+
+  /* No services: a single range can't have any records. */
+  n = 4;
+  msg = upb_msg_new(l, upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(upb_decode_split(upb_stringview_make(file, file_len), msg,
+                          (const upb_msglayout_msginit_v1*)l, &env, NULL, 6,
+                          ranges, &n));
+  ASSERT(n == 0);
+
+  /* Not repeated submessage fields. */
+  n = 4;
+  ASSERT(!upb_decode_split(upb_stringview_make(file, file_len), msg,
+                           (const upb_msglayout_msginit_v1*)l, &env, NULL, 1,
+                           ranges, &n));
+
+  /* Truncated anywhere, whether in a record or between fields. */
+  for (i = 0; i < file_len; i += 7) {
+    checkdecodesplit(file, i, l, 4, 3, &env);
+  }
+  checkdecodesplit(file, file_len - 1, l, 4, 3, &env);
+
+  upb_env_uninit(&env);
+  free(data);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(s);
+}
+
+/* Decodes |pb| with upb_decode_iov(), cut into |n| + 1 segments at |cuts|,
+ * and checks that the result is |want|.  Each segment is a separate
+ * allocation, so that reading past one would show up under ASAN. */
+static void checkiov(const char *pb, size_t len, const size_t *cuts, int n,
+                     const upb_msglayout *l, const upb_msg *want,
+                     upb_env *env) {
+  upb_stringview segs[3];
+  char *copies[3];
+  upb_msg *msg = upb_msg_new(l, upb_arena_alloc(upb_env_arena(env)));
+  size_t start = 0;
+  int i;
+  ASSERT(msg);
+
+  for (i = 0; i <= n; i++) {
+    size_t end = i < n ? cuts[i] : len;
+    copies[i] = malloc(end - start + 1);
+    ASSERT(copies[i]);
+    memcpy(copies[i], pb + start, end - start);
+    segs[i] = upb_stringview_make(copies[i], end - start);
+    start = end;
+  }
+
+  ASSERT(upb_decode_iov(segs, n + 1, msg, (const upb_msglayout_msginit_v1*)l,
+                        env, NULL));
+  ASSERT(upb_msg_equal(msg, want, l));
+
+  for (i = 0; i <= n; i++) {
+    free(copies[i]);
+  }
+}
+
+/* Every way of cutting the input into two or three segments decodes like the
+ * contiguous input, wherever the cuts fall in a field. */
+static void checkiovsplits(const char *pb, size_t len, const upb_msglayout *l,
+                           upb_env *env) {
+  upb_msg *want = decodecopy(pb, len, l, false, env);
+  size_t cuts[2];
+  size_t i, j;
+
+  for (i = 0; i <= len; i++) {
+    cuts[0] = i;
+    checkiov(pb, len, cuts, 1, l, want, env);
+    for (j = i; j <= len; j++) {
+      cuts[1] = j;
+      checkiov(pb, len, cuts, 2, l, want, env);
+    }
+  }
+}
+
+static void test_decode_iov() {
+  /* FileDescriptorProto { name: "hello" 100 { 1: 5 2: "ab" 101 { 2: 7 } }
+   * message_type { name: "M" field { name: "x" number: 1 } 50 { 1: 1 } }
+   * source_code_info { location { path: [4, 0, 1] span: [1, 2, 3, 4]
+   * leading_comments: "abc" } } package: "p" }, where 100, 101 and 50 are
+   * unknown groups. */
+  const char pb[] =
+      "\x0a\x05" "hello"
+      "\xa3\x06" "\x08\x05" "\x12\x02" "ab" "\xab\x06" "\x10\x07" "\xac\x06"
+          "\xa4\x06"
+      "\x22\x10" "\x0a\x01" "M" "\x12\x05" "\x0a\x01" "x" "\x18\x01"
+          "\x93\x03" "\x08\x01" "\x94\x03"
+      "\x4a\x12" "\x0a\x10" "\x0a\x03\x04\x00\x01" "\x12\x04\x01\x02\x03\x04"
+          "\x1a\x03" "abc"
+      "\x12\x01" "p";
+  /* A group that runs to the end of the input is accepted, as by
+   * upb_decode(). */
+  const char unterminated[] = "\x0a\x01" "a" "\xa3\x06" "\x08\x05";
+  upb_symtab *s = load_proto(DESCRIPTOR_PB);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  const upb_msglayout *l =
+      getlayout(factory, "google.protobuf.FileDescriptorProto");
+  upb_env env;
+  upb_env_init(&env);
+
+  checkiovsplits(pb, sizeof(pb) - 1, l, &env);
+  checkiovsplits(unterminated, sizeof(unterminated) - 1, l, &env);
+
+  upb_env_uninit(&env);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(s);
+}
+
+/* Writes B { b: B { b: ... } }, |depth| submessages deep, to end just before
+ * |end|, and returns where it starts. */
+static char *nest_b(char *end, int depth) {
+  char *p = end;
+  while (depth-- > 0) {
+    size_t len = end - p;
+    char hdr[5];
+    size_t n = 0;
+    do {
+      hdr[n++] = (len & 0x7f) | (len > 0x7f ? 0x80 : 0);
+      len >>= 7;
+    } while (len);
+    p -= n;
+    memcpy(p, hdr, n);
+    *--p = '\x0a';
+  }
+  return p;
+}
+
+static bool decode_b(const char *p, const char *end, uint32_t max_depth,
+                     upb_decstats *stats, const upb_msglayout_msginit_v1 *l,
+                     upb_env *env, bool iov) {
+  upb_decodeopts opts = UPB_DECODEOPTS_INITIALIZER;
+  upb_msg *msg = upb_msg_new((const upb_msglayout*)l,
+                             upb_arena_alloc(upb_env_arena(env)));
+  size_t len = end - p;
+  bool ok;
+
+  opts.max_depth = max_depth;
+  opts.stats = stats;
+  if (iov) {
+    /* Split in the middle, so submessages straddle the boundary. */
+    upb_stringview segs[2];
+    segs[0] = upb_stringview_make(p, len / 2);
+    segs[1] = upb_stringview_make(p + len / 2, len - len / 2);
+    ok = upb_decode_iov(segs, 2, msg, l, env, &opts);
+  } else {
+    ok = upb_decode2(upb_stringview_make(p, len), msg, l, env, &opts);
+  }
+  if (!ok) return false;
+
+  /* Every level was finished and marked present. */
+  checkencode(msg, (const upb_msglayout*)l, env, p, len);
+  return true;
+}
+
+static void test_decode_depth() {
+  static char buf[20000];
+  char *end = buf + sizeof(buf);
+  upb_symtab *s = load_proto(descriptor_file);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  const upb_msglayout_msginit_v1 *b =
+      (const upb_msglayout_msginit_v1*)getlayout(factory, "B");
+  upb_decstats stats;
+  upb_env env;
+  int iov;
+  int i;
+  upb_env_init(&env);
+
+  for (iov = 0; iov < 2; iov++) {
+    /* The default limit is UPB_DECODE_MAXDEPTH, counting submessages. */
+    ASSERT(decode_b(nest_b(end, UPB_DECODE_MAXDEPTH), end, 0, NULL, b, &env,
+                    iov));
+    ASSERT(!decode_b(nest_b(end, UPB_DECODE_MAXDEPTH + 1), end, 0, NULL, b,
+                     &env, iov));
+    ASSERT(decode_b(nest_b(end, 3), end, 3, NULL, b, &env, iov));
+    ASSERT(!decode_b(nest_b(end, 4), end, 3, NULL, b, &env, iov));
+
+    /* Far deeper than the frames the decoder starts out with. */
+    memset(&stats, 0, sizeof(stats));
+    ASSERT(decode_b(nest_b(end, 5000), end, 5000, &stats, b, &env, iov));
+    ASSERT(stats.max_depth == 5000);
+  }
+
+  /* Unknown groups count too: field 15 of B is unknown. */
+  for (i = 0; i < UPB_DECODE_MAXDEPTH + 1; i++) {
+    buf[i] = '\x7b';
+    buf[2 * (UPB_DECODE_MAXDEPTH + 1) - 1 - i] = '\x7c';
+  }
+  {
+    upb_msg *msg = upb_msg_new((const upb_msglayout*)b,
+                               upb_arena_alloc(upb_env_arena(&env)));
+    ASSERT(!upb_decode(upb_stringview_make(buf, 2 * (UPB_DECODE_MAXDEPTH + 1)),
+                       msg, b, &env));
+    ASSERT(upb_decode(upb_stringview_make(buf + 1, 2 * UPB_DECODE_MAXDEPTH),
+                      msg, b, &env));
+  }
+
+  upb_env_uninit(&env);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(s);
+}
+
+static const upb_msgext *add_ext(upb_extreg *r,
+                                 const upb_msglayout_msginit_v1 *extendee,
+                                 const upb_msglayout_msginit_v1 *submsg,
+                                 uint32_t number, uint8_t type, uint8_t label) {
+  upb_msglayout_extinit_v1 init;
+  init.extendee = extendee;
+  init.submsg = submsg;
+  init.number = number;
+  init.type = type;
+  init.label = label;
+  return upb_extreg_add(r, &init);
+}
+
+static void test_extensions() {
+  static const char input[] =
+      "\x0a\x00"                 /* e: {} */
+      "\xa0\x06\x96\x01"         /* [100]: 150 */
+      "\xaa\x06\x02hi"           /* [101]: "hi" */
+      "\xb0\x06\x03"             /* [102]: -2 */
+      "\xb2\x06\x02\x02\x04"     /* [102]: [1, 2], packed */
+      "\xba\x06\x02\x0a\x00"     /* [103]: {e: {}} */
+      "\xc3\x06\x0a\x00\xc4\x06" /* [104]: group {e: {}} */
+      "\xca\x06\x00"             /* [105]: {} */
+      "\xca\x06\x00"             /* [105]: {} */
+      "\xd0\x06\x07";            /* 106: 7, not registered */
+  upb_stringview buf = upb_stringview_make(input, sizeof(input) - 1);
+  upb_symtab *s = load_proto(descriptor_file);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  const upb_msglayout_msginit_v1 *e =
+      (const upb_msglayout_msginit_v1*)getlayout(factory, "E");
+  const upb_msglayout_msginit_v1 *ext_e =
+      (const upb_msglayout_msginit_v1*)getlayout(factory, "Extendable");
+  const upb_msglayout *l = (const upb_msglayout*)ext_e;
+  upb_extreg *r = upb_extreg_new(&upb_alloc_global);
+  const upb_msgext *i32, *str, *rep, *sub, *group, *repsub, *absent;
+  upb_decodeopts opts = UPB_DECODEOPTS_INITIALIZER;
+  upb_decstats stats;
+  const upb_stringview *unknown;
+  size_t count;
+  const upb_array *arr;
+  upb_msgval v;
+  upb_msg *msg;
+  upb_env env;
+  char *out;
+  size_t out_len;
+  upb_env_init(&env);
+
+  /* Only messages that declare extension ranges make room for them. */
+  ASSERT(ext_e->extendable && !e->extendable);
+  ASSERT(upb_msgdef_extendable(upb_symtab_lookupmsg(s, "Extendable")));
+  ASSERT(!upb_msgdef_extendable(upb_symtab_lookupmsg(s, "E")));
+
+  i32 = add_ext(r, ext_e, NULL, 100, UPB_DESCRIPTOR_TYPE_INT32,
+                UPB_LABEL_OPTIONAL);
+  str = add_ext(r, ext_e, NULL, 101, UPB_DESCRIPTOR_TYPE_STRING,
+                UPB_LABEL_OPTIONAL);
+  rep = add_ext(r, ext_e, NULL, 102, UPB_DESCRIPTOR_TYPE_SINT32,
+                UPB_LABEL_REPEATED);
+  sub = add_ext(r, ext_e, e, 103, UPB_DESCRIPTOR_TYPE_MESSAGE,
+                UPB_LABEL_OPTIONAL);
+  group = add_ext(r, ext_e, e, 104, UPB_DESCRIPTOR_TYPE_GROUP,
+                  UPB_LABEL_OPTIONAL);
+  repsub = add_ext(r, ext_e, e, 105, UPB_DESCRIPTOR_TYPE_MESSAGE,
+                   UPB_LABEL_REPEATED);
+  absent = add_ext(r, ext_e, NULL, 107, UPB_DESCRIPTOR_TYPE_INT64,
+                   UPB_LABEL_OPTIONAL);
+  ASSERT(i32 && str && rep && sub && group && repsub && absent);
+  ASSERT(upb_msgext_init(sub)->submsg == e);
+
+  /* Duplicates, non-extendable extendees and missing types are refused. */
+  ASSERT(!add_ext(r, ext_e, NULL, 100, UPB_DESCRIPTOR_TYPE_INT64,
+                  UPB_LABEL_OPTIONAL));
+  ASSERT(!add_ext(r, e, NULL, 100, UPB_DESCRIPTOR_TYPE_INT32,
+                  UPB_LABEL_OPTIONAL));
+  ASSERT(!add_ext(r, ext_e, NULL, 108, UPB_DESCRIPTOR_TYPE_MESSAGE,
+                  UPB_LABEL_OPTIONAL));
+
+  ASSERT(upb_extreg_lookup(r, ext_e, 101) == str);
+  ASSERT(upb_extreg_lookup(r, ext_e, 106) == NULL);
+  ASSERT(upb_extreg_lookup(r, e, 101) == NULL);
+
+  /* The extensions are parsed, and still encode as they came in. */
+  msg = upb_msg_new(l, &upb_alloc_global);
+  memset(&stats, 0, sizeof(stats));
+  opts.extreg = r;
+  opts.stats = &stats;
+  ASSERT(upb_decode2(buf, msg, ext_e, &env, &opts));
+  ASSERT(stats.unknown_fields == 1);
+
+  ASSERT(upb_msg_hasext(msg, l, i32));
+  ASSERT(upb_msg_getext(msg, l, i32).i32 == 150);
+  v = upb_msg_getext(msg, l, str);
+  ASSERT(v.str.size == 2 && memcmp(v.str.data, "hi", 2) == 0);
+
+  arr = upb_msg_getext(msg, l, rep).arr;
+  ASSERT(upb_msg_hasext(msg, l, rep));
+  ASSERT(upb_array_size(arr) == 3);
+  ASSERT(upb_array_get(arr, 0).i32 == -2);
+  ASSERT(upb_array_get(arr, 1).i32 == 1);
+  ASSERT(upb_array_get(arr, 2).i32 == 2);
+
+  v = upb_msg_getext(msg, l, sub);
+  ASSERT(upb_msg_hasext(msg, l, sub) && v.msg);
+  ASSERT(upb_msg_has(v.msg, 0, (const upb_msglayout*)e));
+  v = upb_msg_getext(msg, l, group);
+  ASSERT(upb_msg_hasext(msg, l, group) && v.msg);
+  ASSERT(upb_msg_has(v.msg, 0, (const upb_msglayout*)e));
+  arr = upb_msg_getext(msg, l, repsub).arr;
+  ASSERT(upb_array_size(arr) == 2);
+
+  ASSERT(!upb_msg_hasext(msg, l, absent));
+  ASSERT(upb_msg_getext(msg, l, absent).i64 == 0);
+
+  unknown = upb_msg_getunknown(msg, &count);
+  ASSERT(count == 1);
+  ASSERT(unknown[0].data == input + 2 && unknown[0].size == buf.size - 2);
+  out = upb_encode(msg, ext_e, &env, &out_len);
+  ASSERT(out && out_len == buf.size && memcmp(out, input, out_len) == 0);
+
+  /* A second occurrence of a singular extension replaces the first. */
+  ASSERT(upb_decode2(upb_stringview_make("\xa0\x06\x05", 3), msg, ext_e,
+                     &env, &opts));
+  ASSERT(upb_msg_getext(msg, l, i32).i32 == 5);
+
+  upb_msg_clear(msg, l);
+  ASSERT(!upb_msg_hasext(msg, l, i32));
+  ASSERT(upb_msg_getext(msg, l, str).str.data == NULL);
+  upb_msg_free(msg, l);
+
+  /* Without the registry they are only unknown fields. */
+  msg = upb_msg_new(l, upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(upb_decode(buf, msg, ext_e, &env));
+  ASSERT(!upb_msg_hasext(msg, l, i32));
+  upb_msg_getunknown(msg, &count);
+  ASSERT(count == 1);
+
+  upb_extreg_free(r);
+  upb_env_uninit(&env);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(s);
+}
+
+static bool validate(const char *buf, size_t len,
+                     const upb_msglayout *l, const upb_validateopts *opts) {
+  return upb_validate(upb_stringview_make(buf, len),
+                      (const upb_msglayout_msginit_v1*)l, opts);
+}
+
+static void test_validate() {
+  static char buf[100];
+  char *end = buf + sizeof(buf);
+  upb_symtab *s = load_proto(descriptor_file);
+  upb_symtab *ds = load_proto(DESCRIPTOR_PB);
+  upb_msgfactory *factory = upb_msgfactory_new(s);
+  upb_msgfactory *dfactory = upb_msgfactory_new(ds);
+  upb_validateopts opts = UPB_VALIDATEOPTS_INITIALIZER;
+  const upb_msglayout *simple, *b, *l;
+  upb_msglayout_msginit_v1 simple3, file3;
+  upb_env env;
+  upb_msg *msg;
+  size_t len, i;
+  char *data = upb_readfile(DESCRIPTOR_PB, &len);
+  ASSERT(data);
+  upb_env_init(&env);
+
+  simple = getlayout(factory, "SimplePrimitives");
+  b = getlayout(factory, "B");
+
+  ASSERT(validate("", 0, simple, NULL));
+  ASSERT(validate("\x4a\x02hi\x78\x05", 6, simple, NULL));  /* And 15: 5. */
+  ASSERT(!validate("\x4a\x05hi", 4, simple, NULL));
+  ASSERT(!validate("\x4a", 1, simple, NULL));
+  ASSERT(!validate("\x00\x01", 2, simple, NULL));
+  ASSERT(!validate("\x0c", 1, simple, NULL));
+
+  /* A wire type that doesn't suit the field, which upb_decode() keeps as an
+   * unknown field. */
+  msg = upb_msg_new(simple, upb_arena_alloc(upb_env_arena(&env)));
+  ASSERT(upb_decode(upb_stringview_make("\x08\x01", 2), msg,
+                    (const upb_msglayout_msginit_v1*)simple, &env));
+  ASSERT(!validate("\x08\x01", 2, simple, NULL));
+
+  /* UTF-8 is only checked on request in proto2, and only in strings. */
+  ASSERT(validate("\x4a\x02\xc0\x80", 4, simple, NULL));
+  opts.check_utf8 = true;
+  ASSERT(!validate("\x4a\x02\xc0\x80", 4, simple, &opts));
+  ASSERT(!validate("\x4a\x03\xed\xa0\x80", 5, simple, &opts));
+  ASSERT(!validate("\x4a\x02\xe2\x82", 4, simple, &opts));
+  ASSERT(validate("\x4a\x03\xe2\x82\xac", 5, simple, &opts));
+  ASSERT(validate("\x4a\x0a" "abcdefgh\xc3\xa9", 12, simple, &opts));
+  ASSERT(!validate("\x4a\x0a" "abcdefgh\xc3\x28", 12, simple, &opts));
+  ASSERT(validate("\x72\x02\xc0\x80", 4, simple, &opts));
+
+  /* Proto3 strings are always checked. */
+  simple3 = *(const upb_msglayout_msginit_v1*)simple;
+  simple3.is_proto2 = false;
+  ASSERT(!validate("\x4a\x02\xc0\x80", 4, (upb_msglayout*)&simple3, NULL));
+  ASSERT(validate("\x72\x02\xc0\x80", 4, (upb_msglayout*)&simple3, NULL));
+
+  /* Nesting, with the same limit as upb_decode(). */
+  opts.max_depth = 3;
+  ASSERT(validate(nest_b(end, 3), 6, b, &opts));
+  ASSERT(!validate(nest_b(end, 4), 8, b, &opts));
+  ASSERT(!validate("\x0a\x03\x0a\x02\x0a", 5, b, NULL));
+
+  /* Groups must end with their own END_GROUP, even unknown ones. */
+  ASSERT(validate("\x7b\x08\x01\x7c", 4, b, NULL));
+  ASSERT(!validate("\x7b\x08\x01", 3, b, NULL));
+  ASSERT(!validate("\x7b\x08\x01\x84\x01", 5, b, NULL));
+
+  /* A whole FileDescriptorSet, with packed repeated fields among others. */
+  l = getlayout(dfactory, "google.protobuf.FileDescriptorSet");
+  ASSERT(validate(data, len, l, NULL));
+  ASSERT(!validate(data, len - 1, l, NULL));
+
+  /* upb_decode() rejects bad UTF-8 in proto3 strings too, singular or
+   * repeated (FileDescriptorProto's name and dependency here). */
+  file3 = *(const upb_msglayout_msginit_v1*)getlayout(
+      dfactory, "google.protobuf.FileDescriptorProto");
+  for (i = 0; i < 2; i++) {
+    static const char *inputs[] = {"\x0a\x02\xc0\x80", "\x1a\x02\xc0\x80"};
+    upb_stringview in = upb_stringview_make(inputs[i], 4);
+    file3.is_proto2 = true;
+    msg = upb_msg_new((upb_msglayout*)&file3,
+                      upb_arena_alloc(upb_env_arena(&env)));
+    ASSERT(upb_decode(in, msg, &file3, &env));
+    file3.is_proto2 = false;
+    msg = upb_msg_new((upb_msglayout*)&file3,
+                      upb_arena_alloc(upb_env_arena(&env)));
+    ASSERT(!upb_decode(in, msg, &file3, &env));
+    ASSERT(upb_decode(upb_stringview_make("\x1a\x02\xc3\xa9", 4), msg,
+                      &file3, &env));
+  }
+
+  /* NamePart has two required fields. */
+  opts.max_depth = 0;
+  opts.check_utf8 = false;
+  l = getlayout(dfactory, "google.protobuf.UninterpretedOption.NamePart");
+  ASSERT(validate("\x0a\x01x\x10\x01", 5, l, NULL));
+  ASSERT(!validate("\x0a\x01x", 3, l, NULL));
+  opts.allow_partial = true;
+  ASSERT(validate("\x0a\x01x", 3, l, &opts));
+
+  upb_env_uninit(&env);
+  free(data);
+  upb_msgfactory_free(dfactory);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(ds);
+  upb_symtab_free(s);
+}
+
+static upb_fielddef *newfield(
+    const char *name, int32_t num, uint8_t type, uint8_t label,
+    const char *type_name, void *owner) {
+  upb_fielddef *f = upb_fielddef_new(owner);
+  ASSERT(upb_fielddef_setname(f, name, NULL));
+  ASSERT(upb_fielddef_setnumber(f, num, NULL));
+  upb_fielddef_settype(f, type);
+  upb_fielddef_setlabel(f, label);
+  if (type_name) {
+    ASSERT(upb_fielddef_setsubdefname(f, type_name, NULL));
+  }
+  return f;
+}
+
+static upb_msgdef *upb_msgdef_newnamed(const char *name, void *owner) {
+  upb_msgdef *m = upb_msgdef_new(owner);
+  upb_msgdef_setfullname(m, name, NULL);
+  return m;
+}
+
+static upb_msgdef *newmapentry(const char *name, upb_fieldtype_t key_type,
+                               upb_fieldtype_t val_type, void *owner) {
+  upb_msgdef *m = upb_msgdef_newnamed(name, owner);
+  upb_msgdef_setmapentry(m, true);
+  ASSERT(upb_msgdef_addfield(
+      m, newfield("key", 1, key_type, UPB_LABEL_OPTIONAL, NULL, owner), owner,
+      NULL));
+  ASSERT(upb_msgdef_addfield(
+      m, newfield("value", 2, val_type, UPB_LABEL_OPTIONAL, NULL, owner),
+      owner, NULL));
+  return m;
+}
+
+static uint64_t readvarint(const char **p) {
+  uint64_t val = 0;
+  int shift = 0;
+  while (**p & 0x80) {
+    val |= (uint64_t)(**p & 0x7f) << shift;
+    shift += 7;
+    (*p)++;
+  }
+  val |= (uint64_t)**p << shift;
+  (*p)++;
+  return val;
+}
+
+/* Fills |msg|'s two maps with the same keys in either order. */
+static void fillmaps(upb_msg *msg, const upb_msglayout *l, upb_env *env,
+                     bool reverse) {
+  static const char *prefixes[] = {"", "a", "ab", "abc", "b", "ba"};
+  upb_alloc *a = upb_arena_alloc(upb_env_arena(env));
+  upb_map *im = upb_map_new(UPB_TYPE_INT32, UPB_TYPE_STRING, a);
+  upb_map *sm = upb_map_new(UPB_TYPE_STRING, UPB_TYPE_INT64, a);
+  uint32_t seed = 1;
+  int i;
+
+  for (i = 0; i < 300; i++) {
+    int n = reverse ? 299 - i : i;
+    int32_t key;
+    char *str;
+    int j;
+
+    for (j = 0, seed = 1; j <= n; j++) {
+      seed = seed * 1103515245 + 12345;
+    }
+    /* Small keys too, which the inttable keeps in its array part. */
+    key = n % 3 == 0 ? n - 150 : (int32_t)seed;
+    ASSERT(upb_map_set(im, upb_msgval_int32(key), upb_msgval_makestr("v", 1),
+                       NULL));
+
+    str = upb_env_malloc(env, 16);
+    ASSERT(str);
+    sprintf(str, "%s%u", prefixes[n % 6], (unsigned)(seed >> 20));
+    ASSERT(upb_map_set(sm, upb_msgval_makestr(str, strlen(str)),
+                       upb_msgval_int64(seed >> 20), NULL));
+  }
+  ASSERT(upb_map_set(sm, upb_msgval_makestr("", 0), upb_msgval_int64(-1),
+                     NULL));
+
+  upb_msg_set(msg, 0, upb_msgval_map(im), l);
+  upb_msg_set(msg, 1, upb_msgval_map(sm), l);
+}
+
+static const char *visitdeterministic(const upb_msg *msg,
+                                      const upb_visitorplan *vp,
+                                      const upb_handlers *h, upb_env *env,
+                                      size_t *len) {
+  upb_bufsink *bufsink = upb_bufsink_new(env);
+  upb_pb_encoder *encoder =
+      upb_pb_encoder_create(env, h, upb_bufsink_sink(bufsink));
+  upb_visitor *visitor =
+      upb_visitor_create(env, vp, upb_pb_encoder_input(encoder));
+  upb_visitor_setdeterministic(visitor, true);
+  ASSERT(upb_visitor_visitmsg(visitor, msg));
+  return upb_bufsink_getdata(bufsink, len);
+}
+
+static void test_deterministic_maps() {
+  upb_status s = UPB_STATUS_INIT;
+  upb_symtab *symtab = upb_symtab_new(&symtab);
+  upb_msgdef *m = upb_msgdef_newnamed("MapMessage", &symtab);
+  upb_msgdef *im = newmapentry("MapMessage.ImEntry", UPB_TYPE_INT32,
+                               UPB_TYPE_STRING, &symtab);
+  upb_msgdef *sm = newmapentry("MapMessage.SmEntry", UPB_TYPE_STRING,
+                               UPB_TYPE_INT64, &symtab);
+  upb_def *defs[3];
+  upb_msgfactory *factory;
+  const upb_msglayout *l;
+  const upb_handlers *h;
+  const upb_visitorplan *vp;
+  upb_env env;
+  upb_msg *msg1;
+  upb_msg *msg2;
+  const char *out1;
+  const char *out2;
+  const char *p;
+  const char *end;
+  const char *last_key = NULL;
+  size_t last_len = 0;
+  int64_t last_int = INT64_MIN;
+  size_t len1, len2;
+  int entries = 0;
+
+  ASSERT(upb_msgdef_addfield(
+      m, newfield("im", 1, UPB_TYPE_MESSAGE, UPB_LABEL_REPEATED,
+                  ".MapMessage.ImEntry", &symtab), &symtab, NULL));
+  ASSERT(upb_msgdef_addfield(
+      m, newfield("sm", 2, UPB_TYPE_MESSAGE, UPB_LABEL_REPEATED,
+                  ".MapMessage.SmEntry", &symtab), &symtab, NULL));
+  defs[0] = upb_msgdef_upcast_mutable(m);
+  defs[1] = upb_msgdef_upcast_mutable(im);
+  defs[2] = upb_msgdef_upcast_mutable(sm);
+  ASSERT_STATUS(upb_symtab_add(symtab, defs, 3, &symtab, &s), &s);
+
+  factory = upb_msgfactory_new(symtab);
+  l = upb_msgfactory_getlayout(factory, m);
+  h = upb_pb_encoder_newhandlers(m, &h);
+  vp = upb_msgfactory_getvisitorplan(factory, h);
+
+  upb_env_init(&env);
+  msg1 = upb_msg_new(l, upb_arena_alloc(upb_env_arena(&env)));
+  msg2 = upb_msg_new(l, upb_arena_alloc(upb_env_arena(&env)));
+  fillmaps(msg1, l, &env, false);
+  fillmaps(msg2, l, &env, true);
+
+  /* Inserted in different orders, the maps still serialize the same. */
+  out1 = visitdeterministic(msg1, vp, h, &env, &len1);
+  out2 = visitdeterministic(msg2, vp, h, &env, &len2);
+  ASSERT(len1 == len2 && memcmp(out1, out2, len1) == 0);
+  ASSERT(upb_msg_equal(msg1, msg2, l));
+  ASSERT(upb_msg_hash(msg1, l) == upb_msg_hash(msg2, l));
+
+  /* And their entries are sorted by key. */
+  for (p = out1, end = out1 + len1; p < end; entries++) {
+    uint64_t tag = readvarint(&p);
+    uint64_t entry_len = readvarint(&p);
+    const char *entry_end = p + entry_len;
+
+    if (tag == 0x0a) {
+      int64_t key;
+      ASSERT(last_key == NULL);
+      ASSERT(*p++ == 0x08);
+      key = (int32_t)readvarint(&p);
+      ASSERT(key > last_int);
+      last_int = key;
+      ASSERT(entry_end - p == 3 && memcmp(p, "\x12\x01v", 3) == 0);
+    } else {
+      size_t key_len;
+      ASSERT(tag == 0x12);
+      ASSERT(*p++ == 0x0a);
+      key_len = readvarint(&p);
+      if (last_key) {
+        int cmp = memcmp(last_key, p, UPB_MIN(last_len, key_len));
+        ASSERT(cmp < 0 || (cmp == 0 && last_len < key_len));
+      } else {
+        ASSERT(key_len == 0);
+      }
+      last_key = p;
+      last_len = key_len;
+    }
+    p = entry_end;
+  }
+  ASSERT(p == end);
+  ASSERT((size_t)entries ==
+         upb_map_size(upb_msgval_getmap(upb_msg_get(msg1, 0, l))) +
+         upb_map_size(upb_msgval_getmap(upb_msg_get(msg1, 1, l))));
+
+  ASSERT(upb_map_set((upb_map*)upb_msgval_getmap(upb_msg_get(msg2, 1, l)),
+                     upb_msgval_makestr("", 0), upb_msgval_int64(-2), NULL));
+  ASSERT(!upb_msg_equal(msg1, msg2, l));
+  ASSERT(upb_msg_hash(msg1, l) != upb_msg_hash(msg2, l));
+
+  upb_env_uninit(&env);
+  upb_handlers_unref(h, &h);
+  upb_msgfactory_free(factory);
+  upb_symtab_free(symtab);
+}
+
+int run_tests(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: test_msg <test.proto.pb>\n");
+    return 1;
+  }
+  descriptor_file = argv[1];
+  test_layouts();
+  test_array_storage();
+  test_msg_equal();
+  test_cached_encode();
+  test_msg_clear();
+  test_msg_merge();
+  test_msg_freeze();
+  test_msgfactory_freeze();
+  test_packed_encode();
+  test_encode_plan();
+  test_encode_split();
+  test_encode_segments();
+  test_decode_split();
+  test_decode_iov();
+  test_decode_depth();
+  test_extensions();
+  test_validate();
+  test_deterministic_maps();
+  return 0;
+}
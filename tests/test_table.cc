@@ -614,6 +614,122 @@ void test_delete() {
   upb_inttable_uninit(&t);
 }
 
+void test_lookupbatch(const vector<std::string>& strkeys) {
+  upb_strtable st;
+  upb_inttable it;
+  upb_strtable_init(&st, UPB_CTYPE_INT32);
+  upb_inttable_init(&it, UPB_CTYPE_INT32);
+
+  // Insert every other key, so batches mix hits and misses.
+  for (size_t i = 0; i < strkeys.size(); i += 2) {
+    upb_strtable_insert2(&st, strkeys[i].c_str(), strkeys[i].size(),
+                         upb_value_int32(i));
+  }
+  for (int32_t i = 0; i < 1000; i += 2) {
+    upb_inttable_insert(&it, i * 37, upb_value_int32(i));
+  }
+
+  vector<const char*> keys;
+  vector<size_t> lens;
+  for (size_t i = 0; i < strkeys.size(); i++) {
+    keys.push_back(strkeys[i].c_str());
+    lens.push_back(strkeys[i].size());
+  }
+  vector<upb_value> vals(keys.size());
+  bool *found = new bool[keys.size()];
+  size_t n = upb_strtable_lookupbatch(&st, &keys[0], &lens[0], keys.size(),
+                                      &vals[0], found);
+  ASSERT(n == (strkeys.size() + 1) / 2);
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT(found[i] == (i % 2 == 0));
+    if (found[i]) ASSERT(upb_value_getint32(vals[i]) == (int32_t)i);
+  }
+  delete[] found;
+
+  vector<uintptr_t> intkeys;
+  for (int32_t i = 0; i < 1000; i++) {
+    intkeys.push_back(i * 37);
+  }
+  vector<upb_value> intvals(intkeys.size());
+  found = new bool[intkeys.size()];
+  n = upb_inttable_lookupbatch(&it, &intkeys[0], intkeys.size(), &intvals[0],
+                               found);
+  ASSERT(n == 500);
+  for (int32_t i = 0; i < 1000; i++) {
+    ASSERT(found[i] == (i % 2 == 0));
+    if (found[i]) ASSERT(upb_value_getint32(intvals[i]) == i);
+  }
+  delete[] found;
+
+  upb_strtable_uninit(&st);
+  upb_inttable_uninit(&it);
+}
+
+void test_frozen_strtable(const vector<std::string>& keys) {
+  upb_strtable t;
+  upb_strtable_init(&t, UPB_CTYPE_INT32);
+  for (size_t i = 0; i < keys.size(); i++) {
+    upb_strtable_insert2(&t, keys[i].c_str(), keys[i].size(),
+                         upb_value_int32(i));
+  }
+
+  size_t size = upb_strtable_frozensize(&t);
+  uint64_t *buf = new uint64_t[size / sizeof(uint64_t) + 1];
+  const upb_frozentable *f =
+      upb_strtable_freeze(&t, buf, size, &upb_alloc_global);
+  ASSERT(f);
+  ASSERT(upb_frozentable_count(f) == keys.size());
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    upb_value v;
+    ASSERT(upb_frozentable_lookupstr(f, keys[i].c_str(), keys[i].size(), &v));
+    ASSERT(upb_value_getint32(v) == (int32_t)i);
+
+    // Prefixes of the keys aren't in the table.
+    ASSERT(!upb_frozentable_lookupstr(f, keys[i].c_str(), keys[i].size() - 1,
+                                      &v));
+  }
+
+  // The frozen table has no pointers, so a copy works just as well.
+  uint64_t *copy = new uint64_t[size / sizeof(uint64_t) + 1];
+  memcpy(copy, buf, size);
+  delete[] buf;
+  f = (const upb_frozentable*)copy;
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT(upb_frozentable_lookupstr(f, keys[i].c_str(), keys[i].size(),
+                                     NULL));
+  }
+
+  delete[] copy;
+  upb_strtable_uninit(&t);
+}
+
+void test_frozen_inttable(int32_t *keys, uint16_t num_entries) {
+  upb_inttable t;
+  upb_inttable_init(&t, UPB_CTYPE_UINT32);
+  for (uint16_t i = 0; i < num_entries; i++) {
+    upb_inttable_insert(&t, keys[i], upb_value_uint32(keys[i] * 2));
+  }
+
+  size_t size = upb_inttable_frozensize(&t);
+  uint64_t *buf = new uint64_t[size / sizeof(uint64_t) + 1];
+  const upb_frozentable *f =
+      upb_inttable_freeze(&t, buf, size, &upb_alloc_global);
+  ASSERT(f);
+  ASSERT(upb_frozentable_count(f) == num_entries);
+
+  std::set<int32_t> all(keys, keys + num_entries);
+  for (int32_t i = 0; i < 11000; i++) {
+    upb_value v;
+    bool found = upb_frozentable_lookupint(f, i, &v);
+    ASSERT(found == (all.count(i) == 1));
+    if (found) ASSERT(upb_value_getuint32(v) == (uint32_t)i * 2);
+  }
+
+  delete[] buf;
+  upb_inttable_uninit(&t);
+}
+
 extern "C" {
 
 int run_tests(int argc, char *argv[]) {
@@ -665,8 +781,17 @@ int run_tests(int argc, char *argv[]) {
       keys4[i] = 10101+i;
   }
   test_inttable(keys4, 64, "Table size: 64, keys: 1-32 and 10133-10164 ====\n");
+  test_frozen_inttable(keys4, 64);
   delete[] keys4;
 
+  test_frozen_strtable(keys);
+  test_lookupbatch(keys);
+  int32_t *keys5 = get_contiguous_keys(10000);
+  test_frozen_inttable(keys5, 10000);
+  test_frozen_inttable(keys5, 1);
+  test_frozen_inttable(keys5, 0);
+  delete[] keys5;
+
   test_delete();
   test_int64_max_value();
 
@@ -0,0 +1,184 @@
+/*
+** Tests of the UTF-8 validation in upb/utf8.int.h.
+*/
+
+#include "upb/utf8.int.h"
+#include "upb_test.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* A plain decoder to compare with, one character at a time. */
+static bool reference_isvalid(const char *data, size_t len) {
+  const unsigned char *p = (const unsigned char*)data;
+  const unsigned char *end = p + len;
+
+  while (p < end) {
+    uint32_t c = *p++;
+    uint32_t min;
+    int n, i;
+
+    if (c < 0x80) continue;
+    if ((c & 0xe0) == 0xc0) {
+      n = 1;
+      min = 0x80;
+      c &= 0x1f;
+    } else if ((c & 0xf0) == 0xe0) {
+      n = 2;
+      min = 0x800;
+      c &= 0x0f;
+    } else if ((c & 0xf8) == 0xf0) {
+      n = 3;
+      min = 0x10000;
+      c &= 0x07;
+    } else {
+      return false;
+    }
+
+    for (i = 0; i < n; i++) {
+      if (p == end || (*p & 0xc0) != 0x80) return false;
+      c = (c << 6) | (*p++ & 0x3f);
+    }
+
+    if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Checks |data| whole, then split in two at every point, then a byte at a
+ * time, all against the reference. */
+static void check(const char *data, size_t len) {
+  bool expected = reference_isvalid(data, len);
+  upb_utf8state s;
+  size_t i;
+
+  ASSERT(upb_utf8_isvalid(data, len) == expected);
+
+  for (i = 0; i <= len; i++) {
+    upb_utf8_init(&s);
+    ASSERT((upb_utf8_check(&s, data, i) &&
+            upb_utf8_check(&s, data + i, len - i) &&
+            upb_utf8_done(&s)) == expected);
+  }
+
+  upb_utf8_init(&s);
+  for (i = 0; i < len; i++) {
+    if (!upb_utf8_check(&s, data + i, 1)) break;
+  }
+  ASSERT((i == len && upb_utf8_done(&s)) == expected);
+}
+
+/* Checks |seq| at every offset in runs of ASCII and of a multibyte character
+ * long enough for the vector loop, so that it lands on each position of a
+ * block and straddles each block boundary. */
+static void check_placed(const char *seq, bool valid) {
+  static const char *fills[] = {"a", "\xc3\xa9", "\xe2\x82\xac",
+                                "\xf0\x9f\x98\x80"};
+  char buf[128];
+  size_t seqlen = strlen(seq);
+  size_t i, j, k;
+
+  for (i = 0; i < sizeof(fills) / sizeof(fills[0]); i++) {
+    size_t filllen = strlen(fills[i]);
+    for (j = 0; j + seqlen + filllen <= 80; j += filllen) {
+      size_t len = 0;
+      for (k = 0; k < j; k += filllen) {
+        memcpy(buf + len, fills[i], filllen);
+        len += filllen;
+      }
+      memcpy(buf + len, seq, seqlen);
+      len += seqlen;
+      while (len + filllen <= 80) {
+        memcpy(buf + len, fills[i], filllen);
+        len += filllen;
+      }
+      ASSERT(reference_isvalid(buf, len) == valid);
+      ASSERT(upb_utf8_isvalid(buf, len) == valid);
+    }
+  }
+}
+
+static void test_known() {
+  static const char *valid[] = {
+    "", "hello", "\x7f", "\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80",
+    "\xed\x9f\xbf", "\xee\x80\x80", "\xef\xbf\xbf", "\xf0\x90\x80\x80",
+    "\xf4\x8f\xbf\xbf", "caf\xc3\xa9 \xe2\x82\xac\xf0\x9f\x98\x80"
+  };
+  static const char *invalid[] = {
+    "\x80", "\xbf", "\xc0\x80", "\xc1\xbf", "\xc2", "\xc2\x41", "\xe0\x80\x80",
+    "\xe0\x9f\xbf", "\xed\xa0\x80", "\xed\xbf\xbf", "\xe2\x82", "\xe2\x82\x41",
+    "\xf0\x80\x80\x80", "\xf0\x8f\xbf\xbf", "\xf4\x90\x80\x80",
+    "\xf5\x80\x80\x80", "\xf8\x88\x80\x80\x80", "\xff", "\xfe",
+    "\xf0\x9f\x98", "\xf0\x9f\x98\x80\x80", "\xc3\xa9\xa9"
+  };
+  size_t i;
+
+  for (i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+    ASSERT(reference_isvalid(valid[i], strlen(valid[i])));
+    check(valid[i], strlen(valid[i]));
+    check_placed(valid[i], true);
+  }
+
+  for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    ASSERT(!reference_isvalid(invalid[i], strlen(invalid[i])));
+    check(invalid[i], strlen(invalid[i]));
+    check_placed(invalid[i], false);
+  }
+
+  /* A NUL is valid, and doesn't end the text. */
+  ASSERT(upb_utf8_isvalid("a\0b", 3));
+}
+
+/* Appends a random character to |buf|: a valid one near the edges of the
+ * valid ranges, or if |noisy|, maybe an invalid one or a random byte. */
+static size_t random_char(char *buf, bool noisy) {
+  static const char *edges[] = {
+    "\x7f", "\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80", "\xed\x9f\xbf",
+    "\xef\xbf\xbf", "\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf",
+    /* Invalid. */
+    "\xed\xa0\x80", "\xf4\x90\x80\x80", "\xe0\x9f\xbf", "\xc1\xbf"
+  };
+  int r = rand() % (noisy ? 64 : 56);
+
+  if (r < 32) {
+    buf[0] = 0x20 + rand() % 0x5f;
+    return 1;
+  } else if (r < 56) {
+    const char *e = edges[rand() % (noisy ? 12 : 8)];
+    size_t len = strlen(e);
+    memcpy(buf, e, len);
+    return len;
+  } else {
+    buf[0] = rand() % 256;
+    return 1;
+  }
+}
+
+static void test_random() {
+  char buf[160];
+  int i;
+
+  srand(1);
+  for (i = 0; i < 20000; i++) {
+    size_t len = 0;
+    size_t max = rand() % 150;
+    bool noisy = rand() % 2;
+    while (len < max) {
+      len += random_char(buf + len, noisy && rand() % 16 == 0);
+    }
+    ASSERT(upb_utf8_isvalid(buf, len) == reference_isvalid(buf, len));
+    if (i % 20 == 0) {
+      check(buf, len);
+    }
+  }
+}
+
+int run_tests(int argc, char *argv[]) {
+  UPB_UNUSED(argc);
+  UPB_UNUSED(argv);
+  test_known();
+  test_random();
+  return 0;
+}
@@ -109,7 +109,8 @@ local function field_default(field)
   elseif field:type() == upb.TYPE_STRING or
          field:type() == upb.TYPE_BYTES then
     local default = field:default() or ""
-    return string.format('upb_stringview_make("%s", strlen("%s"))', field:default(), field:default())
+    return string.format('upb_stringview_make("%s", %d)', default,
+                         string.len(default))
   elseif field:type() == upb.TYPE_ENUM then
     return enum_value_symbol(field:subdef(), field:default())
   else
@@ -188,6 +189,391 @@ local function has_hasbit(field)
   end
 end
 
+-- Computes the layout of a message's struct, which both the generated
+-- accessors and the generated msginit table are built from.
+local function msg_layout(msg)
+  local layout = {
+    fields_layout_order = {},
+    fields_number_order = {},
+    hasbit_indexes = {},
+    hasbit_count = 0,
+    oneofs_layout_order = {},
+    oneof_indexes = {},
+  }
+
+  -- Create a layout order for oneofs.
+  for oneof in msg:oneofs() do
+    table.insert(layout.oneofs_layout_order, oneof)
+  end
+  table.sort(layout.oneofs_layout_order, function(a, b)
+    return a:name() < b:name()
+  end)
+
+  for i, oneof in ipairs(layout.oneofs_layout_order) do
+    layout.oneof_indexes[oneof] = i - 1
+  end
+
+  -- Create a layout order for fields.  We use this order for the struct and
+  -- for offsets, but our list of fields we keep in field number order.
+  for field in msg:fields() do
+    table.insert(layout.fields_layout_order, field)
+  end
+  table.sort(layout.fields_layout_order, function(a, b)
+    return field_layout_rank(a) < field_layout_rank(b)
+  end)
+
+  -- Another sorted array in field number order.
+  for field in msg:fields() do
+    table.insert(layout.fields_number_order, field)
+  end
+  table.sort(layout.fields_number_order, function(a, b)
+    return a:number() < b:number()
+  end)
+
+  -- Hasbits are numbered in layout order, and are stored at the start of the
+  -- struct, so hasbit n is bit (n % 8) of byte (n / 8).
+  for _, field in ipairs(layout.fields_layout_order) do
+    if has_hasbit(field) then
+      layout.hasbit_indexes[field] = layout.hasbit_count
+      layout.hasbit_count = layout.hasbit_count + 1
+    end
+  end
+
+  return layout
+end
+
+local function hasbit_byte(hasbit)
+  return math.floor(hasbit / 8)
+end
+
+local function hasbit_mask(hasbit)
+  return string.format("0x%02x", 2^(hasbit % 8))
+end
+
+local function write_struct(msg, layout, append)
+  local msgname = to_cident(msg:full_name())
+
+  append('struct %s {\n', msgname)
+
+  if layout.hasbit_count > 0 then
+    append('  uint8_t _hasbits[%d];\n', hasbit_byte(layout.hasbit_count + 7))
+  end
+
+  -- Non-oneof fields.
+  for _, field in ipairs(layout.fields_layout_order) do
+    if not field:containing_oneof() then
+      append('  %s %s;\n', ctype(field), field:name())
+    end
+  end
+
+  -- Oneof fields.  The case is a uint32_t, like upb_msglayout_oneofinit_v1
+  -- expects, rather than the enum, whose size is up to the compiler.
+  for oneof in msg:oneofs() do
+    append('  union {\n')
+    for field in oneof:fields() do
+      append('    %s %s;\n', ctype(field), field:name())
+    end
+    append('  } %s;\n', oneof:name())
+    append('  uint32_t %s_case;\n', oneof:name())
+  end
+
+  append('};\n\n')
+end
+
+-- Accessors are inline and work on the struct directly, so with the offsets
+-- and hasbit masks known at compile time they compile down to a load or a
+-- store.
+local function write_accessors(msg, layout, append)
+  local msgname = to_cident(msg:full_name())
+  local setters, get_setters = dump_cinit.str_appender()
+
+  append('/* %s getters. */\n', msgname)
+  for field in msg:fields() do
+    local fieldname = to_cident(field:name())
+    local typename = ctype(field)
+    local oneof = field:containing_oneof()
+    local hasbit = layout.hasbit_indexes[field]
+
+    append('UPB_INLINE %s %s_%s(const %s *msg) {\n',
+           typename, msgname, fieldname, msgname)
+    if oneof then
+      append('  return msg->%s_case == %s ? msg->%s.%s : %s;\n',
+             oneof:name(), field:number(), oneof:name(), field:name(),
+             field_default(field))
+    else
+      append('  return msg->%s;\n', field:name())
+    end
+    append('}\n')
+
+    if oneof then
+      append('UPB_INLINE bool %s_has_%s(const %s *msg) {\n',
+             msgname, fieldname, msgname)
+      append('  return msg->%s_case == %s;\n', oneof:name(), field:number())
+      append('}\n')
+    elseif hasbit then
+      append('UPB_INLINE bool %s_has_%s(const %s *msg) {\n',
+             msgname, fieldname, msgname)
+      append('  return (msg->_hasbits[%d] & %s) != 0;\n',
+             hasbit_byte(hasbit), hasbit_mask(hasbit))
+      append('}\n')
+    elseif field:type() == upb.TYPE_MESSAGE and
+           field:label() ~= upb.LABEL_REPEATED then
+      append('UPB_INLINE bool %s_has_%s(const %s *msg) {\n',
+             msgname, fieldname, msgname)
+      append('  return msg->%s != NULL;\n', field:name())
+      append('}\n')
+    end
+
+    setters('UPB_INLINE void %s_set_%s(%s *msg, %s value) {\n',
+            msgname, fieldname, msgname, typename)
+    if oneof then
+      setters('  msg->%s.%s = value;\n', oneof:name(), field:name())
+      setters('  msg->%s_case = %s;\n', oneof:name(), field:number())
+    else
+      setters('  msg->%s = value;\n', field:name())
+      if hasbit then
+        setters('  msg->_hasbits[%d] |= %s;\n',
+                hasbit_byte(hasbit), hasbit_mask(hasbit))
+      end
+    end
+    setters('}\n')
+  end
+
+  for oneof in msg:oneofs() do
+    local fullname = to_cident(oneof:containing_type():full_name() .. "." .. oneof:name())
+    append('typedef enum {\n')
+    for field in oneof:fields() do
+      append('  %s = %d,\n', fullname .. "_" .. field:name(), field:number())
+    end
+    append('  %s_NOT_SET = 0,\n', fullname)
+    append('} %s_oneofcases;\n', fullname)
+    append('UPB_INLINE %s_oneofcases %s_case(const %s *msg) {\n',
+           fullname, fullname, msgname)
+    append('  return (%s_oneofcases)msg->%s_case;\n', fullname, oneof:name())
+    append('}\n')
+  end
+
+  append('\n')
+  append('/* %s setters. */\n', msgname)
+  append(get_setters())
+end
+
+-- C++ views.  Each message gets a FooView class that wraps a const pointer
+-- to its struct and a FooMutView subclass that adds the setters, both in the
+-- package's namespace; upb/msg.h describes them.  Every accessor forwards to
+-- the UPB_INLINE C accessor, so a view costs nothing over using the struct.
+--
+-- Views of submessages (and arrays of them) are only offered for types in
+-- the same file, since the generated header does not include the headers of
+-- its dependencies; other submessages are returned as struct pointers.
+
+local cpp_elemtype = {
+  [upb.TYPE_STRING]   = "::upb::StringView",
+  [upb.TYPE_BYTES]    = "::upb::StringView",
+  [upb.TYPE_ENUM]     = "int32_t",  -- Arrays store enums as 4 bytes.
+}
+
+local function cpp_viewname(msg, suffix)
+  local name = msg:full_name()
+  local package = msg:file():package()
+  if package and package ~= "" then
+    name = string.sub(name, string.len(package) + 2)
+  end
+  return to_cident(name) .. suffix
+end
+
+local function has_cpp_view(field)
+  return field:type() == upb.TYPE_MESSAGE and
+      field:containing_type():file() == field:subdef():file()
+end
+
+local function has_has_accessor(field, layout)
+  return field:containing_oneof() or layout.hasbit_indexes[field] or
+      (field:type() == upb.TYPE_MESSAGE and
+       field:label() ~= upb.LABEL_REPEATED)
+end
+
+-- The type a view's getter returns, for views with the given suffix.
+local function cpp_gettype(field, suffix)
+  if field:label() == upb.LABEL_REPEATED then
+    if has_cpp_view(field) then
+      return string.format("::upb::MessageArrayView<%s>",
+                           cpp_viewname(field:subdef(), suffix))
+    elseif field:type() == upb.TYPE_MESSAGE then
+      return "const upb_array*"
+    else
+      local elemtype = cpp_elemtype[field:type()] or typemap[field:type()]
+      if string.sub(elemtype, 1, 1) == ":" then
+        elemtype = " " .. elemtype  -- Before C++11, "<:" is a digraph.
+      end
+      return string.format("::upb::ArrayView<%s>", elemtype)
+    end
+  elseif has_cpp_view(field) then
+    return cpp_viewname(field:subdef(), suffix)
+  elseif field:type() == upb.TYPE_MESSAGE then
+    return "const " .. ctype(field)
+  elseif field:type() == upb.TYPE_STRING or field:type() == upb.TYPE_BYTES then
+    return "::upb::StringView"
+  else
+    return ctype(field)
+  end
+end
+
+local function write_cpp_classes(msg, layout, append)
+  local msgname = to_cident(msg:full_name())
+  local view = cpp_viewname(msg, "View")
+  local mutview = cpp_viewname(msg, "MutView")
+
+  append('/* %s views. */\n', msgname)
+  append('class %s {\n', view)
+  append(' public:\n')
+  append('  typedef %s CType;\n', msgname)
+  append('  typedef %s Mut;\n\n', mutview)
+  append('  %s() : msg_(NULL) {}\n', view)
+  append('  explicit %s(const CType *msg) : msg_(msg) {}\n\n', view)
+  append('  const CType *ptr() const { return msg_; }\n\n')
+  append('  static CType *New(::upb::Environment *env) {\n')
+  append('    return %s_new(env);\n', msgname)
+  append('  }\n')
+  append('  static CType *ParseNew(::upb::StringView buf, ' ..
+         '::upb::Environment *env) {\n')
+  append('    return %s_parsenew(buf, env);\n', msgname)
+  append('  }\n')
+  append('  static char *Serialize(const CType *msg, ::upb::Environment *env,\n')
+  append('                         size_t *len) {\n')
+  append('    return %s_serialize(const_cast<CType *>(msg), env, len);\n',
+         msgname)
+  append('  }\n\n')
+
+  for field in msg:fields() do
+    local fieldname = to_cident(field:name())
+    if has_cpp_view(field) then
+      append('  inline %s %s() const;\n', cpp_gettype(field, "View"),
+             fieldname)
+    else
+      append('  %s %s() const { return %s_%s(msg_); }\n',
+             cpp_gettype(field, "View"), fieldname, msgname, fieldname)
+    end
+    if has_has_accessor(field, layout) then
+      append('  bool has_%s() const { return %s_has_%s(msg_); }\n',
+             fieldname, msgname, fieldname)
+    end
+  end
+
+  for oneof in msg:oneofs() do
+    local fullname = to_cident(msg:full_name() .. "." .. oneof:name())
+    append('  %s_oneofcases %s_case() const { return %s_case(msg_); }\n',
+           fullname, oneof:name(), fullname)
+  end
+
+  append('\n')
+  append(' protected:\n')
+  append('  const CType *msg_;\n')
+  append('};\n\n')
+
+  append('class %s : public %s {\n', mutview, view)
+  append(' public:\n')
+  append('  %s() {}\n', mutview)
+  append('  explicit %s(CType *msg) : %s(msg) {}\n\n', mutview, view)
+  append('  CType *ptr() const { return const_cast<CType *>(msg_); }\n\n')
+
+  for field in msg:fields() do
+    local fieldname = to_cident(field:name())
+    local settype = ctype(field)
+    if has_cpp_view(field) then
+      append('  inline %s %s() const;\n', cpp_gettype(field, "MutView"),
+             fieldname)
+      if field:label() ~= upb.LABEL_REPEATED then
+        settype = nil
+        append('  inline void set_%s(%s value) const;\n', fieldname,
+               cpp_gettype(field, "MutView"))
+      end
+    elseif field:type() == upb.TYPE_MESSAGE then
+      append('  %s %s() const { return %s_%s(ptr()); }\n',
+             ctype(field), fieldname, msgname, fieldname)
+    elseif field:label() ~= upb.LABEL_REPEATED and
+           (field:type() == upb.TYPE_STRING or
+            field:type() == upb.TYPE_BYTES) then
+      settype = "::upb::StringView"
+    end
+    if settype then
+      append('  void set_%s(%s value) const {\n', fieldname, settype)
+      append('    %s_set_%s(ptr(), value);\n', msgname, fieldname)
+      append('  }\n')
+    end
+  end
+
+  append('};\n\n')
+end
+
+-- The accessors that take or return views, which can only be defined once
+-- every class is complete.
+local function write_cpp_view_accessors(msg, append)
+  local msgname = to_cident(msg:full_name())
+
+  for _, suffix in ipairs({"View", "MutView"}) do
+    local msgarg = "msg_"
+    if suffix == "MutView" then
+      msgarg = "ptr()"
+    end
+    for field in msg:fields() do
+      if has_cpp_view(field) then
+        local fieldname = to_cident(field:name())
+        local gettype = cpp_gettype(field, suffix)
+        append('inline %s %s::%s() const {\n', gettype,
+               cpp_viewname(msg, suffix), fieldname)
+        append('  return %s(%s_%s(%s));\n', gettype, msgname, fieldname,
+               msgarg)
+        append('}\n')
+        if suffix == "MutView" and field:label() ~= upb.LABEL_REPEATED then
+          append('inline void %s::set_%s(%s value) const {\n',
+                 cpp_viewname(msg, suffix), fieldname, gettype)
+          append('  %s_set_%s(ptr(), value.ptr());\n', msgname, fieldname)
+          append('}\n')
+        end
+      end
+    end
+  end
+end
+
+local function write_cpp_views(filedef, append)
+  local namespaces = {}
+  local package = filedef:package()
+
+  if package and package ~= "" then
+    for name in string.gmatch(package, "[^.]+") do
+      table.insert(namespaces, name)
+    end
+  end
+
+  append('#ifdef __cplusplus\n\n')
+  for _, name in ipairs(namespaces) do
+    append('namespace %s {\n', name)
+  end
+  append('\n')
+
+  for msg in filedef:defs(upb.DEF_MSG) do
+    append('class %s;\n', cpp_viewname(msg, "View"))
+    append('class %s;\n', cpp_viewname(msg, "MutView"))
+  end
+  append('\n')
+
+  for msg in filedef:defs(upb.DEF_MSG) do
+    write_cpp_classes(msg, msg_layout(msg), append)
+  end
+
+  for msg in filedef:defs(upb.DEF_MSG) do
+    write_cpp_view_accessors(msg, append)
+  end
+  append('\n')
+
+  for i = #namespaces, 1, -1 do
+    append('}  /* namespace %s */\n', namespaces[i])
+  end
+  append('\n')
+  append('#endif  /* __cplusplus */\n\n')
+end
+
 local function write_h_file(filedef, append)
   emit_file_warning(filedef, append)
   local basename_preproc = to_preproc(filedef:name())
@@ -216,49 +602,28 @@ local function write_h_file(filedef, append)
 
   for msg in filedef:defs(upb.DEF_MSG) do
     local msgname = to_cident(msg:full_name())
-    append('/* %s message definition. */\n', msgname)
-    append('extern const upb_msglayout_msginit_v1 %s_msginit;\n', msgname)
-    append('%s *%s_new(upb_env *env);\n', msgname, msgname)
-    append('%s *%s_parsenew(upb_stringview buf, upb_env *env);\n',
-           msgname, msgname)
-    append('char *%s_serialize(%s *msg, upb_env *env, size_t *len);\n',
-           msgname, msgname)
-    append('void %s_free(%s *msg, upb_env *env);\n', msgname, msgname)
-    append('\n')
+    local layout = msg_layout(msg)
 
-    append('/* %s getters. */\n', msgname)
-    local setters, get_setters = dump_cinit.str_appender()
+    append('/* %s message definition. */\n', msgname)
     for field in msg:fields() do
-      local fieldname = to_cident(field:name())
       if field:type() == upb.TYPE_MESSAGE and
           field:subdef():file() ~= filedef then
         -- Forward declaration for message type declared in another file.
         append('struct %s;\n', to_cident(field:subdef():full_name()))
       end
-      if field:label() == upb.LABEL_REPEATED then
-      else
-        local typename = ctype(field)
-        append('%s %s_%s(const %s *msg);\n',
-               typename, msgname, fieldname, msgname)
-        setters('void %s_set_%s(%s *msg, %s value);\n',
-                msgname, fieldname, msgname, typename)
-      end
-    end
-
-    for oneof in msg:oneofs() do
-      local fullname = to_cident(oneof:containing_type():full_name() .. "." .. oneof:name())
-      append('typedef enum {\n')
-      for field in oneof:fields() do
-        append('  %s = %d,\n', fullname .. "_" .. field:name(), field:number())
-      end
-      append('  %s_NOT_SET = 0,\n', fullname)
-      append('} %s_oneofcases;\n', fullname)
-      append('%s_oneofcases %s_case(const %s *msg);\n', fullname, fullname, msgname)
     end
+    write_struct(msg, layout, append)
 
+    append('extern const upb_msglayout_msginit_v1 %s_msginit;\n', msgname)
+    append('%s *%s_new(upb_env *env);\n', msgname, msgname)
+    append('%s *%s_parsenew(upb_stringview buf, upb_env *env);\n',
+           msgname, msgname)
+    append('char *%s_serialize(%s *msg, upb_env *env, size_t *len);\n',
+           msgname, msgname)
+    append('void %s_free(%s *msg, upb_env *env);\n', msgname, msgname)
     append('\n')
-    append('/* %s setters. */\n', msgname)
-    append(get_setters())
+
+    write_accessors(msg, layout, append)
 
     append('\n')
     append('\n')
@@ -269,9 +634,97 @@ local function write_h_file(filedef, append)
   append('\n')
   append('\n')
 
+  write_cpp_views(filedef, append)
+
   append('#endif  /* %s_UPB_H_ */\n', basename_preproc)
 end
 
+-- Emits the field number -> field index table that the decoder would
+-- otherwise need upb_msglayout_frominit_v1() to build at runtime, with the
+-- same bound on its size.  Returns the reference to it and its size.
+local function write_field_lookup(msgname, layout, append)
+  local fields = layout.fields_number_order
+  local lookup_name = msgname .. "__lookup"
+  local max_number = 0
+  local index = {}
+
+  if #fields == 0 then
+    return "NULL", 0
+  end
+
+  for i, field in ipairs(fields) do
+    max_number = math.max(max_number, field:number())
+    index[field:number()] = i - 1
+  end
+
+  local dense_below = math.min(max_number + 1, #fields * 4 + 64)
+
+  append('static const uint16_t %s[%s] = {\n', lookup_name, dense_below)
+  for n = 0, dense_below - 1 do
+    append('  %s,\n', index[n] or "UPB_NO_FIELD")
+  end
+  append('};\n\n')
+
+  return "&" .. lookup_name .. "[0]", dense_below
+end
+
+-- Emits the presence map described in upb_msglayout_msginit_v1, for the
+-- messages it applies to.  Returns references to the hasbit_fields and
+-- check_fields arrays, and the number of hasbit bytes.
+local function write_presence(msg, msgname, layout, append)
+  local fields = layout.fields_number_order
+  local hasbit_fields = {}
+  local hasbit_bytes = math.floor((layout.hasbit_count + 7) / 8)
+  local hasbit_fields_ref = "NULL"
+  local check_fields_name = msgname .. "__check_fields"
+
+  if msg:file():syntax() ~= upb.SYNTAX_PROTO2 or #fields == 0 or
+     #fields > 512 then  -- UPB_PRESENCE_MAXFIELDS
+    return "NULL", "NULL", 0
+  end
+
+  -- The check_fields words are written as two 32-bit halves, since a Lua
+  -- number can't hold every 64-bit value.
+  local words = {}
+  for w = 1, math.floor((#fields + 63) / 64) do
+    words[w] = {0, 0}
+  end
+
+  for i, field in ipairs(fields) do
+    local hasbit = layout.hasbit_indexes[field]
+    if hasbit then
+      hasbit_fields[hasbit] = i - 1
+    else
+      local bit = (i - 1) % 64
+      local word = words[math.floor((i - 1) / 64) + 1]
+      if bit < 32 then
+        word[2] = word[2] + 2^bit
+      else
+        word[1] = word[1] + 2^(bit - 32)
+      end
+    end
+  end
+
+  if hasbit_bytes > 0 then
+    local hasbit_fields_name = msgname .. "__hasbit_fields"
+    hasbit_fields_ref = "&" .. hasbit_fields_name .. "[0]"
+    append('static const uint16_t %s[%s] = {\n',
+           hasbit_fields_name, hasbit_bytes * 8)
+    for n = 0, hasbit_bytes * 8 - 1 do
+      append('  %s,\n', hasbit_fields[n] or "UPB_NO_FIELD")
+    end
+    append('};\n\n')
+  end
+
+  append('static const uint64_t %s[%s] = {\n', check_fields_name, #words)
+  for _, word in ipairs(words) do
+    append('  ((uint64_t)0x%08xU << 32) | 0x%08xU,\n', word[1], word[2])
+  end
+  append('};\n\n')
+
+  return hasbit_fields_ref, "&" .. check_fields_name .. "[0]", hasbit_bytes
+end
+
 local function write_c_file(filedef, hfilename, append)
   emit_file_warning(filedef, append)
 
@@ -299,86 +752,24 @@ local function write_c_file(filedef, hfilename, append)
     local submsg_count = 0
     local submsg_set = {}
     local submsg_indexes = {}
-    local hasbit_count = 0
-    local hasbit_indexes = {}
-    local oneof_count = 0
-    local oneof_indexes = {}
-
-    -- Create a layout order for oneofs.
-    local oneofs_layout_order = {}
-    for oneof in msg:oneofs() do
-      table.insert(oneofs_layout_order, oneof)
-    end
-    table.sort(oneofs_layout_order, function(a, b)
-      return a:name() < b:name()
-    end)
-
-    for _, oneof in ipairs(oneofs_layout_order) do
-      oneof_indexes[oneof] = oneof_count
-      oneof_count = oneof_count + 1
-    end
-
-    -- Create a layout order for fields.  We use this order for the struct and
-    -- for offsets, but our list of fields we keep in field number order.
-    local fields_layout_order = {}
-    for field in msg:fields() do
-      table.insert(fields_layout_order, field)
-    end
-    table.sort(fields_layout_order, function(a, b)
-      return field_layout_rank(a) < field_layout_rank(b)
-    end)
-
-    -- Another sorted array in field number order.
-    local fields_number_order = {}
-    for field in msg:fields() do
-      table.insert(fields_number_order, field)
-    end
-    table.sort(fields_number_order, function(a, b)
-      return a:number() < b:number()
-    end)
-
-    append('struct %s {\n', msgname)
+    local layout = msg_layout(msg)
+    local oneof_count = #layout.oneofs_layout_order
 
-    -- Non-oneof fields.
-    for _, field in ipairs(fields_layout_order) do
+    for _, field in ipairs(layout.fields_layout_order) do
       field_count = field_count + 1
 
       if field:type() == upb.TYPE_MESSAGE then
         submsg_count = submsg_count + 1
         submsg_set[field:subdef()] = true
       end
-
-      if field:containing_oneof() then
-        -- Handled below.
-      else
-        if has_hasbit(field) then
-          hasbit_indexes[field] = hasbit_count
-          hasbit_count = hasbit_count + 1
-        end
-
-        append('  %s %s;\n', ctype(field), field:name())
-      end
     end
 
-    -- Oneof fields.
-    for oneof in msg:oneofs() do
-      local fullname = to_cident(oneof:containing_type():full_name() .. "." .. oneof:name())
-      append('  union {\n')
-      for field in oneof:fields() do
-        append('    %s %s;\n', ctype(field), field:name())
-      end
-      append('  } %s;\n', oneof:name())
-      append('  %s_oneofcases %s_case;\n', fullname, oneof:name())
-    end
-
-    append('};\n\n')
-
     if oneof_count > 0 then
       local oneofs_array_name = msgname .. "_oneofs"
       oneofs_array_ref = "&" .. oneofs_array_name .. "[0]"
       append('static const upb_msglayout_oneofinit_v1 %s[%s] = {\n',
              oneofs_array_name, oneof_count)
-      for _, oneof in ipairs(oneofs_layout_order) do
+      for _, oneof in ipairs(layout.oneofs_layout_order) do
         append('  {offsetof(%s, %s), offsetof(%s, %s_case)},\n',
                msgname, oneof:name(), msgname, oneof:name())
       end
@@ -390,8 +781,6 @@ local function write_c_file(filedef, hfilename, append)
       -- "submsgs" array for every strongly-connected component.
       local submsgs_array_name = msgname .. "_submsgs"
       submsgs_array_ref = "&" .. submsgs_array_name .. "[0]"
-      append('static const upb_msglayout_msginit_v1 *const %s[%s] = {\n',
-             submsgs_array_name, submsg_count)
 
       -- Create a deterministically-sorted array of submessage entries.
       local submsg_array = {}
@@ -402,6 +791,9 @@ local function write_c_file(filedef, hfilename, append)
         return a:full_name() < b:full_name()
       end)
 
+      append('static const upb_msglayout_msginit_v1 *const %s[%s] = {\n',
+             submsgs_array_name, #submsg_array)
+
       for i, submsg in ipairs(submsg_array) do
         append('  &%s_msginit,\n', to_cident(submsg:full_name()))
         submsg_indexes[submsg] = i - 1
@@ -415,20 +807,20 @@ local function write_c_file(filedef, hfilename, append)
       fields_array_ref = "&" .. fields_array_name .. "[0]"
       append('static const upb_msglayout_fieldinit_v1 %s[%s] = {\n',
              fields_array_name, field_count)
-      for _, field in ipairs(fields_number_order) do
+      for _, field in ipairs(layout.fields_number_order) do
         local submsg_index = "UPB_NO_SUBMSG"
         local oneof_index = "UPB_NOT_IN_ONEOF"
         if field:type() == upb.TYPE_MESSAGE then
           submsg_index = submsg_indexes[field:subdef()]
         end
         if field:containing_oneof() then
-          oneof_index = oneof_indexes[field:containing_oneof()]
+          oneof_index = layout.oneof_indexes[field:containing_oneof()]
         end
         append('  {%s, offsetof(%s, %s), %s, %s, %s, %s, %s},\n',
                field:number(),
                msgname,
                (field:containing_oneof() and field:containing_oneof():name()) or field:name(),
-               hasbit_indexes[field] or "UPB_NO_HASBIT",
+               layout.hasbit_indexes[field] or "UPB_NO_HASBIT",
                oneof_index,
                submsg_index,
                field:descriptor_type(),
@@ -437,24 +829,29 @@ local function write_c_file(filedef, hfilename, append)
       append('};\n\n')
     end
 
+    local lookup_ref, dense_below = write_field_lookup(msgname, layout, append)
+    local hasbit_fields_ref, check_fields_ref, hasbit_bytes =
+        write_presence(msg, msgname, layout, append)
+
     append('const upb_msglayout_msginit_v1 %s_msginit = {\n', msgname)
     append('  %s,\n', submsgs_array_ref)
     append('  %s,\n', fields_array_ref)
     append('  %s,\n', oneofs_array_ref)
     append('  NULL, /* TODO. default_msg */\n')
-    append('  UPB_ALIGNED_SIZEOF(%s), %s, %s, %s, %s\n',
+    append('  UPB_ALIGNED_SIZEOF(%s), %s, %s, %s, %s,\n',
            msgname, field_count,
-           0, -- TODO: oneof_count
-           'false', -- TODO: extendable
+           oneof_count,
+           msg:extendable() and 'true' or 'false',
           msg:file():syntax() == upb.SYNTAX_PROTO2
           )
+    append('  %s, %s,\n', lookup_ref, dense_below)
+    append('  %s, %s, %s\n', hasbit_fields_ref, check_fields_ref, hasbit_bytes)
     append('};\n\n')
 
     append('%s *%s_new(upb_env *env) {\n', msgname, msgname)
-    append('  %s *msg = upb_env_malloc(env, sizeof(*msg));\n',
+    append('  return upb_msg_new((const upb_msglayout*)&%s_msginit,\n',
            msgname)
-    append('  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */\n')
-    append('  return msg;\n')
+    append('                     upb_arena_alloc(upb_env_arena(env)));\n')
     append('}\n')
 
     append('%s *%s_parsenew(upb_stringview buf, upb_env *env) {\n',
@@ -472,37 +869,6 @@ local function write_c_file(filedef, hfilename, append)
     append('  return upb_encode(msg, &%s_msginit, env, size);\n', msgname)
     append('}\n')
 
-    for field in msg:fields() do
-      local typename = ctype(field)
-      append('%s %s_%s(const %s *msg) {\n',
-             typename, msgname, field:name(), msgname);
-      if field:containing_oneof() then
-        local oneof = field:containing_oneof()
-        append('  return msg->%s_case == %s ? msg->%s.%s : %s;\n',
-               oneof:name(), field:number(), oneof:name(), field:name(),
-               field_default(field))
-      else
-        append('  return msg->%s;\n', field:name())
-      end
-      append('}\n')
-      append('void %s_set_%s(%s *msg, %s value) {\n',
-             msgname, field:name(), msgname, typename);
-      if field:containing_oneof() then
-        local oneof = field:containing_oneof()
-        append('  msg->%s.%s = value;\n', oneof:name(), field:name())
-        append('  msg->%s_case = %s;\n', oneof:name(), field:number())
-      else
-        append('  msg->%s = value;\n', field:name())
-      end
-      append('}\n')
-    end
-
-    for oneof in msg:oneofs() do
-      local fullname = to_cident(oneof:containing_type():full_name() .. "." .. oneof:name())
-      append('%s_oneofcases %s_case(const %s *msg) {\n', fullname, fullname, msgname)
-      append('  return msg->%s_case;\n', oneof:name())
-      append('}\n')
-    end
   end
 end
 
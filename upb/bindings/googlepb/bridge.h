@@ -27,6 +27,10 @@
 //   upb::pb::ResetDecoderSink(decoder, write_sink);
 //   write_sink->Reset(&proto);
 //
+// If the message was created on a proto2 Arena, the submessages and strings
+// that parsing creates are allocated on the same arena.  Repeated numeric
+// fields get whole packed runs at once and reserve room for them up front.
+//
 // Note that there is currently no support for
 // CodedInputStream::SetExtensionRegistry(), which allows specifying a separate
 // DescriptorPool and MessageFactory for extensions.  Since this is a property
@@ -592,6 +592,8 @@ case goog::FieldDescriptor::cpptype:                                           \
       if (f->IsSequence()) {
         SetStartRepeatedField<T>(proto2_f, r, f, h);
         CHKRET(h->SetValueHandler<T>(f, UpbMakeHandlerT(AppendPrimitive<T>)));
+        CHKRET(h->SetArrayHandler(
+            f, UpbMakeHandlerT(AppendPrimitiveArray<T>)));
       } else {
         CHKRET(upb_msg_setscalarhandler(h, f, GetOffset(proto2_f, r),
                                         GetHasbit(proto2_f, r)));
@@ -602,6 +604,19 @@ case goog::FieldDescriptor::cpptype:                                           \
   template <typename T>
   static void AppendPrimitive(goog::RepeatedField<T>* r, T val) { r->Add(val); }
 
+  // The decoder delivers packed runs here, so we can grow the RepeatedField
+  // once per run instead of letting Add() double it as it goes.
+  template <typename T>
+  static bool AppendPrimitiveArray(goog::RepeatedField<T>* r, const void* vals,
+                                   size_t n) {
+    const T* v = static_cast<const T*>(vals);
+    r->Reserve(r->size() + n);
+    for (size_t i = 0; i < n; i++) {
+      r->AddAlreadyReserved(v[i]);
+    }
+    return true;
+  }
+
   template <typename T>
   static void AppendPrimitiveExtension(goog::Message* m,
                                        const ExtensionFieldData* data, T val) {
@@ -659,6 +674,8 @@ case goog::FieldDescriptor::cpptype:                                           \
     UPB_ASSERT(!proto2_f->is_extension());
     scoped_ptr<EnumHandlerData> data(new EnumHandlerData(proto2_f, r, f));
     if (f->IsSequence()) {
+      CHKRET(h->SetArrayHandler(
+          f, UpbBind(AppendEnumArray, new EnumHandlerData(proto2_f, r, f))));
       CHKRET(h->SetInt32Handler(f, UpbBind(AppendEnum, data.release())));
     } else {
       CHKRET(h->SetInt32Handler(f, UpbBind(SetEnum, data.release())));
@@ -690,6 +707,23 @@ case goog::FieldDescriptor::cpptype:                                           \
     }
   }
 
+  static bool AppendEnumArray(goog::Message* m, const EnumHandlerData* data,
+                              const void* vals, size_t n) {
+    const int32_t* v = static_cast<const int32_t*>(vals);
+    goog::RepeatedField<int32_t>* r =
+        data->GetFieldPointer<goog::RepeatedField<int32_t> >(m);
+    // Most values will be valid, so reserve for all of them.
+    r->Reserve(r->size() + n);
+    for (size_t i = 0; i < n; i++) {
+      if (data->IsValidValue(v[i])) {
+        r->AddAlreadyReserved(v[i]);
+      } else {
+        data->GetUnknownFieldSet(m)->AddVarint(data->field_number(), v[i]);
+      }
+    }
+    return true;
+  }
+
   // EnumExtension /////////////////////////////////////////////////////////////
 
   static void SetEnumExtensionHandlers(
@@ -774,11 +808,11 @@ case goog::FieldDescriptor::cpptype:                                           \
     data->SetHasbit(m);
     // If it points to the default instance, we must create a new instance.
     if (*str == data->prototype()) {
-      *str = new T();
 #ifdef GOOGLE_PROTOBUF_HAS_ARENAS
-      if (data->GetArena(*m)) {
-        data->GetArena(*m)->Own(*str);
-      }
+      // Allocates on the heap when there is no arena.
+      *str = goog::Arena::Create<T>(data->GetArena(*m));
+#else
+      *str = new T();
 #endif
     }
     (*str)->clear();
@@ -810,16 +844,16 @@ case goog::FieldDescriptor::cpptype:                                           \
     const FieldOffset* ofs = data;
     T** str = ofs->GetFieldPointer<T*>(m);
     if (data->SetOneofHas(m)) {
-      *str = new T();
 #ifdef GOOGLE_PROTOBUF_HAS_ARENAS
       // Note that in the main proto2-arenas implementation, the parsing code
       // creates ArenaString instances for string field data, and the
       // implementation later dynamically converts to ::string if a mutable
       // version is requested. To keep complexity down in this binding, we
-      // create an ordinary string and allow the arena to own its destruction.
-      if (data->GetArena(*m) != NULL) {
-        data->GetArena(*m)->Own(*str);
-      }
+      // create an ordinary string, but in the arena, which also takes care of
+      // its destruction.
+      *str = goog::Arena::Create<T>(data->GetArena(*m));
+#else
+      *str = new T();
 #endif
     } else {
       (*str)->clear();
@@ -895,6 +895,12 @@ static int lupb_msgdef_mapentry(lua_State *L) {
   return 1;
 }
 
+static int lupb_msgdef_extendable(lua_State *L) {
+  const upb_msgdef *m = lupb_msgdef_check(L, 1);
+  lua_pushboolean(L, upb_msgdef_extendable(m));
+  return 1;
+}
+
 static int lupb_msgdef_syntax(lua_State *L) {
   const upb_msgdef *m = lupb_msgdef_check(L, 1);
   lua_pushinteger(L, upb_msgdef_syntax(m));
@@ -910,6 +916,7 @@ static const struct luaL_Reg lupb_msgdef_mm[] = {
 static const struct luaL_Reg lupb_msgdef_m[] = {
   LUPB_COMMON_DEF_METHODS
   {"add", lupb_msgdef_add},
+  {"extendable", lupb_msgdef_extendable},
   {"field", lupb_msgdef_field},
   {"fields", lupb_msgdef_fields},
   {"lookup_name", lupb_msgdef_lookupname},
@@ -1406,6 +1413,7 @@ void lupb_def_registertypes(lua_State *L) {
   lupb_setfieldi(L, "HANDLER_ENDSUBMSG",   UPB_HANDLER_ENDSUBMSG);
   lupb_setfieldi(L, "HANDLER_STARTSEQ",    UPB_HANDLER_STARTSEQ);
   lupb_setfieldi(L, "HANDLER_ENDSEQ",      UPB_HANDLER_ENDSEQ);
+  lupb_setfieldi(L, "HANDLER_ARRAY",       UPB_HANDLER_ARRAY);
 
   lupb_setfieldi(L, "SYNTAX_PROTO2",  UPB_SYNTAX_PROTO2);
   lupb_setfieldi(L, "SYNTAX_PROTO3",  UPB_SYNTAX_PROTO3);
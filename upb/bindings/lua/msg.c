@@ -27,7 +27,14 @@
  * We use the userval of container objects (Message/Array/Map) to store
  * references to sub-objects (Strings/Messages/Arrays/Maps).  But we need to
  * keep the userval in sync with the underlying upb_msg/upb_array/upb_map.
- * We populate the userval lazily from the underlying data.
+ * We populate the userval lazily from the underlying data: the wrapper for a
+ * string, message, array or map is only created when it is first read, and
+ * then cached in the userval.  So parsing a message with a 10k-element
+ * repeated field into an arena creates no Lua objects for its elements until
+ * they are read.
+ *
+ * Wrappers of type (1) keep a reference to the object that owns their data
+ * (the arena, or the container they were read from) and never free it.
  *
  * This means that no one may remove/replace any String/Message/Array/Map
  * field/entry in the underlying upb_{msg,array,map} behind our back.  It's ok
@@ -488,7 +495,9 @@ static void lupb_pushmsgval(lua_State *L, upb_fieldtype_t type,
  *
  * For string/submessage entries we keep in the userval:
  *
- *   [number index] -> [lupb_string/lupb_msg userdata]
+ *   [0] -> the message class, for arrays of messages
+ *   [-1] -> the object that owns the array, for arrays we were parsed into
+ *   [1-based index] -> [lupb_string/lupb_msg userdata]
  */
 
 typedef struct {
@@ -499,6 +508,7 @@ typedef struct {
 } lupb_array;
 
 #define ARRAY_MSGCLASS_INDEX 0
+#define ARRAY_OWNER_INDEX -1
 
 static lupb_array *lupb_array_check(lua_State *L, int narg) {
   return luaL_checkudata(L, narg, LUPB_ARRAY);
@@ -549,10 +559,35 @@ static int lupb_array_checkindex(lua_State *L, int narg, uint32_t max) {
 
 static int lupb_array_gc(lua_State *L) {
   lupb_array *larray = lupb_array_check(L, 1);
-  upb_array_uninit(larray->arr);
+  /* Arrays from lupb_array_pushref() belong to their owner. */
+  if (larray->arr == ADD_BYTES(larray, sizeof(*larray))) {
+    upb_array_uninit(larray->arr);
+  }
   return 0;
 }
 
+/**
+ * lupb_array_pushref()
+ *
+ * Pushes a wrapper for the existing array |arr|, which is owned by the object
+ * at the top of the stack.  For arrays of messages, |msgclass| is the absolute
+ * stack index of the element message class; otherwise it is zero.
+ */
+static int lupb_array_pushref(lua_State *L, int msgclass, upb_array *arr) {
+  lupb_array *larray = lupb_newuserdata(L, sizeof(*larray), LUPB_ARRAY);
+
+  larray->lmsgclass = NULL;
+  larray->arr = arr;
+
+  if (msgclass) {
+    larray->lmsgclass = lupb_msgclass_check(L, msgclass);
+    lupb_uservalseti(L, -1, ARRAY_MSGCLASS_INDEX, msgclass);
+  }
+  lupb_uservalseti(L, -1, ARRAY_OWNER_INDEX, -2);
+
+  return 1;
+}
+
 /* lupb_array Public API */
 
 static int lupb_array_new(lua_State *L) {
@@ -586,7 +621,7 @@ static int lupb_array_newindex(lua_State *L) {
   upb_array_set(larray->arr, n, msgval);
 
   if (lupb_istypewrapped(type)) {
-    lupb_uservalseti(L, 1, n, 3);
+    lupb_uservalseti(L, 1, n + 1, 3);
   }
 
   return 0;  /* 1 for chained assignments? */
@@ -599,7 +634,21 @@ static int lupb_array_index(lua_State *L) {
   upb_fieldtype_t type = upb_array_type(array);
 
   if (lupb_istypewrapped(type)) {
-    lupb_uservalgeti(L, 1, n);
+    lupb_uservalgeti(L, 1, n + 1);
+
+    if (lua_isnil(L, -1)) {
+      /* Lazily create the wrapper for an element we were parsed into. */
+      upb_msgval val = upb_array_get(array, n);
+      lua_pop(L, 1);
+      if (type == UPB_TYPE_MESSAGE) {
+        lupb_uservalgeti(L, 1, ARRAY_MSGCLASS_INDEX);
+        lua_pushvalue(L, 1);
+        lupb_msg_pushref(L, lua_gettop(L) - 1, (upb_msg*)val.msg);
+      } else {
+        lua_pushlstring(L, val.str.data, val.str.size);
+      }
+      lupb_uservalseti(L, 1, n + 1, -1);
+    }
   } else {
     lupb_pushmsgval(L, upb_array_type(array), upb_array_get(array, n));
   }
@@ -631,6 +680,10 @@ static const struct luaL_Reg lupb_array_mm[] = {
  *   [Lua number/string] -> [lupb_string/lupb_msg userdata]
  *
  * For other value types we don't use the userdata.
+ *
+ * Maps of messages also keep the value message class, and maps we were parsed
+ * into keep the object that owns them.  These live under light userdata keys
+ * that can't collide with map keys.
  */
 
 typedef struct {
@@ -638,12 +691,23 @@ typedef struct {
   upb_map *map;
 } lupb_map;
 
-#define MAP_MSGCLASS_INDEX 0
+static char lupb_map_ownerkey;
+static char lupb_map_msgclasskey;
+
+/* Sets |key| in the userval of the userdata at the top of the stack to the
+ * value at stack index |val|. */
+static void lupb_map_setref(lua_State *L, char *key, int val) {
+  lupb_getuservalue(L, -1);
+  lua_pushlightuserdata(L, key);
+  lua_pushvalue(L, val);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);  /* Uservalue. */
+}
 
 /* lupb_map internal functions */
 
 static lupb_map *lupb_map_check(lua_State *L, int narg) {
-  return luaL_checkudata(L, narg, LUPB_ARRAY);
+  return luaL_checkudata(L, narg, LUPB_MAP);
 }
 
 /**
@@ -683,10 +747,36 @@ static upb_msgval lupb_map_typecheck(lua_State *L, int narg, int msg,
 
 static int lupb_map_gc(lua_State *L) {
   lupb_map *lmap = lupb_map_check(L, 1);
-  upb_map_uninit(lmap->map);
+  /* Maps from lupb_map_pushref() belong to their owner. */
+  if (lmap->map == ADD_BYTES(lmap, sizeof(*lmap))) {
+    upb_map_uninit(lmap->map);
+  }
   return 0;
 }
 
+/**
+ * lupb_map_pushref()
+ *
+ * Pushes a wrapper for the existing map |map|, which is owned by the object at
+ * the top of the stack.  For maps of messages, |msgclass| is the absolute
+ * stack index of the value message class; otherwise it is zero.
+ */
+static int lupb_map_pushref(lua_State *L, int msgclass, upb_map *map) {
+  int owner = lua_gettop(L);
+  lupb_map *lmap = lupb_newuserdata(L, sizeof(*lmap), LUPB_MAP);
+
+  lmap->value_lmsgclass = NULL;
+  lmap->map = map;
+
+  if (msgclass) {
+    lmap->value_lmsgclass = lupb_msgclass_check(L, msgclass);
+    lupb_map_setref(L, &lupb_map_msgclasskey, msgclass);
+  }
+  lupb_map_setref(L, &lupb_map_ownerkey, owner);
+
+  return 1;
+}
+
 /* lupb_map Public API */
 
 /**
@@ -713,7 +803,7 @@ static int lupb_map_new(lua_State *L) {
 
   if (value_type == UPB_TYPE_MESSAGE) {
     value_lmsgclass = lupb_msgclass_check(L, 2);
-    lupb_uservalseti(L, -1, MAP_MSGCLASS_INDEX, 2);  /* GC-root lmsgclass. */
+    lupb_map_setref(L, &lupb_map_msgclasskey, 2);  /* GC-root lmsgclass. */
   }
 
   lmap->value_lmsgclass = value_lmsgclass;
@@ -737,12 +827,29 @@ static int lupb_map_index(lua_State *L) {
 
   if (lupb_istypewrapped(valtype)) {
     /* Userval contains the full map, lookup there by key. */
+    int userval;
     lupb_getuservalue(L, 1);
+    userval = lua_gettop(L);
     lua_pushvalue(L, 2);
     lua_rawget(L, -2);
 
     if (lua_isnil(L, -1)) {
-      /* TODO: lazy read from upb_map */
+      /* Lazily create the wrapper for a value we were parsed into. */
+      upb_msgval val;
+      if (upb_map_get(map, key, &val)) {
+        lua_pop(L, 1);
+        if (valtype == UPB_TYPE_MESSAGE) {
+          lua_pushlightuserdata(L, &lupb_map_msgclasskey);
+          lua_rawget(L, userval);
+          lua_pushvalue(L, 1);
+          lupb_msg_pushref(L, lua_gettop(L) - 1, (upb_msg*)val.msg);
+        } else {
+          lua_pushlstring(L, val.str.data, val.str.size);
+        }
+        lua_pushvalue(L, 2);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, userval);
+      }
     }
   } else {
     /* Lookup in upb_map. */
@@ -874,13 +981,14 @@ static const struct luaL_Reg lupb_map_mm[] = {
  * Our userval contains:
  *
  * - [0] -> our message class
+ * - [-1] -> the object that owns the message, for messages we were parsed into
  * - [lupb_fieldindex(f)] -> [lupb_{string,array,map,msg} userdata]
  *
  * Fields with scalar number/bool types don't go in the userval.
  */
 
 #define LUPB_MSG_MSGCLASSINDEX 0
-#define LUPB_MSG_ARENA -1
+#define LUPB_MSG_OWNER -1
 
 int lupb_fieldindex(const upb_fielddef *f) {
   return upb_fielddef_index(f) + 1;  /* 1-based Lua arrays. */
@@ -945,7 +1053,14 @@ static const lupb_msgclass *lupb_msg_getsubmsgclass(lua_State *L, int narg,
   return lupb_msgclass_getsubmsgclass(L, -1, f);
 }
 
-int lupb_msg_pushref(lua_State *L, int msgclass, upb_msg *msg) {
+/**
+ * lupb_msg_pushref()
+ *
+ * Pushes a wrapper for the existing message |msg|, which is owned by the
+ * object at the top of the stack: the arena it was parsed into, or the
+ * container it was read from.  |msgclass| must not be a negative index.
+ */
+int lupb_msg_pushref(lua_State *L, int msgclass, void *msg) {
   const lupb_msgclass *lmsgclass = lupb_msgclass_check(L, msgclass);
   lupb_msg *lmsg = lupb_newuserdata(L, sizeof(lupb_msg), LUPB_MSG);
 
@@ -953,17 +1068,53 @@ int lupb_msg_pushref(lua_State *L, int msgclass, upb_msg *msg) {
   lmsg->msg = msg;
 
   lupb_uservalseti(L, -1, LUPB_MSG_MSGCLASSINDEX, msgclass);
-  lupb_uservalseti(L, -1, LUPB_MSG_ARENA, -2);
+  lupb_uservalseti(L, -1, LUPB_MSG_OWNER, -2);
 
   return 1;
 }
 
 static int lupb_msg_gc(lua_State *L) {
   lupb_msg *lmsg = lupb_msg_check(L, 1);
-  upb_msg_uninit(lmsg->msg, lmsg->lmsgclass->layout);
+  /* Messages from lupb_msg_pushref() belong to their owner. */
+  if (lmsg->msg == ADD_BYTES(lmsg, sizeof(*lmsg))) {
+    upb_msg_uninit(lmsg->msg, lmsg->lmsgclass->layout);
+  }
   return 0;
 }
 
+/**
+ * lupb_msg_pushsubref()
+ *
+ * Pushes a wrapper for |val|, the array, map or message in field |f| of the
+ * message at index 1, which owns it.
+ */
+static void lupb_msg_pushsubref(lua_State *L, const upb_fielddef *f,
+                                upb_msgval val) {
+  int msgclass = 0;
+
+  if (upb_fielddef_ismap(f)) {
+    const upb_fielddef *value_field =
+        upb_msgdef_itof(upb_fielddef_msgsubdef(f), UPB_MAPENTRY_VALUE);
+    if (upb_fielddef_type(value_field) == UPB_TYPE_MESSAGE) {
+      lupb_msg_msgclassfor(L, 1, upb_fielddef_msgsubdef(value_field));
+      msgclass = lua_gettop(L);
+    }
+    lua_pushvalue(L, 1);
+    lupb_map_pushref(L, msgclass, (upb_map*)val.map);
+  } else {
+    if (upb_fielddef_type(f) == UPB_TYPE_MESSAGE) {
+      lupb_msg_getsubmsgclass(L, 1, f);
+      msgclass = lua_gettop(L);
+    }
+    lua_pushvalue(L, 1);
+    if (upb_fielddef_isseq(f)) {
+      lupb_array_pushref(L, msgclass, (upb_array*)val.arr);
+    } else {
+      lupb_msg_pushref(L, msgclass, (upb_msg*)val.msg);
+    }
+  }
+}
+
 /* lupb_msg Public API */
 
 /**
@@ -1005,10 +1156,13 @@ static int lupb_msg_index(lua_State *L) {
 
     if (lua_isnil(L, -1)) {
       /* Check if we need to lazily create wrapper. */
-      if (upb_fielddef_isseq(f)) {
-        /* TODO(haberman) */
-      } else if (upb_fielddef_issubmsg(f)) {
-        /* TODO(haberman) */
+      if (upb_fielddef_isseq(f) || upb_fielddef_issubmsg(f)) {
+        upb_msgval val = upb_msg_get(lmsg->msg, field_index, l);
+        if (val.ptr) {
+          lua_pop(L, 1);
+          lupb_msg_pushsubref(L, f, val);
+          lupb_uservalseti(L, 1, lupb_fieldindex(f), -1);
+        }
       } else {
         UPB_ASSERT(upb_fielddef_isstring(f));
         if (upb_msg_has(lmsg->msg, field_index, l)) {
@@ -40,7 +40,8 @@ static int lupb_pb_strtomessage(lua_State *L) {
   upb_env_uninit(&env);
   lupb_checkstatus(L, &status);
 
-  /* References the arena at the top of the stack. */
+  /* References the arena at the top of the stack.  The message's strings,
+   * submessages, arrays and maps get Lua wrappers only when they are read. */
   lupb_msg_pushref(L, lua_upvalueindex(3), msg);
   return 1;
 }
@@ -0,0 +1,619 @@
+/*
+** upb_filesrc and upb_filesink implementation.
+*/
+
+/* read(), mmap() and friends are POSIX, syscall() is a BSD/GNU extension. */
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include "upb/bindings/posix/io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__GNUC__)
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#define UPB_HAVE_IO_URING
+#endif
+#endif
+
+static void seterrno(upb_status *status, const char *what) {
+  upb_status_seterrf(status, "%s: %s", what, strerror(errno));
+}
+
+/* Passes one buffer to the sink, which must take all of it. */
+static bool putblock(upb_bytessink *sink, void *subc, const char *buf,
+                     size_t len, upb_status *status) {
+  upb_bufhandle handle;
+  bool ok;
+
+  if (len == 0) return true;
+
+  upb_bufhandle_init(&handle);
+  upb_bufhandle_setbuf(&handle, buf, 0);
+  ok = upb_bytessink_putbuf(sink, subc, buf, len, &handle) >= len;
+  upb_bufhandle_uninit(&handle);
+
+  if (!ok) {
+    upb_status_seterrmsg(status, "sink did not accept all of the file data");
+  }
+  return ok;
+}
+
+
+/* UPB_FILESRC_READ ***********************************************************/
+
+static bool put_read(int fd, upb_bytessink *sink, void *subc,
+                     size_t block_size, upb_status *status) {
+  char *buf = upb_gmalloc(block_size);
+  bool ok = true;
+
+  if (!buf) {
+    upb_upberr_setoom(status);
+    return false;
+  }
+
+  while (ok) {
+    ssize_t n = read(fd, buf, block_size);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      seterrno(status, "read");
+      ok = false;
+    } else if (n == 0) {
+      break;
+    } else {
+      ok = putblock(sink, subc, buf, n, status);
+    }
+  }
+
+  upb_gfree(buf);
+  return ok;
+}
+
+
+/* UPB_FILESRC_MMAP ***********************************************************/
+
+typedef struct {
+  char *map;
+  size_t map_len;
+
+  /* The unread part of the file, which starts "data" bytes into the map, since
+   * the map has to start on a page boundary. */
+  size_t data;
+  size_t len;
+} filemap;
+
+/* Maps the rest of the file, returning false if it can't be mapped. */
+static bool filemap_init(filemap *m, int fd, const struct stat *st) {
+  off_t pos = lseek(fd, 0, SEEK_CUR);
+  off_t page = sysconf(_SC_PAGESIZE);
+  off_t start;
+
+  if (!S_ISREG(st->st_mode) || pos < 0 || page <= 0 || pos >= st->st_size) {
+    return false;
+  }
+
+  start = pos - pos % page;
+  m->map_len = st->st_size - start;
+  m->data = pos - start;
+  m->len = st->st_size - pos;
+  m->map = mmap(NULL, m->map_len, PROT_READ, MAP_PRIVATE, fd, start);
+  if (m->map == MAP_FAILED) {
+    return false;
+  }
+
+  /* Only a hint, so failure doesn't matter. */
+  posix_madvise(m->map, m->map_len, POSIX_MADV_SEQUENTIAL);
+  return true;
+}
+
+static void filemap_uninit(filemap *m) { munmap(m->map, m->map_len); }
+
+
+/* UPB_FILESRC_URING **********************************************************/
+
+#ifdef UPB_HAVE_IO_URING
+
+/* We talk to the kernel directly rather than through liburing, which is
+ * only a thin layer over these rings anyway. */
+typedef struct {
+  int fd;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_len, cq_ring_len, sqes_len;
+  unsigned to_submit;
+} uring;
+
+/* One block's buffer and the read into it. */
+typedef struct {
+  char *buf;
+  struct iovec iov;
+  uint64_t ofs;
+  size_t len;   /* Bytes in this block. */
+  size_t done;  /* Bytes already passed to the sink. */
+  int res;
+  bool active;
+  bool pending;
+} uring_block;
+
+static void uring_uninit(uring *r) {
+  if (r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_len);
+  if (r->cq_ring != MAP_FAILED) munmap(r->cq_ring, r->cq_ring_len);
+  if (r->sq_ring != MAP_FAILED) munmap(r->sq_ring, r->sq_ring_len);
+  close(r->fd);
+}
+
+static bool uring_init(uring *r, unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  r->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0) {
+    return false;
+  }
+
+  r->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sq_ring = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    r->fd, IORING_OFF_SQ_RING);
+  r->cq_ring = mmap(NULL, r->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    r->fd, IORING_OFF_CQ_RING);
+  r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 r->fd, IORING_OFF_SQES);
+  if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED ||
+      r->sqes == MAP_FAILED) {
+    uring_uninit(r);
+    return false;
+  }
+
+  r->sq_tail = (unsigned*)((char*)r->sq_ring + p.sq_off.tail);
+  r->sq_mask = (unsigned*)((char*)r->sq_ring + p.sq_off.ring_mask);
+  r->sq_array = (unsigned*)((char*)r->sq_ring + p.sq_off.array);
+  r->cq_head = (unsigned*)((char*)r->cq_ring + p.cq_off.head);
+  r->cq_tail = (unsigned*)((char*)r->cq_ring + p.cq_off.tail);
+  r->cq_mask = (unsigned*)((char*)r->cq_ring + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe*)((char*)r->cq_ring + p.cq_off.cqes);
+  r->to_submit = 0;
+  return true;
+}
+
+/* Queues a read of the unread part of block |i|. */
+static void uring_queue(uring *r, int fd, uring_block *blocks, unsigned i) {
+  uring_block *b = &blocks[i];
+  unsigned tail = *r->sq_tail;
+  unsigned idx = tail & *r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[idx];
+
+  b->iov.iov_base = b->buf + b->done;
+  b->iov.iov_len = b->len - b->done;
+  b->pending = true;
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = fd;
+  sqe->off = b->ofs + b->done;
+  sqe->addr = (uint64_t)(uintptr_t)&b->iov;
+  sqe->len = 1;
+  sqe->user_data = i;
+  r->sq_array[idx] = idx;
+
+  /* The kernel must see the entry before the new tail. */
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  r->to_submit++;
+}
+
+/* Submits queued reads and waits for at least one to complete. */
+static bool uring_wait(uring *r, uring_block *blocks) {
+  unsigned head;
+  unsigned tail;
+  int ret;
+
+  do {
+    ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, 1,
+                  IORING_ENTER_GETEVENTS, NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret < 0) {
+    return false;
+  }
+  r->to_submit -= ret;
+
+  head = *r->cq_head;
+  tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    uring_block *b = &blocks[cqe->user_data];
+    b->res = cqe->res;
+    b->pending = false;
+    head++;
+  }
+  __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+  return true;
+}
+
+/* Reads [ofs, end) of |fd| with up to |depth| block reads in flight, passing
+ * the blocks to the sink in order. */
+static bool put_uring(uring *r, int fd, uint64_t ofs, uint64_t end,
+                      upb_bytessink *sink, void *subc, size_t block_size,
+                      unsigned depth, upb_status *status) {
+  uring_block *blocks = upb_gmalloc(depth * sizeof(*blocks));
+  char *bufs = upb_gmalloc(depth * block_size);
+  unsigned cur = 0;
+  unsigned i;
+  bool ok = true;
+
+  if (!blocks || !bufs) {
+    upb_gfree(blocks);
+    upb_gfree(bufs);
+    upb_upberr_setoom(status);
+    return false;
+  }
+
+  for (i = 0; i < depth; i++) {
+    uring_block *b = &blocks[i];
+    b->buf = bufs + i * block_size;
+    b->active = ofs < end;
+    b->pending = false;
+    if (b->active) {
+      b->ofs = ofs;
+      b->len = UPB_MIN(block_size, end - ofs);
+      b->done = 0;
+      ofs += b->len;
+      uring_queue(r, fd, blocks, i);
+    }
+  }
+
+  while (ok && blocks[cur].active) {
+    uring_block *b = &blocks[cur];
+
+    while (b->pending) {
+      if (!uring_wait(r, blocks)) {
+        seterrno(status, "io_uring_enter");
+        ok = false;
+        break;
+      }
+    }
+    if (!ok) break;
+
+    if (b->res <= 0) {
+      /* The file shrank if there's nothing left to read. */
+      errno = b->res < 0 ? -b->res : EIO;
+      seterrno(status, "read");
+      ok = false;
+      break;
+    }
+
+    ok = putblock(sink, subc, b->buf + b->done, b->res, status);
+    b->done += b->res;
+
+    if (b->done < b->len) {
+      /* Short read: fetch the rest of this block before moving on. */
+      uring_queue(r, fd, blocks, cur);
+      continue;
+    }
+
+    /* This buffer is free again; start reading a later block into it. */
+    b->active = ofs < end;
+    if (b->active) {
+      b->ofs = ofs;
+      b->len = UPB_MIN(block_size, end - ofs);
+      b->done = 0;
+      ofs += b->len;
+      uring_queue(r, fd, blocks, cur);
+    }
+    cur = (cur + 1) % depth;
+  }
+
+  /* The kernel may still be writing into our buffers after a failure. */
+  for (i = 0; i < depth; i++) {
+    while (blocks[i].pending && uring_wait(r, blocks)) {}
+  }
+
+  upb_gfree(bufs);
+  upb_gfree(blocks);
+  return ok;
+}
+
+#endif  /* UPB_HAVE_IO_URING */
+
+
+/* Public API *****************************************************************/
+
+bool upb_filesrc_putfd(int fd, upb_bytessink *sink,
+                       const upb_filesrc_opts *opts, upb_status *status) {
+  upb_filesrc_opts defaults = UPB_FILESRC_OPTS_INITIALIZER;
+  upb_filesrc_method method;
+  size_t block_size;
+  size_t size_hint = 0;
+  struct stat st;
+  off_t pos = -1;
+  filemap map = {NULL, 0, 0, 0};
+  void *subc;
+  bool ok;
+#ifdef UPB_HAVE_IO_URING
+  uring ring;
+  unsigned depth = 0;
+#endif
+
+  if (!opts) opts = &defaults;
+  method = opts->method;
+  block_size = opts->block_size > 0 ? opts->block_size : defaults.block_size;
+
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    pos = lseek(fd, 0, SEEK_CUR);
+    if (pos >= 0 && pos < st.st_size) {
+      size_hint = st.st_size - pos;
+    }
+  }
+
+  /* Set up the method before starting the sink, so we can still fall back to
+   * the next one. */
+  if (method == UPB_FILESRC_MMAP && !(pos >= 0 && filemap_init(&map, fd, &st))) {
+    method = UPB_FILESRC_READ;
+  }
+
+  if (method == UPB_FILESRC_URING) {
+#ifdef UPB_HAVE_IO_URING
+    depth = opts->queue_depth > 0 ? opts->queue_depth : defaults.queue_depth;
+    if (pos < 0 || !uring_init(&ring, depth)) {
+      method = UPB_FILESRC_READ;
+    }
+#else
+    method = UPB_FILESRC_READ;
+#endif
+  }
+
+  ok = upb_bytessink_start(sink, size_hint, &subc);
+  if (!ok) {
+    upb_status_seterrmsg(status, "sink failed to start");
+  }
+
+  switch (method) {
+    case UPB_FILESRC_MMAP:
+      ok = ok && putblock(sink, subc, map.map + map.data, map.len, status);
+      filemap_uninit(&map);
+      /* Leave the file position at EOF, as reading would. */
+      lseek(fd, st.st_size, SEEK_SET);
+      break;
+    case UPB_FILESRC_URING:
+#ifdef UPB_HAVE_IO_URING
+      ok = ok && put_uring(&ring, fd, pos, st.st_size, sink, subc, block_size,
+                           depth, status);
+      uring_uninit(&ring);
+      lseek(fd, st.st_size, SEEK_SET);
+#endif
+      break;
+    case UPB_FILESRC_READ:
+      ok = ok && put_read(fd, sink, subc, block_size, status);
+      break;
+  }
+
+  if (ok && !upb_bytessink_end(sink)) {
+    upb_status_seterrmsg(status, "sink failed to end");
+    ok = false;
+  }
+
+  return ok;
+}
+
+bool upb_filesrc_putfile(const char *filename, upb_bytessink *sink,
+                         const upb_filesrc_opts *opts, upb_status *status) {
+  int fd;
+  bool ok;
+
+  do {
+    fd = open(filename, O_RDONLY);
+  } while (fd < 0 && errno == EINTR);
+
+  if (fd < 0) {
+    upb_status_seterrf(status, "couldn't open %s: %s", filename,
+                       strerror(errno));
+    return false;
+  }
+
+  ok = upb_filesrc_putfd(fd, sink, opts, status);
+  close(fd);
+  return ok;
+}
+
+
+/* upb_filesink ***************************************************************/
+
+/* Size of the page that small buffers are gathered into. */
+#define FILESINK_PAGE 65536
+
+/* Buffers at least this big are written from the caller's memory instead of
+ * being copied into the page. */
+#define FILESINK_MAXCOPY 4096
+
+struct upb_filesink {
+  upb_byteshandler handler;
+  upb_bytessink sink;
+  upb_env *env;
+  upb_status status;
+
+  upb_filesink_writefunc *write;
+  void *closure;
+  int fd;
+
+  char *page;
+  size_t len;
+};
+
+static bool filesink_writev(void *closure, const struct iovec *iov,
+                            int iovcnt, upb_status *status) {
+  upb_filesink *sink = closure;
+  struct iovec vec[2];
+  int i;
+
+  UPB_ASSERT(iovcnt <= 2);
+  for (i = 0; i < iovcnt; i++) {
+    vec[i] = iov[i];
+  }
+
+  i = 0;
+  while (i < iovcnt) {
+    ssize_t n = writev(sink->fd, vec + i, iovcnt - i);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      seterrno(status, "writev");
+      return false;
+    }
+
+    /* Skip past whatever was written, which may end mid-buffer. */
+    while (i < iovcnt && (size_t)n >= vec[i].iov_len) {
+      n -= vec[i].iov_len;
+      i++;
+    }
+    if (i < iovcnt) {
+      vec[i].iov_base = (char*)vec[i].iov_base + n;
+      vec[i].iov_len -= n;
+    }
+  }
+
+  return true;
+}
+
+/* Writes the page followed by |len| bytes of |ptr|. */
+static bool filesink_write(upb_filesink *sink, const char *ptr, size_t len) {
+  struct iovec iov[2];
+  int n = 0;
+
+  if (!upb_ok(&sink->status)) return false;
+
+  if (sink->len > 0) {
+    iov[n].iov_base = sink->page;
+    iov[n].iov_len = sink->len;
+    n++;
+  }
+  if (len > 0) {
+    iov[n].iov_base = (char*)ptr;
+    iov[n].iov_len = len;
+    n++;
+  }
+
+  if (n > 0 && !sink->write(sink->closure, iov, n, &sink->status)) {
+    if (upb_ok(&sink->status)) {
+      upb_status_seterrmsg(&sink->status, "write failed");
+    }
+    return false;
+  }
+
+  sink->len = 0;
+  return true;
+}
+
+static void *filesink_start(void *_sink, const void *hd, size_t size_hint) {
+  UPB_UNUSED(hd);
+  UPB_UNUSED(size_hint);
+  return _sink;
+}
+
+static size_t filesink_string(void *_sink, const void *hd, const char *ptr,
+                              size_t len, const upb_bufhandle *handle) {
+  upb_filesink *sink = _sink;
+  UPB_UNUSED(hd);
+  UPB_UNUSED(handle);
+
+  if (!upb_ok(&sink->status)) {
+    return 0;
+  } else if (ptr == sink->page + sink->len) {
+    /* Written into the page we lent from getbuf. */
+    UPB_ASSERT(sink->len + len <= FILESINK_PAGE);
+    sink->len += len;
+  } else if (len >= FILESINK_MAXCOPY) {
+    if (!filesink_write(sink, ptr, len)) return 0;
+  } else {
+    if (sink->len + len > FILESINK_PAGE && !filesink_write(sink, NULL, 0)) {
+      return 0;
+    }
+    memcpy(sink->page + sink->len, ptr, len);
+    sink->len += len;
+  }
+
+  return len;
+}
+
+static char *filesink_getbuf(void *_sink, const void *hd, size_t min,
+                             size_t *size) {
+  upb_filesink *sink = _sink;
+  UPB_UNUSED(hd);
+
+  if (min > FILESINK_PAGE) return NULL;
+  if (sink->len + min > FILESINK_PAGE && !filesink_write(sink, NULL, 0)) {
+    return NULL;
+  }
+
+  *size = FILESINK_PAGE - sink->len;
+  return sink->page + sink->len;
+}
+
+static bool filesink_end(void *_sink, const void *hd) {
+  UPB_UNUSED(hd);
+  return upb_filesink_flush(_sink);
+}
+
+upb_filesink *upb_filesink_newwriter(upb_env *env, upb_filesink_writefunc *func,
+                                     void *closure) {
+  upb_filesink *sink = upb_env_malloc(env, sizeof(upb_filesink));
+  if (!sink) return NULL;
+
+  sink->page = upb_env_malloc(env, FILESINK_PAGE);
+  if (!sink->page) {
+    upb_env_free(env, sink);
+    return NULL;
+  }
+
+  upb_byteshandler_init(&sink->handler);
+  upb_byteshandler_setstartstr(&sink->handler, filesink_start, NULL);
+  upb_byteshandler_setstring(&sink->handler, filesink_string, NULL);
+  upb_byteshandler_setgetbuf(&sink->handler, filesink_getbuf, NULL);
+  upb_byteshandler_setendstr(&sink->handler, filesink_end, NULL);
+  upb_bytessink_reset(&sink->sink, &sink->handler, sink);
+
+  sink->env = env;
+  upb_status_clear(&sink->status);
+  sink->write = func;
+  sink->closure = closure;
+  sink->fd = -1;
+  sink->len = 0;
+
+  return sink;
+}
+
+upb_filesink *upb_filesink_new(upb_env *env, int fd) {
+  upb_filesink *sink = upb_filesink_newwriter(env, filesink_writev, NULL);
+  if (!sink) return NULL;
+  sink->closure = sink;
+  sink->fd = fd;
+  return sink;
+}
+
+void upb_filesink_free(upb_filesink *sink) {
+  upb_env_free(sink->env, sink->page);
+  upb_env_free(sink->env, sink);
+}
+
+upb_bytessink *upb_filesink_sink(upb_filesink *sink) {
+  return &sink->sink;
+}
+
+bool upb_filesink_flush(upb_filesink *sink) {
+  return filesink_write(sink, NULL, 0);
+}
+
+const upb_status *upb_filesink_status(const upb_filesink *sink) {
+  return &sink->status;
+}
@@ -0,0 +1,106 @@
+/*
+** File I/O for upb::BytesSink:
+**
+**   upb_filesrc: pushes the contents of a file into a upb::BytesSink.
+**   upb_filesink: a upb::BytesSink that writes into a file.
+**
+** Three ways of reading the file are offered:
+**
+**  - UPB_FILESRC_READ: read() into a buffer of a configurable block size,
+**    which is passed to the sink one block at a time.  Works on any file
+**    descriptor, including pipes and sockets.
+**
+**  - UPB_FILESRC_MMAP: maps the whole file and passes it to the sink in a
+**    single buffer, so nothing is copied.  The kernel is told that the mapping
+**    will be read sequentially, so it can read ahead aggressively.
+**
+**  - UPB_FILESRC_URING: keeps several block-sized reads in flight with Linux
+**    io_uring, so the sink works on one block while the next ones are being
+**    read.
+**
+** When a method isn't available (a pipe can't be mapped, io_uring needs a
+** recent Linux kernel) we fall back to UPB_FILESRC_READ.
+**
+** A sink that can't take the whole buffer it is given (ie. that returns less
+** from putbuf) fails the transfer, since these functions can't be resumed.
+**
+** upb_filesink is meant for producers like the JSON and text printers, which
+** emit many tiny buffers (a quote, a comma).  Small buffers are copied into a
+** fixed-size page, while a buffer too big to be worth copying is written
+** straight from the caller's memory, together with the buffered data, by a
+** single writev().  Producers that write into memory from getbuf (like the
+** protobuf encoder) fill the page without any copy at all.
+*/
+
+#ifndef UPB_POSIX_IO_H_
+#define UPB_POSIX_IO_H_
+
+#include <sys/uio.h>
+
+#include "upb/sink.h"
+
+UPB_BEGIN_EXTERN_C
+
+typedef enum {
+  UPB_FILESRC_READ = 0,
+  UPB_FILESRC_MMAP = 1,
+  UPB_FILESRC_URING = 2
+} upb_filesrc_method;
+
+typedef struct {
+  upb_filesrc_method method;
+
+  /* Size of each read for UPB_FILESRC_READ and UPB_FILESRC_URING. */
+  size_t block_size;
+
+  /* Number of reads UPB_FILESRC_URING keeps in flight. */
+  unsigned int queue_depth;
+} upb_filesrc_opts;
+
+#define UPB_FILESRC_OPTS_INITIALIZER {UPB_FILESRC_READ, 65536, 4}
+
+/* Reads |fd| from its current position to EOF and pushes the data into |sink|
+ * with a single start/end pair.  The file descriptor is not closed.  |opts|
+ * may be NULL for the defaults.  Returns false and sets |status| on failure,
+ * either of the read or of the sink. */
+bool upb_filesrc_putfd(int fd, upb_bytessink *sink,
+                       const upb_filesrc_opts *opts, upb_status *status);
+
+/* Like upb_filesrc_putfd(), but opens and closes |filename| itself. */
+bool upb_filesrc_putfile(const char *filename, upb_bytessink *sink,
+                         const upb_filesrc_opts *opts, upb_status *status);
+
+
+/* upb_filesink ***************************************************************/
+
+typedef struct upb_filesink upb_filesink;
+
+/* Writes all |iovcnt| buffers of |iov| in order, returning false and setting
+ * |status| on failure.  Used in place of writev() to send the output somewhere
+ * other than a file descriptor. */
+typedef bool upb_filesink_writefunc(void *closure, const struct iovec *iov,
+                                    int iovcnt, upb_status *status);
+
+/* Creates a sink that writes to |fd|, which is not closed by the sink. */
+upb_filesink *upb_filesink_new(upb_env *env, int fd);
+
+/* Creates a sink that passes its output to |func|. */
+upb_filesink *upb_filesink_newwriter(upb_env *env, upb_filesink_writefunc *func,
+                                     void *closure);
+
+/* Frees the sink.  Data that hasn't been flushed yet is lost. */
+void upb_filesink_free(upb_filesink *sink);
+
+upb_bytessink *upb_filesink_sink(upb_filesink *sink);
+
+/* Writes out any buffered data.  The sink also flushes itself when the
+ * bytessink ends, so this is only needed to see the data earlier. */
+bool upb_filesink_flush(upb_filesink *sink);
+
+/* The first write error, if any.  Once a write has failed, the sink accepts
+ * no more data. */
+const upb_status *upb_filesink_status(const upb_filesink *sink);
+
+UPB_END_EXTERN_C
+
+#endif  /* UPB_POSIX_IO_H_ */
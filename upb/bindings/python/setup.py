@@ -1,13 +1,13 @@
-from distutils.core import setup, Extension
+from setuptools import setup, Extension
 
+# Build the upb libraries first with "make lib"; "make python" does both.
 setup(name='upb',
       version='0.1',
       ext_modules=[
-          Extension('upb.__init__', ['upb.c'],
-              include_dirs=['../../'],
-              define_macros=[("UPB_UNALIGNED_READS_OK", 1)],
-              library_dirs=['../../upb'],
-              libraries=['upb_pic'],
+          Extension('upb._upb', ['upb.c'],
+              include_dirs=['../../../'],
+              library_dirs=['../../../lib'],
+              libraries=['upb.pb_pic', 'upb.descriptor_pic', 'upb_pic'],
           ),
       ],
       packages=['upb']
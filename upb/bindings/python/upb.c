@@ -1,732 +1,824 @@
 /*
-** Python extension exposing the core of upb: definitions, handlers,
-** and a message type.
-**/
-
-#include <stddef.h>
+** Python extension exposing upb messages.
+**
+** A DescriptorPool is loaded from a serialized FileDescriptorSet and hands out
+** a MessageClass for each message type.  Messages are upb_msg objects in an
+** arena: MessageClass.FromString() parses with upb_decode() and
+** Message.SerializeToString() encodes with upb_encode().
+**
+** Parsing aliases the input.  Strings and unknown fields point into the
+** caller's buffer, which may be any object supporting the buffer protocol.
+** It is kept alive, and locked against resizing where the object supports
+** that, for as long as any part of the message is.  So the input must not be
+** modified while the message is in use.
+**
+** Python objects are only created for the fields that are read.  Submessage
+** and repeated-field wrappers are then cached, so reading the same field twice
+** returns the same object.  Scalar and string fields may be assigned, and
+** deleted to clear them; submessages and repeated fields are read-only.
+**
+** Messages with map fields, directly or in any submessage type, are rejected
+** since the message factory has no layouts for map entries yet.
+*/
+
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
+
+#include "upb/decode.h"
 #include "upb/def.h"
+#include "upb/encode.h"
 #include "upb/msg.h"
+#include "upb/pb/glue.h"
 
-static bool streql(const char *a, const char *b) { return strcmp(a, b) == 0; }
+static PyObject *PyUpb_DecodeError;
 
-PyObject *PyUpb_Error(const char *str) {
-  PyErr_SetString(PyExc_TypeError, str);
-  return NULL;
-}
+static PyTypeObject *PyUpb_ArenaType;
+static PyTypeObject *PyUpb_DescriptorPoolType;
+static PyTypeObject *PyUpb_MessageClassType;
+static PyTypeObject *PyUpb_MessageType;
+static PyTypeObject *PyUpb_RepeatedType;
 
-int PyUpb_ErrorInt(const char *str) {
-  PyErr_SetString(PyExc_TypeError, str);
-  return -1;
+/* Heap types own a reference to their type object. */
+static void PyUpb_Dealloc(PyObject *self) {
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free(self);
+  Py_DECREF(type);
 }
 
-#define PyUpb_CheckStatus(status) \
-  if (!upb_ok(status)) return PyUpb_Error((status)->str);
 
-static upb_accessor_vtbl *PyUpb_AccessorForField(upb_fielddef *f);
+/* PyUpb_Arena ****************************************************************/
 
+/* Owns the memory of a tree of messages, and the buffer it was parsed from.
+ * Every wrapper for a part of the tree holds a reference to it. */
 
-/* Object cache ***************************************************************/
+typedef struct {
+  PyObject_HEAD
+  upb_env env;
+  Py_buffer buf;  /* buf.obj is NULL if there is no buffer. */
+} PyUpb_Arena;
 
-// For objects that are just wrappers around a C object pointer, we keep a
-// cache mapping C pointer -> wrapper object.  This allows us to consistently
-// vend the same Python object given the same C object.  This prevents us from
-// creating too many Python objects unnecessarily.  Just as importantly, it
-// provides the expected semantics:
-//
-//   if field.subdef is field.subdef:
-//     print "Sanity prevails."
-//
-// If we conjured up a new wrapper object every time, the above would not be
-// true.
-//
-// The cost is having to put all such objects in a table, but since this only
-// applies to schema-level objects (defs, handlers, etc) this seems acceptable.
-// We do *not* have to put all message objects in this table.
-//
-// We use weak refs so that the cache does not prevent the wrapper objects from
-// being collected.  The table is stored as a static variable; to use
-// sub-interpreters this would need to change, but I believe that using
-// sub-interpreters is exceedingly rare in practice.
+static PyUpb_Arena *PyUpb_Arena_new(void) {
+  PyUpb_Arena *arena = PyObject_New(PyUpb_Arena, PyUpb_ArenaType);
+  if (!arena) return NULL;
+  upb_env_init(&arena->env);
+  arena->buf.obj = NULL;
+  return arena;
+}
 
-typedef struct {
-  PyObject_HEAD;
-  void *obj;
-  PyObject *weakreflist;
-} PyUpb_ObjWrapper;
-
-static PyObject *obj_cache = NULL;
-static PyObject *reverse_cache = NULL;
-static PyObject *weakref_callback = NULL;
-
-// Utility functions for manipulating Python dictionaries keyed by pointer.
-
-static PyObject *PyUpb_StringForPointer(const void *ptr) {
-  PyObject *o = PyString_FromStringAndSize((const char *)&ptr, sizeof(void*));
-  UPB_ASSERT(o);
-  return o;
-}
-
-static PyObject *PyUpb_ObjCacheDeleteCallback(PyObject *self, PyObject *ref) {
-  // Python very unfortunately clears the weakref before running our callback.
-  // This prevents us from using the weakref to find the C pointer we need to
-  // remove from the cache.  As a result we are forced to keep a second map
-  // mapping weakref->C pointer.
-  PyObject *ptr_str = PyDict_GetItem(reverse_cache, ref);
-  UPB_ASSERT(ptr_str);
-  int err = PyDict_DelItem(obj_cache, ptr_str);
-  UPB_ASSERT(!err);
-  err = PyDict_DelItem(reverse_cache, ref);
-  UPB_ASSERT(!err);
-  return Py_None;
-}
-
-static PyObject *PyUpb_ObjCacheGet(const void *obj, PyTypeObject *type) {
-  PyObject *kv = PyUpb_StringForPointer(obj);
-  PyObject *ref = PyDict_GetItem(obj_cache, kv);
-  PyObject *ret;
-  if (ref) {
-    ret = PyWeakref_GetObject(ref);
-    UPB_ASSERT(ret != Py_None);
-    Py_INCREF(ret);
-  } else {
-    PyUpb_ObjWrapper *wrapper = (PyUpb_ObjWrapper*)type->tp_alloc(type, 0);
-    wrapper->obj = (void*)obj;
-    wrapper->weakreflist = NULL;
-    ret = (PyObject*)wrapper;
-    ref = PyWeakref_NewRef(ret, weakref_callback);
-    UPB_ASSERT(PyWeakref_GetObject(ref) == ret);
-    UPB_ASSERT(ref);
-    PyDict_SetItem(obj_cache, kv, ref);
-    PyDict_SetItem(reverse_cache, ref, kv);
-  }
-  UPB_ASSERT(ret);
-  Py_DECREF(kv);
-  return ret;
+static upb_alloc *PyUpb_Arena_alloc(PyUpb_Arena *arena) {
+  return upb_arena_alloc(upb_env_arena(&arena->env));
 }
 
+static void PyUpb_Arena_dealloc(PyObject *self) {
+  PyUpb_Arena *arena = (PyUpb_Arena*)self;
+  upb_env_uninit(&arena->env);
+  if (arena->buf.obj) PyBuffer_Release(&arena->buf);
+  PyUpb_Dealloc(self);
+}
 
-/* PyUpb_Def ******************************************************************/
+static PyType_Slot PyUpb_Arena_slots[] = {
+  {Py_tp_dealloc, PyUpb_Arena_dealloc},
+  {0, NULL}
+};
 
-static PyTypeObject *PyUpb_TypeForDef(const upb_def *def);
+static PyType_Spec PyUpb_Arena_spec = {
+  "upb._upb.Arena",
+  sizeof(PyUpb_Arena),
+  0,
+  Py_TPFLAGS_DEFAULT,
+  PyUpb_Arena_slots
+};
 
-static void PyUpb_Def_dealloc(PyObject *obj) {
-  PyUpb_ObjWrapper *wrapper = (void*)obj;
-  upb_def_unref((upb_def*)wrapper->obj);
-  obj->ob_type->tp_free(obj);
-}
 
-PyObject *PyUpb_Def_GetOrCreate(const upb_def *def) {
-  return def ? PyUpb_ObjCacheGet(def, PyUpb_TypeForDef(def)) : Py_None;
-}
+/* PyUpb_DescriptorPool *******************************************************/
 
-// Will need to expand once other kinds of defs are supported.
-#define Check_Def(o, badret) Check_MessageDef(o, badret)
+typedef struct {
+  PyObject_HEAD
+  upb_symtab *symtab;
+  upb_msgfactory *factory;
+  PyObject *classes;  /* Full name -> MessageClass. */
+} PyUpb_DescriptorPool;
 
+typedef struct {
+  PyObject_HEAD
+  PyUpb_DescriptorPool *pool;
+  const upb_msgdef *md;
+  const upb_msglayout *layout;
+  int hasmaps;  /* -1 until computed. */
+} PyUpb_MessageClass;
+
+static PyObject *PyUpb_DescriptorPool_new(PyTypeObject *type, PyObject *args,
+                                          PyObject *kwds) {
+  static char *kwlist[] = {"serialized_file_descriptor_set", NULL};
+  PyUpb_DescriptorPool *pool;
+  upb_status status = UPB_STATUS_INIT;
+  upb_filedef **files;
+  Py_buffer buf;
+  bool ok = true;
+  size_t i;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*", kwlist, &buf)) {
+    return NULL;
+  }
 
-/* PyUpb_FieldDef *************************************************************/
+  files = upb_loaddescriptor(buf.buf, buf.len, &files, &status);
+  PyBuffer_Release(&buf);
+  if (!files) {
+    PyErr_SetString(PyExc_ValueError, upb_status_errmsg(&status));
+    return NULL;
+  }
 
-static PyTypeObject PyUpb_FieldDefType;
-static int PyUpb_FieldDef_setattro(PyObject *o, PyObject *key, PyObject *val);
+  pool = (PyUpb_DescriptorPool*)type->tp_alloc(type, 0);
+  if (pool) {
+    pool->symtab = upb_symtab_new();
+    pool->classes = PyDict_New();
+  }
 
-#define Check_FieldDef(o, badret) \
-  (void*)(((PyUpb_ObjWrapper*)o)->obj); do { \
-    if(!PyObject_TypeCheck(o, &PyUpb_FieldDefType)) { \
-      PyErr_SetString(PyExc_TypeError, "must be a upb.FieldDef"); \
-      return badret; \
-    } \
-  } while(0)
+  for (i = 0; files[i]; i++) {
+    if (ok && pool && !upb_symtab_addfile(pool->symtab, files[i], &status)) {
+      PyErr_SetString(PyExc_ValueError, upb_status_errmsg(&status));
+      ok = false;
+    }
+    upb_filedef_unref(files[i], &files);
+  }
+  upb_gfree(files);
 
-static PyObject *PyUpb_FieldDef_GetOrCreate(const upb_fielddef *f) {
-  return PyUpb_ObjCacheGet(f, &PyUpb_FieldDefType);
+  if (!pool) return NULL;
+  pool->factory = upb_msgfactory_new(pool->symtab);
+  if (!ok || !pool->classes) {
+    Py_DECREF(pool);
+    return NULL;
+  }
+  return (PyObject*)pool;
 }
 
-static PyObject *PyUpb_FieldDef_new(PyTypeObject *subtype,
-                                    PyObject *args, PyObject *kwds) {
-  return PyUpb_ObjCacheGet(upb_fielddef_new(), subtype);
+static int PyUpb_DescriptorPool_traverse(PyObject *self, visitproc visit,
+                                         void *arg) {
+  Py_VISIT(((PyUpb_DescriptorPool*)self)->classes);
+  Py_VISIT(Py_TYPE(self));
+  return 0;
 }
 
-static int PyUpb_FieldDef_init(PyObject *self, PyObject *args, PyObject *kwds) {
-  if (!kwds) return 0;
-  PyObject *key, *value;
-  Py_ssize_t pos = 0;
-  while (PyDict_Next(kwds, &pos, &key, &value))
-    PyUpb_FieldDef_setattro(self, key, value);
+static int PyUpb_DescriptorPool_clear(PyObject *self) {
+  Py_CLEAR(((PyUpb_DescriptorPool*)self)->classes);
   return 0;
 }
 
-static void PyUpb_FieldDef_dealloc(PyObject *obj) {
-  PyUpb_ObjWrapper *wrapper = (void*)obj;
-  if (wrapper->weakreflist) PyObject_ClearWeakRefs(obj);
-  upb_fielddef_unref((upb_fielddef*)wrapper->obj);
-  obj->ob_type->tp_free(obj);
+static void PyUpb_DescriptorPool_dealloc(PyObject *self) {
+  PyUpb_DescriptorPool *pool = (PyUpb_DescriptorPool*)self;
+  PyObject_GC_UnTrack(self);
+  PyUpb_DescriptorPool_clear(self);
+  if (pool->factory) upb_msgfactory_free(pool->factory);
+  if (pool->symtab) upb_symtab_free(pool->symtab);
+  PyUpb_Dealloc(self);
 }
 
-static PyObject *PyUpb_FieldDef_getattro(PyObject *obj, PyObject *attr_name) {
-  upb_fielddef *f = Check_FieldDef(obj, NULL);
-  if (!upb_fielddef_ismutable(f)) {
-    PyErr_SetString(PyExc_TypeError, "fielddef is not mutable.");
-    return NULL;
+/* Returns a new reference to the class for |md|, which is in |pool|. */
+static PyObject *PyUpb_DescriptorPool_getclass(PyUpb_DescriptorPool *pool,
+                                               const upb_msgdef *md) {
+  PyObject *name = PyUnicode_FromString(upb_msgdef_fullname(md));
+  PyUpb_MessageClass *cls;
+
+  if (!name) return NULL;
+  cls = (PyUpb_MessageClass*)PyDict_GetItemWithError(pool->classes, name);
+  if (cls || PyErr_Occurred()) {
+    Py_XINCREF(cls);
+    Py_DECREF(name);
+    return (PyObject*)cls;
   }
-  const char *name = PyString_AsString(attr_name);
-  if (streql(name, "name")) {
-    const char *name = upb_fielddef_name(f);
-    return name == NULL ? Py_None : PyString_FromString(name);
-  } else if (streql(name, "number")) {
-    uint32_t num = upb_fielddef_number(f);
-    return num == 0 ? Py_None : PyInt_FromLong(num);
-  } else if (streql(name, "type")) {
-    uint8_t type = upb_fielddef_type(f);
-    return type == 0 ? Py_None : PyInt_FromLong(type);
-  } else if (streql(name, "label")) {
-    return PyInt_FromLong(upb_fielddef_label(f));
-  } else if (streql(name, "type_name")) {
-    const char *name = upb_fielddef_typename(f);
-    return name == NULL ? Py_None : PyString_FromString(name);
-  } else if (streql(name, "subdef")) {
-    // NYI;
-    return NULL;
-  } else if (streql(name, "msgdef")) {
-    // NYI;
+
+  cls = PyObject_GC_New(PyUpb_MessageClass, PyUpb_MessageClassType);
+  if (cls) {
+    Py_INCREF(pool);
+    cls->pool = pool;
+    cls->md = md;
+    cls->layout = upb_msgfactory_getlayout(pool->factory, md);
+    cls->hasmaps = -1;
+    PyObject_GC_Track(cls);
+    if (PyDict_SetItem(pool->classes, name, (PyObject*)cls) < 0) {
+      Py_CLEAR(cls);
+    }
+  }
+  Py_DECREF(name);
+  return (PyObject*)cls;
+}
+
+static PyObject *PyUpb_DescriptorPool_message_class(PyObject *self,
+                                                    PyObject *arg) {
+  PyUpb_DescriptorPool *pool = (PyUpb_DescriptorPool*)self;
+  const char *name = PyUnicode_AsUTF8(arg);
+  const upb_msgdef *md;
+
+  if (!name) return NULL;
+  md = upb_symtab_lookupmsg(pool->symtab, name);
+  if (!md || upb_msgdef_mapentry(md)) {
+    PyErr_Format(PyExc_KeyError, "no message type named '%s'", name);
     return NULL;
-  } else {
-    return PyUpb_Error("Invalid fielddef member.");
-  }
-}
-
-static int PyUpb_FieldDef_setattro(PyObject *o, PyObject *key, PyObject *val) {
-  upb_fielddef *f = Check_FieldDef(o, -1);
-  const char *field = PyString_AsString(key);
-  if (!upb_fielddef_ismutable(f))
-    return PyUpb_ErrorInt("fielddef is not mutable.");
-  if (streql(field, "name")) {
-    const char *name = PyString_AsString(val);
-    if (!name || !upb_fielddef_setname(f, name))
-      return PyUpb_ErrorInt("Invalid name");
-  } else if (streql(field, "number")) {
-    // TODO: should check truncation.  Non-security issue.
-    // Non-int will return -1, which is already invalid as a field number.
-    if (!upb_fielddef_setnumber(f, PyInt_AsLong(val)))
-      return PyUpb_ErrorInt("Invalid number");
-  } else if (streql(field, "type")) {
-    // TODO: should check truncation.  Non-security issue.
-    if (!upb_fielddef_settype(f, PyInt_AsLong(val)))
-      return PyUpb_ErrorInt("Invalid type");
-  } else if (streql(field, "label")) {
-    // TODO: should check truncation.  Non-security issue.
-    if (!upb_fielddef_setlabel(f, PyInt_AsLong(val)))
-      return PyUpb_ErrorInt("Invalid label");
-  } else if (streql(field, "type_name")) {
-    const char *name = PyString_AsString(val);
-    if (!name || !upb_fielddef_settypename(f, name))
-      return PyUpb_ErrorInt("Invalid type_name");
-  } else if (streql(field, "default_value")) {
-    // NYI
-    return -1;
-  } else {
-    return PyUpb_ErrorInt("Invalid fielddef member.");
   }
-  return 0;
+  return PyUpb_DescriptorPool_getclass(pool, md);
 }
 
-static PyTypeObject PyUpb_FieldDefType = {
-  PyObject_HEAD_INIT(NULL)
-  0,                                      /* ob_size */
-  "upb.FieldDef",                         /* tp_name */
-  sizeof(PyUpb_ObjWrapper),               /* tp_basicsize */
-  0,                                      /* tp_itemsize */
-  &PyUpb_FieldDef_dealloc,                /* tp_dealloc */
-  0,                                      /* tp_print */
-  0,                                      /* tp_getattr */
-  0,                                      /* tp_setattr */
-  0,                                      /* tp_compare */
-  0, /* TODO */                           /* tp_repr */
-  0,                                      /* tp_as_number */
-  0,                                      /* tp_as_sequence */
-  0,                                      /* tp_as_mapping */
-  0,                                      /* tp_hash */
-  0,                                      /* tp_call */
-  0,                                      /* tp_str */
-  &PyUpb_FieldDef_getattro,               /* tp_getattro */
-  &PyUpb_FieldDef_setattro,               /* tp_setattro */
-  0,                                      /* tp_as_buffer */
-  Py_TPFLAGS_DEFAULT,                     /* tp_flags */
-  0,                                      /* tp_doc */
-  0,                                      /* tp_traverse */
-  0,                                      /* tp_clear */
-  0,                                      /* tp_richcompare */
-  offsetof(PyUpb_ObjWrapper, weakreflist),/* tp_weaklistoffset */
-  0,                                      /* tp_iter */
-  0,                                      /* tp_iternext */
-  0,                                      /* tp_methods */
-  0,                                      /* tp_members */
-  0,                                      /* tp_getset */
-  0,                                      /* tp_base */
-  0,                                      /* tp_dict */
-  0,                                      /* tp_descr_get */
-  0,                                      /* tp_descr_set */
-  0,                                      /* tp_dictoffset */
-  &PyUpb_FieldDef_init,                   /* tp_init */
-  0,                                      /* tp_alloc */
-  &PyUpb_FieldDef_new,                    /* tp_new */
-  0,                                      /* tp_free */
+static PyMethodDef PyUpb_DescriptorPool_methods[] = {
+  {"message_class", PyUpb_DescriptorPool_message_class, METH_O,
+   "Returns the MessageClass for the message type with this full name."},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyType_Slot PyUpb_DescriptorPool_slots[] = {
+  {Py_tp_new, PyUpb_DescriptorPool_new},
+  {Py_tp_dealloc, PyUpb_DescriptorPool_dealloc},
+  {Py_tp_traverse, PyUpb_DescriptorPool_traverse},
+  {Py_tp_clear, PyUpb_DescriptorPool_clear},
+  {Py_tp_methods, PyUpb_DescriptorPool_methods},
+  {Py_tp_doc, "DescriptorPool(serialized_file_descriptor_set)"},
+  {0, NULL}
 };
 
+static PyType_Spec PyUpb_DescriptorPool_spec = {
+  "upb._upb.DescriptorPool",
+  sizeof(PyUpb_DescriptorPool),
+  0,
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+  PyUpb_DescriptorPool_slots
+};
 
-/* PyUpb_MessageDef ***********************************************************/
 
-static PyTypeObject PyUpb_MessageDefType;
-static int PyUpb_MessageDef_setattro(PyObject *o, PyObject *key, PyObject *val);
+/* PyUpb_Message **************************************************************/
 
-#define Check_MessageDef(o, badret) \
-  (void*)(((PyUpb_ObjWrapper*)o)->obj); do { \
-    if(!PyObject_TypeCheck(o, &PyUpb_MessageDefType)) { \
-      PyErr_SetString(PyExc_TypeError, "must be a upb.MessageDef"); \
-      return badret; \
-    } \
-  } while(0)
+typedef struct {
+  PyObject_HEAD
+  PyUpb_MessageClass *cls;
+  PyUpb_Arena *arena;
+  upb_msg *msg;
+  PyObject *wrappers;  /* Field name -> wrapper, NULL until one is created. */
+} PyUpb_Message;
 
-static PyObject *PyUpb_MessageDef_new(PyTypeObject *subtype,
-                                      PyObject *args, PyObject *kwds) {
-  return PyUpb_ObjCacheGet(upb_msgdef_new(), subtype);
+static PyObject *PyUpb_Message_wrap(PyUpb_MessageClass *cls,
+                                    PyUpb_Arena *arena, upb_msg *msg) {
+  PyUpb_Message *m = PyObject_New(PyUpb_Message, PyUpb_MessageType);
+  if (!m) return NULL;
+  Py_INCREF(cls);
+  Py_INCREF(arena);
+  m->cls = cls;
+  m->arena = arena;
+  m->msg = msg;
+  m->wrappers = NULL;
+  return (PyObject*)m;
+}
+
+static void PyUpb_Message_dealloc(PyObject *self) {
+  PyUpb_Message *m = (PyUpb_Message*)self;
+  Py_DECREF(m->cls);
+  Py_DECREF(m->arena);
+  Py_XDECREF(m->wrappers);
+  PyUpb_Dealloc(self);
+}
+
+static const upb_msglayout_msginit_v1 *PyUpb_Message_init(
+    const PyUpb_Message *m) {
+  return (const upb_msglayout_msginit_v1*)m->cls->layout;
+}
+
+/* Converts a scalar or string field value. */
+static PyObject *PyUpb_ToPy(upb_fieldtype_t type, upb_msgval val) {
+  switch (type) {
+    case UPB_TYPE_INT32:
+    case UPB_TYPE_ENUM:
+      return PyLong_FromLong(upb_msgval_getint32(val));
+    case UPB_TYPE_INT64:
+      return PyLong_FromLongLong(upb_msgval_getint64(val));
+    case UPB_TYPE_UINT32:
+      return PyLong_FromUnsignedLong(upb_msgval_getuint32(val));
+    case UPB_TYPE_UINT64:
+      return PyLong_FromUnsignedLongLong(upb_msgval_getuint64(val));
+    case UPB_TYPE_FLOAT:
+      return PyFloat_FromDouble(upb_msgval_getfloat(val));
+    case UPB_TYPE_DOUBLE:
+      return PyFloat_FromDouble(upb_msgval_getdouble(val));
+    case UPB_TYPE_BOOL:
+      return PyBool_FromLong(upb_msgval_getbool(val));
+    case UPB_TYPE_STRING:
+      return PyUnicode_DecodeUTF8(val.str.data, val.str.size, NULL);
+    case UPB_TYPE_BYTES:
+      return PyBytes_FromStringAndSize(val.str.data, val.str.size);
+    case UPB_TYPE_MESSAGE:
+      break;
+  }
+  UPB_UNREACHABLE();
 }
 
-static PyObject *PyUpb_MessageDef_add_fields(PyObject *o, PyObject *args);
-
-static int PyUpb_MessageDef_init(
-    PyObject *self, PyObject *args, PyObject *kwds) {
-  if (!kwds) return 0;
-  PyObject *key, *value;
-  Py_ssize_t pos = 0;
-  while (PyDict_Next(kwds, &pos, &key, &value)) {
-    const char *field = PyString_AsString(key);
-    if (streql(field, "fields")) {
-      PyUpb_MessageDef_add_fields(self, value);
-    } else {
-      PyUpb_MessageDef_setattro(self, key, value);
+static bool PyUpb_CheckRange(long long val, long long min, long long max) {
+  if (val < min || val > max) {
+    PyErr_SetString(PyExc_ValueError, "value out of range for field");
+    return false;
+  }
+  return true;
+}
+
+/* Converts |obj| for a scalar or string field, copying strings into |arena|.
+ * Returns false with an exception set if |obj| has the wrong type. */
+static bool PyUpb_FromPy(upb_fieldtype_t type, PyObject *obj,
+                         PyUpb_Arena *arena, upb_msgval *val) {
+  switch (type) {
+    case UPB_TYPE_INT32:
+    case UPB_TYPE_ENUM:
+    case UPB_TYPE_INT64: {
+      long long v = PyLong_AsLongLong(obj);
+      if (v == -1 && PyErr_Occurred()) return false;
+      if (type == UPB_TYPE_INT64) {
+        *val = upb_msgval_int64(v);
+      } else {
+        if (!PyUpb_CheckRange(v, INT32_MIN, INT32_MAX)) return false;
+        *val = upb_msgval_int32((int32_t)v);
+      }
+      return true;
+    }
+    case UPB_TYPE_UINT32:
+    case UPB_TYPE_UINT64: {
+      unsigned long long v = PyLong_AsUnsignedLongLong(obj);
+      if (v == (unsigned long long)-1 && PyErr_Occurred()) return false;
+      if (type == UPB_TYPE_UINT64) {
+        *val = upb_msgval_uint64(v);
+      } else {
+        if (v > UINT32_MAX) return PyUpb_CheckRange(1, 0, 0);
+        *val = upb_msgval_uint32((uint32_t)v);
+      }
+      return true;
+    }
+    case UPB_TYPE_FLOAT:
+    case UPB_TYPE_DOUBLE: {
+      double v = PyFloat_AsDouble(obj);
+      if (v == -1.0 && PyErr_Occurred()) return false;
+      if (type == UPB_TYPE_FLOAT) {
+        *val = upb_msgval_float((float)v);
+      } else {
+        *val = upb_msgval_double(v);
+      }
+      return true;
+    }
+    case UPB_TYPE_BOOL: {
+      int v = PyObject_IsTrue(obj);
+      if (v < 0) return false;
+      *val = upb_msgval_bool(v);
+      return true;
+    }
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES: {
+      const char *data;
+      Py_ssize_t len;
+      char *copy;
+      if (type == UPB_TYPE_STRING) {
+        data = PyUnicode_AsUTF8AndSize(obj, &len);
+        if (!data) return false;
+      } else if (PyBytes_AsStringAndSize(obj, (char**)&data, &len) < 0) {
+        return false;
+      }
+      copy = upb_malloc(PyUpb_Arena_alloc(arena), len);
+      if (!copy && len > 0) {
+        PyErr_NoMemory();
+        return false;
+      }
+      memcpy(copy, data, len);
+      *val = upb_msgval_makestr(copy, len);
+      return true;
     }
+    case UPB_TYPE_MESSAGE:
+      break;
   }
-  return 0;
+  UPB_UNREACHABLE();
 }
 
-static PyObject *PyUpb_MessageDef_getattro(PyObject *obj, PyObject *attr_name) {
-  upb_msgdef *m = Check_MessageDef(obj, NULL);
-  const char *name = PyString_AsString(attr_name);
-  if (streql(name, "fqname")) {
-    const char *fqname = upb_def_fqname(UPB_UPCAST(m));
-    return fqname == NULL ? Py_None : PyString_FromString(fqname);
+static PyObject *PyUpb_Repeated_new(PyUpb_Arena *arena,
+                                    const upb_fielddef *f, PyObject *cls,
+                                    const upb_array *arr);
+
+/* Returns the field named |name|, or NULL without an exception if there is
+ * none. */
+static const upb_fielddef *PyUpb_Message_field(PyUpb_Message *m,
+                                               PyObject *name) {
+  Py_ssize_t len;
+  const char *str;
+
+  if (!PyUnicode_Check(name)) return NULL;
+  str = PyUnicode_AsUTF8AndSize(name, &len);
+  if (!str) {
+    PyErr_Clear();
+    return NULL;
   }
-  return PyObject_GenericGetAttr(obj, attr_name);
+  return upb_msgdef_ntof(m->cls->md, str, len);
 }
 
-static int PyUpb_MessageDef_setattro(
-    PyObject *o, PyObject *key, PyObject *val) {
-  upb_msgdef *m = Check_MessageDef(o, -1);
-  if (!upb_def_ismutable(UPB_UPCAST(m))) {
-    PyErr_SetString(PyExc_TypeError, "MessageDef is not mutable.");
-    return -1;
+/* Creates the wrapper for submessage or repeated field |f|, or returns None
+ * for an unset submessage. */
+static PyObject *PyUpb_Message_newwrapper(PyUpb_Message *m,
+                                          const upb_fielddef *f) {
+  upb_msgval val = upb_msg_get(m->msg, upb_fielddef_index(f), m->cls->layout);
+  PyObject *subcls = NULL;
+  PyObject *ret;
+
+  if (upb_fielddef_issubmsg(f)) {
+    if (!upb_fielddef_isseq(f) && !val.msg) Py_RETURN_NONE;
+    subcls = PyUpb_DescriptorPool_getclass(m->cls->pool,
+                                           upb_fielddef_msgsubdef(f));
+    if (!subcls) return NULL;
   }
-  const char *name = PyString_AsString(key);
-  if (streql(name, "fqname")) {
-    const char *fqname = PyString_AsString(val);
-    if (!fqname || !upb_def_setfqname(UPB_UPCAST(m), fqname))
-      return PyUpb_ErrorInt("Invalid fqname");
+
+  if (upb_fielddef_isseq(f)) {
+    ret = PyUpb_Repeated_new(m->arena, f, subcls, val.arr);
   } else {
-    return PyUpb_ErrorInt("Invalid MessageDef member.");
+    ret = PyUpb_Message_wrap((PyUpb_MessageClass*)subcls, m->arena,
+                             (upb_msg*)val.msg);
+  }
+  Py_XDECREF(subcls);
+  return ret;
+}
+
+static PyObject *PyUpb_Message_getattro(PyObject *self, PyObject *name) {
+  PyUpb_Message *m = (PyUpb_Message*)self;
+  const upb_fielddef *f = PyUpb_Message_field(m, name);
+  PyObject *ret;
+
+  if (!f) return PyObject_GenericGetAttr(self, name);
+
+  if (!upb_fielddef_issubmsg(f) && !upb_fielddef_isseq(f)) {
+    return PyUpb_ToPy(
+        upb_fielddef_type(f),
+        upb_msg_get(m->msg, upb_fielddef_index(f), m->cls->layout));
+  }
+
+  if (m->wrappers) {
+    ret = PyDict_GetItemWithError(m->wrappers, name);
+    if (ret) {
+      Py_INCREF(ret);
+      return ret;
+    } else if (PyErr_Occurred()) {
+      return NULL;
+    }
+  } else if (!(m->wrappers = PyDict_New())) {
+    return NULL;
+  }
+
+  ret = PyUpb_Message_newwrapper(m, f);
+  if (ret && ret != Py_None && PyDict_SetItem(m->wrappers, name, ret) < 0) {
+    Py_CLEAR(ret);
+  }
+  return ret;
+}
+
+static int PyUpb_Message_setattro(PyObject *self, PyObject *name,
+                                  PyObject *value) {
+  PyUpb_Message *m = (PyUpb_Message*)self;
+  const upb_fielddef *f = PyUpb_Message_field(m, name);
+  int index;
+  upb_msgval val;
+
+  if (!f) return PyObject_GenericSetAttr(self, name, value);
+
+  if (upb_fielddef_issubmsg(f) || upb_fielddef_isseq(f)) {
+    PyErr_Format(PyExc_AttributeError,
+                 "submessage and repeated field '%s' are read-only",
+                 upb_fielddef_name(f));
+    return -1;
+  }
+
+  index = upb_fielddef_index(f);
+  if (!value) {
+    upb_msg_clearfield(m->msg, index, m->cls->layout);
+    return 0;
   }
+
+  if (!PyUpb_FromPy(upb_fielddef_type(f), value, m->arena, &val)) return -1;
+  upb_msg_set(m->msg, index, val, m->cls->layout);
   return 0;
 }
 
-static PyObject *PyUpb_MessageDef_fields(PyObject *obj, PyObject *args) {
-  upb_msgdef *m = Check_MessageDef(obj, NULL);
-  PyObject *ret = PyList_New(0);
-  upb_msg_field_iter i;
-  for(upb_msg_field_begin(&i, m);
-      !upb_msg_field_done(&i);
-      upb_msg_field_next(&ii)) {
-    upb_fielddef *f = upb_msg_iter_field(&i);
-    PyList_Append(ret, PyUpb_FieldDef_GetOrCreate(f));
+static PyObject *PyUpb_Message_SerializeToString(PyObject *self,
+                                                 PyObject *unused) {
+  PyUpb_Message *m = (PyUpb_Message*)self;
+  const upb_msglayout_msginit_v1 *l = PyUpb_Message_init(m);
+  size_t size = upb_encode_size(m->msg, l);
+  size_t len;
+  PyObject *ret = PyBytes_FromStringAndSize(NULL, size);
+
+  UPB_UNUSED(unused);
+  if (!ret) return NULL;
+
+  /* Sized exactly, so the encoder writes straight into the bytes object. */
+  if (!upb_encode_into(m->msg, l, PyBytes_AS_STRING(ret), size, &len)) {
+    Py_DECREF(ret);
+    PyErr_SetString(PyExc_RuntimeError, "error serializing message");
+    return NULL;
   }
+  UPB_ASSERT(len == size);
   return ret;
 }
 
-static PyObject *PyUpb_MessageDef_add_fields(PyObject *o, PyObject *fields) {
-  upb_msgdef *m = Check_MessageDef(o, NULL);
-  if (!PySequence_Check(fields)) return PyUpb_Error("Must be a sequence");
-  Py_ssize_t len = PySequence_Length(fields);
-  if (len > UPB_MAX_FIELDS) return PyUpb_Error("Too many fields.");
-  upb_fielddef *f[len];
-  int i;
-  for (i = 0; i < len; i++) {
-    PyObject *field = PySequence_GetItem(fields, i);
-    f[i] = Check_FieldDef(field, NULL);
-  }
-  upb_msgdef_addfields(m, f, len);
-  return Py_None;
-}
-
-static PyObject *PyUpb_MessageDef_add_field(PyObject *o, PyObject *field) {
-  upb_msgdef *m = Check_MessageDef(o, NULL);
-  upb_fielddef *f = Check_FieldDef(field, NULL);
-  upb_msgdef_addfield(m, f);
-  return Py_None;
-}
-
-static PyMethodDef PyUpb_MessageDef_methods[] = {
-  {"add_field", &PyUpb_MessageDef_add_field, METH_O,
-    "Adds a list of fields."},
-  {"add_fields", &PyUpb_MessageDef_add_fields, METH_O,
-    "Adds a list of fields."},
-  {"fields", &PyUpb_MessageDef_fields, METH_NOARGS,
-    "Returns list of fields."},
-  {NULL, NULL}
+static PyObject *PyUpb_Message_repr(PyObject *self) {
+  PyUpb_Message *m = (PyUpb_Message*)self;
+  return PyUnicode_FromFormat("<upb message %s>",
+                              upb_msgdef_fullname(m->cls->md));
+}
+
+static PyMethodDef PyUpb_Message_methods[] = {
+  {"SerializeToString", PyUpb_Message_SerializeToString, METH_NOARGS,
+   "Returns the message serialized as bytes."},
+  {NULL, NULL, 0, NULL}
 };
 
-static PyTypeObject PyUpb_MessageDefType = {
-  PyObject_HEAD_INIT(NULL)
-  0,                                      /* ob_size */
-  "upb.MessageDef",                       /* tp_name */
-  sizeof(PyUpb_ObjWrapper),               /* tp_basicsize */
-  0,                                      /* tp_itemsize */
-  &PyUpb_Def_dealloc,                     /* tp_dealloc */
-  0,                                      /* tp_print */
-  0,                                      /* tp_getattr */
-  0,                                      /* tp_setattr */
-  0,                                      /* tp_compare */
-  0, /* TODO */                           /* tp_repr */
-  0,                                      /* tp_as_number */
-  0,                                      /* tp_as_sequence */
-  0,                                      /* tp_as_mapping */
-  0,                                      /* tp_hash */
-  0,                                      /* tp_call */
-  0,                                      /* tp_str */
-  &PyUpb_MessageDef_getattro,             /* tp_getattro */
-  &PyUpb_MessageDef_setattro,             /* tp_setattro */
-  0,                                      /* tp_as_buffer */
-  Py_TPFLAGS_DEFAULT,                     /* tp_flags */
-  0,                                      /* tp_doc */
-  0,                                      /* tp_traverse */
-  0,                                      /* tp_clear */
-  0,                                      /* tp_richcompare */
-  offsetof(PyUpb_ObjWrapper, weakreflist),/* tp_weaklistoffset */
-  0,                                      /* tp_iter */
-  0,                                      /* tp_iternext */
-  PyUpb_MessageDef_methods,               /* tp_methods */
-  0,                                      /* tp_members */
-  0,                                      /* tp_getset */
-  0,                                      /* tp_base */
-  0,                                      /* tp_dict */
-  0,                                      /* tp_descr_get */
-  0,                                      /* tp_descr_set */
-  0,                                      /* tp_dictoffset */
-  &PyUpb_MessageDef_init,                 /* tp_init */
-  0,                                      /* tp_alloc */
-  &PyUpb_MessageDef_new,                  /* tp_new */
-  0,                                      /* tp_free */
+static PyType_Slot PyUpb_Message_slots[] = {
+  {Py_tp_dealloc, PyUpb_Message_dealloc},
+  {Py_tp_getattro, PyUpb_Message_getattro},
+  {Py_tp_setattro, PyUpb_Message_setattro},
+  {Py_tp_repr, PyUpb_Message_repr},
+  {Py_tp_methods, PyUpb_Message_methods},
+  {0, NULL}
 };
 
+static PyType_Spec PyUpb_Message_spec = {
+  "upb._upb.Message",
+  sizeof(PyUpb_Message),
+  0,
+  Py_TPFLAGS_DEFAULT,
+  PyUpb_Message_slots
+};
+
+
+/* PyUpb_Repeated *************************************************************/
+
+typedef struct {
+  PyObject_HEAD
+  PyUpb_Arena *arena;
+  PyObject *cls;  /* Element MessageClass, or NULL for other types. */
+  upb_fieldtype_t type;
+  const upb_array *arr;  /* NULL for an unset field. */
+  PyObject *elems;  /* List of element wrappers, for messages; lazy. */
+} PyUpb_Repeated;
+
+static PyObject *PyUpb_Repeated_new(PyUpb_Arena *arena,
+                                    const upb_fielddef *f, PyObject *cls,
+                                    const upb_array *arr) {
+  PyUpb_Repeated *r = PyObject_New(PyUpb_Repeated, PyUpb_RepeatedType);
+  if (!r) return NULL;
+  Py_INCREF(arena);
+  Py_XINCREF(cls);
+  r->arena = arena;
+  r->cls = cls;
+  r->type = upb_fielddef_type(f);
+  r->arr = arr;
+  r->elems = NULL;
+  return (PyObject*)r;
+}
+
+static void PyUpb_Repeated_dealloc(PyObject *self) {
+  PyUpb_Repeated *r = (PyUpb_Repeated*)self;
+  Py_DECREF(r->arena);
+  Py_XDECREF(r->cls);
+  Py_XDECREF(r->elems);
+  PyUpb_Dealloc(self);
+}
+
+static Py_ssize_t PyUpb_Repeated_len(PyObject *self) {
+  PyUpb_Repeated *r = (PyUpb_Repeated*)self;
+  return r->arr ? upb_array_size(r->arr) : 0;
+}
+
+static PyObject *PyUpb_Repeated_item(PyObject *self, Py_ssize_t i) {
+  PyUpb_Repeated *r = (PyUpb_Repeated*)self;
+  Py_ssize_t n = PyUpb_Repeated_len(self);
+  PyObject *ret;
+
+  if (i < 0 || i >= n) {
+    PyErr_SetString(PyExc_IndexError, "index out of range");
+    return NULL;
+  }
+
+  if (r->type != UPB_TYPE_MESSAGE) {
+    return PyUpb_ToPy(r->type, upb_array_get(r->arr, i));
+  }
+
+  if (!r->elems) {
+    Py_ssize_t j;
+    if (!(r->elems = PyList_New(n))) return NULL;
+    for (j = 0; j < n; j++) {
+      Py_INCREF(Py_None);
+      PyList_SET_ITEM(r->elems, j, Py_None);
+    }
+  }
 
-static PyTypeObject *PyUpb_TypeForDef(const upb_def *def) {
-  switch(def->type) {
-    case UPB_DEF_MSG: return &PyUpb_MessageDefType;
-    default: return NULL;
+  ret = PyList_GET_ITEM(r->elems, i);
+  if (ret == Py_None) {
+    ret = PyUpb_Message_wrap((PyUpb_MessageClass*)r->cls, r->arena,
+                             (upb_msg*)upb_array_get(r->arr, i).msg);
+    if (!ret) return NULL;
+    PyList_SetItem(r->elems, i, ret);  /* Steals the reference. */
   }
+  Py_INCREF(ret);
+  return ret;
 }
 
-/* PyUpb_SymbolTable **********************************************************/
+static PyType_Slot PyUpb_Repeated_slots[] = {
+  {Py_tp_dealloc, PyUpb_Repeated_dealloc},
+  {Py_sq_length, PyUpb_Repeated_len},
+  {Py_sq_item, PyUpb_Repeated_item},
+  {0, NULL}
+};
 
-static PyTypeObject PyUpb_SymbolTableType;
+static PyType_Spec PyUpb_Repeated_spec = {
+  "upb._upb.RepeatedContainer",
+  sizeof(PyUpb_Repeated),
+  0,
+  Py_TPFLAGS_DEFAULT,
+  PyUpb_Repeated_slots
+};
 
-#define Check_SymbolTable(o, badret) \
-  (void*)(((PyUpb_ObjWrapper*)o)->obj); do { \
-    if(!PyObject_TypeCheck(o, &PyUpb_SymbolTableType)) { \
-      PyErr_SetString(PyExc_TypeError, "must be a upb.MessageDef"); \
-      return badret; \
-    } \
-  } while(0)
 
-static PyObject *PyUpb_SymbolTable_new(PyTypeObject *subtype,
-                                       PyObject *args, PyObject *kwds) {
-  return PyUpb_ObjCacheGet(upb_symtab_new(), subtype);
-}
+/* PyUpb_MessageClass *********************************************************/
 
-static int PyUpb_SymbolTable_init(
-    PyObject *self, PyObject *args, PyObject *kwds) {
+/* Returns true if |md| or any message type reachable from it has a map
+ * field.  |seen| holds the types already visited, to stop at cycles. */
+static int PyUpb_hasmaps(const upb_msgdef *md, PyObject *seen) {
+  upb_msg_field_iter i;
+  PyObject *key = PyLong_FromVoidPtr((void*)md);
+  int found;
+
+  if (!key) return -1;
+  found = PySet_Contains(seen, key);
+  if (found == 0) found = PySet_Add(seen, key);
+  Py_DECREF(key);
+  if (found != 0) return found < 0 ? -1 : 0;
+
+  for (upb_msg_field_begin(&i, md);
+       !upb_msg_field_done(&i);
+       upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    if (upb_fielddef_ismap(f)) return 1;
+    if (upb_fielddef_issubmsg(f)) {
+      int ret = PyUpb_hasmaps(upb_fielddef_msgsubdef(f), seen);
+      if (ret != 0) return ret;
+    }
+  }
   return 0;
 }
 
-static void PyUpb_SymbolTable_dealloc(PyObject *obj) {
-  PyUpb_ObjWrapper *wrapper = (void*)obj;
-  upb_symtab_unref((upb_symtab*)wrapper->obj);
-  obj->ob_type->tp_free(obj);
-}
-
-// narg is a lua table containing a list of defs to add.
-static PyObject *PyUpb_SymbolTable_add_defs(PyObject *o, PyObject *defs) {
-  upb_symtab *s = Check_SymbolTable(o, NULL);
-  if (!PySequence_Check(defs)) return PyUpb_Error("Must be a sequence");
-  Py_ssize_t n = PySequence_Length(defs);
-
-  // Prevent stack overflow.
-  if (n > 2048) return PyUpb_Error("Too many defs");
-  upb_def *cdefs[n];
-
-  int i = 0;
-  for (i = 0; i < n; i++) {
-    PyObject *pydef = PySequence_GetItem(defs, i);
-    upb_def *def = Check_MessageDef(pydef, NULL);
-    cdefs[i++] = def;
-    upb_msgdef *md = upb_dyncast_msgdef(def);
-    if (!md) continue;
-    upb_msg_field_iter j;
-    for(upb_msg_field_begin(&j, md);
-        !upb_msg_field_done(&j);
-        upb_msg_field_next(&j)) {
-      upb_fielddef *f = upb_msg_iter_field(j);
-      upb_fielddef_setaccessor(f, PyUpb_AccessorForField(f));
-    }
-    upb_msgdef_layout(md);
+/* Raises NotImplementedError for types that upb_decode() can't handle. */
+static bool PyUpb_MessageClass_checksupported(PyUpb_MessageClass *cls) {
+  if (cls->hasmaps < 0) {
+    PyObject *seen = PySet_New(NULL);
+    if (!seen) return false;
+    cls->hasmaps = PyUpb_hasmaps(cls->md, seen);
+    Py_DECREF(seen);
+    if (cls->hasmaps < 0) return false;
+  }
+  if (cls->hasmaps) {
+    PyErr_Format(PyExc_NotImplementedError,
+                 "message type %s uses map fields, which are not supported",
+                 upb_msgdef_fullname(cls->md));
+    return false;
   }
+  return true;
+}
 
-  upb_status status = UPB_STATUS_INIT;
-  upb_symtab_add(s, cdefs, n, &status);
-  PyUpb_CheckStatus(&status);
-  return Py_None;
-}
-
-static PyObject *PyUpb_SymbolTable_add_def(PyObject *o, PyObject *def) {
-  PyObject *defs = PyList_New(1);
-  PyList_SetItem(defs, 0, def);
-  return PyUpb_SymbolTable_add_defs(o, defs);
-}
-
-// TODO: update to allow user to choose type of defs.
-static PyObject *PyUpb_SymbolTable_defs(PyObject *o, PyObject *none) {
-  upb_symtab *s = Check_SymbolTable(o, NULL);
-  int count;
-  const upb_def **defs = upb_symtab_getdefs(s, &count, UPB_DEF_ANY);
-  PyObject *ret = PyList_New(count);
-  int i;
-  for(i = 0; i < count; i++)
-    PyList_SetItem(ret, i, PyUpb_Def_GetOrCreate(defs[i]));
+/* Creates an empty message in a new arena. */
+static PyObject *PyUpb_MessageClass_newmsg(PyUpb_MessageClass *cls,
+                                           PyUpb_Arena **arena) {
+  upb_msg *msg;
+  PyObject *ret;
+
+  if (!PyUpb_MessageClass_checksupported(cls)) return NULL;
+  if (!(*arena = PyUpb_Arena_new())) return NULL;
+
+  msg = upb_msg_new(cls->layout, PyUpb_Arena_alloc(*arena));
+  ret = msg ? PyUpb_Message_wrap(cls, *arena, msg) : PyErr_NoMemory();
+  Py_DECREF(*arena);
   return ret;
 }
 
-static PyObject *PyUpb_SymbolTable_lookup(PyObject *o, PyObject *arg) {
-  upb_symtab *s = Check_SymbolTable(o, NULL);
-  const char *name = PyString_AsString(arg);
-  const upb_def *def = upb_symtab_lookup(s, name);
-  return PyUpb_Def_GetOrCreate(def);
+static PyObject *PyUpb_MessageClass_call(PyObject *self, PyObject *args,
+                                         PyObject *kwds) {
+  PyUpb_Arena *arena;
+  if (PyTuple_GET_SIZE(args) != 0 || (kwds && PyDict_GET_SIZE(kwds) != 0)) {
+    PyErr_SetString(PyExc_TypeError, "message classes take no arguments");
+    return NULL;
+  }
+  return PyUpb_MessageClass_newmsg((PyUpb_MessageClass*)self, &arena);
 }
 
-static PyMethodDef PyUpb_SymbolTable_methods[] = {
-  {"add_def", &PyUpb_SymbolTable_add_def, METH_O, NULL},
-  {"add_defs", &PyUpb_SymbolTable_add_defs, METH_O, NULL},
-  {"defs", &PyUpb_SymbolTable_defs, METH_NOARGS, NULL},
-  {"lookup", &PyUpb_SymbolTable_lookup, METH_O, NULL},
-  {NULL, NULL}
-};
+static PyObject *PyUpb_MessageClass_FromString(PyObject *self, PyObject *arg) {
+  PyUpb_MessageClass *cls = (PyUpb_MessageClass*)self;
+  PyUpb_Arena *arena;
+  PyUpb_Message *m =
+      (PyUpb_Message*)PyUpb_MessageClass_newmsg(cls, &arena);
 
-static PyTypeObject PyUpb_SymbolTableType = {
-  PyObject_HEAD_INIT(NULL)
-  0,                                      /* ob_size */
-  "upb.SymbolTable",                      /* tp_name */
-  sizeof(PyUpb_ObjWrapper),               /* tp_basicsize */
-  0,                                      /* tp_itemsize */
-  &PyUpb_SymbolTable_dealloc,             /* tp_dealloc */
-  0,                                      /* tp_print */
-  0,                                      /* tp_getattr */
-  0,                                      /* tp_setattr */
-  0,                                      /* tp_compare */
-  0, /* TODO */                           /* tp_repr */
-  0,                                      /* tp_as_number */
-  0,                                      /* tp_as_sequence */
-  0,                                      /* tp_as_mapping */
-  0,                                      /* tp_hash */
-  0,                                      /* tp_call */
-  0,                                      /* tp_str */
-  0,                                      /* tp_getattro */
-  0,                                      /* tp_setattro */
-  0,                                      /* tp_as_buffer */
-  Py_TPFLAGS_DEFAULT,                     /* tp_flags */
-  0,                                      /* tp_doc */
-  0,                                      /* tp_traverse */
-  0,                                      /* tp_clear */
-  0,                                      /* tp_richcompare */
-  offsetof(PyUpb_ObjWrapper, weakreflist),/* tp_weaklistoffset */
-  0,                                      /* tp_iter */
-  0,                                      /* tp_iternext */
-  PyUpb_SymbolTable_methods,              /* tp_methods */
-  0,                                      /* tp_members */
-  0,                                      /* tp_getset */
-  0,                                      /* tp_base */
-  0,                                      /* tp_dict */
-  0,                                      /* tp_descr_get */
-  0,                                      /* tp_descr_set */
-  0,                                      /* tp_dictoffset */
-  &PyUpb_SymbolTable_init,                /* tp_init */
-  0,                                      /* tp_alloc */
-  &PyUpb_SymbolTable_new,                 /* tp_new */
-  0,                                      /* tp_free */
-};
+  if (!m) return NULL;
+  if (PyObject_GetBuffer(arg, &arena->buf, PyBUF_SIMPLE) < 0) {
+    Py_DECREF(m);
+    return NULL;
+  }
 
+  if (!upb_decode(upb_stringview_make(arena->buf.buf, arena->buf.len), m->msg,
+                  PyUpb_Message_init(m), &arena->env)) {
+    Py_DECREF(m);
+    PyErr_Format(PyUpb_DecodeError, "error parsing %s",
+                 upb_msgdef_fullname(cls->md));
+    return NULL;
+  }
+  return (PyObject*)m;
+}
 
-/* Accessor and PyUpb_Message *************************************************/
+static PyObject *PyUpb_MessageClass_getfullname(PyObject *self, void *closure) {
+  UPB_UNUSED(closure);
+  return PyUnicode_FromString(
+      upb_msgdef_fullname(((PyUpb_MessageClass*)self)->md));
+}
 
-typedef struct {
-  PyTypeObject type;
-  PyTypeObject *alt_type;
-} PyUpb_MessageType;
+static int PyUpb_MessageClass_traverse(PyObject *self, visitproc visit,
+                                       void *arg) {
+  Py_VISIT(((PyUpb_MessageClass*)self)->pool);
+  Py_VISIT(Py_TYPE(self));
+  return 0;
+}
 
-typedef struct {
-  PyObject_HEAD;
-  PyObject *msgdef;
-  char data[1];
-} PyUpb_Message;
+static int PyUpb_MessageClass_clear(PyObject *self) {
+  Py_CLEAR(((PyUpb_MessageClass*)self)->pool);
+  return 0;
+}
 
-PyObject **PyUpb_Accessor_GetPtr(PyObject *_m, upb_value fval) {
-  PyUpb_Message *m = (PyUpb_Message*)_m;
-  const upb_fielddef *f = upb_value_getfielddef(fval);
-  return (PyObject**)&m->data[f->offset];
-}
-
-static upb_sflow_t PyUpb_Message_StartSequence(void *m, upb_value fval) {
-  PyObject **seq = PyUpb_Accessor_GetPtr(m, fval);
-  PyTypeObject *type = ((PyUpb_MessageType*)Py_TYPE(m))->alt_type;
-  if (!*seq) *seq = type->tp_alloc(type, 0);
-  upb_stdmsg_sethas(m, fval);
-  return UPB_CONTINUE_WITH(*seq);
-}
-
-static upb_sflow_t PyUpb_Message_StartSubmessage(void *m, upb_value fval) {
-  PyObject **submsg = PyUpb_Accessor_GetPtr(m, fval);
-  PyTypeObject *type = Py_TYPE(m);
-  if (!*submsg) *submsg = type->tp_alloc(type, 0);
-  upb_stdmsg_sethas(m, fval);
-  return UPB_CONTINUE_WITH(*submsg);
-}
-
-static upb_sflow_t PyUpb_Message_StartRepeatedSubmessage(
-    void *a, upb_value fval) {
-  (void)fval;
-  PyObject **elem = upb_stdarray_append(a, sizeof(void*));
-  PyTypeObject *type = ((PyUpb_MessageType*)Py_TYPE(a))->alt_type;
-  if (!*elem) *elem = type->tp_alloc(type, 0);
-  return UPB_CONTINUE_WITH(*elem);
-}
-
-static upb_flow_t PyUpb_Message_StringValue(
-    void *m, upb_value fval, upb_value val) {
-  PyObject **str = PyUpb_Accessor_GetPtr(m, fval);
-  if (*str) { Py_DECREF(*str); }
-  *str = PyString_FromStringAndSize(NULL, upb_value_getstrref(val)->len);
-  upb_strref_read(upb_value_getstrref(val), PyString_AsString(*str));
-  upb_stdmsg_sethas(m, fval);
-  return UPB_CONTINUE;
-}
-
-static upb_flow_t PyUpb_Message_AppendStringValue(
-    void *a, upb_value fval, upb_value val) {
-  (void)fval;
-  PyObject **elem = upb_stdarray_append(a, sizeof(void*));
-  *elem = PyString_FromStringAndSize(NULL, upb_value_getstrref(val)->len);
-  upb_strref_read(upb_value_getstrref(val), PyString_AsString(*elem));
-  return UPB_CONTINUE;
-}
-
-#define STDMSG(type, size) static upb_accessor_vtbl vtbl = { \
-    &PyUpb_Message_StartSubmessage, \
-    &upb_stdmsg_set ## type, \
-    &PyUpb_Message_StartSequence, \
-    &PyUpb_Message_StartRepeatedSubmessage, \
-    &upb_stdmsg_set ## type ## _r, \
-    &upb_stdmsg_has, \
-    &upb_stdmsg_getptr, \
-    &upb_stdmsg_get ## type, \
-    &upb_stdmsg_seqbegin, \
-    &upb_stdmsg_ ## size ## byte_seqnext, \
-    &upb_stdmsg_seqget ## type};
-
-#define RETURN_STDMSG(type, size) { STDMSG(type, size); return &vtbl; }
-
-static upb_accessor_vtbl *PyUpb_AccessorForField(upb_fielddef *f) {
-  switch (f->type) {
-    case UPB_TYPE(DOUBLE): RETURN_STDMSG(double, 8)
-    case UPB_TYPE(FLOAT): RETURN_STDMSG(float, 4)
-    case UPB_TYPE(UINT64):
-    case UPB_TYPE(FIXED64): RETURN_STDMSG(uint64, 8)
-    case UPB_TYPE(INT64):
-    case UPB_TYPE(SFIXED64):
-    case UPB_TYPE(SINT64): RETURN_STDMSG(int64, 8)
-    case UPB_TYPE(INT32):
-    case UPB_TYPE(SINT32):
-    case UPB_TYPE(ENUM):
-    case UPB_TYPE(SFIXED32): RETURN_STDMSG(int32, 4)
-    case UPB_TYPE(UINT32):
-    case UPB_TYPE(FIXED32): RETURN_STDMSG(uint32, 4)
-    case UPB_TYPE(BOOL): { STDMSG(bool, 1); return &vtbl; }
-    case UPB_TYPE(GROUP):
-    case UPB_TYPE(MESSAGE): RETURN_STDMSG(ptr, 8)  // TODO: 32-bit
-    case UPB_TYPE(STRING):
-    case UPB_TYPE(BYTES): {
-      STDMSG(ptr, 8);
-      vtbl.set = &PyUpb_Message_StringValue;
-      vtbl.append = &PyUpb_Message_AppendStringValue;
-      return &vtbl;
-    }
-  }
-  return NULL;
+static void PyUpb_MessageClass_dealloc(PyObject *self) {
+  PyObject_GC_UnTrack(self);
+  PyUpb_MessageClass_clear(self);
+  PyUpb_Dealloc(self);
 }
 
+static PyMethodDef PyUpb_MessageClass_methods[] = {
+  {"FromString", PyUpb_MessageClass_FromString, METH_O,
+   "Parses a message from an object supporting the buffer protocol, which\n"
+   "the message refers to rather than copies."},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef PyUpb_MessageClass_getset[] = {
+  {"full_name", PyUpb_MessageClass_getfullname, NULL, NULL, NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyType_Slot PyUpb_MessageClass_slots[] = {
+  {Py_tp_dealloc, PyUpb_MessageClass_dealloc},
+  {Py_tp_traverse, PyUpb_MessageClass_traverse},
+  {Py_tp_clear, PyUpb_MessageClass_clear},
+  {Py_tp_call, PyUpb_MessageClass_call},
+  {Py_tp_methods, PyUpb_MessageClass_methods},
+  {Py_tp_getset, PyUpb_MessageClass_getset},
+  {0, NULL}
+};
+
+static PyType_Spec PyUpb_MessageClass_spec = {
+  "upb._upb.MessageClass",
+  sizeof(PyUpb_MessageClass),
+  0,
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+  PyUpb_MessageClass_slots
+};
 
-/* Toplevel *******************************************************************/
 
-static PyMethodDef methods[] = {
-  {NULL, NULL}
+/* Module *********************************************************************/
+
+static struct PyModuleDef PyUpb_module = {
+  PyModuleDef_HEAD_INIT,
+  "upb._upb",
+  "upb messages, parsed and serialized by the upb table-driven core.",
+  -1,
+  NULL, NULL, NULL, NULL, NULL
 };
 
-// PyModule_AddObject steals a ref, but our object is statically allocated
-// and must not be deleted.
-#define PyUpb_AddType(mod, name, type) \
-  if (PyType_Ready(type) < 0) return; \
-  Py_INCREF(type); \
-  PyModule_AddObject(mod, name, (PyObject*)type);
-
-PyMODINIT_FUNC initupb(void) {
-  PyObject *mod = Py_InitModule("upb", methods);
-
-  PyUpb_AddType(mod, "FieldDef", &PyUpb_FieldDefType);
-  PyUpb_AddType(mod, "MessageDef", &PyUpb_MessageDefType);
-  PyUpb_AddType(mod, "SymbolTable", &PyUpb_SymbolTableType);
-
-  PyModule_AddIntConstant(mod, "LABEL_OPTIONAL", UPB_LABEL(OPTIONAL));
-  PyModule_AddIntConstant(mod, "LABEL_REQUIRED", UPB_LABEL(REQUIRED));
-  PyModule_AddIntConstant(mod, "LABEL_REPEATED", UPB_LABEL(REPEATED));
-
-  PyModule_AddIntConstant(mod, "TYPE_DOUBLE", UPB_TYPE(DOUBLE));
-  PyModule_AddIntConstant(mod, "TYPE_FLOAT", UPB_TYPE(FLOAT));
-  PyModule_AddIntConstant(mod, "TYPE_INT64", UPB_TYPE(INT64));
-  PyModule_AddIntConstant(mod, "TYPE_UINT64", UPB_TYPE(UINT64));
-  PyModule_AddIntConstant(mod, "TYPE_INT32", UPB_TYPE(INT32));
-  PyModule_AddIntConstant(mod, "TYPE_FIXED64", UPB_TYPE(FIXED64));
-  PyModule_AddIntConstant(mod, "TYPE_FIXED32", UPB_TYPE(FIXED32));
-  PyModule_AddIntConstant(mod, "TYPE_BOOL", UPB_TYPE(BOOL));
-  PyModule_AddIntConstant(mod, "TYPE_STRING", UPB_TYPE(STRING));
-  PyModule_AddIntConstant(mod, "TYPE_GROUP", UPB_TYPE(GROUP));
-  PyModule_AddIntConstant(mod, "TYPE_MESSAGE", UPB_TYPE(MESSAGE));
-  PyModule_AddIntConstant(mod, "TYPE_BYTES", UPB_TYPE(BYTES));
-  PyModule_AddIntConstant(mod, "TYPE_UINT32", UPB_TYPE(UINT32));
-  PyModule_AddIntConstant(mod, "TYPE_ENUM", UPB_TYPE(ENUM));
-  PyModule_AddIntConstant(mod, "TYPE_SFIXED32", UPB_TYPE(SFIXED32));
-  PyModule_AddIntConstant(mod, "TYPE_SFIXED64", UPB_TYPE(SFIXED64));
-  PyModule_AddIntConstant(mod, "TYPE_SINT32", UPB_TYPE(SINT32));
-  PyModule_AddIntConstant(mod, "TYPE_SINT64", UPB_TYPE(SINT64));
-
-  obj_cache = PyDict_New();
-  reverse_cache = PyDict_New();
-  static PyMethodDef method = {
-        "WeakRefCallback", &PyUpb_ObjCacheDeleteCallback, METH_O, NULL};
-  PyObject *pyname = PyString_FromString(method.ml_name);
-  weakref_callback = PyCFunction_NewEx(&method, NULL, pyname);
-  Py_DECREF(pyname);
+static PyTypeObject *PyUpb_AddType(PyObject *module, PyType_Spec *spec,
+                                   const char *name) {
+  PyObject *type = PyType_FromSpec(spec);
+  if (!type || (name && PyModule_AddObjectRef(module, name, type) < 0)) {
+    Py_XDECREF(type);
+    return NULL;
+  }
+  return (PyTypeObject*)type;
+}
+
+PyMODINIT_FUNC PyInit__upb(void) {
+  PyObject *m = PyModule_Create(&PyUpb_module);
+  if (!m) return NULL;
+
+  PyUpb_DecodeError = PyErr_NewException("upb.DecodeError", NULL, NULL);
+  if (!PyUpb_DecodeError ||
+      PyModule_AddObjectRef(m, "DecodeError", PyUpb_DecodeError) < 0 ||
+      !(PyUpb_ArenaType = PyUpb_AddType(m, &PyUpb_Arena_spec, NULL)) ||
+      !(PyUpb_DescriptorPoolType =
+            PyUpb_AddType(m, &PyUpb_DescriptorPool_spec, "DescriptorPool")) ||
+      !(PyUpb_MessageClassType =
+            PyUpb_AddType(m, &PyUpb_MessageClass_spec, "MessageClass")) ||
+      !(PyUpb_MessageType =
+            PyUpb_AddType(m, &PyUpb_Message_spec, "Message")) ||
+      !(PyUpb_RepeatedType = PyUpb_AddType(m, &PyUpb_Repeated_spec,
+                                           "RepeatedContainer"))) {
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  return m;
 }
@@ -0,0 +1 @@
+from upb._upb import *
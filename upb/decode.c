@@ -2,6 +2,8 @@
 #include "upb/upb.h"
 #include "upb/decode.h"
 #include "upb/structs.int.h"
+#include "upb/trace.h"
+#include "upb/utf8.int.h"
 
 /* Maps descriptor type -> upb field type.  */
 static const uint8_t upb_desctype_to_fieldtype[] = {
@@ -26,37 +28,165 @@ static const uint8_t upb_desctype_to_fieldtype[] = {
   UPB_TYPE_INT64,           /* SINT64 */
 };
 
-/* Data pertaining to the parse. */
-typedef struct {
-  upb_env *env;
-  /* Current decoding pointer.  Points to the beginning of a field until we
-   * have finished decoding the whole field. */
-  const char *ptr;
-} upb_decstate;
-
 /* Data pertaining to a single message frame. */
-typedef struct {
+typedef struct upb_decframe {
   const char *limit;
   int32_t group_number;  /* 0 if we are not parsing a group. */
 
   /* These members are unset for an unknown group frame. */
   char *msg;
   const upb_msglayout_msginit_v1 *m;
+
+  /* Index of the last field we decoded, or -1.  Fields usually arrive in
+   * order, so this is our first guess for the next tag. */
+  int last_field;
+
+  /* The frame below this one on the stack.  For a submessage frame, also
+   * what upb_decode_pop() needs to finish it: the parent's field, where the
+   * submessage's bytes start, and whether it is the field's first
+   * occurrence. */
+  struct upb_decframe *parent;
+  const upb_msglayout_fieldinit_v1 *field;
+  const char *start;
+  bool fresh;
 } upb_decframe;
 
+/* Submessage frames that every decode has without allocating, enough for
+ * most schemas. */
+#define UPB_DECODE_INLINEFRAMES 8
+
+/* Data pertaining to the parse. */
+typedef struct {
+  /* Where messages, arrays and lazy submessages are allocated. */
+  upb_alloc *alloc;
+  /* Current decoding pointer.  Points to the beginning of a field until we
+   * have finished decoding the whole field. */
+  const char *ptr;
+  /* Leave singular submessages serialized?  See upb_decodeopts.lazy. */
+  bool lazy;
+  /* Keep each message's input span?  See upb_decodeopts.cache. */
+  bool cache;
+  /* Counters to update, or NULL. */
+  upb_decstats *stats;
+  /* Extensions to parse, or NULL.  See upb_decodeopts.extreg. */
+  const upb_extreg *extreg;
+
+  /* The current nesting of submessages and groups, and its limit. */
+  uint32_t depth;
+  uint32_t max_depth;
+
+  /* The frame stack.  |top| is the frame being decoded into.  Frames for
+   * submessages come from the |spare| list, which starts out as |frames| and
+   * grows from |alloc| for input that nests deeper, so the decoder's use of
+   * the C stack does not depend on the input. */
+  upb_decframe *top;
+  upb_decframe *spare;
+  upb_decframe frames[UPB_DECODE_INLINEFRAMES];
+} upb_decstate;
+
 #define CHK(x) if (!(x)) { return false; }
 
 static bool upb_skip_unknowngroup(upb_decstate *d, int field_number,
                                   const char *limit);
-static bool upb_decode_message(upb_decstate *d, const char *limit,
-                               int group_number, char *msg,
+static bool upb_decode_message(upb_decstate *d, const char *limit, char *msg,
                                const upb_msglayout_msginit_v1 *l);
 
+static void upb_decstack_init(upb_decstate *d, const upb_decodeopts *opts) {
+  int i;
+  d->depth = 0;
+  d->max_depth = opts && opts->max_depth ? opts->max_depth
+                                         : UPB_DECODE_MAXDEPTH;
+  d->top = NULL;
+  d->spare = NULL;
+  for (i = UPB_DECODE_INLINEFRAMES - 1; i >= 0; i--) {
+    d->frames[i].parent = d->spare;
+    d->spare = &d->frames[i];
+  }
+}
+
+/* Counts one more level of nesting, failing past the limit. */
+static bool upb_decode_enter(upb_decstate *d) {
+  CHK(d->depth < d->max_depth);
+  d->depth++;
+  return true;
+}
+
+/* The maximum number of bytes that it takes to encode a 64-bit varint. */
+#define UPB_DECODE_VARINT_MAX_LEN 10
+
+#ifndef UPB_BIG_ENDIAN
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+/* Squeezes the low seven bits of each byte of |word| together into a 56-bit
+ * value, as a varint's payload is laid out. */
+static uint64_t upb_varint_compact(uint64_t word) {
+#ifdef __BMI2__
+  return _pext_u64(word, 0x7f7f7f7f7f7f7f7fU);
+#else
+  word &= 0x7f7f7f7f7f7f7f7fU;
+  word = (word & 0x007f007f007f007fU) | ((word & 0x7f007f007f007f00U) >> 1);
+  word = (word & 0x00003fff00003fffU) | ((word & 0x3fff00003fff0000U) >> 2);
+  word = (word & 0x000000000fffffffU) | ((word & 0x0fffffff00000000U) >> 4);
+  return word;
+#endif
+}
+
+/* Decodes a varint without any bounds checks, so the caller must ensure that
+ * UPB_DECODE_VARINT_MAX_LEN bytes are readable.  Instead of branching on each
+ * byte, this loads eight bytes at once and finds the end of the varint from
+ * their continuation bits.  Returns NULL if the varint is unterminated. */
+static const char *upb_decode_varint_fast(const char *p, uint64_t *val) {
+  uint64_t word;
+  uint64_t stops;
+  uint8_t byte;
+
+  memcpy(&word, p, 8);
+  stops = ~word & 0x8080808080808080U;
+
+  if (UPB_LIKELY(stops != 0)) {
+    /* Clear every bit above the terminating byte. */
+    word &= stops ^ (stops - 1);
+    *val = upb_varint_compact(word);
+    return p + upb_ctz64(stops) / 8 + 1;
+  }
+
+  /* Rare case: nine or ten bytes. */
+  *val = upb_varint_compact(word);
+  byte = p[8];
+  *val |= (uint64_t)(byte & 0x7F) << 56;
+  if (!(byte & 0x80)) return p + 9;
+  byte = p[9];
+  *val |= (uint64_t)(byte & 0x7F) << 63;
+  if (!(byte & 0x80)) return p + 10;
+  return NULL;
+}
+
+#endif  /* UPB_BIG_ENDIAN */
+
 static bool upb_decode_varint(const char **ptr, const char *limit,
                               uint64_t *val) {
   uint8_t byte;
   int bitpos = 0;
   const char *p = *ptr;
+
+  if (p < limit && !(*p & 0x80)) {
+    /* Common case: one-byte varint. */
+    *val = (uint8_t)*p;
+    *ptr = p + 1;
+    return true;
+  }
+
+#ifndef UPB_BIG_ENDIAN
+  if (UPB_LIKELY(limit - p >= UPB_DECODE_VARINT_MAX_LEN)) {
+    *ptr = upb_decode_varint_fast(p, val);
+    return *ptr != NULL;
+  }
+#endif
+
+  /* Slow path near the end of the buffer: check bounds on every byte. */
   *val = 0;
 
   do {
@@ -125,16 +255,30 @@ static bool upb_decode_string(const char **ptr, const char *limit,
   return true;
 }
 
+/* Proto3 string fields must hold valid UTF-8, as in the other protobuf
+ * implementations.  Proto2 ones, like bytes fields, may hold anything. */
+static bool upb_decode_checkutf8(const upb_decframe *frame,
+                                 const upb_msglayout_fieldinit_v1 *field,
+                                 upb_stringview val) {
+  return field->type != UPB_DESCRIPTOR_TYPE_STRING || frame->m->is_proto2 ||
+         upb_utf8_isvalid(val.data, val.size);
+}
+
 static void upb_set32(void *msg, size_t ofs, uint32_t val) {
   memcpy((char*)msg + ofs, &val, sizeof(val));
 }
 
+static uint32_t upb_get32(const void *msg, size_t ofs) {
+  uint32_t val;
+  memcpy(&val, (const char*)msg + ofs, sizeof(val));
+  return val;
+}
+
+/* Records the field from |start| to the current position as unknown.  The
+ * message aliases the input, so this does not copy any data. */
 static bool upb_append_unknown(upb_decstate *d, upb_decframe *frame,
                                const char *start) {
-  UPB_UNUSED(d);
-  UPB_UNUSED(frame);
-  UPB_UNUSED(start);
-  return true;
+  return upb_msg_addunknown(frame->msg, start, d->ptr - start);
 }
 
 static bool upb_skip_unknownfielddata(upb_decstate *d, upb_decframe *frame,
@@ -166,36 +310,18 @@ static bool upb_skip_unknownfielddata(upb_decstate *d, upb_decframe *frame,
   return false;
 }
 
-static bool upb_array_grow(upb_array *arr, size_t elements) {
+static void *upb_array_prepare(upb_array *arr, size_t elements) {
   size_t needed = arr->len + elements;
-  size_t new_size = UPB_MAX(arr->size, 8);
-  size_t new_bytes;
-  size_t old_bytes;
-  void *new_data;
-
-  while (new_size < needed) {
-    new_size *= 2;
-  }
-
-  old_bytes = arr->len * arr->element_size;
-  new_bytes = new_size * arr->element_size;
-  new_data = upb_realloc(arr->alloc, arr->data, old_bytes, new_bytes);
-  CHK(new_data);
-
-  arr->data = new_data;
-  arr->size = new_size;
-  return true;
-}
-
-static void *upb_array_reserve(upb_array *arr, size_t elements) {
-  if (arr->size - arr->len < elements) {
-    CHK(upb_array_grow(arr, elements));
+  if (needed > arr->size) {
+    /* Grow by doubling, unless a packed field brings in more elements than
+     * that, in which case we allocate exactly what it needs. */
+    CHK(upb_array_reserve(arr, UPB_MAX(arr->size * 2, needed)));
   }
   return (char*)arr->data + (arr->len * arr->element_size);
 }
 
 static void *upb_array_add(upb_array *arr, size_t elements) {
-  void *ret = upb_array_reserve(arr, elements);
+  void *ret = upb_array_prepare(arr, elements);
   arr->len += elements;
   return ret;
 }
@@ -212,12 +338,12 @@ static upb_array *upb_getorcreatearr(upb_decstate *d,
   upb_array *arr = upb_getarr(frame, field);
 
   if (!arr) {
-    arr = upb_env_malloc(d->env, sizeof(*arr));
+    arr = upb_malloc(d->alloc, sizeof(*arr));
     if (!arr) {
       return NULL;
     }
     upb_array_init(arr, upb_desctype_to_fieldtype[field->type],
-                   upb_arena_alloc(upb_env_arena(d->env)));
+                   d->alloc);
     *(upb_array**)&frame->msg[field->offset] = arr;
   }
 
@@ -245,7 +371,7 @@ static char *upb_decode_prepareslot(upb_decstate *d,
 
   if (field->label == UPB_LABEL_REPEATED) {
     arr = upb_getorcreatearr(d, frame, field);
-    field_mem = upb_array_reserve(arr, 1);
+    field_mem = upb_array_prepare(arr, 1);
   }
 
   return field_mem;
@@ -264,28 +390,174 @@ static void upb_decode_setpresent(upb_decframe *frame,
   }
 }
 
-static bool upb_decode_submsg(upb_decstate *d,
-                              upb_decframe *frame,
-                              const char *limit,
-                              const upb_msglayout_fieldinit_v1 *field,
-                              int group_number) {
-  char *submsg = *(void**)&frame->msg[field->offset];
+/* Whether an occurrence of |field| will be merged into one decoded before. */
+static bool upb_decode_hassubmsg(upb_decframe *frame,
+                                 const upb_msglayout_fieldinit_v1 *field) {
+  if (field->label == UPB_LABEL_REPEATED) {
+    return false;
+  } else if (field->oneof_index != UPB_NOT_IN_ONEOF) {
+    return upb_get32(frame->msg,
+                     frame->m->oneofs[field->oneof_index].case_offset) ==
+           field->number;
+  } else if (field->hasbit != UPB_NO_HASBIT) {
+    return (frame->msg[field->hasbit / 8] & (1 << (field->hasbit % 8))) != 0;
+  } else {
+    return *(void**)(frame->msg + field->offset) != NULL;
+  }
+}
+
+/* Returns the message already in |slot| that an occurrence of submessage
+ * |field| should be parsed into, or NULL if it needs a new one. */
+static char *upb_decode_reusablesubmsg(upb_decframe *frame,
+                                       const upb_msglayout_fieldinit_v1 *field,
+                                       char *slot) {
+  if (field->label == UPB_LABEL_REPEATED) {
+    /* A repeated field always gets a new message, but upb_msg_clear() may
+     * have left cleared ones past the end of the array. */
+    upb_array *arr = upb_getarr(frame, field);
+    return arr->len < arr->pooled ? *(char**)slot : NULL;
+  } else if (field->oneof_index != UPB_NOT_IN_ONEOF &&
+             !upb_decode_hassubmsg(frame, field)) {
+    /* The slot belongs to whichever member of the oneof was set last. */
+    return NULL;
+  } else {
+    /* A singular field merges into the existing message, if any.  One that
+     * upb_msg_clear() cleared is still there, with its hasbit unset. */
+    return *(char**)slot;
+  }
+}
+
+/* Returns the message that an occurrence of submessage |field| is parsed
+ * into, creating it if necessary, or NULL on allocation failure. */
+static char *upb_decode_getsubmsg(upb_decstate *d, upb_decframe *frame,
+                                  const upb_msglayout_fieldinit_v1 *field) {
+  char *submsg_slot = upb_decode_prepareslot(d, frame, field);
+  char *submsg;
   const upb_msglayout_msginit_v1 *subm;
 
+  CHK(submsg_slot);
   UPB_ASSERT(field->submsg_index != UPB_NO_SUBMSG);
   subm = frame->m->submsgs[field->submsg_index];
   UPB_ASSERT(subm);
 
-  if (!submsg) {
-    submsg = upb_env_malloc(d->env, upb_msg_sizeof((upb_msglayout *)subm));
+  submsg = upb_decode_reusablesubmsg(frame, field, submsg_slot);
+
+  if (upb_lazymsg_is(submsg)) {
+    /* A second occurrence of a lazy field has to be merged into the first. */
+    submsg = upb_lazymsg_parse(upb_lazymsg_data(submsg), subm, d->alloc,
+                               d->cache ? frame->msg : NULL);
+    CHK(submsg);
+    *(char**)submsg_slot = submsg;
+  } else if (!submsg) {
+    submsg = upb_malloc(d->alloc, upb_msg_sizeof((upb_msglayout *)subm));
     CHK(submsg);
-    submsg = upb_msg_init(
-        submsg, (upb_msglayout*)subm, upb_arena_alloc(upb_env_arena(d->env)));
-    *(void**)&frame->msg[field->offset] = submsg;
+    submsg = upb_msg_init(submsg, (upb_msglayout*)subm, d->alloc);
+    *(char**)submsg_slot = submsg;
+  }
+
+  CHK(upb_decode_enter(d));
+  if (d->stats && d->depth > d->stats->max_depth) {
+    d->stats->max_depth = d->depth;
   }
 
-  upb_decode_message(d, limit, group_number, submsg, subm);
+  return submsg;
+}
+
+/* Pushes a frame for decoding |submsg|, of type |subm|, from d->ptr to
+ * |limit|.  upb_decode_pop() marks |field| present in |frame| at the end,
+ * unless it is NULL.  |frame| must be the top of the stack. */
+static bool upb_decode_push(upb_decstate *d, upb_decframe *frame,
+                            const upb_msglayout_fieldinit_v1 *field,
+                            char *submsg, const upb_msglayout_msginit_v1 *subm,
+                            const char *limit, int group_number, bool fresh) {
+  upb_decframe *sub = d->spare;
 
+  UPB_ASSERT(frame == d->top);
+
+  if (sub) {
+    d->spare = sub->parent;
+  } else {
+    sub = upb_malloc(d->alloc, sizeof(*sub));
+    CHK(sub);
+  }
+
+  sub->limit = limit;
+  sub->group_number = group_number;
+  sub->msg = submsg;
+  sub->m = subm;
+  sub->last_field = -1;
+  sub->parent = frame;
+  sub->field = field;
+  sub->start = d->ptr;
+  sub->fresh = fresh;
+  d->top = sub;
+  return true;
+}
+
+/* Starts decoding an occurrence of submessage |field|, whose bytes run from
+ * d->ptr to |limit|, by pushing a frame for it; upb_decode_run() takes it from
+ * there.  |frame| must be the top of the stack. */
+static bool upb_decode_submsg(upb_decstate *d,
+                              upb_decframe *frame,
+                              const char *limit,
+                              const upb_msglayout_fieldinit_v1 *field,
+                              int group_number) {
+  bool fresh = !upb_decode_hassubmsg(frame, field);
+  char *submsg = upb_decode_getsubmsg(d, frame, field);
+
+  CHK(submsg);
+  return upb_decode_push(d, frame, field, submsg,
+                         frame->m->submsgs[field->submsg_index], limit,
+                         group_number, fresh);
+}
+
+/* Finishes the submessage on top of the stack, once its input is used up. */
+static bool upb_decode_pop(upb_decstate *d) {
+  upb_decframe *frame = d->top;
+  upb_decframe *parent = frame->parent;
+
+  d->depth--;
+  if (frame->field) {
+    upb_decode_setpresent(parent, frame->field);
+  }
+
+  if (d->cache) {
+    /* A second occurrence is merged into the first, so its span isn't all of
+     * the submessage, and a group's span would end in its END_GROUP tag.
+     * These only get a parent. */
+    bool whole = frame->fresh && frame->group_number == 0;
+    CHK(upb_msg_setcache(frame->msg, parent->msg,
+                         whole ? frame->start : NULL,
+                         whole ? frame->limit - frame->start : 0, d->alloc));
+  }
+
+  d->top = parent;
+  frame->parent = d->spare;
+  d->spare = frame;
+  return true;
+}
+
+/* Drops the frames above |base| without finishing them, after a failure that
+ * the caller recovers from, and restores the nesting |depth|. */
+static void upb_decode_unwind(upb_decstate *d, upb_decframe *base,
+                              uint32_t depth) {
+  while (d->top != base) {
+    upb_decframe *frame = d->top;
+    d->top = frame->parent;
+    frame->parent = d->spare;
+    d->spare = frame;
+  }
+  d->depth = depth;
+}
+
+static bool upb_decode_lazysubmsg(upb_decstate *d, upb_decframe *frame,
+                                  const upb_msglayout_fieldinit_v1 *field,
+                                  upb_stringview val) {
+  upb_stringview *data = upb_malloc(d->alloc, sizeof(*data));
+  CHK(data);
+  *data = val;
+  *(void**)(frame->msg + field->offset) = upb_lazymsg_make(data);
+  upb_decode_setpresent(frame, field);
   return true;
 }
 
@@ -394,32 +666,61 @@ static bool upb_decode_fixedpacked(upb_array *arr, upb_stringview data,
   return true;
 }
 
+/* Returns the number of varints in [ptr, limit), which is the number of bytes
+ * without a continuation bit.  This checks eight bytes at a time. */
+static size_t upb_count_varints(const char *ptr, const char *limit) {
+  size_t count = 0;
+
+  while (limit - ptr >= 8) {
+    uint64_t word;
+    memcpy(&word, ptr, 8);
+    /* Move each byte's inverted continuation bit to the bottom of the byte,
+     * then sum the bytes with a multiply. */
+    word = (~word >> 7) & 0x0101010101010101U;
+    count += (word * 0x0101010101010101U) >> 56;
+    ptr += 8;
+  }
+
+  while (ptr < limit) {
+    count += !(*ptr & 0x80);
+    ptr++;
+  }
+
+  return count;
+}
+
 static bool upb_decode_toarray(upb_decstate *d, upb_decframe *frame,
                                const char *field_start,
                                const upb_msglayout_fieldinit_v1 *field,
                                upb_stringview val) {
   upb_array *arr = upb_getorcreatearr(d, frame, field);
 
+  /* Packed varints: count them first so we can reserve space for all of them
+   * at once and write them straight into the array. */
 #define VARINT_CASE(ctype, decode) { \
   const char *ptr = val.data; \
   const char *limit = ptr + val.size; \
+  size_t count = upb_count_varints(ptr, limit); \
+  char *field_mem = upb_array_prepare(arr, count); \
+  CHK(field_mem || count == 0); \
   while (ptr < limit) { \
     uint64_t val; \
-    void *field_mem; \
     ctype decoded; \
     CHK(upb_decode_varint(&ptr, limit, &val)); \
     decoded = (decode)(val); \
-    field_mem = upb_array_add(arr, 1); \
-    CHK(field_mem); \
     memcpy(field_mem, &decoded, sizeof(ctype)); \
+    field_mem += sizeof(ctype); \
   } \
+  arr->len += count; \
   return true; \
 }
 
   switch ((upb_descriptortype_t)field->type) {
     case UPB_DESCRIPTOR_TYPE_STRING:
     case UPB_DESCRIPTOR_TYPE_BYTES: {
-      void *field_mem = upb_array_add(arr, 1);
+      void *field_mem;
+      CHK(upb_decode_checkutf8(frame, field, val));
+      field_mem = upb_array_add(arr, 1);
       CHK(field_mem);
       memcpy(field_mem, &val, sizeof(val));
       return true;
@@ -448,6 +749,7 @@ static bool upb_decode_toarray(upb_decstate *d, upb_decframe *frame,
       VARINT_CASE(int64_t, upb_zzdecode_64);
     case UPB_DESCRIPTOR_TYPE_MESSAGE:
       CHK(val.size <= (size_t)(frame->limit - val.data));
+      d->ptr -= val.size;
       return upb_decode_submsg(d, frame, val.data + val.size, field, 0);
     case UPB_DESCRIPTOR_TYPE_GROUP:
       return upb_append_unknown(d, frame, field_start);
@@ -469,15 +771,21 @@ static bool upb_decode_delimitedfield(upb_decstate *d, upb_decframe *frame,
     switch ((upb_descriptortype_t)field->type) {
       case UPB_DESCRIPTOR_TYPE_STRING:
       case UPB_DESCRIPTOR_TYPE_BYTES: {
-        void *field_mem = upb_decode_prepareslot(d, frame, field);
+        void *field_mem;
+        CHK(upb_decode_checkutf8(frame, field, val));
+        field_mem = upb_decode_prepareslot(d, frame, field);
         CHK(field_mem);
         memcpy(field_mem, &val, sizeof(val));
         break;
       }
       case UPB_DESCRIPTOR_TYPE_MESSAGE:
         CHK(val.size <= (size_t)(frame->limit - val.data));
-        CHK(upb_decode_submsg(d, frame, val.data + val.size, field, 0));
-        break;
+        if (d->lazy && field->oneof_index == UPB_NOT_IN_ONEOF &&
+            *(void**)(frame->msg + field->offset) == NULL) {
+          return upb_decode_lazysubmsg(d, frame, field, val);
+        }
+        d->ptr -= val.size;
+        return upb_decode_submsg(d, frame, val.data + val.size, field, 0);
       default:
         /* TODO(haberman): should we accept the last element of a packed? */
         return upb_append_unknown(d, frame, field_start);
@@ -488,16 +796,109 @@ static bool upb_decode_delimitedfield(upb_decstate *d, upb_decframe *frame,
 }
 
 static const upb_msglayout_fieldinit_v1 *upb_find_field(
-    const upb_msglayout_msginit_v1 *l, uint32_t field_number) {
-  /* Lots of optimization opportunities here. */
-  int i;
-  for (i = 0; i < l->field_count; i++) {
-    if (l->fields[i].number == field_number) {
-      return &l->fields[i];
+    upb_decstate *d, upb_decframe *frame, uint32_t field_number) {
+  const upb_msglayout_msginit_v1 *l = frame->m;
+  int i = frame->last_field + 1;
+
+  if (i < l->field_count && l->fields[i].number == field_number) {
+    /* Fast path: the field after the last one. */
+  } else if (i > 0 && l->fields[i - 1].number == field_number) {
+    /* Fast path: the last field again, as for repeated fields. */
+    i--;
+  } else {
+    if (d->stats) d->stats->dispatch_lookups++;
+    if (l->field_lookup && field_number < l->dense_below) {
+      i = l->field_lookup[field_number];
+      if (i == UPB_NO_FIELD) {
+        return NULL;  /* Unknown field. */
+      }
+    } else {
+      for (i = 0; i < l->field_count; i++) {
+        if (l->fields[i].number == field_number) {
+          break;
+        }
+      }
+      if (i == l->field_count) {
+        return NULL;  /* Unknown field. */
+      }
     }
+    frame->last_field = i;
+    return &l->fields[i];
+  }
+
+  if (d->stats) d->stats->tag_hits++;
+  frame->last_field = i;
+  return &l->fields[i];
+}
+
+/* Decodes an occurrence of extension |ext| of the message in |frame|, whose
+ * tag runs from |field_start| to d->ptr, into the message that holds the
+ * extension's value.  The whole field is also kept as an unknown field of
+ * |frame|, so that the message encodes it. */
+static bool upb_decode_extension(upb_decstate *d, upb_decframe *frame,
+                                 const char *field_start, int field_number,
+                                 int wire_type, const upb_msgext *ext) {
+  const upb_msglayout_fieldinit_v1 *field = &ext->field;
+  const char *value_start = d->ptr;
+  bool is_submsg = false;
+  upb_decframe storage;
+
+  /* Find the end of the field first: a submessage is only finished after we
+   * return, and its bytes have to be recorded before any later field's. */
+  CHK(upb_skip_unknownfielddata(d, frame, field_number, wire_type));
+  CHK(upb_append_unknown(d, frame, field_start));
+
+  storage.limit = d->ptr;
+  storage.group_number = 0;
+  storage.msg = upb_msg_getorcreateext(frame->msg, frame->m, ext);
+  storage.m = &ext->layout;
+  storage.last_field = 0;
+  storage.parent = NULL;
+  storage.field = NULL;
+  CHK(storage.msg);
+  d->ptr = value_start;
+
+  switch (wire_type) {
+    case UPB_WIRE_TYPE_VARINT:
+      CHK(upb_decode_varintfield(d, &storage, field_start, field));
+      break;
+    case UPB_WIRE_TYPE_32BIT:
+      CHK(upb_decode_32bitfield(d, &storage, field_start, field));
+      break;
+    case UPB_WIRE_TYPE_64BIT:
+      CHK(upb_decode_64bitfield(d, &storage, field_start, field));
+      break;
+    case UPB_WIRE_TYPE_DELIMITED:
+      if (field->type == UPB_DESCRIPTOR_TYPE_MESSAGE) {
+        upb_stringview val;
+        CHK(upb_decode_string(&d->ptr, storage.limit, &val));
+        d->ptr = val.data;
+        is_submsg = true;
+        break;
+      }
+      CHK(upb_decode_delimitedfield(d, &storage, field_start, field));
+      break;
+    case UPB_WIRE_TYPE_START_GROUP:
+      CHK(field->type == UPB_DESCRIPTOR_TYPE_GROUP);
+      is_submsg = true;
+      break;
+    default:
+      return false;
+  }
+
+  if (is_submsg) {
+    /* A submessage: the value's frame sits directly on |frame|, which it
+     * returns to.  It is marked present in its storage now, since |storage|
+     * is gone by the time it is finished. */
+    char *submsg = upb_decode_getsubmsg(d, &storage, field);
+    CHK(submsg);
+    upb_decode_setpresent(&storage, field);
+    return upb_decode_push(
+        d, frame, NULL, submsg, ext->init.submsg, storage.limit,
+        wire_type == UPB_WIRE_TYPE_START_GROUP ? field_number : 0, false);
   }
 
-  return NULL;  /* Unknown field. */
+  return true;
 }
 
 static bool upb_decode_field(upb_decstate *d, upb_decframe *frame) {
@@ -505,11 +906,29 @@ static bool upb_decode_field(upb_decstate *d, upb_decframe *frame) {
   int wire_type;
   const char *field_start = d->ptr;
   const upb_msglayout_fieldinit_v1 *field;
+  const upb_msgext *ext = NULL;
 
   CHK(upb_decode_tag(&d->ptr, frame->limit, &field_number, &wire_type));
-  field = upb_find_field(frame->m, field_number);
+  field = upb_find_field(d, frame, field_number);
 
-  if (field) {
+  if (!field && d->extreg && frame->m->extendable &&
+      wire_type != UPB_WIRE_TYPE_END_GROUP) {
+    /* Only fields that the layout doesn't have can be extensions. */
+    ext = upb_extreg_lookup(d->extreg, frame->m, field_number);
+  }
+
+  if (d->stats && wire_type != UPB_WIRE_TYPE_END_GROUP) {
+    if (field || ext) {
+      d->stats->fields++;
+    } else {
+      d->stats->unknown_fields++;
+    }
+  }
+
+  if (ext) {
+    return upb_decode_extension(d, frame, field_start, field_number,
+                                wire_type, ext);
+  } else if (field) {
     switch (wire_type) {
       case UPB_WIRE_TYPE_VARINT:
         return upb_decode_varintfield(d, frame, field_start, field);
@@ -531,18 +950,27 @@ static bool upb_decode_field(upb_decstate *d, upb_decframe *frame) {
     }
   } else {
     CHK(field_number != 0);
-    return upb_skip_unknownfielddata(d, frame, field_number, wire_type);
+    CHK(upb_skip_unknownfielddata(d, frame, field_number, wire_type));
+
+    /* The END_GROUP that terminates this frame is not an unknown field. */
+    return wire_type == UPB_WIRE_TYPE_END_GROUP ||
+           upb_append_unknown(d, frame, field_start);
   }
 }
 
+/* Unknown groups are skipped recursively, since they have no message to keep
+ * a frame for, but they count towards the nesting limit all the same. */
 static bool upb_skip_unknowngroup(upb_decstate *d, int field_number,
                                   const char *limit) {
   upb_decframe frame;
   frame.msg = NULL;
   frame.m = NULL;
+  frame.last_field = -1;
   frame.group_number = field_number;
   frame.limit = limit;
 
+  CHK(upb_decode_enter(d));
+
   while (d->ptr < frame.limit) {
     int wire_type;
     int field_number;
@@ -551,32 +979,865 @@ static bool upb_skip_unknowngroup(upb_decstate *d, int field_number,
     CHK(upb_skip_unknownfielddata(d, &frame, field_number, wire_type));
   }
 
+  d->depth--;
+  return true;
+}
+
+/* The decoding loop: decodes fields into the frame on top of the stack, and
+ * finishes each submessage as its input runs out, until the stack is back
+ * down to |base|.  A submessage pushes a frame instead of recursing, so the
+ * only limit on nesting is d->max_depth. */
+static bool upb_decode_run(upb_decstate *d, const upb_decframe *base) {
+  while (d->top != base) {
+    upb_decframe *frame = d->top;
+    if (d->ptr < frame->limit) {
+      CHK(upb_decode_field(d, frame));
+    } else {
+      CHK(upb_decode_pop(d));
+    }
+  }
   return true;
 }
 
-static bool upb_decode_message(upb_decstate *d, const char *limit,
-                               int group_number, char *msg,
+/* Pushes |frame| as the base of a new stack for |msg|. */
+static void upb_decode_base(upb_decstate *d, upb_decframe *frame,
+                            const char *limit, char *msg,
+                            const upb_msglayout_msginit_v1 *l) {
+  frame->group_number = 0;
+  frame->limit = limit;
+  frame->msg = msg;
+  frame->m = l;
+  frame->last_field = -1;
+  frame->parent = d->top;
+  frame->field = NULL;
+  d->top = frame;
+}
+
+static bool upb_decode_message(upb_decstate *d, const char *limit, char *msg,
                                const upb_msglayout_msginit_v1 *l) {
   upb_decframe frame;
-  frame.group_number = group_number;
-  frame.limit = limit;
-  frame.msg = msg;
-  frame.m = l;
-
-  while (d->ptr < frame.limit) {
-    CHK(upb_decode_field(d, &frame));
+  upb_decode_base(d, &frame, limit, msg, l);
+
+  /* Like upb_decode_run(), until |frame| itself is done too. */
+  for (;;) {
+    upb_decframe *top = d->top;
+    if (d->ptr < top->limit) {
+      CHK(upb_decode_field(d, top));
+    } else if (top != &frame) {
+      CHK(upb_decode_pop(d));
+    } else {
+      break;
+    }
   }
 
+  d->top = frame.parent;
+  return true;
+}
+
+/* Adds the totals for a finished top-level parse of |bytes| bytes to the
+ * caller's counters.  |blocks| is the arena's block count when we started. */
+static bool upb_decode_done(const upb_decstate *d, upb_env *env, size_t bytes,
+                            size_t blocks) {
+  if (d->stats) {
+    d->stats->bytes += bytes;
+    d->stats->arena_blocks +=
+        upb_arena_blockcount(upb_env_arena(env)) - blocks;
+  }
   return true;
 }
 
 bool upb_decode(upb_stringview buf, void *msg,
                 const upb_msglayout_msginit_v1 *l, upb_env *env) {
+  return upb_decode2(buf, msg, l, env, NULL);
+}
+
+static bool upb_dodecode(upb_stringview buf, void *msg,
+                         const upb_msglayout_msginit_v1 *l, upb_env *env,
+                         const upb_decodeopts *opts) {
+  upb_decstate state;
+  size_t blocks = upb_arena_blockcount(upb_env_arena(env));
+
+  if (opts && opts->string_mode == UPB_DECODE_COPY && buf.size > 0) {
+    /* Every string and bytes field points into the input, so one copy of the
+     * whole input is enough to make them all independent of it. */
+    char *copy = upb_env_malloc(env, buf.size);
+    CHK(copy);
+    memcpy(copy, buf.data, buf.size);
+    buf.data = copy;
+  }
+
+  state.ptr = buf.data;
+  state.alloc = upb_arena_alloc(upb_env_arena(env));
+  state.lazy = opts && opts->lazy;
+  state.cache = opts && opts->cache;
+  state.stats = opts ? opts->stats : NULL;
+  state.extreg = opts ? opts->extreg : NULL;
+  upb_decstack_init(&state, opts);
+
+  CHK(upb_decode_message(&state, buf.data + buf.size, msg, l));
+  CHK(!state.cache ||
+      upb_msg_setcache(msg, NULL, buf.data, buf.size, state.alloc));
+  return upb_decode_done(&state, env, buf.size, blocks);
+}
+
+bool upb_decode2(upb_stringview buf, void *msg,
+                 const upb_msglayout_msginit_v1 *l, upb_env *env,
+                 const upb_decodeopts *opts) {
+  bool ok;
+  upb_trace(UPB_TRACE_DECODE, false, false, NULL, l, buf.size);
+  ok = upb_dodecode(buf, msg, l, env, opts);
+  upb_trace(UPB_TRACE_DECODE, true, ok, NULL, l, buf.size);
+  return ok;
+}
+
+bool upb_decode_delimited(upb_stringview buf, upb_array *msgs,
+                          const upb_msglayout_msginit_v1 *l, upb_env *env,
+                          const upb_decodeopts *opts) {
   upb_decstate state;
+  const char *limit;
+  size_t blocks = upb_arena_blockcount(upb_env_arena(env));
+
+  UPB_ASSERT(upb_array_type(msgs) == UPB_TYPE_MESSAGE);
+
+  if (opts && opts->string_mode == UPB_DECODE_COPY && buf.size > 0) {
+    char *copy = upb_env_malloc(env, buf.size);
+    CHK(copy);
+    memcpy(copy, buf.data, buf.size);
+    buf.data = copy;
+  }
+
   state.ptr = buf.data;
-  state.env = env;
+  state.alloc = upb_arena_alloc(upb_env_arena(env));
+  state.lazy = opts && opts->lazy;
+  state.cache = opts && opts->cache;
+  state.stats = opts ? opts->stats : NULL;
+  state.extreg = opts ? opts->extreg : NULL;
+  upb_decstack_init(&state, opts);
+  limit = buf.data + buf.size;
+
+  /* One decstate serves every record; only the frame is per-message. */
+  while (state.ptr < limit) {
+    upb_stringview record;
+    char *msg;
+    void **slot;
+
+    CHK(upb_decode_string(&state.ptr, limit, &record));
+    msg = upb_malloc(state.alloc, upb_msg_sizeof((upb_msglayout*)l));
+    CHK(msg);
+    msg = upb_msg_init(msg, (upb_msglayout*)l, state.alloc);
+
+    state.ptr = record.data;
+    CHK(upb_decode_message(&state, record.data + record.size, msg, l));
+    CHK(!state.cache || upb_msg_setcache(msg, NULL, record.data, record.size,
+                                         state.alloc));
+
+    slot = upb_array_add(msgs, 1);
+    CHK(slot);
+    *slot = msg;
+  }
+
+  return upb_decode_done(&state, env, buf.size, blocks);
+}
+
+/* Discontiguous input ********************************************************/
+
+/* Position in a sequence of segments.  |ptr| is only at |end| when the input
+ * is exhausted. */
+typedef struct {
+  const upb_stringview *seg;
+  const upb_stringview *last_seg;
+  const char *ptr;
+  const char *end;
+} upb_iovstate;
+
+/* Moves to the next non-empty segment once the current one is used up. */
+static void upb_iov_settle(upb_iovstate *s) {
+  while (s->ptr == s->end && s->seg < s->last_seg) {
+    s->seg++;
+    s->ptr = s->seg->data;
+    s->end = s->ptr + s->seg->size;
+  }
+}
+
+/* Moves past the next |n| bytes, copying them to |buf| if it is non-NULL.
+ * Returns the number of bytes, which is less than |n| only if the input ends
+ * first. */
+static size_t upb_iov_read(upb_iovstate *s, char *buf, size_t n) {
+  size_t done = 0;
+
+  while (done < n && s->ptr < s->end) {
+    size_t avail = UPB_MIN((size_t)(s->end - s->ptr), n - done);
+    if (buf) memcpy(buf + done, s->ptr, avail);
+    done += avail;
+    s->ptr += avail;
+    upb_iov_settle(s);
+  }
+
+  return done;
+}
+
+/* Like upb_iov_read(), but leaves the position alone. */
+static size_t upb_iov_peek(const upb_iovstate *s, char *buf, size_t n) {
+  upb_iovstate copy = *s;
+  return upb_iov_read(&copy, buf, n);
+}
 
-  return upb_decode_message(&state, buf.data + buf.size, 0, msg, l);
+/* Skips the rest of a group.  Unlike upb_skip_unknowngroup(), this insists on
+ * the END_GROUP: running into |limit| first means the group carries on past
+ * it. */
+static bool upb_skip_wholegroup(upb_decstate *d, upb_decframe *frame,
+                                int group_number) {
+  CHK(upb_decode_enter(d));
+
+  for (;;) {
+    int field_number;
+    int wire_type;
+
+    CHK(d->ptr < frame->limit);
+    CHK(upb_decode_tag(&d->ptr, frame->limit, &field_number, &wire_type));
+    CHK(field_number != 0);
+
+    if (wire_type == UPB_WIRE_TYPE_END_GROUP) {
+      CHK(field_number == group_number);
+      break;
+    } else if (wire_type == UPB_WIRE_TYPE_START_GROUP) {
+      CHK(upb_skip_wholegroup(d, frame, field_number));
+    } else {
+      CHK(upb_skip_unknownfielddata(d, frame, field_number, wire_type));
+    }
+  }
+
+  d->depth--;
+  return true;
+}
+
+/* Returns the end of the field that starts at |ptr|, or NULL if it is
+ * malformed, nests deeper than |max_depth| or does not end by |limit|. */
+static const char *upb_decode_fieldend(const char *ptr, const char *limit,
+                                       uint32_t max_depth) {
+  upb_decstate d;
+  upb_decframe frame;
+  int field_number;
+  int wire_type;
+
+  d.ptr = ptr;
+  d.depth = 0;
+  d.max_depth = max_depth;
+  frame.limit = limit;
+  frame.group_number = 0;
+  frame.msg = NULL;
+  frame.m = NULL;
+  frame.last_field = -1;
+
+  if (!upb_decode_tag(&d.ptr, limit, &field_number, &wire_type)) {
+    return NULL;
+  } else if (wire_type == UPB_WIRE_TYPE_START_GROUP) {
+    if (!upb_skip_wholegroup(&d, &frame, field_number)) return NULL;
+  } else if (!upb_skip_unknownfielddata(&d, &frame, field_number, wire_type)) {
+    return NULL;
+  }
+
+  return d.ptr;
+}
+
+static bool upb_decode_iovmessage(upb_decstate *d, upb_iovstate *s,
+                                  size_t len, char *msg,
+                                  const upb_msglayout_msginit_v1 *l);
+
+/* Decodes the field at the current position, which runs past the end of the
+ * current segment, and subtracts its size from |*len|, the bytes left in the
+ * frame.  A submessage is decoded across the boundary like any other message;
+ * other fields are copied into the arena to make them contiguous, and decoded
+ * from the copy. */
+static bool upb_decode_iovstraddler(upb_decstate *d, upb_iovstate *s,
+                                    upb_decframe *frame, size_t *len) {
+  /* Room for a tag and a varint, the longest header a field can have. */
+  char hdr[5 + UPB_DECODE_VARINT_MAX_LEN];
+  size_t hdrlen = upb_iov_peek(s, hdr, UPB_MIN(sizeof(hdr), *len));
+  const char *p = hdr;
+  int field_number;
+  int wire_type;
+  size_t size;
+  char *buf;
+
+  CHK(upb_decode_tag(&p, hdr + hdrlen, &field_number, &wire_type));
+
+  if (wire_type == UPB_WIRE_TYPE_DELIMITED) {
+    const upb_msglayout_fieldinit_v1 *field;
+    uint32_t fieldlen;
+
+    CHK(upb_decode_varint32(&p, hdr + hdrlen, &fieldlen));
+    size = p - hdr;
+    CHK(fieldlen <= *len - size);
+    field = upb_find_field(d, frame, field_number);
+
+    if (field && field->type == UPB_DESCRIPTOR_TYPE_MESSAGE) {
+      char *submsg = upb_decode_getsubmsg(d, frame, field);
+      CHK(submsg);
+      if (d->stats) d->stats->fields++;
+      upb_iov_read(s, NULL, size);
+      CHK(upb_decode_iovmessage(d, s, fieldlen, submsg,
+                                frame->m->submsgs[field->submsg_index]));
+      d->depth--;
+      upb_decode_setpresent(frame, field);
+      *len -= size + fieldlen;
+      return true;
+    }
+
+    size += fieldlen;
+    buf = upb_malloc(d->alloc, size);
+    CHK(buf);
+    CHK(upb_iov_peek(s, buf, size) == size);
+  } else {
+    /* Scalars fit in the header, but a group's end has to be found by
+     * copying more and more of the input until the copy contains it.  Groups
+     * are rare enough for that to be fine. */
+    size_t want = hdrlen;
+    size = 0;
+    buf = NULL;
+
+    for (;;) {
+      const char *end;
+      buf = upb_realloc(d->alloc, buf, size, want);
+      CHK(buf);
+      size = want;
+      CHK(upb_iov_peek(s, buf, size) == size);
+      end = upb_decode_fieldend(buf, buf + size, d->max_depth - d->depth);
+      if (end) {
+        size = end - buf;
+        break;
+      } else if (size == *len) {
+        /* The frame ends inside the group, which upb_decode() accepts, so
+         * decode it the same way. */
+        break;
+      }
+      want = UPB_MIN(size * 2, *len);
+    }
+  }
+
+  d->ptr = buf;
+  frame->limit = buf + size;
+  CHK(upb_decode_field(d, frame) && upb_decode_run(d, frame));
+  CHK(d->ptr == buf + size);
+  upb_iov_read(s, NULL, size);
+  *len -= size;
+  return true;
+}
+
+/* Decodes the next |len| bytes of the input into |msg|. */
+static bool upb_decode_iovmessage(upb_decstate *d, upb_iovstate *s,
+                                  size_t len, char *msg,
+                                  const upb_msglayout_msginit_v1 *l) {
+  upb_decframe frame;
+  upb_decode_base(d, &frame, NULL, msg, l);
+
+  while (len > 0) {
+    upb_decstats saved;
+    uint32_t depth = d->depth;
+
+    CHK(s->ptr < s->end);
+    d->ptr = s->ptr;
+    frame.limit = s->ptr + UPB_MIN((size_t)(s->end - s->ptr), len);
+
+    /* Fields are decoded in place from the segment.  One that turns out to
+     * run past the end of it fails before changing the message, except for a
+     * group, which is checked for first; we then try again as a
+     * straddler. */
+    if (d->stats) saved = *d->stats;
+    if (((*d->ptr & 7) != UPB_WIRE_TYPE_START_GROUP ||
+         upb_decode_fieldend(d->ptr, frame.limit, d->max_depth - depth)) &&
+        upb_decode_field(d, &frame) && upb_decode_run(d, &frame)) {
+      len -= d->ptr - s->ptr;
+      s->ptr = d->ptr;
+      upb_iov_settle(s);
+    } else {
+      if (d->stats) *d->stats = saved;
+      upb_decode_unwind(d, &frame, depth);
+      CHK(upb_decode_iovstraddler(d, s, &frame, &len));
+    }
+  }
+
+  d->top = frame.parent;
+  return true;
+}
+
+static bool upb_dodecode_iov(const upb_stringview *segs, size_t n, void *msg,
+                             const upb_msglayout_msginit_v1 *l, upb_env *env,
+                             const upb_decodeopts *opts, size_t total) {
+  upb_decstate state;
+  upb_iovstate s;
+  size_t blocks = upb_arena_blockcount(upb_env_arena(env));
+
+  if (n == 0) {
+    return upb_dodecode(upb_stringview_make(NULL, 0), msg, l, env, opts);
+  } else if (n == 1 || (opts && (opts->string_mode == UPB_DECODE_COPY ||
+                                  opts->cache))) {
+    /* UPB_DECODE_COPY copies the whole input anyway, so we may as well make
+     * the copy contiguous and decode it as usual.  Cached spans have to be
+     * contiguous too. */
+    upb_stringview buf = segs[0];
+    if (n > 1) {
+      upb_decodeopts alias = *opts;
+      char *copy = upb_env_malloc(env, total);
+      size_t i;
+      CHK(copy);
+      for (i = 0, buf.size = 0; i < n; i++) {
+        memcpy(copy + buf.size, segs[i].data, segs[i].size);
+        buf.size += segs[i].size;
+      }
+      buf.data = copy;
+      alias.string_mode = UPB_DECODE_ALIAS;
+      return upb_dodecode(buf, msg, l, env, &alias);
+    }
+    return upb_dodecode(buf, msg, l, env, opts);
+  }
+
+  s.seg = segs;
+  s.last_seg = segs + n - 1;
+  s.ptr = segs[0].data;
+  s.end = s.ptr + segs[0].size;
+  upb_iov_settle(&s);
+
+  state.alloc = upb_arena_alloc(upb_env_arena(env));
+  state.lazy = opts && opts->lazy;
+  state.cache = false;
+  state.stats = opts ? opts->stats : NULL;
+  state.extreg = opts ? opts->extreg : NULL;
+  upb_decstack_init(&state, opts);
+
+  CHK(upb_decode_iovmessage(&state, &s, total, msg, l));
+  return upb_decode_done(&state, env, total, blocks);
+}
+
+bool upb_decode_iov(const upb_stringview *segs, size_t n, void *msg,
+                    const upb_msglayout_msginit_v1 *l, upb_env *env,
+                    const upb_decodeopts *opts) {
+  size_t total = 0;
+  size_t i;
+  bool ok;
+
+  for (i = 0; i < n; i++) {
+    total += segs[i].size;
+  }
+
+  upb_trace(UPB_TRACE_DECODE, false, false, NULL, l, total);
+  ok = upb_dodecode_iov(segs, n, msg, l, env, opts, total);
+  upb_trace(UPB_TRACE_DECODE, true, ok, NULL, l, total);
+  return ok;
+}
+
+/* Parallel decoding of one repeated field ************************************/
+
+static const upb_msglayout_fieldinit_v1 *upb_find_splitfield(
+    const upb_msglayout_msginit_v1 *l, uint32_t field_number) {
+  int i;
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_fieldinit_v1 *field = &l->fields[i];
+    if (field->number == field_number) {
+      return field->label == UPB_LABEL_REPEATED &&
+             field->type == UPB_DESCRIPTOR_TYPE_MESSAGE ? field : NULL;
+    }
+  }
+  return NULL;
+}
+
+/* Reads the next top-level field.  If it is a record of |field_number|, sets
+ * |*rec| and returns true with |*is_rec| set; otherwise skips it. */
+static bool upb_next_record(upb_decstate *d, upb_decframe *frame,
+                            uint32_t field_number, bool *is_rec,
+                            upb_stringview *rec) {
+  int num;
+  int wire_type;
+
+  CHK(upb_decode_tag(&d->ptr, frame->limit, &num, &wire_type));
+  *is_rec = (uint32_t)num == field_number &&
+            wire_type == UPB_WIRE_TYPE_DELIMITED;
+  if (*is_rec) {
+    return upb_decode_string(&d->ptr, frame->limit, rec);
+  }
+  CHK(num != 0);
+  return upb_skip_unknownfielddata(d, frame, num, wire_type);
+}
+
+bool upb_decode_split(upb_stringview buf, void *msg,
+                      const upb_msglayout_msginit_v1 *l, upb_env *env,
+                      const upb_decodeopts *opts, uint32_t field_number,
+                      upb_decoderange *ranges, size_t *n) {
+  const upb_msglayout_fieldinit_v1 *field = upb_find_splitfield(l, field_number);
+  upb_decstate state;
+  upb_decframe frame;
+  upb_array *arr;
+  void *elems;
+  size_t records = 0;
+  size_t first;
+  uint64_t record_bytes = 0;
+  uint64_t seen_bytes = 0;
+  size_t used = 0;
+  size_t blocks = upb_arena_blockcount(upb_env_arena(env));
+
+  CHK(field && *n > 0);
+
+  if (opts && opts->string_mode == UPB_DECODE_COPY && buf.size > 0) {
+    char *copy = upb_env_malloc(env, buf.size);
+    CHK(copy);
+    memcpy(copy, buf.data, buf.size);
+    buf.data = copy;
+  }
+
+  state.ptr = buf.data;
+  state.alloc = upb_arena_alloc(upb_env_arena(env));
+  state.lazy = opts && opts->lazy;
+  state.cache = false;
+  state.stats = opts ? opts->stats : NULL;
+  state.extreg = opts ? opts->extreg : NULL;
+  upb_decstack_init(&state, opts);
+  upb_decode_base(&state, &frame, buf.data + buf.size, msg, l);
+
+  /* First pass: decode everything except the records, which we only count. */
+  while (state.ptr < frame.limit) {
+    const char *field_start = state.ptr;
+    int num;
+    int wire_type;
+    upb_stringview rec;
+
+    CHK(upb_decode_tag(&state.ptr, frame.limit, &num, &wire_type));
+    if ((uint32_t)num == field_number &&
+        wire_type == UPB_WIRE_TYPE_DELIMITED) {
+      CHK(upb_decode_string(&state.ptr, frame.limit, &rec));
+      records++;
+      record_bytes += rec.size;
+    } else {
+      state.ptr = field_start;
+      CHK(upb_decode_field(&state, &frame) && upb_decode_run(&state, &frame));
+    }
+  }
+
+  /* Every range gets its slots up front, so ranges never touch the same part
+   * of the array. */
+  arr = upb_getorcreatearr(&state, &frame, field);
+  CHK(arr);
+  first = arr->len;
+  elems = upb_array_add(arr, records);
+  CHK(elems || records == 0);
+  if (records > 0) {
+    memset(elems, 0, records * arr->element_size);
+  }
+
+  /* Second pass: cut the records into ranges of about equal size. */
+  state.ptr = buf.data;
+  frame.msg = NULL;
+  frame.m = NULL;
+  ranges[0].count = 0;
+  while (state.ptr < frame.limit) {
+    const char *field_start = state.ptr;
+    upb_decoderange *r = &ranges[used];
+    bool is_rec;
+    upb_stringview rec;
+
+    CHK(upb_next_record(&state, &frame, field_number, &is_rec, &rec));
+    if (!is_rec) continue;
+
+    if (r->count == 0) {
+      r->begin = field_start;
+      r->first = first;
+      r->field_number = field_number;
+      r->lazy = state.lazy;
+      r->max_depth = state.max_depth;
+      r->extreg = state.extreg;
+    }
+    r->count++;
+    r->end = state.ptr;
+    first++;
+    seen_bytes += rec.size;
+
+    if (used + 1 < *n && seen_bytes * *n >= record_bytes * (used + 1)) {
+      ranges[++used].count = 0;
+    }
+  }
+
+  *n = used + (ranges[used].count > 0);
+  return upb_decode_done(&state, env, buf.size, blocks);
+}
+
+bool upb_decode_range(const upb_decoderange *r, void *msg,
+                      const upb_msglayout_msginit_v1 *l, upb_alloc *alloc) {
+  const upb_msglayout_fieldinit_v1 *field =
+      upb_find_splitfield(l, r->field_number);
+  const upb_msglayout_msginit_v1 *subm;
+  upb_decstate state;
+  upb_decframe frame;
+  upb_array *arr;
+  char **slots;
+  size_t i = 0;
+
+  CHK(field);
+  arr = *(upb_array**)((char*)msg + field->offset);
+  CHK(arr && r->first + r->count <= arr->len);
+  slots = (char**)arr->data + r->first;
+  subm = l->submsgs[field->submsg_index];
+
+  state.ptr = r->begin;
+  state.alloc = alloc;
+  state.lazy = r->lazy;
+  state.cache = false;
+  state.stats = NULL;
+  state.extreg = r->extreg;
+  upb_decstack_init(&state, NULL);
+  state.max_depth = r->max_depth;
+  state.depth = 1;  /* The records are submessages. */
+
+  frame.group_number = 0;
+  frame.limit = r->end;
+  frame.msg = NULL;
+  frame.m = NULL;
+  frame.last_field = -1;
+
+  while (state.ptr < frame.limit) {
+    bool is_rec;
+    upb_stringview rec;
+    char *submsg;
+
+    /* Other fields in the range were decoded by upb_decode_split(). */
+    CHK(upb_next_record(&state, &frame, r->field_number, &is_rec, &rec));
+    if (!is_rec) continue;
+
+    CHK(i < r->count);
+    submsg = upb_malloc(alloc, upb_msg_sizeof((upb_msglayout*)subm));
+    CHK(submsg);
+    submsg = upb_msg_init(submsg, (upb_msglayout*)subm, alloc);
+    state.ptr = rec.data;
+    CHK(upb_decode_message(&state, rec.data + rec.size, submsg, subm));
+    slots[i++] = submsg;
+  }
+
+  return i == r->count;
+}
+
+upb_msg *upb_lazymsg_parse(const upb_stringview *data,
+                           const upb_msglayout_msginit_v1 *l, upb_alloc *a,
+                           upb_msg *parent) {
+  upb_decstate state;
+  char *msg = upb_malloc(a, upb_msg_sizeof((upb_msglayout*)l));
+
+  if (!msg) return NULL;
+  msg = upb_msg_init(msg, (upb_msglayout*)l, a);
+
+  /* Its own submessages can stay lazy too. */
+  state.ptr = data->data;
+  state.alloc = a;
+  state.lazy = true;
+  state.cache = parent != NULL;
+  state.stats = NULL;
+  state.extreg = NULL;
+  upb_decstack_init(&state, NULL);
+
+  if (!upb_decode_message(&state, data->data + data->size, msg, l) ||
+      (parent && !upb_msg_setcache(msg, parent, data->data, data->size, a))) {
+    return NULL;
+  }
+
+  return msg;
+}
+
+/* Validation without decoding ************************************************/
+
+/* Whether the payload of a packed repeated |field| holds whole elements. */
+static bool upb_validate_packed(const upb_msglayout_fieldinit_v1 *field,
+                                upb_stringview val) {
+  switch ((upb_descriptortype_t)field->type) {
+    case UPB_DESCRIPTOR_TYPE_FLOAT:
+    case UPB_DESCRIPTOR_TYPE_FIXED32:
+    case UPB_DESCRIPTOR_TYPE_SFIXED32:
+      return val.size % sizeof(uint32_t) == 0;
+    case UPB_DESCRIPTOR_TYPE_DOUBLE:
+    case UPB_DESCRIPTOR_TYPE_FIXED64:
+    case UPB_DESCRIPTOR_TYPE_SFIXED64:
+      return val.size % sizeof(uint64_t) == 0;
+    case UPB_DESCRIPTOR_TYPE_INT32:
+    case UPB_DESCRIPTOR_TYPE_UINT32:
+    case UPB_DESCRIPTOR_TYPE_ENUM:
+    case UPB_DESCRIPTOR_TYPE_INT64:
+    case UPB_DESCRIPTOR_TYPE_UINT64:
+    case UPB_DESCRIPTOR_TYPE_BOOL:
+    case UPB_DESCRIPTOR_TYPE_SINT32:
+    case UPB_DESCRIPTOR_TYPE_SINT64: {
+      const char *ptr = val.data;
+      const char *limit = ptr + val.size;
+      while (ptr < limit) {
+        uint64_t v;
+        CHK(upb_decode_varint(&ptr, limit, &v));
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+static bool upb_validate_submsg(upb_decstate *d, upb_decframe *frame,
+                                const upb_validateopts *opts);
+
+/* Checks the value of |field|, whose tag we just read, and skips it. */
+static bool upb_validate_field(upb_decstate *d, upb_decframe *frame,
+                               const upb_msglayout_fieldinit_v1 *field,
+                               int wire_type, const upb_validateopts *opts) {
+  upb_descriptortype_t type = field->type;
+  upb_decframe sub;
+
+  switch (wire_type) {
+    case UPB_WIRE_TYPE_VARINT: {
+      uint64_t val;
+      CHK(type == UPB_DESCRIPTOR_TYPE_INT32 ||
+          type == UPB_DESCRIPTOR_TYPE_UINT32 ||
+          type == UPB_DESCRIPTOR_TYPE_ENUM ||
+          type == UPB_DESCRIPTOR_TYPE_INT64 ||
+          type == UPB_DESCRIPTOR_TYPE_UINT64 ||
+          type == UPB_DESCRIPTOR_TYPE_BOOL ||
+          type == UPB_DESCRIPTOR_TYPE_SINT32 ||
+          type == UPB_DESCRIPTOR_TYPE_SINT64);
+      return upb_decode_varint(&d->ptr, frame->limit, &val);
+    }
+    case UPB_WIRE_TYPE_32BIT: {
+      uint32_t val;
+      CHK(type == UPB_DESCRIPTOR_TYPE_FLOAT ||
+          type == UPB_DESCRIPTOR_TYPE_FIXED32 ||
+          type == UPB_DESCRIPTOR_TYPE_SFIXED32);
+      return upb_decode_32bit(&d->ptr, frame->limit, &val);
+    }
+    case UPB_WIRE_TYPE_64BIT: {
+      uint64_t val;
+      CHK(type == UPB_DESCRIPTOR_TYPE_DOUBLE ||
+          type == UPB_DESCRIPTOR_TYPE_FIXED64 ||
+          type == UPB_DESCRIPTOR_TYPE_SFIXED64);
+      return upb_decode_64bit(&d->ptr, frame->limit, &val);
+    }
+    case UPB_WIRE_TYPE_DELIMITED: {
+      upb_stringview val;
+      CHK(upb_decode_string(&d->ptr, frame->limit, &val));
+      switch (type) {
+        case UPB_DESCRIPTOR_TYPE_STRING:
+          return (!opts->check_utf8 && frame->m->is_proto2) ||
+                 upb_utf8_isvalid(val.data, val.size);
+        case UPB_DESCRIPTOR_TYPE_BYTES:
+          return true;
+        case UPB_DESCRIPTOR_TYPE_MESSAGE:
+          sub.m = frame->m->submsgs[field->submsg_index];
+          if (!sub.m) {
+            /* A map, which has no layout for its entries. */
+            return true;
+          }
+          sub.limit = val.data + val.size;
+          sub.group_number = 0;
+          d->ptr = val.data;
+          return upb_validate_submsg(d, &sub, opts);
+        case UPB_DESCRIPTOR_TYPE_GROUP:
+          return false;
+        default:
+          return field->label == UPB_LABEL_REPEATED &&
+                 upb_validate_packed(field, val);
+      }
+    }
+    case UPB_WIRE_TYPE_START_GROUP:
+      CHK(type == UPB_DESCRIPTOR_TYPE_GROUP);
+      sub.m = frame->m->submsgs[field->submsg_index];
+      sub.limit = frame->limit;
+      sub.group_number = field->number;
+      return upb_validate_submsg(d, &sub, opts);
+    default:
+      return false;
+  }
+}
+
+/* Checks the message in |frame| and skips it.  For an unknown group, which
+ * has no layout, this only checks that it is well-formed. */
+static bool upb_validate_message(upb_decstate *d, upb_decframe *frame,
+                                 const upb_validateopts *opts) {
+  const upb_msglayout_msginit_v1 *l = frame->m;
+  bool check_required = l && !opts->allow_partial && l->is_proto2;
+  uint64_t seen[UPB_PRESENCE_MAXWORDS];
+  bool ended = false;
+  int i;
+
+  frame->last_field = -1;
+  if (check_required) {
+    memset(seen, 0, sizeof(seen));
+  }
+
+  while (d->ptr < frame->limit) {
+    int field_number;
+    int wire_type;
+    const upb_msglayout_fieldinit_v1 *field;
+
+    CHK(upb_decode_tag(&d->ptr, frame->limit, &field_number, &wire_type));
+    CHK(field_number != 0);
+
+    if (wire_type == UPB_WIRE_TYPE_END_GROUP) {
+      CHK(field_number == frame->group_number);
+      ended = true;
+      break;
+    }
+
+    field = l ? upb_find_field(d, frame, field_number) : NULL;
+    if (!field && wire_type == UPB_WIRE_TYPE_START_GROUP) {
+      /* Unlike upb_skip_unknowngroup(), this insists on the END_GROUP. */
+      upb_decframe group;
+      group.m = NULL;
+      group.limit = frame->limit;
+      group.group_number = field_number;
+      CHK(upb_validate_submsg(d, &group, opts));
+      continue;
+    } else if (!field) {
+      CHK(upb_skip_unknownfielddata(d, frame, field_number, wire_type));
+      continue;
+    }
+
+    CHK(upb_validate_field(d, frame, field, wire_type, opts));
+    i = field - l->fields;
+    if (check_required && i < UPB_PRESENCE_MAXFIELDS) {
+      seen[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+  }
+
+  /* A group must end in its END_GROUP tag. */
+  CHK(frame->group_number == 0 || ended);
+
+  if (check_required) {
+    for (i = 0; i < l->field_count && i < UPB_PRESENCE_MAXFIELDS; i++) {
+      CHK(l->fields[i].label != UPB_LABEL_REQUIRED ||
+          (seen[i / 64] & ((uint64_t)1 << (i % 64))));
+    }
+  }
+
+  return true;
+}
+
+/* Submessages are checked recursively, like unknown groups are skipped:
+ * there is no message to keep a frame for, so they cost C stack, within
+ * d->max_depth. */
+static bool upb_validate_submsg(upb_decstate *d, upb_decframe *frame,
+                                const upb_validateopts *opts) {
+  CHK(upb_decode_enter(d));
+  CHK(upb_validate_message(d, frame, opts));
+  d->depth--;
+  return true;
+}
+
+bool upb_validate(upb_stringview buf, const upb_msglayout_msginit_v1 *l,
+                  const upb_validateopts *opts) {
+  upb_validateopts defaults = UPB_VALIDATEOPTS_INITIALIZER;
+  upb_decstate d;
+  upb_decframe frame;
+
+  if (!opts) opts = &defaults;
+
+  d.ptr = buf.data;
+  d.stats = NULL;
+  d.depth = 0;
+  d.max_depth = opts->max_depth ? opts->max_depth : UPB_DECODE_MAXDEPTH;
+  frame.limit = buf.data + buf.size;
+  frame.group_number = 0;
+  frame.m = l;
+  return upb_validate_message(&d, &frame, opts);
 }
 
 #undef CHK
@@ -9,9 +9,170 @@
 
 UPB_BEGIN_EXTERN_C
 
+typedef enum {
+  /* String and bytes fields point into the input buffer, which must outlive
+   * the message.  No string data is copied. */
+  UPB_DECODE_ALIAS = 0,
+
+  /* The input buffer is copied into the env's arena with a single allocation
+   * and string and bytes fields point into the copy, so the input buffer may
+   * be freed as soon as upb_decode2() returns. */
+  UPB_DECODE_COPY = 1
+} upb_decode_stringmode;
+
+typedef struct {
+  upb_decode_stringmode string_mode;
+
+  /* If true, singular submessage fields (other than groups and oneof members)
+   * are not parsed.  Their bytes are kept, like string fields, and parsed
+   * into the owning message's arena the first time upb_msg_get() reads them,
+   * so a parse error in one only shows up then, as an unset field.  This is
+   * much cheaper when few submessages are read, but is not safe when several
+   * threads read the same message. */
+  bool lazy;
+
+  /* If non-NULL, counters to update; see upb_decstats in upb.h.  Nothing is
+   * counted for submessages that lazy parsing defers or for the records that
+   * upb_decode_range() parses.  Suspends and resumes are always zero, since
+   * upb_decode() only takes whole buffers. */
+  upb_decstats *stats;
+
+  /* If true, each message keeps the span of input it was decoded from, and
+   * upb_encode() writes that span back out instead of encoding the message
+   * again, until the message or one of its submessages is changed.  So
+   * re-encoding a message that was only changed in a few places costs about
+   * as much as the changes.  The spans point into the input (or its copy, for
+   * UPB_DECODE_COPY), which must then outlive the message.  See
+   * upb_msg_markdirty() for the changes that are noticed.  |msg| should be a
+   * new message, since the span stands for all of it.  upb_decode_split()
+   * ignores this, and upb_decode_iov() copies segmented input into one
+   * buffer first. */
+  bool cache;
+
+  /* The deepest that submessages and groups may nest, or 0 for
+   * UPB_DECODE_MAXDEPTH; input that nests deeper fails to parse.  Nesting
+   * costs no C stack, except for unknown groups and for submessages that
+   * straddle upb_decode_iov() segments, so this mostly bounds the decoder's
+   * memory.  Lazy submessages get the default when they are finally parsed. */
+  uint32_t max_depth;
+
+  /* If non-NULL, the extensions to parse; see upb_extreg in msg.h.  A field
+   * that an extendable message's layout doesn't have is looked up here, and
+   * parsed into the message if it is registered.  It stays an unknown field
+   * either way.  Lazy submessages are parsed without extensions. */
+  const upb_extreg *extreg;
+} upb_decodeopts;
+
+/* The default max_depth, the same as the pb decoder's. */
+#define UPB_DECODE_MAXDEPTH 64
+
+#define UPB_DECODEOPTS_INITIALIZER \
+  {UPB_DECODE_ALIAS, false, NULL, false, 0, NULL}
+
+/* Parses |buf| into |msg|, allocating from |env|.  |msg| must have been
+ * created with upb_msg_init() or upb_msg_new(), since unknown fields are stored
+ * in its internal members.  A string field of a proto3 message that isn't
+ * valid UTF-8 fails the parse; proto2 string fields aren't checked.
+ * Equivalent to upb_decode2() with default options, ie. UPB_DECODE_ALIAS. */
 bool upb_decode(upb_stringview buf, void *msg,
                 const upb_msglayout_msginit_v1 *l, upb_env *env);
 
+/* Like upb_decode(), but with explicit options.  |opts| may be NULL for the
+ * defaults. */
+bool upb_decode2(upb_stringview buf, void *msg,
+                 const upb_msglayout_msginit_v1 *l, upb_env *env,
+                 const upb_decodeopts *opts);
+
+/* Like upb_decode2(), but the input is the concatenation of the |n| segments
+ * |segs|, such as a chain of network buffers, which need not be linearized
+ * first.  Each field is decoded in place from its segment; only one that
+ * straddles a boundary is treated differently.  A straddling submessage is
+ * decoded across the boundary, and any other straddling field (a string, say)
+ * is copied into |env|'s arena first.  So string and bytes fields usually
+ * point into the segments, which must outlive the message.  For
+ * UPB_DECODE_COPY, which copies all of the input anyway, the segments are
+ * copied into one buffer and that is decoded as by upb_decode2(). */
+bool upb_decode_iov(const upb_stringview *segs, size_t n, void *msg,
+                    const upb_msglayout_msginit_v1 *l, upb_env *env,
+                    const upb_decodeopts *opts);
+
+/* Parses |buf| as a stream of records, each a varint length followed by that
+ * many bytes of a message of type |l|, as written by
+ * writeDelimitedTo() in other protobuf implementations.  Every record becomes
+ * a new upb_msg allocated from |env|, and is appended to |msgs|, which must be
+ * an array of UPB_TYPE_MESSAGE.  This is much cheaper than framing each record
+ * and calling upb_decode2() on it.  On failure, the records before the bad one
+ * are left in |msgs|.  |opts| may be NULL for the defaults. */
+bool upb_decode_delimited(upb_stringview buf, upb_array *msgs,
+                          const upb_msglayout_msginit_v1 *l, upb_env *env,
+                          const upb_decodeopts *opts);
+
+/* A share of the records of one top-level repeated submessage field, as
+ * divided up by upb_decode_split(). */
+typedef struct {
+  /* The part of the input holding this share's records.  It may also hold
+   * other fields, which are skipped. */
+  const char *begin;
+  const char *end;
+
+  /* Index in the field's array of the first record, and number of records. */
+  size_t first;
+  size_t count;
+
+  uint32_t field_number;
+  bool lazy;
+  uint32_t max_depth;
+  const upb_extreg *extreg;
+} upb_decoderange;
+
+/* Parallel decoding, for messages made up mostly of one large top-level
+ * repeated submessage field |field_number|.  upb_decode_split() parses |buf|
+ * into |msg| like upb_decode2(), except that the field's records are only
+ * located: its array is grown to hold all of them, with NULL elements, and
+ * the records are divided into at most |*n| |ranges| of about equal size.
+ * |*n| is set to the number of ranges used.
+ *
+ * Each range is then parsed by upb_decode_range(), which fills in the
+ * range's elements of the array.  Ranges do not share any state, so they may
+ * be parsed on different threads at the same time, each allocating from its
+ * own arena; a upb_concurrentarena keeps all of their memory alive together.
+ * |msg| must not be used until every range has been parsed successfully.
+ *
+ * String data always points into |buf| (or its copy, for UPB_DECODE_COPY),
+ * which must outlive the ranges. */
+bool upb_decode_split(upb_stringview buf, void *msg,
+                      const upb_msglayout_msginit_v1 *l, upb_env *env,
+                      const upb_decodeopts *opts, uint32_t field_number,
+                      upb_decoderange *ranges, size_t *n);
+bool upb_decode_range(const upb_decoderange *r, void *msg,
+                      const upb_msglayout_msginit_v1 *l, upb_alloc *alloc);
+
+typedef struct {
+  /* Like upb_decodeopts.max_depth. */
+  uint32_t max_depth;
+
+  /* If true, a proto2 message isn't required to have its required fields. */
+  bool allow_partial;
+
+  /* If true, proto2 string fields must be valid UTF-8 too.  Proto3 ones
+   * always must be, as for upb_decode(), and bytes fields never are. */
+  bool check_utf8;
+} upb_validateopts;
+
+#define UPB_VALIDATEOPTS_INITIALIZER {0, false, false}
+
+/* Returns whether |buf| is a well-formed message of type |l|, without building
+ * it: this only walks the input, and allocates nothing.  The input must have
+ * valid tags and lengths and nest no deeper than the limit, as for
+ * upb_decode().  This is also stricter than upb_decode() in two ways: a known
+ * field must have a wire type that suits its type (upb_decode() keeps one
+ * that doesn't as an unknown field), and every required field among the first
+ * UPB_PRESENCE_MAXFIELDS must be present, unless |opts| allows partial
+ * messages.  Maps are only checked for their length.  |opts| may be NULL for
+ * the defaults. */
+bool upb_validate(upb_stringview buf, const upb_msglayout_msginit_v1 *l,
+                  const upb_validateopts *opts);
+
 UPB_END_EXTERN_C
 
 #endif  /* UPB_DECODE_H_ */
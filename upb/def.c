@@ -348,6 +348,7 @@ static bool assign_msg_indices(upb_msgdef *m, upb_status *s) {
       TRY(UPB_HANDLER_ENDSUBMSG)
       TRY(UPB_HANDLER_STARTSEQ)
       TRY(UPB_HANDLER_ENDSEQ)
+      TRY(UPB_HANDLER_ARRAY)
     }
     upb_inttable_uninit(&t);
   }
@@ -1383,6 +1384,7 @@ upb_msgdef *upb_msgdef_new(const void *owner) {
   if (!upb_strtable_init(&m->ntof, UPB_CTYPE_PTR)) goto err1;
   m->map_entry = false;
   m->syntax = UPB_SYNTAX_PROTO2;
+  m->extendable = false;
   return m;
 
 err1:
@@ -1593,6 +1595,15 @@ bool upb_msgdef_mapentry(const upb_msgdef *m) {
   return m->map_entry;
 }
 
+void upb_msgdef_setextendable(upb_msgdef *m, bool extendable) {
+  UPB_ASSERT(!upb_msgdef_isfrozen(m));
+  m->extendable = extendable;
+}
+
+bool upb_msgdef_extendable(const upb_msgdef *m) {
+  return m->extendable;
+}
+
 void upb_msg_field_begin(upb_msg_field_iter *iter, const upb_msgdef *m) {
   upb_inttable_begin(iter, &m->itof);
 }
@@ -2068,6 +2079,7 @@ void upb_symtab_free(upb_symtab *s) {
     upb_def_unref(def, s);
   }
   upb_strtable_uninit(&s->symtab);
+  if (s->freeloader) s->freeloader(s->loader_closure);
   upb_gfree(s);
 }
 
@@ -2078,27 +2090,53 @@ upb_symtab *upb_symtab_new() {
   }
 
   upb_strtable_init(&s->symtab, UPB_CTYPE_PTR);
+  s->load = NULL;
+  s->freeloader = NULL;
+  s->loader_closure = NULL;
   return s;
 }
 
-const upb_def *upb_symtab_lookup(const upb_symtab *s, const char *sym) {
+void upb_symtab_setloader(upb_symtab *s, upb_symtab_loadfunc *load,
+                          upb_symtab_freeloaderfunc *freeloader,
+                          void *closure) {
+  if (s->freeloader) s->freeloader(s->loader_closure);
+  s->load = load;
+  s->freeloader = freeloader;
+  s->loader_closure = closure;
+}
+
+void *upb_symtab_loaderclosure(const upb_symtab *s, upb_symtab_loadfunc *load) {
+  return s->load == load ? s->loader_closure : NULL;
+}
+
+static upb_def *symtab_lookup(const upb_symtab *s, const char *sym) {
   upb_value v;
-  upb_def *ret = upb_strtable_lookup(&s->symtab, sym, &v) ?
-      upb_value_getptr(v) : NULL;
-  return ret;
+
+  if (upb_strtable_lookup(&s->symtab, sym, &v)) {
+    return upb_value_getptr(v);
+  }
+
+  /* Lazy symtabs are logically const: the loader only adds defs that were
+   * already (lazily) part of the table. */
+  if (s->load && s->load(s->loader_closure, (upb_symtab*)s, sym) &&
+      upb_strtable_lookup(&s->symtab, sym, &v)) {
+    return upb_value_getptr(v);
+  }
+
+  return NULL;
+}
+
+const upb_def *upb_symtab_lookup(const upb_symtab *s, const char *sym) {
+  return symtab_lookup(s, sym);
 }
 
 const upb_msgdef *upb_symtab_lookupmsg(const upb_symtab *s, const char *sym) {
-  upb_value v;
-  upb_def *def = upb_strtable_lookup(&s->symtab, sym, &v) ?
-      upb_value_getptr(v) : NULL;
+  upb_def *def = symtab_lookup(s, sym);
   return def ? upb_dyncast_msgdef(def) : NULL;
 }
 
 const upb_enumdef *upb_symtab_lookupenum(const upb_symtab *s, const char *sym) {
-  upb_value v;
-  upb_def *def = upb_strtable_lookup(&s->symtab, sym, &v) ?
-      upb_value_getptr(v) : NULL;
+  upb_def *def = symtab_lookup(s, sym);
   return def ? upb_dyncast_enumdef(def) : NULL;
 }
 
@@ -2124,13 +2162,16 @@ static upb_def *upb_resolvename(const upb_strtable *t,
 const upb_def *upb_symtab_resolve(const upb_symtab *s, const char *base,
                                   const char *sym) {
   upb_def *ret = upb_resolvename(&s->symtab, base, sym);
+  if (!ret && s->load && sym[0] == '.') {
+    ret = symtab_lookup(s, sym + 1);
+  }
   return ret;
 }
 
 /* TODO(haberman): we need a lot more testing of error conditions. */
 static bool symtab_add(upb_symtab *s, upb_def *const*defs, size_t n,
-                       void *ref_donor, upb_refcounted *freeze_also,
-                       upb_status *status) {
+                       void *ref_donor, upb_refcounted *const*freeze_also,
+                       size_t freeze_also_n, upb_status *status) {
   size_t i;
   size_t add_n;
   size_t freeze_n;
@@ -2140,7 +2181,7 @@ static bool symtab_add(upb_symtab *s, upb_def *const*defs, size_t n,
   size_t add_objs_size;
   upb_strtable addtab;
 
-  if (n == 0 && !freeze_also) {
+  if (n == 0 && freeze_also_n == 0) {
     return true;
   }
 
@@ -2235,10 +2276,7 @@ static bool symtab_add(upb_symtab *s, upb_def *const*defs, size_t n,
 
   /* We need an array of the defs in addtab, for passing to
    * upb_refcounted_freeze(). */
-  add_objs_size = upb_strtable_count(&addtab);
-  if (freeze_also) {
-    add_objs_size++;
-  }
+  add_objs_size = upb_strtable_count(&addtab) + freeze_also_n;
 
   add_defs = upb_gmalloc(sizeof(void*) * add_objs_size);
   if (add_defs == NULL) goto oom_err;
@@ -2257,8 +2295,8 @@ static bool symtab_add(upb_symtab *s, upb_def *const*defs, size_t n,
   add_objs = (upb_refcounted**)add_defs;
 
   freeze_n = add_n;
-  if (freeze_also) {
-    add_objs[freeze_n++] = freeze_also;
+  for (i = 0; i < freeze_also_n; i++) {
+    add_objs[freeze_n++] = freeze_also[i];
   }
 
   if (!upb_refcounted_freeze(add_objs, freeze_n, status,
@@ -2300,31 +2338,50 @@ err: {
 
 bool upb_symtab_add(upb_symtab *s, upb_def *const*defs, size_t n,
                     void *ref_donor, upb_status *status) {
-  return symtab_add(s, defs, n, ref_donor, NULL, status);
+  return symtab_add(s, defs, n, ref_donor, NULL, 0, status);
 }
 
 bool upb_symtab_addfile(upb_symtab *s, upb_filedef *file, upb_status *status) {
-  size_t n;
+  return upb_symtab_addfiles(s, &file, 1, status);
+}
+
+bool upb_symtab_addfiles(upb_symtab *s, upb_filedef *const*files, size_t n,
+                         upb_status *status) {
+  size_t defcount = 0;
   size_t i;
+  size_t j;
   upb_def **defs;
   bool ret;
 
-  n = upb_filedef_defcount(file);
-  if (n == 0) {
+  for (i = 0; i < n; i++) {
+    defcount += upb_filedef_defcount(files[i]);
+  }
+
+  if (defcount == 0) {
     return true;
   }
-  defs = upb_gmalloc(sizeof(*defs) * n);
+
+  /* One allocation holds both the defs and the files (as freeze roots). */
+  defs = upb_gmalloc(sizeof(*defs) * defcount + sizeof(upb_refcounted*) * n);
 
   if (defs == NULL) {
     upb_status_seterrmsg(status, "Out of memory");
     return false;
   }
 
-  for (i = 0; i < n; i++) {
-    defs[i] = upb_filedef_mutabledef(file, i);
+  for (i = 0, defcount = 0; i < n; i++) {
+    for (j = 0; j < upb_filedef_defcount(files[i]); j++) {
+      defs[defcount++] = upb_filedef_mutabledef(files[i], j);
+    }
   }
 
-  ret = symtab_add(s, defs, n, NULL, upb_filedef_upcast_mutable(file), status);
+  {
+    upb_refcounted **roots = (upb_refcounted**)&defs[defcount];
+    for (i = 0; i < n; i++) {
+      roots[i] = upb_filedef_upcast_mutable(files[i]);
+    }
+    ret = symtab_add(s, defs, defcount, NULL, roots, n, status);
+  }
 
   upb_gfree(defs);
   return ret;
@@ -2361,3 +2418,565 @@ bool upb_symtab_done(const upb_symtab_iter *iter) {
 const upb_def *upb_symtab_iter_def(const upb_symtab_iter *iter) {
   return upb_value_getptr(upb_strtable_iter_value(&iter->iter));
 }
+
+
+/* upb_symtab snapshots *******************************************************/
+
+/* A snapshot is a single flat buffer.  Every reference inside it is an offset
+ * or an index, never a pointer, so it can be written at build time and later
+ * mmap()'d at any address and read in place:
+ *
+ *   snapshot_hdr
+ *   snapshot_field[field_count]
+ *   snapshot_msg[msg_count]
+ *   snapshot_enum[enum_count]
+ *   snapshot_enumval[val_count]
+ *   snapshot_oneof[oneof_count]
+ *   string pool (NULL-terminated strings, referenced by offset)
+ *
+ * The snapshot uses the byte order and alignment of the machine that wrote
+ * it; the header records enough to reject a snapshot from a different kind of
+ * machine or a different version of this format. */
+
+#define SNAPSHOT_MAGIC 0x53425055  /* "UPBS" in little-endian. */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_NONE 0xffffffff
+#define SNAPSHOT_ENUMBIT 0x80000000  /* Set on subdef refs to enums. */
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  uint32_t field_count;
+  uint32_t msg_count;
+  uint32_t enum_count;
+  uint32_t val_count;
+  uint32_t oneof_count;
+  uint32_t str_size;
+  uint32_t pad;
+} snapshot_hdr;
+
+typedef struct {
+  uint64_t defaultval;   /* Raw bits, or string offset for string types. */
+  uint32_t default_len;  /* Only for string types. */
+  uint32_t name;
+  uint32_t number;
+  uint32_t subdef;       /* Msg index, enum index | SNAPSHOT_ENUMBIT, or NONE. */
+  uint32_t oneof;        /* Index into the message's oneofs, or NONE. */
+  uint8_t descriptortype;
+  uint8_t label;
+  uint8_t lazy;
+  uint8_t packed;
+} snapshot_field;
+
+typedef struct {
+  uint32_t name;
+  uint32_t field_begin;
+  uint32_t field_count;
+  uint32_t oneof_begin;
+  uint32_t oneof_count;
+  uint8_t syntax;
+  uint8_t mapentry;
+  uint8_t extendable;
+  uint8_t pad;
+} snapshot_msg;
+
+typedef struct {
+  uint32_t name;
+  uint32_t val_begin;
+  uint32_t val_count;
+  int32_t defaultval;
+} snapshot_enum;
+
+typedef struct {
+  uint32_t name;
+  int32_t number;
+} snapshot_enumval;
+
+typedef struct {
+  uint32_t name;
+} snapshot_oneof;
+
+typedef struct {
+  char *buf;
+  snapshot_hdr *hdr;
+  snapshot_field *fields;
+  snapshot_msg *msgs;
+  snapshot_enum *enums;
+  snapshot_enumval *vals;
+  snapshot_oneof *oneofs;
+  char *strs;
+  uint32_t str_ofs;
+  upb_inttable index;  /* Maps def/oneof pointer -> index. */
+} snapshot_writer;
+
+static size_t snapshot_align(size_t size) {
+  return (size + 7) & ~(size_t)7;
+}
+
+static uint32_t snapshot_putstr(snapshot_writer *w, const char *str,
+                                size_t len) {
+  uint32_t ret = w->str_ofs;
+  memcpy(w->strs + ret, str, len);
+  w->strs[ret + len] = '\0';
+  w->str_ofs += len + 1;
+  return ret;
+}
+
+static uint32_t snapshot_putcstr(snapshot_writer *w, const char *str) {
+  return snapshot_putstr(w, str, strlen(str));
+}
+
+static size_t snapshot_fieldstrsize(const upb_fielddef *f) {
+  size_t size = strlen(upb_fielddef_name(f)) + 1;
+  if (upb_fielddef_isstring(f)) {
+    size_t len;
+    upb_fielddef_defaultstr(f, &len);
+    size += len + 1;
+  }
+  return size;
+}
+
+static void snapshot_putfield(snapshot_writer *w, snapshot_field *sf,
+                              const upb_fielddef *f, uint32_t oneof_begin) {
+  upb_value v;
+
+  sf->name = snapshot_putcstr(w, upb_fielddef_name(f));
+  sf->number = upb_fielddef_number(f);
+  sf->descriptortype = upb_fielddef_descriptortype(f);
+  sf->label = upb_fielddef_label(f);
+  sf->lazy = upb_fielddef_lazy(f);
+  sf->packed = upb_fielddef_packed(f);
+  sf->default_len = 0;
+  sf->defaultval = 0;
+
+  sf->subdef = SNAPSHOT_NONE;
+  if (upb_fielddef_hassubdef(f)) {
+    bool ok = upb_inttable_lookupptr(&w->index, upb_fielddef_subdef(f), &v);
+    UPB_ASSERT(ok);
+    sf->subdef = upb_value_getuint32(v);
+  }
+
+  sf->oneof = SNAPSHOT_NONE;
+  if (upb_fielddef_containingoneof(f)) {
+    bool ok = upb_inttable_lookupptr(&w->index,
+                                     upb_fielddef_containingoneof(f), &v);
+    UPB_ASSERT(ok);
+    sf->oneof = upb_value_getuint32(v) - oneof_begin;
+  }
+
+  switch (upb_fielddef_type(f)) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES: {
+      size_t len;
+      const char *str = upb_fielddef_defaultstr(f, &len);
+      sf->default_len = len;
+      sf->defaultval = snapshot_putstr(w, str, len);
+      break;
+    }
+    case UPB_TYPE_FLOAT: {
+      float val = upb_fielddef_defaultfloat(f);
+      memcpy(&sf->defaultval, &val, sizeof(val));
+      break;
+    }
+    case UPB_TYPE_DOUBLE: {
+      double val = upb_fielddef_defaultdouble(f);
+      memcpy(&sf->defaultval, &val, sizeof(val));
+      break;
+    }
+    case UPB_TYPE_BOOL:
+      sf->defaultval = upb_fielddef_defaultbool(f);
+      break;
+    case UPB_TYPE_INT32:
+    case UPB_TYPE_ENUM:
+      sf->defaultval = (uint64_t)(int64_t)upb_fielddef_defaultint32(f);
+      break;
+    case UPB_TYPE_INT64:
+      sf->defaultval = upb_fielddef_defaultint64(f);
+      break;
+    case UPB_TYPE_UINT32:
+      sf->defaultval = upb_fielddef_defaultuint32(f);
+      break;
+    case UPB_TYPE_UINT64:
+      sf->defaultval = upb_fielddef_defaultuint64(f);
+      break;
+    case UPB_TYPE_MESSAGE:
+      break;
+  }
+}
+
+void *upb_symtab_snapshot(const upb_symtab *s, upb_alloc *a, size_t *size) {
+  snapshot_writer w;
+  snapshot_hdr hdr;
+  upb_symtab_iter i;
+  size_t str_size = 0;
+  size_t total;
+  uint32_t msg = 0, en = 0, field = 0, val = 0, oneof = 0;
+
+  memset(&hdr, 0, sizeof(hdr));
+  if (!upb_inttable_init(&w.index, UPB_CTYPE_UINT32)) return NULL;
+
+  /* Pass 1: count everything and assign each def (and oneof) its index. */
+  for (upb_symtab_begin(&i, s, UPB_DEF_ANY); !upb_symtab_done(&i);
+       upb_symtab_next(&i)) {
+    const upb_def *def = upb_symtab_iter_def(&i);
+    const upb_msgdef *m = upb_dyncast_msgdef(def);
+    const upb_enumdef *e = upb_dyncast_enumdef(def);
+    bool ok = true;
+
+    str_size += strlen(upb_def_fullname(def)) + 1;
+
+    if (m) {
+      upb_msg_field_iter j;
+      upb_msg_oneof_iter k;
+      ok = upb_inttable_insertptr(&w.index, def,
+                                  upb_value_uint32(hdr.msg_count++));
+      for (upb_msg_field_begin(&j, m); !upb_msg_field_done(&j);
+           upb_msg_field_next(&j)) {
+        str_size += snapshot_fieldstrsize(upb_msg_iter_field(&j));
+        hdr.field_count++;
+      }
+      for (upb_msg_oneof_begin(&k, m); ok && !upb_msg_oneof_done(&k);
+           upb_msg_oneof_next(&k)) {
+        const upb_oneofdef *o = upb_msg_iter_oneof(&k);
+        str_size += strlen(upb_oneofdef_name(o)) + 1;
+        ok = upb_inttable_insertptr(&w.index, o,
+                                    upb_value_uint32(hdr.oneof_count++));
+      }
+    } else if (e) {
+      upb_enum_iter j;
+      ok = upb_inttable_insertptr(
+          &w.index, def,
+          upb_value_uint32(hdr.enum_count++ | SNAPSHOT_ENUMBIT));
+      for (upb_enum_begin(&j, e); !upb_enum_done(&j); upb_enum_next(&j)) {
+        str_size += strlen(upb_enum_iter_name(&j)) + 1;
+        hdr.val_count++;
+      }
+    }
+
+    if (!ok) goto err;
+  }
+
+  total = snapshot_align(sizeof(snapshot_hdr)) +
+          snapshot_align(sizeof(snapshot_field) * hdr.field_count) +
+          snapshot_align(sizeof(snapshot_msg) * hdr.msg_count) +
+          snapshot_align(sizeof(snapshot_enum) * hdr.enum_count) +
+          snapshot_align(sizeof(snapshot_enumval) * hdr.val_count) +
+          snapshot_align(sizeof(snapshot_oneof) * hdr.oneof_count) +
+          snapshot_align(str_size);
+  if (total > UINT32_MAX) goto err;
+
+  w.buf = upb_malloc(a, total);
+  if (!w.buf) goto err;
+  memset(w.buf, 0, total);
+
+  hdr.magic = SNAPSHOT_MAGIC;
+  hdr.version = SNAPSHOT_VERSION;
+  hdr.size = total;
+  hdr.str_size = str_size;
+  w.hdr = (snapshot_hdr*)w.buf;
+  *w.hdr = hdr;
+  w.fields = (snapshot_field*)(w.buf + snapshot_align(sizeof(snapshot_hdr)));
+  w.msgs = (snapshot_msg*)((char*)w.fields +
+      snapshot_align(sizeof(snapshot_field) * hdr.field_count));
+  w.enums = (snapshot_enum*)((char*)w.msgs +
+      snapshot_align(sizeof(snapshot_msg) * hdr.msg_count));
+  w.vals = (snapshot_enumval*)((char*)w.enums +
+      snapshot_align(sizeof(snapshot_enum) * hdr.enum_count));
+  w.oneofs = (snapshot_oneof*)((char*)w.vals +
+      snapshot_align(sizeof(snapshot_enumval) * hdr.val_count));
+  w.strs = (char*)w.oneofs +
+      snapshot_align(sizeof(snapshot_oneof) * hdr.oneof_count);
+  w.str_ofs = 0;
+
+  /* Pass 2: write the records, in the same order as pass 1. */
+  for (upb_symtab_begin(&i, s, UPB_DEF_ANY); !upb_symtab_done(&i);
+       upb_symtab_next(&i)) {
+    const upb_def *def = upb_symtab_iter_def(&i);
+    const upb_msgdef *m = upb_dyncast_msgdef(def);
+    const upb_enumdef *e = upb_dyncast_enumdef(def);
+
+    if (m) {
+      snapshot_msg *sm = &w.msgs[msg++];
+      upb_msg_field_iter j;
+      upb_msg_oneof_iter k;
+      sm->name = snapshot_putcstr(&w, upb_def_fullname(def));
+      sm->syntax = upb_msgdef_syntax(m);
+      sm->mapentry = upb_msgdef_mapentry(m);
+      sm->extendable = upb_msgdef_extendable(m);
+      sm->oneof_begin = oneof;
+      sm->oneof_count = upb_msgdef_numoneofs(m);
+      for (upb_msg_oneof_begin(&k, m); !upb_msg_oneof_done(&k);
+           upb_msg_oneof_next(&k)) {
+        w.oneofs[oneof++].name =
+            snapshot_putcstr(&w, upb_oneofdef_name(upb_msg_iter_oneof(&k)));
+      }
+      sm->field_begin = field;
+      sm->field_count = upb_msgdef_numfields(m);
+      for (upb_msg_field_begin(&j, m); !upb_msg_field_done(&j);
+           upb_msg_field_next(&j)) {
+        snapshot_putfield(&w, &w.fields[field++], upb_msg_iter_field(&j),
+                          sm->oneof_begin);
+      }
+    } else if (e) {
+      snapshot_enum *se = &w.enums[en++];
+      upb_enum_iter j;
+      se->name = snapshot_putcstr(&w, upb_def_fullname(def));
+      se->defaultval = upb_enumdef_default(e);
+      se->val_begin = val;
+      se->val_count = upb_enumdef_numvals(e);
+      for (upb_enum_begin(&j, e); !upb_enum_done(&j); upb_enum_next(&j)) {
+        snapshot_enumval *sv = &w.vals[val++];
+        sv->name = snapshot_putcstr(&w, upb_enum_iter_name(&j));
+        sv->number = upb_enum_iter_number(&j);
+      }
+    }
+  }
+
+  UPB_ASSERT(w.str_ofs == str_size);
+  upb_inttable_uninit(&w.index);
+  *size = total;
+  return w.buf;
+
+err:
+  upb_inttable_uninit(&w.index);
+  return NULL;
+}
+
+/* Returns the string at the given offset, or NULL if the offset does not
+ * point at a NULL-terminated string inside the pool. */
+static const char *snapshot_getstr(const char *strs, uint32_t size,
+                                   uint32_t ofs) {
+  if (ofs >= size || !memchr(strs + ofs, '\0', size - ofs)) return NULL;
+  return strs + ofs;
+}
+
+static bool snapshot_checkrange(uint32_t begin, uint32_t count,
+                                uint32_t total) {
+  return begin <= total && count <= total - begin;
+}
+
+bool upb_symtab_addsnapshot(upb_symtab *s, const void *buf, size_t size,
+                            upb_status *status) {
+  const snapshot_hdr *hdr = buf;
+  const snapshot_field *fields;
+  const snapshot_msg *msgs;
+  const snapshot_enum *enums;
+  const snapshot_enumval *vals;
+  const snapshot_oneof *oneofs;
+  const char *strs;
+  upb_def **defs = NULL;
+  upb_oneofdef **oneofdefs = NULL;
+  size_t ndefs;
+  size_t i;
+  uint32_t j;
+  bool ret = false;
+
+  if (size < sizeof(*hdr) || hdr->magic != SNAPSHOT_MAGIC ||
+      hdr->version != SNAPSHOT_VERSION || hdr->size != size) {
+    upb_status_seterrmsg(status, "not a valid snapshot for this machine");
+    return false;
+  }
+
+  fields = (const snapshot_field*)((const char*)buf +
+      snapshot_align(sizeof(snapshot_hdr)));
+  msgs = (const snapshot_msg*)((const char*)fields +
+      snapshot_align(sizeof(snapshot_field) * hdr->field_count));
+  enums = (const snapshot_enum*)((const char*)msgs +
+      snapshot_align(sizeof(snapshot_msg) * hdr->msg_count));
+  vals = (const snapshot_enumval*)((const char*)enums +
+      snapshot_align(sizeof(snapshot_enum) * hdr->enum_count));
+  oneofs = (const snapshot_oneof*)((const char*)vals +
+      snapshot_align(sizeof(snapshot_enumval) * hdr->val_count));
+  strs = (const char*)oneofs +
+      snapshot_align(sizeof(snapshot_oneof) * hdr->oneof_count);
+
+  if (strs < (const char*)buf || strs + hdr->str_size < strs ||
+      strs + hdr->str_size > (const char*)buf + size) {
+    upb_status_seterrmsg(status, "snapshot is truncated");
+    return false;
+  }
+
+  ndefs = hdr->msg_count + hdr->enum_count;
+  defs = upb_gmalloc(sizeof(*defs) * UPB_MAX(ndefs, 1));
+  oneofdefs = upb_gmalloc(sizeof(*oneofdefs) * UPB_MAX(hdr->oneof_count, 1));
+  if (!defs || !oneofdefs) {
+    upb_status_seterrmsg(status, "out of memory");
+    goto done;
+  }
+  memset(defs, 0, sizeof(*defs) * ndefs);
+
+  /* Create all defs first, so that fields can point at their subdefs
+   * directly instead of going through symbol resolution. */
+  for (i = 0; i < hdr->msg_count; i++) {
+    upb_msgdef *m = upb_msgdef_new(&defs);
+    const char *name = snapshot_getstr(strs, hdr->str_size, msgs[i].name);
+    if (!m) goto oom;
+    defs[i] = upb_msgdef_upcast_mutable(m);
+    if (!name || !upb_msgdef_setfullname(m, name, status) ||
+        !upb_msgdef_setsyntax(m, msgs[i].syntax)) {
+      goto err;
+    }
+    upb_msgdef_setmapentry(m, msgs[i].mapentry);
+    upb_msgdef_setextendable(m, msgs[i].extendable);
+  }
+
+  for (i = 0; i < hdr->enum_count; i++) {
+    const snapshot_enum *se = &enums[i];
+    upb_enumdef *e = upb_enumdef_new(&defs);
+    const char *name = snapshot_getstr(strs, hdr->str_size, se->name);
+    if (!e) goto oom;
+    defs[hdr->msg_count + i] = upb_enumdef_upcast_mutable(e);
+    if (!name || !upb_enumdef_setfullname(e, name, status) ||
+        !snapshot_checkrange(se->val_begin, se->val_count, hdr->val_count)) {
+      goto err;
+    }
+    for (j = se->val_begin; j < se->val_begin + se->val_count; j++) {
+      name = snapshot_getstr(strs, hdr->str_size, vals[j].name);
+      if (!name || !upb_enumdef_addval(e, name, vals[j].number, status)) {
+        goto err;
+      }
+    }
+    if (se->val_count > 0 &&
+        !upb_enumdef_setdefault(e, se->defaultval, status)) {
+      goto err;
+    }
+  }
+
+  for (i = 0; i < hdr->msg_count; i++) {
+    const snapshot_msg *sm = &msgs[i];
+    upb_msgdef *m = upb_downcast_msgdef_mutable(defs[i]);
+
+    if (!snapshot_checkrange(sm->field_begin, sm->field_count,
+                             hdr->field_count) ||
+        !snapshot_checkrange(sm->oneof_begin, sm->oneof_count,
+                             hdr->oneof_count)) {
+      goto err;
+    }
+
+    /* Oneofs are added empty and their fields are added through them
+     * below, which also adds the fields to the message. */
+    for (j = 0; j < sm->oneof_count; j++) {
+      upb_oneofdef *o = upb_oneofdef_new(&oneofdefs);
+      const char *name =
+          snapshot_getstr(strs, hdr->str_size, oneofs[sm->oneof_begin + j].name);
+      if (!o) goto oom;
+      oneofdefs[j] = o;
+      if (!name || !upb_oneofdef_setname(o, name, status) ||
+          !upb_msgdef_addoneof(m, o, &oneofdefs, status)) {
+        upb_oneofdef_unref(o, &oneofdefs);
+        goto err;
+      }
+    }
+
+    for (j = sm->field_begin; j < sm->field_begin + sm->field_count; j++) {
+      const snapshot_field *sf = &fields[j];
+      upb_fielddef *f = upb_fielddef_new(&f);
+      const char *name = snapshot_getstr(strs, hdr->str_size, sf->name);
+      bool ok;
+
+      if (!f) goto oom;
+
+      ok = name &&
+           upb_fielddef_checkdescriptortype(sf->descriptortype) &&
+           upb_fielddef_checklabel(sf->label) &&
+           upb_fielddef_setname(f, name, status) &&
+           upb_fielddef_setnumber(f, sf->number, status);
+
+      if (ok) {
+        upb_fielddef_setdescriptortype(f, sf->descriptortype);
+        upb_fielddef_setlabel(f, sf->label);
+        upb_fielddef_setlazy(f, sf->lazy);
+        upb_fielddef_setpacked(f, sf->packed);
+
+        if (sf->subdef != SNAPSHOT_NONE) {
+          uint32_t idx = sf->subdef & ~SNAPSHOT_ENUMBIT;
+          if (sf->subdef & SNAPSHOT_ENUMBIT) {
+            ok = idx < hdr->enum_count &&
+                 upb_fielddef_setsubdef(f, defs[hdr->msg_count + idx], status);
+          } else {
+            ok = idx < hdr->msg_count &&
+                 upb_fielddef_setsubdef(f, defs[idx], status);
+          }
+        }
+      }
+
+      if (ok) {
+        switch (upb_fielddef_type(f)) {
+          case UPB_TYPE_STRING:
+          case UPB_TYPE_BYTES:
+            ok = sf->defaultval < hdr->str_size &&
+                 sf->default_len <= hdr->str_size - sf->defaultval &&
+                 upb_fielddef_setdefaultstr(f, strs + sf->defaultval,
+                                            sf->default_len, status);
+            break;
+          case UPB_TYPE_FLOAT: {
+            float val;
+            memcpy(&val, &sf->defaultval, sizeof(val));
+            upb_fielddef_setdefaultfloat(f, val);
+            break;
+          }
+          case UPB_TYPE_DOUBLE: {
+            double val;
+            memcpy(&val, &sf->defaultval, sizeof(val));
+            upb_fielddef_setdefaultdouble(f, val);
+            break;
+          }
+          case UPB_TYPE_BOOL:
+            upb_fielddef_setdefaultbool(f, sf->defaultval);
+            break;
+          case UPB_TYPE_INT32:
+          case UPB_TYPE_ENUM:
+            upb_fielddef_setdefaultint32(f, (int32_t)sf->defaultval);
+            break;
+          case UPB_TYPE_INT64:
+            upb_fielddef_setdefaultint64(f, sf->defaultval);
+            break;
+          case UPB_TYPE_UINT32:
+            upb_fielddef_setdefaultuint32(f, (uint32_t)sf->defaultval);
+            break;
+          case UPB_TYPE_UINT64:
+            upb_fielddef_setdefaultuint64(f, sf->defaultval);
+            break;
+          case UPB_TYPE_MESSAGE:
+            break;
+        }
+      }
+
+      if (ok) {
+        if (sf->oneof == SNAPSHOT_NONE) {
+          ok = upb_msgdef_addfield(m, f, &f, status);
+        } else {
+          ok = sf->oneof < sm->oneof_count &&
+               upb_oneofdef_addfield(oneofdefs[sf->oneof], f, &f, status);
+        }
+      }
+
+      if (!ok) {
+        upb_fielddef_unref(f, &f);
+        goto err;
+      }
+    }
+  }
+
+  /* upb_symtab_add() takes our refs whether or not it succeeds. */
+  ret = upb_symtab_add(s, defs, ndefs, &defs, status);
+  ndefs = 0;
+  goto done;
+
+oom:
+  upb_status_seterrmsg(status, "out of memory");
+err:
+  if (upb_ok(status)) {
+    upb_status_seterrmsg(status, "snapshot is corrupt");
+  }
+done:
+  if (defs) {
+    for (i = 0; i < ndefs; i++) {
+      if (defs[i]) upb_def_unref(defs[i], &defs);
+    }
+  }
+  upb_gfree(defs);
+  upb_gfree(oneofdefs);
+  return ret;
+}
@@ -774,6 +774,11 @@ class upb::MessageDef {
   void setmapentry(bool map_entry);
   bool mapentry() const;
 
+  /* Does this message declare any extension ranges?  Its layouts only make
+   * room for extensions if so. */
+  void setextendable(bool extendable);
+  bool extendable() const;
+
   /* Iteration over fields.  The order is undefined. */
   class field_iterator
       : public std::iterator<std::forward_iterator_tag, FieldDef*> {
@@ -915,6 +920,8 @@ bool upb_msgdef_addoneof(upb_msgdef *m, upb_oneofdef *o, const void *ref_donor,
 bool upb_msgdef_setfullname(upb_msgdef *m, const char *fullname, upb_status *s);
 void upb_msgdef_setmapentry(upb_msgdef *m, bool map_entry);
 bool upb_msgdef_mapentry(const upb_msgdef *m);
+void upb_msgdef_setextendable(upb_msgdef *m, bool extendable);
+bool upb_msgdef_extendable(const upb_msgdef *m);
 bool upb_msgdef_setsyntax(upb_msgdef *m, upb_syntax_t syntax);
 
 /* Field lookup in a couple of different variations:
@@ -1482,6 +1489,21 @@ class upb::SymbolTable {
    * (replacing any existing ones with the same names). */
   bool AddFile(FileDef* file, Status* s);
 
+  /* Like AddFile(), but adds a whole batch of files in one operation, which
+   * either succeeds or fails as a whole.  Files in the batch may depend on
+   * each other in any order, and the graph is frozen only once, so this is
+   * cheaper than adding the files one at a time.
+   *
+   * Together with LoadDescriptor() (which is safe to call concurrently on
+   * different threads) this lets a program parse many descriptors in parallel
+   * and then link them with a single serial call. */
+  bool AddFiles(FileDef*const* files, size_t n, Status* s);
+
+  /* Writes a flat, mmap()-able image of all defs in this symtab, or adds the
+   * defs from such an image.  See upb_symtab_snapshot() below. */
+  void* Snapshot(Allocator* a, size_t* size) const;
+  bool AddSnapshot(const void* buf, size_t size, Status* s);
+
  private:
   UPB_DISALLOW_POD_OPS(SymbolTable, upb::SymbolTable)
 };
@@ -1502,6 +1524,45 @@ const upb_enumdef *upb_symtab_lookupenum(const upb_symtab *s, const char *sym);
 bool upb_symtab_add(upb_symtab *s, upb_def *const*defs, size_t n,
                     void *ref_donor, upb_status *status);
 bool upb_symtab_addfile(upb_symtab *s, upb_filedef *file, upb_status* status);
+bool upb_symtab_addfiles(upb_symtab *s, upb_filedef *const*files, size_t n,
+                         upb_status *status);
+
+/* Lazy loading.  A symtab may have a loader, which is called whenever a
+ * lookup misses.  The loader may add the def named "sym" (along with anything
+ * it depends on) to "s" with any of the upb_symtab_add*() functions, and
+ * returns true if it did.  This lets a symtab stand in for a huge registry of
+ * types while only building the ones that are actually used.
+ *
+ * Since lookups on a symtab with a loader may add defs, they are not
+ * threadsafe.  Iteration only sees the defs that have been loaded so far, and
+ * defs added with upb_symtab_add() can only refer to defs already loaded.
+ *
+ * "freeloader" (if non-NULL) is called on "closure" when the symtab is freed
+ * or another loader replaces this one.  upb_symtab_loaderclosure() returns
+ * the current closure if the loader is "load", or NULL otherwise. */
+typedef bool upb_symtab_loadfunc(void *closure, upb_symtab *s, const char *sym);
+typedef void upb_symtab_freeloaderfunc(void *closure);
+void upb_symtab_setloader(upb_symtab *s, upb_symtab_loadfunc *load,
+                          upb_symtab_freeloaderfunc *freeloader,
+                          void *closure);
+void *upb_symtab_loaderclosure(const upb_symtab *s, upb_symtab_loadfunc *load);
+
+/* Snapshots: a flat, pointer-free image of every def in a symtab.  All
+ * references inside a snapshot are offsets, so it can be written once (say at
+ * build time) and later mmap()'d at any address.  Adding a snapshot to a
+ * symtab builds the defs straight from the image, skipping descriptor parsing
+ * and symbol resolution entirely.
+ *
+ * Snapshots are only portable between machines with the same byte order and
+ * alignment, and between identical versions of upb.
+ *
+ * upb_symtab_snapshot() returns a buffer allocated from "a" and sets "*size",
+ * or returns NULL on allocation failure.  upb_symtab_addsnapshot() has the
+ * same all-or-nothing semantics as upb_symtab_add(); it does not retain any
+ * pointers into "buf". */
+void *upb_symtab_snapshot(const upb_symtab *s, upb_alloc *a, size_t *size);
+bool upb_symtab_addsnapshot(upb_symtab *s, const void *buf, size_t size,
+                            upb_status *status);
 
 /* upb_symtab_iter i;
  * for(upb_symtab_begin(&i, s, type); !upb_symtab_done(&i);
@@ -1547,6 +1608,15 @@ inline bool SymbolTable::Add(
 inline bool SymbolTable::AddFile(FileDef* file, Status* s) {
   return upb_symtab_addfile(this, file, s);
 }
+inline bool SymbolTable::AddFiles(FileDef*const* files, size_t n, Status* s) {
+  return upb_symtab_addfiles(this, files, n, s);
+}
+inline void* SymbolTable::Snapshot(Allocator* a, size_t* size) const {
+  return upb_symtab_snapshot(this, a, size);
+}
+inline bool SymbolTable::AddSnapshot(const void* buf, size_t size, Status* s) {
+  return upb_symtab_addsnapshot(this, buf, size, s);
+}
 }  /* namespace upb */
 #endif
 
@@ -1854,6 +1924,12 @@ inline void MessageDef::setmapentry(bool map_entry) {
 inline bool MessageDef::mapentry() const {
   return upb_msgdef_mapentry(this);
 }
+inline void MessageDef::setextendable(bool extendable) {
+  upb_msgdef_setextendable(this, extendable);
+}
+inline bool MessageDef::extendable() const {
+  return upb_msgdef_extendable(this);
+}
 inline MessageDef::field_iterator MessageDef::field_begin() {
   return field_iterator(this);
 }
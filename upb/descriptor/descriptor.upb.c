@@ -14,10 +14,6 @@
 #include "upb/descriptor/descriptor.upb.h"
 
 
-struct google_protobuf_FileDescriptorSet {
-  upb_array* file;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_FileDescriptorSet_submsgs[1] = {
   &google_protobuf_FileDescriptorProto_msginit,
 };
@@ -26,18 +22,28 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_FileDescriptorSet__field
   {1, offsetof(google_protobuf_FileDescriptorSet, file), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_FileDescriptorSet__lookup[2] = {
+  UPB_NO_FIELD,
+  0,
+};
+
+static const uint64_t google_protobuf_FileDescriptorSet__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000001U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_FileDescriptorSet_msginit = {
   &google_protobuf_FileDescriptorSet_submsgs[0],
   &google_protobuf_FileDescriptorSet__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_FileDescriptorSet), 1, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_FileDescriptorSet), 1, 0, false, true,
+  &google_protobuf_FileDescriptorSet__lookup[0], 2,
+  NULL, &google_protobuf_FileDescriptorSet__check_fields[0], 0
 };
 
 google_protobuf_FileDescriptorSet *google_protobuf_FileDescriptorSet_new(upb_env *env) {
-  google_protobuf_FileDescriptorSet *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_FileDescriptorSet_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_FileDescriptorSet *google_protobuf_FileDescriptorSet_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_FileDescriptorSet *msg = google_protobuf_FileDescriptorSet_new(env);
@@ -50,27 +56,6 @@ google_protobuf_FileDescriptorSet *google_protobuf_FileDescriptorSet_parsenew(up
 char *google_protobuf_FileDescriptorSet_serialize(google_protobuf_FileDescriptorSet *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_FileDescriptorSet_msginit, env, size);
 }
-upb_array* google_protobuf_FileDescriptorSet_file(const google_protobuf_FileDescriptorSet *msg) {
-  return msg->file;
-}
-void google_protobuf_FileDescriptorSet_set_file(google_protobuf_FileDescriptorSet *msg, upb_array* value) {
-  msg->file = value;
-}
-struct google_protobuf_FileDescriptorProto {
-  upb_stringview name;
-  upb_stringview package;
-  upb_stringview syntax;
-  google_protobuf_FileOptions* options;
-  google_protobuf_SourceCodeInfo* source_code_info;
-  upb_array* dependency;
-  upb_array* message_type;
-  upb_array* enum_type;
-  upb_array* service;
-  upb_array* extension;
-  upb_array* public_dependency;
-  upb_array* weak_dependency;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_FileDescriptorProto_submsgs[6] = {
   &google_protobuf_DescriptorProto_msginit,
   &google_protobuf_EnumDescriptorProto_msginit,
@@ -95,18 +80,50 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_FileDescriptorProto__fie
   {12, offsetof(google_protobuf_FileDescriptorProto, syntax), 2, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 9, 1},
 };
 
+static const uint16_t google_protobuf_FileDescriptorProto__lookup[13] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+  2,
+  3,
+  4,
+  5,
+  6,
+  7,
+  8,
+  9,
+  10,
+  11,
+};
+
+static const uint16_t google_protobuf_FileDescriptorProto__hasbit_fields[8] = {
+  0,
+  1,
+  11,
+  7,
+  8,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_FileDescriptorProto__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x0000067cU,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_FileDescriptorProto_msginit = {
   &google_protobuf_FileDescriptorProto_submsgs[0],
   &google_protobuf_FileDescriptorProto__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_FileDescriptorProto), 12, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_FileDescriptorProto), 12, 0, false, true,
+  &google_protobuf_FileDescriptorProto__lookup[0], 13,
+  &google_protobuf_FileDescriptorProto__hasbit_fields[0], &google_protobuf_FileDescriptorProto__check_fields[0], 1
 };
 
 google_protobuf_FileDescriptorProto *google_protobuf_FileDescriptorProto_new(upb_env *env) {
-  google_protobuf_FileDescriptorProto *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_FileDescriptorProto_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_FileDescriptorProto *google_protobuf_FileDescriptorProto_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_FileDescriptorProto *msg = google_protobuf_FileDescriptorProto_new(env);
@@ -119,92 +136,7 @@ google_protobuf_FileDescriptorProto *google_protobuf_FileDescriptorProto_parsene
 char *google_protobuf_FileDescriptorProto_serialize(google_protobuf_FileDescriptorProto *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_FileDescriptorProto_msginit, env, size);
 }
-upb_stringview google_protobuf_FileDescriptorProto_name(const google_protobuf_FileDescriptorProto *msg) {
-  return msg->name;
-}
-void google_protobuf_FileDescriptorProto_set_name(google_protobuf_FileDescriptorProto *msg, upb_stringview value) {
-  msg->name = value;
-}
-upb_stringview google_protobuf_FileDescriptorProto_package(const google_protobuf_FileDescriptorProto *msg) {
-  return msg->package;
-}
-void google_protobuf_FileDescriptorProto_set_package(google_protobuf_FileDescriptorProto *msg, upb_stringview value) {
-  msg->package = value;
-}
-upb_array* google_protobuf_FileDescriptorProto_dependency(const google_protobuf_FileDescriptorProto *msg) {
-  return msg->dependency;
-}
-void google_protobuf_FileDescriptorProto_set_dependency(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
-  msg->dependency = value;
-}
-upb_array* google_protobuf_FileDescriptorProto_message_type(const google_protobuf_FileDescriptorProto *msg) {
-  return msg->message_type;
-}
-void google_protobuf_FileDescriptorProto_set_message_type(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
-  msg->message_type = value;
-}
-upb_array* google_protobuf_FileDescriptorProto_enum_type(const google_protobuf_FileDescriptorProto *msg) {
-  return msg->enum_type;
-}
-void google_protobuf_FileDescriptorProto_set_enum_type(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
-  msg->enum_type = value;
-}
-upb_array* google_protobuf_FileDescriptorProto_service(const google_protobuf_FileDescriptorProto *msg) {
-  return msg->service;
-}
-void google_protobuf_FileDescriptorProto_set_service(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
-  msg->service = value;
-}
-upb_array* google_protobuf_FileDescriptorProto_extension(const google_protobuf_FileDescriptorProto *msg) {
-  return msg->extension;
-}
-void google_protobuf_FileDescriptorProto_set_extension(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
-  msg->extension = value;
-}
-google_protobuf_FileOptions* google_protobuf_FileDescriptorProto_options(const google_protobuf_FileDescriptorProto *msg) {
-  return msg->options;
-}
-void google_protobuf_FileDescriptorProto_set_options(google_protobuf_FileDescriptorProto *msg, google_protobuf_FileOptions* value) {
-  msg->options = value;
-}
-google_protobuf_SourceCodeInfo* google_protobuf_FileDescriptorProto_source_code_info(const google_protobuf_FileDescriptorProto *msg) {
-  return msg->source_code_info;
-}
-void google_protobuf_FileDescriptorProto_set_source_code_info(google_protobuf_FileDescriptorProto *msg, google_protobuf_SourceCodeInfo* value) {
-  msg->source_code_info = value;
-}
-upb_array* google_protobuf_FileDescriptorProto_public_dependency(const google_protobuf_FileDescriptorProto *msg) {
-  return msg->public_dependency;
-}
-void google_protobuf_FileDescriptorProto_set_public_dependency(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
-  msg->public_dependency = value;
-}
-upb_array* google_protobuf_FileDescriptorProto_weak_dependency(const google_protobuf_FileDescriptorProto *msg) {
-  return msg->weak_dependency;
-}
-void google_protobuf_FileDescriptorProto_set_weak_dependency(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
-  msg->weak_dependency = value;
-}
-upb_stringview google_protobuf_FileDescriptorProto_syntax(const google_protobuf_FileDescriptorProto *msg) {
-  return msg->syntax;
-}
-void google_protobuf_FileDescriptorProto_set_syntax(google_protobuf_FileDescriptorProto *msg, upb_stringview value) {
-  msg->syntax = value;
-}
-struct google_protobuf_DescriptorProto {
-  upb_stringview name;
-  google_protobuf_MessageOptions* options;
-  upb_array* field;
-  upb_array* nested_type;
-  upb_array* enum_type;
-  upb_array* extension_range;
-  upb_array* extension;
-  upb_array* oneof_decl;
-  upb_array* reserved_range;
-  upb_array* reserved_name;
-};
-
-static const upb_msglayout_msginit_v1 *const google_protobuf_DescriptorProto_submsgs[8] = {
+static const upb_msglayout_msginit_v1 *const google_protobuf_DescriptorProto_submsgs[7] = {
   &google_protobuf_DescriptorProto_msginit,
   &google_protobuf_DescriptorProto_ExtensionRange_msginit,
   &google_protobuf_DescriptorProto_ReservedRange_msginit,
@@ -227,18 +159,48 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_DescriptorProto__fields[
   {10, offsetof(google_protobuf_DescriptorProto, reserved_name), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 9, 3},
 };
 
+static const uint16_t google_protobuf_DescriptorProto__lookup[11] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+  2,
+  3,
+  4,
+  5,
+  6,
+  7,
+  8,
+  9,
+};
+
+static const uint16_t google_protobuf_DescriptorProto__hasbit_fields[8] = {
+  0,
+  6,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_DescriptorProto__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x000003beU,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_DescriptorProto_msginit = {
   &google_protobuf_DescriptorProto_submsgs[0],
   &google_protobuf_DescriptorProto__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_DescriptorProto), 10, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_DescriptorProto), 10, 0, false, true,
+  &google_protobuf_DescriptorProto__lookup[0], 11,
+  &google_protobuf_DescriptorProto__hasbit_fields[0], &google_protobuf_DescriptorProto__check_fields[0], 1
 };
 
 google_protobuf_DescriptorProto *google_protobuf_DescriptorProto_new(upb_env *env) {
-  google_protobuf_DescriptorProto *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_DescriptorProto_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_DescriptorProto *google_protobuf_DescriptorProto_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_DescriptorProto *msg = google_protobuf_DescriptorProto_new(env);
@@ -251,88 +213,45 @@ google_protobuf_DescriptorProto *google_protobuf_DescriptorProto_parsenew(upb_st
 char *google_protobuf_DescriptorProto_serialize(google_protobuf_DescriptorProto *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_DescriptorProto_msginit, env, size);
 }
-upb_stringview google_protobuf_DescriptorProto_name(const google_protobuf_DescriptorProto *msg) {
-  return msg->name;
-}
-void google_protobuf_DescriptorProto_set_name(google_protobuf_DescriptorProto *msg, upb_stringview value) {
-  msg->name = value;
-}
-upb_array* google_protobuf_DescriptorProto_field(const google_protobuf_DescriptorProto *msg) {
-  return msg->field;
-}
-void google_protobuf_DescriptorProto_set_field(google_protobuf_DescriptorProto *msg, upb_array* value) {
-  msg->field = value;
-}
-upb_array* google_protobuf_DescriptorProto_nested_type(const google_protobuf_DescriptorProto *msg) {
-  return msg->nested_type;
-}
-void google_protobuf_DescriptorProto_set_nested_type(google_protobuf_DescriptorProto *msg, upb_array* value) {
-  msg->nested_type = value;
-}
-upb_array* google_protobuf_DescriptorProto_enum_type(const google_protobuf_DescriptorProto *msg) {
-  return msg->enum_type;
-}
-void google_protobuf_DescriptorProto_set_enum_type(google_protobuf_DescriptorProto *msg, upb_array* value) {
-  msg->enum_type = value;
-}
-upb_array* google_protobuf_DescriptorProto_extension_range(const google_protobuf_DescriptorProto *msg) {
-  return msg->extension_range;
-}
-void google_protobuf_DescriptorProto_set_extension_range(google_protobuf_DescriptorProto *msg, upb_array* value) {
-  msg->extension_range = value;
-}
-upb_array* google_protobuf_DescriptorProto_extension(const google_protobuf_DescriptorProto *msg) {
-  return msg->extension;
-}
-void google_protobuf_DescriptorProto_set_extension(google_protobuf_DescriptorProto *msg, upb_array* value) {
-  msg->extension = value;
-}
-google_protobuf_MessageOptions* google_protobuf_DescriptorProto_options(const google_protobuf_DescriptorProto *msg) {
-  return msg->options;
-}
-void google_protobuf_DescriptorProto_set_options(google_protobuf_DescriptorProto *msg, google_protobuf_MessageOptions* value) {
-  msg->options = value;
-}
-upb_array* google_protobuf_DescriptorProto_oneof_decl(const google_protobuf_DescriptorProto *msg) {
-  return msg->oneof_decl;
-}
-void google_protobuf_DescriptorProto_set_oneof_decl(google_protobuf_DescriptorProto *msg, upb_array* value) {
-  msg->oneof_decl = value;
-}
-upb_array* google_protobuf_DescriptorProto_reserved_range(const google_protobuf_DescriptorProto *msg) {
-  return msg->reserved_range;
-}
-void google_protobuf_DescriptorProto_set_reserved_range(google_protobuf_DescriptorProto *msg, upb_array* value) {
-  msg->reserved_range = value;
-}
-upb_array* google_protobuf_DescriptorProto_reserved_name(const google_protobuf_DescriptorProto *msg) {
-  return msg->reserved_name;
-}
-void google_protobuf_DescriptorProto_set_reserved_name(google_protobuf_DescriptorProto *msg, upb_array* value) {
-  msg->reserved_name = value;
-}
-struct google_protobuf_DescriptorProto_ExtensionRange {
-  int32_t start;
-  int32_t end;
-};
-
 static const upb_msglayout_fieldinit_v1 google_protobuf_DescriptorProto_ExtensionRange__fields[2] = {
   {1, offsetof(google_protobuf_DescriptorProto_ExtensionRange, start), 0, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 5, 1},
   {2, offsetof(google_protobuf_DescriptorProto_ExtensionRange, end), 1, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 5, 1},
 };
 
+static const uint16_t google_protobuf_DescriptorProto_ExtensionRange__lookup[3] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+};
+
+static const uint16_t google_protobuf_DescriptorProto_ExtensionRange__hasbit_fields[8] = {
+  0,
+  1,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_DescriptorProto_ExtensionRange__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000000U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_DescriptorProto_ExtensionRange_msginit = {
   NULL,
   &google_protobuf_DescriptorProto_ExtensionRange__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_DescriptorProto_ExtensionRange), 2, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_DescriptorProto_ExtensionRange), 2, 0, false, true,
+  &google_protobuf_DescriptorProto_ExtensionRange__lookup[0], 3,
+  &google_protobuf_DescriptorProto_ExtensionRange__hasbit_fields[0], &google_protobuf_DescriptorProto_ExtensionRange__check_fields[0], 1
 };
 
 google_protobuf_DescriptorProto_ExtensionRange *google_protobuf_DescriptorProto_ExtensionRange_new(upb_env *env) {
-  google_protobuf_DescriptorProto_ExtensionRange *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_DescriptorProto_ExtensionRange_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_DescriptorProto_ExtensionRange *google_protobuf_DescriptorProto_ExtensionRange_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_DescriptorProto_ExtensionRange *msg = google_protobuf_DescriptorProto_ExtensionRange_new(env);
@@ -345,40 +264,45 @@ google_protobuf_DescriptorProto_ExtensionRange *google_protobuf_DescriptorProto_
 char *google_protobuf_DescriptorProto_ExtensionRange_serialize(google_protobuf_DescriptorProto_ExtensionRange *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_DescriptorProto_ExtensionRange_msginit, env, size);
 }
-int32_t google_protobuf_DescriptorProto_ExtensionRange_start(const google_protobuf_DescriptorProto_ExtensionRange *msg) {
-  return msg->start;
-}
-void google_protobuf_DescriptorProto_ExtensionRange_set_start(google_protobuf_DescriptorProto_ExtensionRange *msg, int32_t value) {
-  msg->start = value;
-}
-int32_t google_protobuf_DescriptorProto_ExtensionRange_end(const google_protobuf_DescriptorProto_ExtensionRange *msg) {
-  return msg->end;
-}
-void google_protobuf_DescriptorProto_ExtensionRange_set_end(google_protobuf_DescriptorProto_ExtensionRange *msg, int32_t value) {
-  msg->end = value;
-}
-struct google_protobuf_DescriptorProto_ReservedRange {
-  int32_t start;
-  int32_t end;
-};
-
 static const upb_msglayout_fieldinit_v1 google_protobuf_DescriptorProto_ReservedRange__fields[2] = {
   {1, offsetof(google_protobuf_DescriptorProto_ReservedRange, start), 0, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 5, 1},
   {2, offsetof(google_protobuf_DescriptorProto_ReservedRange, end), 1, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 5, 1},
 };
 
+static const uint16_t google_protobuf_DescriptorProto_ReservedRange__lookup[3] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+};
+
+static const uint16_t google_protobuf_DescriptorProto_ReservedRange__hasbit_fields[8] = {
+  0,
+  1,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_DescriptorProto_ReservedRange__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000000U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_DescriptorProto_ReservedRange_msginit = {
   NULL,
   &google_protobuf_DescriptorProto_ReservedRange__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_DescriptorProto_ReservedRange), 2, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_DescriptorProto_ReservedRange), 2, 0, false, true,
+  &google_protobuf_DescriptorProto_ReservedRange__lookup[0], 3,
+  &google_protobuf_DescriptorProto_ReservedRange__hasbit_fields[0], &google_protobuf_DescriptorProto_ReservedRange__check_fields[0], 1
 };
 
 google_protobuf_DescriptorProto_ReservedRange *google_protobuf_DescriptorProto_ReservedRange_new(upb_env *env) {
-  google_protobuf_DescriptorProto_ReservedRange *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_DescriptorProto_ReservedRange_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_DescriptorProto_ReservedRange *google_protobuf_DescriptorProto_ReservedRange_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_DescriptorProto_ReservedRange *msg = google_protobuf_DescriptorProto_ReservedRange_new(env);
@@ -391,31 +315,6 @@ google_protobuf_DescriptorProto_ReservedRange *google_protobuf_DescriptorProto_R
 char *google_protobuf_DescriptorProto_ReservedRange_serialize(google_protobuf_DescriptorProto_ReservedRange *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_DescriptorProto_ReservedRange_msginit, env, size);
 }
-int32_t google_protobuf_DescriptorProto_ReservedRange_start(const google_protobuf_DescriptorProto_ReservedRange *msg) {
-  return msg->start;
-}
-void google_protobuf_DescriptorProto_ReservedRange_set_start(google_protobuf_DescriptorProto_ReservedRange *msg, int32_t value) {
-  msg->start = value;
-}
-int32_t google_protobuf_DescriptorProto_ReservedRange_end(const google_protobuf_DescriptorProto_ReservedRange *msg) {
-  return msg->end;
-}
-void google_protobuf_DescriptorProto_ReservedRange_set_end(google_protobuf_DescriptorProto_ReservedRange *msg, int32_t value) {
-  msg->end = value;
-}
-struct google_protobuf_FieldDescriptorProto {
-  google_protobuf_FieldDescriptorProto_Label label;
-  google_protobuf_FieldDescriptorProto_Type type;
-  int32_t number;
-  int32_t oneof_index;
-  upb_stringview name;
-  upb_stringview extendee;
-  upb_stringview type_name;
-  upb_stringview default_value;
-  upb_stringview json_name;
-  google_protobuf_FieldOptions* options;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_FieldDescriptorProto_submsgs[1] = {
   &google_protobuf_FieldOptions_msginit,
 };
@@ -433,18 +332,56 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_FieldDescriptorProto__fi
   {10, offsetof(google_protobuf_FieldDescriptorProto, json_name), 8, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 9, 1},
 };
 
+static const uint16_t google_protobuf_FieldDescriptorProto__lookup[11] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+  2,
+  3,
+  4,
+  5,
+  6,
+  7,
+  8,
+  9,
+};
+
+static const uint16_t google_protobuf_FieldDescriptorProto__hasbit_fields[16] = {
+  3,
+  4,
+  2,
+  8,
+  0,
+  1,
+  5,
+  6,
+  9,
+  7,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_FieldDescriptorProto__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000000U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_FieldDescriptorProto_msginit = {
   &google_protobuf_FieldDescriptorProto_submsgs[0],
   &google_protobuf_FieldDescriptorProto__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_FieldDescriptorProto), 10, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_FieldDescriptorProto), 10, 0, false, true,
+  &google_protobuf_FieldDescriptorProto__lookup[0], 11,
+  &google_protobuf_FieldDescriptorProto__hasbit_fields[0], &google_protobuf_FieldDescriptorProto__check_fields[0], 2
 };
 
 google_protobuf_FieldDescriptorProto *google_protobuf_FieldDescriptorProto_new(upb_env *env) {
-  google_protobuf_FieldDescriptorProto *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_FieldDescriptorProto_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_FieldDescriptorProto *google_protobuf_FieldDescriptorProto_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_FieldDescriptorProto *msg = google_protobuf_FieldDescriptorProto_new(env);
@@ -457,86 +394,43 @@ google_protobuf_FieldDescriptorProto *google_protobuf_FieldDescriptorProto_parse
 char *google_protobuf_FieldDescriptorProto_serialize(google_protobuf_FieldDescriptorProto *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_FieldDescriptorProto_msginit, env, size);
 }
-upb_stringview google_protobuf_FieldDescriptorProto_name(const google_protobuf_FieldDescriptorProto *msg) {
-  return msg->name;
-}
-void google_protobuf_FieldDescriptorProto_set_name(google_protobuf_FieldDescriptorProto *msg, upb_stringview value) {
-  msg->name = value;
-}
-upb_stringview google_protobuf_FieldDescriptorProto_extendee(const google_protobuf_FieldDescriptorProto *msg) {
-  return msg->extendee;
-}
-void google_protobuf_FieldDescriptorProto_set_extendee(google_protobuf_FieldDescriptorProto *msg, upb_stringview value) {
-  msg->extendee = value;
-}
-int32_t google_protobuf_FieldDescriptorProto_number(const google_protobuf_FieldDescriptorProto *msg) {
-  return msg->number;
-}
-void google_protobuf_FieldDescriptorProto_set_number(google_protobuf_FieldDescriptorProto *msg, int32_t value) {
-  msg->number = value;
-}
-google_protobuf_FieldDescriptorProto_Label google_protobuf_FieldDescriptorProto_label(const google_protobuf_FieldDescriptorProto *msg) {
-  return msg->label;
-}
-void google_protobuf_FieldDescriptorProto_set_label(google_protobuf_FieldDescriptorProto *msg, google_protobuf_FieldDescriptorProto_Label value) {
-  msg->label = value;
-}
-google_protobuf_FieldDescriptorProto_Type google_protobuf_FieldDescriptorProto_type(const google_protobuf_FieldDescriptorProto *msg) {
-  return msg->type;
-}
-void google_protobuf_FieldDescriptorProto_set_type(google_protobuf_FieldDescriptorProto *msg, google_protobuf_FieldDescriptorProto_Type value) {
-  msg->type = value;
-}
-upb_stringview google_protobuf_FieldDescriptorProto_type_name(const google_protobuf_FieldDescriptorProto *msg) {
-  return msg->type_name;
-}
-void google_protobuf_FieldDescriptorProto_set_type_name(google_protobuf_FieldDescriptorProto *msg, upb_stringview value) {
-  msg->type_name = value;
-}
-upb_stringview google_protobuf_FieldDescriptorProto_default_value(const google_protobuf_FieldDescriptorProto *msg) {
-  return msg->default_value;
-}
-void google_protobuf_FieldDescriptorProto_set_default_value(google_protobuf_FieldDescriptorProto *msg, upb_stringview value) {
-  msg->default_value = value;
-}
-google_protobuf_FieldOptions* google_protobuf_FieldDescriptorProto_options(const google_protobuf_FieldDescriptorProto *msg) {
-  return msg->options;
-}
-void google_protobuf_FieldDescriptorProto_set_options(google_protobuf_FieldDescriptorProto *msg, google_protobuf_FieldOptions* value) {
-  msg->options = value;
-}
-int32_t google_protobuf_FieldDescriptorProto_oneof_index(const google_protobuf_FieldDescriptorProto *msg) {
-  return msg->oneof_index;
-}
-void google_protobuf_FieldDescriptorProto_set_oneof_index(google_protobuf_FieldDescriptorProto *msg, int32_t value) {
-  msg->oneof_index = value;
-}
-upb_stringview google_protobuf_FieldDescriptorProto_json_name(const google_protobuf_FieldDescriptorProto *msg) {
-  return msg->json_name;
-}
-void google_protobuf_FieldDescriptorProto_set_json_name(google_protobuf_FieldDescriptorProto *msg, upb_stringview value) {
-  msg->json_name = value;
-}
-struct google_protobuf_OneofDescriptorProto {
-  upb_stringview name;
-};
-
 static const upb_msglayout_fieldinit_v1 google_protobuf_OneofDescriptorProto__fields[1] = {
   {1, offsetof(google_protobuf_OneofDescriptorProto, name), 0, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 9, 1},
 };
 
+static const uint16_t google_protobuf_OneofDescriptorProto__lookup[2] = {
+  UPB_NO_FIELD,
+  0,
+};
+
+static const uint16_t google_protobuf_OneofDescriptorProto__hasbit_fields[8] = {
+  0,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_OneofDescriptorProto__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000000U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_OneofDescriptorProto_msginit = {
   NULL,
   &google_protobuf_OneofDescriptorProto__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_OneofDescriptorProto), 1, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_OneofDescriptorProto), 1, 0, false, true,
+  &google_protobuf_OneofDescriptorProto__lookup[0], 2,
+  &google_protobuf_OneofDescriptorProto__hasbit_fields[0], &google_protobuf_OneofDescriptorProto__check_fields[0], 1
 };
 
 google_protobuf_OneofDescriptorProto *google_protobuf_OneofDescriptorProto_new(upb_env *env) {
-  google_protobuf_OneofDescriptorProto *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_OneofDescriptorProto_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_OneofDescriptorProto *google_protobuf_OneofDescriptorProto_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_OneofDescriptorProto *msg = google_protobuf_OneofDescriptorProto_new(env);
@@ -549,18 +443,6 @@ google_protobuf_OneofDescriptorProto *google_protobuf_OneofDescriptorProto_parse
 char *google_protobuf_OneofDescriptorProto_serialize(google_protobuf_OneofDescriptorProto *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_OneofDescriptorProto_msginit, env, size);
 }
-upb_stringview google_protobuf_OneofDescriptorProto_name(const google_protobuf_OneofDescriptorProto *msg) {
-  return msg->name;
-}
-void google_protobuf_OneofDescriptorProto_set_name(google_protobuf_OneofDescriptorProto *msg, upb_stringview value) {
-  msg->name = value;
-}
-struct google_protobuf_EnumDescriptorProto {
-  upb_stringview name;
-  google_protobuf_EnumOptions* options;
-  upb_array* value;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_EnumDescriptorProto_submsgs[2] = {
   &google_protobuf_EnumOptions_msginit,
   &google_protobuf_EnumValueDescriptorProto_msginit,
@@ -572,18 +454,41 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_EnumDescriptorProto__fie
   {3, offsetof(google_protobuf_EnumDescriptorProto, options), 1, UPB_NOT_IN_ONEOF, 0, 11, 1},
 };
 
+static const uint16_t google_protobuf_EnumDescriptorProto__lookup[4] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+  2,
+};
+
+static const uint16_t google_protobuf_EnumDescriptorProto__hasbit_fields[8] = {
+  0,
+  2,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_EnumDescriptorProto__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000002U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_EnumDescriptorProto_msginit = {
   &google_protobuf_EnumDescriptorProto_submsgs[0],
   &google_protobuf_EnumDescriptorProto__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_EnumDescriptorProto), 3, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_EnumDescriptorProto), 3, 0, false, true,
+  &google_protobuf_EnumDescriptorProto__lookup[0], 4,
+  &google_protobuf_EnumDescriptorProto__hasbit_fields[0], &google_protobuf_EnumDescriptorProto__check_fields[0], 1
 };
 
 google_protobuf_EnumDescriptorProto *google_protobuf_EnumDescriptorProto_new(upb_env *env) {
-  google_protobuf_EnumDescriptorProto *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_EnumDescriptorProto_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_EnumDescriptorProto *google_protobuf_EnumDescriptorProto_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_EnumDescriptorProto *msg = google_protobuf_EnumDescriptorProto_new(env);
@@ -596,30 +501,6 @@ google_protobuf_EnumDescriptorProto *google_protobuf_EnumDescriptorProto_parsene
 char *google_protobuf_EnumDescriptorProto_serialize(google_protobuf_EnumDescriptorProto *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_EnumDescriptorProto_msginit, env, size);
 }
-upb_stringview google_protobuf_EnumDescriptorProto_name(const google_protobuf_EnumDescriptorProto *msg) {
-  return msg->name;
-}
-void google_protobuf_EnumDescriptorProto_set_name(google_protobuf_EnumDescriptorProto *msg, upb_stringview value) {
-  msg->name = value;
-}
-upb_array* google_protobuf_EnumDescriptorProto_value(const google_protobuf_EnumDescriptorProto *msg) {
-  return msg->value;
-}
-void google_protobuf_EnumDescriptorProto_set_value(google_protobuf_EnumDescriptorProto *msg, upb_array* value) {
-  msg->value = value;
-}
-google_protobuf_EnumOptions* google_protobuf_EnumDescriptorProto_options(const google_protobuf_EnumDescriptorProto *msg) {
-  return msg->options;
-}
-void google_protobuf_EnumDescriptorProto_set_options(google_protobuf_EnumDescriptorProto *msg, google_protobuf_EnumOptions* value) {
-  msg->options = value;
-}
-struct google_protobuf_EnumValueDescriptorProto {
-  int32_t number;
-  upb_stringview name;
-  google_protobuf_EnumValueOptions* options;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_EnumValueDescriptorProto_submsgs[1] = {
   &google_protobuf_EnumValueOptions_msginit,
 };
@@ -630,18 +511,41 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_EnumValueDescriptorProto
   {3, offsetof(google_protobuf_EnumValueDescriptorProto, options), 2, UPB_NOT_IN_ONEOF, 0, 11, 1},
 };
 
+static const uint16_t google_protobuf_EnumValueDescriptorProto__lookup[4] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+  2,
+};
+
+static const uint16_t google_protobuf_EnumValueDescriptorProto__hasbit_fields[8] = {
+  1,
+  0,
+  2,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_EnumValueDescriptorProto__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000000U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_EnumValueDescriptorProto_msginit = {
   &google_protobuf_EnumValueDescriptorProto_submsgs[0],
   &google_protobuf_EnumValueDescriptorProto__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_EnumValueDescriptorProto), 3, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_EnumValueDescriptorProto), 3, 0, false, true,
+  &google_protobuf_EnumValueDescriptorProto__lookup[0], 4,
+  &google_protobuf_EnumValueDescriptorProto__hasbit_fields[0], &google_protobuf_EnumValueDescriptorProto__check_fields[0], 1
 };
 
 google_protobuf_EnumValueDescriptorProto *google_protobuf_EnumValueDescriptorProto_new(upb_env *env) {
-  google_protobuf_EnumValueDescriptorProto *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_EnumValueDescriptorProto_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_EnumValueDescriptorProto *google_protobuf_EnumValueDescriptorProto_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_EnumValueDescriptorProto *msg = google_protobuf_EnumValueDescriptorProto_new(env);
@@ -654,30 +558,6 @@ google_protobuf_EnumValueDescriptorProto *google_protobuf_EnumValueDescriptorPro
 char *google_protobuf_EnumValueDescriptorProto_serialize(google_protobuf_EnumValueDescriptorProto *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_EnumValueDescriptorProto_msginit, env, size);
 }
-upb_stringview google_protobuf_EnumValueDescriptorProto_name(const google_protobuf_EnumValueDescriptorProto *msg) {
-  return msg->name;
-}
-void google_protobuf_EnumValueDescriptorProto_set_name(google_protobuf_EnumValueDescriptorProto *msg, upb_stringview value) {
-  msg->name = value;
-}
-int32_t google_protobuf_EnumValueDescriptorProto_number(const google_protobuf_EnumValueDescriptorProto *msg) {
-  return msg->number;
-}
-void google_protobuf_EnumValueDescriptorProto_set_number(google_protobuf_EnumValueDescriptorProto *msg, int32_t value) {
-  msg->number = value;
-}
-google_protobuf_EnumValueOptions* google_protobuf_EnumValueDescriptorProto_options(const google_protobuf_EnumValueDescriptorProto *msg) {
-  return msg->options;
-}
-void google_protobuf_EnumValueDescriptorProto_set_options(google_protobuf_EnumValueDescriptorProto *msg, google_protobuf_EnumValueOptions* value) {
-  msg->options = value;
-}
-struct google_protobuf_ServiceDescriptorProto {
-  upb_stringview name;
-  google_protobuf_ServiceOptions* options;
-  upb_array* method;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_ServiceDescriptorProto_submsgs[2] = {
   &google_protobuf_MethodDescriptorProto_msginit,
   &google_protobuf_ServiceOptions_msginit,
@@ -689,18 +569,41 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_ServiceDescriptorProto__
   {3, offsetof(google_protobuf_ServiceDescriptorProto, options), 1, UPB_NOT_IN_ONEOF, 1, 11, 1},
 };
 
+static const uint16_t google_protobuf_ServiceDescriptorProto__lookup[4] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+  2,
+};
+
+static const uint16_t google_protobuf_ServiceDescriptorProto__hasbit_fields[8] = {
+  0,
+  2,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_ServiceDescriptorProto__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000002U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_ServiceDescriptorProto_msginit = {
   &google_protobuf_ServiceDescriptorProto_submsgs[0],
   &google_protobuf_ServiceDescriptorProto__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_ServiceDescriptorProto), 3, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_ServiceDescriptorProto), 3, 0, false, true,
+  &google_protobuf_ServiceDescriptorProto__lookup[0], 4,
+  &google_protobuf_ServiceDescriptorProto__hasbit_fields[0], &google_protobuf_ServiceDescriptorProto__check_fields[0], 1
 };
 
 google_protobuf_ServiceDescriptorProto *google_protobuf_ServiceDescriptorProto_new(upb_env *env) {
-  google_protobuf_ServiceDescriptorProto *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_ServiceDescriptorProto_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_ServiceDescriptorProto *google_protobuf_ServiceDescriptorProto_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_ServiceDescriptorProto *msg = google_protobuf_ServiceDescriptorProto_new(env);
@@ -713,33 +616,6 @@ google_protobuf_ServiceDescriptorProto *google_protobuf_ServiceDescriptorProto_p
 char *google_protobuf_ServiceDescriptorProto_serialize(google_protobuf_ServiceDescriptorProto *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_ServiceDescriptorProto_msginit, env, size);
 }
-upb_stringview google_protobuf_ServiceDescriptorProto_name(const google_protobuf_ServiceDescriptorProto *msg) {
-  return msg->name;
-}
-void google_protobuf_ServiceDescriptorProto_set_name(google_protobuf_ServiceDescriptorProto *msg, upb_stringview value) {
-  msg->name = value;
-}
-upb_array* google_protobuf_ServiceDescriptorProto_method(const google_protobuf_ServiceDescriptorProto *msg) {
-  return msg->method;
-}
-void google_protobuf_ServiceDescriptorProto_set_method(google_protobuf_ServiceDescriptorProto *msg, upb_array* value) {
-  msg->method = value;
-}
-google_protobuf_ServiceOptions* google_protobuf_ServiceDescriptorProto_options(const google_protobuf_ServiceDescriptorProto *msg) {
-  return msg->options;
-}
-void google_protobuf_ServiceDescriptorProto_set_options(google_protobuf_ServiceDescriptorProto *msg, google_protobuf_ServiceOptions* value) {
-  msg->options = value;
-}
-struct google_protobuf_MethodDescriptorProto {
-  bool client_streaming;
-  bool server_streaming;
-  upb_stringview name;
-  upb_stringview input_type;
-  upb_stringview output_type;
-  google_protobuf_MethodOptions* options;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_MethodDescriptorProto_submsgs[1] = {
   &google_protobuf_MethodOptions_msginit,
 };
@@ -753,18 +629,44 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_MethodDescriptorProto__f
   {6, offsetof(google_protobuf_MethodDescriptorProto, server_streaming), 1, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 8, 1},
 };
 
+static const uint16_t google_protobuf_MethodDescriptorProto__lookup[7] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+  2,
+  3,
+  4,
+  5,
+};
+
+static const uint16_t google_protobuf_MethodDescriptorProto__hasbit_fields[8] = {
+  4,
+  5,
+  0,
+  1,
+  2,
+  3,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_MethodDescriptorProto__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000000U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_MethodDescriptorProto_msginit = {
   &google_protobuf_MethodDescriptorProto_submsgs[0],
   &google_protobuf_MethodDescriptorProto__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_MethodDescriptorProto), 6, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_MethodDescriptorProto), 6, 0, false, true,
+  &google_protobuf_MethodDescriptorProto__lookup[0], 7,
+  &google_protobuf_MethodDescriptorProto__hasbit_fields[0], &google_protobuf_MethodDescriptorProto__check_fields[0], 1
 };
 
 google_protobuf_MethodDescriptorProto *google_protobuf_MethodDescriptorProto_new(upb_env *env) {
-  google_protobuf_MethodDescriptorProto *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_MethodDescriptorProto_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_MethodDescriptorProto *google_protobuf_MethodDescriptorProto_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_MethodDescriptorProto *msg = google_protobuf_MethodDescriptorProto_new(env);
@@ -777,63 +679,6 @@ google_protobuf_MethodDescriptorProto *google_protobuf_MethodDescriptorProto_par
 char *google_protobuf_MethodDescriptorProto_serialize(google_protobuf_MethodDescriptorProto *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_MethodDescriptorProto_msginit, env, size);
 }
-upb_stringview google_protobuf_MethodDescriptorProto_name(const google_protobuf_MethodDescriptorProto *msg) {
-  return msg->name;
-}
-void google_protobuf_MethodDescriptorProto_set_name(google_protobuf_MethodDescriptorProto *msg, upb_stringview value) {
-  msg->name = value;
-}
-upb_stringview google_protobuf_MethodDescriptorProto_input_type(const google_protobuf_MethodDescriptorProto *msg) {
-  return msg->input_type;
-}
-void google_protobuf_MethodDescriptorProto_set_input_type(google_protobuf_MethodDescriptorProto *msg, upb_stringview value) {
-  msg->input_type = value;
-}
-upb_stringview google_protobuf_MethodDescriptorProto_output_type(const google_protobuf_MethodDescriptorProto *msg) {
-  return msg->output_type;
-}
-void google_protobuf_MethodDescriptorProto_set_output_type(google_protobuf_MethodDescriptorProto *msg, upb_stringview value) {
-  msg->output_type = value;
-}
-google_protobuf_MethodOptions* google_protobuf_MethodDescriptorProto_options(const google_protobuf_MethodDescriptorProto *msg) {
-  return msg->options;
-}
-void google_protobuf_MethodDescriptorProto_set_options(google_protobuf_MethodDescriptorProto *msg, google_protobuf_MethodOptions* value) {
-  msg->options = value;
-}
-bool google_protobuf_MethodDescriptorProto_client_streaming(const google_protobuf_MethodDescriptorProto *msg) {
-  return msg->client_streaming;
-}
-void google_protobuf_MethodDescriptorProto_set_client_streaming(google_protobuf_MethodDescriptorProto *msg, bool value) {
-  msg->client_streaming = value;
-}
-bool google_protobuf_MethodDescriptorProto_server_streaming(const google_protobuf_MethodDescriptorProto *msg) {
-  return msg->server_streaming;
-}
-void google_protobuf_MethodDescriptorProto_set_server_streaming(google_protobuf_MethodDescriptorProto *msg, bool value) {
-  msg->server_streaming = value;
-}
-struct google_protobuf_FileOptions {
-  google_protobuf_FileOptions_OptimizeMode optimize_for;
-  bool java_multiple_files;
-  bool cc_generic_services;
-  bool java_generic_services;
-  bool py_generic_services;
-  bool java_generate_equals_and_hash;
-  bool deprecated;
-  bool java_string_check_utf8;
-  bool cc_enable_arenas;
-  bool javanano_use_deprecated_package;
-  upb_stringview java_package;
-  upb_stringview java_outer_classname;
-  upb_stringview go_package;
-  upb_stringview objc_class_prefix;
-  upb_stringview csharp_namespace;
-  upb_stringview php_class_prefix;
-  upb_stringview php_namespace;
-  upb_array* uninterpreted_option;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_FileOptions_submsgs[1] = {
   &google_protobuf_UninterpretedOption_msginit,
 };
@@ -859,18 +704,189 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_FileOptions__fields[18]
   {999, offsetof(google_protobuf_FileOptions, uninterpreted_option), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_FileOptions__lookup[136] = {
+  UPB_NO_FIELD,
+  0,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  1,
+  2,
+  3,
+  4,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  5,
+  6,
+  7,
+  UPB_NO_FIELD,
+  8,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  9,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  10,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  11,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  12,
+  13,
+  14,
+  UPB_NO_FIELD,
+  15,
+  16,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint16_t google_protobuf_FileOptions__hasbit_fields[24] = {
+  2,
+  3,
+  5,
+  6,
+  7,
+  8,
+  9,
+  10,
+  11,
+  14,
+  0,
+  1,
+  4,
+  12,
+  13,
+  15,
+  16,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_FileOptions__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00020000U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_FileOptions_msginit = {
   &google_protobuf_FileOptions_submsgs[0],
   &google_protobuf_FileOptions__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_FileOptions), 18, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_FileOptions), 18, 0, false, true,
+  &google_protobuf_FileOptions__lookup[0], 136,
+  &google_protobuf_FileOptions__hasbit_fields[0], &google_protobuf_FileOptions__check_fields[0], 3
 };
 
 google_protobuf_FileOptions *google_protobuf_FileOptions_new(upb_env *env) {
-  google_protobuf_FileOptions *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_FileOptions_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_FileOptions *google_protobuf_FileOptions_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_FileOptions *msg = google_protobuf_FileOptions_new(env);
@@ -883,122 +899,6 @@ google_protobuf_FileOptions *google_protobuf_FileOptions_parsenew(upb_stringview
 char *google_protobuf_FileOptions_serialize(google_protobuf_FileOptions *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_FileOptions_msginit, env, size);
 }
-upb_stringview google_protobuf_FileOptions_java_package(const google_protobuf_FileOptions *msg) {
-  return msg->java_package;
-}
-void google_protobuf_FileOptions_set_java_package(google_protobuf_FileOptions *msg, upb_stringview value) {
-  msg->java_package = value;
-}
-upb_stringview google_protobuf_FileOptions_java_outer_classname(const google_protobuf_FileOptions *msg) {
-  return msg->java_outer_classname;
-}
-void google_protobuf_FileOptions_set_java_outer_classname(google_protobuf_FileOptions *msg, upb_stringview value) {
-  msg->java_outer_classname = value;
-}
-google_protobuf_FileOptions_OptimizeMode google_protobuf_FileOptions_optimize_for(const google_protobuf_FileOptions *msg) {
-  return msg->optimize_for;
-}
-void google_protobuf_FileOptions_set_optimize_for(google_protobuf_FileOptions *msg, google_protobuf_FileOptions_OptimizeMode value) {
-  msg->optimize_for = value;
-}
-bool google_protobuf_FileOptions_java_multiple_files(const google_protobuf_FileOptions *msg) {
-  return msg->java_multiple_files;
-}
-void google_protobuf_FileOptions_set_java_multiple_files(google_protobuf_FileOptions *msg, bool value) {
-  msg->java_multiple_files = value;
-}
-upb_stringview google_protobuf_FileOptions_go_package(const google_protobuf_FileOptions *msg) {
-  return msg->go_package;
-}
-void google_protobuf_FileOptions_set_go_package(google_protobuf_FileOptions *msg, upb_stringview value) {
-  msg->go_package = value;
-}
-bool google_protobuf_FileOptions_cc_generic_services(const google_protobuf_FileOptions *msg) {
-  return msg->cc_generic_services;
-}
-void google_protobuf_FileOptions_set_cc_generic_services(google_protobuf_FileOptions *msg, bool value) {
-  msg->cc_generic_services = value;
-}
-bool google_protobuf_FileOptions_java_generic_services(const google_protobuf_FileOptions *msg) {
-  return msg->java_generic_services;
-}
-void google_protobuf_FileOptions_set_java_generic_services(google_protobuf_FileOptions *msg, bool value) {
-  msg->java_generic_services = value;
-}
-bool google_protobuf_FileOptions_py_generic_services(const google_protobuf_FileOptions *msg) {
-  return msg->py_generic_services;
-}
-void google_protobuf_FileOptions_set_py_generic_services(google_protobuf_FileOptions *msg, bool value) {
-  msg->py_generic_services = value;
-}
-bool google_protobuf_FileOptions_java_generate_equals_and_hash(const google_protobuf_FileOptions *msg) {
-  return msg->java_generate_equals_and_hash;
-}
-void google_protobuf_FileOptions_set_java_generate_equals_and_hash(google_protobuf_FileOptions *msg, bool value) {
-  msg->java_generate_equals_and_hash = value;
-}
-bool google_protobuf_FileOptions_deprecated(const google_protobuf_FileOptions *msg) {
-  return msg->deprecated;
-}
-void google_protobuf_FileOptions_set_deprecated(google_protobuf_FileOptions *msg, bool value) {
-  msg->deprecated = value;
-}
-bool google_protobuf_FileOptions_java_string_check_utf8(const google_protobuf_FileOptions *msg) {
-  return msg->java_string_check_utf8;
-}
-void google_protobuf_FileOptions_set_java_string_check_utf8(google_protobuf_FileOptions *msg, bool value) {
-  msg->java_string_check_utf8 = value;
-}
-bool google_protobuf_FileOptions_cc_enable_arenas(const google_protobuf_FileOptions *msg) {
-  return msg->cc_enable_arenas;
-}
-void google_protobuf_FileOptions_set_cc_enable_arenas(google_protobuf_FileOptions *msg, bool value) {
-  msg->cc_enable_arenas = value;
-}
-upb_stringview google_protobuf_FileOptions_objc_class_prefix(const google_protobuf_FileOptions *msg) {
-  return msg->objc_class_prefix;
-}
-void google_protobuf_FileOptions_set_objc_class_prefix(google_protobuf_FileOptions *msg, upb_stringview value) {
-  msg->objc_class_prefix = value;
-}
-upb_stringview google_protobuf_FileOptions_csharp_namespace(const google_protobuf_FileOptions *msg) {
-  return msg->csharp_namespace;
-}
-void google_protobuf_FileOptions_set_csharp_namespace(google_protobuf_FileOptions *msg, upb_stringview value) {
-  msg->csharp_namespace = value;
-}
-bool google_protobuf_FileOptions_javanano_use_deprecated_package(const google_protobuf_FileOptions *msg) {
-  return msg->javanano_use_deprecated_package;
-}
-void google_protobuf_FileOptions_set_javanano_use_deprecated_package(google_protobuf_FileOptions *msg, bool value) {
-  msg->javanano_use_deprecated_package = value;
-}
-upb_stringview google_protobuf_FileOptions_php_class_prefix(const google_protobuf_FileOptions *msg) {
-  return msg->php_class_prefix;
-}
-void google_protobuf_FileOptions_set_php_class_prefix(google_protobuf_FileOptions *msg, upb_stringview value) {
-  msg->php_class_prefix = value;
-}
-upb_stringview google_protobuf_FileOptions_php_namespace(const google_protobuf_FileOptions *msg) {
-  return msg->php_namespace;
-}
-void google_protobuf_FileOptions_set_php_namespace(google_protobuf_FileOptions *msg, upb_stringview value) {
-  msg->php_namespace = value;
-}
-upb_array* google_protobuf_FileOptions_uninterpreted_option(const google_protobuf_FileOptions *msg) {
-  return msg->uninterpreted_option;
-}
-void google_protobuf_FileOptions_set_uninterpreted_option(google_protobuf_FileOptions *msg, upb_array* value) {
-  msg->uninterpreted_option = value;
-}
-struct google_protobuf_MessageOptions {
-  bool message_set_wire_format;
-  bool no_standard_descriptor_accessor;
-  bool deprecated;
-  bool map_entry;
-  upb_array* uninterpreted_option;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_MessageOptions_submsgs[1] = {
   &google_protobuf_UninterpretedOption_msginit,
 };
@@ -1011,18 +911,121 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_MessageOptions__fields[5
   {999, offsetof(google_protobuf_MessageOptions, uninterpreted_option), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_MessageOptions__lookup[84] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+  2,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  3,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint16_t google_protobuf_MessageOptions__hasbit_fields[8] = {
+  0,
+  1,
+  2,
+  3,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_MessageOptions__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000010U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_MessageOptions_msginit = {
   &google_protobuf_MessageOptions_submsgs[0],
   &google_protobuf_MessageOptions__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_MessageOptions), 5, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_MessageOptions), 5, 0, false, true,
+  &google_protobuf_MessageOptions__lookup[0], 84,
+  &google_protobuf_MessageOptions__hasbit_fields[0], &google_protobuf_MessageOptions__check_fields[0], 1
 };
 
 google_protobuf_MessageOptions *google_protobuf_MessageOptions_new(upb_env *env) {
-  google_protobuf_MessageOptions *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_MessageOptions_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_MessageOptions *google_protobuf_MessageOptions_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_MessageOptions *msg = google_protobuf_MessageOptions_new(env);
@@ -1035,46 +1038,6 @@ google_protobuf_MessageOptions *google_protobuf_MessageOptions_parsenew(upb_stri
 char *google_protobuf_MessageOptions_serialize(google_protobuf_MessageOptions *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_MessageOptions_msginit, env, size);
 }
-bool google_protobuf_MessageOptions_message_set_wire_format(const google_protobuf_MessageOptions *msg) {
-  return msg->message_set_wire_format;
-}
-void google_protobuf_MessageOptions_set_message_set_wire_format(google_protobuf_MessageOptions *msg, bool value) {
-  msg->message_set_wire_format = value;
-}
-bool google_protobuf_MessageOptions_no_standard_descriptor_accessor(const google_protobuf_MessageOptions *msg) {
-  return msg->no_standard_descriptor_accessor;
-}
-void google_protobuf_MessageOptions_set_no_standard_descriptor_accessor(google_protobuf_MessageOptions *msg, bool value) {
-  msg->no_standard_descriptor_accessor = value;
-}
-bool google_protobuf_MessageOptions_deprecated(const google_protobuf_MessageOptions *msg) {
-  return msg->deprecated;
-}
-void google_protobuf_MessageOptions_set_deprecated(google_protobuf_MessageOptions *msg, bool value) {
-  msg->deprecated = value;
-}
-bool google_protobuf_MessageOptions_map_entry(const google_protobuf_MessageOptions *msg) {
-  return msg->map_entry;
-}
-void google_protobuf_MessageOptions_set_map_entry(google_protobuf_MessageOptions *msg, bool value) {
-  msg->map_entry = value;
-}
-upb_array* google_protobuf_MessageOptions_uninterpreted_option(const google_protobuf_MessageOptions *msg) {
-  return msg->uninterpreted_option;
-}
-void google_protobuf_MessageOptions_set_uninterpreted_option(google_protobuf_MessageOptions *msg, upb_array* value) {
-  msg->uninterpreted_option = value;
-}
-struct google_protobuf_FieldOptions {
-  google_protobuf_FieldOptions_CType ctype;
-  google_protobuf_FieldOptions_JSType jstype;
-  bool packed;
-  bool deprecated;
-  bool lazy;
-  bool weak;
-  upb_array* uninterpreted_option;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_FieldOptions_submsgs[1] = {
   &google_protobuf_UninterpretedOption_msginit,
 };
@@ -1089,18 +1052,129 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_FieldOptions__fields[7]
   {999, offsetof(google_protobuf_FieldOptions, uninterpreted_option), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_FieldOptions__lookup[92] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+  2,
+  UPB_NO_FIELD,
+  3,
+  4,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  5,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint16_t google_protobuf_FieldOptions__hasbit_fields[8] = {
+  0,
+  4,
+  1,
+  2,
+  3,
+  5,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_FieldOptions__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000040U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_FieldOptions_msginit = {
   &google_protobuf_FieldOptions_submsgs[0],
   &google_protobuf_FieldOptions__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_FieldOptions), 7, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_FieldOptions), 7, 0, false, true,
+  &google_protobuf_FieldOptions__lookup[0], 92,
+  &google_protobuf_FieldOptions__hasbit_fields[0], &google_protobuf_FieldOptions__check_fields[0], 1
 };
 
 google_protobuf_FieldOptions *google_protobuf_FieldOptions_new(upb_env *env) {
-  google_protobuf_FieldOptions *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_FieldOptions_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_FieldOptions *google_protobuf_FieldOptions_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_FieldOptions *msg = google_protobuf_FieldOptions_new(env);
@@ -1113,54 +1187,6 @@ google_protobuf_FieldOptions *google_protobuf_FieldOptions_parsenew(upb_stringvi
 char *google_protobuf_FieldOptions_serialize(google_protobuf_FieldOptions *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_FieldOptions_msginit, env, size);
 }
-google_protobuf_FieldOptions_CType google_protobuf_FieldOptions_ctype(const google_protobuf_FieldOptions *msg) {
-  return msg->ctype;
-}
-void google_protobuf_FieldOptions_set_ctype(google_protobuf_FieldOptions *msg, google_protobuf_FieldOptions_CType value) {
-  msg->ctype = value;
-}
-bool google_protobuf_FieldOptions_packed(const google_protobuf_FieldOptions *msg) {
-  return msg->packed;
-}
-void google_protobuf_FieldOptions_set_packed(google_protobuf_FieldOptions *msg, bool value) {
-  msg->packed = value;
-}
-bool google_protobuf_FieldOptions_deprecated(const google_protobuf_FieldOptions *msg) {
-  return msg->deprecated;
-}
-void google_protobuf_FieldOptions_set_deprecated(google_protobuf_FieldOptions *msg, bool value) {
-  msg->deprecated = value;
-}
-bool google_protobuf_FieldOptions_lazy(const google_protobuf_FieldOptions *msg) {
-  return msg->lazy;
-}
-void google_protobuf_FieldOptions_set_lazy(google_protobuf_FieldOptions *msg, bool value) {
-  msg->lazy = value;
-}
-google_protobuf_FieldOptions_JSType google_protobuf_FieldOptions_jstype(const google_protobuf_FieldOptions *msg) {
-  return msg->jstype;
-}
-void google_protobuf_FieldOptions_set_jstype(google_protobuf_FieldOptions *msg, google_protobuf_FieldOptions_JSType value) {
-  msg->jstype = value;
-}
-bool google_protobuf_FieldOptions_weak(const google_protobuf_FieldOptions *msg) {
-  return msg->weak;
-}
-void google_protobuf_FieldOptions_set_weak(google_protobuf_FieldOptions *msg, bool value) {
-  msg->weak = value;
-}
-upb_array* google_protobuf_FieldOptions_uninterpreted_option(const google_protobuf_FieldOptions *msg) {
-  return msg->uninterpreted_option;
-}
-void google_protobuf_FieldOptions_set_uninterpreted_option(google_protobuf_FieldOptions *msg, upb_array* value) {
-  msg->uninterpreted_option = value;
-}
-struct google_protobuf_EnumOptions {
-  bool allow_alias;
-  bool deprecated;
-  upb_array* uninterpreted_option;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_EnumOptions_submsgs[1] = {
   &google_protobuf_UninterpretedOption_msginit,
 };
@@ -1171,18 +1197,113 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_EnumOptions__fields[3] =
   {999, offsetof(google_protobuf_EnumOptions, uninterpreted_option), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_EnumOptions__lookup[76] = {
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  0,
+  1,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint16_t google_protobuf_EnumOptions__hasbit_fields[8] = {
+  0,
+  1,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_EnumOptions__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000004U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_EnumOptions_msginit = {
   &google_protobuf_EnumOptions_submsgs[0],
   &google_protobuf_EnumOptions__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_EnumOptions), 3, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_EnumOptions), 3, 0, false, true,
+  &google_protobuf_EnumOptions__lookup[0], 76,
+  &google_protobuf_EnumOptions__hasbit_fields[0], &google_protobuf_EnumOptions__check_fields[0], 1
 };
 
 google_protobuf_EnumOptions *google_protobuf_EnumOptions_new(upb_env *env) {
-  google_protobuf_EnumOptions *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_EnumOptions_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_EnumOptions *google_protobuf_EnumOptions_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_EnumOptions *msg = google_protobuf_EnumOptions_new(env);
@@ -1195,29 +1316,6 @@ google_protobuf_EnumOptions *google_protobuf_EnumOptions_parsenew(upb_stringview
 char *google_protobuf_EnumOptions_serialize(google_protobuf_EnumOptions *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_EnumOptions_msginit, env, size);
 }
-bool google_protobuf_EnumOptions_allow_alias(const google_protobuf_EnumOptions *msg) {
-  return msg->allow_alias;
-}
-void google_protobuf_EnumOptions_set_allow_alias(google_protobuf_EnumOptions *msg, bool value) {
-  msg->allow_alias = value;
-}
-bool google_protobuf_EnumOptions_deprecated(const google_protobuf_EnumOptions *msg) {
-  return msg->deprecated;
-}
-void google_protobuf_EnumOptions_set_deprecated(google_protobuf_EnumOptions *msg, bool value) {
-  msg->deprecated = value;
-}
-upb_array* google_protobuf_EnumOptions_uninterpreted_option(const google_protobuf_EnumOptions *msg) {
-  return msg->uninterpreted_option;
-}
-void google_protobuf_EnumOptions_set_uninterpreted_option(google_protobuf_EnumOptions *msg, upb_array* value) {
-  msg->uninterpreted_option = value;
-}
-struct google_protobuf_EnumValueOptions {
-  bool deprecated;
-  upb_array* uninterpreted_option;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_EnumValueOptions_submsgs[1] = {
   &google_protobuf_UninterpretedOption_msginit,
 };
@@ -1227,18 +1325,109 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_EnumValueOptions__fields
   {999, offsetof(google_protobuf_EnumValueOptions, uninterpreted_option), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_EnumValueOptions__lookup[72] = {
+  UPB_NO_FIELD,
+  0,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint16_t google_protobuf_EnumValueOptions__hasbit_fields[8] = {
+  0,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_EnumValueOptions__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000002U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_EnumValueOptions_msginit = {
   &google_protobuf_EnumValueOptions_submsgs[0],
   &google_protobuf_EnumValueOptions__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_EnumValueOptions), 2, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_EnumValueOptions), 2, 0, false, true,
+  &google_protobuf_EnumValueOptions__lookup[0], 72,
+  &google_protobuf_EnumValueOptions__hasbit_fields[0], &google_protobuf_EnumValueOptions__check_fields[0], 1
 };
 
 google_protobuf_EnumValueOptions *google_protobuf_EnumValueOptions_new(upb_env *env) {
-  google_protobuf_EnumValueOptions *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_EnumValueOptions_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_EnumValueOptions *google_protobuf_EnumValueOptions_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_EnumValueOptions *msg = google_protobuf_EnumValueOptions_new(env);
@@ -1251,23 +1440,6 @@ google_protobuf_EnumValueOptions *google_protobuf_EnumValueOptions_parsenew(upb_
 char *google_protobuf_EnumValueOptions_serialize(google_protobuf_EnumValueOptions *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_EnumValueOptions_msginit, env, size);
 }
-bool google_protobuf_EnumValueOptions_deprecated(const google_protobuf_EnumValueOptions *msg) {
-  return msg->deprecated;
-}
-void google_protobuf_EnumValueOptions_set_deprecated(google_protobuf_EnumValueOptions *msg, bool value) {
-  msg->deprecated = value;
-}
-upb_array* google_protobuf_EnumValueOptions_uninterpreted_option(const google_protobuf_EnumValueOptions *msg) {
-  return msg->uninterpreted_option;
-}
-void google_protobuf_EnumValueOptions_set_uninterpreted_option(google_protobuf_EnumValueOptions *msg, upb_array* value) {
-  msg->uninterpreted_option = value;
-}
-struct google_protobuf_ServiceOptions {
-  bool deprecated;
-  upb_array* uninterpreted_option;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_ServiceOptions_submsgs[1] = {
   &google_protobuf_UninterpretedOption_msginit,
 };
@@ -1277,18 +1449,109 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_ServiceOptions__fields[2
   {999, offsetof(google_protobuf_ServiceOptions, uninterpreted_option), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_ServiceOptions__lookup[72] = {
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  0,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint16_t google_protobuf_ServiceOptions__hasbit_fields[8] = {
+  0,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_ServiceOptions__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000002U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_ServiceOptions_msginit = {
   &google_protobuf_ServiceOptions_submsgs[0],
   &google_protobuf_ServiceOptions__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_ServiceOptions), 2, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_ServiceOptions), 2, 0, false, true,
+  &google_protobuf_ServiceOptions__lookup[0], 72,
+  &google_protobuf_ServiceOptions__hasbit_fields[0], &google_protobuf_ServiceOptions__check_fields[0], 1
 };
 
 google_protobuf_ServiceOptions *google_protobuf_ServiceOptions_new(upb_env *env) {
-  google_protobuf_ServiceOptions *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_ServiceOptions_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_ServiceOptions *google_protobuf_ServiceOptions_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_ServiceOptions *msg = google_protobuf_ServiceOptions_new(env);
@@ -1301,23 +1564,6 @@ google_protobuf_ServiceOptions *google_protobuf_ServiceOptions_parsenew(upb_stri
 char *google_protobuf_ServiceOptions_serialize(google_protobuf_ServiceOptions *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_ServiceOptions_msginit, env, size);
 }
-bool google_protobuf_ServiceOptions_deprecated(const google_protobuf_ServiceOptions *msg) {
-  return msg->deprecated;
-}
-void google_protobuf_ServiceOptions_set_deprecated(google_protobuf_ServiceOptions *msg, bool value) {
-  msg->deprecated = value;
-}
-upb_array* google_protobuf_ServiceOptions_uninterpreted_option(const google_protobuf_ServiceOptions *msg) {
-  return msg->uninterpreted_option;
-}
-void google_protobuf_ServiceOptions_set_uninterpreted_option(google_protobuf_ServiceOptions *msg, upb_array* value) {
-  msg->uninterpreted_option = value;
-}
-struct google_protobuf_MethodOptions {
-  bool deprecated;
-  upb_array* uninterpreted_option;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_MethodOptions_submsgs[1] = {
   &google_protobuf_UninterpretedOption_msginit,
 };
@@ -1327,18 +1573,109 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_MethodOptions__fields[2]
   {999, offsetof(google_protobuf_MethodOptions, uninterpreted_option), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_MethodOptions__lookup[72] = {
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  0,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint16_t google_protobuf_MethodOptions__hasbit_fields[8] = {
+  0,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_MethodOptions__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000002U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_MethodOptions_msginit = {
   &google_protobuf_MethodOptions_submsgs[0],
   &google_protobuf_MethodOptions__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_MethodOptions), 2, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_MethodOptions), 2, 0, false, true,
+  &google_protobuf_MethodOptions__lookup[0], 72,
+  &google_protobuf_MethodOptions__hasbit_fields[0], &google_protobuf_MethodOptions__check_fields[0], 1
 };
 
 google_protobuf_MethodOptions *google_protobuf_MethodOptions_new(upb_env *env) {
-  google_protobuf_MethodOptions *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_MethodOptions_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_MethodOptions *google_protobuf_MethodOptions_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_MethodOptions *msg = google_protobuf_MethodOptions_new(env);
@@ -1351,28 +1688,6 @@ google_protobuf_MethodOptions *google_protobuf_MethodOptions_parsenew(upb_string
 char *google_protobuf_MethodOptions_serialize(google_protobuf_MethodOptions *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_MethodOptions_msginit, env, size);
 }
-bool google_protobuf_MethodOptions_deprecated(const google_protobuf_MethodOptions *msg) {
-  return msg->deprecated;
-}
-void google_protobuf_MethodOptions_set_deprecated(google_protobuf_MethodOptions *msg, bool value) {
-  msg->deprecated = value;
-}
-upb_array* google_protobuf_MethodOptions_uninterpreted_option(const google_protobuf_MethodOptions *msg) {
-  return msg->uninterpreted_option;
-}
-void google_protobuf_MethodOptions_set_uninterpreted_option(google_protobuf_MethodOptions *msg, upb_array* value) {
-  msg->uninterpreted_option = value;
-}
-struct google_protobuf_UninterpretedOption {
-  uint64_t positive_int_value;
-  int64_t negative_int_value;
-  double double_value;
-  upb_stringview identifier_value;
-  upb_stringview string_value;
-  upb_stringview aggregate_value;
-  upb_array* name;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_UninterpretedOption_submsgs[1] = {
   &google_protobuf_UninterpretedOption_NamePart_msginit,
 };
@@ -1387,18 +1702,46 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_UninterpretedOption__fie
   {8, offsetof(google_protobuf_UninterpretedOption, aggregate_value), 5, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 9, 1},
 };
 
+static const uint16_t google_protobuf_UninterpretedOption__lookup[9] = {
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  0,
+  1,
+  2,
+  3,
+  4,
+  5,
+  6,
+};
+
+static const uint16_t google_protobuf_UninterpretedOption__hasbit_fields[8] = {
+  2,
+  3,
+  4,
+  1,
+  5,
+  6,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_UninterpretedOption__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000001U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_UninterpretedOption_msginit = {
   &google_protobuf_UninterpretedOption_submsgs[0],
   &google_protobuf_UninterpretedOption__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_UninterpretedOption), 7, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_UninterpretedOption), 7, 0, false, true,
+  &google_protobuf_UninterpretedOption__lookup[0], 9,
+  &google_protobuf_UninterpretedOption__hasbit_fields[0], &google_protobuf_UninterpretedOption__check_fields[0], 1
 };
 
 google_protobuf_UninterpretedOption *google_protobuf_UninterpretedOption_new(upb_env *env) {
-  google_protobuf_UninterpretedOption *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_UninterpretedOption_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_UninterpretedOption *google_protobuf_UninterpretedOption_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_UninterpretedOption *msg = google_protobuf_UninterpretedOption_new(env);
@@ -1411,70 +1754,45 @@ google_protobuf_UninterpretedOption *google_protobuf_UninterpretedOption_parsene
 char *google_protobuf_UninterpretedOption_serialize(google_protobuf_UninterpretedOption *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_UninterpretedOption_msginit, env, size);
 }
-upb_array* google_protobuf_UninterpretedOption_name(const google_protobuf_UninterpretedOption *msg) {
-  return msg->name;
-}
-void google_protobuf_UninterpretedOption_set_name(google_protobuf_UninterpretedOption *msg, upb_array* value) {
-  msg->name = value;
-}
-upb_stringview google_protobuf_UninterpretedOption_identifier_value(const google_protobuf_UninterpretedOption *msg) {
-  return msg->identifier_value;
-}
-void google_protobuf_UninterpretedOption_set_identifier_value(google_protobuf_UninterpretedOption *msg, upb_stringview value) {
-  msg->identifier_value = value;
-}
-uint64_t google_protobuf_UninterpretedOption_positive_int_value(const google_protobuf_UninterpretedOption *msg) {
-  return msg->positive_int_value;
-}
-void google_protobuf_UninterpretedOption_set_positive_int_value(google_protobuf_UninterpretedOption *msg, uint64_t value) {
-  msg->positive_int_value = value;
-}
-int64_t google_protobuf_UninterpretedOption_negative_int_value(const google_protobuf_UninterpretedOption *msg) {
-  return msg->negative_int_value;
-}
-void google_protobuf_UninterpretedOption_set_negative_int_value(google_protobuf_UninterpretedOption *msg, int64_t value) {
-  msg->negative_int_value = value;
-}
-double google_protobuf_UninterpretedOption_double_value(const google_protobuf_UninterpretedOption *msg) {
-  return msg->double_value;
-}
-void google_protobuf_UninterpretedOption_set_double_value(google_protobuf_UninterpretedOption *msg, double value) {
-  msg->double_value = value;
-}
-upb_stringview google_protobuf_UninterpretedOption_string_value(const google_protobuf_UninterpretedOption *msg) {
-  return msg->string_value;
-}
-void google_protobuf_UninterpretedOption_set_string_value(google_protobuf_UninterpretedOption *msg, upb_stringview value) {
-  msg->string_value = value;
-}
-upb_stringview google_protobuf_UninterpretedOption_aggregate_value(const google_protobuf_UninterpretedOption *msg) {
-  return msg->aggregate_value;
-}
-void google_protobuf_UninterpretedOption_set_aggregate_value(google_protobuf_UninterpretedOption *msg, upb_stringview value) {
-  msg->aggregate_value = value;
-}
-struct google_protobuf_UninterpretedOption_NamePart {
-  bool is_extension;
-  upb_stringview name_part;
-};
-
 static const upb_msglayout_fieldinit_v1 google_protobuf_UninterpretedOption_NamePart__fields[2] = {
   {1, offsetof(google_protobuf_UninterpretedOption_NamePart, name_part), 1, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 9, 2},
   {2, offsetof(google_protobuf_UninterpretedOption_NamePart, is_extension), 0, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 8, 2},
 };
 
+static const uint16_t google_protobuf_UninterpretedOption_NamePart__lookup[3] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+};
+
+static const uint16_t google_protobuf_UninterpretedOption_NamePart__hasbit_fields[8] = {
+  1,
+  0,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_UninterpretedOption_NamePart__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000000U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_UninterpretedOption_NamePart_msginit = {
   NULL,
   &google_protobuf_UninterpretedOption_NamePart__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_UninterpretedOption_NamePart), 2, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_UninterpretedOption_NamePart), 2, 0, false, true,
+  &google_protobuf_UninterpretedOption_NamePart__lookup[0], 3,
+  &google_protobuf_UninterpretedOption_NamePart__hasbit_fields[0], &google_protobuf_UninterpretedOption_NamePart__check_fields[0], 1
 };
 
 google_protobuf_UninterpretedOption_NamePart *google_protobuf_UninterpretedOption_NamePart_new(upb_env *env) {
-  google_protobuf_UninterpretedOption_NamePart *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_UninterpretedOption_NamePart_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_UninterpretedOption_NamePart *google_protobuf_UninterpretedOption_NamePart_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_UninterpretedOption_NamePart *msg = google_protobuf_UninterpretedOption_NamePart_new(env);
@@ -1487,22 +1805,6 @@ google_protobuf_UninterpretedOption_NamePart *google_protobuf_UninterpretedOptio
 char *google_protobuf_UninterpretedOption_NamePart_serialize(google_protobuf_UninterpretedOption_NamePart *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_UninterpretedOption_NamePart_msginit, env, size);
 }
-upb_stringview google_protobuf_UninterpretedOption_NamePart_name_part(const google_protobuf_UninterpretedOption_NamePart *msg) {
-  return msg->name_part;
-}
-void google_protobuf_UninterpretedOption_NamePart_set_name_part(google_protobuf_UninterpretedOption_NamePart *msg, upb_stringview value) {
-  msg->name_part = value;
-}
-bool google_protobuf_UninterpretedOption_NamePart_is_extension(const google_protobuf_UninterpretedOption_NamePart *msg) {
-  return msg->is_extension;
-}
-void google_protobuf_UninterpretedOption_NamePart_set_is_extension(google_protobuf_UninterpretedOption_NamePart *msg, bool value) {
-  msg->is_extension = value;
-}
-struct google_protobuf_SourceCodeInfo {
-  upb_array* location;
-};
-
 static const upb_msglayout_msginit_v1 *const google_protobuf_SourceCodeInfo_submsgs[1] = {
   &google_protobuf_SourceCodeInfo_Location_msginit,
 };
@@ -1511,18 +1813,28 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_SourceCodeInfo__fields[1
   {1, offsetof(google_protobuf_SourceCodeInfo, location), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, 0, 11, 3},
 };
 
+static const uint16_t google_protobuf_SourceCodeInfo__lookup[2] = {
+  UPB_NO_FIELD,
+  0,
+};
+
+static const uint64_t google_protobuf_SourceCodeInfo__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000001U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_SourceCodeInfo_msginit = {
   &google_protobuf_SourceCodeInfo_submsgs[0],
   &google_protobuf_SourceCodeInfo__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_SourceCodeInfo), 1, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_SourceCodeInfo), 1, 0, false, true,
+  &google_protobuf_SourceCodeInfo__lookup[0], 2,
+  NULL, &google_protobuf_SourceCodeInfo__check_fields[0], 0
 };
 
 google_protobuf_SourceCodeInfo *google_protobuf_SourceCodeInfo_new(upb_env *env) {
-  google_protobuf_SourceCodeInfo *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_SourceCodeInfo_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_SourceCodeInfo *google_protobuf_SourceCodeInfo_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_SourceCodeInfo *msg = google_protobuf_SourceCodeInfo_new(env);
@@ -1535,20 +1847,6 @@ google_protobuf_SourceCodeInfo *google_protobuf_SourceCodeInfo_parsenew(upb_stri
 char *google_protobuf_SourceCodeInfo_serialize(google_protobuf_SourceCodeInfo *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_SourceCodeInfo_msginit, env, size);
 }
-upb_array* google_protobuf_SourceCodeInfo_location(const google_protobuf_SourceCodeInfo *msg) {
-  return msg->location;
-}
-void google_protobuf_SourceCodeInfo_set_location(google_protobuf_SourceCodeInfo *msg, upb_array* value) {
-  msg->location = value;
-}
-struct google_protobuf_SourceCodeInfo_Location {
-  upb_stringview leading_comments;
-  upb_stringview trailing_comments;
-  upb_array* path;
-  upb_array* span;
-  upb_array* leading_detached_comments;
-};
-
 static const upb_msglayout_fieldinit_v1 google_protobuf_SourceCodeInfo_Location__fields[5] = {
   {1, offsetof(google_protobuf_SourceCodeInfo_Location, path), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 5, 3},
   {2, offsetof(google_protobuf_SourceCodeInfo_Location, span), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 5, 3},
@@ -1557,18 +1855,44 @@ static const upb_msglayout_fieldinit_v1 google_protobuf_SourceCodeInfo_Location_
   {6, offsetof(google_protobuf_SourceCodeInfo_Location, leading_detached_comments), UPB_NO_HASBIT, UPB_NOT_IN_ONEOF, UPB_NO_SUBMSG, 9, 3},
 };
 
+static const uint16_t google_protobuf_SourceCodeInfo_Location__lookup[7] = {
+  UPB_NO_FIELD,
+  0,
+  1,
+  2,
+  3,
+  UPB_NO_FIELD,
+  4,
+};
+
+static const uint16_t google_protobuf_SourceCodeInfo_Location__hasbit_fields[8] = {
+  2,
+  3,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+  UPB_NO_FIELD,
+};
+
+static const uint64_t google_protobuf_SourceCodeInfo_Location__check_fields[1] = {
+  ((uint64_t)0x00000000U << 32) | 0x00000013U,
+};
+
 const upb_msglayout_msginit_v1 google_protobuf_SourceCodeInfo_Location_msginit = {
   NULL,
   &google_protobuf_SourceCodeInfo_Location__fields[0],
   NULL,
   NULL, /* TODO. default_msg */
-  UPB_ALIGNED_SIZEOF(google_protobuf_SourceCodeInfo_Location), 5, 0, false, true
+  UPB_ALIGNED_SIZEOF(google_protobuf_SourceCodeInfo_Location), 5, 0, false, true,
+  &google_protobuf_SourceCodeInfo_Location__lookup[0], 7,
+  &google_protobuf_SourceCodeInfo_Location__hasbit_fields[0], &google_protobuf_SourceCodeInfo_Location__check_fields[0], 1
 };
 
 google_protobuf_SourceCodeInfo_Location *google_protobuf_SourceCodeInfo_Location_new(upb_env *env) {
-  google_protobuf_SourceCodeInfo_Location *msg = upb_env_malloc(env, sizeof(*msg));
-  memset(msg, 0, sizeof(*msg));  /* TODO: defaults */
-  return msg;
+  return upb_msg_new((const upb_msglayout*)&google_protobuf_SourceCodeInfo_Location_msginit,
+                     upb_arena_alloc(upb_env_arena(env)));
 }
 google_protobuf_SourceCodeInfo_Location *google_protobuf_SourceCodeInfo_Location_parsenew(upb_stringview buf, upb_env *env) {
   google_protobuf_SourceCodeInfo_Location *msg = google_protobuf_SourceCodeInfo_Location_new(env);
@@ -1581,33 +1905,3 @@ google_protobuf_SourceCodeInfo_Location *google_protobuf_SourceCodeInfo_Location
 char *google_protobuf_SourceCodeInfo_Location_serialize(google_protobuf_SourceCodeInfo_Location *msg, upb_env *env, size_t *size) {
   return upb_encode(msg, &google_protobuf_SourceCodeInfo_Location_msginit, env, size);
 }
-upb_array* google_protobuf_SourceCodeInfo_Location_path(const google_protobuf_SourceCodeInfo_Location *msg) {
-  return msg->path;
-}
-void google_protobuf_SourceCodeInfo_Location_set_path(google_protobuf_SourceCodeInfo_Location *msg, upb_array* value) {
-  msg->path = value;
-}
-upb_array* google_protobuf_SourceCodeInfo_Location_span(const google_protobuf_SourceCodeInfo_Location *msg) {
-  return msg->span;
-}
-void google_protobuf_SourceCodeInfo_Location_set_span(google_protobuf_SourceCodeInfo_Location *msg, upb_array* value) {
-  msg->span = value;
-}
-upb_stringview google_protobuf_SourceCodeInfo_Location_leading_comments(const google_protobuf_SourceCodeInfo_Location *msg) {
-  return msg->leading_comments;
-}
-void google_protobuf_SourceCodeInfo_Location_set_leading_comments(google_protobuf_SourceCodeInfo_Location *msg, upb_stringview value) {
-  msg->leading_comments = value;
-}
-upb_stringview google_protobuf_SourceCodeInfo_Location_trailing_comments(const google_protobuf_SourceCodeInfo_Location *msg) {
-  return msg->trailing_comments;
-}
-void google_protobuf_SourceCodeInfo_Location_set_trailing_comments(google_protobuf_SourceCodeInfo_Location *msg, upb_stringview value) {
-  msg->trailing_comments = value;
-}
-upb_array* google_protobuf_SourceCodeInfo_Location_leading_detached_comments(const google_protobuf_SourceCodeInfo_Location *msg) {
-  return msg->leading_detached_comments;
-}
-void google_protobuf_SourceCodeInfo_Location_set_leading_detached_comments(google_protobuf_SourceCodeInfo_Location *msg, upb_array* value) {
-  msg->leading_detached_comments = value;
-}
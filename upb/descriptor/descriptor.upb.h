@@ -105,6 +105,10 @@ typedef enum {
 } google_protobuf_FileOptions_OptimizeMode;
 
 /* google_protobuf_FileDescriptorSet message definition. */
+struct google_protobuf_FileDescriptorSet {
+  upb_array* file;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_FileDescriptorSet_msginit;
 google_protobuf_FileDescriptorSet *google_protobuf_FileDescriptorSet_new(upb_env *env);
 google_protobuf_FileDescriptorSet *google_protobuf_FileDescriptorSet_parsenew(upb_stringview buf, upb_env *env);
@@ -112,11 +116,33 @@ char *google_protobuf_FileDescriptorSet_serialize(google_protobuf_FileDescriptor
 void google_protobuf_FileDescriptorSet_free(google_protobuf_FileDescriptorSet *msg, upb_env *env);
 
 /* google_protobuf_FileDescriptorSet getters. */
+UPB_INLINE upb_array* google_protobuf_FileDescriptorSet_file(const google_protobuf_FileDescriptorSet *msg) {
+  return msg->file;
+}
 
 /* google_protobuf_FileDescriptorSet setters. */
+UPB_INLINE void google_protobuf_FileDescriptorSet_set_file(google_protobuf_FileDescriptorSet *msg, upb_array* value) {
+  msg->file = value;
+}
 
 
 /* google_protobuf_FileDescriptorProto message definition. */
+struct google_protobuf_FileDescriptorProto {
+  uint8_t _hasbits[1];
+  upb_stringview name;
+  upb_stringview package;
+  upb_stringview syntax;
+  google_protobuf_FileOptions* options;
+  google_protobuf_SourceCodeInfo* source_code_info;
+  upb_array* dependency;
+  upb_array* message_type;
+  upb_array* enum_type;
+  upb_array* service;
+  upb_array* extension;
+  upb_array* public_dependency;
+  upb_array* weak_dependency;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_FileDescriptorProto_msginit;
 google_protobuf_FileDescriptorProto *google_protobuf_FileDescriptorProto_new(upb_env *env);
 google_protobuf_FileDescriptorProto *google_protobuf_FileDescriptorProto_parsenew(upb_stringview buf, upb_env *env);
@@ -124,21 +150,117 @@ char *google_protobuf_FileDescriptorProto_serialize(google_protobuf_FileDescript
 void google_protobuf_FileDescriptorProto_free(google_protobuf_FileDescriptorProto *msg, upb_env *env);
 
 /* google_protobuf_FileDescriptorProto getters. */
-upb_stringview google_protobuf_FileDescriptorProto_name(const google_protobuf_FileDescriptorProto *msg);
-upb_stringview google_protobuf_FileDescriptorProto_package(const google_protobuf_FileDescriptorProto *msg);
-google_protobuf_FileOptions* google_protobuf_FileDescriptorProto_options(const google_protobuf_FileDescriptorProto *msg);
-google_protobuf_SourceCodeInfo* google_protobuf_FileDescriptorProto_source_code_info(const google_protobuf_FileDescriptorProto *msg);
-upb_stringview google_protobuf_FileDescriptorProto_syntax(const google_protobuf_FileDescriptorProto *msg);
+UPB_INLINE upb_stringview google_protobuf_FileDescriptorProto_name(const google_protobuf_FileDescriptorProto *msg) {
+  return msg->name;
+}
+UPB_INLINE bool google_protobuf_FileDescriptorProto_has_name(const google_protobuf_FileDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_FileDescriptorProto_package(const google_protobuf_FileDescriptorProto *msg) {
+  return msg->package;
+}
+UPB_INLINE bool google_protobuf_FileDescriptorProto_has_package(const google_protobuf_FileDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_FileDescriptorProto_dependency(const google_protobuf_FileDescriptorProto *msg) {
+  return msg->dependency;
+}
+UPB_INLINE upb_array* google_protobuf_FileDescriptorProto_message_type(const google_protobuf_FileDescriptorProto *msg) {
+  return msg->message_type;
+}
+UPB_INLINE upb_array* google_protobuf_FileDescriptorProto_enum_type(const google_protobuf_FileDescriptorProto *msg) {
+  return msg->enum_type;
+}
+UPB_INLINE upb_array* google_protobuf_FileDescriptorProto_service(const google_protobuf_FileDescriptorProto *msg) {
+  return msg->service;
+}
+UPB_INLINE upb_array* google_protobuf_FileDescriptorProto_extension(const google_protobuf_FileDescriptorProto *msg) {
+  return msg->extension;
+}
+UPB_INLINE google_protobuf_FileOptions* google_protobuf_FileDescriptorProto_options(const google_protobuf_FileDescriptorProto *msg) {
+  return msg->options;
+}
+UPB_INLINE bool google_protobuf_FileDescriptorProto_has_options(const google_protobuf_FileDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x08) != 0;
+}
+UPB_INLINE google_protobuf_SourceCodeInfo* google_protobuf_FileDescriptorProto_source_code_info(const google_protobuf_FileDescriptorProto *msg) {
+  return msg->source_code_info;
+}
+UPB_INLINE bool google_protobuf_FileDescriptorProto_has_source_code_info(const google_protobuf_FileDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x10) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_FileDescriptorProto_public_dependency(const google_protobuf_FileDescriptorProto *msg) {
+  return msg->public_dependency;
+}
+UPB_INLINE upb_array* google_protobuf_FileDescriptorProto_weak_dependency(const google_protobuf_FileDescriptorProto *msg) {
+  return msg->weak_dependency;
+}
+UPB_INLINE upb_stringview google_protobuf_FileDescriptorProto_syntax(const google_protobuf_FileDescriptorProto *msg) {
+  return msg->syntax;
+}
+UPB_INLINE bool google_protobuf_FileDescriptorProto_has_syntax(const google_protobuf_FileDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x04) != 0;
+}
 
 /* google_protobuf_FileDescriptorProto setters. */
-void google_protobuf_FileDescriptorProto_set_name(google_protobuf_FileDescriptorProto *msg, upb_stringview value);
-void google_protobuf_FileDescriptorProto_set_package(google_protobuf_FileDescriptorProto *msg, upb_stringview value);
-void google_protobuf_FileDescriptorProto_set_options(google_protobuf_FileDescriptorProto *msg, google_protobuf_FileOptions* value);
-void google_protobuf_FileDescriptorProto_set_source_code_info(google_protobuf_FileDescriptorProto *msg, google_protobuf_SourceCodeInfo* value);
-void google_protobuf_FileDescriptorProto_set_syntax(google_protobuf_FileDescriptorProto *msg, upb_stringview value);
+UPB_INLINE void google_protobuf_FileDescriptorProto_set_name(google_protobuf_FileDescriptorProto *msg, upb_stringview value) {
+  msg->name = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_FileDescriptorProto_set_package(google_protobuf_FileDescriptorProto *msg, upb_stringview value) {
+  msg->package = value;
+  msg->_hasbits[0] |= 0x02;
+}
+UPB_INLINE void google_protobuf_FileDescriptorProto_set_dependency(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
+  msg->dependency = value;
+}
+UPB_INLINE void google_protobuf_FileDescriptorProto_set_message_type(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
+  msg->message_type = value;
+}
+UPB_INLINE void google_protobuf_FileDescriptorProto_set_enum_type(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
+  msg->enum_type = value;
+}
+UPB_INLINE void google_protobuf_FileDescriptorProto_set_service(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
+  msg->service = value;
+}
+UPB_INLINE void google_protobuf_FileDescriptorProto_set_extension(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
+  msg->extension = value;
+}
+UPB_INLINE void google_protobuf_FileDescriptorProto_set_options(google_protobuf_FileDescriptorProto *msg, google_protobuf_FileOptions* value) {
+  msg->options = value;
+  msg->_hasbits[0] |= 0x08;
+}
+UPB_INLINE void google_protobuf_FileDescriptorProto_set_source_code_info(google_protobuf_FileDescriptorProto *msg, google_protobuf_SourceCodeInfo* value) {
+  msg->source_code_info = value;
+  msg->_hasbits[0] |= 0x10;
+}
+UPB_INLINE void google_protobuf_FileDescriptorProto_set_public_dependency(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
+  msg->public_dependency = value;
+}
+UPB_INLINE void google_protobuf_FileDescriptorProto_set_weak_dependency(google_protobuf_FileDescriptorProto *msg, upb_array* value) {
+  msg->weak_dependency = value;
+}
+UPB_INLINE void google_protobuf_FileDescriptorProto_set_syntax(google_protobuf_FileDescriptorProto *msg, upb_stringview value) {
+  msg->syntax = value;
+  msg->_hasbits[0] |= 0x04;
+}
 
 
 /* google_protobuf_DescriptorProto message definition. */
+struct google_protobuf_DescriptorProto {
+  uint8_t _hasbits[1];
+  upb_stringview name;
+  google_protobuf_MessageOptions* options;
+  upb_array* field;
+  upb_array* nested_type;
+  upb_array* enum_type;
+  upb_array* extension_range;
+  upb_array* extension;
+  upb_array* oneof_decl;
+  upb_array* reserved_range;
+  upb_array* reserved_name;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_DescriptorProto_msginit;
 google_protobuf_DescriptorProto *google_protobuf_DescriptorProto_new(upb_env *env);
 google_protobuf_DescriptorProto *google_protobuf_DescriptorProto_parsenew(upb_stringview buf, upb_env *env);
@@ -146,15 +268,85 @@ char *google_protobuf_DescriptorProto_serialize(google_protobuf_DescriptorProto
 void google_protobuf_DescriptorProto_free(google_protobuf_DescriptorProto *msg, upb_env *env);
 
 /* google_protobuf_DescriptorProto getters. */
-upb_stringview google_protobuf_DescriptorProto_name(const google_protobuf_DescriptorProto *msg);
-google_protobuf_MessageOptions* google_protobuf_DescriptorProto_options(const google_protobuf_DescriptorProto *msg);
+UPB_INLINE upb_stringview google_protobuf_DescriptorProto_name(const google_protobuf_DescriptorProto *msg) {
+  return msg->name;
+}
+UPB_INLINE bool google_protobuf_DescriptorProto_has_name(const google_protobuf_DescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_DescriptorProto_field(const google_protobuf_DescriptorProto *msg) {
+  return msg->field;
+}
+UPB_INLINE upb_array* google_protobuf_DescriptorProto_nested_type(const google_protobuf_DescriptorProto *msg) {
+  return msg->nested_type;
+}
+UPB_INLINE upb_array* google_protobuf_DescriptorProto_enum_type(const google_protobuf_DescriptorProto *msg) {
+  return msg->enum_type;
+}
+UPB_INLINE upb_array* google_protobuf_DescriptorProto_extension_range(const google_protobuf_DescriptorProto *msg) {
+  return msg->extension_range;
+}
+UPB_INLINE upb_array* google_protobuf_DescriptorProto_extension(const google_protobuf_DescriptorProto *msg) {
+  return msg->extension;
+}
+UPB_INLINE google_protobuf_MessageOptions* google_protobuf_DescriptorProto_options(const google_protobuf_DescriptorProto *msg) {
+  return msg->options;
+}
+UPB_INLINE bool google_protobuf_DescriptorProto_has_options(const google_protobuf_DescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_DescriptorProto_oneof_decl(const google_protobuf_DescriptorProto *msg) {
+  return msg->oneof_decl;
+}
+UPB_INLINE upb_array* google_protobuf_DescriptorProto_reserved_range(const google_protobuf_DescriptorProto *msg) {
+  return msg->reserved_range;
+}
+UPB_INLINE upb_array* google_protobuf_DescriptorProto_reserved_name(const google_protobuf_DescriptorProto *msg) {
+  return msg->reserved_name;
+}
 
 /* google_protobuf_DescriptorProto setters. */
-void google_protobuf_DescriptorProto_set_name(google_protobuf_DescriptorProto *msg, upb_stringview value);
-void google_protobuf_DescriptorProto_set_options(google_protobuf_DescriptorProto *msg, google_protobuf_MessageOptions* value);
+UPB_INLINE void google_protobuf_DescriptorProto_set_name(google_protobuf_DescriptorProto *msg, upb_stringview value) {
+  msg->name = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_DescriptorProto_set_field(google_protobuf_DescriptorProto *msg, upb_array* value) {
+  msg->field = value;
+}
+UPB_INLINE void google_protobuf_DescriptorProto_set_nested_type(google_protobuf_DescriptorProto *msg, upb_array* value) {
+  msg->nested_type = value;
+}
+UPB_INLINE void google_protobuf_DescriptorProto_set_enum_type(google_protobuf_DescriptorProto *msg, upb_array* value) {
+  msg->enum_type = value;
+}
+UPB_INLINE void google_protobuf_DescriptorProto_set_extension_range(google_protobuf_DescriptorProto *msg, upb_array* value) {
+  msg->extension_range = value;
+}
+UPB_INLINE void google_protobuf_DescriptorProto_set_extension(google_protobuf_DescriptorProto *msg, upb_array* value) {
+  msg->extension = value;
+}
+UPB_INLINE void google_protobuf_DescriptorProto_set_options(google_protobuf_DescriptorProto *msg, google_protobuf_MessageOptions* value) {
+  msg->options = value;
+  msg->_hasbits[0] |= 0x02;
+}
+UPB_INLINE void google_protobuf_DescriptorProto_set_oneof_decl(google_protobuf_DescriptorProto *msg, upb_array* value) {
+  msg->oneof_decl = value;
+}
+UPB_INLINE void google_protobuf_DescriptorProto_set_reserved_range(google_protobuf_DescriptorProto *msg, upb_array* value) {
+  msg->reserved_range = value;
+}
+UPB_INLINE void google_protobuf_DescriptorProto_set_reserved_name(google_protobuf_DescriptorProto *msg, upb_array* value) {
+  msg->reserved_name = value;
+}
 
 
 /* google_protobuf_DescriptorProto_ExtensionRange message definition. */
+struct google_protobuf_DescriptorProto_ExtensionRange {
+  uint8_t _hasbits[1];
+  int32_t start;
+  int32_t end;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_DescriptorProto_ExtensionRange_msginit;
 google_protobuf_DescriptorProto_ExtensionRange *google_protobuf_DescriptorProto_ExtensionRange_new(upb_env *env);
 google_protobuf_DescriptorProto_ExtensionRange *google_protobuf_DescriptorProto_ExtensionRange_parsenew(upb_stringview buf, upb_env *env);
@@ -162,15 +354,37 @@ char *google_protobuf_DescriptorProto_ExtensionRange_serialize(google_protobuf_D
 void google_protobuf_DescriptorProto_ExtensionRange_free(google_protobuf_DescriptorProto_ExtensionRange *msg, upb_env *env);
 
 /* google_protobuf_DescriptorProto_ExtensionRange getters. */
-int32_t google_protobuf_DescriptorProto_ExtensionRange_start(const google_protobuf_DescriptorProto_ExtensionRange *msg);
-int32_t google_protobuf_DescriptorProto_ExtensionRange_end(const google_protobuf_DescriptorProto_ExtensionRange *msg);
+UPB_INLINE int32_t google_protobuf_DescriptorProto_ExtensionRange_start(const google_protobuf_DescriptorProto_ExtensionRange *msg) {
+  return msg->start;
+}
+UPB_INLINE bool google_protobuf_DescriptorProto_ExtensionRange_has_start(const google_protobuf_DescriptorProto_ExtensionRange *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE int32_t google_protobuf_DescriptorProto_ExtensionRange_end(const google_protobuf_DescriptorProto_ExtensionRange *msg) {
+  return msg->end;
+}
+UPB_INLINE bool google_protobuf_DescriptorProto_ExtensionRange_has_end(const google_protobuf_DescriptorProto_ExtensionRange *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
 
 /* google_protobuf_DescriptorProto_ExtensionRange setters. */
-void google_protobuf_DescriptorProto_ExtensionRange_set_start(google_protobuf_DescriptorProto_ExtensionRange *msg, int32_t value);
-void google_protobuf_DescriptorProto_ExtensionRange_set_end(google_protobuf_DescriptorProto_ExtensionRange *msg, int32_t value);
+UPB_INLINE void google_protobuf_DescriptorProto_ExtensionRange_set_start(google_protobuf_DescriptorProto_ExtensionRange *msg, int32_t value) {
+  msg->start = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_DescriptorProto_ExtensionRange_set_end(google_protobuf_DescriptorProto_ExtensionRange *msg, int32_t value) {
+  msg->end = value;
+  msg->_hasbits[0] |= 0x02;
+}
 
 
 /* google_protobuf_DescriptorProto_ReservedRange message definition. */
+struct google_protobuf_DescriptorProto_ReservedRange {
+  uint8_t _hasbits[1];
+  int32_t start;
+  int32_t end;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_DescriptorProto_ReservedRange_msginit;
 google_protobuf_DescriptorProto_ReservedRange *google_protobuf_DescriptorProto_ReservedRange_new(upb_env *env);
 google_protobuf_DescriptorProto_ReservedRange *google_protobuf_DescriptorProto_ReservedRange_parsenew(upb_stringview buf, upb_env *env);
@@ -178,15 +392,45 @@ char *google_protobuf_DescriptorProto_ReservedRange_serialize(google_protobuf_De
 void google_protobuf_DescriptorProto_ReservedRange_free(google_protobuf_DescriptorProto_ReservedRange *msg, upb_env *env);
 
 /* google_protobuf_DescriptorProto_ReservedRange getters. */
-int32_t google_protobuf_DescriptorProto_ReservedRange_start(const google_protobuf_DescriptorProto_ReservedRange *msg);
-int32_t google_protobuf_DescriptorProto_ReservedRange_end(const google_protobuf_DescriptorProto_ReservedRange *msg);
+UPB_INLINE int32_t google_protobuf_DescriptorProto_ReservedRange_start(const google_protobuf_DescriptorProto_ReservedRange *msg) {
+  return msg->start;
+}
+UPB_INLINE bool google_protobuf_DescriptorProto_ReservedRange_has_start(const google_protobuf_DescriptorProto_ReservedRange *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE int32_t google_protobuf_DescriptorProto_ReservedRange_end(const google_protobuf_DescriptorProto_ReservedRange *msg) {
+  return msg->end;
+}
+UPB_INLINE bool google_protobuf_DescriptorProto_ReservedRange_has_end(const google_protobuf_DescriptorProto_ReservedRange *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
 
 /* google_protobuf_DescriptorProto_ReservedRange setters. */
-void google_protobuf_DescriptorProto_ReservedRange_set_start(google_protobuf_DescriptorProto_ReservedRange *msg, int32_t value);
-void google_protobuf_DescriptorProto_ReservedRange_set_end(google_protobuf_DescriptorProto_ReservedRange *msg, int32_t value);
+UPB_INLINE void google_protobuf_DescriptorProto_ReservedRange_set_start(google_protobuf_DescriptorProto_ReservedRange *msg, int32_t value) {
+  msg->start = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_DescriptorProto_ReservedRange_set_end(google_protobuf_DescriptorProto_ReservedRange *msg, int32_t value) {
+  msg->end = value;
+  msg->_hasbits[0] |= 0x02;
+}
 
 
 /* google_protobuf_FieldDescriptorProto message definition. */
+struct google_protobuf_FieldDescriptorProto {
+  uint8_t _hasbits[2];
+  google_protobuf_FieldDescriptorProto_Label label;
+  google_protobuf_FieldDescriptorProto_Type type;
+  int32_t number;
+  int32_t oneof_index;
+  upb_stringview name;
+  upb_stringview extendee;
+  upb_stringview type_name;
+  upb_stringview default_value;
+  upb_stringview json_name;
+  google_protobuf_FieldOptions* options;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_FieldDescriptorProto_msginit;
 google_protobuf_FieldDescriptorProto *google_protobuf_FieldDescriptorProto_new(upb_env *env);
 google_protobuf_FieldDescriptorProto *google_protobuf_FieldDescriptorProto_parsenew(upb_stringview buf, upb_env *env);
@@ -194,31 +438,116 @@ char *google_protobuf_FieldDescriptorProto_serialize(google_protobuf_FieldDescri
 void google_protobuf_FieldDescriptorProto_free(google_protobuf_FieldDescriptorProto *msg, upb_env *env);
 
 /* google_protobuf_FieldDescriptorProto getters. */
-upb_stringview google_protobuf_FieldDescriptorProto_name(const google_protobuf_FieldDescriptorProto *msg);
-upb_stringview google_protobuf_FieldDescriptorProto_extendee(const google_protobuf_FieldDescriptorProto *msg);
-int32_t google_protobuf_FieldDescriptorProto_number(const google_protobuf_FieldDescriptorProto *msg);
-google_protobuf_FieldDescriptorProto_Label google_protobuf_FieldDescriptorProto_label(const google_protobuf_FieldDescriptorProto *msg);
-google_protobuf_FieldDescriptorProto_Type google_protobuf_FieldDescriptorProto_type(const google_protobuf_FieldDescriptorProto *msg);
-upb_stringview google_protobuf_FieldDescriptorProto_type_name(const google_protobuf_FieldDescriptorProto *msg);
-upb_stringview google_protobuf_FieldDescriptorProto_default_value(const google_protobuf_FieldDescriptorProto *msg);
-google_protobuf_FieldOptions* google_protobuf_FieldDescriptorProto_options(const google_protobuf_FieldDescriptorProto *msg);
-int32_t google_protobuf_FieldDescriptorProto_oneof_index(const google_protobuf_FieldDescriptorProto *msg);
-upb_stringview google_protobuf_FieldDescriptorProto_json_name(const google_protobuf_FieldDescriptorProto *msg);
+UPB_INLINE upb_stringview google_protobuf_FieldDescriptorProto_name(const google_protobuf_FieldDescriptorProto *msg) {
+  return msg->name;
+}
+UPB_INLINE bool google_protobuf_FieldDescriptorProto_has_name(const google_protobuf_FieldDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x10) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_FieldDescriptorProto_extendee(const google_protobuf_FieldDescriptorProto *msg) {
+  return msg->extendee;
+}
+UPB_INLINE bool google_protobuf_FieldDescriptorProto_has_extendee(const google_protobuf_FieldDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x20) != 0;
+}
+UPB_INLINE int32_t google_protobuf_FieldDescriptorProto_number(const google_protobuf_FieldDescriptorProto *msg) {
+  return msg->number;
+}
+UPB_INLINE bool google_protobuf_FieldDescriptorProto_has_number(const google_protobuf_FieldDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x04) != 0;
+}
+UPB_INLINE google_protobuf_FieldDescriptorProto_Label google_protobuf_FieldDescriptorProto_label(const google_protobuf_FieldDescriptorProto *msg) {
+  return msg->label;
+}
+UPB_INLINE bool google_protobuf_FieldDescriptorProto_has_label(const google_protobuf_FieldDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE google_protobuf_FieldDescriptorProto_Type google_protobuf_FieldDescriptorProto_type(const google_protobuf_FieldDescriptorProto *msg) {
+  return msg->type;
+}
+UPB_INLINE bool google_protobuf_FieldDescriptorProto_has_type(const google_protobuf_FieldDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_FieldDescriptorProto_type_name(const google_protobuf_FieldDescriptorProto *msg) {
+  return msg->type_name;
+}
+UPB_INLINE bool google_protobuf_FieldDescriptorProto_has_type_name(const google_protobuf_FieldDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x40) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_FieldDescriptorProto_default_value(const google_protobuf_FieldDescriptorProto *msg) {
+  return msg->default_value;
+}
+UPB_INLINE bool google_protobuf_FieldDescriptorProto_has_default_value(const google_protobuf_FieldDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x80) != 0;
+}
+UPB_INLINE google_protobuf_FieldOptions* google_protobuf_FieldDescriptorProto_options(const google_protobuf_FieldDescriptorProto *msg) {
+  return msg->options;
+}
+UPB_INLINE bool google_protobuf_FieldDescriptorProto_has_options(const google_protobuf_FieldDescriptorProto *msg) {
+  return (msg->_hasbits[1] & 0x02) != 0;
+}
+UPB_INLINE int32_t google_protobuf_FieldDescriptorProto_oneof_index(const google_protobuf_FieldDescriptorProto *msg) {
+  return msg->oneof_index;
+}
+UPB_INLINE bool google_protobuf_FieldDescriptorProto_has_oneof_index(const google_protobuf_FieldDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x08) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_FieldDescriptorProto_json_name(const google_protobuf_FieldDescriptorProto *msg) {
+  return msg->json_name;
+}
+UPB_INLINE bool google_protobuf_FieldDescriptorProto_has_json_name(const google_protobuf_FieldDescriptorProto *msg) {
+  return (msg->_hasbits[1] & 0x01) != 0;
+}
 
 /* google_protobuf_FieldDescriptorProto setters. */
-void google_protobuf_FieldDescriptorProto_set_name(google_protobuf_FieldDescriptorProto *msg, upb_stringview value);
-void google_protobuf_FieldDescriptorProto_set_extendee(google_protobuf_FieldDescriptorProto *msg, upb_stringview value);
-void google_protobuf_FieldDescriptorProto_set_number(google_protobuf_FieldDescriptorProto *msg, int32_t value);
-void google_protobuf_FieldDescriptorProto_set_label(google_protobuf_FieldDescriptorProto *msg, google_protobuf_FieldDescriptorProto_Label value);
-void google_protobuf_FieldDescriptorProto_set_type(google_protobuf_FieldDescriptorProto *msg, google_protobuf_FieldDescriptorProto_Type value);
-void google_protobuf_FieldDescriptorProto_set_type_name(google_protobuf_FieldDescriptorProto *msg, upb_stringview value);
-void google_protobuf_FieldDescriptorProto_set_default_value(google_protobuf_FieldDescriptorProto *msg, upb_stringview value);
-void google_protobuf_FieldDescriptorProto_set_options(google_protobuf_FieldDescriptorProto *msg, google_protobuf_FieldOptions* value);
-void google_protobuf_FieldDescriptorProto_set_oneof_index(google_protobuf_FieldDescriptorProto *msg, int32_t value);
-void google_protobuf_FieldDescriptorProto_set_json_name(google_protobuf_FieldDescriptorProto *msg, upb_stringview value);
+UPB_INLINE void google_protobuf_FieldDescriptorProto_set_name(google_protobuf_FieldDescriptorProto *msg, upb_stringview value) {
+  msg->name = value;
+  msg->_hasbits[0] |= 0x10;
+}
+UPB_INLINE void google_protobuf_FieldDescriptorProto_set_extendee(google_protobuf_FieldDescriptorProto *msg, upb_stringview value) {
+  msg->extendee = value;
+  msg->_hasbits[0] |= 0x20;
+}
+UPB_INLINE void google_protobuf_FieldDescriptorProto_set_number(google_protobuf_FieldDescriptorProto *msg, int32_t value) {
+  msg->number = value;
+  msg->_hasbits[0] |= 0x04;
+}
+UPB_INLINE void google_protobuf_FieldDescriptorProto_set_label(google_protobuf_FieldDescriptorProto *msg, google_protobuf_FieldDescriptorProto_Label value) {
+  msg->label = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_FieldDescriptorProto_set_type(google_protobuf_FieldDescriptorProto *msg, google_protobuf_FieldDescriptorProto_Type value) {
+  msg->type = value;
+  msg->_hasbits[0] |= 0x02;
+}
+UPB_INLINE void google_protobuf_FieldDescriptorProto_set_type_name(google_protobuf_FieldDescriptorProto *msg, upb_stringview value) {
+  msg->type_name = value;
+  msg->_hasbits[0] |= 0x40;
+}
+UPB_INLINE void google_protobuf_FieldDescriptorProto_set_default_value(google_protobuf_FieldDescriptorProto *msg, upb_stringview value) {
+  msg->default_value = value;
+  msg->_hasbits[0] |= 0x80;
+}
+UPB_INLINE void google_protobuf_FieldDescriptorProto_set_options(google_protobuf_FieldDescriptorProto *msg, google_protobuf_FieldOptions* value) {
+  msg->options = value;
+  msg->_hasbits[1] |= 0x02;
+}
+UPB_INLINE void google_protobuf_FieldDescriptorProto_set_oneof_index(google_protobuf_FieldDescriptorProto *msg, int32_t value) {
+  msg->oneof_index = value;
+  msg->_hasbits[0] |= 0x08;
+}
+UPB_INLINE void google_protobuf_FieldDescriptorProto_set_json_name(google_protobuf_FieldDescriptorProto *msg, upb_stringview value) {
+  msg->json_name = value;
+  msg->_hasbits[1] |= 0x01;
+}
 
 
 /* google_protobuf_OneofDescriptorProto message definition. */
+struct google_protobuf_OneofDescriptorProto {
+  uint8_t _hasbits[1];
+  upb_stringview name;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_OneofDescriptorProto_msginit;
 google_protobuf_OneofDescriptorProto *google_protobuf_OneofDescriptorProto_new(upb_env *env);
 google_protobuf_OneofDescriptorProto *google_protobuf_OneofDescriptorProto_parsenew(upb_stringview buf, upb_env *env);
@@ -226,13 +555,28 @@ char *google_protobuf_OneofDescriptorProto_serialize(google_protobuf_OneofDescri
 void google_protobuf_OneofDescriptorProto_free(google_protobuf_OneofDescriptorProto *msg, upb_env *env);
 
 /* google_protobuf_OneofDescriptorProto getters. */
-upb_stringview google_protobuf_OneofDescriptorProto_name(const google_protobuf_OneofDescriptorProto *msg);
+UPB_INLINE upb_stringview google_protobuf_OneofDescriptorProto_name(const google_protobuf_OneofDescriptorProto *msg) {
+  return msg->name;
+}
+UPB_INLINE bool google_protobuf_OneofDescriptorProto_has_name(const google_protobuf_OneofDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
 
 /* google_protobuf_OneofDescriptorProto setters. */
-void google_protobuf_OneofDescriptorProto_set_name(google_protobuf_OneofDescriptorProto *msg, upb_stringview value);
+UPB_INLINE void google_protobuf_OneofDescriptorProto_set_name(google_protobuf_OneofDescriptorProto *msg, upb_stringview value) {
+  msg->name = value;
+  msg->_hasbits[0] |= 0x01;
+}
 
 
 /* google_protobuf_EnumDescriptorProto message definition. */
+struct google_protobuf_EnumDescriptorProto {
+  uint8_t _hasbits[1];
+  upb_stringview name;
+  google_protobuf_EnumOptions* options;
+  upb_array* value;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_EnumDescriptorProto_msginit;
 google_protobuf_EnumDescriptorProto *google_protobuf_EnumDescriptorProto_new(upb_env *env);
 google_protobuf_EnumDescriptorProto *google_protobuf_EnumDescriptorProto_parsenew(upb_stringview buf, upb_env *env);
@@ -240,15 +584,44 @@ char *google_protobuf_EnumDescriptorProto_serialize(google_protobuf_EnumDescript
 void google_protobuf_EnumDescriptorProto_free(google_protobuf_EnumDescriptorProto *msg, upb_env *env);
 
 /* google_protobuf_EnumDescriptorProto getters. */
-upb_stringview google_protobuf_EnumDescriptorProto_name(const google_protobuf_EnumDescriptorProto *msg);
-google_protobuf_EnumOptions* google_protobuf_EnumDescriptorProto_options(const google_protobuf_EnumDescriptorProto *msg);
+UPB_INLINE upb_stringview google_protobuf_EnumDescriptorProto_name(const google_protobuf_EnumDescriptorProto *msg) {
+  return msg->name;
+}
+UPB_INLINE bool google_protobuf_EnumDescriptorProto_has_name(const google_protobuf_EnumDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_EnumDescriptorProto_value(const google_protobuf_EnumDescriptorProto *msg) {
+  return msg->value;
+}
+UPB_INLINE google_protobuf_EnumOptions* google_protobuf_EnumDescriptorProto_options(const google_protobuf_EnumDescriptorProto *msg) {
+  return msg->options;
+}
+UPB_INLINE bool google_protobuf_EnumDescriptorProto_has_options(const google_protobuf_EnumDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
 
 /* google_protobuf_EnumDescriptorProto setters. */
-void google_protobuf_EnumDescriptorProto_set_name(google_protobuf_EnumDescriptorProto *msg, upb_stringview value);
-void google_protobuf_EnumDescriptorProto_set_options(google_protobuf_EnumDescriptorProto *msg, google_protobuf_EnumOptions* value);
+UPB_INLINE void google_protobuf_EnumDescriptorProto_set_name(google_protobuf_EnumDescriptorProto *msg, upb_stringview value) {
+  msg->name = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_EnumDescriptorProto_set_value(google_protobuf_EnumDescriptorProto *msg, upb_array* value) {
+  msg->value = value;
+}
+UPB_INLINE void google_protobuf_EnumDescriptorProto_set_options(google_protobuf_EnumDescriptorProto *msg, google_protobuf_EnumOptions* value) {
+  msg->options = value;
+  msg->_hasbits[0] |= 0x02;
+}
 
 
 /* google_protobuf_EnumValueDescriptorProto message definition. */
+struct google_protobuf_EnumValueDescriptorProto {
+  uint8_t _hasbits[1];
+  int32_t number;
+  upb_stringview name;
+  google_protobuf_EnumValueOptions* options;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_EnumValueDescriptorProto_msginit;
 google_protobuf_EnumValueDescriptorProto *google_protobuf_EnumValueDescriptorProto_new(upb_env *env);
 google_protobuf_EnumValueDescriptorProto *google_protobuf_EnumValueDescriptorProto_parsenew(upb_stringview buf, upb_env *env);
@@ -256,17 +629,48 @@ char *google_protobuf_EnumValueDescriptorProto_serialize(google_protobuf_EnumVal
 void google_protobuf_EnumValueDescriptorProto_free(google_protobuf_EnumValueDescriptorProto *msg, upb_env *env);
 
 /* google_protobuf_EnumValueDescriptorProto getters. */
-upb_stringview google_protobuf_EnumValueDescriptorProto_name(const google_protobuf_EnumValueDescriptorProto *msg);
-int32_t google_protobuf_EnumValueDescriptorProto_number(const google_protobuf_EnumValueDescriptorProto *msg);
-google_protobuf_EnumValueOptions* google_protobuf_EnumValueDescriptorProto_options(const google_protobuf_EnumValueDescriptorProto *msg);
+UPB_INLINE upb_stringview google_protobuf_EnumValueDescriptorProto_name(const google_protobuf_EnumValueDescriptorProto *msg) {
+  return msg->name;
+}
+UPB_INLINE bool google_protobuf_EnumValueDescriptorProto_has_name(const google_protobuf_EnumValueDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
+UPB_INLINE int32_t google_protobuf_EnumValueDescriptorProto_number(const google_protobuf_EnumValueDescriptorProto *msg) {
+  return msg->number;
+}
+UPB_INLINE bool google_protobuf_EnumValueDescriptorProto_has_number(const google_protobuf_EnumValueDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE google_protobuf_EnumValueOptions* google_protobuf_EnumValueDescriptorProto_options(const google_protobuf_EnumValueDescriptorProto *msg) {
+  return msg->options;
+}
+UPB_INLINE bool google_protobuf_EnumValueDescriptorProto_has_options(const google_protobuf_EnumValueDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x04) != 0;
+}
 
 /* google_protobuf_EnumValueDescriptorProto setters. */
-void google_protobuf_EnumValueDescriptorProto_set_name(google_protobuf_EnumValueDescriptorProto *msg, upb_stringview value);
-void google_protobuf_EnumValueDescriptorProto_set_number(google_protobuf_EnumValueDescriptorProto *msg, int32_t value);
-void google_protobuf_EnumValueDescriptorProto_set_options(google_protobuf_EnumValueDescriptorProto *msg, google_protobuf_EnumValueOptions* value);
+UPB_INLINE void google_protobuf_EnumValueDescriptorProto_set_name(google_protobuf_EnumValueDescriptorProto *msg, upb_stringview value) {
+  msg->name = value;
+  msg->_hasbits[0] |= 0x02;
+}
+UPB_INLINE void google_protobuf_EnumValueDescriptorProto_set_number(google_protobuf_EnumValueDescriptorProto *msg, int32_t value) {
+  msg->number = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_EnumValueDescriptorProto_set_options(google_protobuf_EnumValueDescriptorProto *msg, google_protobuf_EnumValueOptions* value) {
+  msg->options = value;
+  msg->_hasbits[0] |= 0x04;
+}
 
 
 /* google_protobuf_ServiceDescriptorProto message definition. */
+struct google_protobuf_ServiceDescriptorProto {
+  uint8_t _hasbits[1];
+  upb_stringview name;
+  google_protobuf_ServiceOptions* options;
+  upb_array* method;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_ServiceDescriptorProto_msginit;
 google_protobuf_ServiceDescriptorProto *google_protobuf_ServiceDescriptorProto_new(upb_env *env);
 google_protobuf_ServiceDescriptorProto *google_protobuf_ServiceDescriptorProto_parsenew(upb_stringview buf, upb_env *env);
@@ -274,15 +678,47 @@ char *google_protobuf_ServiceDescriptorProto_serialize(google_protobuf_ServiceDe
 void google_protobuf_ServiceDescriptorProto_free(google_protobuf_ServiceDescriptorProto *msg, upb_env *env);
 
 /* google_protobuf_ServiceDescriptorProto getters. */
-upb_stringview google_protobuf_ServiceDescriptorProto_name(const google_protobuf_ServiceDescriptorProto *msg);
-google_protobuf_ServiceOptions* google_protobuf_ServiceDescriptorProto_options(const google_protobuf_ServiceDescriptorProto *msg);
+UPB_INLINE upb_stringview google_protobuf_ServiceDescriptorProto_name(const google_protobuf_ServiceDescriptorProto *msg) {
+  return msg->name;
+}
+UPB_INLINE bool google_protobuf_ServiceDescriptorProto_has_name(const google_protobuf_ServiceDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_ServiceDescriptorProto_method(const google_protobuf_ServiceDescriptorProto *msg) {
+  return msg->method;
+}
+UPB_INLINE google_protobuf_ServiceOptions* google_protobuf_ServiceDescriptorProto_options(const google_protobuf_ServiceDescriptorProto *msg) {
+  return msg->options;
+}
+UPB_INLINE bool google_protobuf_ServiceDescriptorProto_has_options(const google_protobuf_ServiceDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
 
 /* google_protobuf_ServiceDescriptorProto setters. */
-void google_protobuf_ServiceDescriptorProto_set_name(google_protobuf_ServiceDescriptorProto *msg, upb_stringview value);
-void google_protobuf_ServiceDescriptorProto_set_options(google_protobuf_ServiceDescriptorProto *msg, google_protobuf_ServiceOptions* value);
+UPB_INLINE void google_protobuf_ServiceDescriptorProto_set_name(google_protobuf_ServiceDescriptorProto *msg, upb_stringview value) {
+  msg->name = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_ServiceDescriptorProto_set_method(google_protobuf_ServiceDescriptorProto *msg, upb_array* value) {
+  msg->method = value;
+}
+UPB_INLINE void google_protobuf_ServiceDescriptorProto_set_options(google_protobuf_ServiceDescriptorProto *msg, google_protobuf_ServiceOptions* value) {
+  msg->options = value;
+  msg->_hasbits[0] |= 0x02;
+}
 
 
 /* google_protobuf_MethodDescriptorProto message definition. */
+struct google_protobuf_MethodDescriptorProto {
+  uint8_t _hasbits[1];
+  bool client_streaming;
+  bool server_streaming;
+  upb_stringview name;
+  upb_stringview input_type;
+  upb_stringview output_type;
+  google_protobuf_MethodOptions* options;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_MethodDescriptorProto_msginit;
 google_protobuf_MethodDescriptorProto *google_protobuf_MethodDescriptorProto_new(upb_env *env);
 google_protobuf_MethodDescriptorProto *google_protobuf_MethodDescriptorProto_parsenew(upb_stringview buf, upb_env *env);
@@ -290,23 +726,93 @@ char *google_protobuf_MethodDescriptorProto_serialize(google_protobuf_MethodDesc
 void google_protobuf_MethodDescriptorProto_free(google_protobuf_MethodDescriptorProto *msg, upb_env *env);
 
 /* google_protobuf_MethodDescriptorProto getters. */
-upb_stringview google_protobuf_MethodDescriptorProto_name(const google_protobuf_MethodDescriptorProto *msg);
-upb_stringview google_protobuf_MethodDescriptorProto_input_type(const google_protobuf_MethodDescriptorProto *msg);
-upb_stringview google_protobuf_MethodDescriptorProto_output_type(const google_protobuf_MethodDescriptorProto *msg);
-google_protobuf_MethodOptions* google_protobuf_MethodDescriptorProto_options(const google_protobuf_MethodDescriptorProto *msg);
-bool google_protobuf_MethodDescriptorProto_client_streaming(const google_protobuf_MethodDescriptorProto *msg);
-bool google_protobuf_MethodDescriptorProto_server_streaming(const google_protobuf_MethodDescriptorProto *msg);
+UPB_INLINE upb_stringview google_protobuf_MethodDescriptorProto_name(const google_protobuf_MethodDescriptorProto *msg) {
+  return msg->name;
+}
+UPB_INLINE bool google_protobuf_MethodDescriptorProto_has_name(const google_protobuf_MethodDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x04) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_MethodDescriptorProto_input_type(const google_protobuf_MethodDescriptorProto *msg) {
+  return msg->input_type;
+}
+UPB_INLINE bool google_protobuf_MethodDescriptorProto_has_input_type(const google_protobuf_MethodDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x08) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_MethodDescriptorProto_output_type(const google_protobuf_MethodDescriptorProto *msg) {
+  return msg->output_type;
+}
+UPB_INLINE bool google_protobuf_MethodDescriptorProto_has_output_type(const google_protobuf_MethodDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x10) != 0;
+}
+UPB_INLINE google_protobuf_MethodOptions* google_protobuf_MethodDescriptorProto_options(const google_protobuf_MethodDescriptorProto *msg) {
+  return msg->options;
+}
+UPB_INLINE bool google_protobuf_MethodDescriptorProto_has_options(const google_protobuf_MethodDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x20) != 0;
+}
+UPB_INLINE bool google_protobuf_MethodDescriptorProto_client_streaming(const google_protobuf_MethodDescriptorProto *msg) {
+  return msg->client_streaming;
+}
+UPB_INLINE bool google_protobuf_MethodDescriptorProto_has_client_streaming(const google_protobuf_MethodDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE bool google_protobuf_MethodDescriptorProto_server_streaming(const google_protobuf_MethodDescriptorProto *msg) {
+  return msg->server_streaming;
+}
+UPB_INLINE bool google_protobuf_MethodDescriptorProto_has_server_streaming(const google_protobuf_MethodDescriptorProto *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
 
 /* google_protobuf_MethodDescriptorProto setters. */
-void google_protobuf_MethodDescriptorProto_set_name(google_protobuf_MethodDescriptorProto *msg, upb_stringview value);
-void google_protobuf_MethodDescriptorProto_set_input_type(google_protobuf_MethodDescriptorProto *msg, upb_stringview value);
-void google_protobuf_MethodDescriptorProto_set_output_type(google_protobuf_MethodDescriptorProto *msg, upb_stringview value);
-void google_protobuf_MethodDescriptorProto_set_options(google_protobuf_MethodDescriptorProto *msg, google_protobuf_MethodOptions* value);
-void google_protobuf_MethodDescriptorProto_set_client_streaming(google_protobuf_MethodDescriptorProto *msg, bool value);
-void google_protobuf_MethodDescriptorProto_set_server_streaming(google_protobuf_MethodDescriptorProto *msg, bool value);
+UPB_INLINE void google_protobuf_MethodDescriptorProto_set_name(google_protobuf_MethodDescriptorProto *msg, upb_stringview value) {
+  msg->name = value;
+  msg->_hasbits[0] |= 0x04;
+}
+UPB_INLINE void google_protobuf_MethodDescriptorProto_set_input_type(google_protobuf_MethodDescriptorProto *msg, upb_stringview value) {
+  msg->input_type = value;
+  msg->_hasbits[0] |= 0x08;
+}
+UPB_INLINE void google_protobuf_MethodDescriptorProto_set_output_type(google_protobuf_MethodDescriptorProto *msg, upb_stringview value) {
+  msg->output_type = value;
+  msg->_hasbits[0] |= 0x10;
+}
+UPB_INLINE void google_protobuf_MethodDescriptorProto_set_options(google_protobuf_MethodDescriptorProto *msg, google_protobuf_MethodOptions* value) {
+  msg->options = value;
+  msg->_hasbits[0] |= 0x20;
+}
+UPB_INLINE void google_protobuf_MethodDescriptorProto_set_client_streaming(google_protobuf_MethodDescriptorProto *msg, bool value) {
+  msg->client_streaming = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_MethodDescriptorProto_set_server_streaming(google_protobuf_MethodDescriptorProto *msg, bool value) {
+  msg->server_streaming = value;
+  msg->_hasbits[0] |= 0x02;
+}
 
 
 /* google_protobuf_FileOptions message definition. */
+struct google_protobuf_FileOptions {
+  uint8_t _hasbits[3];
+  google_protobuf_FileOptions_OptimizeMode optimize_for;
+  bool java_multiple_files;
+  bool cc_generic_services;
+  bool java_generic_services;
+  bool py_generic_services;
+  bool java_generate_equals_and_hash;
+  bool deprecated;
+  bool java_string_check_utf8;
+  bool cc_enable_arenas;
+  bool javanano_use_deprecated_package;
+  upb_stringview java_package;
+  upb_stringview java_outer_classname;
+  upb_stringview go_package;
+  upb_stringview objc_class_prefix;
+  upb_stringview csharp_namespace;
+  upb_stringview php_class_prefix;
+  upb_stringview php_namespace;
+  upb_array* uninterpreted_option;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_FileOptions_msginit;
 google_protobuf_FileOptions *google_protobuf_FileOptions_new(upb_env *env);
 google_protobuf_FileOptions *google_protobuf_FileOptions_parsenew(upb_stringview buf, upb_env *env);
@@ -314,45 +820,196 @@ char *google_protobuf_FileOptions_serialize(google_protobuf_FileOptions *msg, up
 void google_protobuf_FileOptions_free(google_protobuf_FileOptions *msg, upb_env *env);
 
 /* google_protobuf_FileOptions getters. */
-upb_stringview google_protobuf_FileOptions_java_package(const google_protobuf_FileOptions *msg);
-upb_stringview google_protobuf_FileOptions_java_outer_classname(const google_protobuf_FileOptions *msg);
-google_protobuf_FileOptions_OptimizeMode google_protobuf_FileOptions_optimize_for(const google_protobuf_FileOptions *msg);
-bool google_protobuf_FileOptions_java_multiple_files(const google_protobuf_FileOptions *msg);
-upb_stringview google_protobuf_FileOptions_go_package(const google_protobuf_FileOptions *msg);
-bool google_protobuf_FileOptions_cc_generic_services(const google_protobuf_FileOptions *msg);
-bool google_protobuf_FileOptions_java_generic_services(const google_protobuf_FileOptions *msg);
-bool google_protobuf_FileOptions_py_generic_services(const google_protobuf_FileOptions *msg);
-bool google_protobuf_FileOptions_java_generate_equals_and_hash(const google_protobuf_FileOptions *msg);
-bool google_protobuf_FileOptions_deprecated(const google_protobuf_FileOptions *msg);
-bool google_protobuf_FileOptions_java_string_check_utf8(const google_protobuf_FileOptions *msg);
-bool google_protobuf_FileOptions_cc_enable_arenas(const google_protobuf_FileOptions *msg);
-upb_stringview google_protobuf_FileOptions_objc_class_prefix(const google_protobuf_FileOptions *msg);
-upb_stringview google_protobuf_FileOptions_csharp_namespace(const google_protobuf_FileOptions *msg);
-bool google_protobuf_FileOptions_javanano_use_deprecated_package(const google_protobuf_FileOptions *msg);
-upb_stringview google_protobuf_FileOptions_php_class_prefix(const google_protobuf_FileOptions *msg);
-upb_stringview google_protobuf_FileOptions_php_namespace(const google_protobuf_FileOptions *msg);
+UPB_INLINE upb_stringview google_protobuf_FileOptions_java_package(const google_protobuf_FileOptions *msg) {
+  return msg->java_package;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_java_package(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[1] & 0x04) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_FileOptions_java_outer_classname(const google_protobuf_FileOptions *msg) {
+  return msg->java_outer_classname;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_java_outer_classname(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[1] & 0x08) != 0;
+}
+UPB_INLINE google_protobuf_FileOptions_OptimizeMode google_protobuf_FileOptions_optimize_for(const google_protobuf_FileOptions *msg) {
+  return msg->optimize_for;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_optimize_for(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE bool google_protobuf_FileOptions_java_multiple_files(const google_protobuf_FileOptions *msg) {
+  return msg->java_multiple_files;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_java_multiple_files(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_FileOptions_go_package(const google_protobuf_FileOptions *msg) {
+  return msg->go_package;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_go_package(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[1] & 0x10) != 0;
+}
+UPB_INLINE bool google_protobuf_FileOptions_cc_generic_services(const google_protobuf_FileOptions *msg) {
+  return msg->cc_generic_services;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_cc_generic_services(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[0] & 0x04) != 0;
+}
+UPB_INLINE bool google_protobuf_FileOptions_java_generic_services(const google_protobuf_FileOptions *msg) {
+  return msg->java_generic_services;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_java_generic_services(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[0] & 0x08) != 0;
+}
+UPB_INLINE bool google_protobuf_FileOptions_py_generic_services(const google_protobuf_FileOptions *msg) {
+  return msg->py_generic_services;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_py_generic_services(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[0] & 0x10) != 0;
+}
+UPB_INLINE bool google_protobuf_FileOptions_java_generate_equals_and_hash(const google_protobuf_FileOptions *msg) {
+  return msg->java_generate_equals_and_hash;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_java_generate_equals_and_hash(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[0] & 0x20) != 0;
+}
+UPB_INLINE bool google_protobuf_FileOptions_deprecated(const google_protobuf_FileOptions *msg) {
+  return msg->deprecated;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_deprecated(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[0] & 0x40) != 0;
+}
+UPB_INLINE bool google_protobuf_FileOptions_java_string_check_utf8(const google_protobuf_FileOptions *msg) {
+  return msg->java_string_check_utf8;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_java_string_check_utf8(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[0] & 0x80) != 0;
+}
+UPB_INLINE bool google_protobuf_FileOptions_cc_enable_arenas(const google_protobuf_FileOptions *msg) {
+  return msg->cc_enable_arenas;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_cc_enable_arenas(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[1] & 0x01) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_FileOptions_objc_class_prefix(const google_protobuf_FileOptions *msg) {
+  return msg->objc_class_prefix;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_objc_class_prefix(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[1] & 0x20) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_FileOptions_csharp_namespace(const google_protobuf_FileOptions *msg) {
+  return msg->csharp_namespace;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_csharp_namespace(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[1] & 0x40) != 0;
+}
+UPB_INLINE bool google_protobuf_FileOptions_javanano_use_deprecated_package(const google_protobuf_FileOptions *msg) {
+  return msg->javanano_use_deprecated_package;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_javanano_use_deprecated_package(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[1] & 0x02) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_FileOptions_php_class_prefix(const google_protobuf_FileOptions *msg) {
+  return msg->php_class_prefix;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_php_class_prefix(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[1] & 0x80) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_FileOptions_php_namespace(const google_protobuf_FileOptions *msg) {
+  return msg->php_namespace;
+}
+UPB_INLINE bool google_protobuf_FileOptions_has_php_namespace(const google_protobuf_FileOptions *msg) {
+  return (msg->_hasbits[2] & 0x01) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_FileOptions_uninterpreted_option(const google_protobuf_FileOptions *msg) {
+  return msg->uninterpreted_option;
+}
 
 /* google_protobuf_FileOptions setters. */
-void google_protobuf_FileOptions_set_java_package(google_protobuf_FileOptions *msg, upb_stringview value);
-void google_protobuf_FileOptions_set_java_outer_classname(google_protobuf_FileOptions *msg, upb_stringview value);
-void google_protobuf_FileOptions_set_optimize_for(google_protobuf_FileOptions *msg, google_protobuf_FileOptions_OptimizeMode value);
-void google_protobuf_FileOptions_set_java_multiple_files(google_protobuf_FileOptions *msg, bool value);
-void google_protobuf_FileOptions_set_go_package(google_protobuf_FileOptions *msg, upb_stringview value);
-void google_protobuf_FileOptions_set_cc_generic_services(google_protobuf_FileOptions *msg, bool value);
-void google_protobuf_FileOptions_set_java_generic_services(google_protobuf_FileOptions *msg, bool value);
-void google_protobuf_FileOptions_set_py_generic_services(google_protobuf_FileOptions *msg, bool value);
-void google_protobuf_FileOptions_set_java_generate_equals_and_hash(google_protobuf_FileOptions *msg, bool value);
-void google_protobuf_FileOptions_set_deprecated(google_protobuf_FileOptions *msg, bool value);
-void google_protobuf_FileOptions_set_java_string_check_utf8(google_protobuf_FileOptions *msg, bool value);
-void google_protobuf_FileOptions_set_cc_enable_arenas(google_protobuf_FileOptions *msg, bool value);
-void google_protobuf_FileOptions_set_objc_class_prefix(google_protobuf_FileOptions *msg, upb_stringview value);
-void google_protobuf_FileOptions_set_csharp_namespace(google_protobuf_FileOptions *msg, upb_stringview value);
-void google_protobuf_FileOptions_set_javanano_use_deprecated_package(google_protobuf_FileOptions *msg, bool value);
-void google_protobuf_FileOptions_set_php_class_prefix(google_protobuf_FileOptions *msg, upb_stringview value);
-void google_protobuf_FileOptions_set_php_namespace(google_protobuf_FileOptions *msg, upb_stringview value);
+UPB_INLINE void google_protobuf_FileOptions_set_java_package(google_protobuf_FileOptions *msg, upb_stringview value) {
+  msg->java_package = value;
+  msg->_hasbits[1] |= 0x04;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_java_outer_classname(google_protobuf_FileOptions *msg, upb_stringview value) {
+  msg->java_outer_classname = value;
+  msg->_hasbits[1] |= 0x08;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_optimize_for(google_protobuf_FileOptions *msg, google_protobuf_FileOptions_OptimizeMode value) {
+  msg->optimize_for = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_java_multiple_files(google_protobuf_FileOptions *msg, bool value) {
+  msg->java_multiple_files = value;
+  msg->_hasbits[0] |= 0x02;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_go_package(google_protobuf_FileOptions *msg, upb_stringview value) {
+  msg->go_package = value;
+  msg->_hasbits[1] |= 0x10;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_cc_generic_services(google_protobuf_FileOptions *msg, bool value) {
+  msg->cc_generic_services = value;
+  msg->_hasbits[0] |= 0x04;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_java_generic_services(google_protobuf_FileOptions *msg, bool value) {
+  msg->java_generic_services = value;
+  msg->_hasbits[0] |= 0x08;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_py_generic_services(google_protobuf_FileOptions *msg, bool value) {
+  msg->py_generic_services = value;
+  msg->_hasbits[0] |= 0x10;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_java_generate_equals_and_hash(google_protobuf_FileOptions *msg, bool value) {
+  msg->java_generate_equals_and_hash = value;
+  msg->_hasbits[0] |= 0x20;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_deprecated(google_protobuf_FileOptions *msg, bool value) {
+  msg->deprecated = value;
+  msg->_hasbits[0] |= 0x40;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_java_string_check_utf8(google_protobuf_FileOptions *msg, bool value) {
+  msg->java_string_check_utf8 = value;
+  msg->_hasbits[0] |= 0x80;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_cc_enable_arenas(google_protobuf_FileOptions *msg, bool value) {
+  msg->cc_enable_arenas = value;
+  msg->_hasbits[1] |= 0x01;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_objc_class_prefix(google_protobuf_FileOptions *msg, upb_stringview value) {
+  msg->objc_class_prefix = value;
+  msg->_hasbits[1] |= 0x20;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_csharp_namespace(google_protobuf_FileOptions *msg, upb_stringview value) {
+  msg->csharp_namespace = value;
+  msg->_hasbits[1] |= 0x40;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_javanano_use_deprecated_package(google_protobuf_FileOptions *msg, bool value) {
+  msg->javanano_use_deprecated_package = value;
+  msg->_hasbits[1] |= 0x02;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_php_class_prefix(google_protobuf_FileOptions *msg, upb_stringview value) {
+  msg->php_class_prefix = value;
+  msg->_hasbits[1] |= 0x80;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_php_namespace(google_protobuf_FileOptions *msg, upb_stringview value) {
+  msg->php_namespace = value;
+  msg->_hasbits[2] |= 0x01;
+}
+UPB_INLINE void google_protobuf_FileOptions_set_uninterpreted_option(google_protobuf_FileOptions *msg, upb_array* value) {
+  msg->uninterpreted_option = value;
+}
 
 
 /* google_protobuf_MessageOptions message definition. */
+struct google_protobuf_MessageOptions {
+  uint8_t _hasbits[1];
+  bool message_set_wire_format;
+  bool no_standard_descriptor_accessor;
+  bool deprecated;
+  bool map_entry;
+  upb_array* uninterpreted_option;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_MessageOptions_msginit;
 google_protobuf_MessageOptions *google_protobuf_MessageOptions_new(upb_env *env);
 google_protobuf_MessageOptions *google_protobuf_MessageOptions_parsenew(upb_stringview buf, upb_env *env);
@@ -360,19 +1017,68 @@ char *google_protobuf_MessageOptions_serialize(google_protobuf_MessageOptions *m
 void google_protobuf_MessageOptions_free(google_protobuf_MessageOptions *msg, upb_env *env);
 
 /* google_protobuf_MessageOptions getters. */
-bool google_protobuf_MessageOptions_message_set_wire_format(const google_protobuf_MessageOptions *msg);
-bool google_protobuf_MessageOptions_no_standard_descriptor_accessor(const google_protobuf_MessageOptions *msg);
-bool google_protobuf_MessageOptions_deprecated(const google_protobuf_MessageOptions *msg);
-bool google_protobuf_MessageOptions_map_entry(const google_protobuf_MessageOptions *msg);
+UPB_INLINE bool google_protobuf_MessageOptions_message_set_wire_format(const google_protobuf_MessageOptions *msg) {
+  return msg->message_set_wire_format;
+}
+UPB_INLINE bool google_protobuf_MessageOptions_has_message_set_wire_format(const google_protobuf_MessageOptions *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE bool google_protobuf_MessageOptions_no_standard_descriptor_accessor(const google_protobuf_MessageOptions *msg) {
+  return msg->no_standard_descriptor_accessor;
+}
+UPB_INLINE bool google_protobuf_MessageOptions_has_no_standard_descriptor_accessor(const google_protobuf_MessageOptions *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
+UPB_INLINE bool google_protobuf_MessageOptions_deprecated(const google_protobuf_MessageOptions *msg) {
+  return msg->deprecated;
+}
+UPB_INLINE bool google_protobuf_MessageOptions_has_deprecated(const google_protobuf_MessageOptions *msg) {
+  return (msg->_hasbits[0] & 0x04) != 0;
+}
+UPB_INLINE bool google_protobuf_MessageOptions_map_entry(const google_protobuf_MessageOptions *msg) {
+  return msg->map_entry;
+}
+UPB_INLINE bool google_protobuf_MessageOptions_has_map_entry(const google_protobuf_MessageOptions *msg) {
+  return (msg->_hasbits[0] & 0x08) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_MessageOptions_uninterpreted_option(const google_protobuf_MessageOptions *msg) {
+  return msg->uninterpreted_option;
+}
 
 /* google_protobuf_MessageOptions setters. */
-void google_protobuf_MessageOptions_set_message_set_wire_format(google_protobuf_MessageOptions *msg, bool value);
-void google_protobuf_MessageOptions_set_no_standard_descriptor_accessor(google_protobuf_MessageOptions *msg, bool value);
-void google_protobuf_MessageOptions_set_deprecated(google_protobuf_MessageOptions *msg, bool value);
-void google_protobuf_MessageOptions_set_map_entry(google_protobuf_MessageOptions *msg, bool value);
+UPB_INLINE void google_protobuf_MessageOptions_set_message_set_wire_format(google_protobuf_MessageOptions *msg, bool value) {
+  msg->message_set_wire_format = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_MessageOptions_set_no_standard_descriptor_accessor(google_protobuf_MessageOptions *msg, bool value) {
+  msg->no_standard_descriptor_accessor = value;
+  msg->_hasbits[0] |= 0x02;
+}
+UPB_INLINE void google_protobuf_MessageOptions_set_deprecated(google_protobuf_MessageOptions *msg, bool value) {
+  msg->deprecated = value;
+  msg->_hasbits[0] |= 0x04;
+}
+UPB_INLINE void google_protobuf_MessageOptions_set_map_entry(google_protobuf_MessageOptions *msg, bool value) {
+  msg->map_entry = value;
+  msg->_hasbits[0] |= 0x08;
+}
+UPB_INLINE void google_protobuf_MessageOptions_set_uninterpreted_option(google_protobuf_MessageOptions *msg, upb_array* value) {
+  msg->uninterpreted_option = value;
+}
 
 
 /* google_protobuf_FieldOptions message definition. */
+struct google_protobuf_FieldOptions {
+  uint8_t _hasbits[1];
+  google_protobuf_FieldOptions_CType ctype;
+  google_protobuf_FieldOptions_JSType jstype;
+  bool packed;
+  bool deprecated;
+  bool lazy;
+  bool weak;
+  upb_array* uninterpreted_option;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_FieldOptions_msginit;
 google_protobuf_FieldOptions *google_protobuf_FieldOptions_new(upb_env *env);
 google_protobuf_FieldOptions *google_protobuf_FieldOptions_parsenew(upb_stringview buf, upb_env *env);
@@ -380,23 +1086,84 @@ char *google_protobuf_FieldOptions_serialize(google_protobuf_FieldOptions *msg,
 void google_protobuf_FieldOptions_free(google_protobuf_FieldOptions *msg, upb_env *env);
 
 /* google_protobuf_FieldOptions getters. */
-google_protobuf_FieldOptions_CType google_protobuf_FieldOptions_ctype(const google_protobuf_FieldOptions *msg);
-bool google_protobuf_FieldOptions_packed(const google_protobuf_FieldOptions *msg);
-bool google_protobuf_FieldOptions_deprecated(const google_protobuf_FieldOptions *msg);
-bool google_protobuf_FieldOptions_lazy(const google_protobuf_FieldOptions *msg);
-google_protobuf_FieldOptions_JSType google_protobuf_FieldOptions_jstype(const google_protobuf_FieldOptions *msg);
-bool google_protobuf_FieldOptions_weak(const google_protobuf_FieldOptions *msg);
+UPB_INLINE google_protobuf_FieldOptions_CType google_protobuf_FieldOptions_ctype(const google_protobuf_FieldOptions *msg) {
+  return msg->ctype;
+}
+UPB_INLINE bool google_protobuf_FieldOptions_has_ctype(const google_protobuf_FieldOptions *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE bool google_protobuf_FieldOptions_packed(const google_protobuf_FieldOptions *msg) {
+  return msg->packed;
+}
+UPB_INLINE bool google_protobuf_FieldOptions_has_packed(const google_protobuf_FieldOptions *msg) {
+  return (msg->_hasbits[0] & 0x04) != 0;
+}
+UPB_INLINE bool google_protobuf_FieldOptions_deprecated(const google_protobuf_FieldOptions *msg) {
+  return msg->deprecated;
+}
+UPB_INLINE bool google_protobuf_FieldOptions_has_deprecated(const google_protobuf_FieldOptions *msg) {
+  return (msg->_hasbits[0] & 0x08) != 0;
+}
+UPB_INLINE bool google_protobuf_FieldOptions_lazy(const google_protobuf_FieldOptions *msg) {
+  return msg->lazy;
+}
+UPB_INLINE bool google_protobuf_FieldOptions_has_lazy(const google_protobuf_FieldOptions *msg) {
+  return (msg->_hasbits[0] & 0x10) != 0;
+}
+UPB_INLINE google_protobuf_FieldOptions_JSType google_protobuf_FieldOptions_jstype(const google_protobuf_FieldOptions *msg) {
+  return msg->jstype;
+}
+UPB_INLINE bool google_protobuf_FieldOptions_has_jstype(const google_protobuf_FieldOptions *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
+UPB_INLINE bool google_protobuf_FieldOptions_weak(const google_protobuf_FieldOptions *msg) {
+  return msg->weak;
+}
+UPB_INLINE bool google_protobuf_FieldOptions_has_weak(const google_protobuf_FieldOptions *msg) {
+  return (msg->_hasbits[0] & 0x20) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_FieldOptions_uninterpreted_option(const google_protobuf_FieldOptions *msg) {
+  return msg->uninterpreted_option;
+}
 
 /* google_protobuf_FieldOptions setters. */
-void google_protobuf_FieldOptions_set_ctype(google_protobuf_FieldOptions *msg, google_protobuf_FieldOptions_CType value);
-void google_protobuf_FieldOptions_set_packed(google_protobuf_FieldOptions *msg, bool value);
-void google_protobuf_FieldOptions_set_deprecated(google_protobuf_FieldOptions *msg, bool value);
-void google_protobuf_FieldOptions_set_lazy(google_protobuf_FieldOptions *msg, bool value);
-void google_protobuf_FieldOptions_set_jstype(google_protobuf_FieldOptions *msg, google_protobuf_FieldOptions_JSType value);
-void google_protobuf_FieldOptions_set_weak(google_protobuf_FieldOptions *msg, bool value);
+UPB_INLINE void google_protobuf_FieldOptions_set_ctype(google_protobuf_FieldOptions *msg, google_protobuf_FieldOptions_CType value) {
+  msg->ctype = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_FieldOptions_set_packed(google_protobuf_FieldOptions *msg, bool value) {
+  msg->packed = value;
+  msg->_hasbits[0] |= 0x04;
+}
+UPB_INLINE void google_protobuf_FieldOptions_set_deprecated(google_protobuf_FieldOptions *msg, bool value) {
+  msg->deprecated = value;
+  msg->_hasbits[0] |= 0x08;
+}
+UPB_INLINE void google_protobuf_FieldOptions_set_lazy(google_protobuf_FieldOptions *msg, bool value) {
+  msg->lazy = value;
+  msg->_hasbits[0] |= 0x10;
+}
+UPB_INLINE void google_protobuf_FieldOptions_set_jstype(google_protobuf_FieldOptions *msg, google_protobuf_FieldOptions_JSType value) {
+  msg->jstype = value;
+  msg->_hasbits[0] |= 0x02;
+}
+UPB_INLINE void google_protobuf_FieldOptions_set_weak(google_protobuf_FieldOptions *msg, bool value) {
+  msg->weak = value;
+  msg->_hasbits[0] |= 0x20;
+}
+UPB_INLINE void google_protobuf_FieldOptions_set_uninterpreted_option(google_protobuf_FieldOptions *msg, upb_array* value) {
+  msg->uninterpreted_option = value;
+}
 
 
 /* google_protobuf_EnumOptions message definition. */
+struct google_protobuf_EnumOptions {
+  uint8_t _hasbits[1];
+  bool allow_alias;
+  bool deprecated;
+  upb_array* uninterpreted_option;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_EnumOptions_msginit;
 google_protobuf_EnumOptions *google_protobuf_EnumOptions_new(upb_env *env);
 google_protobuf_EnumOptions *google_protobuf_EnumOptions_parsenew(upb_stringview buf, upb_env *env);
@@ -404,15 +1171,43 @@ char *google_protobuf_EnumOptions_serialize(google_protobuf_EnumOptions *msg, up
 void google_protobuf_EnumOptions_free(google_protobuf_EnumOptions *msg, upb_env *env);
 
 /* google_protobuf_EnumOptions getters. */
-bool google_protobuf_EnumOptions_allow_alias(const google_protobuf_EnumOptions *msg);
-bool google_protobuf_EnumOptions_deprecated(const google_protobuf_EnumOptions *msg);
+UPB_INLINE bool google_protobuf_EnumOptions_allow_alias(const google_protobuf_EnumOptions *msg) {
+  return msg->allow_alias;
+}
+UPB_INLINE bool google_protobuf_EnumOptions_has_allow_alias(const google_protobuf_EnumOptions *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE bool google_protobuf_EnumOptions_deprecated(const google_protobuf_EnumOptions *msg) {
+  return msg->deprecated;
+}
+UPB_INLINE bool google_protobuf_EnumOptions_has_deprecated(const google_protobuf_EnumOptions *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_EnumOptions_uninterpreted_option(const google_protobuf_EnumOptions *msg) {
+  return msg->uninterpreted_option;
+}
 
 /* google_protobuf_EnumOptions setters. */
-void google_protobuf_EnumOptions_set_allow_alias(google_protobuf_EnumOptions *msg, bool value);
-void google_protobuf_EnumOptions_set_deprecated(google_protobuf_EnumOptions *msg, bool value);
+UPB_INLINE void google_protobuf_EnumOptions_set_allow_alias(google_protobuf_EnumOptions *msg, bool value) {
+  msg->allow_alias = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_EnumOptions_set_deprecated(google_protobuf_EnumOptions *msg, bool value) {
+  msg->deprecated = value;
+  msg->_hasbits[0] |= 0x02;
+}
+UPB_INLINE void google_protobuf_EnumOptions_set_uninterpreted_option(google_protobuf_EnumOptions *msg, upb_array* value) {
+  msg->uninterpreted_option = value;
+}
 
 
 /* google_protobuf_EnumValueOptions message definition. */
+struct google_protobuf_EnumValueOptions {
+  uint8_t _hasbits[1];
+  bool deprecated;
+  upb_array* uninterpreted_option;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_EnumValueOptions_msginit;
 google_protobuf_EnumValueOptions *google_protobuf_EnumValueOptions_new(upb_env *env);
 google_protobuf_EnumValueOptions *google_protobuf_EnumValueOptions_parsenew(upb_stringview buf, upb_env *env);
@@ -420,13 +1215,33 @@ char *google_protobuf_EnumValueOptions_serialize(google_protobuf_EnumValueOption
 void google_protobuf_EnumValueOptions_free(google_protobuf_EnumValueOptions *msg, upb_env *env);
 
 /* google_protobuf_EnumValueOptions getters. */
-bool google_protobuf_EnumValueOptions_deprecated(const google_protobuf_EnumValueOptions *msg);
+UPB_INLINE bool google_protobuf_EnumValueOptions_deprecated(const google_protobuf_EnumValueOptions *msg) {
+  return msg->deprecated;
+}
+UPB_INLINE bool google_protobuf_EnumValueOptions_has_deprecated(const google_protobuf_EnumValueOptions *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_EnumValueOptions_uninterpreted_option(const google_protobuf_EnumValueOptions *msg) {
+  return msg->uninterpreted_option;
+}
 
 /* google_protobuf_EnumValueOptions setters. */
-void google_protobuf_EnumValueOptions_set_deprecated(google_protobuf_EnumValueOptions *msg, bool value);
+UPB_INLINE void google_protobuf_EnumValueOptions_set_deprecated(google_protobuf_EnumValueOptions *msg, bool value) {
+  msg->deprecated = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_EnumValueOptions_set_uninterpreted_option(google_protobuf_EnumValueOptions *msg, upb_array* value) {
+  msg->uninterpreted_option = value;
+}
 
 
 /* google_protobuf_ServiceOptions message definition. */
+struct google_protobuf_ServiceOptions {
+  uint8_t _hasbits[1];
+  bool deprecated;
+  upb_array* uninterpreted_option;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_ServiceOptions_msginit;
 google_protobuf_ServiceOptions *google_protobuf_ServiceOptions_new(upb_env *env);
 google_protobuf_ServiceOptions *google_protobuf_ServiceOptions_parsenew(upb_stringview buf, upb_env *env);
@@ -434,13 +1249,33 @@ char *google_protobuf_ServiceOptions_serialize(google_protobuf_ServiceOptions *m
 void google_protobuf_ServiceOptions_free(google_protobuf_ServiceOptions *msg, upb_env *env);
 
 /* google_protobuf_ServiceOptions getters. */
-bool google_protobuf_ServiceOptions_deprecated(const google_protobuf_ServiceOptions *msg);
+UPB_INLINE bool google_protobuf_ServiceOptions_deprecated(const google_protobuf_ServiceOptions *msg) {
+  return msg->deprecated;
+}
+UPB_INLINE bool google_protobuf_ServiceOptions_has_deprecated(const google_protobuf_ServiceOptions *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_ServiceOptions_uninterpreted_option(const google_protobuf_ServiceOptions *msg) {
+  return msg->uninterpreted_option;
+}
 
 /* google_protobuf_ServiceOptions setters. */
-void google_protobuf_ServiceOptions_set_deprecated(google_protobuf_ServiceOptions *msg, bool value);
+UPB_INLINE void google_protobuf_ServiceOptions_set_deprecated(google_protobuf_ServiceOptions *msg, bool value) {
+  msg->deprecated = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_ServiceOptions_set_uninterpreted_option(google_protobuf_ServiceOptions *msg, upb_array* value) {
+  msg->uninterpreted_option = value;
+}
 
 
 /* google_protobuf_MethodOptions message definition. */
+struct google_protobuf_MethodOptions {
+  uint8_t _hasbits[1];
+  bool deprecated;
+  upb_array* uninterpreted_option;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_MethodOptions_msginit;
 google_protobuf_MethodOptions *google_protobuf_MethodOptions_new(upb_env *env);
 google_protobuf_MethodOptions *google_protobuf_MethodOptions_parsenew(upb_stringview buf, upb_env *env);
@@ -448,13 +1283,38 @@ char *google_protobuf_MethodOptions_serialize(google_protobuf_MethodOptions *msg
 void google_protobuf_MethodOptions_free(google_protobuf_MethodOptions *msg, upb_env *env);
 
 /* google_protobuf_MethodOptions getters. */
-bool google_protobuf_MethodOptions_deprecated(const google_protobuf_MethodOptions *msg);
+UPB_INLINE bool google_protobuf_MethodOptions_deprecated(const google_protobuf_MethodOptions *msg) {
+  return msg->deprecated;
+}
+UPB_INLINE bool google_protobuf_MethodOptions_has_deprecated(const google_protobuf_MethodOptions *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_MethodOptions_uninterpreted_option(const google_protobuf_MethodOptions *msg) {
+  return msg->uninterpreted_option;
+}
 
 /* google_protobuf_MethodOptions setters. */
-void google_protobuf_MethodOptions_set_deprecated(google_protobuf_MethodOptions *msg, bool value);
+UPB_INLINE void google_protobuf_MethodOptions_set_deprecated(google_protobuf_MethodOptions *msg, bool value) {
+  msg->deprecated = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_MethodOptions_set_uninterpreted_option(google_protobuf_MethodOptions *msg, upb_array* value) {
+  msg->uninterpreted_option = value;
+}
 
 
 /* google_protobuf_UninterpretedOption message definition. */
+struct google_protobuf_UninterpretedOption {
+  uint8_t _hasbits[1];
+  uint64_t positive_int_value;
+  int64_t negative_int_value;
+  double double_value;
+  upb_stringview identifier_value;
+  upb_stringview string_value;
+  upb_stringview aggregate_value;
+  upb_array* name;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_UninterpretedOption_msginit;
 google_protobuf_UninterpretedOption *google_protobuf_UninterpretedOption_new(upb_env *env);
 google_protobuf_UninterpretedOption *google_protobuf_UninterpretedOption_parsenew(upb_stringview buf, upb_env *env);
@@ -462,23 +1322,83 @@ char *google_protobuf_UninterpretedOption_serialize(google_protobuf_Uninterprete
 void google_protobuf_UninterpretedOption_free(google_protobuf_UninterpretedOption *msg, upb_env *env);
 
 /* google_protobuf_UninterpretedOption getters. */
-upb_stringview google_protobuf_UninterpretedOption_identifier_value(const google_protobuf_UninterpretedOption *msg);
-uint64_t google_protobuf_UninterpretedOption_positive_int_value(const google_protobuf_UninterpretedOption *msg);
-int64_t google_protobuf_UninterpretedOption_negative_int_value(const google_protobuf_UninterpretedOption *msg);
-double google_protobuf_UninterpretedOption_double_value(const google_protobuf_UninterpretedOption *msg);
-upb_stringview google_protobuf_UninterpretedOption_string_value(const google_protobuf_UninterpretedOption *msg);
-upb_stringview google_protobuf_UninterpretedOption_aggregate_value(const google_protobuf_UninterpretedOption *msg);
+UPB_INLINE upb_array* google_protobuf_UninterpretedOption_name(const google_protobuf_UninterpretedOption *msg) {
+  return msg->name;
+}
+UPB_INLINE upb_stringview google_protobuf_UninterpretedOption_identifier_value(const google_protobuf_UninterpretedOption *msg) {
+  return msg->identifier_value;
+}
+UPB_INLINE bool google_protobuf_UninterpretedOption_has_identifier_value(const google_protobuf_UninterpretedOption *msg) {
+  return (msg->_hasbits[0] & 0x08) != 0;
+}
+UPB_INLINE uint64_t google_protobuf_UninterpretedOption_positive_int_value(const google_protobuf_UninterpretedOption *msg) {
+  return msg->positive_int_value;
+}
+UPB_INLINE bool google_protobuf_UninterpretedOption_has_positive_int_value(const google_protobuf_UninterpretedOption *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE int64_t google_protobuf_UninterpretedOption_negative_int_value(const google_protobuf_UninterpretedOption *msg) {
+  return msg->negative_int_value;
+}
+UPB_INLINE bool google_protobuf_UninterpretedOption_has_negative_int_value(const google_protobuf_UninterpretedOption *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
+UPB_INLINE double google_protobuf_UninterpretedOption_double_value(const google_protobuf_UninterpretedOption *msg) {
+  return msg->double_value;
+}
+UPB_INLINE bool google_protobuf_UninterpretedOption_has_double_value(const google_protobuf_UninterpretedOption *msg) {
+  return (msg->_hasbits[0] & 0x04) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_UninterpretedOption_string_value(const google_protobuf_UninterpretedOption *msg) {
+  return msg->string_value;
+}
+UPB_INLINE bool google_protobuf_UninterpretedOption_has_string_value(const google_protobuf_UninterpretedOption *msg) {
+  return (msg->_hasbits[0] & 0x10) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_UninterpretedOption_aggregate_value(const google_protobuf_UninterpretedOption *msg) {
+  return msg->aggregate_value;
+}
+UPB_INLINE bool google_protobuf_UninterpretedOption_has_aggregate_value(const google_protobuf_UninterpretedOption *msg) {
+  return (msg->_hasbits[0] & 0x20) != 0;
+}
 
 /* google_protobuf_UninterpretedOption setters. */
-void google_protobuf_UninterpretedOption_set_identifier_value(google_protobuf_UninterpretedOption *msg, upb_stringview value);
-void google_protobuf_UninterpretedOption_set_positive_int_value(google_protobuf_UninterpretedOption *msg, uint64_t value);
-void google_protobuf_UninterpretedOption_set_negative_int_value(google_protobuf_UninterpretedOption *msg, int64_t value);
-void google_protobuf_UninterpretedOption_set_double_value(google_protobuf_UninterpretedOption *msg, double value);
-void google_protobuf_UninterpretedOption_set_string_value(google_protobuf_UninterpretedOption *msg, upb_stringview value);
-void google_protobuf_UninterpretedOption_set_aggregate_value(google_protobuf_UninterpretedOption *msg, upb_stringview value);
+UPB_INLINE void google_protobuf_UninterpretedOption_set_name(google_protobuf_UninterpretedOption *msg, upb_array* value) {
+  msg->name = value;
+}
+UPB_INLINE void google_protobuf_UninterpretedOption_set_identifier_value(google_protobuf_UninterpretedOption *msg, upb_stringview value) {
+  msg->identifier_value = value;
+  msg->_hasbits[0] |= 0x08;
+}
+UPB_INLINE void google_protobuf_UninterpretedOption_set_positive_int_value(google_protobuf_UninterpretedOption *msg, uint64_t value) {
+  msg->positive_int_value = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_UninterpretedOption_set_negative_int_value(google_protobuf_UninterpretedOption *msg, int64_t value) {
+  msg->negative_int_value = value;
+  msg->_hasbits[0] |= 0x02;
+}
+UPB_INLINE void google_protobuf_UninterpretedOption_set_double_value(google_protobuf_UninterpretedOption *msg, double value) {
+  msg->double_value = value;
+  msg->_hasbits[0] |= 0x04;
+}
+UPB_INLINE void google_protobuf_UninterpretedOption_set_string_value(google_protobuf_UninterpretedOption *msg, upb_stringview value) {
+  msg->string_value = value;
+  msg->_hasbits[0] |= 0x10;
+}
+UPB_INLINE void google_protobuf_UninterpretedOption_set_aggregate_value(google_protobuf_UninterpretedOption *msg, upb_stringview value) {
+  msg->aggregate_value = value;
+  msg->_hasbits[0] |= 0x20;
+}
 
 
 /* google_protobuf_UninterpretedOption_NamePart message definition. */
+struct google_protobuf_UninterpretedOption_NamePart {
+  uint8_t _hasbits[1];
+  bool is_extension;
+  upb_stringview name_part;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_UninterpretedOption_NamePart_msginit;
 google_protobuf_UninterpretedOption_NamePart *google_protobuf_UninterpretedOption_NamePart_new(upb_env *env);
 google_protobuf_UninterpretedOption_NamePart *google_protobuf_UninterpretedOption_NamePart_parsenew(upb_stringview buf, upb_env *env);
@@ -486,15 +1406,35 @@ char *google_protobuf_UninterpretedOption_NamePart_serialize(google_protobuf_Uni
 void google_protobuf_UninterpretedOption_NamePart_free(google_protobuf_UninterpretedOption_NamePart *msg, upb_env *env);
 
 /* google_protobuf_UninterpretedOption_NamePart getters. */
-upb_stringview google_protobuf_UninterpretedOption_NamePart_name_part(const google_protobuf_UninterpretedOption_NamePart *msg);
-bool google_protobuf_UninterpretedOption_NamePart_is_extension(const google_protobuf_UninterpretedOption_NamePart *msg);
+UPB_INLINE upb_stringview google_protobuf_UninterpretedOption_NamePart_name_part(const google_protobuf_UninterpretedOption_NamePart *msg) {
+  return msg->name_part;
+}
+UPB_INLINE bool google_protobuf_UninterpretedOption_NamePart_has_name_part(const google_protobuf_UninterpretedOption_NamePart *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
+UPB_INLINE bool google_protobuf_UninterpretedOption_NamePart_is_extension(const google_protobuf_UninterpretedOption_NamePart *msg) {
+  return msg->is_extension;
+}
+UPB_INLINE bool google_protobuf_UninterpretedOption_NamePart_has_is_extension(const google_protobuf_UninterpretedOption_NamePart *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
 
 /* google_protobuf_UninterpretedOption_NamePart setters. */
-void google_protobuf_UninterpretedOption_NamePart_set_name_part(google_protobuf_UninterpretedOption_NamePart *msg, upb_stringview value);
-void google_protobuf_UninterpretedOption_NamePart_set_is_extension(google_protobuf_UninterpretedOption_NamePart *msg, bool value);
+UPB_INLINE void google_protobuf_UninterpretedOption_NamePart_set_name_part(google_protobuf_UninterpretedOption_NamePart *msg, upb_stringview value) {
+  msg->name_part = value;
+  msg->_hasbits[0] |= 0x02;
+}
+UPB_INLINE void google_protobuf_UninterpretedOption_NamePart_set_is_extension(google_protobuf_UninterpretedOption_NamePart *msg, bool value) {
+  msg->is_extension = value;
+  msg->_hasbits[0] |= 0x01;
+}
 
 
 /* google_protobuf_SourceCodeInfo message definition. */
+struct google_protobuf_SourceCodeInfo {
+  upb_array* location;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_SourceCodeInfo_msginit;
 google_protobuf_SourceCodeInfo *google_protobuf_SourceCodeInfo_new(upb_env *env);
 google_protobuf_SourceCodeInfo *google_protobuf_SourceCodeInfo_parsenew(upb_stringview buf, upb_env *env);
@@ -502,11 +1442,26 @@ char *google_protobuf_SourceCodeInfo_serialize(google_protobuf_SourceCodeInfo *m
 void google_protobuf_SourceCodeInfo_free(google_protobuf_SourceCodeInfo *msg, upb_env *env);
 
 /* google_protobuf_SourceCodeInfo getters. */
+UPB_INLINE upb_array* google_protobuf_SourceCodeInfo_location(const google_protobuf_SourceCodeInfo *msg) {
+  return msg->location;
+}
 
 /* google_protobuf_SourceCodeInfo setters. */
+UPB_INLINE void google_protobuf_SourceCodeInfo_set_location(google_protobuf_SourceCodeInfo *msg, upb_array* value) {
+  msg->location = value;
+}
 
 
 /* google_protobuf_SourceCodeInfo_Location message definition. */
+struct google_protobuf_SourceCodeInfo_Location {
+  uint8_t _hasbits[1];
+  upb_stringview leading_comments;
+  upb_stringview trailing_comments;
+  upb_array* path;
+  upb_array* span;
+  upb_array* leading_detached_comments;
+};
+
 extern const upb_msglayout_msginit_v1 google_protobuf_SourceCodeInfo_Location_msginit;
 google_protobuf_SourceCodeInfo_Location *google_protobuf_SourceCodeInfo_Location_new(upb_env *env);
 google_protobuf_SourceCodeInfo_Location *google_protobuf_SourceCodeInfo_Location_parsenew(upb_stringview buf, upb_env *env);
@@ -514,14 +1469,1626 @@ char *google_protobuf_SourceCodeInfo_Location_serialize(google_protobuf_SourceCo
 void google_protobuf_SourceCodeInfo_Location_free(google_protobuf_SourceCodeInfo_Location *msg, upb_env *env);
 
 /* google_protobuf_SourceCodeInfo_Location getters. */
-upb_stringview google_protobuf_SourceCodeInfo_Location_leading_comments(const google_protobuf_SourceCodeInfo_Location *msg);
-upb_stringview google_protobuf_SourceCodeInfo_Location_trailing_comments(const google_protobuf_SourceCodeInfo_Location *msg);
+UPB_INLINE upb_array* google_protobuf_SourceCodeInfo_Location_path(const google_protobuf_SourceCodeInfo_Location *msg) {
+  return msg->path;
+}
+UPB_INLINE upb_array* google_protobuf_SourceCodeInfo_Location_span(const google_protobuf_SourceCodeInfo_Location *msg) {
+  return msg->span;
+}
+UPB_INLINE upb_stringview google_protobuf_SourceCodeInfo_Location_leading_comments(const google_protobuf_SourceCodeInfo_Location *msg) {
+  return msg->leading_comments;
+}
+UPB_INLINE bool google_protobuf_SourceCodeInfo_Location_has_leading_comments(const google_protobuf_SourceCodeInfo_Location *msg) {
+  return (msg->_hasbits[0] & 0x01) != 0;
+}
+UPB_INLINE upb_stringview google_protobuf_SourceCodeInfo_Location_trailing_comments(const google_protobuf_SourceCodeInfo_Location *msg) {
+  return msg->trailing_comments;
+}
+UPB_INLINE bool google_protobuf_SourceCodeInfo_Location_has_trailing_comments(const google_protobuf_SourceCodeInfo_Location *msg) {
+  return (msg->_hasbits[0] & 0x02) != 0;
+}
+UPB_INLINE upb_array* google_protobuf_SourceCodeInfo_Location_leading_detached_comments(const google_protobuf_SourceCodeInfo_Location *msg) {
+  return msg->leading_detached_comments;
+}
 
 /* google_protobuf_SourceCodeInfo_Location setters. */
-void google_protobuf_SourceCodeInfo_Location_set_leading_comments(google_protobuf_SourceCodeInfo_Location *msg, upb_stringview value);
-void google_protobuf_SourceCodeInfo_Location_set_trailing_comments(google_protobuf_SourceCodeInfo_Location *msg, upb_stringview value);
+UPB_INLINE void google_protobuf_SourceCodeInfo_Location_set_path(google_protobuf_SourceCodeInfo_Location *msg, upb_array* value) {
+  msg->path = value;
+}
+UPB_INLINE void google_protobuf_SourceCodeInfo_Location_set_span(google_protobuf_SourceCodeInfo_Location *msg, upb_array* value) {
+  msg->span = value;
+}
+UPB_INLINE void google_protobuf_SourceCodeInfo_Location_set_leading_comments(google_protobuf_SourceCodeInfo_Location *msg, upb_stringview value) {
+  msg->leading_comments = value;
+  msg->_hasbits[0] |= 0x01;
+}
+UPB_INLINE void google_protobuf_SourceCodeInfo_Location_set_trailing_comments(google_protobuf_SourceCodeInfo_Location *msg, upb_stringview value) {
+  msg->trailing_comments = value;
+  msg->_hasbits[0] |= 0x02;
+}
+UPB_INLINE void google_protobuf_SourceCodeInfo_Location_set_leading_detached_comments(google_protobuf_SourceCodeInfo_Location *msg, upb_array* value) {
+  msg->leading_detached_comments = value;
+}
 
 
 UPB_END_EXTERN_C
 
+#ifdef __cplusplus
+
+namespace google {
+namespace protobuf {
+
+class FileDescriptorSetView;
+class FileDescriptorSetMutView;
+class FileDescriptorProtoView;
+class FileDescriptorProtoMutView;
+class DescriptorProtoView;
+class DescriptorProtoMutView;
+class DescriptorProto_ExtensionRangeView;
+class DescriptorProto_ExtensionRangeMutView;
+class DescriptorProto_ReservedRangeView;
+class DescriptorProto_ReservedRangeMutView;
+class FieldDescriptorProtoView;
+class FieldDescriptorProtoMutView;
+class OneofDescriptorProtoView;
+class OneofDescriptorProtoMutView;
+class EnumDescriptorProtoView;
+class EnumDescriptorProtoMutView;
+class EnumValueDescriptorProtoView;
+class EnumValueDescriptorProtoMutView;
+class ServiceDescriptorProtoView;
+class ServiceDescriptorProtoMutView;
+class MethodDescriptorProtoView;
+class MethodDescriptorProtoMutView;
+class FileOptionsView;
+class FileOptionsMutView;
+class MessageOptionsView;
+class MessageOptionsMutView;
+class FieldOptionsView;
+class FieldOptionsMutView;
+class EnumOptionsView;
+class EnumOptionsMutView;
+class EnumValueOptionsView;
+class EnumValueOptionsMutView;
+class ServiceOptionsView;
+class ServiceOptionsMutView;
+class MethodOptionsView;
+class MethodOptionsMutView;
+class UninterpretedOptionView;
+class UninterpretedOptionMutView;
+class UninterpretedOption_NamePartView;
+class UninterpretedOption_NamePartMutView;
+class SourceCodeInfoView;
+class SourceCodeInfoMutView;
+class SourceCodeInfo_LocationView;
+class SourceCodeInfo_LocationMutView;
+
+/* google_protobuf_FileDescriptorSet views. */
+class FileDescriptorSetView {
+ public:
+  typedef google_protobuf_FileDescriptorSet CType;
+  typedef FileDescriptorSetMutView Mut;
+
+  FileDescriptorSetView() : msg_(NULL) {}
+  explicit FileDescriptorSetView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_FileDescriptorSet_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_FileDescriptorSet_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_FileDescriptorSet_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  inline ::upb::MessageArrayView<FileDescriptorProtoView> file() const;
+
+ protected:
+  const CType *msg_;
+};
+
+class FileDescriptorSetMutView : public FileDescriptorSetView {
+ public:
+  FileDescriptorSetMutView() {}
+  explicit FileDescriptorSetMutView(CType *msg) : FileDescriptorSetView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  inline ::upb::MessageArrayView<FileDescriptorProtoMutView> file() const;
+  void set_file(upb_array* value) const {
+    google_protobuf_FileDescriptorSet_set_file(ptr(), value);
+  }
+};
+
+/* google_protobuf_FileDescriptorProto views. */
+class FileDescriptorProtoView {
+ public:
+  typedef google_protobuf_FileDescriptorProto CType;
+  typedef FileDescriptorProtoMutView Mut;
+
+  FileDescriptorProtoView() : msg_(NULL) {}
+  explicit FileDescriptorProtoView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_FileDescriptorProto_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_FileDescriptorProto_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_FileDescriptorProto_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  ::upb::StringView name() const { return google_protobuf_FileDescriptorProto_name(msg_); }
+  bool has_name() const { return google_protobuf_FileDescriptorProto_has_name(msg_); }
+  ::upb::StringView package() const { return google_protobuf_FileDescriptorProto_package(msg_); }
+  bool has_package() const { return google_protobuf_FileDescriptorProto_has_package(msg_); }
+  ::upb::ArrayView< ::upb::StringView> dependency() const { return google_protobuf_FileDescriptorProto_dependency(msg_); }
+  inline ::upb::MessageArrayView<DescriptorProtoView> message_type() const;
+  inline ::upb::MessageArrayView<EnumDescriptorProtoView> enum_type() const;
+  inline ::upb::MessageArrayView<ServiceDescriptorProtoView> service() const;
+  inline ::upb::MessageArrayView<FieldDescriptorProtoView> extension() const;
+  inline FileOptionsView options() const;
+  bool has_options() const { return google_protobuf_FileDescriptorProto_has_options(msg_); }
+  inline SourceCodeInfoView source_code_info() const;
+  bool has_source_code_info() const { return google_protobuf_FileDescriptorProto_has_source_code_info(msg_); }
+  ::upb::ArrayView<int32_t> public_dependency() const { return google_protobuf_FileDescriptorProto_public_dependency(msg_); }
+  ::upb::ArrayView<int32_t> weak_dependency() const { return google_protobuf_FileDescriptorProto_weak_dependency(msg_); }
+  ::upb::StringView syntax() const { return google_protobuf_FileDescriptorProto_syntax(msg_); }
+  bool has_syntax() const { return google_protobuf_FileDescriptorProto_has_syntax(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class FileDescriptorProtoMutView : public FileDescriptorProtoView {
+ public:
+  FileDescriptorProtoMutView() {}
+  explicit FileDescriptorProtoMutView(CType *msg) : FileDescriptorProtoView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_name(::upb::StringView value) const {
+    google_protobuf_FileDescriptorProto_set_name(ptr(), value);
+  }
+  void set_package(::upb::StringView value) const {
+    google_protobuf_FileDescriptorProto_set_package(ptr(), value);
+  }
+  void set_dependency(upb_array* value) const {
+    google_protobuf_FileDescriptorProto_set_dependency(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<DescriptorProtoMutView> message_type() const;
+  void set_message_type(upb_array* value) const {
+    google_protobuf_FileDescriptorProto_set_message_type(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<EnumDescriptorProtoMutView> enum_type() const;
+  void set_enum_type(upb_array* value) const {
+    google_protobuf_FileDescriptorProto_set_enum_type(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<ServiceDescriptorProtoMutView> service() const;
+  void set_service(upb_array* value) const {
+    google_protobuf_FileDescriptorProto_set_service(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<FieldDescriptorProtoMutView> extension() const;
+  void set_extension(upb_array* value) const {
+    google_protobuf_FileDescriptorProto_set_extension(ptr(), value);
+  }
+  inline FileOptionsMutView options() const;
+  inline void set_options(FileOptionsMutView value) const;
+  inline SourceCodeInfoMutView source_code_info() const;
+  inline void set_source_code_info(SourceCodeInfoMutView value) const;
+  void set_public_dependency(upb_array* value) const {
+    google_protobuf_FileDescriptorProto_set_public_dependency(ptr(), value);
+  }
+  void set_weak_dependency(upb_array* value) const {
+    google_protobuf_FileDescriptorProto_set_weak_dependency(ptr(), value);
+  }
+  void set_syntax(::upb::StringView value) const {
+    google_protobuf_FileDescriptorProto_set_syntax(ptr(), value);
+  }
+};
+
+/* google_protobuf_DescriptorProto views. */
+class DescriptorProtoView {
+ public:
+  typedef google_protobuf_DescriptorProto CType;
+  typedef DescriptorProtoMutView Mut;
+
+  DescriptorProtoView() : msg_(NULL) {}
+  explicit DescriptorProtoView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_DescriptorProto_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_DescriptorProto_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_DescriptorProto_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  ::upb::StringView name() const { return google_protobuf_DescriptorProto_name(msg_); }
+  bool has_name() const { return google_protobuf_DescriptorProto_has_name(msg_); }
+  inline ::upb::MessageArrayView<FieldDescriptorProtoView> field() const;
+  inline ::upb::MessageArrayView<DescriptorProtoView> nested_type() const;
+  inline ::upb::MessageArrayView<EnumDescriptorProtoView> enum_type() const;
+  inline ::upb::MessageArrayView<DescriptorProto_ExtensionRangeView> extension_range() const;
+  inline ::upb::MessageArrayView<FieldDescriptorProtoView> extension() const;
+  inline MessageOptionsView options() const;
+  bool has_options() const { return google_protobuf_DescriptorProto_has_options(msg_); }
+  inline ::upb::MessageArrayView<OneofDescriptorProtoView> oneof_decl() const;
+  inline ::upb::MessageArrayView<DescriptorProto_ReservedRangeView> reserved_range() const;
+  ::upb::ArrayView< ::upb::StringView> reserved_name() const { return google_protobuf_DescriptorProto_reserved_name(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class DescriptorProtoMutView : public DescriptorProtoView {
+ public:
+  DescriptorProtoMutView() {}
+  explicit DescriptorProtoMutView(CType *msg) : DescriptorProtoView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_name(::upb::StringView value) const {
+    google_protobuf_DescriptorProto_set_name(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<FieldDescriptorProtoMutView> field() const;
+  void set_field(upb_array* value) const {
+    google_protobuf_DescriptorProto_set_field(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<DescriptorProtoMutView> nested_type() const;
+  void set_nested_type(upb_array* value) const {
+    google_protobuf_DescriptorProto_set_nested_type(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<EnumDescriptorProtoMutView> enum_type() const;
+  void set_enum_type(upb_array* value) const {
+    google_protobuf_DescriptorProto_set_enum_type(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<DescriptorProto_ExtensionRangeMutView> extension_range() const;
+  void set_extension_range(upb_array* value) const {
+    google_protobuf_DescriptorProto_set_extension_range(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<FieldDescriptorProtoMutView> extension() const;
+  void set_extension(upb_array* value) const {
+    google_protobuf_DescriptorProto_set_extension(ptr(), value);
+  }
+  inline MessageOptionsMutView options() const;
+  inline void set_options(MessageOptionsMutView value) const;
+  inline ::upb::MessageArrayView<OneofDescriptorProtoMutView> oneof_decl() const;
+  void set_oneof_decl(upb_array* value) const {
+    google_protobuf_DescriptorProto_set_oneof_decl(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<DescriptorProto_ReservedRangeMutView> reserved_range() const;
+  void set_reserved_range(upb_array* value) const {
+    google_protobuf_DescriptorProto_set_reserved_range(ptr(), value);
+  }
+  void set_reserved_name(upb_array* value) const {
+    google_protobuf_DescriptorProto_set_reserved_name(ptr(), value);
+  }
+};
+
+/* google_protobuf_DescriptorProto_ExtensionRange views. */
+class DescriptorProto_ExtensionRangeView {
+ public:
+  typedef google_protobuf_DescriptorProto_ExtensionRange CType;
+  typedef DescriptorProto_ExtensionRangeMutView Mut;
+
+  DescriptorProto_ExtensionRangeView() : msg_(NULL) {}
+  explicit DescriptorProto_ExtensionRangeView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_DescriptorProto_ExtensionRange_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_DescriptorProto_ExtensionRange_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_DescriptorProto_ExtensionRange_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  int32_t start() const { return google_protobuf_DescriptorProto_ExtensionRange_start(msg_); }
+  bool has_start() const { return google_protobuf_DescriptorProto_ExtensionRange_has_start(msg_); }
+  int32_t end() const { return google_protobuf_DescriptorProto_ExtensionRange_end(msg_); }
+  bool has_end() const { return google_protobuf_DescriptorProto_ExtensionRange_has_end(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class DescriptorProto_ExtensionRangeMutView : public DescriptorProto_ExtensionRangeView {
+ public:
+  DescriptorProto_ExtensionRangeMutView() {}
+  explicit DescriptorProto_ExtensionRangeMutView(CType *msg) : DescriptorProto_ExtensionRangeView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_start(int32_t value) const {
+    google_protobuf_DescriptorProto_ExtensionRange_set_start(ptr(), value);
+  }
+  void set_end(int32_t value) const {
+    google_protobuf_DescriptorProto_ExtensionRange_set_end(ptr(), value);
+  }
+};
+
+/* google_protobuf_DescriptorProto_ReservedRange views. */
+class DescriptorProto_ReservedRangeView {
+ public:
+  typedef google_protobuf_DescriptorProto_ReservedRange CType;
+  typedef DescriptorProto_ReservedRangeMutView Mut;
+
+  DescriptorProto_ReservedRangeView() : msg_(NULL) {}
+  explicit DescriptorProto_ReservedRangeView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_DescriptorProto_ReservedRange_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_DescriptorProto_ReservedRange_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_DescriptorProto_ReservedRange_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  int32_t start() const { return google_protobuf_DescriptorProto_ReservedRange_start(msg_); }
+  bool has_start() const { return google_protobuf_DescriptorProto_ReservedRange_has_start(msg_); }
+  int32_t end() const { return google_protobuf_DescriptorProto_ReservedRange_end(msg_); }
+  bool has_end() const { return google_protobuf_DescriptorProto_ReservedRange_has_end(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class DescriptorProto_ReservedRangeMutView : public DescriptorProto_ReservedRangeView {
+ public:
+  DescriptorProto_ReservedRangeMutView() {}
+  explicit DescriptorProto_ReservedRangeMutView(CType *msg) : DescriptorProto_ReservedRangeView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_start(int32_t value) const {
+    google_protobuf_DescriptorProto_ReservedRange_set_start(ptr(), value);
+  }
+  void set_end(int32_t value) const {
+    google_protobuf_DescriptorProto_ReservedRange_set_end(ptr(), value);
+  }
+};
+
+/* google_protobuf_FieldDescriptorProto views. */
+class FieldDescriptorProtoView {
+ public:
+  typedef google_protobuf_FieldDescriptorProto CType;
+  typedef FieldDescriptorProtoMutView Mut;
+
+  FieldDescriptorProtoView() : msg_(NULL) {}
+  explicit FieldDescriptorProtoView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_FieldDescriptorProto_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_FieldDescriptorProto_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_FieldDescriptorProto_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  ::upb::StringView name() const { return google_protobuf_FieldDescriptorProto_name(msg_); }
+  bool has_name() const { return google_protobuf_FieldDescriptorProto_has_name(msg_); }
+  ::upb::StringView extendee() const { return google_protobuf_FieldDescriptorProto_extendee(msg_); }
+  bool has_extendee() const { return google_protobuf_FieldDescriptorProto_has_extendee(msg_); }
+  int32_t number() const { return google_protobuf_FieldDescriptorProto_number(msg_); }
+  bool has_number() const { return google_protobuf_FieldDescriptorProto_has_number(msg_); }
+  google_protobuf_FieldDescriptorProto_Label label() const { return google_protobuf_FieldDescriptorProto_label(msg_); }
+  bool has_label() const { return google_protobuf_FieldDescriptorProto_has_label(msg_); }
+  google_protobuf_FieldDescriptorProto_Type type() const { return google_protobuf_FieldDescriptorProto_type(msg_); }
+  bool has_type() const { return google_protobuf_FieldDescriptorProto_has_type(msg_); }
+  ::upb::StringView type_name() const { return google_protobuf_FieldDescriptorProto_type_name(msg_); }
+  bool has_type_name() const { return google_protobuf_FieldDescriptorProto_has_type_name(msg_); }
+  ::upb::StringView default_value() const { return google_protobuf_FieldDescriptorProto_default_value(msg_); }
+  bool has_default_value() const { return google_protobuf_FieldDescriptorProto_has_default_value(msg_); }
+  inline FieldOptionsView options() const;
+  bool has_options() const { return google_protobuf_FieldDescriptorProto_has_options(msg_); }
+  int32_t oneof_index() const { return google_protobuf_FieldDescriptorProto_oneof_index(msg_); }
+  bool has_oneof_index() const { return google_protobuf_FieldDescriptorProto_has_oneof_index(msg_); }
+  ::upb::StringView json_name() const { return google_protobuf_FieldDescriptorProto_json_name(msg_); }
+  bool has_json_name() const { return google_protobuf_FieldDescriptorProto_has_json_name(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class FieldDescriptorProtoMutView : public FieldDescriptorProtoView {
+ public:
+  FieldDescriptorProtoMutView() {}
+  explicit FieldDescriptorProtoMutView(CType *msg) : FieldDescriptorProtoView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_name(::upb::StringView value) const {
+    google_protobuf_FieldDescriptorProto_set_name(ptr(), value);
+  }
+  void set_extendee(::upb::StringView value) const {
+    google_protobuf_FieldDescriptorProto_set_extendee(ptr(), value);
+  }
+  void set_number(int32_t value) const {
+    google_protobuf_FieldDescriptorProto_set_number(ptr(), value);
+  }
+  void set_label(google_protobuf_FieldDescriptorProto_Label value) const {
+    google_protobuf_FieldDescriptorProto_set_label(ptr(), value);
+  }
+  void set_type(google_protobuf_FieldDescriptorProto_Type value) const {
+    google_protobuf_FieldDescriptorProto_set_type(ptr(), value);
+  }
+  void set_type_name(::upb::StringView value) const {
+    google_protobuf_FieldDescriptorProto_set_type_name(ptr(), value);
+  }
+  void set_default_value(::upb::StringView value) const {
+    google_protobuf_FieldDescriptorProto_set_default_value(ptr(), value);
+  }
+  inline FieldOptionsMutView options() const;
+  inline void set_options(FieldOptionsMutView value) const;
+  void set_oneof_index(int32_t value) const {
+    google_protobuf_FieldDescriptorProto_set_oneof_index(ptr(), value);
+  }
+  void set_json_name(::upb::StringView value) const {
+    google_protobuf_FieldDescriptorProto_set_json_name(ptr(), value);
+  }
+};
+
+/* google_protobuf_OneofDescriptorProto views. */
+class OneofDescriptorProtoView {
+ public:
+  typedef google_protobuf_OneofDescriptorProto CType;
+  typedef OneofDescriptorProtoMutView Mut;
+
+  OneofDescriptorProtoView() : msg_(NULL) {}
+  explicit OneofDescriptorProtoView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_OneofDescriptorProto_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_OneofDescriptorProto_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_OneofDescriptorProto_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  ::upb::StringView name() const { return google_protobuf_OneofDescriptorProto_name(msg_); }
+  bool has_name() const { return google_protobuf_OneofDescriptorProto_has_name(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class OneofDescriptorProtoMutView : public OneofDescriptorProtoView {
+ public:
+  OneofDescriptorProtoMutView() {}
+  explicit OneofDescriptorProtoMutView(CType *msg) : OneofDescriptorProtoView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_name(::upb::StringView value) const {
+    google_protobuf_OneofDescriptorProto_set_name(ptr(), value);
+  }
+};
+
+/* google_protobuf_EnumDescriptorProto views. */
+class EnumDescriptorProtoView {
+ public:
+  typedef google_protobuf_EnumDescriptorProto CType;
+  typedef EnumDescriptorProtoMutView Mut;
+
+  EnumDescriptorProtoView() : msg_(NULL) {}
+  explicit EnumDescriptorProtoView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_EnumDescriptorProto_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_EnumDescriptorProto_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_EnumDescriptorProto_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  ::upb::StringView name() const { return google_protobuf_EnumDescriptorProto_name(msg_); }
+  bool has_name() const { return google_protobuf_EnumDescriptorProto_has_name(msg_); }
+  inline ::upb::MessageArrayView<EnumValueDescriptorProtoView> value() const;
+  inline EnumOptionsView options() const;
+  bool has_options() const { return google_protobuf_EnumDescriptorProto_has_options(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class EnumDescriptorProtoMutView : public EnumDescriptorProtoView {
+ public:
+  EnumDescriptorProtoMutView() {}
+  explicit EnumDescriptorProtoMutView(CType *msg) : EnumDescriptorProtoView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_name(::upb::StringView value) const {
+    google_protobuf_EnumDescriptorProto_set_name(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<EnumValueDescriptorProtoMutView> value() const;
+  void set_value(upb_array* value) const {
+    google_protobuf_EnumDescriptorProto_set_value(ptr(), value);
+  }
+  inline EnumOptionsMutView options() const;
+  inline void set_options(EnumOptionsMutView value) const;
+};
+
+/* google_protobuf_EnumValueDescriptorProto views. */
+class EnumValueDescriptorProtoView {
+ public:
+  typedef google_protobuf_EnumValueDescriptorProto CType;
+  typedef EnumValueDescriptorProtoMutView Mut;
+
+  EnumValueDescriptorProtoView() : msg_(NULL) {}
+  explicit EnumValueDescriptorProtoView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_EnumValueDescriptorProto_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_EnumValueDescriptorProto_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_EnumValueDescriptorProto_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  ::upb::StringView name() const { return google_protobuf_EnumValueDescriptorProto_name(msg_); }
+  bool has_name() const { return google_protobuf_EnumValueDescriptorProto_has_name(msg_); }
+  int32_t number() const { return google_protobuf_EnumValueDescriptorProto_number(msg_); }
+  bool has_number() const { return google_protobuf_EnumValueDescriptorProto_has_number(msg_); }
+  inline EnumValueOptionsView options() const;
+  bool has_options() const { return google_protobuf_EnumValueDescriptorProto_has_options(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class EnumValueDescriptorProtoMutView : public EnumValueDescriptorProtoView {
+ public:
+  EnumValueDescriptorProtoMutView() {}
+  explicit EnumValueDescriptorProtoMutView(CType *msg) : EnumValueDescriptorProtoView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_name(::upb::StringView value) const {
+    google_protobuf_EnumValueDescriptorProto_set_name(ptr(), value);
+  }
+  void set_number(int32_t value) const {
+    google_protobuf_EnumValueDescriptorProto_set_number(ptr(), value);
+  }
+  inline EnumValueOptionsMutView options() const;
+  inline void set_options(EnumValueOptionsMutView value) const;
+};
+
+/* google_protobuf_ServiceDescriptorProto views. */
+class ServiceDescriptorProtoView {
+ public:
+  typedef google_protobuf_ServiceDescriptorProto CType;
+  typedef ServiceDescriptorProtoMutView Mut;
+
+  ServiceDescriptorProtoView() : msg_(NULL) {}
+  explicit ServiceDescriptorProtoView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_ServiceDescriptorProto_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_ServiceDescriptorProto_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_ServiceDescriptorProto_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  ::upb::StringView name() const { return google_protobuf_ServiceDescriptorProto_name(msg_); }
+  bool has_name() const { return google_protobuf_ServiceDescriptorProto_has_name(msg_); }
+  inline ::upb::MessageArrayView<MethodDescriptorProtoView> method() const;
+  inline ServiceOptionsView options() const;
+  bool has_options() const { return google_protobuf_ServiceDescriptorProto_has_options(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class ServiceDescriptorProtoMutView : public ServiceDescriptorProtoView {
+ public:
+  ServiceDescriptorProtoMutView() {}
+  explicit ServiceDescriptorProtoMutView(CType *msg) : ServiceDescriptorProtoView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_name(::upb::StringView value) const {
+    google_protobuf_ServiceDescriptorProto_set_name(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<MethodDescriptorProtoMutView> method() const;
+  void set_method(upb_array* value) const {
+    google_protobuf_ServiceDescriptorProto_set_method(ptr(), value);
+  }
+  inline ServiceOptionsMutView options() const;
+  inline void set_options(ServiceOptionsMutView value) const;
+};
+
+/* google_protobuf_MethodDescriptorProto views. */
+class MethodDescriptorProtoView {
+ public:
+  typedef google_protobuf_MethodDescriptorProto CType;
+  typedef MethodDescriptorProtoMutView Mut;
+
+  MethodDescriptorProtoView() : msg_(NULL) {}
+  explicit MethodDescriptorProtoView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_MethodDescriptorProto_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_MethodDescriptorProto_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_MethodDescriptorProto_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  ::upb::StringView name() const { return google_protobuf_MethodDescriptorProto_name(msg_); }
+  bool has_name() const { return google_protobuf_MethodDescriptorProto_has_name(msg_); }
+  ::upb::StringView input_type() const { return google_protobuf_MethodDescriptorProto_input_type(msg_); }
+  bool has_input_type() const { return google_protobuf_MethodDescriptorProto_has_input_type(msg_); }
+  ::upb::StringView output_type() const { return google_protobuf_MethodDescriptorProto_output_type(msg_); }
+  bool has_output_type() const { return google_protobuf_MethodDescriptorProto_has_output_type(msg_); }
+  inline MethodOptionsView options() const;
+  bool has_options() const { return google_protobuf_MethodDescriptorProto_has_options(msg_); }
+  bool client_streaming() const { return google_protobuf_MethodDescriptorProto_client_streaming(msg_); }
+  bool has_client_streaming() const { return google_protobuf_MethodDescriptorProto_has_client_streaming(msg_); }
+  bool server_streaming() const { return google_protobuf_MethodDescriptorProto_server_streaming(msg_); }
+  bool has_server_streaming() const { return google_protobuf_MethodDescriptorProto_has_server_streaming(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class MethodDescriptorProtoMutView : public MethodDescriptorProtoView {
+ public:
+  MethodDescriptorProtoMutView() {}
+  explicit MethodDescriptorProtoMutView(CType *msg) : MethodDescriptorProtoView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_name(::upb::StringView value) const {
+    google_protobuf_MethodDescriptorProto_set_name(ptr(), value);
+  }
+  void set_input_type(::upb::StringView value) const {
+    google_protobuf_MethodDescriptorProto_set_input_type(ptr(), value);
+  }
+  void set_output_type(::upb::StringView value) const {
+    google_protobuf_MethodDescriptorProto_set_output_type(ptr(), value);
+  }
+  inline MethodOptionsMutView options() const;
+  inline void set_options(MethodOptionsMutView value) const;
+  void set_client_streaming(bool value) const {
+    google_protobuf_MethodDescriptorProto_set_client_streaming(ptr(), value);
+  }
+  void set_server_streaming(bool value) const {
+    google_protobuf_MethodDescriptorProto_set_server_streaming(ptr(), value);
+  }
+};
+
+/* google_protobuf_FileOptions views. */
+class FileOptionsView {
+ public:
+  typedef google_protobuf_FileOptions CType;
+  typedef FileOptionsMutView Mut;
+
+  FileOptionsView() : msg_(NULL) {}
+  explicit FileOptionsView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_FileOptions_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_FileOptions_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_FileOptions_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  ::upb::StringView java_package() const { return google_protobuf_FileOptions_java_package(msg_); }
+  bool has_java_package() const { return google_protobuf_FileOptions_has_java_package(msg_); }
+  ::upb::StringView java_outer_classname() const { return google_protobuf_FileOptions_java_outer_classname(msg_); }
+  bool has_java_outer_classname() const { return google_protobuf_FileOptions_has_java_outer_classname(msg_); }
+  google_protobuf_FileOptions_OptimizeMode optimize_for() const { return google_protobuf_FileOptions_optimize_for(msg_); }
+  bool has_optimize_for() const { return google_protobuf_FileOptions_has_optimize_for(msg_); }
+  bool java_multiple_files() const { return google_protobuf_FileOptions_java_multiple_files(msg_); }
+  bool has_java_multiple_files() const { return google_protobuf_FileOptions_has_java_multiple_files(msg_); }
+  ::upb::StringView go_package() const { return google_protobuf_FileOptions_go_package(msg_); }
+  bool has_go_package() const { return google_protobuf_FileOptions_has_go_package(msg_); }
+  bool cc_generic_services() const { return google_protobuf_FileOptions_cc_generic_services(msg_); }
+  bool has_cc_generic_services() const { return google_protobuf_FileOptions_has_cc_generic_services(msg_); }
+  bool java_generic_services() const { return google_protobuf_FileOptions_java_generic_services(msg_); }
+  bool has_java_generic_services() const { return google_protobuf_FileOptions_has_java_generic_services(msg_); }
+  bool py_generic_services() const { return google_protobuf_FileOptions_py_generic_services(msg_); }
+  bool has_py_generic_services() const { return google_protobuf_FileOptions_has_py_generic_services(msg_); }
+  bool java_generate_equals_and_hash() const { return google_protobuf_FileOptions_java_generate_equals_and_hash(msg_); }
+  bool has_java_generate_equals_and_hash() const { return google_protobuf_FileOptions_has_java_generate_equals_and_hash(msg_); }
+  bool deprecated() const { return google_protobuf_FileOptions_deprecated(msg_); }
+  bool has_deprecated() const { return google_protobuf_FileOptions_has_deprecated(msg_); }
+  bool java_string_check_utf8() const { return google_protobuf_FileOptions_java_string_check_utf8(msg_); }
+  bool has_java_string_check_utf8() const { return google_protobuf_FileOptions_has_java_string_check_utf8(msg_); }
+  bool cc_enable_arenas() const { return google_protobuf_FileOptions_cc_enable_arenas(msg_); }
+  bool has_cc_enable_arenas() const { return google_protobuf_FileOptions_has_cc_enable_arenas(msg_); }
+  ::upb::StringView objc_class_prefix() const { return google_protobuf_FileOptions_objc_class_prefix(msg_); }
+  bool has_objc_class_prefix() const { return google_protobuf_FileOptions_has_objc_class_prefix(msg_); }
+  ::upb::StringView csharp_namespace() const { return google_protobuf_FileOptions_csharp_namespace(msg_); }
+  bool has_csharp_namespace() const { return google_protobuf_FileOptions_has_csharp_namespace(msg_); }
+  bool javanano_use_deprecated_package() const { return google_protobuf_FileOptions_javanano_use_deprecated_package(msg_); }
+  bool has_javanano_use_deprecated_package() const { return google_protobuf_FileOptions_has_javanano_use_deprecated_package(msg_); }
+  ::upb::StringView php_class_prefix() const { return google_protobuf_FileOptions_php_class_prefix(msg_); }
+  bool has_php_class_prefix() const { return google_protobuf_FileOptions_has_php_class_prefix(msg_); }
+  ::upb::StringView php_namespace() const { return google_protobuf_FileOptions_php_namespace(msg_); }
+  bool has_php_namespace() const { return google_protobuf_FileOptions_has_php_namespace(msg_); }
+  inline ::upb::MessageArrayView<UninterpretedOptionView> uninterpreted_option() const;
+
+ protected:
+  const CType *msg_;
+};
+
+class FileOptionsMutView : public FileOptionsView {
+ public:
+  FileOptionsMutView() {}
+  explicit FileOptionsMutView(CType *msg) : FileOptionsView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_java_package(::upb::StringView value) const {
+    google_protobuf_FileOptions_set_java_package(ptr(), value);
+  }
+  void set_java_outer_classname(::upb::StringView value) const {
+    google_protobuf_FileOptions_set_java_outer_classname(ptr(), value);
+  }
+  void set_optimize_for(google_protobuf_FileOptions_OptimizeMode value) const {
+    google_protobuf_FileOptions_set_optimize_for(ptr(), value);
+  }
+  void set_java_multiple_files(bool value) const {
+    google_protobuf_FileOptions_set_java_multiple_files(ptr(), value);
+  }
+  void set_go_package(::upb::StringView value) const {
+    google_protobuf_FileOptions_set_go_package(ptr(), value);
+  }
+  void set_cc_generic_services(bool value) const {
+    google_protobuf_FileOptions_set_cc_generic_services(ptr(), value);
+  }
+  void set_java_generic_services(bool value) const {
+    google_protobuf_FileOptions_set_java_generic_services(ptr(), value);
+  }
+  void set_py_generic_services(bool value) const {
+    google_protobuf_FileOptions_set_py_generic_services(ptr(), value);
+  }
+  void set_java_generate_equals_and_hash(bool value) const {
+    google_protobuf_FileOptions_set_java_generate_equals_and_hash(ptr(), value);
+  }
+  void set_deprecated(bool value) const {
+    google_protobuf_FileOptions_set_deprecated(ptr(), value);
+  }
+  void set_java_string_check_utf8(bool value) const {
+    google_protobuf_FileOptions_set_java_string_check_utf8(ptr(), value);
+  }
+  void set_cc_enable_arenas(bool value) const {
+    google_protobuf_FileOptions_set_cc_enable_arenas(ptr(), value);
+  }
+  void set_objc_class_prefix(::upb::StringView value) const {
+    google_protobuf_FileOptions_set_objc_class_prefix(ptr(), value);
+  }
+  void set_csharp_namespace(::upb::StringView value) const {
+    google_protobuf_FileOptions_set_csharp_namespace(ptr(), value);
+  }
+  void set_javanano_use_deprecated_package(bool value) const {
+    google_protobuf_FileOptions_set_javanano_use_deprecated_package(ptr(), value);
+  }
+  void set_php_class_prefix(::upb::StringView value) const {
+    google_protobuf_FileOptions_set_php_class_prefix(ptr(), value);
+  }
+  void set_php_namespace(::upb::StringView value) const {
+    google_protobuf_FileOptions_set_php_namespace(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<UninterpretedOptionMutView> uninterpreted_option() const;
+  void set_uninterpreted_option(upb_array* value) const {
+    google_protobuf_FileOptions_set_uninterpreted_option(ptr(), value);
+  }
+};
+
+/* google_protobuf_MessageOptions views. */
+class MessageOptionsView {
+ public:
+  typedef google_protobuf_MessageOptions CType;
+  typedef MessageOptionsMutView Mut;
+
+  MessageOptionsView() : msg_(NULL) {}
+  explicit MessageOptionsView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_MessageOptions_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_MessageOptions_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_MessageOptions_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  bool message_set_wire_format() const { return google_protobuf_MessageOptions_message_set_wire_format(msg_); }
+  bool has_message_set_wire_format() const { return google_protobuf_MessageOptions_has_message_set_wire_format(msg_); }
+  bool no_standard_descriptor_accessor() const { return google_protobuf_MessageOptions_no_standard_descriptor_accessor(msg_); }
+  bool has_no_standard_descriptor_accessor() const { return google_protobuf_MessageOptions_has_no_standard_descriptor_accessor(msg_); }
+  bool deprecated() const { return google_protobuf_MessageOptions_deprecated(msg_); }
+  bool has_deprecated() const { return google_protobuf_MessageOptions_has_deprecated(msg_); }
+  bool map_entry() const { return google_protobuf_MessageOptions_map_entry(msg_); }
+  bool has_map_entry() const { return google_protobuf_MessageOptions_has_map_entry(msg_); }
+  inline ::upb::MessageArrayView<UninterpretedOptionView> uninterpreted_option() const;
+
+ protected:
+  const CType *msg_;
+};
+
+class MessageOptionsMutView : public MessageOptionsView {
+ public:
+  MessageOptionsMutView() {}
+  explicit MessageOptionsMutView(CType *msg) : MessageOptionsView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_message_set_wire_format(bool value) const {
+    google_protobuf_MessageOptions_set_message_set_wire_format(ptr(), value);
+  }
+  void set_no_standard_descriptor_accessor(bool value) const {
+    google_protobuf_MessageOptions_set_no_standard_descriptor_accessor(ptr(), value);
+  }
+  void set_deprecated(bool value) const {
+    google_protobuf_MessageOptions_set_deprecated(ptr(), value);
+  }
+  void set_map_entry(bool value) const {
+    google_protobuf_MessageOptions_set_map_entry(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<UninterpretedOptionMutView> uninterpreted_option() const;
+  void set_uninterpreted_option(upb_array* value) const {
+    google_protobuf_MessageOptions_set_uninterpreted_option(ptr(), value);
+  }
+};
+
+/* google_protobuf_FieldOptions views. */
+class FieldOptionsView {
+ public:
+  typedef google_protobuf_FieldOptions CType;
+  typedef FieldOptionsMutView Mut;
+
+  FieldOptionsView() : msg_(NULL) {}
+  explicit FieldOptionsView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_FieldOptions_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_FieldOptions_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_FieldOptions_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  google_protobuf_FieldOptions_CType ctype() const { return google_protobuf_FieldOptions_ctype(msg_); }
+  bool has_ctype() const { return google_protobuf_FieldOptions_has_ctype(msg_); }
+  bool packed() const { return google_protobuf_FieldOptions_packed(msg_); }
+  bool has_packed() const { return google_protobuf_FieldOptions_has_packed(msg_); }
+  bool deprecated() const { return google_protobuf_FieldOptions_deprecated(msg_); }
+  bool has_deprecated() const { return google_protobuf_FieldOptions_has_deprecated(msg_); }
+  bool lazy() const { return google_protobuf_FieldOptions_lazy(msg_); }
+  bool has_lazy() const { return google_protobuf_FieldOptions_has_lazy(msg_); }
+  google_protobuf_FieldOptions_JSType jstype() const { return google_protobuf_FieldOptions_jstype(msg_); }
+  bool has_jstype() const { return google_protobuf_FieldOptions_has_jstype(msg_); }
+  bool weak() const { return google_protobuf_FieldOptions_weak(msg_); }
+  bool has_weak() const { return google_protobuf_FieldOptions_has_weak(msg_); }
+  inline ::upb::MessageArrayView<UninterpretedOptionView> uninterpreted_option() const;
+
+ protected:
+  const CType *msg_;
+};
+
+class FieldOptionsMutView : public FieldOptionsView {
+ public:
+  FieldOptionsMutView() {}
+  explicit FieldOptionsMutView(CType *msg) : FieldOptionsView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_ctype(google_protobuf_FieldOptions_CType value) const {
+    google_protobuf_FieldOptions_set_ctype(ptr(), value);
+  }
+  void set_packed(bool value) const {
+    google_protobuf_FieldOptions_set_packed(ptr(), value);
+  }
+  void set_deprecated(bool value) const {
+    google_protobuf_FieldOptions_set_deprecated(ptr(), value);
+  }
+  void set_lazy(bool value) const {
+    google_protobuf_FieldOptions_set_lazy(ptr(), value);
+  }
+  void set_jstype(google_protobuf_FieldOptions_JSType value) const {
+    google_protobuf_FieldOptions_set_jstype(ptr(), value);
+  }
+  void set_weak(bool value) const {
+    google_protobuf_FieldOptions_set_weak(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<UninterpretedOptionMutView> uninterpreted_option() const;
+  void set_uninterpreted_option(upb_array* value) const {
+    google_protobuf_FieldOptions_set_uninterpreted_option(ptr(), value);
+  }
+};
+
+/* google_protobuf_EnumOptions views. */
+class EnumOptionsView {
+ public:
+  typedef google_protobuf_EnumOptions CType;
+  typedef EnumOptionsMutView Mut;
+
+  EnumOptionsView() : msg_(NULL) {}
+  explicit EnumOptionsView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_EnumOptions_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_EnumOptions_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_EnumOptions_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  bool allow_alias() const { return google_protobuf_EnumOptions_allow_alias(msg_); }
+  bool has_allow_alias() const { return google_protobuf_EnumOptions_has_allow_alias(msg_); }
+  bool deprecated() const { return google_protobuf_EnumOptions_deprecated(msg_); }
+  bool has_deprecated() const { return google_protobuf_EnumOptions_has_deprecated(msg_); }
+  inline ::upb::MessageArrayView<UninterpretedOptionView> uninterpreted_option() const;
+
+ protected:
+  const CType *msg_;
+};
+
+class EnumOptionsMutView : public EnumOptionsView {
+ public:
+  EnumOptionsMutView() {}
+  explicit EnumOptionsMutView(CType *msg) : EnumOptionsView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_allow_alias(bool value) const {
+    google_protobuf_EnumOptions_set_allow_alias(ptr(), value);
+  }
+  void set_deprecated(bool value) const {
+    google_protobuf_EnumOptions_set_deprecated(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<UninterpretedOptionMutView> uninterpreted_option() const;
+  void set_uninterpreted_option(upb_array* value) const {
+    google_protobuf_EnumOptions_set_uninterpreted_option(ptr(), value);
+  }
+};
+
+/* google_protobuf_EnumValueOptions views. */
+class EnumValueOptionsView {
+ public:
+  typedef google_protobuf_EnumValueOptions CType;
+  typedef EnumValueOptionsMutView Mut;
+
+  EnumValueOptionsView() : msg_(NULL) {}
+  explicit EnumValueOptionsView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_EnumValueOptions_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_EnumValueOptions_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_EnumValueOptions_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  bool deprecated() const { return google_protobuf_EnumValueOptions_deprecated(msg_); }
+  bool has_deprecated() const { return google_protobuf_EnumValueOptions_has_deprecated(msg_); }
+  inline ::upb::MessageArrayView<UninterpretedOptionView> uninterpreted_option() const;
+
+ protected:
+  const CType *msg_;
+};
+
+class EnumValueOptionsMutView : public EnumValueOptionsView {
+ public:
+  EnumValueOptionsMutView() {}
+  explicit EnumValueOptionsMutView(CType *msg) : EnumValueOptionsView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_deprecated(bool value) const {
+    google_protobuf_EnumValueOptions_set_deprecated(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<UninterpretedOptionMutView> uninterpreted_option() const;
+  void set_uninterpreted_option(upb_array* value) const {
+    google_protobuf_EnumValueOptions_set_uninterpreted_option(ptr(), value);
+  }
+};
+
+/* google_protobuf_ServiceOptions views. */
+class ServiceOptionsView {
+ public:
+  typedef google_protobuf_ServiceOptions CType;
+  typedef ServiceOptionsMutView Mut;
+
+  ServiceOptionsView() : msg_(NULL) {}
+  explicit ServiceOptionsView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_ServiceOptions_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_ServiceOptions_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_ServiceOptions_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  bool deprecated() const { return google_protobuf_ServiceOptions_deprecated(msg_); }
+  bool has_deprecated() const { return google_protobuf_ServiceOptions_has_deprecated(msg_); }
+  inline ::upb::MessageArrayView<UninterpretedOptionView> uninterpreted_option() const;
+
+ protected:
+  const CType *msg_;
+};
+
+class ServiceOptionsMutView : public ServiceOptionsView {
+ public:
+  ServiceOptionsMutView() {}
+  explicit ServiceOptionsMutView(CType *msg) : ServiceOptionsView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_deprecated(bool value) const {
+    google_protobuf_ServiceOptions_set_deprecated(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<UninterpretedOptionMutView> uninterpreted_option() const;
+  void set_uninterpreted_option(upb_array* value) const {
+    google_protobuf_ServiceOptions_set_uninterpreted_option(ptr(), value);
+  }
+};
+
+/* google_protobuf_MethodOptions views. */
+class MethodOptionsView {
+ public:
+  typedef google_protobuf_MethodOptions CType;
+  typedef MethodOptionsMutView Mut;
+
+  MethodOptionsView() : msg_(NULL) {}
+  explicit MethodOptionsView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_MethodOptions_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_MethodOptions_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_MethodOptions_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  bool deprecated() const { return google_protobuf_MethodOptions_deprecated(msg_); }
+  bool has_deprecated() const { return google_protobuf_MethodOptions_has_deprecated(msg_); }
+  inline ::upb::MessageArrayView<UninterpretedOptionView> uninterpreted_option() const;
+
+ protected:
+  const CType *msg_;
+};
+
+class MethodOptionsMutView : public MethodOptionsView {
+ public:
+  MethodOptionsMutView() {}
+  explicit MethodOptionsMutView(CType *msg) : MethodOptionsView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_deprecated(bool value) const {
+    google_protobuf_MethodOptions_set_deprecated(ptr(), value);
+  }
+  inline ::upb::MessageArrayView<UninterpretedOptionMutView> uninterpreted_option() const;
+  void set_uninterpreted_option(upb_array* value) const {
+    google_protobuf_MethodOptions_set_uninterpreted_option(ptr(), value);
+  }
+};
+
+/* google_protobuf_UninterpretedOption views. */
+class UninterpretedOptionView {
+ public:
+  typedef google_protobuf_UninterpretedOption CType;
+  typedef UninterpretedOptionMutView Mut;
+
+  UninterpretedOptionView() : msg_(NULL) {}
+  explicit UninterpretedOptionView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_UninterpretedOption_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_UninterpretedOption_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_UninterpretedOption_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  inline ::upb::MessageArrayView<UninterpretedOption_NamePartView> name() const;
+  ::upb::StringView identifier_value() const { return google_protobuf_UninterpretedOption_identifier_value(msg_); }
+  bool has_identifier_value() const { return google_protobuf_UninterpretedOption_has_identifier_value(msg_); }
+  uint64_t positive_int_value() const { return google_protobuf_UninterpretedOption_positive_int_value(msg_); }
+  bool has_positive_int_value() const { return google_protobuf_UninterpretedOption_has_positive_int_value(msg_); }
+  int64_t negative_int_value() const { return google_protobuf_UninterpretedOption_negative_int_value(msg_); }
+  bool has_negative_int_value() const { return google_protobuf_UninterpretedOption_has_negative_int_value(msg_); }
+  double double_value() const { return google_protobuf_UninterpretedOption_double_value(msg_); }
+  bool has_double_value() const { return google_protobuf_UninterpretedOption_has_double_value(msg_); }
+  ::upb::StringView string_value() const { return google_protobuf_UninterpretedOption_string_value(msg_); }
+  bool has_string_value() const { return google_protobuf_UninterpretedOption_has_string_value(msg_); }
+  ::upb::StringView aggregate_value() const { return google_protobuf_UninterpretedOption_aggregate_value(msg_); }
+  bool has_aggregate_value() const { return google_protobuf_UninterpretedOption_has_aggregate_value(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class UninterpretedOptionMutView : public UninterpretedOptionView {
+ public:
+  UninterpretedOptionMutView() {}
+  explicit UninterpretedOptionMutView(CType *msg) : UninterpretedOptionView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  inline ::upb::MessageArrayView<UninterpretedOption_NamePartMutView> name() const;
+  void set_name(upb_array* value) const {
+    google_protobuf_UninterpretedOption_set_name(ptr(), value);
+  }
+  void set_identifier_value(::upb::StringView value) const {
+    google_protobuf_UninterpretedOption_set_identifier_value(ptr(), value);
+  }
+  void set_positive_int_value(uint64_t value) const {
+    google_protobuf_UninterpretedOption_set_positive_int_value(ptr(), value);
+  }
+  void set_negative_int_value(int64_t value) const {
+    google_protobuf_UninterpretedOption_set_negative_int_value(ptr(), value);
+  }
+  void set_double_value(double value) const {
+    google_protobuf_UninterpretedOption_set_double_value(ptr(), value);
+  }
+  void set_string_value(::upb::StringView value) const {
+    google_protobuf_UninterpretedOption_set_string_value(ptr(), value);
+  }
+  void set_aggregate_value(::upb::StringView value) const {
+    google_protobuf_UninterpretedOption_set_aggregate_value(ptr(), value);
+  }
+};
+
+/* google_protobuf_UninterpretedOption_NamePart views. */
+class UninterpretedOption_NamePartView {
+ public:
+  typedef google_protobuf_UninterpretedOption_NamePart CType;
+  typedef UninterpretedOption_NamePartMutView Mut;
+
+  UninterpretedOption_NamePartView() : msg_(NULL) {}
+  explicit UninterpretedOption_NamePartView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_UninterpretedOption_NamePart_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_UninterpretedOption_NamePart_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_UninterpretedOption_NamePart_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  ::upb::StringView name_part() const { return google_protobuf_UninterpretedOption_NamePart_name_part(msg_); }
+  bool has_name_part() const { return google_protobuf_UninterpretedOption_NamePart_has_name_part(msg_); }
+  bool is_extension() const { return google_protobuf_UninterpretedOption_NamePart_is_extension(msg_); }
+  bool has_is_extension() const { return google_protobuf_UninterpretedOption_NamePart_has_is_extension(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class UninterpretedOption_NamePartMutView : public UninterpretedOption_NamePartView {
+ public:
+  UninterpretedOption_NamePartMutView() {}
+  explicit UninterpretedOption_NamePartMutView(CType *msg) : UninterpretedOption_NamePartView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_name_part(::upb::StringView value) const {
+    google_protobuf_UninterpretedOption_NamePart_set_name_part(ptr(), value);
+  }
+  void set_is_extension(bool value) const {
+    google_protobuf_UninterpretedOption_NamePart_set_is_extension(ptr(), value);
+  }
+};
+
+/* google_protobuf_SourceCodeInfo views. */
+class SourceCodeInfoView {
+ public:
+  typedef google_protobuf_SourceCodeInfo CType;
+  typedef SourceCodeInfoMutView Mut;
+
+  SourceCodeInfoView() : msg_(NULL) {}
+  explicit SourceCodeInfoView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_SourceCodeInfo_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_SourceCodeInfo_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_SourceCodeInfo_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  inline ::upb::MessageArrayView<SourceCodeInfo_LocationView> location() const;
+
+ protected:
+  const CType *msg_;
+};
+
+class SourceCodeInfoMutView : public SourceCodeInfoView {
+ public:
+  SourceCodeInfoMutView() {}
+  explicit SourceCodeInfoMutView(CType *msg) : SourceCodeInfoView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  inline ::upb::MessageArrayView<SourceCodeInfo_LocationMutView> location() const;
+  void set_location(upb_array* value) const {
+    google_protobuf_SourceCodeInfo_set_location(ptr(), value);
+  }
+};
+
+/* google_protobuf_SourceCodeInfo_Location views. */
+class SourceCodeInfo_LocationView {
+ public:
+  typedef google_protobuf_SourceCodeInfo_Location CType;
+  typedef SourceCodeInfo_LocationMutView Mut;
+
+  SourceCodeInfo_LocationView() : msg_(NULL) {}
+  explicit SourceCodeInfo_LocationView(const CType *msg) : msg_(msg) {}
+
+  const CType *ptr() const { return msg_; }
+
+  static CType *New(::upb::Environment *env) {
+    return google_protobuf_SourceCodeInfo_Location_new(env);
+  }
+  static CType *ParseNew(::upb::StringView buf, ::upb::Environment *env) {
+    return google_protobuf_SourceCodeInfo_Location_parsenew(buf, env);
+  }
+  static char *Serialize(const CType *msg, ::upb::Environment *env,
+                         size_t *len) {
+    return google_protobuf_SourceCodeInfo_Location_serialize(const_cast<CType *>(msg), env, len);
+  }
+
+  ::upb::ArrayView<int32_t> path() const { return google_protobuf_SourceCodeInfo_Location_path(msg_); }
+  ::upb::ArrayView<int32_t> span() const { return google_protobuf_SourceCodeInfo_Location_span(msg_); }
+  ::upb::StringView leading_comments() const { return google_protobuf_SourceCodeInfo_Location_leading_comments(msg_); }
+  bool has_leading_comments() const { return google_protobuf_SourceCodeInfo_Location_has_leading_comments(msg_); }
+  ::upb::StringView trailing_comments() const { return google_protobuf_SourceCodeInfo_Location_trailing_comments(msg_); }
+  bool has_trailing_comments() const { return google_protobuf_SourceCodeInfo_Location_has_trailing_comments(msg_); }
+  ::upb::ArrayView< ::upb::StringView> leading_detached_comments() const { return google_protobuf_SourceCodeInfo_Location_leading_detached_comments(msg_); }
+
+ protected:
+  const CType *msg_;
+};
+
+class SourceCodeInfo_LocationMutView : public SourceCodeInfo_LocationView {
+ public:
+  SourceCodeInfo_LocationMutView() {}
+  explicit SourceCodeInfo_LocationMutView(CType *msg) : SourceCodeInfo_LocationView(msg) {}
+
+  CType *ptr() const { return const_cast<CType *>(msg_); }
+
+  void set_path(upb_array* value) const {
+    google_protobuf_SourceCodeInfo_Location_set_path(ptr(), value);
+  }
+  void set_span(upb_array* value) const {
+    google_protobuf_SourceCodeInfo_Location_set_span(ptr(), value);
+  }
+  void set_leading_comments(::upb::StringView value) const {
+    google_protobuf_SourceCodeInfo_Location_set_leading_comments(ptr(), value);
+  }
+  void set_trailing_comments(::upb::StringView value) const {
+    google_protobuf_SourceCodeInfo_Location_set_trailing_comments(ptr(), value);
+  }
+  void set_leading_detached_comments(upb_array* value) const {
+    google_protobuf_SourceCodeInfo_Location_set_leading_detached_comments(ptr(), value);
+  }
+};
+
+inline ::upb::MessageArrayView<FileDescriptorProtoView> FileDescriptorSetView::file() const {
+  return ::upb::MessageArrayView<FileDescriptorProtoView>(google_protobuf_FileDescriptorSet_file(msg_));
+}
+inline ::upb::MessageArrayView<FileDescriptorProtoMutView> FileDescriptorSetMutView::file() const {
+  return ::upb::MessageArrayView<FileDescriptorProtoMutView>(google_protobuf_FileDescriptorSet_file(ptr()));
+}
+inline ::upb::MessageArrayView<DescriptorProtoView> FileDescriptorProtoView::message_type() const {
+  return ::upb::MessageArrayView<DescriptorProtoView>(google_protobuf_FileDescriptorProto_message_type(msg_));
+}
+inline ::upb::MessageArrayView<EnumDescriptorProtoView> FileDescriptorProtoView::enum_type() const {
+  return ::upb::MessageArrayView<EnumDescriptorProtoView>(google_protobuf_FileDescriptorProto_enum_type(msg_));
+}
+inline ::upb::MessageArrayView<ServiceDescriptorProtoView> FileDescriptorProtoView::service() const {
+  return ::upb::MessageArrayView<ServiceDescriptorProtoView>(google_protobuf_FileDescriptorProto_service(msg_));
+}
+inline ::upb::MessageArrayView<FieldDescriptorProtoView> FileDescriptorProtoView::extension() const {
+  return ::upb::MessageArrayView<FieldDescriptorProtoView>(google_protobuf_FileDescriptorProto_extension(msg_));
+}
+inline FileOptionsView FileDescriptorProtoView::options() const {
+  return FileOptionsView(google_protobuf_FileDescriptorProto_options(msg_));
+}
+inline SourceCodeInfoView FileDescriptorProtoView::source_code_info() const {
+  return SourceCodeInfoView(google_protobuf_FileDescriptorProto_source_code_info(msg_));
+}
+inline ::upb::MessageArrayView<DescriptorProtoMutView> FileDescriptorProtoMutView::message_type() const {
+  return ::upb::MessageArrayView<DescriptorProtoMutView>(google_protobuf_FileDescriptorProto_message_type(ptr()));
+}
+inline ::upb::MessageArrayView<EnumDescriptorProtoMutView> FileDescriptorProtoMutView::enum_type() const {
+  return ::upb::MessageArrayView<EnumDescriptorProtoMutView>(google_protobuf_FileDescriptorProto_enum_type(ptr()));
+}
+inline ::upb::MessageArrayView<ServiceDescriptorProtoMutView> FileDescriptorProtoMutView::service() const {
+  return ::upb::MessageArrayView<ServiceDescriptorProtoMutView>(google_protobuf_FileDescriptorProto_service(ptr()));
+}
+inline ::upb::MessageArrayView<FieldDescriptorProtoMutView> FileDescriptorProtoMutView::extension() const {
+  return ::upb::MessageArrayView<FieldDescriptorProtoMutView>(google_protobuf_FileDescriptorProto_extension(ptr()));
+}
+inline FileOptionsMutView FileDescriptorProtoMutView::options() const {
+  return FileOptionsMutView(google_protobuf_FileDescriptorProto_options(ptr()));
+}
+inline void FileDescriptorProtoMutView::set_options(FileOptionsMutView value) const {
+  google_protobuf_FileDescriptorProto_set_options(ptr(), value.ptr());
+}
+inline SourceCodeInfoMutView FileDescriptorProtoMutView::source_code_info() const {
+  return SourceCodeInfoMutView(google_protobuf_FileDescriptorProto_source_code_info(ptr()));
+}
+inline void FileDescriptorProtoMutView::set_source_code_info(SourceCodeInfoMutView value) const {
+  google_protobuf_FileDescriptorProto_set_source_code_info(ptr(), value.ptr());
+}
+inline ::upb::MessageArrayView<FieldDescriptorProtoView> DescriptorProtoView::field() const {
+  return ::upb::MessageArrayView<FieldDescriptorProtoView>(google_protobuf_DescriptorProto_field(msg_));
+}
+inline ::upb::MessageArrayView<DescriptorProtoView> DescriptorProtoView::nested_type() const {
+  return ::upb::MessageArrayView<DescriptorProtoView>(google_protobuf_DescriptorProto_nested_type(msg_));
+}
+inline ::upb::MessageArrayView<EnumDescriptorProtoView> DescriptorProtoView::enum_type() const {
+  return ::upb::MessageArrayView<EnumDescriptorProtoView>(google_protobuf_DescriptorProto_enum_type(msg_));
+}
+inline ::upb::MessageArrayView<DescriptorProto_ExtensionRangeView> DescriptorProtoView::extension_range() const {
+  return ::upb::MessageArrayView<DescriptorProto_ExtensionRangeView>(google_protobuf_DescriptorProto_extension_range(msg_));
+}
+inline ::upb::MessageArrayView<FieldDescriptorProtoView> DescriptorProtoView::extension() const {
+  return ::upb::MessageArrayView<FieldDescriptorProtoView>(google_protobuf_DescriptorProto_extension(msg_));
+}
+inline MessageOptionsView DescriptorProtoView::options() const {
+  return MessageOptionsView(google_protobuf_DescriptorProto_options(msg_));
+}
+inline ::upb::MessageArrayView<OneofDescriptorProtoView> DescriptorProtoView::oneof_decl() const {
+  return ::upb::MessageArrayView<OneofDescriptorProtoView>(google_protobuf_DescriptorProto_oneof_decl(msg_));
+}
+inline ::upb::MessageArrayView<DescriptorProto_ReservedRangeView> DescriptorProtoView::reserved_range() const {
+  return ::upb::MessageArrayView<DescriptorProto_ReservedRangeView>(google_protobuf_DescriptorProto_reserved_range(msg_));
+}
+inline ::upb::MessageArrayView<FieldDescriptorProtoMutView> DescriptorProtoMutView::field() const {
+  return ::upb::MessageArrayView<FieldDescriptorProtoMutView>(google_protobuf_DescriptorProto_field(ptr()));
+}
+inline ::upb::MessageArrayView<DescriptorProtoMutView> DescriptorProtoMutView::nested_type() const {
+  return ::upb::MessageArrayView<DescriptorProtoMutView>(google_protobuf_DescriptorProto_nested_type(ptr()));
+}
+inline ::upb::MessageArrayView<EnumDescriptorProtoMutView> DescriptorProtoMutView::enum_type() const {
+  return ::upb::MessageArrayView<EnumDescriptorProtoMutView>(google_protobuf_DescriptorProto_enum_type(ptr()));
+}
+inline ::upb::MessageArrayView<DescriptorProto_ExtensionRangeMutView> DescriptorProtoMutView::extension_range() const {
+  return ::upb::MessageArrayView<DescriptorProto_ExtensionRangeMutView>(google_protobuf_DescriptorProto_extension_range(ptr()));
+}
+inline ::upb::MessageArrayView<FieldDescriptorProtoMutView> DescriptorProtoMutView::extension() const {
+  return ::upb::MessageArrayView<FieldDescriptorProtoMutView>(google_protobuf_DescriptorProto_extension(ptr()));
+}
+inline MessageOptionsMutView DescriptorProtoMutView::options() const {
+  return MessageOptionsMutView(google_protobuf_DescriptorProto_options(ptr()));
+}
+inline void DescriptorProtoMutView::set_options(MessageOptionsMutView value) const {
+  google_protobuf_DescriptorProto_set_options(ptr(), value.ptr());
+}
+inline ::upb::MessageArrayView<OneofDescriptorProtoMutView> DescriptorProtoMutView::oneof_decl() const {
+  return ::upb::MessageArrayView<OneofDescriptorProtoMutView>(google_protobuf_DescriptorProto_oneof_decl(ptr()));
+}
+inline ::upb::MessageArrayView<DescriptorProto_ReservedRangeMutView> DescriptorProtoMutView::reserved_range() const {
+  return ::upb::MessageArrayView<DescriptorProto_ReservedRangeMutView>(google_protobuf_DescriptorProto_reserved_range(ptr()));
+}
+inline FieldOptionsView FieldDescriptorProtoView::options() const {
+  return FieldOptionsView(google_protobuf_FieldDescriptorProto_options(msg_));
+}
+inline FieldOptionsMutView FieldDescriptorProtoMutView::options() const {
+  return FieldOptionsMutView(google_protobuf_FieldDescriptorProto_options(ptr()));
+}
+inline void FieldDescriptorProtoMutView::set_options(FieldOptionsMutView value) const {
+  google_protobuf_FieldDescriptorProto_set_options(ptr(), value.ptr());
+}
+inline ::upb::MessageArrayView<EnumValueDescriptorProtoView> EnumDescriptorProtoView::value() const {
+  return ::upb::MessageArrayView<EnumValueDescriptorProtoView>(google_protobuf_EnumDescriptorProto_value(msg_));
+}
+inline EnumOptionsView EnumDescriptorProtoView::options() const {
+  return EnumOptionsView(google_protobuf_EnumDescriptorProto_options(msg_));
+}
+inline ::upb::MessageArrayView<EnumValueDescriptorProtoMutView> EnumDescriptorProtoMutView::value() const {
+  return ::upb::MessageArrayView<EnumValueDescriptorProtoMutView>(google_protobuf_EnumDescriptorProto_value(ptr()));
+}
+inline EnumOptionsMutView EnumDescriptorProtoMutView::options() const {
+  return EnumOptionsMutView(google_protobuf_EnumDescriptorProto_options(ptr()));
+}
+inline void EnumDescriptorProtoMutView::set_options(EnumOptionsMutView value) const {
+  google_protobuf_EnumDescriptorProto_set_options(ptr(), value.ptr());
+}
+inline EnumValueOptionsView EnumValueDescriptorProtoView::options() const {
+  return EnumValueOptionsView(google_protobuf_EnumValueDescriptorProto_options(msg_));
+}
+inline EnumValueOptionsMutView EnumValueDescriptorProtoMutView::options() const {
+  return EnumValueOptionsMutView(google_protobuf_EnumValueDescriptorProto_options(ptr()));
+}
+inline void EnumValueDescriptorProtoMutView::set_options(EnumValueOptionsMutView value) const {
+  google_protobuf_EnumValueDescriptorProto_set_options(ptr(), value.ptr());
+}
+inline ::upb::MessageArrayView<MethodDescriptorProtoView> ServiceDescriptorProtoView::method() const {
+  return ::upb::MessageArrayView<MethodDescriptorProtoView>(google_protobuf_ServiceDescriptorProto_method(msg_));
+}
+inline ServiceOptionsView ServiceDescriptorProtoView::options() const {
+  return ServiceOptionsView(google_protobuf_ServiceDescriptorProto_options(msg_));
+}
+inline ::upb::MessageArrayView<MethodDescriptorProtoMutView> ServiceDescriptorProtoMutView::method() const {
+  return ::upb::MessageArrayView<MethodDescriptorProtoMutView>(google_protobuf_ServiceDescriptorProto_method(ptr()));
+}
+inline ServiceOptionsMutView ServiceDescriptorProtoMutView::options() const {
+  return ServiceOptionsMutView(google_protobuf_ServiceDescriptorProto_options(ptr()));
+}
+inline void ServiceDescriptorProtoMutView::set_options(ServiceOptionsMutView value) const {
+  google_protobuf_ServiceDescriptorProto_set_options(ptr(), value.ptr());
+}
+inline MethodOptionsView MethodDescriptorProtoView::options() const {
+  return MethodOptionsView(google_protobuf_MethodDescriptorProto_options(msg_));
+}
+inline MethodOptionsMutView MethodDescriptorProtoMutView::options() const {
+  return MethodOptionsMutView(google_protobuf_MethodDescriptorProto_options(ptr()));
+}
+inline void MethodDescriptorProtoMutView::set_options(MethodOptionsMutView value) const {
+  google_protobuf_MethodDescriptorProto_set_options(ptr(), value.ptr());
+}
+inline ::upb::MessageArrayView<UninterpretedOptionView> FileOptionsView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionView>(google_protobuf_FileOptions_uninterpreted_option(msg_));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionMutView> FileOptionsMutView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionMutView>(google_protobuf_FileOptions_uninterpreted_option(ptr()));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionView> MessageOptionsView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionView>(google_protobuf_MessageOptions_uninterpreted_option(msg_));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionMutView> MessageOptionsMutView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionMutView>(google_protobuf_MessageOptions_uninterpreted_option(ptr()));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionView> FieldOptionsView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionView>(google_protobuf_FieldOptions_uninterpreted_option(msg_));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionMutView> FieldOptionsMutView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionMutView>(google_protobuf_FieldOptions_uninterpreted_option(ptr()));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionView> EnumOptionsView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionView>(google_protobuf_EnumOptions_uninterpreted_option(msg_));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionMutView> EnumOptionsMutView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionMutView>(google_protobuf_EnumOptions_uninterpreted_option(ptr()));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionView> EnumValueOptionsView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionView>(google_protobuf_EnumValueOptions_uninterpreted_option(msg_));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionMutView> EnumValueOptionsMutView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionMutView>(google_protobuf_EnumValueOptions_uninterpreted_option(ptr()));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionView> ServiceOptionsView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionView>(google_protobuf_ServiceOptions_uninterpreted_option(msg_));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionMutView> ServiceOptionsMutView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionMutView>(google_protobuf_ServiceOptions_uninterpreted_option(ptr()));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionView> MethodOptionsView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionView>(google_protobuf_MethodOptions_uninterpreted_option(msg_));
+}
+inline ::upb::MessageArrayView<UninterpretedOptionMutView> MethodOptionsMutView::uninterpreted_option() const {
+  return ::upb::MessageArrayView<UninterpretedOptionMutView>(google_protobuf_MethodOptions_uninterpreted_option(ptr()));
+}
+inline ::upb::MessageArrayView<UninterpretedOption_NamePartView> UninterpretedOptionView::name() const {
+  return ::upb::MessageArrayView<UninterpretedOption_NamePartView>(google_protobuf_UninterpretedOption_name(msg_));
+}
+inline ::upb::MessageArrayView<UninterpretedOption_NamePartMutView> UninterpretedOptionMutView::name() const {
+  return ::upb::MessageArrayView<UninterpretedOption_NamePartMutView>(google_protobuf_UninterpretedOption_name(ptr()));
+}
+inline ::upb::MessageArrayView<SourceCodeInfo_LocationView> SourceCodeInfoView::location() const {
+  return ::upb::MessageArrayView<SourceCodeInfo_LocationView>(google_protobuf_SourceCodeInfo_location(msg_));
+}
+inline ::upb::MessageArrayView<SourceCodeInfo_LocationMutView> SourceCodeInfoMutView::location() const {
+  return ::upb::MessageArrayView<SourceCodeInfo_LocationMutView>(google_protobuf_SourceCodeInfo_location(ptr()));
+}
+
+}  /* namespace protobuf */
+}  /* namespace google */
+
+#endif  /* __cplusplus */
+
 #endif  /* UPB_DESCRIPTOR_DESCRIPTOR_PROTO_UPB_H_ */
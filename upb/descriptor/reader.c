@@ -22,8 +22,8 @@ static bool upb_streq(const char *str, const char *buf, size_t n) {
 
 /* We keep a stack of all the messages scopes we are currently in, as well as
  * the top-level file scope.  This is necessary to correctly qualify the
- * definitions that are contained inside.  "name" tracks the name of the
- * message or package (a bare name -- not qualified by any enclosing scopes). */
+ * definitions that are contained inside.  "name" tracks the package of the
+ * file scope; message scopes are named by their msgdef. */
 typedef struct {
   char *name;
   /* Index of the first def that is under this scope.  For msgdefs, the
@@ -45,8 +45,12 @@ typedef struct {
  * TODO: make this a runtime-settable property of the Reader instance. */
 #define UPB_MAX_MESSAGE_NESTING 64
 
+/* All the strings the reader needs only while parsing (scope names, enum value
+ * names, defaults and names on their way into a def) are allocated from the
+ * env's arena, so none of them is ever freed individually. */
 struct upb_descreader {
   upb_sink sink;
+  upb_env *env;
   upb_inttable files;
   upb_strtable files_by_name;
   upb_filedef *file;  /* The last file in files. */
@@ -54,6 +58,11 @@ struct upb_descreader {
   int stack_len;
   upb_inttable oneofs;
 
+  /* For each def in the current file, one more than the index of the msgdef
+   * it is nested in, or 0 at the top level.  (-1 can't be stored in an
+   * inttable's array part.) */
+  upb_inttable parents;
+
   uint32_t number;
   char *name;
   bool saw_number;
@@ -64,48 +73,80 @@ struct upb_descreader {
   upb_fielddef *f;
 };
 
-static char *upb_gstrndup(const char *buf, size_t n) {
-  char *ret = upb_gmalloc(n + 1);
+static char *upb_descreader_strndup(upb_descreader *r, const char *buf,
+                                    size_t n) {
+  char *ret = upb_env_malloc(r->env, n + 1);
   if (!ret) return NULL;
   memcpy(ret, buf, n);
   ret[n] = '\0';
   return ret;
 }
 
-/* Returns a newly allocated string that joins input strings together, for
- * example:
- *   join("Foo.Bar", "Baz") -> "Foo.Bar.Baz"
- *   join("", "Baz") -> "Baz"
- * Caller owns a ref on the returned string. */
-static char *upb_join(const char *base, const char *name) {
-  if (!base || strlen(base) == 0) {
-    return upb_gstrdup(name);
-  } else {
-    char *ret = upb_gmalloc(strlen(base) + strlen(name) + 2);
-    if (!ret) {
-      return NULL;
+/* Joins "base" and "name" with a '.', for example:
+ *   join("Foo.Bar", "Baz") -> "Foo.Bar.Baz" */
+static char *upb_descreader_join(upb_descreader *r, const char *base,
+                                 const char *name) {
+  size_t base_len = strlen(base);
+  size_t name_len = strlen(name);
+  char *ret = upb_env_malloc(r->env, base_len + name_len + 2);
+  if (!ret) return NULL;
+  memcpy(ret, base, base_len);
+  ret[base_len] = '.';
+  memcpy(ret + base_len + 1, name, name_len + 1);
+  return ret;
+}
+
+static int32_t upb_descreader_parent(const upb_descreader *r, size_t i) {
+  upb_value v;
+  return upb_inttable_lookup(&r->parents, i, &v) ?
+      (int32_t)upb_value_getuint32(v) - 1 : -1;
+}
+
+/* Marks the defs from offset "start" that aren't already inside a nested
+ * message as being inside the msgdef at "start - 1". */
+static bool upb_descreader_setparents(upb_descreader *r, int32_t start) {
+  size_t i;
+  for (i = start; i < upb_filedef_defcount(r->file); i++) {
+    while (i >= upb_inttable_count(&r->parents)) {
+      if (!upb_inttable_push(&r->parents, upb_value_uint32(0))) return false;
+    }
+    if (upb_descreader_parent(r, i) < 0) {
+      upb_inttable_replace(&r->parents, i, upb_value_uint32(start));
     }
-    ret[0] = '\0';
-    strcat(ret, base);
-    strcat(ret, ".");
-    strcat(ret, name);
-    return ret;
   }
+  return true;
 }
 
-/* Qualify the defname for all defs starting with offset "start" with "str". */
-static bool upb_descreader_qualify(upb_filedef *f, char *str, int32_t start) {
+/* Qualifies the names of all the defs in the current file.  A def comes after
+ * the msgdef it is nested in, so by the time we reach it its parent already
+ * has its full name, and every def is renamed exactly once. */
+static bool upb_descreader_qualify(upb_descreader *r, const char *package) {
   size_t i;
-  for (i = start; i < upb_filedef_defcount(f); i++) {
-    upb_def *def = upb_filedef_mutabledef(f, i);
-    char *name = upb_join(str, upb_def_fullname(def));
+  for (i = 0; i < upb_filedef_defcount(r->file); i++) {
+    upb_def *def = upb_filedef_mutabledef(r->file, i);
+    int32_t parent = upb_descreader_parent(r, i);
+    const char *base = package;
+    char *name;
+
+    if (parent >= 0) {
+      base = upb_def_fullname(upb_filedef_mutabledef(r->file, parent));
+    }
+
+    if (!base || *base == '\0' || !upb_def_fullname(def)) {
+      continue;
+    }
+
+    name = upb_descreader_join(r, base, upb_def_fullname(def));
     if (!name) {
       /* Need better logic here; at this point we've qualified some names but
        * not others. */
       return false;
     }
     upb_def_setfullname(def, name, NULL);
-    upb_gfree(name);
+  }
+
+  while (upb_inttable_count(&r->parents) > 0) {
+    upb_inttable_pop(&r->parents);
   }
   return true;
 }
@@ -144,10 +185,14 @@ bool upb_descreader_endcontainer(upb_descreader *r) {
     UPB_ASSERT(ok);
   }
 
-  if (!upb_descreader_qualify(r->file, f->name, f->start)) {
+  if (r->stack_len > 1) {
+    /* Qualifying is left to the end of the file. */
+    if (!upb_descreader_setparents(r, f->start)) {
+      return false;
+    }
+  } else if (!upb_descreader_qualify(r, f->name)) {
     return false;
   }
-  upb_gfree(f->name);
   f->name = NULL;
 
   r->stack_len--;
@@ -156,7 +201,6 @@ bool upb_descreader_endcontainer(upb_descreader *r) {
 
 void upb_descreader_setscopename(upb_descreader *r, char *str) {
   upb_descreader_frame *f = &r->stack[r->stack_len-1];
-  upb_gfree(f->name);
   f->name = str;
 }
 
@@ -214,11 +258,11 @@ static size_t file_onname(void *closure, const void *hd, const char *buf,
   UPB_UNUSED(hd);
   UPB_UNUSED(handle);
 
-  name = upb_gstrndup(buf, n);
+  name = upb_descreader_strndup(r, buf, n);
+  if (!name) return 0;
   upb_strtable_insert(&r->files_by_name, name, upb_value_ptr(r->file));
   /* XXX: see comment at the top of the file. */
   ok = upb_filedef_setname(r->file, name, NULL);
-  upb_gfree(name);
   UPB_ASSERT(ok);
   return n;
 }
@@ -231,7 +275,8 @@ static size_t file_onpackage(void *closure, const void *hd, const char *buf,
   UPB_UNUSED(hd);
   UPB_UNUSED(handle);
 
-  package = upb_gstrndup(buf, n);
+  package = upb_descreader_strndup(r, buf, n);
+  if (!package) return 0;
   /* XXX: see comment at the top of the file. */
   upb_descreader_setscopename(r, package);
   ok = upb_filedef_setpackage(r->file, package, NULL);
@@ -260,9 +305,9 @@ static size_t file_onphpnamespace(void *closure, const void *hd,
   UPB_UNUSED(hd);
   UPB_UNUSED(handle);
 
-  php_namespace = upb_gstrndup(buf, n);
+  php_namespace = upb_descreader_strndup(r, buf, n);
+  if (!php_namespace) return 0;
   ok = upb_filedef_setphpnamespace(r->file, php_namespace, NULL);
-  upb_gfree(php_namespace);
   UPB_ASSERT(ok);
   return n;
 }
@@ -275,9 +320,9 @@ static size_t file_onphpprefix(void *closure, const void *hd, const char *buf,
   UPB_UNUSED(hd);
   UPB_UNUSED(handle);
 
-  prefix = upb_gstrndup(buf, n);
+  prefix = upb_descreader_strndup(r, buf, n);
+  if (!prefix) return 0;
   ok = upb_filedef_setphpprefix(r->file, prefix, NULL);
-  upb_gfree(prefix);
   UPB_ASSERT(ok);
   return n;
 }
@@ -357,8 +402,8 @@ static size_t enumval_onname(void *closure, const void *hd, const char *buf,
   UPB_UNUSED(hd);
   UPB_UNUSED(handle);
   /* XXX: see comment at the top of the file. */
-  upb_gfree(r->name);
-  r->name = upb_gstrndup(buf, n);
+  r->name = upb_descreader_strndup(r, buf, n);
+  if (!r->name) return 0;
   r->saw_name = true;
   return n;
 }
@@ -382,7 +427,6 @@ static bool enumval_endmsg(void *closure, const void *hd, upb_status *status) {
   }
   e = upb_downcast_enumdef_mutable(upb_descreader_last(r));
   upb_enumdef_addval(e, r->name, r->number, status);
-  upb_gfree(r->name);
   r->name = NULL;
   return true;
 }
@@ -409,12 +453,12 @@ static bool enum_endmsg(void *closure, const void *hd, upb_status *status) {
 static size_t enum_onname(void *closure, const void *hd, const char *buf,
                           size_t n, const upb_bufhandle *handle) {
   upb_descreader *r = closure;
-  char *fullname = upb_gstrndup(buf, n);
+  char *fullname = upb_descreader_strndup(r, buf, n);
   UPB_UNUSED(hd);
   UPB_UNUSED(handle);
+  if (!fullname) return 0;
   /* XXX: see comment at the top of the file. */
   upb_def_setfullname(upb_descreader_last(r), fullname, NULL);
-  upb_gfree(fullname);
   return n;
 }
 
@@ -424,7 +468,6 @@ static bool field_startmsg(void *closure, const void *hd) {
   upb_descreader *r = closure;
   UPB_UNUSED(hd);
   UPB_ASSERT(r->f);
-  upb_gfree(r->default_string);
   r->default_string = NULL;
 
   /* fielddefs default to packed, but descriptors default to non-packed. */
@@ -577,39 +620,39 @@ static bool field_onnumber(void *closure, const void *hd, int32_t val) {
 static size_t field_onname(void *closure, const void *hd, const char *buf,
                            size_t n, const upb_bufhandle *handle) {
   upb_descreader *r = closure;
-  char *name = upb_gstrndup(buf, n);
+  char *name = upb_descreader_strndup(r, buf, n);
   UPB_UNUSED(hd);
   UPB_UNUSED(handle);
+  if (!name) return 0;
 
   /* XXX: see comment at the top of the file. */
   upb_fielddef_setname(r->f, name, NULL);
-  upb_gfree(name);
   return n;
 }
 
 static size_t field_ontypename(void *closure, const void *hd, const char *buf,
                                size_t n, const upb_bufhandle *handle) {
   upb_descreader *r = closure;
-  char *name = upb_gstrndup(buf, n);
+  char *name = upb_descreader_strndup(r, buf, n);
   UPB_UNUSED(hd);
   UPB_UNUSED(handle);
+  if (!name) return 0;
 
   /* XXX: see comment at the top of the file. */
   upb_fielddef_setsubdefname(r->f, name, NULL);
-  upb_gfree(name);
   return n;
 }
 
 static size_t field_onextendee(void *closure, const void *hd, const char *buf,
                                size_t n, const upb_bufhandle *handle) {
   upb_descreader *r = closure;
-  char *name = upb_gstrndup(buf, n);
+  char *name = upb_descreader_strndup(r, buf, n);
   UPB_UNUSED(hd);
   UPB_UNUSED(handle);
+  if (!name) return 0;
 
   /* XXX: see comment at the top of the file. */
   upb_fielddef_setcontainingtypename(r->f, name, NULL);
-  upb_gfree(name);
   return n;
 }
 
@@ -622,9 +665,8 @@ static size_t field_ondefaultval(void *closure, const void *hd, const char *buf,
   /* Have to convert from string to the correct type, but we might not know the
    * type yet, so we save it as a string until the end of the field.
    * XXX: see comment at the top of the file. */
-  upb_gfree(r->default_string);
-  r->default_string = upb_gstrndup(buf, n);
-  return n;
+  r->default_string = upb_descreader_strndup(r, buf, n);
+  return r->default_string ? n : 0;
 }
 
 static bool field_ononeofindex(void *closure, const void *hd, int32_t index) {
@@ -644,13 +686,14 @@ static size_t oneof_name(void *closure, const void *hd, const char *buf,
   upb_descreader *r = closure;
   upb_descreader_frame *f = &r->stack[r->stack_len-1];
   upb_oneofdef *o = upb_descreader_getoneof(r, f->oneof_index++);
-  char *name_null_terminated = upb_gstrndup(buf, n);
-  bool ok = upb_oneofdef_setname(o, name_null_terminated, NULL);
+  char *name_null_terminated = upb_descreader_strndup(r, buf, n);
+  bool ok;
   UPB_UNUSED(hd);
   UPB_UNUSED(handle);
 
+  if (!name_null_terminated) return 0;
+  ok = upb_oneofdef_setname(o, name_null_terminated, NULL);
   UPB_ASSERT(ok);
-  free(name_null_terminated);
   return n;
 }
 
@@ -681,12 +724,12 @@ static size_t msg_name(void *closure, const void *hd, const char *buf,
   upb_descreader *r = closure;
   upb_msgdef *m = upb_descreader_top(r);
   /* XXX: see comment at the top of the file. */
-  char *name = upb_gstrndup(buf, n);
+  char *name = upb_descreader_strndup(r, buf, n);
   UPB_UNUSED(hd);
   UPB_UNUSED(handle);
+  if (!name) return 0;
 
   upb_def_setfullname(upb_msgdef_upcast_mutable(m), name, NULL);
-  upb_descreader_setscopename(r, name);  /* Passes ownership of name. */
   return n;
 }
 
@@ -733,6 +776,15 @@ static bool msg_endfield(void *closure, const void *hd) {
   return true;
 }
 
+static void *msg_startextrange(void *closure, const void *hd) {
+  upb_descreader *r = closure;
+  upb_msgdef *m = upb_descreader_top(r);
+  UPB_UNUSED(hd);
+
+  upb_msgdef_setextendable(m, true);
+  return r;
+}
+
 static bool msg_onmapentry(void *closure, const void *hd, bool mapentry) {
   upb_descreader *r = closure;
   upb_msgdef *m = upb_descreader_top(r);
@@ -762,6 +814,8 @@ static void reghandlers(const void *closure, upb_handlers *h) {
     upb_handlers_setstring(h, F(DescriptorProto, name), &msg_name, NULL);
     upb_handlers_setstartsubmsg(h, F(DescriptorProto, extension), &msg_startext,
                                 NULL);
+    upb_handlers_setstartsubmsg(h, F(DescriptorProto, extension_range),
+                                &msg_startextrange, NULL);
     upb_handlers_setstartsubmsg(h, F(DescriptorProto, nested_type),
                                 &msg_startmsg, NULL);
     upb_handlers_setstartsubmsg(h, F(DescriptorProto, field),
@@ -844,15 +898,10 @@ void descreader_cleanup(void *_r) {
     upb_filedef_unref(upb_descreader_file(r, i), &r->files);
   }
 
-  upb_gfree(r->name);
   upb_inttable_uninit(&r->files);
   upb_strtable_uninit(&r->files_by_name);
   upb_inttable_uninit(&r->oneofs);
-  upb_gfree(r->default_string);
-  while (r->stack_len > 0) {
-    upb_descreader_frame *f = &r->stack[--r->stack_len];
-    upb_gfree(f->name);
-  }
+  upb_inttable_uninit(&r->parents);
 }
 
 
@@ -867,7 +916,9 @@ upb_descreader *upb_descreader_create(upb_env *e, const upb_handlers *h) {
   upb_inttable_init(&r->files, UPB_CTYPE_PTR);
   upb_strtable_init(&r->files_by_name, UPB_CTYPE_PTR);
   upb_inttable_init(&r->oneofs, UPB_CTYPE_PTR);
+  upb_inttable_init(&r->parents, UPB_CTYPE_UINT32);
   upb_sink_reset(upb_descreader_input(r), h, r);
+  r->env = e;
   r->stack_len = 0;
   r->name = NULL;
   r->default_string = NULL;
@@ -2,9 +2,10 @@
 
 #include "upb/upb.h"
 #include "upb/encode.h"
+#include "upb/pb/varint.int.h"
 #include "upb/structs.int.h"
+#include "upb/trace.h"
 
-#define UPB_PB_VARINT_MAX_LEN 10
 #define CHK(x) do { if (!(x)) { return false; } } while(0)
 
 /* Maps descriptor type -> upb field type.  */
@@ -30,27 +31,29 @@ static const uint8_t upb_desctype_to_fieldtype2[] = {
   UPB_TYPE_INT64,           /* SINT64 */
 };
 
-static size_t upb_encode_varint(uint64_t val, char *buf) {
-  size_t i;
-  if (val < 128) { buf[0] = val; return 1; }
-  i = 0;
-  while (val) {
-    uint8_t byte = val & 0x7fU;
-    val >>= 7;
-    if (val) byte |= 0x80U;
-    buf[i++] = byte;
-  }
-  return i;
-}
-
 static uint32_t upb_zzencode_32(int32_t n) { return (n << 1) ^ (n >> 31); }
 static uint64_t upb_zzencode_64(int64_t n) { return (n << 1) ^ (n >> 63); }
 
 typedef struct {
   upb_env *env;
   char *buf, *ptr, *limit;
+
+  /* Segmented output (upb_encode_segments()).  Segments are collected
+   * back-to-front; a segment with NULL data stands for the next |size| bytes
+   * of the buffer. */
+  upb_stringview *segs;
+  size_t seg_count, seg_size;
+  size_t threshold;  /* Strings this long are referenced, 0 to disable. */
+  size_t ref_bytes;  /* Total length of referenced strings so far. */
+  size_t seg_mark;   /* Buffer bytes already covered by segments. */
 } upb_encstate;
 
+/* Returns the number of bytes encoded so far, including referenced strings.
+ * This is what lengths must be computed from, not e->limit - e->ptr. */
+static size_t upb_encode_pos(const upb_encstate *e) {
+  return (e->limit - e->ptr) + e->ref_bytes;
+}
+
 static size_t upb_roundup_pow2(size_t bytes) {
   size_t ret = 128;
   while (ret < bytes) {
@@ -62,11 +65,15 @@ static size_t upb_roundup_pow2(size_t bytes) {
 static bool upb_encode_growbuffer(upb_encstate *e, size_t bytes) {
   size_t old_size = e->limit - e->buf;
   size_t new_size = upb_roundup_pow2(bytes + (e->limit - e->ptr));
-  char *new_buf = upb_env_realloc(e->env, e->buf, old_size, new_size);
+  char *new_buf;
+
+  /* A caller-supplied buffer (upb_encode_into()) cannot grow. */
+  CHK(e->env);
+  new_buf = upb_env_realloc(e->env, e->buf, old_size, new_size);
   CHK(new_buf);
 
   /* We want previous data at the end, realloc() put it at the beginning. */
-  memmove(e->limit - old_size, e->buf, old_size);
+  memmove(new_buf + new_size - old_size, new_buf, old_size);
 
   e->ptr = new_buf + new_size - (e->limit - e->ptr);
   e->limit = new_buf + new_size;
@@ -84,6 +91,33 @@ static bool upb_encode_reserve(upb_encstate *e, size_t bytes) {
   return true;
 }
 
+static bool upb_encode_addseg(upb_encstate *e, const char *data, size_t len) {
+  if (e->seg_count == e->seg_size) {
+    size_t new_size = UPB_MAX(e->seg_size * 2, 8);
+    upb_stringview *segs = upb_env_realloc(
+        e->env, e->segs, e->seg_size * sizeof(*segs),
+        new_size * sizeof(*segs));
+    CHK(segs);
+    e->segs = segs;
+    e->seg_size = new_size;
+  }
+
+  e->segs[e->seg_count++] = upb_stringview_make(data, len);
+  return true;
+}
+
+/* Ends the current run of buffer bytes, if any, as a segment. */
+static bool upb_encode_cut(upb_encstate *e) {
+  size_t buffered = e->limit - e->ptr;
+
+  if (buffered > e->seg_mark) {
+    CHK(upb_encode_addseg(e, NULL, buffered - e->seg_mark));
+    e->seg_mark = buffered;
+  }
+
+  return true;
+}
+
 /* Writes the given bytes to the buffer, handling reserve/advance. */
 static bool upb_put_bytes(upb_encstate *e, const void *data, size_t len) {
   CHK(upb_encode_reserve(e, len));
@@ -91,6 +125,18 @@ static bool upb_put_bytes(upb_encstate *e, const void *data, size_t len) {
   return true;
 }
 
+/* Writes string or bytes field data: large payloads are referenced in place
+ * when producing segments, everything else is copied. */
+static bool upb_put_string(upb_encstate *e, const char *data, size_t len) {
+  if (e->threshold > 0 && len >= e->threshold) {
+    CHK(upb_encode_cut(e) && upb_encode_addseg(e, data, len));
+    e->ref_bytes += len;
+    return true;
+  }
+
+  return upb_put_bytes(e, data, len);
+}
+
 static bool upb_put_fixed64(upb_encstate *e, uint64_t val) {
   /* TODO(haberman): byte-swap for big endian. */
   return upb_put_bytes(e, &val, sizeof(uint64_t));
@@ -102,13 +148,10 @@ static bool upb_put_fixed32(upb_encstate *e, uint32_t val) {
 }
 
 static bool upb_put_varint(upb_encstate *e, uint64_t val) {
-  size_t len;
-  char *start;
-  CHK(upb_encode_reserve(e, UPB_PB_VARINT_MAX_LEN));
-  len = upb_encode_varint(val, e->ptr);
-  start = e->ptr + UPB_PB_VARINT_MAX_LEN - len;
-  memmove(start, e->ptr, len);
-  e->ptr = start;
+  /* Reserve only the bytes we write; upb_encode_into() buffers may be sized
+   * exactly by upb_encode_size(). */
+  CHK(upb_encode_reserve(e, upb_varint_size(val)));
+  upb_vencode64(val, e->ptr);
   return true;
 }
 
@@ -139,7 +182,10 @@ static bool upb_readhasbit(const char *msg,
   return msg[f->hasbit / 8] & (1 << (f->hasbit % 8));
 }
 
-static bool upb_put_tag(upb_encstate *e, int field_number, int wire_type) {
+/* The tag is unsigned, so field numbers of 2^28 and up don't sign-extend it to
+ * a 10-byte varint. */
+static bool upb_put_tag(upb_encstate *e, uint32_t field_number,
+                        int wire_type) {
   return upb_put_varint(e, (field_number << 3) | wire_type);
 }
 
@@ -164,15 +210,23 @@ static bool upb_encode_array(upb_encstate *e, const char *field_mem,
 
   UPB_ASSERT(arr->type == upb_desctype_to_fieldtype2[f->type]);
 
+/* Packed varints are sized in a first pass, so that the whole run is reserved
+ * at once and then encoded front to back straight into place. */
 #define VARINT_CASE(ctype, encode) { \
-  ctype *start = arr->data; \
-  ctype *ptr = start + arr->len; \
-  size_t pre_len = e->limit - e->ptr; \
-  do { \
-    ptr--; \
-    CHK(upb_put_varint(e, encode)); \
-  } while (ptr != start); \
-  CHK(upb_put_varint(e, e->limit - e->ptr - pre_len)); \
+  const ctype *start = arr->data; \
+  const ctype *end = start + arr->len; \
+  const ctype *ptr; \
+  size_t bytes = 0; \
+  char *out; \
+  for (ptr = start; ptr != end; ptr++) { \
+    bytes += upb_varint_size(encode); \
+  } \
+  CHK(upb_encode_reserve(e, bytes)); \
+  out = e->ptr; \
+  for (ptr = start; ptr != end; ptr++) { \
+    out += upb_vencode64(encode, out); \
+  } \
+  CHK(upb_put_varint(e, bytes)); \
 } \
 break; \
 do { ; } while(0)
@@ -211,7 +265,7 @@ do { ; } while(0)
       upb_stringview *ptr = start + arr->len;
       do {
         ptr--;
-        CHK(upb_put_bytes(e, ptr->data, ptr->size) &&
+        CHK(upb_put_string(e, ptr->data, ptr->size) &&
             upb_put_varint(e, ptr->size) &&
             upb_put_tag(e, f->number, UPB_WIRE_TYPE_DELIMITED));
       } while (ptr != start);
@@ -297,7 +351,7 @@ static bool upb_encode_scalarfield(upb_encstate *e, const char *field_mem,
       if (skip_zero_value && view.size == 0) {
         return true;
       }
-      return upb_put_bytes(e, view.data, view.size) &&
+      return upb_put_string(e, view.data, view.size) &&
           upb_put_varint(e, view.size) &&
           upb_put_tag(e, f->number, UPB_WIRE_TYPE_DELIMITED);
     }
@@ -319,6 +373,13 @@ static bool upb_encode_scalarfield(upb_encstate *e, const char *field_mem,
       if (skip_zero_value && submsg == NULL) {
         return true;
       }
+      if (upb_lazymsg_is(submsg)) {
+        /* Never parsed, so it can't have changed. */
+        const upb_stringview *data = upb_lazymsg_data(submsg);
+        return upb_put_string(e, data->data, data->size) &&
+            upb_put_varint(e, data->size) &&
+            upb_put_tag(e, f->number, UPB_WIRE_TYPE_DELIMITED);
+      }
       return upb_encode_message(e, submsg, subm, &size) &&
           upb_put_varint(e, size) &&
           upb_put_tag(e, f->number, UPB_WIRE_TYPE_DELIMITED);
@@ -333,7 +394,9 @@ bool upb_encode_hasscalarfield(const char *msg,
                                const upb_msglayout_fieldinit_v1 *f) {
   if (f->oneof_index != UPB_NOT_IN_ONEOF) {
     return upb_readcase(msg, m, f->oneof_index) == f->number;
-  } else if (m->is_proto2) {
+  } else if (m->is_proto2 || f->hasbit != UPB_NO_HASBIT) {
+    /* Proto3 submessages can have a hasbit too, and then a non-NULL one
+     * without it is one that upb_msg_clear() left for reuse. */
     return upb_readhasbit(msg, f);
   } else {
     /* For proto3, we'll test for the field being empty later. */
@@ -341,39 +404,327 @@ bool upb_encode_hasscalarfield(const char *msg,
   }
 }
 
+static bool upb_encode_field(upb_encstate *e, const char *msg,
+                             const upb_msglayout_msginit_v1 *m,
+                             const upb_msglayout_fieldinit_v1 *f) {
+  if (f->label == UPB_LABEL_REPEATED) {
+    return upb_encode_array(e, msg + f->offset, m, f);
+  } else if (upb_encode_hasscalarfield(msg, m, f)) {
+    return upb_encode_scalarfield(e, msg + f->offset, m, f, !m->is_proto2);
+  } else {
+    return true;
+  }
+}
+
 bool upb_encode_message(upb_encstate* e, const char *msg,
                         const upb_msglayout_msginit_v1 *m,
                         size_t *size) {
   int i;
-  char *buf_end = e->ptr;
+  size_t pre_len = upb_encode_pos(e);
+  uint64_t present[UPB_PRESENCE_MAXWORDS];
+  const upb_stringview *unknown;
+  const upb_stringview *cached;
+  size_t unknown_count;
 
   if (msg == NULL) {
+    *size = 0;
     return true;
   }
 
-  for (i = m->field_count - 1; i >= 0; i--) {
-    const upb_msglayout_fieldinit_v1 *f = &m->fields[i];
+  /* Unchanged since it was decoded (upb_decodeopts.cache). */
+  cached = upb_msg_getcache(msg);
+  if (cached) {
+    *size = cached->size;
+    return upb_put_string(e, cached->data, cached->size);
+  }
 
-    if (f->label == UPB_LABEL_REPEATED) {
-      CHK(upb_encode_array(e, msg + f->offset, m, f));
-    } else {
-      if (upb_encode_hasscalarfield(msg, m, f)) {
-        CHK(upb_encode_scalarfield(e, msg + f->offset, m, f, !m->is_proto2));
+  /* Unknown fields go last, and are already serialized. */
+  unknown = upb_msg_getunknown(msg, &unknown_count);
+  while (unknown_count > 0) {
+    unknown_count--;
+    CHK(upb_put_bytes(e, unknown[unknown_count].data,
+                      unknown[unknown_count].size));
+  }
+
+  if (upb_msg_presence(msg, m, present)) {
+    /* Only visit the fields that may be present, last one first. */
+    for (i = (m->field_count + 63) / 64 - 1; i >= 0; i--) {
+      uint64_t word = present[i];
+      while (word) {
+        int bit = 63 - upb_clz64(word);
+        CHK(upb_encode_field(e, msg, m, &m->fields[i * 64 + bit]));
+        word &= ~((uint64_t)1 << bit);
       }
     }
+  } else {
+    for (i = m->field_count - 1; i >= 0; i--) {
+      CHK(upb_encode_field(e, msg, m, &m->fields[i]));
+    }
   }
 
-  *size = buf_end - e->ptr;
+  *size = upb_encode_pos(e) - pre_len;
   return true;
 }
 
-char *upb_encode(const void *msg, const upb_msglayout_msginit_v1 *m,
-                 upb_env *env, size_t *size) {
+
+/* Size computation ***********************************************************/
+
+/* These mirror the encoding functions above and must produce exactly the
+ * number of bytes that they write. */
+
+static size_t upb_tag_size(uint32_t field_number, int wire_type) {
+  return upb_varint_size((field_number << 3) | wire_type);
+}
+
+static size_t upb_encode_messagesize(const char *msg,
+                                     const upb_msglayout_msginit_v1 *m);
+
+static size_t upb_encode_arraysize(const upb_array *arr,
+                                   const upb_msglayout_msginit_v1 *m,
+                                   const upb_msglayout_fieldinit_v1 *f) {
+  size_t ret = 0;
+  size_t i;
+
+  if (arr == NULL || arr->len == 0) {
+    return 0;
+  }
+
+#define VARINT_CASE(ctype, encode) { \
+  const ctype *ptr = arr->data; \
+  for (i = 0; i < arr->len; i++, ptr++) { \
+    ret += upb_varint_size(encode); \
+  } \
+} \
+break; \
+do { ; } while(0)
+
+  switch (f->type) {
+    case UPB_DESCRIPTOR_TYPE_DOUBLE:
+    case UPB_DESCRIPTOR_TYPE_SFIXED64:
+    case UPB_DESCRIPTOR_TYPE_FIXED64:
+      ret = arr->len * sizeof(uint64_t);
+      break;
+    case UPB_DESCRIPTOR_TYPE_FLOAT:
+    case UPB_DESCRIPTOR_TYPE_FIXED32:
+    case UPB_DESCRIPTOR_TYPE_SFIXED32:
+      ret = arr->len * sizeof(uint32_t);
+      break;
+    case UPB_DESCRIPTOR_TYPE_INT64:
+    case UPB_DESCRIPTOR_TYPE_UINT64:
+      VARINT_CASE(uint64_t, *ptr);
+    case UPB_DESCRIPTOR_TYPE_UINT32:
+    case UPB_DESCRIPTOR_TYPE_INT32:
+    case UPB_DESCRIPTOR_TYPE_ENUM:
+      VARINT_CASE(uint32_t, *ptr);
+    case UPB_DESCRIPTOR_TYPE_BOOL:
+      VARINT_CASE(bool, *ptr);
+    case UPB_DESCRIPTOR_TYPE_SINT32:
+      VARINT_CASE(int32_t, upb_zzencode_32(*ptr));
+    case UPB_DESCRIPTOR_TYPE_SINT64:
+      VARINT_CASE(int64_t, upb_zzencode_64(*ptr));
+    case UPB_DESCRIPTOR_TYPE_STRING:
+    case UPB_DESCRIPTOR_TYPE_BYTES: {
+      const upb_stringview *ptr = arr->data;
+      for (i = 0; i < arr->len; i++, ptr++) {
+        ret += upb_tag_size(f->number, UPB_WIRE_TYPE_DELIMITED) +
+               upb_varint_size(ptr->size) + ptr->size;
+      }
+      return ret;
+    }
+    case UPB_DESCRIPTOR_TYPE_GROUP: {
+      const char *const *ptr = arr->data;
+      const upb_msglayout_msginit_v1 *subm = m->submsgs[f->submsg_index];
+      for (i = 0; i < arr->len; i++, ptr++) {
+        ret += upb_tag_size(f->number, UPB_WIRE_TYPE_START_GROUP) +
+               upb_encode_messagesize(*ptr, subm) +
+               upb_tag_size(f->number, UPB_WIRE_TYPE_END_GROUP);
+      }
+      return ret;
+    }
+    case UPB_DESCRIPTOR_TYPE_MESSAGE: {
+      const char *const *ptr = arr->data;
+      const upb_msglayout_msginit_v1 *subm = m->submsgs[f->submsg_index];
+      for (i = 0; i < arr->len; i++, ptr++) {
+        size_t size = upb_encode_messagesize(*ptr, subm);
+        ret += upb_tag_size(f->number, UPB_WIRE_TYPE_DELIMITED) +
+               upb_varint_size(size) + size;
+      }
+      return ret;
+    }
+  }
+#undef VARINT_CASE
+
+  /* Primitive arrays are always packed. */
+  return upb_tag_size(f->number, UPB_WIRE_TYPE_DELIMITED) +
+         upb_varint_size(ret) + ret;
+}
+
+static size_t upb_encode_scalarsize(const char *field_mem,
+                                    const upb_msglayout_msginit_v1 *m,
+                                    const upb_msglayout_fieldinit_v1 *f,
+                                    bool is_proto3) {
+  bool skip_zero_value = is_proto3 && f->oneof_index == UPB_NOT_IN_ONEOF;
+
+#define CASE(ctype, wire_type, valsize) do { \
+  ctype val = *(ctype*)field_mem; \
+  if (skip_zero_value && val == 0) { \
+    return 0; \
+  } \
+  return upb_tag_size(f->number, wire_type) + (valsize); \
+} while(0)
+
+  switch (f->type) {
+    case UPB_DESCRIPTOR_TYPE_DOUBLE:
+      CASE(double, UPB_WIRE_TYPE_64BIT, sizeof(uint64_t));
+    case UPB_DESCRIPTOR_TYPE_FLOAT:
+      CASE(float, UPB_WIRE_TYPE_32BIT, sizeof(uint32_t));
+    case UPB_DESCRIPTOR_TYPE_INT64:
+    case UPB_DESCRIPTOR_TYPE_UINT64:
+      CASE(uint64_t, UPB_WIRE_TYPE_VARINT, upb_varint_size(val));
+    case UPB_DESCRIPTOR_TYPE_UINT32:
+    case UPB_DESCRIPTOR_TYPE_INT32:
+    case UPB_DESCRIPTOR_TYPE_ENUM:
+      CASE(uint32_t, UPB_WIRE_TYPE_VARINT, upb_varint_size(val));
+    case UPB_DESCRIPTOR_TYPE_SFIXED64:
+    case UPB_DESCRIPTOR_TYPE_FIXED64:
+      CASE(uint64_t, UPB_WIRE_TYPE_64BIT, sizeof(uint64_t));
+    case UPB_DESCRIPTOR_TYPE_FIXED32:
+    case UPB_DESCRIPTOR_TYPE_SFIXED32:
+      CASE(uint32_t, UPB_WIRE_TYPE_32BIT, sizeof(uint32_t));
+    case UPB_DESCRIPTOR_TYPE_BOOL:
+      CASE(bool, UPB_WIRE_TYPE_VARINT, 1);
+    case UPB_DESCRIPTOR_TYPE_SINT32:
+      CASE(int32_t, UPB_WIRE_TYPE_VARINT,
+           upb_varint_size(upb_zzencode_32(val)));
+    case UPB_DESCRIPTOR_TYPE_SINT64:
+      CASE(int64_t, UPB_WIRE_TYPE_VARINT,
+           upb_varint_size(upb_zzencode_64(val)));
+    case UPB_DESCRIPTOR_TYPE_STRING:
+    case UPB_DESCRIPTOR_TYPE_BYTES: {
+      upb_stringview view = *(upb_stringview*)field_mem;
+      if (skip_zero_value && view.size == 0) {
+        return 0;
+      }
+      return upb_tag_size(f->number, UPB_WIRE_TYPE_DELIMITED) +
+             upb_varint_size(view.size) + view.size;
+    }
+    case UPB_DESCRIPTOR_TYPE_GROUP: {
+      const char *submsg = *(const char**)field_mem;
+      const upb_msglayout_msginit_v1 *subm = m->submsgs[f->submsg_index];
+      if (skip_zero_value && submsg == NULL) {
+        return 0;
+      }
+      return upb_tag_size(f->number, UPB_WIRE_TYPE_START_GROUP) +
+             upb_encode_messagesize(submsg, subm) +
+             upb_tag_size(f->number, UPB_WIRE_TYPE_END_GROUP);
+    }
+    case UPB_DESCRIPTOR_TYPE_MESSAGE: {
+      const char *submsg = *(const char**)field_mem;
+      const upb_msglayout_msginit_v1 *subm = m->submsgs[f->submsg_index];
+      size_t size;
+      if (skip_zero_value && submsg == NULL) {
+        return 0;
+      }
+      size = upb_lazymsg_is(submsg) ? upb_lazymsg_data(submsg)->size
+                                     : upb_encode_messagesize(submsg, subm);
+      return upb_tag_size(f->number, UPB_WIRE_TYPE_DELIMITED) +
+             upb_varint_size(size) + size;
+    }
+  }
+#undef CASE
+  UPB_UNREACHABLE();
+}
+
+static size_t upb_encode_fieldsize(const char *msg,
+                                   const upb_msglayout_msginit_v1 *m,
+                                   const upb_msglayout_fieldinit_v1 *f) {
+  if (f->label == UPB_LABEL_REPEATED) {
+    return upb_encode_arraysize(*(const upb_array**)(msg + f->offset), m, f);
+  } else if (upb_encode_hasscalarfield(msg, m, f)) {
+    return upb_encode_scalarsize(msg + f->offset, m, f, !m->is_proto2);
+  } else {
+    return 0;
+  }
+}
+
+static size_t upb_encode_messagesize(const char *msg,
+                                     const upb_msglayout_msginit_v1 *m) {
+  size_t ret = 0;
+  const upb_stringview *unknown;
+  size_t unknown_count;
+  size_t i;
+  uint64_t present[UPB_PRESENCE_MAXWORDS];
+  const upb_stringview *cached;
+
+  if (msg == NULL) {
+    return 0;
+  }
+
+  cached = upb_msg_getcache(msg);
+  if (cached) {
+    return cached->size;
+  }
+
+  unknown = upb_msg_getunknown(msg, &unknown_count);
+  for (i = 0; i < unknown_count; i++) {
+    ret += unknown[i].size;
+  }
+
+  if (upb_msg_presence(msg, m, present)) {
+    for (i = 0; i < (size_t)(m->field_count + 63) / 64; i++) {
+      uint64_t word = present[i];
+      while (word) {
+        ret += upb_encode_fieldsize(msg, m,
+                                    &m->fields[i * 64 + upb_ctz64(word)]);
+        word &= word - 1;
+      }
+    }
+  } else {
+    for (i = 0; i < m->field_count; i++) {
+      ret += upb_encode_fieldsize(msg, m, &m->fields[i]);
+    }
+  }
+
+  return ret;
+}
+
+size_t upb_encode_size(const void *msg, const upb_msglayout_msginit_v1 *m) {
+  return upb_encode_messagesize(msg, m);
+}
+
+bool upb_encode_into(const void *msg, const upb_msglayout_msginit_v1 *m,
+                     char *buf, size_t cap, size_t *size) {
+  upb_encstate e;
+  e.env = NULL;
+  e.buf = buf;
+  e.limit = buf + cap;
+  e.ptr = e.limit;
+  e.threshold = 0;
+  e.ref_bytes = 0;
+
+  if (!upb_encode_message(&e, msg, m, size)) {
+    *size = 0;
+    return false;
+  }
+
+  /* We encode backwards from the end of the buffer, so the output only needs
+   * to move if the buffer was bigger than upb_encode_size(). */
+  if (e.ptr != buf) {
+    memmove(buf, e.ptr, *size);
+  }
+
+  return true;
+}
+
+static char *upb_doencode(const void *msg, const upb_msglayout_msginit_v1 *m,
+                          upb_env *env, size_t *size) {
   upb_encstate e;
   e.env = env;
   e.buf = NULL;
   e.limit = NULL;
   e.ptr = NULL;
+  e.threshold = 0;
+  e.ref_bytes = 0;
 
   if (!upb_encode_message(&e, msg, m, size)) {
     *size = 0;
@@ -391,4 +742,709 @@ char *upb_encode(const void *msg, const upb_msglayout_msginit_v1 *m,
   }
 }
 
+char *upb_encode(const void *msg, const upb_msglayout_msginit_v1 *m,
+                 upb_env *env, size_t *size) {
+  char *ret;
+  upb_trace(UPB_TRACE_ENCODE, false, false, NULL, m, 0);
+  ret = upb_doencode(msg, m, env, size);
+  upb_trace(UPB_TRACE_ENCODE, true, ret != NULL, NULL, m, *size);
+  return ret;
+}
+
+upb_stringview *upb_encode_segments(const void *msg,
+                                    const upb_msglayout_msginit_v1 *m,
+                                    size_t threshold, upb_env *env,
+                                    size_t *count) {
+  upb_encstate e;
+  size_t size;
+  size_t i;
+  const char *p;
+
+  e.env = env;
+  e.buf = NULL;
+  e.limit = NULL;
+  e.ptr = NULL;
+  e.segs = NULL;
+  e.seg_count = 0;
+  e.seg_size = 0;
+  e.threshold = UPB_MAX(threshold, 1);
+  e.ref_bytes = 0;
+  e.seg_mark = 0;
+
+  if (!upb_encode_message(&e, msg, m, &size) || !upb_encode_cut(&e)) {
+    *count = 0;
+    return NULL;
+  }
+
+  /* Put the segments in output order and resolve buffer ranges, which are
+   * consecutive in the buffer starting at e.ptr. */
+  for (i = 0; i < e.seg_count / 2; i++) {
+    upb_stringview tmp = e.segs[i];
+    e.segs[i] = e.segs[e.seg_count - 1 - i];
+    e.segs[e.seg_count - 1 - i] = tmp;
+  }
+
+  p = e.ptr;
+  for (i = 0; i < e.seg_count; i++) {
+    if (e.segs[i].data == NULL) {
+      e.segs[i].data = p;
+      p += e.segs[i].size;
+    }
+  }
+
+  UPB_ASSERT(p == e.limit);
+  *count = e.seg_count;
+
+  if (e.seg_count == 0) {
+    static upb_stringview empty;
+    return &empty;
+  } else {
+    return e.segs;
+  }
+}
+
+
+/* Parallel encoding **********************************************************/
+
+static const upb_msglayout_fieldinit_v1 *upb_encode_splitfield(
+    const upb_msglayout_msginit_v1 *m, uint32_t field_number) {
+  int i;
+  for (i = 0; i < m->field_count; i++) {
+    const upb_msglayout_fieldinit_v1 *f = &m->fields[i];
+    if (f->number == field_number) {
+      return f->label == UPB_LABEL_REPEATED &&
+             f->type == UPB_DESCRIPTOR_TYPE_MESSAGE ? f : NULL;
+    }
+  }
+  return NULL;
+}
+
+/* The size of |msg| without |split|, like upb_encode_messagesize().  Every
+ * field is visited, since this is only done for the top level. */
+static size_t upb_encode_restsize(const char *msg,
+                                  const upb_msglayout_msginit_v1 *m,
+                                  const upb_msglayout_fieldinit_v1 *split) {
+  size_t ret = 0;
+  const upb_stringview *unknown;
+  size_t unknown_count;
+  size_t i;
+
+  unknown = upb_msg_getunknown(msg, &unknown_count);
+  for (i = 0; i < unknown_count; i++) {
+    ret += unknown[i].size;
+  }
+
+  for (i = 0; i < m->field_count; i++) {
+    if (&m->fields[i] != split) {
+      ret += upb_encode_fieldsize(msg, m, &m->fields[i]);
+    }
+  }
+
+  return ret;
+}
+
+/* Encodes |msg| like upb_encode_message(), except that |split| is left as a
+ * hole of |split_size| bytes, which is returned in |*hole|. */
+static bool upb_encode_rest(upb_encstate *e, const char *msg,
+                            const upb_msglayout_msginit_v1 *m,
+                            const upb_msglayout_fieldinit_v1 *split,
+                            size_t split_size, char **hole) {
+  const upb_stringview *unknown;
+  size_t unknown_count;
+  int i;
+
+  unknown = upb_msg_getunknown(msg, &unknown_count);
+  while (unknown_count > 0) {
+    unknown_count--;
+    CHK(upb_put_bytes(e, unknown[unknown_count].data,
+                      unknown[unknown_count].size));
+  }
+
+  for (i = m->field_count - 1; i >= 0; i--) {
+    if (&m->fields[i] == split) {
+      CHK(upb_encode_reserve(e, split_size));
+      *hole = e->ptr;
+    } else {
+      CHK(upb_encode_field(e, msg, m, &m->fields[i]));
+    }
+  }
+
+  return true;
+}
+
+char *upb_encode_split(const void *msg, const upb_msglayout_msginit_v1 *m,
+                       upb_env *env, uint32_t field_number,
+                       upb_encoderange *ranges, size_t *n, size_t *size) {
+  const upb_msglayout_fieldinit_v1 *field =
+      upb_encode_splitfield(m, field_number);
+  const upb_array *arr;
+  const upb_msglayout_msginit_v1 *subm;
+  const char *const *elems;
+  size_t split_size = 0;
+  size_t used, per, extra, first, i;
+  upb_encstate e;
+  char *buf;
+  char *hole = NULL;
+
+  *size = 0;
+  if (!field || *n == 0) {
+    *n = 0;
+    return NULL;
+  }
+
+  arr = msg ? *(const upb_array**)((const char*)msg + field->offset) : NULL;
+  if (arr == NULL || arr->len == 0 || upb_msg_getcache(msg)) {
+    /* Nothing to share out. */
+    *n = 0;
+    return upb_encode(msg, m, env, size);
+  }
+
+  /* Cut the elements into ranges of about equal counts, sizing each element
+   * once. */
+  subm = m->submsgs[field->submsg_index];
+  elems = arr->data;
+  used = UPB_MIN(*n, arr->len);
+  per = arr->len / used;
+  extra = arr->len % used;
+  first = 0;
+  for (i = 0; i < used; i++) {
+    upb_encoderange *r = &ranges[i];
+    size_t j;
+    r->first = first;
+    r->count = per + (i < extra);
+    r->field_number = field_number;
+    r->size = 0;
+    for (j = first; j < first + r->count; j++) {
+      size_t elem_size = upb_encode_messagesize(elems[j], subm);
+      r->size += upb_tag_size(field->number, UPB_WIRE_TYPE_DELIMITED) +
+                 upb_varint_size(elem_size) + elem_size;
+    }
+    split_size += r->size;
+    first += r->count;
+  }
+
+  *size = upb_encode_restsize(msg, m, field) + split_size;
+  buf = upb_env_malloc(env, *size);
+  if (!buf) {
+    *n = 0;
+    *size = 0;
+    return NULL;
+  }
+
+  /* The output is sized exactly, so this never grows it. */
+  e.env = NULL;
+  e.buf = buf;
+  e.limit = buf + *size;
+  e.ptr = e.limit;
+  e.threshold = 0;
+  e.ref_bytes = 0;
+  if (!upb_encode_rest(&e, msg, m, field, split_size, &hole)) {
+    *n = 0;
+    *size = 0;
+    return NULL;
+  }
+  UPB_ASSERT(e.ptr == buf);
+
+  for (i = 0; i < used; i++) {
+    ranges[i].out = hole;
+    hole += ranges[i].size;
+  }
+
+  *n = used;
+  return buf;
+}
+
+bool upb_encode_range(const upb_encoderange *r, const void *msg,
+                      const upb_msglayout_msginit_v1 *m) {
+  const upb_msglayout_fieldinit_v1 *field =
+      upb_encode_splitfield(m, r->field_number);
+  const upb_array *arr;
+  const upb_msglayout_msginit_v1 *subm;
+  void *const *ptr;
+  upb_encstate e;
+  size_t i;
+
+  CHK(field);
+  arr = *(const upb_array**)((const char*)msg + field->offset);
+  CHK(arr && r->first + r->count <= arr->len);
+  subm = m->submsgs[field->submsg_index];
+  ptr = (void *const *)arr->data + r->first;
+
+  e.env = NULL;
+  e.buf = r->out;
+  e.limit = r->out + r->size;
+  e.ptr = e.limit;
+  e.threshold = 0;
+  e.ref_bytes = 0;
+
+  for (i = r->count; i > 0; i--) {
+    size_t size;
+    CHK(upb_encode_message(&e, ptr[i - 1], subm, &size) &&
+        upb_put_varint(&e, size) &&
+        upb_put_tag(&e, field->number, UPB_WIRE_TYPE_DELIMITED));
+  }
+
+  /* Short if the elements changed since upb_encode_split() sized them. */
+  return e.ptr == r->out;
+}
+
+
+/* Encode plans ***************************************************************/
+
+/* A plan is the layout compiled into one op per field, with everything that
+ * upb_encode_message() works out per field per message done up front: the
+ * tag is already varint-encoded, the presence test is resolved to a byte and a
+ * mask (or a oneof case), the descriptor type is narrowed to the handful of
+ * encodings that actually differ, and submessages point straight at their own
+ * program.  The output is byte-for-byte what upb_encode() produces. */
+
+typedef enum {
+  UPB_EOP_FIXED32,
+  UPB_EOP_FIXED64,
+  UPB_EOP_VARINT32,
+  UPB_EOP_VARINT64,
+  UPB_EOP_BOOL,
+  UPB_EOP_ZZ32,
+  UPB_EOP_ZZ64,
+  UPB_EOP_STRING,
+  UPB_EOP_MSG,
+  UPB_EOP_GROUP,
+  UPB_EOP_REP_STRING,
+  UPB_EOP_REP_MSG,
+  UPB_EOP_REP_GROUP,
+  UPB_EOP_PACKED     /* Primitive arrays, via upb_encode_array(). */
+} upb_encodeop_type;
+
+typedef enum {
+  UPB_EPRES_ALWAYS,
+  UPB_EPRES_HASBIT,
+  UPB_EPRES_ONEOF
+} upb_encodepresence;
+
+/* Field numbers are at most 29 bits, so a tag takes at most 5 bytes. */
+#define UPB_ENCODE_MAXTAGLEN 5
+
+struct upb_encodeprog;
+
+typedef struct {
+  uint8_t op;          /* upb_encodeop_type */
+  uint8_t presence;    /* upb_encodepresence */
+  bool skip_zero;      /* Proto3 singular fields: zero/empty is not written. */
+  uint8_t tag_len;
+  char tag[UPB_ENCODE_MAXTAGLEN];
+  uint8_t endtag_len;  /* Groups only. */
+  char endtag[UPB_ENCODE_MAXTAGLEN];
+  uint8_t hasmask;
+  uint32_t hasbyte;    /* Or the oneof's case offset. */
+  uint32_t number;
+  uint32_t offset;
+  const struct upb_encodeprog *sub;
+  const upb_msglayout_fieldinit_v1 *field;
+} upb_encodeop;
+
+typedef struct upb_encodeprog {
+  const upb_msglayout_msginit_v1 *layout;
+  const upb_encodeop *ops;  /* One per field, in field index order. */
+} upb_encodeprog;
+
+struct upb_encodeplan {
+  upb_alloc *alloc;
+  upb_encodeprog *progs;  /* progs[0] is the root message. */
+  upb_encodeop *ops;
+};
+
+static bool upb_encode_prog(upb_encstate *e, const char *msg,
+                            const upb_encodeprog *p, size_t *size);
+
+static bool upb_put_optag(upb_encstate *e, const char *tag, size_t len) {
+  CHK(upb_encode_reserve(e, len));
+  memcpy(e->ptr, tag, len);
+  return true;
+}
+
+static bool upb_encode_opsubmsg(upb_encstate *e, const void *submsg,
+                                const upb_encodeop *op) {
+  size_t size;
+
+  if (op->op == UPB_EOP_GROUP || op->op == UPB_EOP_REP_GROUP) {
+    return upb_put_optag(e, op->endtag, op->endtag_len) &&
+           upb_encode_prog(e, submsg, op->sub, &size) &&
+           upb_put_optag(e, op->tag, op->tag_len);
+  }
+
+  if (upb_lazymsg_is(submsg)) {
+    const upb_stringview *data = upb_lazymsg_data(submsg);
+    CHK(upb_put_string(e, data->data, data->size));
+    size = data->size;
+  } else {
+    CHK(upb_encode_prog(e, submsg, op->sub, &size));
+  }
+
+  return upb_put_varint(e, size) && upb_put_optag(e, op->tag, op->tag_len);
+}
+
+static bool upb_encode_op(upb_encstate *e, const char *msg,
+                          const upb_encodeop *op) {
+  const char *mem = msg + op->offset;
+
+  switch (op->presence) {
+    case UPB_EPRES_HASBIT:
+      if (!(msg[op->hasbyte] & op->hasmask)) return true;
+      break;
+    case UPB_EPRES_ONEOF: {
+      uint32_t oneofcase;
+      memcpy(&oneofcase, msg + op->hasbyte, sizeof(oneofcase));
+      if (oneofcase != op->number) return true;
+      break;
+    }
+  }
+
+#define CASE(ctype, put) { \
+  ctype val; \
+  memcpy(&val, mem, sizeof(val)); \
+  if (op->skip_zero && val == 0) return true; \
+  CHK(put); \
+  break; \
+}
+
+  switch (op->op) {
+    case UPB_EOP_FIXED32:
+      CASE(uint32_t, upb_put_fixed32(e, val));
+    case UPB_EOP_FIXED64:
+      CASE(uint64_t, upb_put_fixed64(e, val));
+    case UPB_EOP_VARINT32:
+      CASE(uint32_t, upb_put_varint(e, val));
+    case UPB_EOP_VARINT64:
+      CASE(uint64_t, upb_put_varint(e, val));
+    case UPB_EOP_BOOL:
+      CASE(bool, upb_put_varint(e, val));
+    case UPB_EOP_ZZ32:
+      CASE(int32_t, upb_put_varint(e, upb_zzencode_32(val)));
+    case UPB_EOP_ZZ64:
+      CASE(int64_t, upb_put_varint(e, upb_zzencode_64(val)));
+    case UPB_EOP_STRING: {
+      const upb_stringview *view = (const upb_stringview*)mem;
+      if (op->skip_zero && view->size == 0) return true;
+      CHK(upb_put_string(e, view->data, view->size) &&
+          upb_put_varint(e, view->size));
+      break;
+    }
+    case UPB_EOP_MSG:
+    case UPB_EOP_GROUP: {
+      const void *submsg = *(const void**)mem;
+      if (op->skip_zero && submsg == NULL) return true;
+      return upb_encode_opsubmsg(e, submsg, op);
+    }
+    case UPB_EOP_REP_STRING: {
+      const upb_array *arr = *(const upb_array**)mem;
+      const upb_stringview *start, *ptr;
+      if (arr == NULL || arr->len == 0) return true;
+      start = arr->data;
+      ptr = start + arr->len;
+      do {
+        ptr--;
+        CHK(upb_put_string(e, ptr->data, ptr->size) &&
+            upb_put_varint(e, ptr->size) &&
+            upb_put_optag(e, op->tag, op->tag_len));
+      } while (ptr != start);
+      return true;
+    }
+    case UPB_EOP_REP_MSG:
+    case UPB_EOP_REP_GROUP: {
+      const upb_array *arr = *(const upb_array**)mem;
+      void *const *start;
+      void *const *ptr;
+      if (arr == NULL || arr->len == 0) return true;
+      start = arr->data;
+      ptr = start + arr->len;
+      do {
+        ptr--;
+        CHK(upb_encode_opsubmsg(e, *ptr, op));
+      } while (ptr != start);
+      return true;
+    }
+    case UPB_EOP_PACKED:
+      return upb_encode_array(e, mem, op->sub->layout, op->field);
+  }
+#undef CASE
+
+  return upb_put_optag(e, op->tag, op->tag_len);
+}
+
+static bool upb_encode_prog(upb_encstate *e, const char *msg,
+                            const upb_encodeprog *p, size_t *size) {
+  const upb_msglayout_msginit_v1 *m = p->layout;
+  size_t pre_len = upb_encode_pos(e);
+  uint64_t present[UPB_PRESENCE_MAXWORDS];
+  const upb_stringview *unknown;
+  const upb_stringview *cached;
+  size_t unknown_count;
+  int i;
+
+  if (msg == NULL) {
+    *size = 0;
+    return true;
+  }
+
+  cached = upb_msg_getcache(msg);
+  if (cached) {
+    *size = cached->size;
+    return upb_put_string(e, cached->data, cached->size);
+  }
+
+  unknown = upb_msg_getunknown(msg, &unknown_count);
+  while (unknown_count > 0) {
+    unknown_count--;
+    CHK(upb_put_bytes(e, unknown[unknown_count].data,
+                      unknown[unknown_count].size));
+  }
+
+  if (upb_msg_presence(msg, m, present)) {
+    for (i = (m->field_count + 63) / 64 - 1; i >= 0; i--) {
+      uint64_t word = present[i];
+      while (word) {
+        int bit = 63 - upb_clz64(word);
+        CHK(upb_encode_op(e, msg, &p->ops[i * 64 + bit]));
+        word &= ~((uint64_t)1 << bit);
+      }
+    }
+  } else {
+    for (i = m->field_count - 1; i >= 0; i--) {
+      CHK(upb_encode_op(e, msg, &p->ops[i]));
+    }
+  }
+
+  *size = upb_encode_pos(e) - pre_len;
+  return true;
+}
+
+static const upb_msglayout_msginit_v1 *upb_encode_submsglayout(
+    const upb_msglayout_msginit_v1 *m, const upb_msglayout_fieldinit_v1 *f) {
+  if (f->type != UPB_DESCRIPTOR_TYPE_MESSAGE &&
+      f->type != UPB_DESCRIPTOR_TYPE_GROUP) {
+    return NULL;
+  }
+  /* NULL for map fields, which the plan leaves to upb_encode_array(). */
+  return m->submsgs[f->submsg_index];
+}
+
+/* Numbers every layout reachable from |m|, in the order first seen, and counts
+ * their fields. */
+static bool upb_encodeplan_collect(upb_inttable *t, upb_alloc *a,
+                                   const upb_msglayout_msginit_v1 *m,
+                                   size_t *field_count) {
+  size_t i;
+
+  if (upb_inttable_lookupptr(t, m, NULL)) {
+    return true;
+  }
+
+  CHK(upb_inttable_insertptr2(t, m, upb_value_uint64(upb_inttable_count(t)),
+                              a));
+  *field_count += m->field_count;
+
+  for (i = 0; i < m->field_count; i++) {
+    const upb_msglayout_msginit_v1 *subm =
+        upb_encode_submsglayout(m, &m->fields[i]);
+    if (subm) {
+      CHK(upb_encodeplan_collect(t, a, subm, field_count));
+    }
+  }
+
+  return true;
+}
+
+static void upb_encodeplan_compileop(const upb_inttable *t,
+                                     const upb_encodeprog *progs,
+                                     const upb_encodeprog *p,
+                                     const upb_msglayout_fieldinit_v1 *f,
+                                     upb_encodeop *op) {
+  const upb_msglayout_msginit_v1 *m = p->layout;
+  const upb_msglayout_msginit_v1 *subm = upb_encode_submsglayout(m, f);
+  bool repeated = f->label == UPB_LABEL_REPEATED;
+  int wire_type;
+
+  memset(op, 0, sizeof(*op));
+  op->number = f->number;
+  op->offset = f->offset;
+  op->field = f;
+  op->sub = p;
+
+  if (subm) {
+    upb_value v;
+    bool ok = upb_inttable_lookupptr(t, subm, &v);
+    UPB_ASSERT(ok);
+    UPB_UNUSED(ok);
+    op->sub = &progs[upb_value_getuint64(v)];
+  }
+
+  /* Same presence rules as upb_encode_hasscalarfield(). */
+  if (repeated) {
+    op->presence = UPB_EPRES_ALWAYS;
+  } else if (f->oneof_index != UPB_NOT_IN_ONEOF) {
+    op->presence = UPB_EPRES_ONEOF;
+    op->hasbyte = m->oneofs[f->oneof_index].case_offset;
+  } else if (m->is_proto2 || f->hasbit != UPB_NO_HASBIT) {
+    op->presence = UPB_EPRES_HASBIT;
+    op->hasbyte = f->hasbit / 8;
+    op->hasmask = 1 << (f->hasbit % 8);
+  }
+  op->skip_zero = !repeated && !m->is_proto2 &&
+                  f->oneof_index == UPB_NOT_IN_ONEOF;
+
+  switch (f->type) {
+    case UPB_DESCRIPTOR_TYPE_DOUBLE:
+    case UPB_DESCRIPTOR_TYPE_FIXED64:
+    case UPB_DESCRIPTOR_TYPE_SFIXED64:
+      op->op = UPB_EOP_FIXED64;
+      wire_type = UPB_WIRE_TYPE_64BIT;
+      break;
+    case UPB_DESCRIPTOR_TYPE_FLOAT:
+    case UPB_DESCRIPTOR_TYPE_FIXED32:
+    case UPB_DESCRIPTOR_TYPE_SFIXED32:
+      op->op = UPB_EOP_FIXED32;
+      wire_type = UPB_WIRE_TYPE_32BIT;
+      break;
+    case UPB_DESCRIPTOR_TYPE_INT64:
+    case UPB_DESCRIPTOR_TYPE_UINT64:
+      op->op = UPB_EOP_VARINT64;
+      wire_type = UPB_WIRE_TYPE_VARINT;
+      break;
+    case UPB_DESCRIPTOR_TYPE_INT32:
+    case UPB_DESCRIPTOR_TYPE_UINT32:
+    case UPB_DESCRIPTOR_TYPE_ENUM:
+      op->op = UPB_EOP_VARINT32;
+      wire_type = UPB_WIRE_TYPE_VARINT;
+      break;
+    case UPB_DESCRIPTOR_TYPE_BOOL:
+      op->op = UPB_EOP_BOOL;
+      wire_type = UPB_WIRE_TYPE_VARINT;
+      break;
+    case UPB_DESCRIPTOR_TYPE_SINT32:
+      op->op = UPB_EOP_ZZ32;
+      wire_type = UPB_WIRE_TYPE_VARINT;
+      break;
+    case UPB_DESCRIPTOR_TYPE_SINT64:
+      op->op = UPB_EOP_ZZ64;
+      wire_type = UPB_WIRE_TYPE_VARINT;
+      break;
+    case UPB_DESCRIPTOR_TYPE_STRING:
+    case UPB_DESCRIPTOR_TYPE_BYTES:
+      op->op = repeated ? UPB_EOP_REP_STRING : UPB_EOP_STRING;
+      wire_type = UPB_WIRE_TYPE_DELIMITED;
+      break;
+    case UPB_DESCRIPTOR_TYPE_MESSAGE:
+      op->op = repeated ? UPB_EOP_REP_MSG : UPB_EOP_MSG;
+      wire_type = UPB_WIRE_TYPE_DELIMITED;
+      break;
+    case UPB_DESCRIPTOR_TYPE_GROUP:
+      op->op = repeated ? UPB_EOP_REP_GROUP : UPB_EOP_GROUP;
+      wire_type = UPB_WIRE_TYPE_START_GROUP;
+      op->endtag_len = upb_vencode64(
+          (f->number << 3) | UPB_WIRE_TYPE_END_GROUP, op->endtag);
+      break;
+    default:
+      UPB_UNREACHABLE();
+  }
+
+  if (repeated && !subm && op->op != UPB_EOP_REP_STRING) {
+    /* Packed primitives (and maps, which have no submessage layout) are left
+     * to upb_encode_array(), which writes their tag itself. */
+    op->op = UPB_EOP_PACKED;
+  }
+
+  op->tag_len = upb_vencode64((f->number << 3) | wire_type, op->tag);
+}
+
+upb_encodeplan *upb_encodeplan_new(const upb_msglayout_msginit_v1 *m,
+                                   upb_alloc *a) {
+  upb_encodeplan *p;
+  upb_inttable t;
+  upb_inttable_iter iter;
+  size_t field_count = 0;
+  size_t prog_count;
+  size_t i;
+  upb_encodeop *op;
+
+  if (!upb_inttable_init2(&t, UPB_CTYPE_UINT64, a)) {
+    return NULL;
+  }
+
+  p = upb_malloc(a, sizeof(*p));
+  if (!p || !upb_encodeplan_collect(&t, a, m, &field_count)) {
+    goto err;
+  }
+
+  prog_count = upb_inttable_count(&t);
+  p->alloc = a;
+  p->progs = upb_malloc(a, prog_count * sizeof(*p->progs));
+  p->ops = upb_malloc(a, UPB_MAX(field_count, 1) * sizeof(*p->ops));
+  if (!p->progs || !p->ops) {
+    upb_free(a, p->progs);
+    upb_free(a, p->ops);
+    goto err;
+  }
+
+  upb_inttable_begin(&iter, &t);
+  for (; !upb_inttable_done(&iter); upb_inttable_next(&iter)) {
+    size_t idx = upb_value_getuint64(upb_inttable_iter_value(&iter));
+    p->progs[idx].layout =
+        (const upb_msglayout_msginit_v1*)upb_inttable_iter_key(&iter);
+  }
+
+  op = p->ops;
+  for (i = 0; i < prog_count; i++) {
+    upb_encodeprog *prog = &p->progs[i];
+    size_t j;
+    prog->ops = op;
+    for (j = 0; j < prog->layout->field_count; j++) {
+      upb_encodeplan_compileop(&t, p->progs, prog, &prog->layout->fields[j],
+                               op++);
+    }
+  }
+
+  upb_inttable_uninit2(&t, a);
+  return p;
+
+err:
+  upb_free(a, p);
+  upb_inttable_uninit2(&t, a);
+  return NULL;
+}
+
+void upb_encodeplan_free(upb_encodeplan *p) {
+  upb_alloc *a = p->alloc;
+  upb_free(a, p->progs);
+  upb_free(a, p->ops);
+  upb_free(a, p);
+}
+
+char *upb_encode_withplan(const void *msg, const upb_encodeplan *p,
+                          upb_env *env, size_t *size) {
+  upb_encstate e;
+  const upb_msglayout_msginit_v1 *m = p->progs[0].layout;
+  bool ok;
+
+  e.env = env;
+  e.buf = NULL;
+  e.limit = NULL;
+  e.ptr = NULL;
+  e.threshold = 0;
+  e.ref_bytes = 0;
+
+  upb_trace(UPB_TRACE_ENCODE, false, false, NULL, m, 0);
+  ok = upb_encode_prog(&e, msg, &p->progs[0], size);
+  *size = ok ? (size_t)(e.limit - e.ptr) : 0;
+  upb_trace(UPB_TRACE_ENCODE, true, ok, NULL, m, *size);
+
+  if (!ok) {
+    return NULL;
+  } else if (*size == 0) {
+    static char ch;
+    return &ch;
+  } else {
+    return e.ptr;
+  }
+}
+
 #undef CHK
@@ -12,6 +12,87 @@ UPB_BEGIN_EXTERN_C
 char *upb_encode(const void *msg, const upb_msglayout_msginit_v1 *l,
                  upb_env *env, size_t *size);
 
+/* Returns the exact number of bytes that upb_encode() would produce for this
+ * message, computed in a single pass without allocating. */
+size_t upb_encode_size(const void *msg, const upb_msglayout_msginit_v1 *l);
+
+/* Serializes the message into the caller-supplied buffer [buf, buf+cap)
+ * without allocating.  Returns false if the buffer is too small.  On success
+ * the output starts at |buf| and its length is stored in |*size|.
+ *
+ * Sizing the buffer with upb_encode_size() lets the encoder write straight
+ * into place; a larger buffer costs one memmove() at the end. */
+bool upb_encode_into(const void *msg, const upb_msglayout_msginit_v1 *l,
+                     char *buf, size_t cap, size_t *size);
+
+/* Serializes the message as a list of segments whose concatenation is the
+ * encoded message, suitable for writev()/sendmsg().  String and bytes fields
+ * of at least |threshold| bytes are not copied: their segment points straight
+ * at the message's data, so the message must outlive the segments.  All other
+ * output is encoded into buffers allocated from |env|, as is the returned
+ * array of |*count| segments.  Returns NULL on failure. */
+upb_stringview *upb_encode_segments(const void *msg,
+                                    const upb_msglayout_msginit_v1 *l,
+                                    size_t threshold, upb_env *env,
+                                    size_t *count);
+
+/* A share of the elements of one top-level repeated submessage field, as
+ * divided up by upb_encode_split(). */
+typedef struct {
+  /* Where this share's encoding goes: exactly |size| bytes at |out|, in the
+   * buffer that upb_encode_split() returned. */
+  char *out;
+  size_t size;
+
+  /* Index in the field's array of the first element, and number of
+   * elements. */
+  size_t first;
+  size_t count;
+
+  uint32_t field_number;
+} upb_encoderange;
+
+/* Parallel encoding, the counterpart of upb_decode_split(), for messages made
+ * up mostly of one large top-level repeated submessage field |field_number|.
+ * upb_encode_split() sizes the message exactly and allocates the whole output
+ * from |env| at once, of |*size| bytes, but only encodes the other fields.
+ * The field's elements are divided into at most |*n| |ranges| of about equal
+ * numbers of elements, each given its place in the output, and |*n| is set to
+ * the number of ranges used.
+ *
+ * Each range is then encoded by upb_encode_range(), which writes its elements
+ * into their place without allocating.  Ranges do not share any state, so they
+ * may be encoded on different threads at the same time, and the output is
+ * complete once every range has been encoded successfully.  |msg| must not
+ * change in the meantime.
+ *
+ * If the field is empty (or the message is cached, see upb_decodeopts.cache),
+ * the output is encoded whole and |*n| is set to 0.  Returns NULL if
+ * |field_number| is not a repeated submessage field of |l|, or on failure. */
+char *upb_encode_split(const void *msg, const upb_msglayout_msginit_v1 *l,
+                       upb_env *env, uint32_t field_number,
+                       upb_encoderange *ranges, size_t *n, size_t *size);
+bool upb_encode_range(const upb_encoderange *r, const void *msg,
+                      const upb_msglayout_msginit_v1 *l);
+
+/* A plan compiles a layout, and every layout reachable from it, into a flat
+ * list of per-field encoding ops with the tags already encoded.  Encoding with
+ * a plan produces exactly the bytes upb_encode() would, without re-deriving
+ * each field's wire format from its descriptor type on every message.
+ *
+ * A plan only points at the layouts, so they must outlive it.  It is
+ * immutable once built and can be shared between threads. */
+typedef struct upb_encodeplan upb_encodeplan;
+
+/* Returns NULL if memory allocation failed. */
+upb_encodeplan *upb_encodeplan_new(const upb_msglayout_msginit_v1 *l,
+                                   upb_alloc *a);
+void upb_encodeplan_free(upb_encodeplan *p);
+
+/* Like upb_encode(), for a message of the plan's root layout. */
+char *upb_encode_withplan(const void *msg, const upb_encodeplan *p,
+                          upb_env *env, size_t *size);
+
 UPB_END_EXTERN_C
 
 #endif  /* UPB_ENCODE_H_ */
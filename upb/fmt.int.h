@@ -0,0 +1,44 @@
+/*
+** Number formatting and parsing for the text and JSON printers and parsers.
+**
+** This header is INTERNAL-ONLY!  Its interfaces are not public or stable!
+**
+** Floating-point values are printed with the fewest digits that parse back to
+** the same value (using the Ryu algorithm), laid out like printf's "%g".  None
+** of these functions depend on the locale.
+*/
+
+#ifndef UPB_FMT_H_
+#define UPB_FMT_H_
+
+#include <stdint.h>
+#include "upb/upb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Enough room for any value these functions print, plus a NULL terminator. */
+#define UPB_FMT_BUFSIZE 32
+
+/* Each of these writes |val| and a NULL terminator into |buf|, which must have
+ * room for UPB_FMT_BUFSIZE bytes, and returns the length without the NULL.
+ *
+ * Infinities and NaN are printed as "inf", "-inf" and "nan". */
+size_t upb_fmt_double(double val, char *buf);
+size_t upb_fmt_float(float val, char *buf);
+size_t upb_fmt_int64(int64_t val, char *buf);
+size_t upb_fmt_uint64(uint64_t val, char *buf);
+
+/* Sets |val| to the double nearest to digits * 10^exp10, negated if |neg|.
+ * Returns false, leaving |val| alone, for the rare inputs where this can't
+ * cheaply be sure of the rounding, and for results that are subnormal or out
+ * of range.  The caller should then fall back to strtod(). */
+bool upb_fmt_decimaltodouble(uint64_t digits, int32_t exp10, bool neg,
+                             double *val);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UPB_FMT_H_ */
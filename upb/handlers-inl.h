@@ -157,22 +157,18 @@ struct FirstUnlessVoidOrBool<bool, T2> {
   typedef T2 value;
 };
 
+/* A compile-time constant, so that attributes derived from it (like always_ok
+ * below) fold away instead of being read from a global at runtime. */
 template<class T, class U>
 struct is_same {
-  static bool value;
+  static const bool value = false;
 };
 
 template<class T>
 struct is_same<T, T> {
-  static bool value;
+  static const bool value = true;
 };
 
-template<class T, class U>
-bool is_same<T, U>::value = false;
-
-template<class T>
-bool is_same<T, T>::value = true;
-
 /* FuncInfo *******************************************************************/
 
 /* Info about the user's original, pre-wrapped function. */
@@ -567,6 +563,12 @@ bool ReturnTrue3(P1 p1, P2 p2, P3 p3) {
   return true;
 }
 
+template <class P1, class P2, class P3, class P4, void F(P1, P2, P3, P4)>
+bool ReturnTrue4(P1 p1, P2 p2, P3 p3, P4 p4) {
+  F(p1, p2, p3, p4);
+  return true;
+}
+
 /* Function wrapper that munges the return value from void to (void*)arg1  */
 template <class P1, class P2, void F(P1, P2)>
 void *ReturnClosure2(P1 p1, P2 p2) {
@@ -632,6 +634,13 @@ struct MaybeWrapReturn<Func3<void, P1, P2, P3, F, I>, bool> {
   typedef Func3<bool, P1, P2, P3, ReturnTrue3<P1, P2, P3, F>, I> Func;
 };
 
+/* For the array handler. */
+template <class P1, class P2, class P3, class P4, void F(P1, P2, P3, P4),
+          class I>
+struct MaybeWrapReturn<Func4<void, P1, P2, P3, P4, F, I>, bool> {
+  typedef Func4<bool, P1, P2, P3, P4, ReturnTrue4<P1, P2, P3, P4, F>, I> Func;
+};
+
 /* If our function returns void but we want one returning void*, wrap it in a
  * function that returns the first argument. */
 template <class P1, class P2, void F(P1, P2), class I>
@@ -749,6 +758,12 @@ R CastHandlerData3(void *c, const void *hd, P3Wrapper p3) {
   return F(static_cast<P1>(c), static_cast<P2>(hd), p3);
 }
 
+template <class R, class P1, class P2, class P3, class P4,
+          R F(P1, P2, P3, P4)>
+R CastHandlerData4(void *c, const void *hd, P3 p3, P4 p4) {
+  return F(static_cast<P1>(c), static_cast<P2>(hd), p3, p4);
+}
+
 template <class R, class P1, class P2, class P3, class P4, class P5,
           R F(P1, P2, P3, P4, P5)>
 R CastHandlerData5(void *c, const void *hd, P3 p3, P4 p4, P5 p5) {
@@ -785,6 +800,14 @@ struct ConvertParams<Func3<R, P1, const char *, size_t, F, I>, T> {
                 I> Func;
 };
 
+/* For the array handler. */
+template <class R, class P1, class P2, class P3, R F(P1, P2, P3), class I,
+          class T>
+struct ConvertParams<Func3<R, P1, P2, P3, F, I>, T> {
+  typedef Func4<R, void *, const void *, P2, P3,
+                IgnoreHandlerData4<R, P1, P2, P3, F>, I> Func;
+};
+
 template <class R, class P1, class P2, class P3, class P4, R F(P1, P2, P3, P4),
           class I, class T>
 struct ConvertParams<Func4<R, P1, P2, P3, P4, F, I>, T> {
@@ -816,6 +839,14 @@ struct ConvertParams<BoundFunc4<R, P1, P2, const char *, size_t, F, I>, T> {
                 I> Func;
 };
 
+/* For the array handler. */
+template <class R, class P1, class P2, class P3, class P4, R F(P1, P2, P3, P4),
+          class I, class T>
+struct ConvertParams<BoundFunc4<R, P1, P2, P3, P4, F, I>, T> {
+  typedef Func4<R, void *, const void *, P3, P4,
+                CastHandlerData4<R, P1, P2, P3, P4, F>, I> Func;
+};
+
 template <class R, class P1, class P2, class P3, class P4, class P5,
           R F(P1, P2, P3, P4, P5), class I, class T>
 struct ConvertParams<BoundFunc5<R, P1, P2, P3, P4, P5, F, I>, T> {
@@ -974,6 +1005,12 @@ inline bool HandlerAttributes::SetAlwaysOk(bool always_ok) {
 inline bool HandlerAttributes::always_ok() const {
   return upb_handlerattr_alwaysok(this);
 }
+inline bool HandlerAttributes::SetStore(size_t offset, int32_t hasbit) {
+  return upb_handlerattr_setstore(this, offset, hasbit);
+}
+inline bool HandlerAttributes::store(size_t *offset, int32_t *hasbit) const {
+  return upb_handlerattr_store(this, offset, hasbit);
+}
 
 inline BufferHandle::BufferHandle() { upb_bufhandle_init(this); }
 inline BufferHandle::~BufferHandle() { upb_bufhandle_uninit(this); }
@@ -1092,6 +1129,13 @@ inline bool Handlers::SetEndSequenceHandler(const FieldDef *f,
   handler.AddCleanup(this);
   return upb_handlers_setendseq(this, f, handler.handler_, &handler.attr_);
 }
+inline bool Handlers::SetArrayHandler(const FieldDef *f,
+                                      const ArrayHandler &handler) {
+  UPB_ASSERT(!handler.registered_);
+  handler.registered_ = true;
+  handler.AddCleanup(this);
+  return upb_handlers_setarray(this, f, handler.handler_, &handler.attr_);
+}
 inline bool Handlers::SetSubHandlers(const FieldDef *f, const Handlers *sub) {
   return upb_handlers_setsubhandlers(this, f, sub);
 }
@@ -1115,6 +1159,10 @@ inline Handlers::GenericFunction *Handlers::GetHandler(
 inline const void *Handlers::GetHandlerData(Handlers::Selector selector) {
   return upb_handlers_gethandlerdata(this, selector);
 }
+inline bool Handlers::GetAttributes(Handlers::Selector selector,
+                                    HandlerAttributes *attr) {
+  return upb_handlers_getattr(this, selector, attr);
+}
 
 inline BytesHandler::BytesHandler() {
   upb_byteshandler_init(this);
@@ -37,6 +37,7 @@ static void freehandlers(upb_refcounted *r) {
   upb_inttable_uninit(&h->cleanup_);
   upb_msgdef_unref(h->msg, h);
   upb_gfree(h->sub);
+  upb_gfree(h->attr);
   upb_gfree(h);
 }
 
@@ -139,7 +140,7 @@ static upb_selector_t handlers_getsel(upb_handlers *h, const upb_fielddef *f,
 
 static const void **returntype(upb_handlers *h, const upb_fielddef *f,
                                upb_handlertype_t type) {
-  return &h->table[handlers_getsel(h, f, type)].attr.return_closure_type_;
+  return &h->attr[handlers_getsel(h, f, type)].return_closure_type_;
 }
 
 static bool doset(upb_handlers *h, int32_t sel, const upb_fielddef *f,
@@ -167,6 +168,14 @@ static bool doset(upb_handlers *h, int32_t sel, const upb_fielddef *f,
     set_attr = *attr;
   }
 
+  if (set_attr.store_ &&
+      (type > UPB_HANDLER_BOOL || !f || upb_fielddef_isseq(f))) {
+    upb_status_seterrmsg(
+        &h->status_,
+        "store attribute is only valid for non-repeated primitive fields.");
+    return false;
+  }
+
   /* Check that the given closure type matches the closure type that has been
    * established for this context (if any). */
   closure_type = upb_handlerattr_closuretype(&set_attr);
@@ -203,7 +212,7 @@ static bool doset(upb_handlers *h, int32_t sel, const upb_fielddef *f,
   if (type == UPB_HANDLER_STARTSEQ || type == UPB_HANDLER_STARTSTR) {
     const void *return_type = upb_handlerattr_returnclosuretype(&set_attr);
     const void *table_return_type =
-        upb_handlerattr_returnclosuretype(&h->table[sel].attr);
+        upb_handlerattr_returnclosuretype(&h->attr[sel]);
     if (return_type && table_return_type && return_type != table_return_type) {
       upb_status_seterrmsg(&h->status_, "closure return type does not match");
       return false;
@@ -214,7 +223,8 @@ static bool doset(upb_handlers *h, int32_t sel, const upb_fielddef *f,
   }
 
   h->table[sel].func = (upb_func*)func;
-  h->table[sel].attr = set_attr;
+  h->table[sel].handler_data = upb_handlerattr_handlerdata(&set_attr);
+  h->attr[sel] = set_attr;
   return true;
 }
 
@@ -236,18 +246,18 @@ const void *effective_closure_type(upb_handlers *h, const upb_fielddef *f,
       type != UPB_HANDLER_STARTSEQ &&
       type != UPB_HANDLER_ENDSEQ &&
       h->table[sel = handlers_getsel(h, f, UPB_HANDLER_STARTSEQ)].func) {
-    ret = upb_handlerattr_returnclosuretype(&h->table[sel].attr);
+    ret = upb_handlerattr_returnclosuretype(&h->attr[sel]);
   }
 
   if (type == UPB_HANDLER_STRING &&
       h->table[sel = handlers_getsel(h, f, UPB_HANDLER_STARTSTR)].func) {
-    ret = upb_handlerattr_returnclosuretype(&h->table[sel].attr);
+    ret = upb_handlerattr_returnclosuretype(&h->attr[sel]);
   }
 
   /* The effective type of the submessage; not used yet.
    * if (type == SUBMESSAGE &&
    *     h->table[sel = handlers_getsel(h, f, UPB_HANDLER_STARTSUBMSG)].func) {
-   *   ret = upb_handlerattr_returnclosuretype(&h->table[sel].attr);
+   *   ret = upb_handlerattr_returnclosuretype(&h->attr[sel]);
    * } */
 
   return ret;
@@ -266,7 +276,7 @@ bool checkstart(upb_handlers *h, const upb_fielddef *f, upb_handlertype_t type,
   upb_selector_t sel = handlers_getsel(h, f, type);
   if (h->table[sel].func) return true;
   closure_type = effective_closure_type(h, f, type);
-  attr = &h->table[sel].attr;
+  attr = &h->attr[sel];
   return_closure_type = upb_handlerattr_returnclosuretype(attr);
   if (closure_type && return_closure_type &&
       closure_type != return_closure_type) {
@@ -294,6 +304,9 @@ upb_handlers *upb_handlers_new(const upb_msgdef *md, const void *owner) {
   upb_msgdef_ref(h->msg, h);
   upb_status_clear(&h->status_);
 
+  h->attr = upb_calloc(md->selector_count * sizeof(*h->attr));
+  if (!h->attr) goto oom;
+
   if (md->submsg_field_count > 0) {
     h->sub = upb_calloc(md->submsg_field_count * sizeof(*h->sub));
     if (!h->sub) goto oom;
@@ -338,6 +351,135 @@ const upb_handlers *upb_handlers_newfrozen(const upb_msgdef *m,
   return ret;
 }
 
+static void unrefhandlers(void *h) {
+  upb_handlers_unref(h, UPB_UNTRACKED_REF);
+}
+
+/* Returns the length of the first field name in "path". */
+static size_t pathlen(const char *path) {
+  const char *dot = strchr(path, '.');
+  return dot ? (size_t)(dot - path) : strlen(path);
+}
+
+static bool checkpaths(const upb_msgdef *m, const char *const *paths, size_t n,
+                       upb_status *status) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    size_t len = pathlen(paths[i]);
+    const upb_fielddef *f = upb_msgdef_ntof(m, paths[i], len);
+    if (!f || (paths[i][len] == '.' && !upb_fielddef_issubmsg(f))) {
+      upb_status_seterrf(status, "invalid field mask path for %s: %s",
+                         upb_msgdef_fullname(m), paths[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+static upb_handlers *newmasked(const upb_handlers *from,
+                               const char *const *paths, size_t n,
+                               const void *owner, upb_status *status) {
+  const upb_msgdef *m = upb_handlers_msgdef(from);
+  upb_handlers *h;
+  upb_msg_field_iter i;
+  const char **subpaths;
+
+  if (!checkpaths(m, paths, n, status)) return NULL;
+
+  h = upb_handlers_new(m, owner);
+  subpaths = upb_gmalloc(sizeof(*subpaths) * n);
+  if (!h || (n > 0 && !subpaths)) goto oom;
+
+  /* Our copied handler data belongs to "from", so it must outlive us. */
+  upb_handlers_ref(from, UPB_UNTRACKED_REF);
+  if (!upb_handlers_addcleanup(h, (void*)from, unrefhandlers)) {
+    upb_handlers_unref(from, UPB_UNTRACKED_REF);
+    goto oom;
+  }
+
+  h->top_closure_type = from->top_closure_type;
+  h->table[UPB_STARTMSG_SELECTOR] = from->table[UPB_STARTMSG_SELECTOR];
+  h->attr[UPB_STARTMSG_SELECTOR] = from->attr[UPB_STARTMSG_SELECTOR];
+  h->table[UPB_ENDMSG_SELECTOR] = from->table[UPB_ENDMSG_SELECTOR];
+  h->attr[UPB_ENDMSG_SELECTOR] = from->attr[UPB_ENDMSG_SELECTOR];
+
+  for(upb_msg_field_begin(&i, m);
+      !upb_msg_field_done(&i);
+      upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    const char *name = upb_fielddef_name(f);
+    size_t namelen = strlen(name);
+    bool whole = false;
+    size_t nsub = 0;
+    size_t j;
+    int type;
+
+    for (j = 0; j < n; j++) {
+      if (pathlen(paths[j]) != namelen ||
+          memcmp(paths[j], name, namelen) != 0) {
+        continue;
+      }
+      if (paths[j][namelen] == '\0') {
+        whole = true;
+      } else {
+        subpaths[nsub++] = paths[j] + namelen + 1;
+      }
+    }
+
+    if (!whole && nsub == 0) continue;
+
+    for (type = 0; type < UPB_HANDLER_MAX; type++) {
+      upb_selector_t sel;
+      if (upb_handlers_getselector(f, type, &sel)) {
+        h->table[sel] = from->table[sel];
+        h->attr[sel] = from->attr[sel];
+      }
+    }
+
+    if (upb_fielddef_issubmsg(f) && SUBH_F(from, f)) {
+      const upb_handlers *sub = SUBH_F(from, f);
+      if (whole) {
+        upb_handlers_setsubhandlers(h, f, sub);
+      } else {
+        upb_handlers *subh = newmasked(sub, subpaths, nsub, &subh, status);
+        if (!subh) goto err;
+        upb_handlers_setsubhandlers(h, f, subh);
+        upb_handlers_unref(subh, &subh);
+      }
+    }
+  }
+
+  upb_gfree(subpaths);
+  return h;
+
+oom:
+  upb_status_seterrmsg(status, "out of memory");
+err:
+  upb_gfree(subpaths);
+  if (h) upb_handlers_unref(h, owner);
+  return NULL;
+}
+
+const upb_handlers *upb_handlers_newmasked(const upb_handlers *h,
+                                           const char *const *paths, size_t n,
+                                           const void *owner,
+                                           upb_status *status) {
+  upb_handlers *ret;
+  upb_refcounted *r;
+  bool ok;
+
+  UPB_ASSERT(upb_handlers_isfrozen(h));
+
+  ret = newmasked(h, paths, n, owner, status);
+  if (!ret) return NULL;
+
+  r = upb_handlers_upcast_mutable(ret);
+  ok = upb_refcounted_freeze(&r, 1, NULL, UPB_MAX_HANDLER_DEPTH);
+  UPB_ASSERT(ok);
+
+  return ret;
+}
+
 const upb_status *upb_handlers_status(upb_handlers *h) {
   UPB_ASSERT(!upb_handlers_isfrozen(h));
   return &h->status_;
@@ -369,6 +511,7 @@ SETTER(startseq,    upb_startfield_handlerfunc*,  UPB_HANDLER_STARTSEQ)
 SETTER(startsubmsg, upb_startfield_handlerfunc*,  UPB_HANDLER_STARTSUBMSG)
 SETTER(endsubmsg,   upb_endfield_handlerfunc*,    UPB_HANDLER_ENDSUBMSG)
 SETTER(endseq,      upb_endfield_handlerfunc*,    UPB_HANDLER_ENDSEQ)
+SETTER(array,       upb_array_handlerfunc*,       UPB_HANDLER_ARRAY)
 
 #undef SETTER
 
@@ -415,7 +558,7 @@ bool upb_handlers_getattr(const upb_handlers *h, upb_selector_t sel,
                           upb_handlerattr *attr) {
   if (!upb_handlers_gethandler(h, sel))
     return false;
-  *attr = h->table[sel].attr;
+  *attr = h->attr[sel];
   return true;
 }
 
@@ -596,6 +739,10 @@ bool upb_handlers_getselector(const upb_fielddef *f, upb_handlertype_t type,
       if (!upb_fielddef_issubmsg(f)) return false;
       *s = f->selector_base;
       break;
+    case UPB_HANDLER_ARRAY:
+      if (!upb_fielddef_isseq(f) || !upb_fielddef_isprimitive(f)) return false;
+      *s = f->selector_base + 1;
+      break;
   }
   UPB_ASSERT((size_t)*s < upb_fielddef_containingtype(f)->selector_count);
   return true;
@@ -608,6 +755,9 @@ uint32_t upb_handlers_selectorbaseoffset(const upb_fielddef *f) {
 uint32_t upb_handlers_selectorcount(const upb_fielddef *f) {
   uint32_t ret = 1;
   if (upb_fielddef_isseq(f)) ret += 2;    /* STARTSEQ/ENDSEQ */
+  if (upb_fielddef_isseq(f) && upb_fielddef_isprimitive(f)) {
+    ret += 1;  /* ARRAY */
+  }
   if (upb_fielddef_isstring(f)) ret += 2; /* [STRING]/STARTSTR/ENDSTR */
   if (upb_fielddef_issubmsg(f)) {
     /* ENDSUBMSG (STARTSUBMSG is at table beginning) */
@@ -665,6 +815,22 @@ bool upb_handlerattr_alwaysok(const upb_handlerattr *attr) {
   return attr->alwaysok_;
 }
 
+bool upb_handlerattr_setstore(upb_handlerattr *attr, size_t offset,
+                              int32_t hasbit) {
+  attr->store_ = true;
+  attr->storeofs_ = offset;
+  attr->storehasbit_ = hasbit;
+  return true;
+}
+
+bool upb_handlerattr_store(const upb_handlerattr *attr, size_t *offset,
+                           int32_t *hasbit) {
+  if (!attr->store_) return false;
+  *offset = attr->storeofs_;
+  *hasbit = attr->storehasbit_;
+  return true;
+}
+
 /* upb_bufhandle **************************************************************/
 
 size_t upb_bufhandle_objofs(const upb_bufhandle *h) {
@@ -685,20 +851,105 @@ void upb_byteshandler_uninit(upb_byteshandler* h) {
 bool upb_byteshandler_setstartstr(upb_byteshandler *h,
                                   upb_startstr_handlerfunc *func, void *d) {
   h->table[UPB_STARTSTR_SELECTOR].func = (upb_func*)func;
-  h->table[UPB_STARTSTR_SELECTOR].attr.handler_data_ = d;
+  h->table[UPB_STARTSTR_SELECTOR].handler_data = d;
   return true;
 }
 
 bool upb_byteshandler_setstring(upb_byteshandler *h,
                                 upb_string_handlerfunc *func, void *d) {
   h->table[UPB_STRING_SELECTOR].func = (upb_func*)func;
-  h->table[UPB_STRING_SELECTOR].attr.handler_data_ = d;
+  h->table[UPB_STRING_SELECTOR].handler_data = d;
   return true;
 }
 
 bool upb_byteshandler_setendstr(upb_byteshandler *h,
                                 upb_endfield_handlerfunc *func, void *d) {
   h->table[UPB_ENDSTR_SELECTOR].func = (upb_func*)func;
-  h->table[UPB_ENDSTR_SELECTOR].attr.handler_data_ = d;
+  h->table[UPB_ENDSTR_SELECTOR].handler_data = d;
+  return true;
+}
+
+bool upb_byteshandler_setgetbuf(upb_byteshandler *h,
+                                upb_getbuf_handlerfunc *func, void *d) {
+  h->table[UPB_GETBUF_SELECTOR].func = (upb_func*)func;
+  h->table[UPB_GETBUF_SELECTOR].handler_data = d;
+  return true;
+}
+
+/* upb_handlercache ***********************************************************/
+
+struct upb_handlercache {
+  upb_inttable tab;  /* maps upb_msgdef* -> upb_handlers*, we own a ref. */
+  upb_handlers_callback *callback;
+  const void *closure;
+};
+
+upb_handlercache *upb_handlercache_new(upb_handlers_callback *callback,
+                                       const void *closure) {
+  upb_handlercache *c = upb_gmalloc(sizeof(*c));
+  if (!c) return NULL;
+
+  c->callback = callback;
+  c->closure = closure;
+
+  if (!upb_inttable_init(&c->tab, UPB_CTYPE_CONSTPTR)) {
+    upb_gfree(c);
+    return NULL;
+  }
+
+  return c;
+}
+
+void upb_handlercache_free(upb_handlercache *c) {
+  upb_inttable_iter i;
+  upb_inttable_begin(&i, &c->tab);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    const upb_handlers *h = upb_value_getconstptr(upb_inttable_iter_value(&i));
+    upb_handlers_unref(h, c);
+  }
+
+  upb_inttable_uninit(&c->tab);
+  upb_gfree(c);
+}
+
+/* Adds "h" and every handlers object reachable from it that is not cached yet,
+ * so later lookups of submessages don't build a second graph. */
+static bool handlercache_add(upb_handlercache *c, const upb_handlers *h) {
+  const upb_msgdef *m = upb_handlers_msgdef(h);
+  upb_msg_field_iter i;
+
+  if (upb_inttable_lookupptr(&c->tab, m, NULL)) return true;
+  if (!upb_inttable_insertptr(&c->tab, m, upb_value_constptr(h))) return false;
+  upb_handlers_ref(h, c);
+
+  for(upb_msg_field_begin(&i, m);
+      !upb_msg_field_done(&i);
+      upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    const upb_handlers *sub;
+
+    if (!upb_fielddef_issubmsg(f)) continue;
+    sub = upb_handlers_getsubhandlers(h, f);
+    if (sub && !handlercache_add(c, sub)) return false;
+  }
+
   return true;
 }
+
+const upb_handlers *upb_handlercache_get(upb_handlercache *c,
+                                         const upb_msgdef *md) {
+  upb_value v;
+  const upb_handlers *h;
+  bool ok;
+
+  if (upb_inttable_lookupptr(&c->tab, md, &v)) {
+    return upb_value_getconstptr(v);
+  }
+
+  h = upb_handlers_newfrozen(md, &h, c->callback, c->closure);
+  if (!h) return NULL;
+
+  ok = handlercache_add(c, h);
+  upb_handlers_unref(h, &h);
+  return ok ? h : NULL;
+}
@@ -26,6 +26,7 @@
 namespace upb {
 class BufferHandle;
 class BytesHandler;
+class HandlerCache;
 class HandlerAttributes;
 class Handlers;
 template <class T> class Handler;
@@ -38,6 +39,7 @@ UPB_DECLARE_TYPE(upb::BytesHandler, upb_byteshandler)
 UPB_DECLARE_TYPE(upb::HandlerAttributes, upb_handlerattr)
 UPB_DECLARE_DERIVED_TYPE(upb::Handlers, upb::RefCounted,
                          upb_handlers, upb_refcounted)
+UPB_DECLARE_TYPE(upb::HandlerCache, upb_handlercache)
 
 /* The maximum depth that the handler graph can have.  This is a resource limit
  * for the C stack since we sometimes need to recursively traverse the graph.
@@ -64,10 +66,11 @@ typedef enum {
   UPB_HANDLER_STARTSUBMSG,
   UPB_HANDLER_ENDSUBMSG,
   UPB_HANDLER_STARTSEQ,
-  UPB_HANDLER_ENDSEQ
+  UPB_HANDLER_ENDSEQ,
+  UPB_HANDLER_ARRAY
 } upb_handlertype_t;
 
-#define UPB_HANDLER_MAX (UPB_HANDLER_ENDSEQ+1)
+#define UPB_HANDLER_MAX (UPB_HANDLER_ARRAY+1)
 
 #define UPB_BREAK NULL
 
@@ -111,6 +114,7 @@ UPB_END_EXTERN_C
 #define UPB_STARTSTR_SELECTOR 0
 #define UPB_STRING_SELECTOR 1
 #define UPB_ENDSTR_SELECTOR 2
+#define UPB_GETBUF_SELECTOR 3
 
 typedef void upb_handlerfree(void *d);
 
@@ -148,6 +152,14 @@ class upb::HandlerAttributes {
   bool SetAlwaysOk(bool always_ok);
   bool always_ok() const;
 
+  /* Declares that the handler does nothing but store its value at "offset"
+   * bytes into the closure and, if "hasbit" is non-negative, set that bit
+   * counting from the start of the closure.  Decoders may then do the store
+   * themselves instead of calling the handler.  Only valid for non-repeated
+   * primitive-valued handlers. */
+  bool SetStore(size_t offset, int32_t hasbit);
+  bool store(size_t *offset, int32_t *hasbit) const;
+
  private:
   friend UPB_INLINE const void * ::upb_handlerattr_handlerdata(
       const upb_handlerattr *attr);
@@ -158,24 +170,21 @@ struct upb_handlerattr {
   const void *closure_type_;
   const void *return_closure_type_;
   bool alwaysok_;
+  bool store_;
+  size_t storeofs_;
+  int32_t storehasbit_;
 };
 
-#define UPB_HANDLERATTR_INITIALIZER {NULL, NULL, NULL, false}
+#define UPB_HANDLERATTR_INITIALIZER {NULL, NULL, NULL, false, false, 0, -1}
 
+/* Only what is needed to call a handler lives in the table, so that four
+ * entries fit in a cache line.  The rest of each handler's attributes is only
+ * needed when setting or inspecting handlers (not when calling them), so
+ * upb_handlers keeps it in a separate array.  We do not expose the table's
+ * layout so that it can keep changing. */
 typedef struct {
   upb_func *func;
-
-  /* It is wasteful to include the entire attributes here:
-   *
-   * * Some of the information is redundant (like storing the closure type
-   *   separately for each handler that must match).
-   * * Some of the info is only needed prior to freeze() (like closure types).
-   * * alignment padding wastes a lot of space for alwaysok_.
-   *
-   * If/when the size and locality of handlers is an issue, we can optimize this
-   * not to store the entire attr like this.  We do not expose the table's
-   * layout to allow this optimization in the future. */
-  upb_handlerattr attr;
+  const void *handler_data;
 } upb_handlers_tabent;
 
 #ifdef __cplusplus
@@ -268,6 +277,9 @@ class upb::Handlers {
   typedef ValueHandler<double>::H      DoubleHandler;
   typedef ValueHandler<bool>::H        BoolHandler;
 
+  typedef Handler<bool (*)(void *, const void *, const void *, size_t)>
+      ArrayHandler;
+
   /* Any function pointer can be converted to this and converted back to its
    * correct type. */
   typedef void GenericFunction();
@@ -472,6 +484,28 @@ class upb::Handlers {
    */
   bool SetEndSequenceHandler(const FieldDef* f, const EndFieldHandler& h);
 
+  /* Sets the array handler for a repeated primitive field, which is defined as
+   * follows:
+   *
+   *   bool array(MyClosure* c, const MyHandlerData* d, const void *vals,
+   *              size_t n) {
+   *     // Called with "n" consecutive values of the sequence, as an array of
+   *     // the field's value type (int32_t for both INT32 and ENUM fields,
+   *     // etc.).  Returns true to continue processing.
+   *     return true;
+   *   }
+   *
+   * This is an optional companion to the field's value handler, and should
+   * have the same effect as calling it once per value.  Decoders that know
+   * about array handlers (the pb decoder and JSON parser) will deliver runs of
+   * values through it when it is set; other producers only call the value
+   * handler.
+   *
+   * Returns "false" if "f" does not belong to this message or is not a
+   * repeated primitive field.
+   */
+  bool SetArrayHandler(const FieldDef* f, const ArrayHandler& h);
+
   /* Sets or gets the object that specifies handlers for the given field, which
    * must be a submessage or group.  Returns NULL if no handlers are set. */
   bool SetSubHandlers(const FieldDef* f, const Handlers* sub);
@@ -525,6 +559,7 @@ struct upb_handlers {
   const void *top_closure_type;
   upb_inttable cleanup_;
   upb_status status_;  /* Used only when mutable. */
+  upb_handlerattr *attr;  /* Full attributes, parallel to table. */
   upb_handlers_tabent table[1];  /* Dynamically-sized field handler array. */
 };
 
@@ -565,6 +600,11 @@ namespace upb {
  *   handlers->SetInt32Handler(f2, UpbMakeHandler(OnValue2));
  *   handlers->SetInt32Handler(f1, UpbMakeHandler(OnValue3));
  *   handlers->SetInt32Handler(f2, UpbMakeHandler(&MyClosure::OnValue));
+ *
+ * The function is a template parameter of the wrapper, which calls it directly
+ * (usually inlined), so calling the handler costs one indirect call.  A
+ * function returning void, including an array handler, is also flagged
+ * always_ok, so the JIT doesn't check its result.
  */
 
 #ifdef UPB_CXX11
@@ -647,10 +687,14 @@ typedef bool upb_uint64_handlerfunc(void *c, const void *hd, uint64_t val);
 typedef bool upb_float_handlerfunc(void *c, const void *hd, float val);
 typedef bool upb_double_handlerfunc(void *c, const void *hd, double val);
 typedef bool upb_bool_handlerfunc(void *c, const void *hd, bool val);
+typedef bool upb_array_handlerfunc(void *c, const void *hd, const void *vals,
+                                   size_t n);
 typedef void *upb_startstr_handlerfunc(void *c, const void *hd,
                                        size_t size_hint);
 typedef size_t upb_string_handlerfunc(void *c, const void *hd, const char *buf,
                                       size_t n, const upb_bufhandle* handle);
+typedef char *upb_getbuf_handlerfunc(void *c, const void *hd, size_t min,
+                                     size_t *size);
 
 /* upb_bufhandle */
 size_t upb_bufhandle_objofs(const upb_bufhandle *h);
@@ -667,6 +711,10 @@ bool upb_handlerattr_setreturnclosuretype(upb_handlerattr *attr,
 const void *upb_handlerattr_returnclosuretype(const upb_handlerattr *attr);
 bool upb_handlerattr_setalwaysok(upb_handlerattr *attr, bool alwaysok);
 bool upb_handlerattr_alwaysok(const upb_handlerattr *attr);
+bool upb_handlerattr_setstore(upb_handlerattr *attr, size_t offset,
+                              int32_t hasbit);
+bool upb_handlerattr_store(const upb_handlerattr *attr, size_t *offset,
+                           int32_t *hasbit);
 
 UPB_INLINE const void *upb_handlerattr_handlerdata(
     const upb_handlerattr *attr) {
@@ -682,6 +730,18 @@ const upb_handlers *upb_handlers_newfrozen(const upb_msgdef *m,
                                            upb_handlers_callback *callback,
                                            const void *closure);
 
+/* Returns frozen handlers that are a copy of the frozen handlers "h", keeping
+ * only the fields named by "paths".  Each path is a list of field names
+ * separated by ".", as in google.protobuf.FieldMask; a path naming a message
+ * field keeps all of it.  Other fields have no handlers, so a decoder method
+ * built with projection enabled skips them without parsing them at all.
+ *
+ * Returns NULL and sets "status" if any path names an unknown field. */
+const upb_handlers *upb_handlers_newmasked(const upb_handlers *h,
+                                           const char *const *paths, size_t n,
+                                           const void *owner,
+                                           upb_status *status);
+
 /* Include refcounted methods like upb_handlers_ref(). */
 UPB_REFCOUNTED_CMETHODS(upb_handlers, upb_handlers_upcast)
 
@@ -735,6 +795,9 @@ bool upb_handlers_setendsubmsg(upb_handlers *h, const upb_fielddef *f,
 bool upb_handlers_setendseq(upb_handlers *h, const upb_fielddef *f,
                             upb_endfield_handlerfunc *func,
                             upb_handlerattr *attr);
+bool upb_handlers_setarray(upb_handlers *h, const upb_fielddef *f,
+                           upb_array_handlerfunc *func,
+                           upb_handlerattr *attr);
 
 bool upb_handlers_setsubhandlers(upb_handlers *h, const upb_fielddef *f,
                                  const upb_handlers *sub);
@@ -753,7 +816,7 @@ bool upb_handlers_getattr(const upb_handlers *h, upb_selector_t s,
 
 UPB_INLINE const void *upb_handlers_gethandlerdata(const upb_handlers *h,
                                                    upb_selector_t s) {
-  return upb_handlerattr_handlerdata(&h->table[s].attr);
+  return h->table[s].handler_data;
 }
 
 #ifdef __cplusplus
@@ -770,7 +833,7 @@ class upb::BytesHandler {
 #else
 struct upb_byteshandler {
 #endif
-  upb_handlers_tabent table[3];
+  upb_handlers_tabent table[4];
 };
 
 void upb_byteshandler_init(upb_byteshandler *h);
@@ -786,6 +849,15 @@ bool upb_byteshandler_setstring(upb_byteshandler *h,
 bool upb_byteshandler_setendstr(upb_byteshandler *h,
                                 upb_endfield_handlerfunc *func, void *d);
 
+/* Optional: lets writers encode directly into the sink's memory.  The handler
+ * returns a writable region of at least |min| bytes and sets |*size| to its
+ * full length, or returns NULL if it cannot.  The writer then passes the
+ * bytes it wrote, from the start of the region, to the string handler as
+ * usual, which must recognize the region and not copy it.  Any other call on
+ * the sink invalidates the region. */
+bool upb_byteshandler_setgetbuf(upb_byteshandler *h,
+                                upb_getbuf_handlerfunc *func, void *d);
+
 /* "Static" methods */
 bool upb_handlers_freeze(upb_handlers *const *handlers, int n, upb_status *s);
 upb_handlertype_t upb_handlers_getprimitivehandlertype(const upb_fielddef *f);
@@ -795,6 +867,24 @@ UPB_INLINE upb_selector_t upb_handlers_getendselector(upb_selector_t start) {
   return start + 1;
 }
 
+
+/* upb_handlercache ***********************************************************/
+
+/* A upb_handlercache lazily builds and caches frozen handlers for any msgdef,
+ * using a single callback/closure (so each cache holds one kind of handlers,
+ * for example "JSON printer handlers that preserve field names").  Building a
+ * handler graph also caches the handlers of every submessage it reaches, so
+ * asking for those later is just a lookup.
+ *
+ * The returned handlers are owned by the cache and live as long as it does;
+ * take a ref to keep them longer.  The closure must outlive the cache.  A
+ * cache is not thread-safe: callers must synchronize access to it. */
+upb_handlercache *upb_handlercache_new(upb_handlers_callback *callback,
+                                       const void *closure);
+void upb_handlercache_free(upb_handlercache *c);
+const upb_handlers *upb_handlercache_get(upb_handlercache *c,
+                                         const upb_msgdef *md);
+
 /* Internal-only. */
 uint32_t upb_handlers_selectorbaseoffset(const upb_fielddef *f);
 uint32_t upb_handlers_selectorcount(const upb_fielddef *f);
@@ -0,0 +1,419 @@
+/*
+** Base64 for the JSON printer and parser.
+**
+** The vector encoders and the SSSE3/AVX2 decoders follow Wojciech Muła and
+** Daniel Lemire, "Faster Base64 Encoding and Decoding Using AVX2
+** Instructions" (ACM TWEB 2018): bytes are spread into 6-bit indices with a
+** shuffle and two multiplies, and characters are mapped to and from values by
+** shuffling small tables indexed by the character's nibbles.  NEON has 64-byte
+** table lookups and interleaving loads and stores, so it uses those directly.
+**
+** Each vector loop stops at the first block with a character outside the
+** alphabets and leaves it to the scalar loop, which finds the exact quartet.
+*/
+
+#include "upb/json/base64.int.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__AVX2__)
+#include <immintrin.h>
+#define UPB_BASE64_AVX2
+#define UPB_BASE64_SSSE3
+#elif defined(__GNUC__) && defined(__SSSE3__)
+#include <tmmintrin.h>
+#define UPB_BASE64_SSSE3
+#elif defined(__GNUC__) && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define UPB_BASE64_NEON
+#endif
+
+static const char base64_std[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char base64_websafe[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+const signed char upb_base64_values[256] = {
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      62/*+*/, -1,      62/*-*/, -1,      63/*/ */,
+  52/*0*/, 53/*1*/, 54/*2*/, 55/*3*/, 56/*4*/, 57/*5*/, 58/*6*/, 59/*7*/,
+  60/*8*/, 61/*9*/, -1,      -1,      -1,      -1,      -1,      -1,
+  -1,       0/*A*/,  1/*B*/,  2/*C*/,  3/*D*/,  4/*E*/,  5/*F*/,  6/*G*/,
+  07/*H*/,  8/*I*/,  9/*J*/, 10/*K*/, 11/*L*/, 12/*M*/, 13/*N*/, 14/*O*/,
+  15/*P*/, 16/*Q*/, 17/*R*/, 18/*S*/, 19/*T*/, 20/*U*/, 21/*V*/, 22/*W*/,
+  23/*X*/, 24/*Y*/, 25/*Z*/, -1,      -1,      -1,      -1,      63/*_*/,
+  -1,      26/*a*/, 27/*b*/, 28/*c*/, 29/*d*/, 30/*e*/, 31/*f*/, 32/*g*/,
+  33/*h*/, 34/*i*/, 35/*j*/, 36/*k*/, 37/*l*/, 38/*m*/, 39/*n*/, 40/*o*/,
+  41/*p*/, 42/*q*/, 43/*r*/, 44/*s*/, 45/*t*/, 46/*u*/, 47/*v*/, 48/*w*/,
+  49/*x*/, 50/*y*/, 51/*z*/, -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
+  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1
+};
+
+
+/* Encoding *******************************************************************/
+
+#if defined(UPB_BASE64_SSSE3)
+
+/* Constants for spreading each three bytes into four 6-bit indices. */
+#define UPB_BASE64_SPREAD_MASK1 0x0fc0fc00
+#define UPB_BASE64_SPREAD_MUL1  0x04000040
+#define UPB_BASE64_SPREAD_MASK2 0x003f03f0
+#define UPB_BASE64_SPREAD_MUL2  0x01000010
+
+/* Encodes the low 12 of 16 bytes into 16 characters.  |shift_lut| holds what
+ * to add to each range of indices, and picks the alphabet. */
+static __m128i encode_ssse3_block(__m128i in, __m128i shift_lut) {
+  __m128i t0, t1, t2, t3, idx, lut_idx;
+
+  in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                          7, 6, 8, 7, 10, 9, 11, 10));
+  t0 = _mm_and_si128(in, _mm_set1_epi32(UPB_BASE64_SPREAD_MASK1));
+  t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(UPB_BASE64_SPREAD_MUL1));
+  t2 = _mm_and_si128(in, _mm_set1_epi32(UPB_BASE64_SPREAD_MASK2));
+  t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(UPB_BASE64_SPREAD_MUL2));
+  idx = _mm_or_si128(t1, t3);
+
+  /* 0-25 -> 13, 26-51 -> 0, 52-61 -> 1-10, 62 -> 11, 63 -> 12. */
+  lut_idx = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+  lut_idx = _mm_or_si128(
+      lut_idx, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx),
+                             _mm_set1_epi8(13)));
+  return _mm_add_epi8(idx, _mm_shuffle_epi8(shift_lut, lut_idx));
+}
+
+static __m128i encode_shift_lut(bool websafe) {
+  return _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                       '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                       '0' - 52, websafe ? '-' - 62 : '+' - 62,
+                       websafe ? '_' - 63 : '/' - 63, 'A', 0, 0);
+}
+
+#endif
+
+#if defined(UPB_BASE64_AVX2)
+
+static __m256i encode_avx2_block(__m256i in, __m256i shift_lut) {
+  __m256i t0, t1, t2, t3, idx, lut_idx;
+
+  in = _mm256_shuffle_epi8(
+      in, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                           1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+  t0 = _mm256_and_si256(in, _mm256_set1_epi32(UPB_BASE64_SPREAD_MASK1));
+  t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(UPB_BASE64_SPREAD_MUL1));
+  t2 = _mm256_and_si256(in, _mm256_set1_epi32(UPB_BASE64_SPREAD_MASK2));
+  t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(UPB_BASE64_SPREAD_MUL2));
+  idx = _mm256_or_si256(t1, t3);
+
+  lut_idx = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+  lut_idx = _mm256_or_si256(
+      lut_idx, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx),
+                                _mm256_set1_epi8(13)));
+  return _mm256_add_epi8(idx, _mm256_shuffle_epi8(shift_lut, lut_idx));
+}
+
+#endif
+
+size_t upb_base64_encode(char *out, const char *in, size_t len, bool websafe) {
+  const char *alphabet = websafe ? base64_websafe : base64_std;
+  const unsigned char *from = (const unsigned char*)in;
+  char *to = out;
+
+#if defined(UPB_BASE64_SSSE3)
+  const __m128i shift_lut = encode_shift_lut(websafe);
+#if defined(UPB_BASE64_AVX2)
+  const __m256i shift_lut256 = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(shift_lut), shift_lut, 1);
+
+  /* Each lane takes 12 bytes, but loads 16. */
+  while (len >= 28) {
+    __m256i chunk = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)from)),
+        _mm_loadu_si128((const __m128i*)(from + 12)), 1);
+    _mm256_storeu_si256((__m256i*)to, encode_avx2_block(chunk, shift_lut256));
+    from += 24;
+    to += 32;
+    len -= 24;
+  }
+#endif
+
+  while (len >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)from);
+    _mm_storeu_si128((__m128i*)to, encode_ssse3_block(chunk, shift_lut));
+    from += 12;
+    to += 16;
+    len -= 12;
+  }
+#elif defined(UPB_BASE64_NEON)
+  uint8x16x4_t table;
+  table.val[0] = vld1q_u8((const uint8_t*)alphabet);
+  table.val[1] = vld1q_u8((const uint8_t*)alphabet + 16);
+  table.val[2] = vld1q_u8((const uint8_t*)alphabet + 32);
+  table.val[3] = vld1q_u8((const uint8_t*)alphabet + 48);
+
+  while (len >= 48) {
+    uint8x16x3_t bytes = vld3q_u8(from);
+    uint8x16x4_t chars;
+    chars.val[0] = vshrq_n_u8(bytes.val[0], 2);
+    chars.val[1] = vorrq_u8(
+        vshlq_n_u8(vandq_u8(bytes.val[0], vdupq_n_u8(0x3)), 4),
+        vshrq_n_u8(bytes.val[1], 4));
+    chars.val[2] = vorrq_u8(
+        vshlq_n_u8(vandq_u8(bytes.val[1], vdupq_n_u8(0xf)), 2),
+        vshrq_n_u8(bytes.val[2], 6));
+    chars.val[3] = vandq_u8(bytes.val[2], vdupq_n_u8(0x3f));
+    chars.val[0] = vqtbl4q_u8(table, chars.val[0]);
+    chars.val[1] = vqtbl4q_u8(table, chars.val[1]);
+    chars.val[2] = vqtbl4q_u8(table, chars.val[2]);
+    chars.val[3] = vqtbl4q_u8(table, chars.val[3]);
+    vst4q_u8((uint8_t*)to, chars);
+    from += 48;
+    to += 64;
+    len -= 48;
+  }
+#endif
+
+  while (len > 2) {
+    to[0] = alphabet[from[0] >> 2];
+    to[1] = alphabet[((from[0] & 0x3) << 4) | (from[1] >> 4)];
+    to[2] = alphabet[((from[1] & 0xf) << 2) | (from[2] >> 6)];
+    to[3] = alphabet[from[2] & 0x3f];
+
+    len -= 3;
+    to += 4;
+    from += 3;
+  }
+
+  switch (len) {
+    case 2:
+      to[0] = alphabet[from[0] >> 2];
+      to[1] = alphabet[((from[0] & 0x3) << 4) | (from[1] >> 4)];
+      to[2] = alphabet[(from[1] & 0xf) << 2];
+      to[3] = '=';
+      to += 4;
+      break;
+    case 1:
+      to[0] = alphabet[from[0] >> 2];
+      to[1] = alphabet[((from[0] & 0x3) << 4)];
+      to[2] = '=';
+      to[3] = '=';
+      to += 4;
+      break;
+  }
+
+  return to - out;
+}
+
+
+/* Decoding *******************************************************************/
+
+#if defined(UPB_BASE64_SSSE3)
+
+/* Indexed by the low and high nibbles of a character: the character is in
+ * the standard alphabet iff the two entries have no bit in common. */
+#define UPB_BASE64_LUT_LO                                                  \
+  0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, \
+  0x1B, 0x1B, 0x1B, 0x1A
+#define UPB_BASE64_LUT_HI                                                  \
+  0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, \
+  0x10, 0x10, 0x10, 0x10
+
+/* Indexed by the high nibble, less one for '/': what to add to the character
+ * to get its value. */
+#define UPB_BASE64_LUT_ROLL \
+  0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+
+/* Translates 16 characters to their values, returning false if any is not in
+ * either alphabet.  The web-safe characters are first rewritten to their
+ * standard counterparts. */
+static bool decode_ssse3_values(__m128i *chars) {
+  __m128i in = *chars;
+  __m128i hi_nibbles, lo, hi, roll;
+
+  in = _mm_sub_epi8(in, _mm_and_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('-')),
+                                      _mm_set1_epi8('-' - '+')));
+  in = _mm_sub_epi8(in, _mm_and_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('_')),
+                                      _mm_set1_epi8('_' - '/')));
+
+  hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+  lo = _mm_shuffle_epi8(_mm_setr_epi8(UPB_BASE64_LUT_LO),
+                        _mm_and_si128(in, _mm_set1_epi8(0x0f)));
+  hi = _mm_shuffle_epi8(_mm_setr_epi8(UPB_BASE64_LUT_HI), hi_nibbles);
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi),
+                                       _mm_setzero_si128())) != 0xffff) {
+    return false;
+  }
+
+  roll = _mm_shuffle_epi8(
+      _mm_setr_epi8(UPB_BASE64_LUT_ROLL),
+      _mm_add_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('/')), hi_nibbles));
+  *chars = _mm_add_epi8(in, roll);
+  return true;
+}
+
+/* Packs 16 6-bit values into 12 bytes at the bottom of the register. */
+static __m128i decode_ssse3_pack(__m128i values) {
+  __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                14, 13, 12, -1, -1, -1, -1));
+}
+
+#endif
+
+#if defined(UPB_BASE64_AVX2)
+
+static bool decode_avx2_values(__m256i *chars) {
+  __m256i in = *chars;
+  __m256i hi_nibbles, lo, hi, roll;
+
+  in = _mm256_sub_epi8(
+      in, _mm256_and_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('-')),
+                           _mm256_set1_epi8('-' - '+')));
+  in = _mm256_sub_epi8(
+      in, _mm256_and_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('_')),
+                           _mm256_set1_epi8('_' - '/')));
+
+  hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4),
+                                _mm256_set1_epi8(0x0f));
+  lo = _mm256_shuffle_epi8(
+      _mm256_setr_epi8(UPB_BASE64_LUT_LO, UPB_BASE64_LUT_LO),
+      _mm256_and_si256(in, _mm256_set1_epi8(0x0f)));
+  hi = _mm256_shuffle_epi8(
+      _mm256_setr_epi8(UPB_BASE64_LUT_HI, UPB_BASE64_LUT_HI), hi_nibbles);
+  if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lo, hi),
+                                             _mm256_setzero_si256())) != -1) {
+    return false;
+  }
+
+  roll = _mm256_shuffle_epi8(
+      _mm256_setr_epi8(UPB_BASE64_LUT_ROLL, UPB_BASE64_LUT_ROLL),
+      _mm256_add_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('/')),
+                      hi_nibbles));
+  *chars = _mm256_add_epi8(in, roll);
+  return true;
+}
+
+/* Packs 32 6-bit values into 24 bytes at the bottom of the register. */
+static __m256i decode_avx2_pack(__m256i values) {
+  __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+  merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+  merged = _mm256_shuffle_epi8(
+      merged, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                               -1, -1, -1, -1,
+                               2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                               -1, -1, -1, -1));
+  return _mm256_permutevar8x32_epi32(merged,
+                                     _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+}
+
+#endif
+
+#if defined(UPB_BASE64_NEON)
+
+/* Values of 16 characters, with 0xff for those outside the alphabets. */
+static uint8x16_t decode_neon_values(uint8x16x4_t lo, uint8x16x4_t hi,
+                                     uint8x16_t chars) {
+  /* Out-of-range indices look up zero, so each character is found in at most
+   * one of the two tables; characters from 128 up are in neither. */
+  uint8x16_t val = vorrq_u8(vqtbl4q_u8(lo, chars),
+                            vqtbl4q_u8(hi, veorq_u8(chars, vdupq_n_u8(0x40))));
+  return vorrq_u8(val, vcgeq_u8(chars, vdupq_n_u8(0x80)));
+}
+
+#endif
+
+size_t upb_base64_decode(char *out, const char *in, size_t len) {
+  const unsigned char *from = (const unsigned char*)in;
+  const unsigned char *start = from;
+
+  UPB_ASSERT(len % 4 == 0);
+
+#if defined(UPB_BASE64_SSSE3)
+#if defined(UPB_BASE64_AVX2)
+  while (len >= 32) {
+    char packed[32];
+    __m256i chars = _mm256_loadu_si256((const __m256i*)from);
+    if (!decode_avx2_values(&chars)) break;
+    _mm256_storeu_si256((__m256i*)packed, decode_avx2_pack(chars));
+    memcpy(out, packed, 24);
+    from += 32;
+    out += 24;
+    len -= 32;
+  }
+#endif
+
+  while (len >= 16) {
+    char packed[16];
+    __m128i chars = _mm_loadu_si128((const __m128i*)from);
+    if (!decode_ssse3_values(&chars)) break;
+    _mm_storeu_si128((__m128i*)packed, decode_ssse3_pack(chars));
+    memcpy(out, packed, 12);
+    from += 16;
+    out += 12;
+    len -= 16;
+  }
+#elif defined(UPB_BASE64_NEON)
+  {
+    const uint8_t *values = (const uint8_t*)upb_base64_values;
+    uint8x16x4_t lo, hi;
+    lo.val[0] = vld1q_u8(values);
+    lo.val[1] = vld1q_u8(values + 16);
+    lo.val[2] = vld1q_u8(values + 32);
+    lo.val[3] = vld1q_u8(values + 48);
+    hi.val[0] = vld1q_u8(values + 64);
+    hi.val[1] = vld1q_u8(values + 80);
+    hi.val[2] = vld1q_u8(values + 96);
+    hi.val[3] = vld1q_u8(values + 112);
+
+    while (len >= 64) {
+      uint8x16x4_t chars = vld4q_u8(from);
+      uint8x16x3_t bytes;
+      uint8x16_t a = decode_neon_values(lo, hi, chars.val[0]);
+      uint8x16_t b = decode_neon_values(lo, hi, chars.val[1]);
+      uint8x16_t c = decode_neon_values(lo, hi, chars.val[2]);
+      uint8x16_t d = decode_neon_values(lo, hi, chars.val[3]);
+      if (vmaxvq_u8(vorrq_u8(vorrq_u8(a, b), vorrq_u8(c, d))) > 63) break;
+      bytes.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+      bytes.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+      bytes.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+      vst3q_u8((uint8_t*)out, bytes);
+      from += 64;
+      out += 48;
+      len -= 64;
+    }
+  }
+#endif
+
+  for (; len > 0; len -= 4, from += 4) {
+    /* The values sign-extend, so any -1 sets the top bit. */
+    uint32_t val = (uint32_t)(int32_t)upb_base64_values[from[0]] << 18 |
+                   (uint32_t)(int32_t)upb_base64_values[from[1]] << 12 |
+                   (uint32_t)(int32_t)upb_base64_values[from[2]] << 6 |
+                   (uint32_t)(int32_t)upb_base64_values[from[3]];
+    if (val & 0x80000000) break;
+    *out++ = val >> 16;
+    *out++ = (val >> 8) & 0xff;
+    *out++ = val & 0xff;
+  }
+
+  return from - start;
+}
@@ -0,0 +1,47 @@
+/*
+** Base64 encoding and decoding for the JSON printer and parser, which carry
+** bytes fields as base64 strings.
+**
+** This header is INTERNAL-ONLY!  Its interfaces are not public or stable!
+**
+** Both directions have SSSE3, AVX2 and NEON versions, chosen at compile time
+** like the rest of the JSON code's vector paths, and a scalar version for
+** everything else and for the tail of each buffer.
+*/
+
+#ifndef UPB_JSON_BASE64_H_
+#define UPB_JSON_BASE64_H_
+
+#include <stdint.h>
+#include "upb/upb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Encoded length of |len| bytes, including padding. */
+#define UPB_BASE64_ENCLEN(len) (((len) + 2) / 3 * 4)
+
+/* Value of each character in either base64 alphabet, or -1 for characters
+ * that are in neither ('=' included). */
+extern const signed char upb_base64_values[256];
+
+/* Encodes |len| bytes from |in| into |out|, which must have room for
+ * UPB_BASE64_ENCLEN(len) characters, padding the last quartet with '='.  Uses
+ * the web-safe alphabet ("-_" for "+/") if |websafe| is true.  Returns the
+ * number of characters written. */
+size_t upb_base64_encode(char *out, const char *in, size_t len, bool websafe);
+
+/* Decodes whole quartets from the |len| characters of |in|, a multiple of
+ * four, into |out|, which must have room for len / 4 * 3 bytes.  Characters
+ * from the standard and web-safe alphabets are both accepted, even mixed.
+ * Stops before the first quartet containing anything else, such as padding,
+ * and returns the number of characters consumed, so the caller can examine
+ * that quartet itself. */
+size_t upb_base64_decode(char *out, const char *in, size_t len);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UPB_JSON_BASE64_H_ */
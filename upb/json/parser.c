@@ -16,11 +16,11 @@
 ** - handling of unicode escape sequences (including high surrogate pairs).
 ** - properly check and report errors for unknown fields, stack overflow,
 **   improper array nesting (or lack of nesting).
-** - handling of base64 sequences with padding characters.
 ** - handling of push-back (non-success returns from sink functions).
 ** - handling of keys/escape-sequences/etc that span input buffers.
 */
 
+#include <ctype.h>
 #include <errno.h>
 #include <float.h>
 #include <math.h>
@@ -29,6 +29,17 @@
 #include <string.h>
 
 #include "upb/json/parser.h"
+#include "upb/fmt.int.h"
+#include "upb/json/base64.int.h"
+#include "upb/utf8.int.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define UPB_JSON_SSE2
+#elif defined(__GNUC__) && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define UPB_JSON_NEON
+#endif
 
 #define UPB_JSON_MAX_DEPTH 64
 
@@ -41,7 +52,7 @@ typedef struct {
   const upb_fielddef *f;
 
   /* The table mapping json name to fielddef for this message. */
-  upb_strtable *name_table;
+  const upb_frozentable *name_table;
 
   /* We are in a repeated-field context, ready to emit mapentries as
    * submessages. This flag alters the start-of-object (open-brace) behavior to
@@ -61,6 +72,10 @@ typedef struct {
   const upb_fielddef *mapfield;
 } upb_jsonparser_frame;
 
+/* How many values of a repeated primitive field we pass to its array handler
+ * at most at once. */
+#define UPB_JSON_ARRAY_BATCH 64
+
 struct upb_json_parser {
   upb_env *env;
   const upb_json_parsermethod *method;
@@ -91,11 +106,42 @@ struct upb_json_parser {
   int multipart_state;
   upb_selector_t string_selector;
 
+  /* Streaming base64: a partial quartet carried over from the last part of a
+   * bytes value, and whether its padding has been seen. */
+  char base64_carry[4];
+  uint8_t base64_carry_len;
+  bool base64_padded;
+
+  /* How much of a character the text of a string value has so far. */
+  upb_utf8state utf8;
+
   /* Input capture.  See details in parser.rl. */
   const char *capture;
 
   /* Intermediate result of parsing a unicode escape sequence. */
   uint32_t digit;
+
+  /* Array batching.  See details in parser.rl. */
+  const upb_jsonparser_frame *array_frame;
+  upb_selector_t array_selector;
+  size_t array_len;
+  union {
+    int32_t i32[UPB_JSON_ARRAY_BATCH];
+    int64_t i64[UPB_JSON_ARRAY_BATCH];
+    uint32_t u32[UPB_JSON_ARRAY_BATCH];
+    uint64_t u64[UPB_JSON_ARRAY_BATCH];
+    bool b[UPB_JSON_ARRAY_BATCH];
+    double dbl[UPB_JSON_ARRAY_BATCH];
+    float flt[UPB_JSON_ARRAY_BATCH];
+  } array_buf;
+
+  /* Counters to update, or NULL.  The rest are for the current message:
+   * whether we have seen any of it, its bytes so far, and the arena's block
+   * count when it started. */
+  upb_decstats *stats;
+  bool stats_started;
+  uint64_t stats_bytes;
+  size_t stats_blocks;
 };
 
 struct upb_json_parsermethod {
@@ -107,7 +153,8 @@ struct upb_json_parsermethod {
    * to stay alive. */
   const upb_msgdef *msg;
 
-  /* Keys are upb_msgdef*, values are upb_strtable (json_name -> fielddef) */
+  /* Keys are upb_msgdef*, values are frozen strtables (json_name -> fielddef),
+   * which place their keys with a perfect hash so every lookup is one probe. */
   upb_inttable name_tables;
 };
 
@@ -139,6 +186,13 @@ static bool check_stack(upb_json_parser *p) {
   return true;
 }
 
+/* Records the depth of a frame that was just pushed. */
+static void count_depth(upb_json_parser *p) {
+  if (p->stats && (uint32_t)(p->top - p->stack) > p->stats->max_depth) {
+    p->stats->max_depth = p->top - p->stack;
+  }
+}
+
 static void set_name_table(upb_json_parser *p, upb_jsonparser_frame *frame) {
   upb_value v;
   bool ok = upb_inttable_lookupptr(&p->method->name_tables, frame->m, &v);
@@ -146,6 +200,44 @@ static void set_name_table(upb_json_parser *p, upb_jsonparser_frame *frame) {
   frame->name_table = upb_value_getptr(v);
 }
 
+
+/* Array batching *************************************************************/
+
+/* When a repeated primitive field has an array handler, start_array() points
+ * p->array_frame at the frame for its values.  The values are then collected
+ * in p->array_buf instead of going to the value handler one at a time, and
+ * passed to the array handler whenever the buffer is full and when the array
+ * ends.  Nothing else is emitted inside such an array, so the batch never has
+ * to be flushed early to keep events in order. */
+
+static void array_flush(upb_json_parser *p) {
+  if (p->array_len > 0) {
+    upb_sink_putarray(&p->top->sink, p->array_selector, &p->array_buf,
+                      p->array_len);
+    p->array_len = 0;
+  }
+}
+
+/* Puts a value for the current field, or adds it to the array batch. */
+#define PUTVAL(type, ctype, member)                                       \
+  static void sink_put ## type(upb_json_parser *p, ctype val) {           \
+    if (p->top == p->array_frame) {                                       \
+      p->array_buf.member[p->array_len++] = val;                          \
+      if (p->array_len == UPB_JSON_ARRAY_BATCH) array_flush(p);           \
+    } else {                                                              \
+      upb_sink_put ## type(&p->top->sink, parser_getsel(p), val);         \
+    }                                                                     \
+  }
+
+PUTVAL(int32,  int32_t,  i32)
+PUTVAL(int64,  int64_t,  i64)
+PUTVAL(uint32, uint32_t, u32)
+PUTVAL(uint64, uint64_t, u64)
+PUTVAL(float,  float,    flt)
+PUTVAL(double, double,   dbl)
+PUTVAL(bool,   bool,     b)
+#undef PUTVAL
+
 /* There are GCC/Clang built-ins for overflow checking which we could start
  * using if there was any performance benefit to it. */
 
@@ -167,81 +259,42 @@ static size_t saturating_multiply(size_t a, size_t b) {
 
 /* Base64 decoding ************************************************************/
 
-/* TODO(haberman): make this streaming. */
-
-static const signed char b64table[] = {
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      62/*+*/, -1,      -1,      -1,      63/*/ */,
-  52/*0*/, 53/*1*/, 54/*2*/, 55/*3*/, 56/*4*/, 57/*5*/, 58/*6*/, 59/*7*/,
-  60/*8*/, 61/*9*/, -1,      -1,      -1,      -1,      -1,      -1,
-  -1,       0/*A*/,  1/*B*/,  2/*C*/,  3/*D*/,  4/*E*/,  5/*F*/,  6/*G*/,
-  07/*H*/,  8/*I*/,  9/*J*/, 10/*K*/, 11/*L*/, 12/*M*/, 13/*N*/, 14/*O*/,
-  15/*P*/, 16/*Q*/, 17/*R*/, 18/*S*/, 19/*T*/, 20/*U*/, 21/*V*/, 22/*W*/,
-  23/*X*/, 24/*Y*/, 25/*Z*/, -1,      -1,      -1,      -1,      -1,
-  -1,      26/*a*/, 27/*b*/, 28/*c*/, 29/*d*/, 30/*e*/, 31/*f*/, 32/*g*/,
-  33/*h*/, 34/*i*/, 35/*j*/, 36/*k*/, 37/*l*/, 38/*m*/, 39/*n*/, 40/*o*/,
-  41/*p*/, 42/*q*/, 43/*r*/, 44/*s*/, 45/*t*/, 46/*u*/, 47/*v*/, 48/*w*/,
-  49/*x*/, 50/*y*/, 51/*z*/, -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1,
-  -1,      -1,      -1,      -1,      -1,      -1,      -1,      -1
-};
-
 /* Returns the table value sign-extended to 32 bits.  Knowing that the upper
  * bits will be 1 for unrecognized characters makes it easier to check for
  * this error condition later (see below). */
-int32_t b64lookup(unsigned char ch) { return b64table[ch]; }
+int32_t b64lookup(unsigned char ch) { return upb_base64_values[ch]; }
 
 /* Returns true if the given character is not a valid base64 character or
  * padding. */
 bool nonbase64(unsigned char ch) { return b64lookup(ch) == -1 && ch != '='; }
 
+/* Decodes whole quartets of base64 text, |len| being a multiple of 4, and
+ * pushes the output in pieces of up to sizeof(out) bytes.  Either alphabet is
+ * accepted, as proto3 JSON requires.  A padded quartet must be the last one of
+ * the value. */
 static bool base64_push(upb_json_parser *p, upb_selector_t sel, const char *ptr,
                         size_t len) {
   const char *limit = ptr + len;
-  for (; ptr < limit; ptr += 4) {
-    uint32_t val;
-    char output[3];
+  char out[768];
+  size_t n = 0;
 
-    if (limit - ptr < 4) {
-      upb_status_seterrf(&p->status,
-                         "Base64 input for bytes field not a multiple of 4: %s",
-                         upb_fielddef_name(p->top->f));
-      upb_env_reporterror(p->env, &p->status);
-      return false;
-    }
+  UPB_ASSERT(len % 4 == 0);
 
-    val = b64lookup(ptr[0]) << 18 |
-          b64lookup(ptr[1]) << 12 |
-          b64lookup(ptr[2]) << 6  |
-          b64lookup(ptr[3]);
+  if (len > 0 && p->base64_padded) {
+    goto badpadding;  /* Data after the padding. */
+  }
+
+  while (ptr < limit) {
+    size_t chunk = UPB_MIN((size_t)(limit - ptr), sizeof(out) / 3 * 4);
+    size_t consumed = upb_base64_decode(out, ptr, chunk);
 
-    /* Test the upper bit; returns true if any of the characters returned -1. */
-    if (val & 0x80000000) {
+    n = consumed / 4 * 3;
+    ptr += consumed;
+    if (consumed < chunk) {
+      /* Padding or a bad character; there is room in out for the rest. */
       goto otherchar;
     }
-
-    output[0] = val >> 16;
-    output[1] = (val >> 8) & 0xff;
-    output[2] = val & 0xff;
-    upb_sink_putstring(&p->top->sink, sel, output, 3, NULL);
+    upb_sink_putstring(&p->top->sink, sel, out, n, NULL);
   }
   return true;
 
@@ -253,9 +306,10 @@ otherchar:
                        upb_fielddef_name(p->top->f));
     upb_env_reporterror(p->env, &p->status);
     return false;
-  } if (ptr[2] == '=') {
+  } else if (ptr + 4 != limit) {
+    goto badpadding;
+  } else if (ptr[2] == '=') {
     uint32_t val;
-    char output;
 
     /* Last group contains only two input bytes, one output byte. */
     if (ptr[0] == '=' || ptr[1] == '=' || ptr[3] != '=') {
@@ -266,12 +320,9 @@ otherchar:
           b64lookup(ptr[1]) << 12;
 
     UPB_ASSERT(!(val & 0x80000000));
-    output = val >> 16;
-    upb_sink_putstring(&p->top->sink, sel, &output, 1, NULL);
-    return true;
+    out[n++] = val >> 16;
   } else {
     uint32_t val;
-    char output[2];
 
     /* Last group contains only three input bytes, two output bytes. */
     if (ptr[0] == '=' || ptr[1] == '=' || ptr[2] == '=') {
@@ -282,12 +333,14 @@ otherchar:
           b64lookup(ptr[1]) << 12 |
           b64lookup(ptr[2]) << 6;
 
-    output[0] = val >> 16;
-    output[1] = (val >> 8) & 0xff;
-    upb_sink_putstring(&p->top->sink, sel, output, 2, NULL);
-    return true;
+    out[n++] = val >> 16;
+    out[n++] = (val >> 8) & 0xff;
   }
 
+  upb_sink_putstring(&p->top->sink, sel, out, n, NULL);
+  p->base64_padded = true;
+  return true;
+
 badpadding:
   upb_status_seterrf(&p->status,
                      "Incorrect base64 padding for field: %s (%.*s)",
@@ -297,6 +350,35 @@ badpadding:
   return false;
 }
 
+/* Decodes the next part of a bytes value's base64 text.  Only a quartet that
+ * straddles two parts is copied, so memory use does not grow with the size
+ * of the value. */
+static bool base64_text(upb_json_parser *p, const char *buf, size_t len) {
+  const char *limit = buf + len;
+  size_t whole;
+
+  if (p->base64_carry_len > 0) {
+    while (p->base64_carry_len < 4 && buf < limit) {
+      p->base64_carry[p->base64_carry_len++] = *buf++;
+    }
+    if (p->base64_carry_len < 4) return true;
+    p->base64_carry_len = 0;
+    if (!base64_push(p, p->string_selector, p->base64_carry, 4)) {
+      return false;
+    }
+  }
+
+  whole = (limit - buf) & ~(size_t)3;
+  if (!base64_push(p, p->string_selector, buf, whole)) {
+    return false;
+  }
+  buf += whole;
+
+  p->base64_carry_len = limit - buf;
+  memcpy(p->base64_carry, buf, p->base64_carry_len);
+  return true;
+}
+
 
 /* Accumulate buffer **********************************************************/
 
@@ -417,7 +499,11 @@ enum {
 
   /* We are processing multipart data by pushing each part directly to the
    * current string handlers. */
-  MULTIPART_PUSHEAGERLY = 2
+  MULTIPART_PUSHEAGERLY = 2,
+
+  /* Like MULTIPART_PUSHEAGERLY, but the parts are base64 text that we decode
+   * on the way. */
+  MULTIPART_BASE64 = 3
 };
 
 /* Start a multi-part text value where we accumulate the data for processing at
@@ -437,6 +523,17 @@ static void multipart_start(upb_json_parser *p, upb_selector_t sel) {
   p->string_selector = sel;
 }
 
+/* Start a multi-part base64 value whose decoded bytes we push to a string
+ * value with the given selector. */
+static void multipart_startbase64(upb_json_parser *p, upb_selector_t sel) {
+  assert_accumulate_empty(p);
+  UPB_ASSERT(p->multipart_state == MULTIPART_INACTIVE);
+  p->multipart_state = MULTIPART_BASE64;
+  p->string_selector = sel;
+  p->base64_carry_len = 0;
+  p->base64_padded = false;
+}
+
 static bool multipart_text(upb_json_parser *p, const char *buf, size_t len,
                            bool can_alias) {
   switch (p->multipart_state) {
@@ -457,6 +554,9 @@ static bool multipart_text(upb_json_parser *p, const char *buf, size_t len,
       upb_sink_putstring(&p->top->sink, p->string_selector, buf, len, handle);
       break;
     }
+
+    case MULTIPART_BASE64:
+      return base64_text(p, buf, len);
   }
 
   return true;
@@ -471,6 +571,37 @@ static void multipart_end(upb_json_parser *p) {
 }
 
 
+/* UTF-8 validation ***********************************************************/
+
+/* JSON text must be UTF-8, so the text of a string value is checked as it is
+ * pushed.  Escapes are not: a \u escape may be half of a surrogate pair,
+ * which end_hex() does not combine yet.  They must fall between characters,
+ * though. */
+
+static bool utf8_error(upb_json_parser *p) {
+  upb_status_seterrf(&p->status, "Invalid UTF-8 in string field: %s",
+                     upb_fielddef_name(p->top->f));
+  upb_env_reporterror(p->env, &p->status);
+  return false;
+}
+
+static bool utf8_text(upb_json_parser *p, const char *buf, size_t len) {
+  if (p->multipart_state != MULTIPART_PUSHEAGERLY ||
+      upb_utf8_check(&p->utf8, buf, len)) {
+    return true;
+  }
+  return utf8_error(p);
+}
+
+static bool utf8_boundary(upb_json_parser *p) {
+  if (p->multipart_state != MULTIPART_PUSHEAGERLY ||
+      upb_utf8_done(&p->utf8)) {
+    return true;
+  }
+  return utf8_error(p);
+}
+
+
 /* Input capture **************************************************************/
 
 /* Functionality for capturing a region of the input as text.  Gracefully
@@ -485,7 +616,8 @@ static void capture_begin(upb_json_parser *p, const char *ptr) {
 
 static bool capture_end(upb_json_parser *p, const char *ptr) {
   UPB_ASSERT(p->capture);
-  if (multipart_text(p, p->capture, ptr - p->capture, true)) {
+  if (utf8_text(p, p->capture, ptr - p->capture) &&
+      multipart_text(p, p->capture, ptr - p->capture, true)) {
     p->capture = NULL;
     return true;
   } else {
@@ -499,7 +631,8 @@ static bool capture_end(upb_json_parser *p, const char *ptr) {
 static void capture_suspend(upb_json_parser *p, const char **ptr) {
   if (!p->capture) return;
 
-  if (multipart_text(p, p->capture, *ptr - p->capture, false)) {
+  if (utf8_text(p, p->capture, *ptr - p->capture) &&
+      multipart_text(p, p->capture, *ptr - p->capture, false)) {
     /* We use this as a signal that we were in the middle of capturing, and
      * that capturing should resume at the beginning of the next buffer.
      * 
@@ -546,7 +679,7 @@ static char escape_char(char in) {
 
 static bool escape(upb_json_parser *p, const char *ptr) {
   char ch = escape_char(*ptr);
-  return multipart_text(p, &ch, 1, false);
+  return utf8_boundary(p) && multipart_text(p, &ch, 1, false);
 }
 
 static void start_hex(upb_json_parser *p) {
@@ -593,7 +726,7 @@ static bool end_hex(upb_json_parser *p) {
   /* TODO(haberman): Handle high surrogates: if codepoint is a high surrogate
    * we have to wait for the next escape to get the full code point). */
 
-  return multipart_text(p, utf8, length, false);
+  return utf8_boundary(p) && multipart_text(p, utf8, length, false);
 }
 
 static void start_text(upb_json_parser *p, const char *ptr) {
@@ -604,6 +737,43 @@ static bool end_text(upb_json_parser *p, const char *ptr) {
   return capture_end(p, ptr);
 }
 
+/* Returns the first '"' or '\\' in [ptr, end), or |end| if there is none.
+ * Without this the state machine would take a transition for every byte of a
+ * string, so the text machine uses it to jump over the whole run at once. */
+static const char *skip_text(const char *ptr, const char *end) {
+#if defined(UPB_JSON_SSE2)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+
+  while (end - ptr >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)ptr);
+    int mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+    if (mask) {
+      return ptr + __builtin_ctz(mask);
+    }
+    ptr += 16;
+  }
+#elif defined(UPB_JSON_NEON)
+  const uint8x16_t quote = vdupq_n_u8('"');
+  const uint8x16_t backslash = vdupq_n_u8('\\');
+
+  while (end - ptr >= 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t*)ptr);
+    if (vmaxvq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)))) {
+      /* The byte loop below finds it within these 16 bytes. */
+      break;
+    }
+    ptr += 16;
+  }
+#endif
+
+  while (ptr < end && *ptr != '"' && *ptr != '\\') {
+    ptr++;
+  }
+  return ptr;
+}
+
 static void start_number(upb_json_parser *p, const char *ptr) {
   multipart_startaccum(p);
   capture_begin(p, ptr);
@@ -650,7 +820,7 @@ static bool parse_number_from_buffer(upb_json_parser *p, const char *buf,
       } else if (val > INT32_MAX || val < INT32_MIN) {
         return false;
       } else {
-        upb_sink_putint32(&p->top->sink, parser_getsel(p), val);
+        sink_putint32(p, val);
         return true;
       }
     }
@@ -661,7 +831,7 @@ static bool parse_number_from_buffer(upb_json_parser *p, const char *buf,
       } else if (val > UINT32_MAX || errno == ERANGE) {
         return false;
       } else {
-        upb_sink_putuint32(&p->top->sink, parser_getsel(p), val);
+        sink_putuint32(p, val);
         return true;
       }
     }
@@ -672,7 +842,7 @@ static bool parse_number_from_buffer(upb_json_parser *p, const char *buf,
       if (errno == ERANGE || end != bufend) {
         break;
       } else {
-        upb_sink_putint64(&p->top->sink, parser_getsel(p), val);
+        sink_putint64(p, val);
         return true;
       }
     }
@@ -683,7 +853,7 @@ static bool parse_number_from_buffer(upb_json_parser *p, const char *buf,
       } else if (errno == ERANGE) {
         return false;
       } else {
-        upb_sink_putuint64(&p->top->sink, parser_getsel(p), val);
+        sink_putuint64(p, val);
         return true;
       }
     }
@@ -714,8 +884,7 @@ static bool parse_number_from_buffer(upb_json_parser *p, const char *buf,
       if (modf(val, &dummy) != 0 || val > max || val < min) {             \
         return false;                                                     \
       } else {                                                            \
-        upb_sink_put ## smalltype(&p->top->sink, parser_getsel(p),        \
-                                  (ctype)val);                            \
+        sink_put ## smalltype(p, (ctype)val);                             \
         return true;                                                      \
       }                                                                   \
       break;                                                              \
@@ -728,13 +897,13 @@ static bool parse_number_from_buffer(upb_json_parser *p, const char *buf,
 #undef CASE
 
     case UPB_TYPE_DOUBLE:
-      upb_sink_putdouble(&p->top->sink, parser_getsel(p), val);
+      sink_putdouble(p, val);
       return true;
     case UPB_TYPE_FLOAT:
       if ((val > FLT_MAX || val < -FLT_MAX) && val != inf && val != -inf) {
         return false;
       } else {
-        upb_sink_putfloat(&p->top->sink, parser_getsel(p), val);
+        sink_putfloat(p, val);
         return true;
       }
     default:
@@ -742,10 +911,121 @@ static bool parse_number_from_buffer(upb_json_parser *p, const char *buf,
   }
 }
 
+/* Parses the common forms of number straight from the input, without the copy
+ * and strtod() of parse_number_from_buffer(): a decimal integer, or a decimal
+ * with at most 19 significant digits for a float or double.  Returns false to
+ * leave everything else, including any error, to parse_number_from_buffer(). */
+static bool parse_number_fast(upb_json_parser *p, const char *buf,
+                              size_t len) {
+  const char *ptr = buf;
+  const char *end = buf + len;
+  upb_fieldtype_t type = upb_fielddef_type(p->top->f);
+  bool neg = false;
+  bool is_integer = true;
+  uint64_t digits = 0;
+  int ndigits = 0;
+  int32_t exp10 = 0;
+  double val;
+
+  if (ptr < end && *ptr == '-') {
+    neg = true;
+    ptr++;
+  }
+
+  /* strtol() would read a leading zero as octal. */
+  if (ptr == end || !isdigit((unsigned char)*ptr) ||
+      (*ptr == '0' && ptr + 1 < end && isdigit((unsigned char)ptr[1]))) {
+    return false;
+  }
+
+  /* Leading zeros don't count towards our 19 digits. */
+  for (; ptr < end && isdigit((unsigned char)*ptr); ptr++) {
+    if (ndigits == 19) return false;
+    digits = digits * 10 + (*ptr - '0');
+    if (digits != 0) ndigits++;
+  }
+
+  if (ptr < end && *ptr == '.') {
+    is_integer = false;
+    ptr++;
+    if (ptr == end || !isdigit((unsigned char)*ptr)) return false;
+    for (; ptr < end && isdigit((unsigned char)*ptr); ptr++) {
+      if (ndigits == 19) return false;
+      digits = digits * 10 + (*ptr - '0');
+      if (digits != 0) ndigits++;
+      exp10--;
+    }
+  }
+
+  if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+    bool exp_neg = false;
+    int32_t exp = 0;
+    is_integer = false;
+    ptr++;
+    if (ptr < end && (*ptr == '+' || *ptr == '-')) {
+      exp_neg = *ptr == '-';
+      ptr++;
+    }
+    if (ptr == end || !isdigit((unsigned char)*ptr)) return false;
+    for (; ptr < end && isdigit((unsigned char)*ptr); ptr++) {
+      if (exp > 100000) return false;
+      exp = exp * 10 + (*ptr - '0');
+    }
+    exp10 += exp_neg ? -exp : exp;
+  }
+
+  if (ptr != end) {
+    return false;
+  }
+
+  switch (type) {
+    case UPB_TYPE_ENUM:
+    case UPB_TYPE_INT32:
+      if (!is_integer || digits > (uint64_t)INT32_MAX + neg) return false;
+      sink_putint32(p, neg ? -(int64_t)digits : (int64_t)digits);
+      return true;
+    case UPB_TYPE_INT64:
+      if (!is_integer || digits > (uint64_t)INT64_MAX + neg) return false;
+      /* Negating 2^63 as a uint64_t wouldn't fit in an int64_t. */
+      sink_putint64(p, neg ? -(int64_t)(digits - 1) - 1 : (int64_t)digits);
+      return true;
+    case UPB_TYPE_UINT32:
+      if (!is_integer || neg || digits > UINT32_MAX) return false;
+      sink_putuint32(p, digits);
+      return true;
+    case UPB_TYPE_UINT64:
+      if (!is_integer || neg) return false;
+      sink_putuint64(p, digits);
+      return true;
+    case UPB_TYPE_DOUBLE:
+      if (!upb_fmt_decimaltodouble(digits, exp10, neg, &val)) return false;
+      sink_putdouble(p, val);
+      return true;
+    case UPB_TYPE_FLOAT:
+      if (!upb_fmt_decimaltodouble(digits, exp10, neg, &val) ||
+          val > FLT_MAX || val < -FLT_MAX) {
+        return false;
+      }
+      sink_putfloat(p, val);
+      return true;
+    default:
+      return false;
+  }
+}
+
 static bool parse_number(upb_json_parser *p, bool is_quoted) {
   size_t len;
   const char *buf;
 
+  /* The number is usually still in the input buffer, and parsed in place. */
+  if (p->accumulated) {
+    buf = accumulate_getptr(p, &len);
+    if (parse_number_fast(p, buf, len)) {
+      multipart_end(p);
+      return true;
+    }
+  }
+
   /* strtol() and friends unfortunately do not support specifying the length of
    * the input string, so we need to force a copy into a NULL-terminated buffer. */
   if (!multipart_text(p, "\0", 1, false)) {
@@ -766,8 +1046,6 @@ static bool parse_number(upb_json_parser *p, bool is_quoted) {
 }
 
 static bool parser_putbool(upb_json_parser *p, bool val) {
-  bool ok;
-
   if (upb_fielddef_type(p->top->f) != UPB_TYPE_BOOL) {
     upb_status_seterrf(&p->status,
                        "Boolean value specified for non-bool field: %s",
@@ -776,9 +1054,7 @@ static bool parser_putbool(upb_json_parser *p, bool val) {
     return false;
   }
 
-  ok = upb_sink_putbool(&p->top->sink, parser_getsel(p), val);
-  UPB_ASSERT(ok);
-
+  sink_putbool(p, val);
   return true;
 }
 
@@ -802,19 +1078,18 @@ static bool start_stringval(upb_json_parser *p) {
     inner->is_map = false;
     inner->is_mapentry = false;
     p->top = inner;
+    count_depth(p);
 
+    /* We push data directly to the handlers as it is parsed, so a string or
+     * bytes value is never held in memory whole, however many input buffers
+     * it spans. */
     if (upb_fielddef_type(p->top->f) == UPB_TYPE_STRING) {
-      /* For STRING fields we push data directly to the handlers as it is
-       * parsed.  We don't do this yet for BYTES fields, because our base64
-       * decoder is not streaming.
-       *
-       * TODO(haberman): make base64 decoding streaming also. */
       multipart_start(p, getsel_for_handlertype(p, UPB_HANDLER_STRING));
-      return true;
+      upb_utf8_init(&p->utf8);
     } else {
-      multipart_startaccum(p);
-      return true;
+      multipart_startbase64(p, getsel_for_handlertype(p, UPB_HANDLER_STRING));
     }
+    return true;
   } else if (upb_fielddef_type(p->top->f) != UPB_TYPE_BOOL &&
              upb_fielddef_type(p->top->f) != UPB_TYPE_MESSAGE) {
     /* No need to push a frame -- numeric values in quotes remain in the
@@ -836,14 +1111,18 @@ static bool end_stringval(upb_json_parser *p) {
 
   switch (upb_fielddef_type(p->top->f)) {
     case UPB_TYPE_BYTES:
-      if (!base64_push(p, getsel_for_handlertype(p, UPB_HANDLER_STRING),
-                       p->accumulated, p->accumulated_len)) {
+      if (p->base64_carry_len > 0) {
+        upb_status_seterrf(
+            &p->status, "Base64 input for bytes field not a multiple of 4: %s",
+            upb_fielddef_name(p->top->f));
+        upb_env_reporterror(p->env, &p->status);
         return false;
       }
       /* Fall through. */
 
     case UPB_TYPE_STRING: {
       upb_selector_t sel = getsel_for_handlertype(p, UPB_HANDLER_ENDSTR);
+      if (!utf8_boundary(p)) return false;
       p->top--;
       upb_sink_endstr(&p->top->sink, sel);
       break;
@@ -861,8 +1140,7 @@ static bool end_stringval(upb_json_parser *p) {
       ok = upb_enumdef_ntoi(enumdef, buf, len, &int_val);
 
       if (ok) {
-        upb_selector_t sel = parser_getsel(p);
-        upb_sink_putint32(&p->top->sink, sel, int_val);
+        sink_putint32(p, int_val);
       } else {
         upb_status_seterrf(&p->status, "Enum value unknown: '%.*s'", len, buf);
         upb_env_reporterror(p->env, &p->status);
@@ -877,8 +1155,8 @@ static bool end_stringval(upb_json_parser *p) {
     case UPB_TYPE_UINT64:
     case UPB_TYPE_DOUBLE:
     case UPB_TYPE_FLOAT:
-      ok = parse_number(p, true);
-      break;
+      /* parse_number() ends the multipart text itself. */
+      return parse_number(p, true);
 
     default:
       UPB_ASSERT(false);
@@ -1003,6 +1281,7 @@ static bool handle_mapentry(upb_json_parser *p) {
    * would have just seen the map-entry value, not key). */
   inner->is_mapentry = false;
   p->top = inner;
+  count_depth(p);
 
   /* send STARTMSG in submsg frame. */
   upb_sink_startmsg(&p->top->sink);
@@ -1032,9 +1311,11 @@ static bool end_membername(upb_json_parser *p) {
     const char *buf = accumulate_getptr(p, &len);
     upb_value v;
 
-    if (upb_strtable_lookup2(p->top->name_table, buf, len, &v)) {
+    if (p->stats) p->stats->dispatch_lookups++;
+    if (upb_frozentable_lookupstr(p->top->name_table, buf, len, &v)) {
       p->top->f = upb_value_getconstptr(v);
       multipart_end(p);
+      if (p->stats) p->stats->fields++;
 
       return true;
     } else {
@@ -1091,6 +1372,7 @@ static bool start_subobject(upb_json_parser *p) {
     inner->is_map = true;
     inner->is_mapentry = false;
     p->top = inner;
+    count_depth(p);
 
     return true;
   } else if (upb_fielddef_issubmsg(p->top->f)) {
@@ -1111,6 +1393,7 @@ static bool start_subobject(upb_json_parser *p) {
     inner->is_map = false;
     inner->is_mapentry = false;
     p->top = inner;
+    count_depth(p);
 
     return true;
   } else {
@@ -1161,6 +1444,16 @@ static bool start_array(upb_json_parser *p) {
   inner->is_map = false;
   inner->is_mapentry = false;
   p->top = inner;
+  count_depth(p);
+
+  if (upb_fielddef_isprimitive(inner->f) && inner->sink.handlers) {
+    sel = getsel_for_handlertype(p, UPB_HANDLER_ARRAY);
+    if (upb_handlers_gethandler(inner->sink.handlers, sel)) {
+      p->array_frame = inner;
+      p->array_selector = sel;
+      p->array_len = 0;
+    }
+  }
 
   return true;
 }
@@ -1170,6 +1463,11 @@ static void end_array(upb_json_parser *p) {
 
   UPB_ASSERT(p->top > p->stack);
 
+  if (p->top == p->array_frame) {
+    array_flush(p);
+    p->array_frame = NULL;
+  }
+
   p->top--;
   sel = getsel_for_handlertype(p, UPB_HANDLER_ENDSEQ);
   upb_sink_endseq(&p->top->sink, sel);
@@ -1214,11 +1512,11 @@ static void end_object(upb_json_parser *p) {
  * final state once, when the closing '"' is seen. */
 
 
-#line 1310 "upb/json/parser.rl"
+#line 1608 "upb/json/parser.rl"
 
 
 
-#line 1222 "upb/json/parser.c"
+#line 1520 "upb/json/parser.c"
 static const char _json_actions[] = {
 	0, 1, 0, 1, 2, 1, 3, 1, 
 	5, 1, 6, 1, 7, 1, 8, 1, 
@@ -1367,7 +1665,7 @@ static const int json_en_value_machine = 27;
 static const int json_en_main = 1;
 
 
-#line 1313 "upb/json/parser.rl"
+#line 1611 "upb/json/parser.rl"
 
 size_t parse(void *closure, const void *hd, const char *buf, size_t size,
              const upb_bufhandle *handle) {
@@ -1386,10 +1684,19 @@ size_t parse(void *closure, const void *hd, const char *buf, size_t size,
   UPB_UNUSED(hd);
   UPB_UNUSED(handle);
 
+  if (parser->stats) {
+    if (parser->stats_started) {
+      parser->stats->resumes++;
+    } else {
+      parser->stats_started = true;
+      parser->stats_blocks = upb_arena_blockcount(upb_env_arena(parser->env));
+    }
+  }
+
   capture_resume(parser, buf);
 
   
-#line 1393 "upb/json/parser.c"
+#line 1700 "upb/json/parser.c"
 	{
 	int _klen;
 	unsigned int _trans;
@@ -1464,118 +1771,118 @@ _match:
 		switch ( *_acts++ )
 		{
 	case 0:
-#line 1225 "upb/json/parser.rl"
+#line 1523 "upb/json/parser.rl"
 	{ p--; {cs = stack[--top]; goto _again;} }
 	break;
 	case 1:
-#line 1226 "upb/json/parser.rl"
+#line 1524 "upb/json/parser.rl"
 	{ p--; {stack[top++] = cs; cs = 10; goto _again;} }
 	break;
 	case 2:
-#line 1230 "upb/json/parser.rl"
-	{ start_text(parser, p); }
+#line 1528 "upb/json/parser.rl"
+	{ start_text(parser, p); {p = ((skip_text(p, pe)))-1;} }
 	break;
 	case 3:
-#line 1231 "upb/json/parser.rl"
+#line 1529 "upb/json/parser.rl"
 	{ CHECK_RETURN_TOP(end_text(parser, p)); }
 	break;
 	case 4:
-#line 1237 "upb/json/parser.rl"
+#line 1535 "upb/json/parser.rl"
 	{ start_hex(parser); }
 	break;
 	case 5:
-#line 1238 "upb/json/parser.rl"
+#line 1536 "upb/json/parser.rl"
 	{ hexdigit(parser, p); }
 	break;
 	case 6:
-#line 1239 "upb/json/parser.rl"
+#line 1537 "upb/json/parser.rl"
 	{ CHECK_RETURN_TOP(end_hex(parser)); }
 	break;
 	case 7:
-#line 1245 "upb/json/parser.rl"
+#line 1543 "upb/json/parser.rl"
 	{ CHECK_RETURN_TOP(escape(parser, p)); }
 	break;
 	case 8:
-#line 1251 "upb/json/parser.rl"
+#line 1549 "upb/json/parser.rl"
 	{ p--; {cs = stack[--top]; goto _again;} }
 	break;
 	case 9:
-#line 1254 "upb/json/parser.rl"
+#line 1552 "upb/json/parser.rl"
 	{ {stack[top++] = cs; cs = 19; goto _again;} }
 	break;
 	case 10:
-#line 1256 "upb/json/parser.rl"
+#line 1554 "upb/json/parser.rl"
 	{ p--; {stack[top++] = cs; cs = 27; goto _again;} }
 	break;
 	case 11:
-#line 1261 "upb/json/parser.rl"
+#line 1559 "upb/json/parser.rl"
 	{ start_member(parser); }
 	break;
 	case 12:
-#line 1262 "upb/json/parser.rl"
+#line 1560 "upb/json/parser.rl"
 	{ CHECK_RETURN_TOP(end_membername(parser)); }
 	break;
 	case 13:
-#line 1265 "upb/json/parser.rl"
+#line 1563 "upb/json/parser.rl"
 	{ end_member(parser); }
 	break;
 	case 14:
-#line 1271 "upb/json/parser.rl"
+#line 1569 "upb/json/parser.rl"
 	{ start_object(parser); }
 	break;
 	case 15:
-#line 1274 "upb/json/parser.rl"
+#line 1572 "upb/json/parser.rl"
 	{ end_object(parser); }
 	break;
 	case 16:
-#line 1280 "upb/json/parser.rl"
+#line 1578 "upb/json/parser.rl"
 	{ CHECK_RETURN_TOP(start_array(parser)); }
 	break;
 	case 17:
-#line 1284 "upb/json/parser.rl"
+#line 1582 "upb/json/parser.rl"
 	{ end_array(parser); }
 	break;
 	case 18:
-#line 1289 "upb/json/parser.rl"
+#line 1587 "upb/json/parser.rl"
 	{ start_number(parser, p); }
 	break;
 	case 19:
-#line 1290 "upb/json/parser.rl"
+#line 1588 "upb/json/parser.rl"
 	{ CHECK_RETURN_TOP(end_number(parser, p)); }
 	break;
 	case 20:
-#line 1292 "upb/json/parser.rl"
+#line 1590 "upb/json/parser.rl"
 	{ CHECK_RETURN_TOP(start_stringval(parser)); }
 	break;
 	case 21:
-#line 1293 "upb/json/parser.rl"
+#line 1591 "upb/json/parser.rl"
 	{ CHECK_RETURN_TOP(end_stringval(parser)); }
 	break;
 	case 22:
-#line 1295 "upb/json/parser.rl"
+#line 1593 "upb/json/parser.rl"
 	{ CHECK_RETURN_TOP(parser_putbool(parser, true)); }
 	break;
 	case 23:
-#line 1297 "upb/json/parser.rl"
+#line 1595 "upb/json/parser.rl"
 	{ CHECK_RETURN_TOP(parser_putbool(parser, false)); }
 	break;
 	case 24:
-#line 1299 "upb/json/parser.rl"
+#line 1597 "upb/json/parser.rl"
 	{ /* null value */ }
 	break;
 	case 25:
-#line 1301 "upb/json/parser.rl"
+#line 1599 "upb/json/parser.rl"
 	{ CHECK_RETURN_TOP(start_subobject(parser)); }
 	break;
 	case 26:
-#line 1302 "upb/json/parser.rl"
+#line 1600 "upb/json/parser.rl"
 	{ end_subobject(parser); }
 	break;
 	case 27:
-#line 1307 "upb/json/parser.rl"
+#line 1605 "upb/json/parser.rl"
 	{ p--; {cs = stack[--top]; goto _again;} }
 	break;
-#line 1579 "upb/json/parser.c"
+#line 1886 "upb/json/parser.c"
 		}
 	}
 
@@ -1588,27 +1895,38 @@ _again:
 	_out: {}
 	}
 
-#line 1334 "upb/json/parser.rl"
+#line 1641 "upb/json/parser.rl"
 
   if (p != pe) {
     upb_status_seterrf(&parser->status, "Parse error at '%.*s'\n", pe - p, p);
     upb_env_reporterror(parser->env, &parser->status);
   } else {
     capture_suspend(parser, &p);
+    if (parser->stats) parser->stats->suspends++;
   }
 
 error:
   /* Save parsing state back to parser. */
   parser->current_state = cs;
   parser->parser_top = top;
+  parser->stats_bytes += p - buf;
 
   return p - buf;
 }
 
 bool end(void *closure, const void *hd) {
-  UPB_UNUSED(closure);
+  upb_json_parser *parser = closure;
   UPB_UNUSED(hd);
 
+  if (parser->stats && parser->stats_started && upb_ok(&parser->status)) {
+    parser->stats->bytes += parser->stats_bytes;
+    parser->stats->arena_blocks +=
+        upb_arena_blockcount(upb_env_arena(parser->env)) -
+        parser->stats_blocks;
+  }
+  parser->stats_started = false;
+  parser->stats_bytes = 0;
+
   /* Prevent compile warning on unused static constants. */
   UPB_UNUSED(json_start);
   UPB_UNUSED(json_en_number_machine);
@@ -1629,19 +1947,20 @@ static void json_parser_reset(upb_json_parser *p) {
 
   /* Emit Ragel initialization of the parser. */
   
-#line 1633 "upb/json/parser.c"
+#line 1951 "upb/json/parser.c"
 	{
 	cs = json_start;
 	top = 0;
 	}
 
-#line 1374 "upb/json/parser.rl"
+#line 1692 "upb/json/parser.rl"
   p->current_state = cs;
   p->parser_top = top;
   accumulate_clear(p);
   p->multipart_state = MULTIPART_INACTIVE;
   p->capture = NULL;
   p->accumulated = NULL;
+  p->array_frame = NULL;
   upb_status_clear(&p->status);
 }
 
@@ -1659,9 +1978,7 @@ static void free_json_parsermethod(upb_refcounted *r) {
   upb_inttable_begin(&i, &method->name_tables);
   for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
     upb_value val = upb_inttable_iter_value(&i);
-    upb_strtable *t = upb_value_getptr(val);
-    upb_strtable_uninit(t);
-    upb_gfree(t);
+    upb_gfree(upb_value_getptr(val));
   }
 
   upb_inttable_uninit(&method->name_tables);
@@ -1669,9 +1986,21 @@ static void free_json_parsermethod(upb_refcounted *r) {
   upb_gfree(r);
 }
 
-static void add_jsonname_table(upb_json_parsermethod *m, const upb_msgdef* md) {
+/* Adds an entry to |t| unless the name is already taken, which can happen if
+ * one field's JSON name is another field's proto name.  Returns false if
+ * memory allocation failed. */
+static bool add_jsonname(upb_strtable *t, const char *name,
+                         const upb_fielddef *f) {
+  return upb_strtable_lookup(t, name, NULL) ||
+         upb_strtable_insert(t, name, upb_value_constptr(f));
+}
+
+static bool add_jsonname_table(upb_json_parsermethod *m,
+                               const upb_msgdef* md) {
   upb_msg_field_iter i;
-  upb_strtable *t;
+  upb_strtable t;
+  void *frozen;
+  size_t size;
 
   /* It would be nice to stack-allocate this, but protobufs do not limit the
    * length of fields to any reasonable limit. */
@@ -1679,13 +2008,12 @@ static void add_jsonname_table(upb_json_parsermethod *m, const upb_msgdef* md) {
   size_t len = 0;
 
   if (upb_inttable_lookupptr(&m->name_tables, md, NULL)) {
-    return;
+    return true;
   }
 
-  /* TODO(haberman): handle malloc failure. */
-  t = upb_gmalloc(sizeof(*t));
-  upb_strtable_init(t, UPB_CTYPE_CONSTPTR);
-  upb_inttable_insertptr(&m->name_tables, md, upb_value_ptr(t));
+  if (!upb_strtable_init(&t, UPB_CTYPE_CONSTPTR)) {
+    return false;
+  }
 
   for(upb_msg_field_begin(&i, md);
       !upb_msg_field_done(&i);
@@ -1696,26 +2024,56 @@ static void add_jsonname_table(upb_json_parsermethod *m, const upb_msgdef* md) {
     size_t field_len = upb_fielddef_getjsonname(f, buf, len);
     if (field_len > len) {
       size_t len2;
-      buf = upb_grealloc(buf, 0, field_len);
+      char *buf2 = upb_grealloc(buf, 0, field_len);
+      if (!buf2) goto err;
+      buf = buf2;
       len = field_len;
       len2 = upb_fielddef_getjsonname(f, buf, len);
       UPB_ASSERT(len == len2);
     }
-    upb_strtable_insert(t, buf, upb_value_constptr(f));
+    if (!add_jsonname(&t, buf, f)) goto err;
 
     if (strcmp(buf, upb_fielddef_name(f)) != 0) {
       /* Since the JSON name is different from the regular field name, add an
        * entry for the raw name (compliant proto3 JSON parsers must accept
        * both). */
-      upb_strtable_insert(t, upb_fielddef_name(f), upb_value_constptr(f));
+      if (!add_jsonname(&t, upb_fielddef_name(f), f)) goto err;
     }
+  }
+
+  upb_gfree(buf);
+
+  /* The table never changes once built, so freeze it for faster lookups. */
+  size = upb_strtable_frozensize(&t);
+  frozen = upb_gmalloc(size);
+  if (!frozen || !upb_strtable_freeze(&t, frozen, size, &upb_alloc_global)) {
+    upb_gfree(frozen);
+    upb_strtable_uninit(&t);
+    return false;
+  }
+  upb_strtable_uninit(&t);
+  if (!upb_inttable_insertptr(&m->name_tables, md, upb_value_ptr(frozen))) {
+    upb_gfree(frozen);
+    return false;
+  }
 
-    if (upb_fielddef_issubmsg(f)) {
-      add_jsonname_table(m, upb_fielddef_msgsubdef(f));
+  /* Recurse only now that |md| is in the table, in case of cycles. */
+  for(upb_msg_field_begin(&i, md);
+      !upb_msg_field_done(&i);
+      upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    if (upb_fielddef_issubmsg(f) &&
+        !add_jsonname_table(m, upb_fielddef_msgsubdef(f))) {
+      return false;
     }
   }
 
+  return true;
+
+err:
   upb_gfree(buf);
+  upb_strtable_uninit(&t);
+  return false;
 }
 
 /* Public API *****************************************************************/
@@ -1734,6 +2092,10 @@ upb_json_parser *upb_json_parser_create(upb_env *env,
   p->limit = p->stack + UPB_JSON_MAX_DEPTH;
   p->accumulate_buf = NULL;
   p->accumulate_buf_size = 0;
+  p->stats = NULL;
+  p->stats_started = false;
+  p->stats_bytes = 0;
+  p->stats_blocks = 0;
   upb_bytessink_reset(&p->input_, &method->input_handler_, p);
 
   json_parser_reset(p);
@@ -1752,11 +2114,22 @@ upb_bytessink *upb_json_parser_input(upb_json_parser *p) {
   return &p->input_;
 }
 
+void upb_json_parser_setstats(upb_json_parser *p, upb_decstats *s) {
+  p->stats = s;
+}
+
 upb_json_parsermethod *upb_json_parsermethod_new(const upb_msgdef* md,
                                                  const void* owner) {
   static const struct upb_refcounted_vtbl vtbl = {visit_json_parsermethod,
                                                   free_json_parsermethod};
   upb_json_parsermethod *ret = upb_gmalloc(sizeof(*ret));
+  if (!ret) return NULL;
+
+  if (!upb_inttable_init(&ret->name_tables, UPB_CTYPE_PTR)) {
+    upb_gfree(ret);
+    return NULL;
+  }
+
   upb_refcounted_init(upb_json_parsermethod_upcast_mutable(ret), &vtbl, owner);
 
   ret->msg = md;
@@ -1766,9 +2139,10 @@ upb_json_parsermethod *upb_json_parsermethod_new(const upb_msgdef* md,
   upb_byteshandler_setstring(&ret->input_handler_, parse, ret);
   upb_byteshandler_setendstr(&ret->input_handler_, end, ret);
 
-  upb_inttable_init(&ret->name_tables, UPB_CTYPE_PTR);
-
-  add_jsonname_table(ret, md);
+  if (!add_jsonname_table(ret, md)) {
+    upb_json_parsermethod_unref(ret, owner);
+    return NULL;
+  }
 
   return ret;
 }
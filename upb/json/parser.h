@@ -29,7 +29,7 @@ UPB_DECLARE_DERIVED_TYPE(upb::json::ParserMethod, upb::RefCounted,
  * constructed.  This hint may be an overestimate for some build configurations.
  * But if the parser library is upgraded without recompiling the application,
  * it may be an underestimate. */
-#define UPB_JSON_PARSER_SIZE 4112
+#define UPB_JSON_PARSER_SIZE 4688
 
 #ifdef __cplusplus
 
@@ -42,6 +42,13 @@ class upb::json::Parser {
 
   BytesSink* input();
 
+  /* Sets the counters this parser updates, or NULL (the default) for none.
+   * Fields and dispatch_lookups count the object members whose names were
+   * looked up; unknown members are errors, so unknown_fields stays zero, as
+   * does tag_hits.  Depth counts the frames for arrays and string values as
+   * well as objects. */
+  void set_stats(upb_decstats* stats);
+
  private:
   UPB_DISALLOW_POD_OPS(Parser, upb::json::Parser)
 };
@@ -74,7 +81,9 @@ upb_json_parser* upb_json_parser_create(upb_env* e,
                                         const upb_json_parsermethod* m,
                                         upb_sink* output);
 upb_bytessink *upb_json_parser_input(upb_json_parser *p);
+void upb_json_parser_setstats(upb_json_parser *p, upb_decstats *s);
 
+/* Returns NULL if memory allocation failed. */
 upb_json_parsermethod* upb_json_parsermethod_new(const upb_msgdef* md,
                                                  const void* owner);
 const upb_handlers *upb_json_parsermethod_desthandlers(
@@ -98,6 +107,9 @@ inline Parser* Parser::Create(Environment* env, const ParserMethod* method,
 inline BytesSink* Parser::input() {
   return upb_json_parser_input(this);
 }
+inline void Parser::set_stats(upb_decstats* stats) {
+  upb_json_parser_setstats(this, stats);
+}
 
 inline const Handlers* ParserMethod::dest_handlers() const {
   return upb_json_parsermethod_desthandlers(this);
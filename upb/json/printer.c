@@ -1,5 +1,5 @@
 /*
-** This currently uses snprintf() to format primitives, and could be optimized
+** This currently uses snprintf() to format bools, and could be optimized
 ** further.
 */
 
@@ -8,6 +8,18 @@
 #include <string.h>
 #include <stdint.h>
 
+#include "upb/fmt.int.h"
+#include "upb/json/base64.int.h"
+#include "upb/trace.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define UPB_JSON_SSE2
+#elif defined(__GNUC__) && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define UPB_JSON_NEON
+#endif
+
 struct upb_json_printer {
   upb_sink input_;
   /* BytesSink closure. */
@@ -18,6 +30,11 @@ struct upb_json_printer {
    * output. */
   int depth_;
 
+#ifdef UPB_TRACING
+  /* Bytes printed for the current top-level message. */
+  uint64_t printed_;
+#endif
+
   /* Have we emitted the first element? This state is necessary to emit commas
    * without leaving a trailing comma in arrays/maps. We keep this state per
    * frame depth.
@@ -29,39 +46,6 @@ struct upb_json_printer {
   bool first_elem_[UPB_MAX_HANDLER_DEPTH * 2];
 };
 
-/* StringPiece; a pointer plus a length. */
-typedef struct {
-  char *ptr;
-  size_t len;
-} strpc;
-
-void freestrpc(void *ptr) {
-  strpc *pc = ptr;
-  upb_gfree(pc->ptr);
-  upb_gfree(pc);
-}
-
-/* Convert fielddef name to JSON name and return as a string piece. */
-strpc *newstrpc(upb_handlers *h, const upb_fielddef *f,
-                bool preserve_fieldnames) {
-  /* TODO(haberman): handle malloc failure. */
-  strpc *ret = upb_gmalloc(sizeof(*ret));
-  if (preserve_fieldnames) {
-    ret->ptr = upb_gstrdup(upb_fielddef_name(f));
-    ret->len = strlen(ret->ptr);
-  } else {
-    size_t len;
-    ret->len = upb_fielddef_getjsonname(f, NULL, 0);
-    ret->ptr = upb_gmalloc(ret->len);
-    len = upb_fielddef_getjsonname(f, ret->ptr, ret->len);
-    UPB_ASSERT(len == ret->len);
-    ret->len--;  /* NULL */
-  }
-
-  upb_handlers_addcleanup(h, ret, freestrpc);
-  return ret;
-}
-
 /* ------------ JSON string printing: values, maps, arrays ------------------ */
 
 static void print_data(
@@ -69,6 +53,9 @@ static void print_data(
   /* TODO: Will need to change if we support pushback from the sink. */
   size_t n = upb_bytessink_putbuf(p->output_, p->subc_, buf, len, NULL);
   UPB_ASSERT(n == len);
+#ifdef UPB_TRACING
+  p->printed_ += len;
+#endif
 }
 
 static void print_comma(upb_json_printer *p) {
@@ -102,57 +89,153 @@ UPB_INLINE const char* json_nice_escape(char c) {
   }
 }
 
+/* Returns the first byte in [ptr, end) that must be escaped, or |end|.  Most
+ * strings are long runs that need no escaping, so we check 16 bytes at a time
+ * where we can. */
+static const char *find_escape(const char *ptr, const char *end) {
+#if defined(UPB_JSON_SSE2)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(kControlCharLimit - 1);
+
+  while (end - ptr >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)ptr);
+    /* There is no unsigned compare; v <= 0x1f if max(v, 0x1f) == 0x1f. */
+    __m128i hits = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+        _mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+    int mask = _mm_movemask_epi8(hits);
+    if (mask) {
+      return ptr + __builtin_ctz(mask);
+    }
+    ptr += 16;
+  }
+#elif defined(UPB_JSON_NEON)
+  const uint8x16_t quote = vdupq_n_u8('"');
+  const uint8x16_t backslash = vdupq_n_u8('\\');
+  const uint8x16_t control = vdupq_n_u8(kControlCharLimit);
+
+  while (end - ptr >= 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t*)ptr);
+    uint8x16_t hits = vorrq_u8(
+        vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)),
+        vcltq_u8(v, control));
+    if (vmaxvq_u8(hits)) {
+      /* The byte loop below finds it within these 16 bytes. */
+      break;
+    }
+    ptr += 16;
+  }
+#endif
+
+  for (; ptr < end; ptr++) {
+    if (is_json_escaped(*ptr)) break;
+  }
+  return ptr;
+}
+
 /* Write a properly escaped string chunk. The surrounding quotes are *not*
  * printed; this is so that the caller has the option of emitting the string
  * content in chunks. */
 static void putstring(upb_json_printer *p, const char *buf, unsigned int len) {
-  const char* unescaped_run = NULL;
-  unsigned int i;
-  for (i = 0; i < len; i++) {
-    char c = buf[i];
-    /* Handle escaping. */
-    if (is_json_escaped(c)) {
-      /* Use a "nice" escape, like \n, if one exists for this character. */
-      const char* escape = json_nice_escape(c);
-      /* If we don't have a specific 'nice' escape code, use a \uXXXX-style
-       * escape. */
-      char escape_buf[8];
-      if (!escape) {
-        unsigned char byte = (unsigned char)c;
-        _upb_snprintf(escape_buf, sizeof(escape_buf), "\\u%04x", (int)byte);
-        escape = escape_buf;
-      }
+  const char *ptr = buf;
+  const char *end = buf + len;
+
+  while (ptr < end) {
+    /* N.B. that we assume that the input encoding is equal to the output
+     * encoding (both UTF-8 for  now), so for chars >= 0x20 and != \, ", we
+     * can simply pass the bytes through. */
+    const char *unescaped_run = ptr;
+    const char *escape;
+    char escape_buf[8];
+
+    ptr = find_escape(ptr, end);
+    if (ptr > unescaped_run) {
+      print_data(p, unescaped_run, ptr - unescaped_run);
+    }
+    if (ptr == end) break;
+
+    /* Use a "nice" escape, like \n, if one exists for this character. */
+    escape = json_nice_escape(*ptr);
+    /* If we don't have a specific 'nice' escape code, use a \uXXXX-style
+     * escape. */
+    if (!escape) {
+      unsigned char byte = (unsigned char)*ptr;
+      _upb_snprintf(escape_buf, sizeof(escape_buf), "\\u%04x", (int)byte);
+      escape = escape_buf;
+    }
+    print_data(p, escape, strlen(escape));
+    ptr++;
+  }
+}
 
-      /* N.B. that we assume that the input encoding is equal to the output
-       * encoding (both UTF-8 for  now), so for chars >= 0x20 and != \, ", we
-       * can simply pass the bytes through. */
+/* StringPiece; a pointer plus a length.  For field names this is the whole key
+ * as printed, ',"name":', so that putkey() is a single print_data().  The
+ * first element of an object skips the leading comma. */
+typedef struct {
+  char *ptr;
+  size_t len;
+} strpc;
 
-      /* If there's a current run of unescaped chars, print that run first. */
-      if (unescaped_run) {
-        print_data(p, unescaped_run, &buf[i] - unescaped_run);
-        unescaped_run = NULL;
-      }
-      /* Then print the escape code. */
-      print_data(p, escape, strlen(escape));
+void freestrpc(void *ptr) {
+  strpc *pc = ptr;
+  upb_gfree(pc->ptr);
+  upb_gfree(pc);
+}
+
+/* Convert fielddef name to JSON name, and return its key as a string piece. */
+strpc *newstrpc(upb_handlers *h, const upb_fielddef *f,
+                bool preserve_fieldnames) {
+  /* TODO(haberman): handle malloc failure. */
+  strpc *ret = upb_gmalloc(sizeof(*ret));
+  char *name;
+  size_t len;
+  const char *ptr;
+  const char *end;
+  char *out;
+
+  if (preserve_fieldnames) {
+    name = upb_gstrdup(upb_fielddef_name(f));
+    len = strlen(name);
+  } else {
+    size_t len2;
+    len = upb_fielddef_getjsonname(f, NULL, 0);
+    name = upb_gmalloc(len);
+    len2 = upb_fielddef_getjsonname(f, name, len);
+    UPB_ASSERT(len2 == len);
+    len--;  /* NULL */
+  }
+
+  /* Room for every character to become a \uXXXX escape, plus ,"": */
+  out = ret->ptr = upb_gmalloc(len * 6 + 4);
+  *out++ = ',';
+  *out++ = '"';
+  for (ptr = name, end = name + len; ptr < end; ptr++) {
+    const char *escape = json_nice_escape(*ptr);
+    if (escape) {
+      memcpy(out, escape, 2);
+      out += 2;
+    } else if (is_json_escaped(*ptr)) {
+      _upb_snprintf(out, 7, "\\u%04x", (int)(unsigned char)*ptr);
+      out += 6;
     } else {
-      /* Add to the current unescaped run of characters. */
-      if (unescaped_run == NULL) {
-        unescaped_run = &buf[i];
-      }
+      *out++ = *ptr;
     }
   }
+  *out++ = '"';
+  *out++ = ':';
+  ret->len = out - ret->ptr;
+  upb_gfree(name);
 
-  /* If the string ended in a run of unescaped characters, print that last run. */
-  if (unescaped_run) {
-    print_data(p, unescaped_run, &buf[len] - unescaped_run);
-  }
+  upb_handlers_addcleanup(h, ret, freestrpc);
+  return ret;
 }
 
 #define CHKLENGTH(x) if (!(x)) return -1;
 
 /* Helpers that format floating point values according to our custom formats.
- * Right now we use %.8g and %.17g for float/double, respectively, to match
- * proto2::util::JsonFormat's defaults.  May want to change this later. */
+ * We print the shortest representation that parses back to the same value,
+ * laid out like %g. */
 
 const char neginf[] = "\"-Infinity\"";
 const char inf[] = "\"Infinity\"";
@@ -167,16 +250,14 @@ static size_t fmt_double(double val, char* buf, size_t length) {
     strcpy(buf, neginf);
     return strlen(neginf);
   } else {
-    size_t n = _upb_snprintf(buf, length, "%.17g", val);
-    CHKLENGTH(n > 0 && n < length);
-    return n;
+    CHKLENGTH(length >= UPB_FMT_BUFSIZE);
+    return upb_fmt_double(val, buf);
   }
 }
 
 static size_t fmt_float(float val, char* buf, size_t length) {
-  size_t n = _upb_snprintf(buf, length, "%.8g", val);
-  CHKLENGTH(n > 0 && n < length);
-  return n;
+  CHKLENGTH(length >= UPB_FMT_BUFSIZE);
+  return upb_fmt_float(val, buf);
 }
 
 static size_t fmt_bool(bool val, char* buf, size_t length) {
@@ -185,16 +266,14 @@ static size_t fmt_bool(bool val, char* buf, size_t length) {
   return n;
 }
 
-static size_t fmt_int64(long val, char* buf, size_t length) {
-  size_t n = _upb_snprintf(buf, length, "%ld", val);
-  CHKLENGTH(n > 0 && n < length);
-  return n;
+static size_t fmt_int64(int64_t val, char* buf, size_t length) {
+  CHKLENGTH(length >= UPB_FMT_BUFSIZE);
+  return upb_fmt_int64(val, buf);
 }
 
-static size_t fmt_uint64(unsigned long long val, char* buf, size_t length) {
-  size_t n = _upb_snprintf(buf, length, "%llu", val);
-  CHKLENGTH(n > 0 && n < length);
-  return n;
+static size_t fmt_uint64(uint64_t val, char* buf, size_t length) {
+  CHKLENGTH(length >= UPB_FMT_BUFSIZE);
+  return upb_fmt_uint64(val, buf);
 }
 
 /* Print a map key given a field name. Called by scalar field handlers and by
@@ -202,10 +281,12 @@ static size_t fmt_uint64(unsigned long long val, char* buf, size_t length) {
 static bool putkey(void *closure, const void *handler_data) {
   upb_json_printer *p = closure;
   const strpc *key = handler_data;
-  print_comma(p);
-  print_data(p, "\"", 1);
-  putstring(p, key->ptr, key->len);
-  print_data(p, "\":", 2);
+  if (p->first_elem_[p->depth_]) {
+    print_data(p, key->ptr + 1, key->len - 1);
+  } else {
+    print_data(p, key->ptr, key->len);
+  }
+  p->first_elem_[p->depth_] = false;
   return true;
 }
 
@@ -264,18 +345,29 @@ TYPE_HANDLERS_MAPKEY(uint64_t, fmt_uint64)
 #undef TYPE_HANDLERS
 #undef TYPE_HANDLERS_MAPKEY
 
+/* Handler data for enum fields.  If the enum's values are about contiguous,
+ * |names| holds each value's name as printed, quotes included, indexed by
+ * value - |min|, so printing one is a single print_data().  Values with no
+ * name, and every value of a sparse enum, go through upb_enumdef_iton(). */
 typedef struct {
   void *keyname;
   const upb_enumdef *enumdef;
+  int32_t min;
+  uint32_t count;  /* 0 if there is no table. */
+  strpc *names;    /* A NULL ptr for a value with no name. */
+  char *buf;
 } EnumHandlerData;
 
-static bool scalar_enum(void *closure, const void *handler_data,
-                        int32_t val) {
-  const EnumHandlerData *hd = handler_data;
-  upb_json_printer *p = closure;
+static void print_enum_symbolic_name(upb_json_printer *p,
+                                     const EnumHandlerData *hd,
+                                     int32_t val) {
+  uint32_t i = (uint32_t)val - (uint32_t)hd->min;
   const char *symbolic_name;
 
-  CHK(putkey(closure, hd->keyname));
+  if (i < hd->count && hd->names[i].ptr) {
+    print_data(p, hd->names[i].ptr, hd->names[i].len);
+    return;
+  }
 
   symbolic_name = upb_enumdef_iton(hd->enumdef, val);
   if (symbolic_name) {
@@ -283,23 +375,19 @@ static bool scalar_enum(void *closure, const void *handler_data,
     putstring(p, symbolic_name, strlen(symbolic_name));
     print_data(p, "\"", 1);
   } else {
-    putint32_t(closure, NULL, val);
+    putint32_t(p, NULL, val);
   }
-
-  return true;
 }
 
-static void print_enum_symbolic_name(upb_json_printer *p,
-                                     const upb_enumdef *def,
-                                     int32_t val) {
-  const char *symbolic_name = upb_enumdef_iton(def, val);
-  if (symbolic_name) {
-    print_data(p, "\"", 1);
-    putstring(p, symbolic_name, strlen(symbolic_name));
-    print_data(p, "\"", 1);
-  } else {
-    putint32_t(p, NULL, val);
-  }
+static bool scalar_enum(void *closure, const void *handler_data,
+                        int32_t val) {
+  const EnumHandlerData *hd = handler_data;
+  upb_json_printer *p = closure;
+
+  CHK(putkey(closure, hd->keyname));
+  print_enum_symbolic_name(p, hd, val);
+
+  return true;
 }
 
 static bool repeated_enum(void *closure, const void *handler_data,
@@ -308,7 +396,7 @@ static bool repeated_enum(void *closure, const void *handler_data,
   upb_json_printer *p = closure;
   print_comma(p);
 
-  print_enum_symbolic_name(p, hd->enumdef, val);
+  print_enum_symbolic_name(p, hd, val);
 
   return true;
 }
@@ -318,7 +406,7 @@ static bool mapvalue_enum(void *closure, const void *handler_data,
   const EnumHandlerData *hd = handler_data;
   upb_json_printer *p = closure;
 
-  print_enum_symbolic_name(p, hd->enumdef, val);
+  print_enum_symbolic_name(p, hd, val);
 
   return true;
 }
@@ -349,6 +437,11 @@ static bool printer_startmsg(void *closure, const void *handler_data) {
   upb_json_printer *p = closure;
   UPB_UNUSED(handler_data);
   if (p->depth_ == 0) {
+#ifdef UPB_TRACING
+    p->printed_ = 0;
+#endif
+    upb_trace(UPB_TRACE_JSONPRINTER, false, false,
+              upb_handlers_msgdef(p->input_.handlers), NULL, 0);
     upb_bytessink_start(p->output_, 0, &p->subc_);
   }
   start_frame(p);
@@ -362,6 +455,10 @@ static bool printer_endmsg(void *closure, const void *handler_data, upb_status *
   end_frame(p);
   if (p->depth_ == 0) {
     upb_bytessink_end(p->output_);
+#ifdef UPB_TRACING
+    upb_trace(UPB_TRACE_JSONPRINTER, true, true,
+              upb_handlers_msgdef(p->input_.handlers), NULL, p->printed_);
+#endif
   }
   return true;
 }
@@ -409,62 +506,26 @@ static size_t putstr(void *closure, const void *handler_data, const char *str,
   return len;
 }
 
-/* This has to Base64 encode the bytes, because JSON has no "bytes" type. */
+/* This has to Base64 encode the bytes, because JSON has no "bytes" type.
+ * This is the regular base64, not the "web-safe" version. */
 static size_t putbytes(void *closure, const void *handler_data, const char *str,
                        size_t len, const upb_bufhandle *handle) {
   upb_json_printer *p = closure;
-
-  /* This is the regular base64, not the "web-safe" version. */
-  static const char base64[] =
-      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-  /* Base64-encode. */
   char data[16000];
-  const char *limit = data + sizeof(data);
-  const unsigned char *from = (const unsigned char*)str;
-  char *to = data;
   size_t remaining = len;
-  size_t bytes;
 
   UPB_UNUSED(handler_data);
   UPB_UNUSED(handle);
 
-  while (remaining > 2) {
-    /* TODO(haberman): handle encoded lengths > sizeof(data) */
-    UPB_ASSERT((limit - to) >= 4);
-
-    to[0] = base64[from[0] >> 2];
-    to[1] = base64[((from[0] & 0x3) << 4) | (from[1] >> 4)];
-    to[2] = base64[((from[1] & 0xf) << 2) | (from[2] >> 6)];
-    to[3] = base64[from[2] & 0x3f];
-
-    remaining -= 3;
-    to += 4;
-    from += 3;
-  }
-
-  switch (remaining) {
-    case 2:
-      to[0] = base64[from[0] >> 2];
-      to[1] = base64[((from[0] & 0x3) << 4) | (from[1] >> 4)];
-      to[2] = base64[(from[1] & 0xf) << 2];
-      to[3] = '=';
-      to += 4;
-      from += 2;
-      break;
-    case 1:
-      to[0] = base64[from[0] >> 2];
-      to[1] = base64[((from[0] & 0x3) << 4)];
-      to[2] = '=';
-      to[3] = '=';
-      to += 4;
-      from += 1;
-      break;
-  }
-
-  bytes = to - data;
   print_data(p, "\"", 1);
-  putstring(p, data, bytes);
+  while (remaining > 0) {
+    /* Whole triples until the last piece, so only that one is padded.  The
+     * output needs no escaping. */
+    size_t n = UPB_MIN(remaining, sizeof(data) / 4 * 3);
+    print_data(p, data, upb_base64_encode(data, str, n, false));
+    str += n;
+    remaining -= n;
+  }
   print_data(p, "\"", 1);
   return len;
 }
@@ -573,6 +634,72 @@ static size_t mapkey_bytes(void *closure, const void *handler_data,
   return len;
 }
 
+static void freeenumhd(void *ptr) {
+  EnumHandlerData *hd = ptr;
+  upb_gfree(hd->names);
+  upb_gfree(hd->buf);
+  upb_gfree(hd);
+}
+
+/* Fills in |hd->names| for an enum that spans at most twice as many numbers as
+ * it has values, the same test as setenumnames() in upb/pb/textprinter.c.
+ * Enum names are identifiers, so they never need escaping.  Without the table
+ * (count 0), values are looked up one by one. */
+static void build_enum_names(EnumHandlerData *hd) {
+  int numvals = upb_enumdef_numvals(hd->enumdef);
+  int64_t min = INT32_MAX;
+  int64_t max = INT32_MIN;
+  size_t bytes = 0;
+  upb_enum_iter it;
+  char *out;
+  uint32_t i;
+
+  hd->min = 0;
+  hd->count = 0;
+  hd->names = NULL;
+  hd->buf = NULL;
+
+  for (upb_enum_begin(&it, hd->enumdef);
+       !upb_enum_done(&it);
+       upb_enum_next(&it)) {
+    int32_t num = upb_enum_iter_number(&it);
+    min = UPB_MIN(min, num);
+    max = UPB_MAX(max, num);
+  }
+
+  if (numvals == 0 || max - min + 1 > 2 * (int64_t)numvals) return;
+
+  hd->names = upb_gmalloc((max - min + 1) * sizeof(*hd->names));
+  if (!hd->names) return;
+  for (i = 0; i < max - min + 1; i++) {
+    const char *name = upb_enumdef_iton(hd->enumdef, (int32_t)(min + i));
+    hd->names[i].len = name ? strlen(name) + 2 : 0;
+    bytes += hd->names[i].len;
+  }
+
+  out = hd->buf = upb_gmalloc(bytes);
+  if (!out) {
+    upb_gfree(hd->names);
+    hd->names = NULL;
+    return;
+  }
+  for (i = 0; i < max - min + 1; i++) {
+    const char *name = upb_enumdef_iton(hd->enumdef, (int32_t)(min + i));
+    if (name) {
+      hd->names[i].ptr = out;
+      *out++ = '"';
+      memcpy(out, name, hd->names[i].len - 2);
+      out += hd->names[i].len - 2;
+      *out++ = '"';
+    } else {
+      hd->names[i].ptr = NULL;
+    }
+  }
+
+  hd->min = (int32_t)min;
+  hd->count = (uint32_t)(max - min + 1);
+}
+
 static void set_enum_hd(upb_handlers *h,
                         const upb_fielddef *f,
                         bool preserve_fieldnames,
@@ -580,7 +707,8 @@ static void set_enum_hd(upb_handlers *h,
   EnumHandlerData *hd = upb_gmalloc(sizeof(EnumHandlerData));
   hd->enumdef = (const upb_enumdef *)upb_fielddef_subdef(f);
   hd->keyname = newstrpc(h, f, preserve_fieldnames);
-  upb_handlers_addcleanup(h, hd, upb_gfree);
+  build_enum_names(hd);
+  upb_handlers_addcleanup(h, hd, freeenumhd);
   upb_handlerattr_sethandlerdata(attr, hd);
 }
 
@@ -824,3 +952,12 @@ const upb_handlers *upb_json_printer_newhandlers(const upb_msgdef *md,
   return upb_handlers_newfrozen(
       md, owner, printer_sethandlers, &preserve_fieldnames);
 }
+
+upb_handlercache *upb_json_printer_newcache(bool preserve_fieldnames) {
+  /* The cache keeps the closure for its whole life, so it can't point to our
+   * argument. */
+  static const bool preserve = true;
+  static const bool camelcase = false;
+  return upb_handlercache_new(printer_sethandlers,
+                              preserve_fieldnames ? &preserve : &camelcase);
+}
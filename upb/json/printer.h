@@ -59,6 +59,9 @@ upb_sink *upb_json_printer_input(upb_json_printer *p);
 const upb_handlers *upb_json_printer_newhandlers(const upb_msgdef *md,
                                                  bool preserve_fieldnames,
                                                  const void *owner);
+/* Returns a new cache of these handlers, for sharing them across printers.
+ * The caller must free it with upb_handlercache_free(). */
+upb_handlercache *upb_json_printer_newcache(bool preserve_fieldnames);
 
 UPB_END_EXTERN_C
 
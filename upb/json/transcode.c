@@ -0,0 +1,92 @@
+/*
+** upb::json::Transcoder
+**
+** The heavy lifting is done by the existing printer, parser, decoder and
+** encoder; this file only builds the two pipelines once and wires fresh
+** per-stream instances together on demand.  With the JIT the decoder calls
+** the printer's handlers directly, so the binary -> JSON path never
+** materializes a message.
+*/
+
+#include "upb/json/transcode.h"
+
+#include "upb/json/parser.h"
+#include "upb/json/printer.h"
+#include "upb/pb/decoder.h"
+#include "upb/pb/encoder.h"
+
+struct upb_json_transcoder {
+  const upb_msgdef *md;
+
+  /* Binary -> JSON. */
+  const upb_handlers *printer_h;
+  const upb_pbdecodermethod *decoder_m;
+
+  /* JSON -> binary. */
+  const upb_handlers *encoder_h;
+  const upb_json_parsermethod *parser_m;
+};
+
+upb_json_transcoder *upb_json_transcoder_new(const upb_msgdef *md,
+                                             bool preserve_fieldnames) {
+  upb_pbdecodermethodopts opts;
+  upb_json_transcoder *t = upb_gmalloc(sizeof(*t));
+  if (!t) return NULL;
+
+  t->md = md;
+  t->printer_h = upb_json_printer_newhandlers(md, preserve_fieldnames, t);
+  t->encoder_h = upb_pb_encoder_newhandlers(md, t);
+  t->decoder_m = NULL;
+  t->parser_m = upb_json_parsermethod_new(md, t);
+
+  if (t->printer_h) {
+    upb_pbdecodermethodopts_init(&opts, t->printer_h);
+    t->decoder_m = upb_pbdecodermethod_new(&opts, t);
+  }
+
+  if (!t->printer_h || !t->encoder_h || !t->decoder_m || !t->parser_m) {
+    upb_json_transcoder_free(t);
+    return NULL;
+  }
+
+  return t;
+}
+
+void upb_json_transcoder_free(upb_json_transcoder *t) {
+  if (!t) return;
+  if (t->decoder_m) upb_pbdecodermethod_unref(t->decoder_m, t);
+  if (t->parser_m) upb_json_parsermethod_unref(t->parser_m, t);
+  if (t->printer_h) upb_handlers_unref(t->printer_h, t);
+  if (t->encoder_h) upb_handlers_unref(t->encoder_h, t);
+  upb_gfree(t);
+}
+
+const upb_msgdef *upb_json_transcoder_msgdef(const upb_json_transcoder *t) {
+  return t->md;
+}
+
+upb_bytessink *upb_json_transcoder_pbinput(const upb_json_transcoder *t,
+                                           upb_env *env,
+                                           upb_bytessink *output) {
+  upb_json_printer *p;
+  upb_pbdecoder *d;
+
+  p = upb_json_printer_create(env, t->printer_h, output);
+  if (!p) return NULL;
+  d = upb_pbdecoder_create(env, t->decoder_m, upb_json_printer_input(p));
+  if (!d) return NULL;
+  return upb_pbdecoder_input(d);
+}
+
+upb_bytessink *upb_json_transcoder_jsoninput(const upb_json_transcoder *t,
+                                             upb_env *env,
+                                             upb_bytessink *output) {
+  upb_pb_encoder *e;
+  upb_json_parser *p;
+
+  e = upb_pb_encoder_create(env, t->encoder_h, output);
+  if (!e) return NULL;
+  p = upb_json_parser_create(env, t->parser_m, upb_pb_encoder_input(e));
+  if (!p) return NULL;
+  return upb_json_parser_input(p);
+}
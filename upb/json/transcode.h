@@ -0,0 +1,56 @@
+/*
+** upb::json::Transcoder (upb_json_transcoder)
+**
+** Converts between the protobuf binary format and JSON without building an
+** intermediate message.  The transcoder owns a pre-built pipeline for one
+** message type: pbdecoder -> JSON printer for binary input, and JSON parser
+** -> pb encoder for JSON input.  Building the handlers and compiling the
+** decoder method is the expensive part, so a transcoder should be created
+** once per type and reused for every message.
+**
+** A transcoder is immutable once created and may be shared between threads;
+** each conversion allocates its per-stream state from the given upb_env.
+*/
+
+#ifndef UPB_JSON_TRANSCODE_H_
+#define UPB_JSON_TRANSCODE_H_
+
+#include "upb/sink.h"
+
+#ifdef __cplusplus
+namespace upb {
+namespace json {
+class Transcoder;
+}  /* namespace json */
+}  /* namespace upb */
+#endif
+
+UPB_DECLARE_TYPE(upb::json::Transcoder, upb_json_transcoder)
+
+UPB_BEGIN_EXTERN_C
+
+/* Creates a transcoder for messages of type "md".  "preserve_fieldnames"
+ * selects the JSON field names exactly as for
+ * upb_json_printer_newhandlers().  Returns NULL on allocation failure. */
+upb_json_transcoder *upb_json_transcoder_new(const upb_msgdef *md,
+                                             bool preserve_fieldnames);
+void upb_json_transcoder_free(upb_json_transcoder *t);
+
+const upb_msgdef *upb_json_transcoder_msgdef(const upb_json_transcoder *t);
+
+/* Returns a sink that accepts protobuf binary data for one message and
+ * writes the equivalent JSON to "output".  All state is allocated from "env",
+ * and lives until the env is uninitialized. */
+upb_bytessink *upb_json_transcoder_pbinput(const upb_json_transcoder *t,
+                                           upb_env *env,
+                                           upb_bytessink *output);
+
+/* Returns a sink that accepts JSON text for one message and writes the
+ * equivalent protobuf binary data to "output". */
+upb_bytessink *upb_json_transcoder_jsoninput(const upb_json_transcoder *t,
+                                             upb_env *env,
+                                             upb_bytessink *output);
+
+UPB_END_EXTERN_C
+
+#endif  /* UPB_JSON_TRANSCODE_H_ */
@@ -27,9 +27,38 @@ void *upb_map_pack(const upb_map *map, void *p, size_t *ofs, size_t size);
 
 #define PTR_AT(msg, ofs, type) (type*)((char*)msg + ofs)
 #define VOIDPTR_AT(msg, ofs) PTR_AT(msg, ofs, void)
+/* If we always read/write as a consistent type to each address, this shouldn't
+ * violate aliasing.
+ */
+#define DEREF(msg, ofs, type) *PTR_AT(msg, ofs, type)
 #define ENCODE_MAX_NESTING 64
 #define CHECK_TRUE(x) if (!(x)) { return false; }
 
+/* Like upb_decode() and upb_encode(), msglayouts store the descriptor type of
+ * each field, which is finer-grained than the upb_fieldtype_t we need for
+ * sizing values. */
+static const uint8_t upb_desctype_to_fieldtype[] = {
+  0,                /* (unused) */
+  UPB_TYPE_DOUBLE,  /* DOUBLE */
+  UPB_TYPE_FLOAT,   /* FLOAT */
+  UPB_TYPE_INT64,   /* INT64 */
+  UPB_TYPE_UINT64,  /* UINT64 */
+  UPB_TYPE_INT32,   /* INT32 */
+  UPB_TYPE_UINT64,  /* FIXED64 */
+  UPB_TYPE_UINT32,  /* FIXED32 */
+  UPB_TYPE_BOOL,    /* BOOL */
+  UPB_TYPE_STRING,  /* STRING */
+  UPB_TYPE_MESSAGE, /* GROUP */
+  UPB_TYPE_MESSAGE, /* MESSAGE */
+  UPB_TYPE_BYTES,   /* BYTES */
+  UPB_TYPE_UINT32,  /* UINT32 */
+  UPB_TYPE_ENUM,    /* ENUM */
+  UPB_TYPE_INT32,   /* SFIXED32 */
+  UPB_TYPE_INT64,   /* SFIXED64 */
+  UPB_TYPE_INT32,   /* SINT32 */
+  UPB_TYPE_INT64,   /* SINT64 */
+};
+
 /** upb_msgval ****************************************************************/
 
 #define upb_alignof(t) offsetof(struct { char c; t x; }, x)
@@ -64,9 +93,9 @@ static size_t upb_msgval_sizeof(upb_fieldtype_t type) {
       return 4;
     case UPB_TYPE_BOOL:
       return 1;
-    case UPB_TYPE_BYTES:
     case UPB_TYPE_MESSAGE:
       return sizeof(void*);
+    case UPB_TYPE_BYTES:
     case UPB_TYPE_STRING:
       return sizeof(upb_stringview);
   }
@@ -77,34 +106,66 @@ static uint8_t upb_msg_fieldsize(const upb_msglayout_fieldinit_v1 *field) {
   if (field->label == UPB_LABEL_REPEATED) {
     return sizeof(void*);
   } else {
-    return upb_msgval_sizeof(field->type);
+    return upb_msgval_sizeof(upb_desctype_to_fieldtype[field->type]);
   }
 }
 
-static uint8_t upb_msg_fielddefsize(const upb_fielddef *f) {
-  if (upb_fielddef_isseq(f)) {
-    return sizeof(void*);
-  } else {
-    return upb_msgval_sizeof(upb_fielddef_type(f));
+/* Map values are stored in a upb_value of the table's ctype.  A string value's
+ * upb_stringview (a char* / size_t pair) is too big for a upb_value, so it is
+ * copied into a small allocation from the map's allocator and the table holds
+ * a pointer to that; upb_map_freeval() frees it when the entry goes away. */
+static bool upb_toval(upb_fieldtype_t type, upb_msgval val, upb_alloc *a,
+                      upb_value *out) {
+  switch (type) {
+    case UPB_TYPE_FLOAT: *out = upb_value_float(val.flt); return true;
+    case UPB_TYPE_DOUBLE: *out = upb_value_double(val.dbl); return true;
+    case UPB_TYPE_BOOL: *out = upb_value_bool(val.b); return true;
+    case UPB_TYPE_ENUM:
+    case UPB_TYPE_INT32: *out = upb_value_int32(val.i32); return true;
+    case UPB_TYPE_UINT32: *out = upb_value_uint32(val.u32); return true;
+    case UPB_TYPE_INT64: *out = upb_value_int64(val.i64); return true;
+    case UPB_TYPE_UINT64: *out = upb_value_uint64(val.u64); return true;
+    case UPB_TYPE_MESSAGE: *out = upb_value_constptr(val.msg); return true;
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES: {
+      upb_stringview *box = upb_malloc(a, sizeof(*box));
+      if (!box) return false;
+      *box = val.str;
+      *out = upb_value_constptr(box);
+      return true;
+    }
   }
+  UPB_UNREACHABLE();
 }
 
-/* TODO(haberman): this is broken right now because upb_msgval can contain
- * a char* / size_t pair, which is too big for a upb_value.  To fix this
- * we'll probably need to dynamically allocate a upb_msgval and store a
- * pointer to that in the tables for extensions/maps. */
-static upb_value upb_toval(upb_msgval val) {
-  upb_value ret;
-  UPB_UNUSED(val);
-  memset(&ret, 0, sizeof(upb_value));  /* XXX */
-  return ret;
+static upb_msgval upb_msgval_fromval(upb_fieldtype_t type, upb_value val) {
+  upb_msgval ret;
+  switch (type) {
+    case UPB_TYPE_FLOAT:
+      memcpy(&ret.flt, &val.val, sizeof(ret.flt));
+      return ret;
+    case UPB_TYPE_DOUBLE:
+      memcpy(&ret.dbl, &val.val, sizeof(ret.dbl));
+      return ret;
+    case UPB_TYPE_BOOL: return upb_msgval_bool(upb_value_getbool(val));
+    case UPB_TYPE_ENUM:
+    case UPB_TYPE_INT32: return upb_msgval_int32(upb_value_getint32(val));
+    case UPB_TYPE_UINT32: return upb_msgval_uint32(upb_value_getuint32(val));
+    case UPB_TYPE_INT64: return upb_msgval_int64(upb_value_getint64(val));
+    case UPB_TYPE_UINT64: return upb_msgval_uint64(upb_value_getuint64(val));
+    case UPB_TYPE_MESSAGE: return upb_msgval_msg(upb_value_getconstptr(val));
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      return upb_msgval_str(
+          *(const upb_stringview*)upb_value_getconstptr(val));
+  }
+  UPB_UNREACHABLE();
 }
 
-static upb_msgval upb_msgval_fromval(upb_value val) {
-  upb_msgval ret;
-  UPB_UNUSED(val);
-  memset(&ret, 0, sizeof(upb_msgval));  /* XXX */
-  return ret;
+static void upb_map_freeval(const upb_map *map, upb_value val) {
+  if (map->val_type == UPB_TYPE_STRING || map->val_type == UPB_TYPE_BYTES) {
+    upb_free(map->alloc, (void*)upb_value_getconstptr(val));
+  }
 }
 
 static upb_ctype_t upb_fieldtotabtype(upb_fieldtype_t type) {
@@ -162,20 +223,223 @@ struct upb_msglayout {
   struct upb_msglayout_msginit_v1 data;
 };
 
+static void upb_msglayout_freelookup(upb_msglayout_msginit_v1 *l,
+                                     upb_alloc *a) {
+  upb_free(a, (void*)l->field_lookup);
+  upb_free(a, (void*)l->hasbit_fields);
+  upb_free(a, (void*)l->check_fields);
+}
+
 static void upb_msglayout_free(upb_msglayout *l) {
+  upb_msglayout_freelookup(&l->data, &upb_alloc_global);
+  upb_gfree((void*)l->data.fields);
+  upb_gfree((void*)l->data.submsgs);
+  upb_gfree((void*)l->data.oneofs);
   upb_gfree(l->data.default_msg);
   upb_gfree(l);
 }
 
-static size_t upb_msglayout_place(upb_msglayout *l, size_t size) {
+/* Builds the presence map described in upb_msglayout_msginit_v1, if the
+ * message qualifies. */
+static bool upb_msglayout_buildpresence(upb_msglayout_msginit_v1 *l,
+                                        upb_alloc *a) {
+  uint32_t hasbit_bytes = 0;
+  size_t words = (l->field_count + 63) / 64;
+  uint16_t *hasbit_fields;
+  uint64_t *check_fields;
+  int i;
+
+  l->hasbit_fields = NULL;
+  l->check_fields = NULL;
+  l->hasbit_bytes = 0;
+
+  /* proto3 fields without a oneof have to be checked for a zero value
+   * anyway, even if they have a hasbit. */
+  if (!l->is_proto2 || l->field_count == 0 ||
+      l->field_count > UPB_PRESENCE_MAXFIELDS) {
+    return true;
+  }
+
+  for (i = 0; i < l->field_count; i++) {
+    if (l->fields[i].hasbit != UPB_NO_HASBIT) {
+      hasbit_bytes = UPB_MAX(hasbit_bytes, l->fields[i].hasbit / 8u + 1);
+    }
+  }
+
+  hasbit_fields = NULL;
+  if (hasbit_bytes > 0) {
+    hasbit_fields = upb_malloc(a, hasbit_bytes * 8 * sizeof(*hasbit_fields));
+  }
+  check_fields = upb_malloc(a, words * sizeof(*check_fields));
+
+  if ((hasbit_bytes > 0 && !hasbit_fields) || !check_fields) {
+    upb_free(a, hasbit_fields);
+    upb_free(a, check_fields);
+    return false;
+  }
+
+  for (i = 0; i < (int)hasbit_bytes * 8; i++) {
+    hasbit_fields[i] = UPB_NO_FIELD;
+  }
+
+  memset(check_fields, 0, words * sizeof(*check_fields));
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_fieldinit_v1 *f = &l->fields[i];
+    if (f->hasbit != UPB_NO_HASBIT) {
+      hasbit_fields[f->hasbit] = i;
+    } else {
+      check_fields[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+  }
+
+  l->hasbit_fields = hasbit_fields;
+  l->check_fields = check_fields;
+  l->hasbit_bytes = hasbit_bytes;
+  return true;
+}
+
+/* Builds the field number -> field index table used by the decoder.  The table
+ * covers field numbers up to the highest one, unless the numbers are so sparse
+ * that the table would be much larger than the field array itself; in that
+ * case only the low numbers get table entries and the rest are scanned. */
+static bool upb_msglayout_buildlookup(upb_msglayout_msginit_v1 *l,
+                                      upb_alloc *a) {
+  uint32_t max_number = 0;
+  uint32_t dense_below;
+  uint16_t *lookup;
+  int i;
+
+  for (i = 0; i < l->field_count; i++) {
+    max_number = UPB_MAX(max_number, l->fields[i].number);
+  }
+
+  dense_below = UPB_MIN(max_number + 1, (uint32_t)l->field_count * 4 + 64);
+  lookup = upb_malloc(a, dense_below * sizeof(*lookup));
+
+  if (!lookup) {
+    return false;
+  }
+
+  for (i = 0; i < (int)dense_below; i++) {
+    lookup[i] = UPB_NO_FIELD;
+  }
+
+  for (i = 0; i < l->field_count; i++) {
+    if (l->fields[i].number < dense_below) {
+      lookup[l->fields[i].number] = i;
+    }
+  }
+
+  l->field_lookup = lookup;
+  l->dense_below = dense_below;
+
+  if (!upb_msglayout_buildpresence(l, a)) {
+    upb_free(a, lookup);
+    l->field_lookup = NULL;
+    return false;
+  }
+
+  return true;
+}
+
+static size_t upb_msglayout_place(upb_msglayout_msginit_v1 *l, size_t size) {
   size_t ret;
 
-  l->data.size = align_up(l->data.size, size);
-  ret = l->data.size;
-  l->data.size += size;
+  /* Nothing needs more than 8-byte alignment; a upb_stringview is 16 bytes on
+   * 64-bit platforms, but only two 8-byte members. */
+  l->size = align_up(l->size, UPB_MIN(size, 8));
+  ret = l->size;
+  l->size += size;
   return ret;
 }
 
+/* The layout of a message depends only on its fields' numbers, types and
+ * labels, and which oneofs they belong to, so the same code serves layouts
+ * built from defs and from raw descriptors. */
+bool upb_msglayout_place_v1(upb_msglayout_msginit_v1 *l,
+                            upb_msglayout_fieldinit_v1 *fields,
+                            upb_msglayout_oneofinit_v1 *oneofs,
+                            upb_alloc *a) {
+  size_t hasbit = 0;
+  size_t size;
+  int i;
+
+  l->fields = fields;
+  l->oneofs = oneofs;
+
+  /* Allocate hasbits.  Only fields outside a oneof that track presence get
+   * one. */
+  for (i = 0; i < l->field_count; i++) {
+    upb_msglayout_fieldinit_v1 *field = &fields[i];
+    bool submsg = field->type == UPB_DESCRIPTOR_TYPE_MESSAGE ||
+                  field->type == UPB_DESCRIPTOR_TYPE_GROUP;
+    field->hasbit = UPB_NO_HASBIT;
+    if (field->label != UPB_LABEL_REPEATED &&
+        field->oneof_index == UPB_NOT_IN_ONEOF &&
+        (submsg || l->is_proto2)) {
+      field->hasbit = hasbit++;
+    }
+  }
+
+  /* Account for space used by hasbits. */
+  l->size = div_round_up(hasbit, 8);
+
+  /* Allocate everything else one size class at a time, smallest first, so
+   * the only padding is where one class gives way to the next (at most 3 + 4
+   * bytes) instead of potentially before every field.  The oneof cases open
+   * the 4-byte class, which keeps them next to the hasbits when there are no
+   * 1-byte fields in between.  A oneof's data is as big as its biggest
+   * member. */
+  for (size = 1; size <= sizeof(upb_stringview); size *= 2) {
+    int j;
+
+    if (size == sizeof(uint32_t)) {
+      for (j = 0; j < l->oneof_count; j++) {
+        oneofs[j].case_offset = upb_msglayout_place(l, sizeof(uint32_t));
+      }
+    }
+
+    for (i = 0; i < l->field_count; i++) {
+      /* Oneofs are handled separately below. */
+      if (fields[i].oneof_index == UPB_NOT_IN_ONEOF &&
+          upb_msg_fieldsize(&fields[i]) == size) {
+        fields[i].offset = upb_msglayout_place(l, size);
+      }
+    }
+
+    for (j = 0; j < l->oneof_count; j++) {
+      size_t field_size = 0;
+
+      for (i = 0; i < l->field_count; i++) {
+        if (fields[i].oneof_index == j) {
+          field_size = UPB_MAX(field_size, upb_msg_fieldsize(&fields[i]));
+        }
+      }
+
+      if (field_size != size) {
+        continue;
+      }
+
+      oneofs[j].data_offset = upb_msglayout_place(l, size);
+
+      /* upb_decode() and upb_encode() find a member's data from its own
+       * offset, as they do for generated layouts. */
+      for (i = 0; i < l->field_count; i++) {
+        if (fields[i].oneof_index == j) {
+          fields[i].offset = oneofs[j].data_offset;
+        }
+      }
+    }
+  }
+
+  /* Size of the entire structure should be a multiple of its greatest
+   * alignment.  TODO: track overall alignment for real? */
+  l->size = align_up(l->size, 8);
+
+  return upb_msglayout_buildlookup(l, a);
+}
+
 static uint32_t upb_msglayout_offset(const upb_msglayout *l,
                                      const upb_fielddef *f) {
   return l->data.fields[upb_fielddef_index(f)].offset;
@@ -210,10 +474,11 @@ static bool upb_msglayout_initdefault(upb_msglayout *l, const upb_msgdef *m) {
       if (!upb_fielddef_isstring(f) &&
           !upb_fielddef_issubmsg(f) &&
           !upb_fielddef_isseq(f)) {
-        upb_msg_set(l->data.default_msg,
-                    upb_fielddef_index(f),
-                    upb_msgval_fromdefault(f),
-                    l);
+        /* Written directly: upb_msg_set() would set the hasbit too. */
+        const upb_msglayout_fieldinit_v1 *field =
+            &l->data.fields[upb_fielddef_index(f)];
+        upb_msgval_write(l->data.default_msg, field->offset,
+                         upb_msgval_fromdefault(f), upb_msg_fieldsize(field));
       }
     }
   }
@@ -223,9 +488,7 @@ static bool upb_msglayout_initdefault(upb_msglayout *l, const upb_msgdef *m) {
 
 static upb_msglayout *upb_msglayout_new(const upb_msgdef *m) {
   upb_msg_field_iter it;
-  upb_msg_oneof_iter oit;
   upb_msglayout *l;
-  size_t hasbit;
   size_t submsg_count = 0;
   const upb_msglayout_msginit_v1 **submsgs;
   upb_msglayout_fieldinit_v1 *fields;
@@ -262,94 +525,67 @@ static upb_msglayout *upb_msglayout_new(const upb_msgdef *m) {
 
   l->data.field_count = upb_msgdef_numfields(m);
   l->data.oneof_count = upb_msgdef_numoneofs(m);
-  l->data.fields = fields;
   l->data.submsgs = submsgs;
-  l->data.oneofs = oneofs;
   l->data.is_proto2 = (upb_msgdef_syntax(m) == UPB_SYNTAX_PROTO2);
+  l->data.extendable = upb_msgdef_extendable(m);
 
-  /* Allocate data offsets in three stages:
-   *
-   * 1. hasbits.
-   * 2. regular fields.
-   * 3. oneof fields.
-   *
-   * OPT: There is a lot of room for optimization here to minimize the size.
-   */
-
-  /* Allocate hasbits and set basic field attributes. */
-  for (upb_msg_field_begin(&it, m), hasbit = 0;
+  /* Set basic field attributes. */
+  submsg_count = 0;
+  for (upb_msg_field_begin(&it, m);
        !upb_msg_field_done(&it);
        upb_msg_field_next(&it)) {
     const upb_fielddef* f = upb_msg_iter_field(&it);
     upb_msglayout_fieldinit_v1 *field = &fields[upb_fielddef_index(f)];
 
     field->number = upb_fielddef_number(f);
-    field->type = upb_fielddef_type(f);
+    field->type = upb_fielddef_descriptortype(f);
     field->label = upb_fielddef_label(f);
 
+    /* The submessage's layout itself is filled in by the msgfactory, which
+     * can resolve (possibly recursive) references between layouts. */
+    if (upb_fielddef_issubmsg(f)) {
+      field->submsg_index = submsg_count++;
+    } else {
+      field->submsg_index = UPB_NO_SUBMSG;
+    }
+
     if (upb_fielddef_containingoneof(f)) {
       field->oneof_index = upb_oneofdef_index(upb_fielddef_containingoneof(f));
     } else {
       field->oneof_index = UPB_NOT_IN_ONEOF;
     }
-
-    if (upb_fielddef_haspresence(f) && !upb_fielddef_containingoneof(f)) {
-      field->hasbit = hasbit++;
-    }
   }
 
-  /* Account for space used by hasbits. */
-  l->data.size = div_round_up(hasbit, 8);
-
-  /* Allocate non-oneof fields. */
-  for (upb_msg_field_begin(&it, m); !upb_msg_field_done(&it);
-       upb_msg_field_next(&it)) {
-    const upb_fielddef* f = upb_msg_iter_field(&it);
-    size_t field_size = upb_msg_fielddefsize(f);
-    size_t index = upb_fielddef_index(f);
-
-    if (upb_fielddef_containingoneof(f)) {
-      /* Oneofs are handled separately below. */
-      continue;
-    }
-
-    fields[index].offset = upb_msglayout_place(l, field_size);
+  if (upb_msglayout_place_v1(&l->data, fields, oneofs, &upb_alloc_global) &&
+      upb_msglayout_initdefault(l, m)) {
+    return l;
+  } else {
+    upb_msglayout_free(l);
+    return NULL;
   }
+}
 
-  /* Allocate oneof fields.  Each oneof field consists of a uint32 for the case
-   * and space for the actual data. */
-  for (upb_msg_oneof_begin(&oit, m); !upb_msg_oneof_done(&oit);
-       upb_msg_oneof_next(&oit)) {
-    const upb_oneofdef* o = upb_msg_iter_oneof(&oit);
-    upb_oneof_iter fit;
-
-    size_t case_size = sizeof(uint32_t);  /* Could potentially optimize this. */
-    upb_msglayout_oneofinit_v1 *oneof = &oneofs[upb_oneofdef_index(o)];
-    size_t field_size = 0;
-
-    /* Calculate field size: the max of all field sizes. */
-    for (upb_oneof_begin(&fit, o);
-         !upb_oneof_done(&fit);
-         upb_oneof_next(&fit)) {
-      const upb_fielddef* f = upb_oneof_iter_field(&fit);
-      field_size = UPB_MAX(field_size, upb_msg_fielddefsize(f));
-    }
+upb_msglayout *upb_msglayout_frominit_v1(
+    const upb_msglayout_msginit_v1 *init, upb_alloc *a) {
+  upb_msglayout *l = upb_malloc(a, sizeof(*l));
 
-    /* Align and allocate case offset. */
-    oneof->case_offset = upb_msglayout_place(l, case_size);
-    oneof->data_offset = upb_msglayout_place(l, field_size);
+  if (!l) {
+    return NULL;
   }
 
-  /* Size of the entire structure should be a multiple of its greatest
-   * alignment.  TODO: track overall alignment for real? */
-  l->data.size = align_up(l->data.size, 8);
+  l->data = *init;
 
-  if (upb_msglayout_initdefault(l, m)) {
-    return l;
-  } else {
-    upb_msglayout_free(l);
+  if (!upb_msglayout_buildlookup(&l->data, a)) {
+    upb_free(a, l);
     return NULL;
   }
+
+  return l;
+}
+
+void upb_msglayout_uninit_v1(upb_msglayout *l, upb_alloc *a) {
+  upb_msglayout_freelookup(&l->data, a);
+  upb_free(a, l);
 }
 
 
@@ -359,14 +595,23 @@ struct upb_msgfactory {
   const upb_symtab *symtab;  /* We own a ref. */
   upb_inttable layouts;
   upb_inttable mergehandlers;
+  upb_inttable visitorplans;
+  /* Once frozen, every object is cached and the tables are only read. */
+  bool frozen;
 };
 
+static void upb_visitorplan_free(upb_visitorplan *vp);
+static const upb_visitorplan *upb_msgfactory_getplan(upb_msgfactory *f,
+                                                     const upb_msgdef *m);
+
 upb_msgfactory *upb_msgfactory_new(const upb_symtab *symtab) {
   upb_msgfactory *ret = upb_gmalloc(sizeof(*ret));
 
   ret->symtab = symtab;
   upb_inttable_init(&ret->layouts, UPB_CTYPE_PTR);
   upb_inttable_init(&ret->mergehandlers, UPB_CTYPE_CONSTPTR);
+  upb_inttable_init(&ret->visitorplans, UPB_CTYPE_PTR);
+  ret->frozen = false;
 
   return ret;
 }
@@ -385,8 +630,14 @@ void upb_msgfactory_free(upb_msgfactory *f) {
     upb_handlers_unref(h, f);
   }
 
+  upb_inttable_begin(&i, &f->visitorplans);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_visitorplan_free(upb_value_getptr(upb_inttable_iter_value(&i)));
+  }
+
   upb_inttable_uninit(&f->layouts);
   upb_inttable_uninit(&f->mergehandlers);
+  upb_inttable_uninit(&f->visitorplans);
   upb_gfree(f);
 }
 
@@ -394,6 +645,44 @@ const upb_symtab *upb_msgfactory_symtab(const upb_msgfactory *f) {
   return f->symtab;
 }
 
+bool upb_msgfactory_freeze(upb_msgfactory *f) {
+  upb_symtab_iter i;
+
+  if (f->frozen) {
+    return true;
+  }
+
+  for (upb_symtab_begin(&i, f->symtab, UPB_DEF_MSG);
+       !upb_symtab_done(&i);
+       upb_symtab_next(&i)) {
+    const upb_msgdef *m = upb_dyncast_msgdef(upb_symtab_iter_def(&i));
+    const upb_handlers *h;
+
+    if (upb_msgdef_mapentry(m)) {
+      continue;
+    }
+
+    upb_msgfactory_getlayout(f, m);
+    h = upb_msgfactory_getmergehandlers(f, m);
+    if (!h) {
+      return false;
+    }
+    upb_msgfactory_getvisitorplan(f, h);
+  }
+
+  /* Nothing will be inserted from now on, so we can make the lookups as fast
+   * as possible. */
+  upb_inttable_compact(&f->layouts);
+  upb_inttable_compact(&f->mergehandlers);
+  upb_inttable_compact(&f->visitorplans);
+  f->frozen = true;
+  return true;
+}
+
+bool upb_msgfactory_isfrozen(const upb_msgfactory *f) {
+  return f->frozen;
+}
+
 const upb_msglayout *upb_msgfactory_getlayout(upb_msgfactory *f,
                                               const upb_msgdef *m) {
   upb_value v;
@@ -405,9 +694,34 @@ const upb_msglayout *upb_msgfactory_getlayout(upb_msgfactory *f,
     return upb_value_getptr(v);
   } else {
     upb_msgfactory *mutable_f = (void*)f;
-    upb_msglayout *l = upb_msglayout_new(m);
-    upb_inttable_insertptr(&mutable_f->layouts, m, upb_value_ptr(l));
+    upb_msglayout *l;
+    upb_msg_field_iter i;
+
+    UPB_ASSERT(!f->frozen);
+    l = upb_msglayout_new(m);
     UPB_ASSERT(l);
+
+    /* Insert before linking submessages, so cycles find this layout. */
+    upb_inttable_insertptr(&mutable_f->layouts, m, upb_value_ptr(l));
+
+    for (upb_msg_field_begin(&i, m);
+         !upb_msg_field_done(&i);
+         upb_msg_field_next(&i)) {
+      const upb_fielddef *field = upb_msg_iter_field(&i);
+      const upb_msgdef *subm = upb_fielddef_msgsubdef(field);
+      const upb_msglayout_msginit_v1 **submsgs =
+          (const upb_msglayout_msginit_v1**)l->data.submsgs;
+
+      /* Map entries have no layout of their own yet, so a map field's
+       * submsg is NULL, and the field holds a upb_map*. */
+      if (subm) {
+        int index = l->data.fields[upb_fielddef_index(field)].submsg_index;
+        submsgs[index] = upb_msgdef_mapentry(subm)
+                             ? NULL
+                             : &upb_msgfactory_getlayout(f, subm)->data;
+      }
+    }
+
     return l;
   }
 }
@@ -453,6 +767,56 @@ size_t upb_msg_str(void *msg, const void *hd, const char *ptr, size_t size,
   return size;
 }
 
+typedef struct {
+  const upb_msglayout *layout;
+  int field_index;
+} upb_msg_submsghandlerdata;
+
+/* Merges into the submessage that is already there, if any, like the wire
+ * format does when a submessage appears more than once. */
+static void *upb_msg_startsubmsg(void *msg, const void *hd) {
+  const upb_msg_submsghandlerdata *d = hd;
+  const upb_msglayout_msginit_v1 *l = &d->layout->data;
+  const upb_msglayout_fieldinit_v1 *field = &l->fields[d->field_index];
+  upb_msg *sub = NULL;
+
+  /* A oneof's data is only the submessage if the case says so. */
+  if (field->oneof_index == UPB_NOT_IN_ONEOF ||
+      DEREF(msg, l->oneofs[field->oneof_index].case_offset, uint32_t) ==
+          field->number) {
+    sub = (upb_msg*)upb_msgval_getmsg(
+        upb_msg_get(msg, d->field_index, d->layout));
+  }
+
+  if (!sub) {
+    sub = upb_msg_new((const upb_msglayout*)l->submsgs[field->submsg_index],
+                      upb_msg_alloc(msg));
+    if (!sub) {
+      return UPB_BREAK;
+    }
+    upb_msg_set(msg, d->field_index, upb_msgval_msg(sub), d->layout);
+  }
+
+  return sub;
+}
+
+static bool upb_msg_setsubmsghandler(upb_handlers *h, const upb_fielddef *f,
+                                     const upb_msglayout *layout) {
+  upb_handlerattr attr = UPB_HANDLERATTR_INITIALIZER;
+  bool ok;
+
+  upb_msg_submsghandlerdata *d = upb_gmalloc(sizeof(*d));
+  if (!d) return false;
+  d->layout = layout;
+  d->field_index = upb_fielddef_index(f);
+
+  upb_handlerattr_sethandlerdata(&attr, d);
+  upb_handlers_addcleanup(h, d, upb_gfree);
+  ok = upb_handlers_setstartsubmsg(h, f, upb_msg_startsubmsg, &attr);
+  upb_handlerattr_uninit(&attr);
+  return ok;
+}
+
 static void callback(const void *closure, upb_handlers *h) {
   upb_msgfactory *factory = (upb_msgfactory*)closure;
   const upb_msgdef *md = upb_handlers_msgdef(h);
@@ -469,39 +833,93 @@ static void callback(const void *closure, upb_handlers *h) {
     upb_handlerattr_sethandlerdata(&attr, (void*)offset);
 
     if (upb_fielddef_isseq(f)) {
+    } else if (upb_fielddef_issubmsg(f)) {
+      upb_msg_setsubmsghandler(h, f, layout);
     } else if (upb_fielddef_isstring(f)) {
       upb_handlers_setstartstr(h, f, upb_msg_startstr, &attr);
       upb_handlers_setstring(h, f, upb_msg_str, &attr);
     } else {
+      uint32_t hasbit = upb_msglayout_hasbit(layout, f);
       upb_msg_setscalarhandler(
-          h, f, offset, upb_msglayout_hasbit(layout, f));
+          h, f, offset, hasbit == UPB_NO_HASBIT ? -1 : (int32_t)hasbit);
     }
   }
 }
 
 const upb_handlers *upb_msgfactory_getmergehandlers(upb_msgfactory *f,
                                                     const upb_msgdef *m) {
-  upb_msgfactory *mutable_f = (void*)f;
+  upb_value v;
+  const upb_handlers *ret;
+
+  if (upb_inttable_lookupptr(&f->mergehandlers, m, &v)) {
+    return upb_value_getconstptr(v);
+  }
 
-  /* TODO(haberman): properly cache these. */
-  const upb_handlers *ret = upb_handlers_newfrozen(m, f, callback, f);
-  upb_inttable_push(&mutable_f->mergehandlers, upb_value_constptr(ret));
+  UPB_ASSERT(!f->frozen);
+  ret = upb_handlers_newfrozen(m, f, callback, f);
+  if (ret) {
+    upb_inttable_insertptr(&f->mergehandlers, m, upb_value_constptr(ret));
+  }
 
   return ret;
 }
 
 const upb_visitorplan *upb_msgfactory_getvisitorplan(upb_msgfactory *f,
                                                      const upb_handlers *h) {
-  const upb_msgdef *md = upb_handlers_msgdef(h);
-  return (const upb_visitorplan*)upb_msgfactory_getlayout(f, md);
+  return upb_msgfactory_getplan(f, upb_handlers_msgdef(h));
 }
 
 
 /** upb_visitor ***************************************************************/
 
-struct upb_visitor {
+/* A visitorplan has everything the visitor needs to know about a message type,
+ * so visiting is a loop over the fields present: no defs, handlers or layout
+ * lookups.  Plans only depend on the msgdef (selectors are the same for all
+ * handlers of a msgdef), so the msgfactory keeps one per msgdef. */
+
+typedef enum {
+  UPB_VISIT_SINGULAR,
+  UPB_VISIT_ARRAY,
+  UPB_VISIT_MAP
+} upb_visitkind;
+
+/* How to put a single value: a field, an element of a repeated field, or the
+ * key or value of a map entry. */
+typedef struct {
+  const upb_visitorplan *sub;  /* For submessages, including map entries. */
+  uint8_t type;                /* upb_fieldtype_t. */
+  /* Scalars: the put selector.  Strings: STARTSTR, STRING and ENDSTR.
+   * Submessages: STARTSUBMSG and ENDSUBMSG. */
+  upb_selector_t sel;
+  upb_selector_t sel2;
+  upb_selector_t sel3;
+} upb_visitval;
+
+typedef struct {
+  upb_visitval val;
+  uint32_t offset;
+  uint32_t case_offset;  /* For oneof members. */
+  uint32_t number;
+  uint16_t hasbit;       /* UPB_NO_HASBIT if none. */
+  uint16_t index;        /* For upb_msg_get(). */
+  uint8_t kind;          /* upb_visitkind. */
+  bool in_oneof;
+  upb_selector_t startseq;
+  upb_selector_t endseq;
+} upb_visitfield;
+
+struct upb_visitorplan {
+  /* NULL for map entries, which only come as key and value. */
   const upb_msglayout *layout;
+  upb_visitfield *fields;  /* By field index, like the layout's fields. */
+  int field_count;
+};
+
+struct upb_visitor {
+  const upb_visitorplan *plan;
   upb_sink *sink;
+  upb_env *env;  /* For sorting map entries. */
+  bool deterministic;
 };
 
 static upb_selector_t getsel2(const upb_fielddef *f, upb_handlertype_t type) {
@@ -511,287 +929,2249 @@ static upb_selector_t getsel2(const upb_fielddef *f, upb_handlertype_t type) {
   return ret;
 }
 
-static bool upb_visitor_hasfield(const upb_msg *msg, const upb_fielddef *f,
-                                 const upb_msglayout *layout) {
-  int field_index = upb_fielddef_index(f);
-  if (upb_fielddef_isseq(f)) {
-    return upb_msgval_getarr(upb_msg_get(msg, field_index, layout)) != NULL;
-  } else if (upb_msgdef_syntax(upb_fielddef_containingtype(f)) ==
-             UPB_SYNTAX_PROTO2) {
-    return upb_msg_has(msg, field_index, layout);
-  } else {
-    upb_msgval val = upb_msg_get(msg, field_index, layout);
-    switch (upb_fielddef_type(f)) {
-      case UPB_TYPE_FLOAT:
-        return upb_msgval_getfloat(val) != 0;
-      case UPB_TYPE_DOUBLE:
-        return upb_msgval_getdouble(val) != 0;
-      case UPB_TYPE_BOOL:
-        return upb_msgval_getbool(val);
-      case UPB_TYPE_ENUM:
-      case UPB_TYPE_INT32:
-        return upb_msgval_getint32(val) != 0;
-      case UPB_TYPE_UINT32:
-        return upb_msgval_getuint32(val) != 0;
-      case UPB_TYPE_INT64:
-        return upb_msgval_getint64(val) != 0;
-      case UPB_TYPE_UINT64:
-        return upb_msgval_getuint64(val) != 0;
-      case UPB_TYPE_STRING:
-      case UPB_TYPE_BYTES:
-        return upb_msgval_getstr(val).size > 0;
-      case UPB_TYPE_MESSAGE:
-        return upb_msgval_getmsg(val) != NULL;
-    }
-    UPB_UNREACHABLE();
+static void upb_visitorplan_free(upb_visitorplan *vp) {
+  upb_gfree(vp->fields);
+  upb_gfree(vp);
+}
+
+static void upb_visitval_init(upb_visitval *v, upb_msgfactory *factory,
+                              const upb_fielddef *f) {
+  v->type = upb_fielddef_type(f);
+  v->sub = NULL;
+
+  switch (v->type) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      v->sel = getsel2(f, UPB_HANDLER_STARTSTR);
+      v->sel2 = getsel2(f, UPB_HANDLER_STRING);
+      v->sel3 = getsel2(f, UPB_HANDLER_ENDSTR);
+      break;
+    case UPB_TYPE_MESSAGE:
+      v->sel = getsel2(f, UPB_HANDLER_STARTSUBMSG);
+      v->sel2 = getsel2(f, UPB_HANDLER_ENDSUBMSG);
+      v->sub = upb_msgfactory_getplan(factory, upb_fielddef_msgsubdef(f));
+      break;
+    default:
+      v->sel = getsel2(f, upb_handlers_getprimitivehandlertype(f));
+      break;
   }
 }
 
-static bool upb_visitor_visitmsg2(const upb_msg *msg,
-                                  const upb_msglayout *layout, upb_sink *sink,
-                                  int depth) {
-  const upb_msgdef *md = upb_handlers_msgdef(sink->handlers);
-  upb_msg_field_iter i;
-  upb_status status;
+/* Plans for map entries only have the key and the value, as fields 0 and 1. */
+static bool upb_visitorplan_initentry(upb_visitorplan *vp,
+                                      upb_msgfactory *factory,
+                                      const upb_msgdef *m) {
+  vp->fields = upb_gmalloc(2 * sizeof(*vp->fields));
+  CHECK_TRUE(vp->fields);
+  vp->field_count = 2;
+  upb_visitval_init(&vp->fields[0].val, factory,
+                    upb_msgdef_itof(m, UPB_MAPENTRY_KEY));
+  upb_visitval_init(&vp->fields[1].val, factory,
+                    upb_msgdef_itof(m, UPB_MAPENTRY_VALUE));
+  return true;
+}
 
-  upb_sink_startmsg(sink);
+static bool upb_visitorplan_init(upb_visitorplan *vp, upb_msgfactory *factory,
+                                 const upb_msgdef *m) {
+  const upb_msglayout *l = upb_msgfactory_getlayout(factory, m);
+  upb_msg_field_iter i;
 
-  /* Protect against cycles (possible because users may freely reassign message
-   * and repeated fields) by imposing a maximum recursion depth. */
-  if (depth > ENCODE_MAX_NESTING) {
-    return false;
-  }
+  vp->layout = l;
+  vp->field_count = upb_msgdef_numfields(m);
+  vp->fields = upb_gmalloc(vp->field_count * sizeof(*vp->fields));
+  CHECK_TRUE(vp->fields || vp->field_count == 0);
 
-  for (upb_msg_field_begin(&i, md);
+  for (upb_msg_field_begin(&i, m);
        !upb_msg_field_done(&i);
        upb_msg_field_next(&i)) {
-    upb_fielddef *f = upb_msg_iter_field(&i);
-    upb_msgval val;
-
-    if (!upb_visitor_hasfield(msg, f, layout)) {
-      continue;
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    const upb_msglayout_fieldinit_v1 *init =
+        &l->data.fields[upb_fielddef_index(f)];
+    upb_visitfield *field = &vp->fields[upb_fielddef_index(f)];
+
+    upb_visitval_init(&field->val, factory, f);
+    field->number = init->number;
+    /* Like upb_encode(), we check proto3 fields for a zero value instead. */
+    field->hasbit = l->data.is_proto2 ? init->hasbit : UPB_NO_HASBIT;
+    field->index = upb_fielddef_index(f);
+    field->in_oneof = init->oneof_index != UPB_NOT_IN_ONEOF;
+
+    if (field->in_oneof) {
+      const upb_msglayout_oneofinit_v1 *o = &l->data.oneofs[init->oneof_index];
+      field->offset = o->data_offset;
+      field->case_offset = o->case_offset;
+    } else {
+      field->offset = init->offset;
+      field->case_offset = 0;
     }
 
-    val = upb_msg_get(msg, upb_fielddef_index(f), layout);
-
     if (upb_fielddef_isseq(f)) {
-      const upb_array *arr = upb_msgval_getarr(val);
-      UPB_ASSERT(arr);
-      /* TODO: putary(ary, f, sink, depth);*/
-    } else if (upb_fielddef_issubmsg(f)) {
-      const upb_map *map = upb_msgval_getmap(val);
-      UPB_ASSERT(map);
-      /* TODO: putmap(map, f, sink, depth);*/
-    } else if (upb_fielddef_isstring(f)) {
-      /* TODO putstr(); */
+      field->kind = upb_fielddef_ismap(f) ? UPB_VISIT_MAP : UPB_VISIT_ARRAY;
+      field->startseq = getsel2(f, UPB_HANDLER_STARTSEQ);
+      field->endseq = getsel2(f, UPB_HANDLER_ENDSEQ);
     } else {
-      upb_selector_t sel = getsel2(f, upb_handlers_getprimitivehandlertype(f));
-      UPB_ASSERT(upb_fielddef_isprimitive(f));
-
-      switch (upb_fielddef_type(f)) {
-        case UPB_TYPE_FLOAT:
-          CHECK_TRUE(upb_sink_putfloat(sink, sel, upb_msgval_getfloat(val)));
-          break;
-        case UPB_TYPE_DOUBLE:
-          CHECK_TRUE(upb_sink_putdouble(sink, sel, upb_msgval_getdouble(val)));
-          break;
-        case UPB_TYPE_BOOL:
-          CHECK_TRUE(upb_sink_putbool(sink, sel, upb_msgval_getbool(val)));
-          break;
-        case UPB_TYPE_ENUM:
-        case UPB_TYPE_INT32:
-          CHECK_TRUE(upb_sink_putint32(sink, sel, upb_msgval_getint32(val)));
-          break;
-        case UPB_TYPE_UINT32:
-          CHECK_TRUE(upb_sink_putuint32(sink, sel, upb_msgval_getuint32(val)));
-          break;
-        case UPB_TYPE_INT64:
-          CHECK_TRUE(upb_sink_putint64(sink, sel, upb_msgval_getint64(val)));
-          break;
-        case UPB_TYPE_UINT64:
-          CHECK_TRUE(upb_sink_putuint64(sink, sel, upb_msgval_getuint64(val)));
-          break;
-        case UPB_TYPE_STRING:
-        case UPB_TYPE_BYTES:
-        case UPB_TYPE_MESSAGE:
-          UPB_UNREACHABLE();
-      }
+      field->kind = UPB_VISIT_SINGULAR;
     }
   }
 
-  upb_sink_endmsg(sink, &status);
   return true;
 }
 
-upb_visitor *upb_visitor_create(upb_env *e, const upb_visitorplan *vp,
-                                upb_sink *output) {
-  upb_visitor *visitor = upb_env_malloc(e, sizeof(*visitor));
-  visitor->layout = (const upb_msglayout*)vp;
-  visitor->sink = output;
-  return visitor;
-}
+static const upb_visitorplan *upb_msgfactory_getplan(upb_msgfactory *f,
+                                                     const upb_msgdef *m) {
+  upb_value v;
+  upb_visitorplan *vp;
+  bool ok;
 
-bool upb_visitor_visitmsg(upb_visitor *visitor, const upb_msg *msg) {
-  return upb_visitor_visitmsg2(msg, visitor->layout, visitor->sink, 0);
-}
+  if (upb_inttable_lookupptr(&f->visitorplans, m, &v)) {
+    return upb_value_getptr(v);
+  }
 
+  UPB_ASSERT(!f->frozen);
+  vp = upb_gmalloc(sizeof(*vp));
+  UPB_ASSERT(vp);
+  vp->layout = NULL;
+  vp->fields = NULL;
+  vp->field_count = 0;
 
-/** upb_msg *******************************************************************/
+  /* Insert before filling in submessages, so cycles find this plan. */
+  upb_inttable_insertptr(&f->visitorplans, m, upb_value_ptr(vp));
 
-/* If we always read/write as a consistent type to each address, this shouldn't
- * violate aliasing.
- */
-#define DEREF(msg, ofs, type) *PTR_AT(msg, ofs, type)
+  if (upb_msgdef_mapentry(m)) {
+    ok = upb_visitorplan_initentry(vp, f, m);
+  } else {
+    ok = upb_visitorplan_init(vp, f, m);
+  }
 
-/* Internal members of a upb_msg.  We can change this without breaking binary
+  UPB_ASSERT(ok);
+  UPB_UNUSED(ok);
+  return vp;
+}
+
+static bool upb_visitor_hasfield(const upb_msg *msg, const upb_visitfield *f) {
+  if (f->in_oneof) {
+    return DEREF(msg, f->case_offset, uint32_t) == f->number;
+  } else if (f->hasbit != UPB_NO_HASBIT) {
+    return DEREF(msg, f->hasbit / 8, char) & (1 << (f->hasbit % 8));
+  } else if (f->kind == UPB_VISIT_ARRAY) {
+    const upb_array *arr = DEREF(msg, f->offset, const upb_array*);
+    return arr && arr->len > 0;
+  } else if (f->kind == UPB_VISIT_MAP) {
+    const upb_map *map = DEREF(msg, f->offset, const upb_map*);
+    return map && upb_map_size(map) > 0;
+  } else {
+    /* proto3 scalars are present when they aren't zero. */
+    switch (f->val.type) {
+      case UPB_TYPE_FLOAT:
+        return DEREF(msg, f->offset, float) != 0;
+      case UPB_TYPE_DOUBLE:
+        return DEREF(msg, f->offset, double) != 0;
+      case UPB_TYPE_BOOL:
+        return DEREF(msg, f->offset, bool);
+      case UPB_TYPE_ENUM:
+      case UPB_TYPE_INT32:
+      case UPB_TYPE_UINT32:
+        return DEREF(msg, f->offset, uint32_t) != 0;
+      case UPB_TYPE_INT64:
+      case UPB_TYPE_UINT64:
+        return DEREF(msg, f->offset, uint64_t) != 0;
+      case UPB_TYPE_STRING:
+      case UPB_TYPE_BYTES:
+        return (DEREF(msg, f->offset, upb_stringview)).size > 0;
+      case UPB_TYPE_MESSAGE:
+        return DEREF(msg, f->offset, const upb_msg*) != NULL;
+    }
+    UPB_UNREACHABLE();
+  }
+}
+
+static bool upb_visitor_visitmsg2(const upb_visitor *visitor,
+                                  const upb_msg *msg,
+                                  const upb_visitorplan *vp, upb_sink *sink,
+                                  int depth);
+
+static bool upb_visitor_putval(const upb_visitor *visitor,
+                               const upb_visitval *v, upb_msgval val,
+                               upb_sink *sink, int depth) {
+  upb_sink sub;
+
+  switch (v->type) {
+    case UPB_TYPE_FLOAT:
+      return upb_sink_putfloat(sink, v->sel, upb_msgval_getfloat(val));
+    case UPB_TYPE_DOUBLE:
+      return upb_sink_putdouble(sink, v->sel, upb_msgval_getdouble(val));
+    case UPB_TYPE_BOOL:
+      return upb_sink_putbool(sink, v->sel, upb_msgval_getbool(val));
+    case UPB_TYPE_ENUM:
+    case UPB_TYPE_INT32:
+      return upb_sink_putint32(sink, v->sel, upb_msgval_getint32(val));
+    case UPB_TYPE_UINT32:
+      return upb_sink_putuint32(sink, v->sel, upb_msgval_getuint32(val));
+    case UPB_TYPE_INT64:
+      return upb_sink_putint64(sink, v->sel, upb_msgval_getint64(val));
+    case UPB_TYPE_UINT64:
+      return upb_sink_putuint64(sink, v->sel, upb_msgval_getuint64(val));
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES: {
+      upb_stringview str = upb_msgval_getstr(val);
+      CHECK_TRUE(upb_sink_startstr(sink, v->sel, str.size, &sub));
+      CHECK_TRUE(upb_sink_putstring(&sub, v->sel2, str.data, str.size, NULL) ==
+                 str.size);
+      return upb_sink_endstr(sink, v->sel3);
+    }
+    case UPB_TYPE_MESSAGE:
+      CHECK_TRUE(upb_msgval_getmsg(val));
+      CHECK_TRUE(upb_sink_startsubmsg(sink, v->sel, &sub));
+      CHECK_TRUE(upb_visitor_visitmsg2(visitor, upb_msgval_getmsg(val), v->sub,
+                                       &sub, depth + 1));
+      return upb_sink_endsubmsg(sink, v->sel2);
+  }
+  UPB_UNREACHABLE();
+}
+
+static bool upb_visitor_putarray(const upb_visitor *visitor,
+                                 const upb_visitfield *f, const upb_array *arr,
+                                 upb_sink *sink, int depth) {
+  upb_sink seq;
+  size_t i;
+
+  CHECK_TRUE(upb_sink_startseq(sink, f->startseq, &seq));
+
+  for (i = 0; i < arr->len; i++) {
+    upb_msgval val = upb_msgval_read(arr->data, i * arr->element_size,
+                                     arr->element_size);
+    CHECK_TRUE(upb_visitor_putval(visitor, &f->val, val, &seq, depth));
+  }
+
+  return upb_sink_endseq(sink, f->endseq);
+}
+
+/* Map entries are sorted by a key that orders like the map key when compared
+ * as an unsigned integer (integer keys) or by their bytes (string keys). */
+typedef struct {
+  uint64_t sortkey;
+  upb_msgval key;
+  upb_msgval val;
+} upb_sortedentry;
+
+/* Below this many entries, insertion sort beats another radix pass. */
+#define UPB_MAPSORT_SMALL 16
+
+static uint64_t upb_map_sortkey(upb_fieldtype_t type, upb_msgval key) {
+  switch (type) {
+    case UPB_TYPE_BOOL:
+      return upb_msgval_getbool(key);
+    case UPB_TYPE_INT32:
+      return (uint32_t)upb_msgval_getint32(key) ^ 0x80000000U;
+    case UPB_TYPE_UINT32:
+      return upb_msgval_getuint32(key);
+    case UPB_TYPE_INT64:
+      return (uint64_t)upb_msgval_getint64(key) ^ 0x8000000000000000U;
+    case UPB_TYPE_UINT64:
+      return upb_msgval_getuint64(key);
+    default:
+      return 0;  /* Strings are sorted by their bytes. */
+  }
+}
+
+/* LSD radix sort of the |n| entries of |a| on the low |bytes| bytes of their
+ * sort keys, one byte per pass, ping-ponging with |tmp|.  Passes over a byte
+ * that all the keys share are skipped, so small keys cost fewer passes.
+ * Returns whichever of |a| and |tmp| ends up sorted. */
+static upb_sortedentry *upb_mapsort_ints(upb_sortedentry *a,
+                                         upb_sortedentry *tmp, size_t n,
+                                         size_t bytes) {
+  size_t shift;
+
+  for (shift = 0; shift < bytes * 8; shift += 8) {
+    size_t count[256];
+    size_t i;
+    size_t sum = 0;
+    upb_sortedentry *swap;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++) {
+      count[(a[i].sortkey >> shift) & 0xff]++;
+    }
+    if (count[(a[0].sortkey >> shift) & 0xff] == n) {
+      continue;
+    }
+
+    for (i = 0; i < 256; i++) {
+      size_t c = count[i];
+      count[i] = sum;
+      sum += c;
+    }
+    for (i = 0; i < n; i++) {
+      tmp[count[(a[i].sortkey >> shift) & 0xff]++] = a[i];
+    }
+
+    swap = a;
+    a = tmp;
+    tmp = swap;
+  }
+
+  return a;
+}
+
+/* Compares string keys that are known to be equal before |depth|. */
+static int upb_mapsort_strcmp(const upb_sortedentry *a,
+                              const upb_sortedentry *b, size_t depth) {
+  size_t len = UPB_MIN(a->key.str.size, b->key.str.size) - depth;
+  int cmp = len ? memcmp(a->key.str.data + depth, b->key.str.data + depth, len)
+                : 0;
+  if (cmp != 0) return cmp;
+  return a->key.str.size < b->key.str.size ? -1 :
+         a->key.str.size > b->key.str.size;
+}
+
+/* MSD radix sort of the |n| entries of |a|, whose string keys are all equal
+ * before |depth|, using |tmp| as scratch.  Each pass buckets on the byte at
+ * |depth|, with keys that end there first.  The largest bucket is sorted by
+ * looping rather than recursing, which bounds the recursion depth by
+ * log2(n). */
+static void upb_mapsort_strs(upb_sortedentry *a, upb_sortedentry *tmp,
+                             size_t n, size_t depth) {
+  size_t i;
+  size_t j;
+
+  while (n > UPB_MAPSORT_SMALL) {
+    size_t count[257];
+    size_t end[257];
+    size_t sum = 0;
+    int largest = 0;
+    int b;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++) {
+      const upb_stringview *key = &a[i].key.str;
+      count[key->size > depth ? 1 + (uint8_t)key->data[depth] : 0]++;
+    }
+
+    for (b = 0; b < 257; b++) {
+      end[b] = sum;
+      sum += count[b];
+      if (count[b] > count[largest]) largest = b;
+    }
+    for (i = 0; i < n; i++) {
+      const upb_stringview *key = &a[i].key.str;
+      tmp[end[key->size > depth ? 1 + (uint8_t)key->data[depth] : 0]++] = a[i];
+    }
+    memcpy(a, tmp, n * sizeof(*a));
+
+    /* The keys that end at |depth| are all equal, so bucket 0 is sorted. */
+    for (b = 1; b < 257; b++) {
+      if (b != largest && count[b] > 1) {
+        upb_mapsort_strs(a + end[b] - count[b], tmp, count[b], depth + 1);
+      }
+    }
+
+    if (largest == 0) {
+      return;
+    }
+    a += end[largest] - count[largest];
+    n = count[largest];
+    depth++;
+  }
+
+  for (i = 1; i < n; i++) {
+    upb_sortedentry e = a[i];
+    for (j = i; j > 0 && upb_mapsort_strcmp(&a[j - 1], &e, depth) > 0; j--) {
+      a[j] = a[j - 1];
+    }
+    a[j] = e;
+  }
+}
+
+static bool upb_visitor_putentry(const upb_visitor *visitor,
+                                 const upb_visitfield *f, upb_msgval key,
+                                 upb_msgval val, upb_sink *seq, int depth) {
+  const upb_visitorplan *entry = f->val.sub;
+  upb_sink sub;
+  upb_status status;
+
+  CHECK_TRUE(upb_sink_startsubmsg(seq, f->val.sel, &sub));
+  CHECK_TRUE(upb_sink_startmsg(&sub));
+  CHECK_TRUE(upb_visitor_putval(visitor, &entry->fields[0].val, key, &sub,
+                                depth + 1));
+  CHECK_TRUE(upb_visitor_putval(visitor, &entry->fields[1].val, val, &sub,
+                                depth + 1));
+  CHECK_TRUE(upb_sink_endmsg(&sub, &status));
+  return upb_sink_endsubmsg(seq, f->val.sel2);
+}
+
+static bool upb_visitor_putsortedmap(const upb_visitor *visitor,
+                                     const upb_visitfield *f,
+                                     const upb_map *map, upb_sink *seq,
+                                     int depth) {
+  upb_fieldtype_t key_type = upb_map_keytype(map);
+  size_t n = upb_map_size(map);
+  upb_sortedentry *buf = upb_env_malloc(visitor->env, 2 * n * sizeof(*buf));
+  upb_sortedentry *sorted = buf;
+  upb_mapiter iter;
+  size_t i = 0;
+
+  CHECK_TRUE(buf);
+
+  for (upb_mapiter_begin(&iter, map);
+       !upb_mapiter_done(&iter);
+       upb_mapiter_next(&iter)) {
+    buf[i].key = upb_mapiter_key(&iter);
+    buf[i].val = upb_mapiter_value(&iter);
+    buf[i].sortkey = upb_map_sortkey(key_type, buf[i].key);
+    i++;
+  }
+  UPB_ASSERT(i == n);
+
+  if (key_type == UPB_TYPE_STRING) {
+    upb_mapsort_strs(buf, buf + n, n, 0);
+  } else {
+    sorted = upb_mapsort_ints(buf, buf + n, n, upb_msgval_sizeof(key_type));
+  }
+
+  for (i = 0; i < n; i++) {
+    CHECK_TRUE(upb_visitor_putentry(visitor, f, sorted[i].key, sorted[i].val,
+                                    seq, depth));
+  }
+
+  upb_env_free(visitor->env, buf);
+  return true;
+}
+
+static bool upb_visitor_putmap(const upb_visitor *visitor,
+                               const upb_visitfield *f, const upb_map *map,
+                               upb_sink *sink, int depth) {
+  upb_sink seq;
+  upb_mapiter i;
+
+  CHECK_TRUE(upb_sink_startseq(sink, f->startseq, &seq));
+
+  if (visitor->deterministic && upb_map_size(map) > 1) {
+    CHECK_TRUE(upb_visitor_putsortedmap(visitor, f, map, &seq, depth));
+  } else {
+    for (upb_mapiter_begin(&i, map);
+         !upb_mapiter_done(&i);
+         upb_mapiter_next(&i)) {
+      CHECK_TRUE(upb_visitor_putentry(visitor, f, upb_mapiter_key(&i),
+                                      upb_mapiter_value(&i), &seq, depth));
+    }
+  }
+
+  return upb_sink_endseq(sink, f->endseq);
+}
+
+static bool upb_visitor_visitfield(const upb_visitor *visitor,
+                                   const upb_msg *msg,
+                                   const upb_visitorplan *vp,
+                                   const upb_visitfield *f, upb_sink *sink,
+                                   int depth) {
+  upb_msgval val;
+
+  if (!upb_visitor_hasfield(msg, f)) {
+    return true;
+  }
+
+  switch (f->kind) {
+    case UPB_VISIT_ARRAY:
+      return upb_visitor_putarray(visitor, f,
+                                  DEREF(msg, f->offset, const upb_array*),
+                                  sink, depth);
+    case UPB_VISIT_MAP:
+      return upb_visitor_putmap(visitor, f,
+                                DEREF(msg, f->offset, const upb_map*), sink,
+                                depth);
+    case UPB_VISIT_SINGULAR:
+      val = upb_msgval_read(msg, f->offset, upb_msgval_sizeof(f->val.type));
+      if (f->val.type == UPB_TYPE_MESSAGE && upb_lazymsg_is(val.msg)) {
+        /* Parses it, or reads as NULL if it doesn't parse. */
+        val = upb_msg_get(msg, f->index, vp->layout);
+      }
+      return upb_visitor_putval(visitor, &f->val, val, sink, depth);
+  }
+  UPB_UNREACHABLE();
+}
+
+static bool upb_visitor_visitmsg2(const upb_visitor *visitor,
+                                  const upb_msg *msg,
+                                  const upb_visitorplan *vp, upb_sink *sink,
+                                  int depth) {
+  const upb_stringview *unknown;
+  size_t unknown_count;
+  uint64_t present[UPB_PRESENCE_MAXWORDS];
+  upb_status status;
+  int i;
+
+  /* Protect against cycles (possible because users may freely reassign message
+   * and repeated fields) by imposing a maximum recursion depth. */
+  if (depth > ENCODE_MAX_NESTING) {
+    return false;
+  }
+
+  CHECK_TRUE(upb_sink_startmsg(sink));
+
+  if (upb_msg_presence(msg, &vp->layout->data, present)) {
+    for (i = 0; i < (vp->field_count + 63) / 64; i++) {
+      uint64_t word = present[i];
+      while (word) {
+        CHECK_TRUE(upb_visitor_visitfield(
+            visitor, msg, vp, &vp->fields[i * 64 + upb_ctz64(word)], sink,
+            depth));
+        word &= word - 1;
+      }
+    }
+  } else {
+    for (i = 0; i < vp->field_count; i++) {
+      CHECK_TRUE(upb_visitor_visitfield(visitor, msg, vp, &vp->fields[i], sink,
+                                        depth));
+    }
+  }
+
+  unknown = upb_msg_getunknown(msg, &unknown_count);
+  for (i = 0; i < (int)unknown_count; i++) {
+    CHECK_TRUE(upb_sink_putunknown(sink, unknown[i].data, unknown[i].size));
+  }
+
+  return upb_sink_endmsg(sink, &status);
+}
+
+upb_visitor *upb_visitor_create(upb_env *e, const upb_visitorplan *vp,
+                                upb_sink *output) {
+  upb_visitor *visitor = upb_env_malloc(e, sizeof(*visitor));
+  visitor->plan = vp;
+  visitor->sink = output;
+  visitor->env = e;
+  visitor->deterministic = false;
+  return visitor;
+}
+
+bool upb_visitor_visitmsg(upb_visitor *visitor, const upb_msg *msg) {
+  return upb_visitor_visitmsg2(visitor, msg, visitor->plan, visitor->sink, 0);
+}
+
+void upb_visitor_setdeterministic(upb_visitor *visitor, bool deterministic) {
+  visitor->deterministic = deterministic;
+}
+
+
+/** upb_msg *******************************************************************/
+
+/* Internal members of a upb_msg.  We can change this without breaking binary
  * compatibility.  We put these before the user's data.  The user's upb_msg*
  * points after the upb_msg_internal. */
 
 /* Used when a message is not extendable. */
 typedef struct {
-  /* TODO(haberman): add unknown fields. */
   upb_alloc *alloc;
+  /* Unknown fields, as ranges of serialized data that we do not own. */
+  upb_stringview *unknown;
+  size_t unknown_count;
+  size_t unknown_size;
+  /* For upb_decodeopts.cache, or NULL. */
+  upb_msgcache *cache;
 } upb_msg_internal;
 
-/* Used when a message is extendable. */
-typedef struct {
-  upb_inttable *extdict;
-  upb_msg_internal base;
-} upb_msg_internal_withext;
+/* Used when a message is extendable. */
+typedef struct {
+  upb_inttable *extdict;
+  upb_msg_internal base;
+} upb_msg_internal_withext;
+
+static int upb_msg_internalsize(const upb_msglayout *l) {
+  return l->data.extendable ? sizeof(upb_msg_internal_withext)
+                            : sizeof(upb_msg_internal);
+}
+
+static upb_msg_internal *upb_msg_getinternal(upb_msg *msg) {
+  return VOIDPTR_AT(msg, -sizeof(upb_msg_internal));
+}
+
+static const upb_msg_internal *upb_msg_getinternal_const(const upb_msg *msg) {
+  return VOIDPTR_AT(msg, -sizeof(upb_msg_internal));
+}
+
+static upb_msg_internal_withext *upb_msg_getinternalwithext(
+    upb_msg *msg, const upb_msglayout *l) {
+  UPB_ASSERT(l->data.extendable);
+  return VOIDPTR_AT(msg, -sizeof(upb_msg_internal_withext));
+}
+
+static const upb_msglayout_fieldinit_v1 *upb_msg_checkfield(
+    int field_index, const upb_msglayout *l) {
+  UPB_ASSERT(field_index >= 0 && field_index < l->data.field_count);
+  return &l->data.fields[field_index];
+}
+
+static bool upb_msg_inoneof(const upb_msglayout_fieldinit_v1 *field) {
+  return field->oneof_index != UPB_NOT_IN_ONEOF;
+}
+
+static uint32_t *upb_msg_oneofcase(const upb_msg *msg, int field_index,
+                                   const upb_msglayout *l) {
+  const upb_msglayout_fieldinit_v1 *field = upb_msg_checkfield(field_index, l);
+  UPB_ASSERT(upb_msg_inoneof(field));
+  return PTR_AT(msg, l->data.oneofs[field->oneof_index].case_offset, uint32_t);
+}
+
+size_t upb_msg_sizeof(const upb_msglayout *l) {
+  return l->data.size + upb_msg_internalsize(l);
+}
+
+upb_msg *upb_msg_init(void *mem, const upb_msglayout *l, upb_alloc *a) {
+  upb_msg *msg = VOIDPTR_AT(mem, upb_msg_internalsize(l));
+
+  /* Initialize normal members. */
+  if (l->data.default_msg) {
+    memcpy(msg, l->data.default_msg, l->data.size);
+  } else {
+    memset(msg, 0, l->data.size);
+  }
+
+  /* Initialize internal members. */
+  upb_msg_getinternal(msg)->alloc = a;
+  upb_msg_getinternal(msg)->unknown = NULL;
+  upb_msg_getinternal(msg)->unknown_count = 0;
+  upb_msg_getinternal(msg)->unknown_size = 0;
+  upb_msg_getinternal(msg)->cache = NULL;
+
+  if (l->data.extendable) {
+    upb_msg_getinternalwithext(msg, l)->extdict = NULL;
+  }
+
+  return msg;
+}
+
+/* Frees the extension dictionary of |msg|, and the messages in it that hold
+ * the extensions' values.  Those are never extendable themselves, so they
+ * have no dictionary of their own. */
+static void upb_msg_freeextdict(upb_msg *msg, const upb_msglayout *l) {
+  upb_msg_internal_withext *in = upb_msg_getinternalwithext(msg, l);
+  upb_alloc *a = upb_msg_alloc(msg);
+  upb_inttable_iter i;
+
+  if (!in->extdict) return;
+
+  upb_inttable_begin(&i, in->extdict);
+  for (; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_msg *ext = upb_value_getptr(upb_inttable_iter_value(&i));
+    upb_free(a, upb_msg_getinternal(ext)->unknown);
+    upb_free(a, upb_msg_getinternal(ext));
+  }
+
+  upb_inttable_uninit2(in->extdict, a);
+  upb_free(a, in->extdict);
+  in->extdict = NULL;
+}
+
+void *upb_msg_uninit(upb_msg *msg, const upb_msglayout *l) {
+  upb_free(upb_msg_alloc(msg), upb_msg_getinternal(msg)->unknown);
+
+  if (l->data.extendable) {
+    upb_msg_freeextdict(msg, l);
+  }
+
+  return VOIDPTR_AT(msg, -upb_msg_internalsize(l));
+}
+
+upb_msg *upb_msg_new(const upb_msglayout *l, upb_alloc *a) {
+  void *mem = upb_malloc(a, upb_msg_sizeof(l));
+  return mem ? upb_msg_init(mem, l, a) : NULL;
+}
+
+void upb_msg_free(upb_msg *msg, const upb_msglayout *l) {
+  upb_free(upb_msg_alloc(msg), upb_msg_uninit(msg, l));
+}
+
+upb_alloc *upb_msg_alloc(const upb_msg *msg) {
+  return upb_msg_getinternal_const(msg)->alloc;
+}
+
+bool upb_msg_addunknown(upb_msg *msg, const char *data, size_t len) {
+  upb_msg_internal *in = upb_msg_getinternal(msg);
+
+  upb_msg_markdirty(msg);
+
+  if (in->unknown_count > 0) {
+    upb_stringview *last = &in->unknown[in->unknown_count - 1];
+    if (last->data + last->size == data) {
+      last->size += len;
+      return true;
+    }
+  }
+
+  if (in->unknown_count == in->unknown_size) {
+    size_t new_size = UPB_MAX(in->unknown_size * 2, 4);
+    upb_stringview *new_unknown =
+        upb_realloc(in->alloc, in->unknown,
+                    in->unknown_size * sizeof(*in->unknown),
+                    new_size * sizeof(*in->unknown));
+
+    if (!new_unknown) {
+      return false;
+    }
+
+    in->unknown = new_unknown;
+    in->unknown_size = new_size;
+  }
+
+  in->unknown[in->unknown_count++] = upb_stringview_make(data, len);
+  return true;
+}
+
+bool upb_msg_setcache(upb_msg *msg, upb_msg *parent, const char *data,
+                      size_t size, upb_alloc *a) {
+  upb_msgcache *cache = upb_malloc(a, sizeof(*cache));
+  if (!cache) return false;
+  cache->bytes = upb_stringview_make(data, size);
+  cache->parent = parent;
+  upb_msg_getinternal(msg)->cache = cache;
+  return true;
+}
+
+const upb_stringview *upb_msg_getcache(const upb_msg *msg) {
+  const upb_msgcache *cache = upb_msg_getinternal_const(msg)->cache;
+  return cache && cache->bytes.data ? &cache->bytes : NULL;
+}
+
+/* The parent to give a lazy submessage of |msg| when it is parsed, so that
+ * changes to it make |msg| dirty too. */
+static upb_msg *upb_msg_cacheparent(const upb_msg *msg) {
+  return upb_msg_getinternal_const(msg)->cache ? (upb_msg*)msg : NULL;
+}
+
+void upb_msg_markdirty(upb_msg *msg) {
+  /* A message with no bytes of its own may still have a parent whose bytes
+   * include it, so this always goes all the way up. */
+  while (msg) {
+    upb_msgcache *cache = upb_msg_getinternal(msg)->cache;
+    if (!cache) return;
+    cache->bytes.data = NULL;
+    msg = cache->parent;
+  }
+}
+
+const upb_stringview *upb_msg_getunknown(const upb_msg *msg, size_t *count) {
+  const upb_msg_internal *in = upb_msg_getinternal_const(msg);
+  *count = in->unknown_count;
+  return in->unknown;
+}
+
+bool upb_msg_has(const upb_msg *msg,
+                 int field_index,
+                 const upb_msglayout *l) {
+  const upb_msglayout_fieldinit_v1 *field = upb_msg_checkfield(field_index, l);
+
+  UPB_ASSERT(l->data.is_proto2);
+
+  if (upb_msg_inoneof(field)) {
+    /* Oneofs are set when the oneof number is set to this field. */
+    return *upb_msg_oneofcase(msg, field_index, l) == field->number;
+  } else {
+    /* Other fields are set when their hasbit is set. */
+    uint32_t hasbit = l->data.fields[field_index].hasbit;
+    return DEREF(msg, hasbit / 8, char) & (1 << (hasbit % 8));
+  }
+}
+
+/* Parses a submessage that upb_decode() left serialized, and replaces it in
+ * the message.  Though this writes to |msg|, the field's value hasn't
+ * logically changed. */
+static upb_msgval upb_msg_getlazy(const upb_msg *msg,
+                                  const upb_msglayout_fieldinit_v1 *field,
+                                  const upb_msglayout *l, upb_msgval val) {
+  const upb_msglayout_msginit_v1 *subl = l->data.submsgs[field->submsg_index];
+  upb_msg *sub = upb_lazymsg_parse(upb_lazymsg_data(val.msg), subl,
+                                   upb_msg_alloc(msg),
+                                   upb_msg_cacheparent(msg));
+
+  if (!sub) {
+    /* Leave it serialized, so we don't lose the data. */
+    return upb_msgval_msg(NULL);
+  }
+
+  val = upb_msgval_msg(sub);
+  upb_msgval_write((upb_msg*)msg, field->offset, val, sizeof(void*));
+  return val;
+}
+
+upb_msgval upb_msg_get(const upb_msg *msg, int field_index,
+                       const upb_msglayout *l) {
+  const upb_msglayout_fieldinit_v1 *field = upb_msg_checkfield(field_index, l);
+  int size = upb_msg_fieldsize(field);
+
+  if (upb_msg_inoneof(field)) {
+    if (*upb_msg_oneofcase(msg, field_index, l) == field->number) {
+      size_t ofs = l->data.oneofs[field->oneof_index].data_offset;
+      return upb_msgval_read(msg, ofs, size);
+    } else {
+      /* Return default. */
+      return upb_msgval_read(l->data.default_msg, field->offset, size);
+    }
+  } else {
+    upb_msgval val = upb_msgval_read(msg, field->offset, size);
+    if (field->type == UPB_DESCRIPTOR_TYPE_MESSAGE &&
+        field->label != UPB_LABEL_REPEATED && upb_lazymsg_is(val.msg)) {
+      val = upb_msg_getlazy(msg, field, l, val);
+    }
+    return val;
+  }
+}
+
+void upb_msg_set(upb_msg *msg, int field_index, upb_msgval val,
+                 const upb_msglayout *l) {
+  const upb_msglayout_fieldinit_v1 *field = upb_msg_checkfield(field_index, l);
+  int size = upb_msg_fieldsize(field);
+
+  upb_msg_markdirty(msg);
+
+  if (upb_msg_inoneof(field)) {
+    size_t ofs = l->data.oneofs[field->oneof_index].data_offset;
+    *upb_msg_oneofcase(msg, field_index, l) = field->number;
+    upb_msgval_write(msg, ofs, val, size);
+  } else {
+    upb_msgval_write(msg, field->offset, val, size);
+    if (field->hasbit != UPB_NO_HASBIT) {
+      DEREF(msg, field->hasbit / 8, char) |= (1 << (field->hasbit % 8));
+    }
+  }
+}
+
+bool upb_msg_clearfield(upb_msg *msg, int field_index,
+                        const upb_msglayout *l) {
+  const upb_msglayout_fieldinit_v1 *field = upb_msg_checkfield(field_index, l);
+  size_t size = upb_msg_fieldsize(field);
+
+  upb_msg_markdirty(msg);
+
+  if (upb_msg_inoneof(field)) {
+    uint32_t *oneofcase = upb_msg_oneofcase(msg, field_index, l);
+    if (*oneofcase == field->number) *oneofcase = 0;
+    return true;
+  }
+
+  if (l->data.default_msg) {
+    memcpy(PTR_AT(msg, field->offset, char),
+           (const char*)l->data.default_msg + field->offset, size);
+  } else {
+    memset(PTR_AT(msg, field->offset, char), 0, size);
+  }
+  if (field->hasbit != UPB_NO_HASBIT) {
+    DEREF(msg, field->hasbit / 8, char) &= ~(1 << (field->hasbit % 8));
+  }
+  return true;
+}
+
+
+/** upb_extreg ****************************************************************/
+
+/* The registry is a table of extendees, each with a table of its extensions
+ * by number. */
+struct upb_extreg {
+  upb_alloc *alloc;
+  upb_inttable extendees;
+};
+
+/* Where a upb_msgext's layout keeps the extension's value, after its
+ * hasbit. */
+#define UPB_MSGEXT_OFFSET 8
+
+upb_extreg *upb_extreg_new(upb_alloc *a) {
+  upb_extreg *r = upb_malloc(a, sizeof(*r));
+  if (!r) return NULL;
+  r->alloc = a;
+  if (!upb_inttable_init2(&r->extendees, UPB_CTYPE_PTR, a)) {
+    upb_free(a, r);
+    return NULL;
+  }
+  return r;
+}
+
+void upb_extreg_free(upb_extreg *r) {
+  upb_inttable_iter i;
+
+  upb_inttable_begin(&i, &r->extendees);
+  for (; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_inttable *exts = upb_value_getptr(upb_inttable_iter_value(&i));
+    upb_inttable_iter j;
+
+    upb_inttable_begin(&j, exts);
+    for (; !upb_inttable_done(&j); upb_inttable_next(&j)) {
+      upb_free(r->alloc, upb_value_getptr(upb_inttable_iter_value(&j)));
+    }
+
+    upb_inttable_uninit2(exts, r->alloc);
+    upb_free(r->alloc, exts);
+  }
+
+  upb_inttable_uninit2(&r->extendees, r->alloc);
+  upb_free(r->alloc, r);
+}
+
+static bool upb_extinit_isvalid(const upb_msglayout_extinit_v1 *init) {
+  bool is_msg = init->type == UPB_DESCRIPTOR_TYPE_MESSAGE ||
+                init->type == UPB_DESCRIPTOR_TYPE_GROUP;
+
+  return init->extendee && init->extendee->extendable &&
+         init->number > 0 && init->number <= UPB_MAX_FIELDNUMBER &&
+         init->type >= UPB_DESCRIPTOR_TYPE_DOUBLE &&
+         init->type <= UPB_DESCRIPTOR_TYPE_SINT64 &&
+         (init->label == UPB_LABEL_OPTIONAL ||
+          init->label == UPB_LABEL_REPEATED) &&
+         is_msg == (init->submsg != NULL);
+}
+
+/* Lays out the one-field message that holds |ext|'s value. */
+static void upb_msgext_place(upb_msgext *ext) {
+  upb_msglayout_fieldinit_v1 *field = &ext->field;
+  upb_msglayout_msginit_v1 *l = &ext->layout;
+  bool repeated = ext->init.label == UPB_LABEL_REPEATED;
+
+  field->number = ext->init.number;
+  field->offset = UPB_MSGEXT_OFFSET;
+  field->hasbit = repeated ? UPB_NO_HASBIT : 0;
+  field->oneof_index = UPB_NOT_IN_ONEOF;
+  field->submsg_index = ext->init.submsg ? 0 : UPB_NO_SUBMSG;
+  field->type = ext->init.type;
+  field->label = ext->init.label;
+  ext->submsgs[0] = ext->init.submsg;
+
+  memset(l, 0, sizeof(*l));
+  l->submsgs = ext->submsgs;
+  l->fields = field;
+  l->size = UPB_ALIGN_UP_TO(UPB_MSGEXT_OFFSET + sizeof(upb_stringview), 8);
+  l->field_count = 1;
+  l->is_proto2 = true;
+}
+
+const upb_msgext *upb_extreg_add(upb_extreg *r,
+                                 const upb_msglayout_extinit_v1 *init) {
+  upb_inttable *exts;
+  upb_msgext *ext;
+  upb_value v;
+
+  if (!upb_extinit_isvalid(init)) return NULL;
+
+  if (upb_inttable_lookupptr(&r->extendees, init->extendee, &v)) {
+    exts = upb_value_getptr(v);
+    if (upb_inttable_lookup(exts, init->number, NULL)) return NULL;
+  } else {
+    exts = upb_malloc(r->alloc, sizeof(*exts));
+    if (!exts) return NULL;
+    if (!upb_inttable_init2(exts, UPB_CTYPE_PTR, r->alloc)) {
+      upb_free(r->alloc, exts);
+      return NULL;
+    }
+    if (!upb_inttable_insertptr2(&r->extendees, init->extendee,
+                                 upb_value_ptr(exts), r->alloc)) {
+      upb_inttable_uninit2(exts, r->alloc);
+      upb_free(r->alloc, exts);
+      return NULL;
+    }
+  }
+
+  ext = upb_malloc(r->alloc, sizeof(*ext));
+  if (!ext) return NULL;
+  ext->init = *init;
+  upb_msgext_place(ext);
+
+  if (!upb_inttable_insert2(exts, init->number, upb_value_ptr(ext),
+                            r->alloc)) {
+    upb_free(r->alloc, ext);
+    return NULL;
+  }
+
+  return ext;
+}
+
+const upb_msgext *upb_extreg_lookup(const upb_extreg *r,
+                                    const upb_msglayout_msginit_v1 *extendee,
+                                    uint32_t number) {
+  upb_value v;
+  if (!upb_inttable_lookupptr(&r->extendees, extendee, &v) ||
+      !upb_inttable_lookup(upb_value_getptr(v), number, &v)) {
+    return NULL;
+  }
+  return upb_value_getptr(v);
+}
+
+const upb_msglayout_extinit_v1 *upb_msgext_init(const upb_msgext *ext) {
+  return &ext->init;
+}
+
+static upb_msg *upb_msg_findext(const upb_msg *msg, const upb_msglayout *l,
+                                const upb_msgext *ext) {
+  const upb_msg_internal_withext *in;
+  upb_value v;
+
+  UPB_ASSERT(ext->init.extendee == &l->data);
+  in = upb_msg_getinternalwithext((upb_msg*)msg, l);
+  if (!in->extdict || !upb_inttable_lookup(in->extdict, ext->init.number, &v)) {
+    return NULL;
+  }
+  return upb_value_getptr(v);
+}
+
+upb_msg *upb_msg_getorcreateext(upb_msg *msg,
+                                const upb_msglayout_msginit_v1 *l,
+                                const upb_msgext *ext) {
+  upb_msg_internal_withext *in =
+      upb_msg_getinternalwithext(msg, (const upb_msglayout*)l);
+  upb_alloc *a = upb_msg_alloc(msg);
+  upb_msg *storage = upb_msg_findext(msg, (const upb_msglayout*)l, ext);
+
+  if (storage) return storage;
+
+  if (!in->extdict) {
+    upb_inttable *t = upb_malloc(a, sizeof(*t));
+    if (!t) return NULL;
+    if (!upb_inttable_init2(t, UPB_CTYPE_PTR, a)) {
+      upb_free(a, t);
+      return NULL;
+    }
+    in->extdict = t;
+  }
+
+  storage = upb_msg_new((const upb_msglayout*)&ext->layout, a);
+  if (!storage) return NULL;
+  if (!upb_inttable_insert2(in->extdict, ext->init.number,
+                            upb_value_ptr(storage), a)) {
+    upb_msg_free(storage, (const upb_msglayout*)&ext->layout);
+    return NULL;
+  }
+
+  return storage;
+}
+
+bool upb_msg_hasext(const upb_msg *msg, const upb_msglayout *l,
+                    const upb_msgext *ext) {
+  const upb_msglayout *extl = (const upb_msglayout*)&ext->layout;
+  const upb_msg *storage = upb_msg_findext(msg, l, ext);
+
+  if (!storage) {
+    return false;
+  } else if (ext->init.label == UPB_LABEL_REPEATED) {
+    const upb_array *arr = upb_msg_get(storage, 0, extl).arr;
+    return arr && upb_array_size(arr) > 0;
+  } else {
+    return upb_msg_has(storage, 0, extl);
+  }
+}
+
+upb_msgval upb_msg_getext(const upb_msg *msg, const upb_msglayout *l,
+                          const upb_msgext *ext) {
+  const upb_msg *storage = upb_msg_findext(msg, l, ext);
+
+  if (!storage) {
+    upb_msgval zero;
+    memset(&zero, 0, sizeof(zero));
+    return zero;
+  }
+
+  return upb_msg_get(storage, 0, (const upb_msglayout*)&ext->layout);
+}
+
+
+/** upb_msg copy and merge ****************************************************/
+
+typedef struct {
+  upb_alloc *alloc;
+  bool share_strings;
+} upb_copystate;
+
+static upb_msg *upb_msg_copy2(upb_copystate *c, const upb_msg *msg,
+                              const upb_msglayout_msginit_v1 *l, int depth);
+static bool upb_msg_merge2(upb_copystate *c, upb_msg *to, const upb_msg *from,
+                           const upb_msglayout_msginit_v1 *l, int depth);
+
+static bool upb_copy_str(upb_copystate *c, upb_stringview *str) {
+  char *data;
+
+  if (c->share_strings || str->size == 0) {
+    return true;
+  }
+
+  data = upb_malloc(c->alloc, str->size);
+  CHECK_TRUE(data);
+  memcpy(data, str->data, str->size);
+  str->data = data;
+  return true;
+}
+
+/* Replaces the submessage pointer at |slot| with a copy of the submessage. */
+static bool upb_copy_submsg(upb_copystate *c, void **slot,
+                            const upb_msglayout_msginit_v1 *subl, int depth) {
+  if (!*slot) {
+    return true;
+  } else if (upb_lazymsg_is(*slot)) {
+    /* Still serialized: copy the bytes, not a parse of them. */
+    upb_stringview *data = upb_malloc(c->alloc, sizeof(*data));
+    CHECK_TRUE(data);
+    *data = *upb_lazymsg_data(*slot);
+    CHECK_TRUE(upb_copy_str(c, data));
+    *slot = upb_lazymsg_make(data);
+    return true;
+  } else {
+    *slot = upb_msg_copy2(c, *slot, subl, depth + 1);
+    return *slot != NULL;
+  }
+}
+
+/* Replaces the value at |slot|, which was memcpy()'d from another message,
+ * with a deep copy of it. */
+static bool upb_copy_field(upb_copystate *c, void *slot,
+                           const upb_msglayout_fieldinit_v1 *field,
+                           const upb_msglayout_msginit_v1 *l, int depth);
+
+static bool upb_copy_elems(upb_copystate *c, upb_array *to,
+                           const upb_array *from,
+                           const upb_msglayout_fieldinit_v1 *field,
+                           const upb_msglayout_msginit_v1 *l, int depth) {
+  size_t len = to->len + from->len;
+  size_t i;
+  char *elems;
+
+  CHECK_TRUE(upb_array_reserve(to, len));
+  elems = (char*)to->data + to->len * to->element_size;
+  memcpy(elems, from->data, from->len * from->element_size);
+  to->len = len;
+
+  if (from->type == UPB_TYPE_STRING || from->type == UPB_TYPE_BYTES) {
+    for (i = 0; i < from->len; i++) {
+      CHECK_TRUE(upb_copy_str(c, (upb_stringview*)elems + i));
+    }
+  } else if (from->type == UPB_TYPE_MESSAGE) {
+    for (i = 0; i < from->len; i++) {
+      CHECK_TRUE(upb_copy_submsg(c, (void**)elems + i,
+                                 l->submsgs[field->submsg_index], depth));
+    }
+  }
+
+  return true;
+}
+
+static bool upb_copy_field(upb_copystate *c, void *slot,
+                           const upb_msglayout_fieldinit_v1 *field,
+                           const upb_msglayout_msginit_v1 *l, int depth) {
+  if (field->label == UPB_LABEL_REPEATED) {
+    const upb_array *from = *(upb_array**)slot;
+    upb_array *to;
+
+    if (!from) {
+      return true;
+    }
+
+    to = upb_array_new(from->type, c->alloc);
+    CHECK_TRUE(to);
+    *(upb_array**)slot = to;
+    return upb_copy_elems(c, to, from, field, l, depth);
+  }
+
+  switch (upb_desctype_to_fieldtype[field->type]) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      return upb_copy_str(c, slot);
+    case UPB_TYPE_MESSAGE:
+      return upb_copy_submsg(c, slot, l->submsgs[field->submsg_index], depth);
+    default:
+      return true;
+  }
+}
+
+/* Returns the offset of the field's value in |msg|, or -1 if it's a oneof
+ * member that isn't the one that is set. */
+static int64_t upb_copy_fieldofs(const upb_msg *msg,
+                                 const upb_msglayout_fieldinit_v1 *field,
+                                 const upb_msglayout_msginit_v1 *l) {
+  if (upb_msg_inoneof(field)) {
+    const upb_msglayout_oneofinit_v1 *o = &l->oneofs[field->oneof_index];
+    return DEREF(msg, o->case_offset, uint32_t) == field->number
+               ? (int64_t)o->data_offset
+               : -1;
+  } else {
+    return field->offset;
+  }
+}
+
+/* Whether a field that is not in a oneof is set, for merging.  Fields without
+ * a hasbit are set if nonzero, as in proto3. */
+static bool upb_copy_fieldisset(const upb_msg *msg,
+                                const upb_msglayout_fieldinit_v1 *field) {
+  if (field->hasbit != UPB_NO_HASBIT) {
+    return DEREF(msg, field->hasbit / 8, char) & (1 << (field->hasbit % 8));
+  } else if (field->label == UPB_LABEL_REPEATED) {
+    const upb_array *arr = DEREF(msg, field->offset, const upb_array*);
+    return arr && arr->len > 0;
+  } else {
+    const char *p = PTR_AT(msg, field->offset, const char);
+    int size = upb_msg_fieldsize(field);
+    int i;
+    for (i = 0; i < size; i++) {
+      if (p[i]) return true;
+    }
+    return false;
+  }
+}
+
+static bool upb_copy_unknown(upb_copystate *c, upb_msg *to,
+                             const upb_msg *from) {
+  size_t i, count, size = 0;
+  const upb_stringview *unknown = upb_msg_getunknown(from, &count);
+  char *data = NULL;
+
+  if (!c->share_strings) {
+    /* One buffer for all of them, so the ranges stay merged. */
+    for (i = 0; i < count; i++) {
+      size += unknown[i].size;
+    }
+    if (size > 0) {
+      data = upb_malloc(c->alloc, size);
+      CHECK_TRUE(data);
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    const char *ptr = unknown[i].data;
+    if (data) {
+      memcpy(data, ptr, unknown[i].size);
+      ptr = data;
+      data += unknown[i].size;
+    }
+    CHECK_TRUE(upb_msg_addunknown(to, ptr, unknown[i].size));
+  }
+
+  return true;
+}
+
+static upb_msg *upb_msg_copy2(upb_copystate *c, const upb_msg *msg,
+                              const upb_msglayout_msginit_v1 *l, int depth) {
+  const upb_msglayout *layout = (const upb_msglayout*)l;
+  upb_msg *ret;
+  void *mem;
+  int i;
+
+  if (depth > ENCODE_MAX_NESTING) {
+    return NULL;
+  }
+
+  mem = upb_malloc(c->alloc, upb_msg_sizeof(layout));
+  if (!mem) {
+    return NULL;
+  }
+
+  ret = upb_msg_init(mem, layout, c->alloc);
+  memcpy(ret, msg, l->size);
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_fieldinit_v1 *field = &l->fields[i];
+    int64_t ofs;
+
+    if (field->label != UPB_LABEL_REPEATED &&
+        field->type != UPB_DESCRIPTOR_TYPE_STRING &&
+        field->type != UPB_DESCRIPTOR_TYPE_BYTES &&
+        field->type != UPB_DESCRIPTOR_TYPE_MESSAGE &&
+        field->type != UPB_DESCRIPTOR_TYPE_GROUP) {
+      continue;  /* Already copied. */
+    }
+
+    ofs = upb_copy_fieldofs(msg, field, l);
+    if (ofs >= 0 &&
+        !upb_copy_field(c, VOIDPTR_AT(ret, ofs), field, l, depth)) {
+      return NULL;
+    }
+  }
+
+  if (!upb_copy_unknown(c, ret, msg)) {
+    return NULL;
+  }
+
+  return ret;
+}
+
+/* Merges the submessage |from| into the one at |slot|. */
+static bool upb_merge_submsg(upb_copystate *c, void **slot, const void *from,
+                             const upb_msglayout_msginit_v1 *subl, int depth) {
+  if (!*slot) {
+    *slot = (void*)from;
+    return upb_copy_submsg(c, slot, subl, depth);
+  }
+
+  /* Both sides have to be parsed to merge them.  A parse of |from| only goes
+   * into |to|'s arena, so |from| is left as it is. */
+  if (upb_lazymsg_is(*slot)) {
+    *slot = upb_lazymsg_parse(upb_lazymsg_data(*slot), subl, c->alloc, NULL);
+    CHECK_TRUE(*slot);
+  }
+
+  if (upb_lazymsg_is(from)) {
+    from = upb_lazymsg_parse(upb_lazymsg_data(from), subl, c->alloc, NULL);
+    CHECK_TRUE(from);
+  }
+
+  return upb_msg_merge2(c, *slot, from, subl, depth + 1);
+}
+
+static bool upb_msg_merge2(upb_copystate *c, upb_msg *to, const upb_msg *from,
+                           const upb_msglayout_msginit_v1 *l, int depth) {
+  int i;
+
+  CHECK_TRUE(depth <= ENCODE_MAX_NESTING);
+  upb_msg_markdirty(to);
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_fieldinit_v1 *field = &l->fields[i];
+    bool is_msg = field->type == UPB_DESCRIPTOR_TYPE_MESSAGE ||
+                  field->type == UPB_DESCRIPTOR_TYPE_GROUP;
+    int64_t from_ofs = upb_copy_fieldofs(from, field, l);
+    void *slot;
+
+    if (from_ofs < 0) {
+      continue;
+    }
+
+    if (upb_msg_inoneof(field)) {
+      const upb_msglayout_oneofinit_v1 *o = &l->oneofs[field->oneof_index];
+      bool was_set = upb_copy_fieldofs(to, field, l) >= 0;
+      slot = VOIDPTR_AT(to, o->data_offset);
+
+      if (is_msg && was_set) {
+        CHECK_TRUE(upb_merge_submsg(c, slot, DEREF(from, from_ofs, void*),
+                                    l->submsgs[field->submsg_index], depth));
+        continue;
+      }
+
+      DEREF(to, o->case_offset, uint32_t) = field->number;
+      if (is_msg) {
+        /* Don't merge into what another member of the oneof left here. */
+        *(void**)slot = NULL;
+      }
+    } else {
+      if (!upb_copy_fieldisset(from, field)) {
+        continue;
+      }
+
+      slot = VOIDPTR_AT(to, field->offset);
+
+      if (field->hasbit != UPB_NO_HASBIT) {
+        DEREF(to, field->hasbit / 8, char) |= (1 << (field->hasbit % 8));
+      }
+
+      if (field->label == UPB_LABEL_REPEATED) {
+        const upb_array *arr = DEREF(from, from_ofs, const upb_array*);
+        if (*(upb_array**)slot) {
+          CHECK_TRUE(upb_copy_elems(c, *(upb_array**)slot, arr, field, l,
+                                    depth));
+          continue;
+        }
+      }
+    }
+
+    if (is_msg && field->label != UPB_LABEL_REPEATED) {
+      CHECK_TRUE(upb_merge_submsg(c, slot, DEREF(from, from_ofs, void*),
+                                  l->submsgs[field->submsg_index], depth));
+    } else {
+      memcpy(slot, PTR_AT(from, from_ofs, char), upb_msg_fieldsize(field));
+      CHECK_TRUE(upb_copy_field(c, slot, field, l, depth));
+    }
+  }
+
+  return upb_copy_unknown(c, to, from);
+}
+
+upb_msg *upb_msg_copy(const upb_msg *msg, const upb_msglayout *l,
+                      bool share_strings, upb_alloc *a) {
+  upb_copystate c;
+  c.alloc = a;
+  c.share_strings = share_strings;
+  return upb_msg_copy2(&c, msg, &l->data, 0);
+}
+
+bool upb_msg_merge(upb_msg *to, const upb_msg *from, const upb_msglayout *l,
+                   bool share_strings) {
+  upb_copystate c;
+  c.alloc = upb_msg_alloc(to);
+  c.share_strings = share_strings;
+  return upb_msg_merge2(&c, to, from, &l->data, 0);
+}
+
+/** upb_msg clear *************************************************************/
+
+static void upb_msg_clear2(upb_msg *msg, const upb_msglayout_msginit_v1 *l,
+                           int depth);
+
+/* Clears the submessage at |slot| in place, or drops it if there is nothing
+ * to keep: a lazy submessage is only a pointer to its bytes. */
+static void upb_clear_submsg(void **slot, const upb_msglayout_msginit_v1 *subl,
+                             int depth) {
+  if (!*slot) {
+    return;
+  } else if (upb_lazymsg_is(*slot) || depth >= ENCODE_MAX_NESTING) {
+    *slot = NULL;
+  } else {
+    upb_msg_clear2(*slot, subl, depth + 1);
+  }
+}
+
+static void upb_msg_clear2(upb_msg *msg, const upb_msglayout_msginit_v1 *l,
+                           int depth) {
+  upb_msg_internal *in = upb_msg_getinternal(msg);
+  int i;
+
+  in->unknown_count = 0;
+  in->cache = NULL;
+
+  if (l->extendable) {
+    /* Extensions are rare enough that these aren't kept for reuse. */
+    upb_msg_freeextdict(msg, (const upb_msglayout*)l);
+  }
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_fieldinit_v1 *field = &l->fields[i];
+    bool is_msg = field->type == UPB_DESCRIPTOR_TYPE_MESSAGE ||
+                  field->type == UPB_DESCRIPTOR_TYPE_GROUP;
+    void *slot = VOIDPTR_AT(msg, field->offset);
+
+    if (upb_msg_inoneof(field)) {
+      /* Zeroed even if another member is set, so that nothing is ever merged
+       * into what the previous member left behind. */
+      const upb_msglayout_oneofinit_v1 *o = &l->oneofs[field->oneof_index];
+      DEREF(msg, o->case_offset, uint32_t) = 0;
+      memset(PTR_AT(msg, o->data_offset, char), 0, upb_msg_fieldsize(field));
+      continue;
+    }
+
+    if (field->label == UPB_LABEL_REPEATED) {
+      upb_array *arr = *(upb_array**)slot;
+      size_t j;
+
+      if (!arr) {
+        continue;
+      } else if (is_msg && l->submsgs[field->submsg_index] == NULL) {
+        /* A map. */
+        *(upb_array**)slot = NULL;
+        continue;
+      }
+
+      if (is_msg) {
+        for (j = 0; j < arr->len; j++) {
+          upb_clear_submsg((void**)arr->data + j,
+                           l->submsgs[field->submsg_index], depth);
+        }
+        arr->pooled = UPB_MAX(arr->pooled, arr->len);
+      }
+      arr->len = 0;
+    } else if (is_msg && field->hasbit != UPB_NO_HASBIT) {
+      upb_clear_submsg(slot, l->submsgs[field->submsg_index], depth);
+    } else if (l->default_msg) {
+      memcpy(slot, (const char*)l->default_msg + field->offset,
+             upb_msg_fieldsize(field));
+    } else {
+      memset(slot, 0, upb_msg_fieldsize(field));
+    }
+
+    if (field->hasbit != UPB_NO_HASBIT) {
+      DEREF(msg, field->hasbit / 8, char) &= ~(1 << (field->hasbit % 8));
+    }
+  }
+}
+
+void upb_msg_clear(upb_msg *msg, const upb_msglayout *l) {
+  upb_msg_markdirty(msg);
+  upb_msg_clear2(msg, &l->data, 0);
+}
+
+/** upb_msg freezing **********************************************************/
+
+/* A frozen buffer starts with this header, followed by the root message.
+ * Every pointer in a frozen message, array or string is replaced by the
+ * distance from the pointer's own slot to its target, or zero for NULL, so
+ * the buffer can be read wherever it is mapped. */
+typedef struct {
+  char magic[4];
+  uint32_t byteorder;  /* 1, as written by the freezing machine. */
+  uint32_t ptrsize;
+  uint32_t rootsize;   /* Size of the root message, as a check on its layout. */
+  uint64_t size;
+} upb_frozenheader;
+
+/* What a repeated field's upb_array* points to. */
+typedef struct {
+  size_t len;
+  intptr_t data;
+} upb_frozenarray;
+
+#define UPB_FROZEN_MAGIC "upbF"
+
+typedef struct {
+  upb_env *env;
+  char *buf;
+  size_t size;
+  size_t capacity;
+} upb_freezestate;
+
+/* Appends |size| zeroed bytes aligned to |align|, returning their offset, or
+ * zero if out of memory. */
+static size_t upb_freeze_reserve(upb_freezestate *f, size_t size,
+                                 size_t align) {
+  size_t ofs = align_up(f->size, align);
+
+  if (ofs + size > f->capacity) {
+    size_t new_capacity = UPB_MAX(f->capacity * 2, ofs + size);
+    char *new_buf = upb_env_realloc(f->env, f->buf, f->capacity, new_capacity);
+    if (!new_buf) {
+      return 0;
+    }
+    f->buf = new_buf;
+    f->capacity = new_capacity;
+  }
+
+  memset(f->buf + f->size, 0, ofs + size - f->size);
+  f->size = ofs + size;
+  return ofs;
+}
+
+static void upb_freeze_setptr(upb_freezestate *f, size_t slot, size_t target) {
+  intptr_t rel = target == 0 ? 0 : (intptr_t)target - (intptr_t)slot;
+  memcpy(f->buf + slot, &rel, sizeof(rel));
+}
+
+static const void *upb_frozen_resolve(const void *slot) {
+  intptr_t rel;
+  memcpy(&rel, slot, sizeof(rel));
+  return rel == 0 ? NULL : (const char*)slot + rel;
+}
+
+static size_t upb_freeze_msg(upb_freezestate *f, const upb_msg *msg,
+                             const upb_msglayout_msginit_v1 *l, int depth);
+
+/* Replaces the upb_stringview at |slot|, which still points to the source
+ * data, with a frozen copy of it. */
+static bool upb_freeze_str(upb_freezestate *f, size_t slot) {
+  upb_stringview str;
+  size_t ofs;
+
+  memcpy(&str, f->buf + slot, sizeof(str));
+  if (str.size == 0) {
+    upb_freeze_setptr(f, slot, 0);
+    return true;
+  }
+
+  ofs = upb_freeze_reserve(f, str.size, 1);
+  CHECK_TRUE(ofs);
+  memcpy(f->buf + ofs, str.data, str.size);
+  upb_freeze_setptr(f, slot, ofs);
+  return true;
+}
+
+/* Replaces the submessage pointer at |slot| with a frozen copy of the
+ * submessage. */
+static bool upb_freeze_submsg(upb_freezestate *f, size_t slot,
+                              const upb_msglayout_msginit_v1 *subl,
+                              int depth) {
+  const upb_msg *sub;
+  size_t ofs;
+
+  memcpy(&sub, f->buf + slot, sizeof(sub));
+  if (upb_lazymsg_is(sub)) {
+    sub = upb_lazymsg_parse(upb_lazymsg_data(sub), subl,
+                            upb_arena_alloc(upb_env_arena(f->env)), NULL);
+    CHECK_TRUE(sub);
+  }
+
+  ofs = sub ? upb_freeze_msg(f, sub, subl, depth + 1) : 0;
+  CHECK_TRUE(ofs || !sub);
+  upb_freeze_setptr(f, slot, ofs);
+  return true;
+}
+
+static bool upb_freeze_array(upb_freezestate *f, size_t slot,
+                             const upb_msglayout_fieldinit_v1 *field,
+                             const upb_msglayout_msginit_v1 *l, int depth) {
+  const upb_array *arr;
+  upb_frozenarray frozen;
+  size_t ofs;
+  size_t data;
+  size_t i;
+
+  memcpy(&arr, f->buf + slot, sizeof(arr));
+  if (!arr) {
+    return true;
+  }
+
+  ofs = upb_freeze_reserve(f, sizeof(frozen), sizeof(void*));
+  CHECK_TRUE(ofs);
+  upb_freeze_setptr(f, slot, ofs);
+  frozen.len = arr->len;
+  frozen.data = 0;
+  memcpy(f->buf + ofs, &frozen, sizeof(frozen));
+  if (arr->len == 0) {
+    return true;
+  }
+
+  data = upb_freeze_reserve(f, arr->len * arr->element_size, sizeof(void*));
+  CHECK_TRUE(data);
+  memcpy(f->buf + data, arr->data, arr->len * arr->element_size);
+  upb_freeze_setptr(f, ofs + offsetof(upb_frozenarray, data), data);
+
+  for (i = 0; i < arr->len; i++) {
+    size_t elem = data + i * arr->element_size;
+    if (arr->type == UPB_TYPE_STRING || arr->type == UPB_TYPE_BYTES) {
+      CHECK_TRUE(upb_freeze_str(f, elem));
+    } else if (arr->type == UPB_TYPE_MESSAGE) {
+      CHECK_TRUE(upb_freeze_submsg(f, elem, l->submsgs[field->submsg_index],
+                                   depth));
+    }
+  }
+
+  return true;
+}
+
+/* Returns the offset of the frozen copy of |msg|, or zero on failure. */
+static size_t upb_freeze_msg(upb_freezestate *f, const upb_msg *msg,
+                             const upb_msglayout_msginit_v1 *l, int depth) {
+  size_t ofs;
+  int i;
+
+  if (depth > ENCODE_MAX_NESTING) {
+    return 0;
+  }
+
+  ofs = upb_freeze_reserve(f, l->size, 8);
+  if (!ofs) {
+    return 0;
+  }
+  memcpy(f->buf + ofs, msg, l->size);
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_fieldinit_v1 *field = &l->fields[i];
+    bool is_msg = field->type == UPB_DESCRIPTOR_TYPE_MESSAGE ||
+                  field->type == UPB_DESCRIPTOR_TYPE_GROUP;
+    int64_t field_ofs = upb_copy_fieldofs(msg, field, l);
+    size_t slot = ofs + field_ofs;
+    bool ok = true;
+
+    if (field_ofs < 0) {
+      const upb_msglayout_oneofinit_v1 *o = &l->oneofs[field->oneof_index];
+      if (DEREF(msg, o->case_offset, uint32_t) == 0) {
+        /* Don't leave whatever was last in an unset oneof in the output. */
+        memset(f->buf + ofs + o->data_offset, 0, upb_msg_fieldsize(field));
+      }
+      continue;
+    }
+
+    if (field->label == UPB_LABEL_REPEATED) {
+      if (is_msg && l->submsgs[field->submsg_index] == NULL) {
+        /* Maps have no frozen form yet. */
+        ok = DEREF(msg, field_ofs, const void*) == NULL;
+      } else {
+        ok = upb_freeze_array(f, slot, field, l, depth);
+      }
+    } else if (is_msg) {
+      if (field->hasbit != UPB_NO_HASBIT && !upb_copy_fieldisset(msg, field)) {
+        /* Possibly one that upb_msg_clear() left behind. */
+        upb_freeze_setptr(f, slot, 0);
+      } else {
+        ok = upb_freeze_submsg(f, slot, l->submsgs[field->submsg_index],
+                               depth);
+      }
+    } else if (field->type == UPB_DESCRIPTOR_TYPE_STRING ||
+               field->type == UPB_DESCRIPTOR_TYPE_BYTES) {
+      ok = upb_freeze_str(f, slot);
+    }
+
+    if (!ok) {
+      return 0;
+    }
+  }
+
+  return ofs;
+}
+
+char *upb_msg_freeze(const upb_msg *msg, const upb_msglayout *l, upb_env *env,
+                     size_t *size) {
+  upb_freezestate f;
+  upb_frozenheader header;
+
+  f.env = env;
+  f.buf = NULL;
+  f.size = 0;
+  f.capacity = 0;
+
+  *size = 0;
+  upb_freeze_reserve(&f, sizeof(header), 8);
+  if (!f.buf || upb_freeze_msg(&f, msg, &l->data, 0) != sizeof(header)) {
+    return NULL;
+  }
+
+  memcpy(header.magic, UPB_FROZEN_MAGIC, sizeof(header.magic));
+  header.byteorder = 1;
+  header.ptrsize = sizeof(void*);
+  header.rootsize = l->data.size;
+  header.size = f.size;
+  memcpy(f.buf, &header, sizeof(header));
+  *size = f.size;
+  return f.buf;
+}
+
+const upb_msg *upb_frozen_root(const void *buf, size_t size,
+                               const upb_msglayout *l) {
+  upb_frozenheader header;
+
+  if (size < sizeof(header) + l->data.size) {
+    return NULL;
+  }
+
+  memcpy(&header, buf, sizeof(header));
+  if (memcmp(header.magic, UPB_FROZEN_MAGIC, sizeof(header.magic)) != 0 ||
+      header.byteorder != 1 || header.ptrsize != sizeof(void*) ||
+      header.rootsize != l->data.size || header.size != size) {
+    return NULL;
+  }
+
+  return (const char*)buf + sizeof(header);
+}
+
+upb_msgval upb_frozen_get(const upb_msg *msg, int field_index,
+                          const upb_msglayout *l) {
+  const upb_msglayout_fieldinit_v1 *field = upb_msg_checkfield(field_index, l);
+  int64_t ofs = upb_copy_fieldofs(msg, field, &l->data);
+  upb_msgval val;
+
+  UPB_ASSERT(field->label != UPB_LABEL_REPEATED);
+
+  if (ofs < 0) {
+    return upb_msg_get(msg, field_index, l);
+  }
+
+  switch (upb_desctype_to_fieldtype[field->type]) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      memcpy(&val.str, PTR_AT(msg, ofs, char), sizeof(val.str));
+      val.str.data = upb_frozen_resolve(PTR_AT(msg, ofs, char));
+      return val;
+    case UPB_TYPE_MESSAGE:
+      return upb_msgval_msg(upb_frozen_resolve(PTR_AT(msg, ofs, char)));
+    default:
+      return upb_msg_get(msg, field_index, l);
+  }
+}
+
+static const upb_frozenarray *upb_frozen_getarr(
+    const upb_msg *msg, const upb_msglayout_fieldinit_v1 *field) {
+  UPB_ASSERT(field->label == UPB_LABEL_REPEATED);
+  return upb_frozen_resolve(PTR_AT(msg, field->offset, char));
+}
+
+size_t upb_frozen_arraysize(const upb_msg *msg, int field_index,
+                            const upb_msglayout *l) {
+  const upb_frozenarray *arr =
+      upb_frozen_getarr(msg, upb_msg_checkfield(field_index, l));
+  return arr ? arr->len : 0;
+}
+
+upb_msgval upb_frozen_getelem(const upb_msg *msg, int field_index, size_t i,
+                              const upb_msglayout *l) {
+  const upb_msglayout_fieldinit_v1 *field = upb_msg_checkfield(field_index, l);
+  const upb_frozenarray *arr = upb_frozen_getarr(msg, field);
+  upb_fieldtype_t type = upb_desctype_to_fieldtype[field->type];
+  size_t elem_size = upb_msgval_sizeof(type);
+  const char *elem;
+  upb_msgval val;
+
+  UPB_ASSERT(arr && i < arr->len);
+  elem = (const char*)upb_frozen_resolve(&arr->data) + i * elem_size;
+  val = upb_msgval_read(elem, 0, elem_size);
+
+  if (type == UPB_TYPE_STRING || type == UPB_TYPE_BYTES) {
+    val.str.data = upb_frozen_resolve(elem);
+  } else if (type == UPB_TYPE_MESSAGE) {
+    val.msg = upb_frozen_resolve(elem);
+  }
+
+  return val;
+}
+
+#undef UPB_FROZEN_MAGIC
+
+/** upb_msg equality and hashing **********************************************/
+
+/* A stable 64-bit hash, fed a stream of bytes in 8-byte words.  It doesn't
+ * depend on addresses or on a seed, so the same contents hash the same in
+ * every process on the same platform. */
+typedef struct {
+  uint64_t h;
+  uint64_t len;
+  char buf[8];
+  size_t buflen;
+} upb_hashstate;
+
+static uint64_t upb_hash_mix(uint64_t h) {
+  /* MurmurHash3's 64-bit finalizer. */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdU;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53U;
+  h ^= h >> 33;
+  return h;
+}
+
+static void upb_hash_init(upb_hashstate *s) {
+  s->h = 0;
+  s->len = 0;
+  s->buflen = 0;
+}
+
+static void upb_hash_word(upb_hashstate *s, const char *p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  s->h = (s->h ^ upb_hash_mix(w)) * 0x9e3779b97f4a7c15U;
+}
+
+static void upb_hash_bytes(upb_hashstate *s, const void *data, size_t len) {
+  const char *p = data;
+  const char *end = p + len;
+
+  if (len == 0) return;
+  s->len += len;
+
+  if (s->buflen > 0) {
+    while (p < end && s->buflen < sizeof(s->buf)) {
+      s->buf[s->buflen++] = *p++;
+    }
+    if (s->buflen < sizeof(s->buf)) return;
+    upb_hash_word(s, s->buf);
+    s->buflen = 0;
+  }
+
+  for (; end - p >= 8; p += 8) {
+    upb_hash_word(s, p);
+  }
+
+  memcpy(s->buf, p, end - p);
+  s->buflen = end - p;
+}
+
+static void upb_hash_u64(upb_hashstate *s, uint64_t val) {
+  upb_hash_bytes(s, &val, sizeof(val));
+}
+
+static uint64_t upb_hash_finish(upb_hashstate *s) {
+  memset(s->buf + s->buflen, 0, sizeof(s->buf) - s->buflen);
+  upb_hash_word(s, s->buf);
+  return upb_hash_mix(s->h ^ s->len);
+}
+
+/* Returns the submessage at |slot| of |owner|, parsing it first if
+ * upb_decode() left it serialized.  Like upb_msg_get(), this stores the parse
+ * back in the slot.  Returns NULL, leaving the bytes in place, if they don't
+ * parse. */
+static const upb_msg *upb_eq_getsubmsg(const upb_msg *owner, const void *slot,
+                                       const upb_msglayout_msginit_v1 *subl) {
+  const void *sub = *(const void**)slot;
+  upb_msg *parsed;
+
+  if (!upb_lazymsg_is(sub)) {
+    return sub;
+  }
+
+  parsed = upb_lazymsg_parse(upb_lazymsg_data(sub), subl, upb_msg_alloc(owner),
+                             upb_msg_cacheparent(owner));
+  if (parsed) {
+    *(void**)slot = parsed;
+  }
+  return parsed;
+}
+
+/* Map fields are the repeated submessage fields whose entry type has no
+ * layout: the msgfactory stores a upb_map* there instead of a upb_array*. */
+static bool upb_eq_ismap(const upb_msglayout_fieldinit_v1 *field,
+                         const upb_msglayout_msginit_v1 *l) {
+  return field->label == UPB_LABEL_REPEATED &&
+         field->submsg_index != UPB_NO_SUBMSG &&
+         l->submsgs[field->submsg_index] == NULL;
+}
+
+static bool upb_eq_isset(const upb_msg *msg,
+                         const upb_msglayout_fieldinit_v1 *field) {
+  return DEREF(msg, field->hasbit / 8, char) & (1 << (field->hasbit % 8));
+}
+
+static bool upb_msg_equal2(const upb_msg *a, const upb_msg *b,
+                           const upb_msglayout_msginit_v1 *l, int depth);
+static uint64_t upb_msg_hash2(const upb_msg *msg,
+                              const upb_msglayout_msginit_v1 *l, int depth);
+
+static bool upb_eq_str(const upb_stringview *a, const upb_stringview *b) {
+  return a->size == b->size &&
+         (a->size == 0 || memcmp(a->data, b->data, a->size) == 0);
+}
+
+/* Submessages are compared by their contents, and a lazy one that doesn't
+ * parse by its bytes. */
+static bool upb_eq_submsg(const upb_msg *owner_a, const void *slot_a,
+                          const upb_msg *owner_b, const void *slot_b,
+                          const upb_msglayout_msginit_v1 *subl, int depth) {
+  const void *a = *(const void**)slot_a;
+  const void *b = *(const void**)slot_b;
+
+  if (a == b) {
+    return true;
+  } else if (!a || !b) {
+    return false;
+  } else if (upb_lazymsg_is(a) && upb_lazymsg_is(b) &&
+             upb_eq_str(upb_lazymsg_data(a), upb_lazymsg_data(b))) {
+    return true;
+  }
+
+  a = upb_eq_getsubmsg(owner_a, slot_a, subl);
+  b = upb_eq_getsubmsg(owner_b, slot_b, subl);
+  if (!a || !b) {
+    return false;
+  }
+
+  return upb_msg_equal2(a, b, subl, depth + 1);
+}
+
+static uint64_t upb_hash_submsg(const upb_msg *owner, const void *slot,
+                                const upb_msglayout_msginit_v1 *subl,
+                                int depth) {
+  const upb_msg *sub;
+
+  if (!*(const void**)slot) {
+    return 0;
+  }
+
+  sub = upb_eq_getsubmsg(owner, slot, subl);
+  if (!sub) {
+    const upb_stringview *data = upb_lazymsg_data(*(const void**)slot);
+    upb_hashstate s;
+    upb_hash_init(&s);
+    upb_hash_bytes(&s, data->data, data->size);
+    return upb_hash_finish(&s);
+  }
+
+  return upb_msg_hash2(sub, subl, depth + 1);
+}
+
+/* Map values of message type have no layout to compare them by, so they are
+ * compared by identity. */
+static bool upb_eq_mapval(upb_fieldtype_t type, upb_msgval a, upb_msgval b) {
+  switch (type) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      return upb_eq_str(&a.str, &b.str);
+    case UPB_TYPE_MESSAGE:
+      return a.msg == b.msg;
+    default:
+      return memcmp(&a, &b, upb_msgval_sizeof(type)) == 0;
+  }
+}
+
+static void upb_hash_mapval(upb_hashstate *s, upb_fieldtype_t type,
+                            upb_msgval val) {
+  switch (type) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      upb_hash_u64(s, val.str.size);
+      upb_hash_bytes(s, val.str.data, val.str.size);
+      break;
+    case UPB_TYPE_MESSAGE:
+      upb_hash_u64(s, (uintptr_t)val.msg);
+      break;
+    default:
+      upb_hash_bytes(s, &val, upb_msgval_sizeof(type));
+      break;
+  }
+}
+
+static bool upb_eq_map(const upb_map *a, const upb_map *b) {
+  size_t len = a ? upb_map_size(a) : 0;
+  upb_mapiter i;
+
+  if ((b ? upb_map_size(b) : 0) != len) {
+    return false;
+  } else if (len == 0 || a == b) {
+    return true;
+  }
 
-static int upb_msg_internalsize(const upb_msglayout *l) {
-    return sizeof(upb_msg_internal) - l->data.extendable * sizeof(void*);
-}
+  for (upb_mapiter_begin(&i, a); !upb_mapiter_done(&i); upb_mapiter_next(&i)) {
+    upb_msgval val;
+    if (!upb_map_get(b, upb_mapiter_key(&i), &val) ||
+        !upb_eq_mapval(upb_map_valuetype(a), upb_mapiter_value(&i), val)) {
+      return false;
+    }
+  }
 
-static upb_msg_internal *upb_msg_getinternal(upb_msg *msg) {
-  return VOIDPTR_AT(msg, -sizeof(upb_msg_internal));
+  return true;
 }
 
-static const upb_msg_internal *upb_msg_getinternal_const(const upb_msg *msg) {
-  return VOIDPTR_AT(msg, -sizeof(upb_msg_internal));
-}
+/* Entries are hashed one by one and summed, so the result doesn't depend on
+ * the order the map keeps them in. */
+static void upb_hash_map(upb_hashstate *s, const upb_map *map) {
+  upb_mapiter i;
+  uint64_t sum = 0;
 
-static upb_msg_internal_withext *upb_msg_getinternalwithext(
-    upb_msg *msg, const upb_msglayout *l) {
-  UPB_ASSERT(l->data.extendable);
-  return VOIDPTR_AT(msg, -sizeof(upb_msg_internal_withext));
-}
+  if (!map) {
+    upb_hash_u64(s, 0);
+    upb_hash_u64(s, 0);
+    return;
+  }
 
-static const upb_msglayout_fieldinit_v1 *upb_msg_checkfield(
-    int field_index, const upb_msglayout *l) {
-  UPB_ASSERT(field_index >= 0 && field_index < l->data.field_count);
-  return &l->data.fields[field_index];
-}
+  for (upb_mapiter_begin(&i, map);
+       !upb_mapiter_done(&i);
+       upb_mapiter_next(&i)) {
+    upb_hashstate entry;
+    upb_hash_init(&entry);
+    upb_hash_mapval(&entry, upb_map_keytype(map), upb_mapiter_key(&i));
+    upb_hash_mapval(&entry, upb_map_valuetype(map), upb_mapiter_value(&i));
+    sum += upb_hash_finish(&entry);
+  }
 
-static bool upb_msg_inoneof(const upb_msglayout_fieldinit_v1 *field) {
-  return field->oneof_index != UPB_NOT_IN_ONEOF;
+  upb_hash_u64(s, upb_map_size(map));
+  upb_hash_u64(s, sum);
 }
 
-static uint32_t *upb_msg_oneofcase(const upb_msg *msg, int field_index,
-                                   const upb_msglayout *l) {
-  const upb_msglayout_fieldinit_v1 *field = upb_msg_checkfield(field_index, l);
-  UPB_ASSERT(upb_msg_inoneof(field));
-  return PTR_AT(msg, l->data.oneofs[field->oneof_index].case_offset, uint32_t);
-}
+/* A missing array or map equals an empty one.  Scalar elements are compared
+ * with one memcmp(). */
+static bool upb_eq_array(const upb_msg *owner_a, const upb_array *a,
+                         const upb_msg *owner_b, const upb_array *b,
+                         const upb_msglayout_fieldinit_v1 *field,
+                         const upb_msglayout_msginit_v1 *l, int depth) {
+  size_t len = a ? a->len : 0;
+  size_t i;
 
-size_t upb_msg_sizeof(const upb_msglayout *l) {
-  return l->data.size + upb_msg_internalsize(l);
+  if ((b ? b->len : 0) != len) {
+    return false;
+  } else if (len == 0 || a == b) {
+    return true;
+  }
+
+  switch (a->type) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      for (i = 0; i < len; i++) {
+        if (!upb_eq_str((const upb_stringview*)a->data + i,
+                        (const upb_stringview*)b->data + i)) {
+          return false;
+        }
+      }
+      return true;
+    case UPB_TYPE_MESSAGE:
+      for (i = 0; i < len; i++) {
+        if (!upb_eq_submsg(owner_a, (void**)a->data + i,
+                           owner_b, (void**)b->data + i,
+                           l->submsgs[field->submsg_index], depth)) {
+          return false;
+        }
+      }
+      return true;
+    default:
+      return memcmp(a->data, b->data, len * a->element_size) == 0;
+  }
 }
 
-upb_msg *upb_msg_init(void *mem, const upb_msglayout *l, upb_alloc *a) {
-  upb_msg *msg = VOIDPTR_AT(mem, upb_msg_internalsize(l));
+static void upb_hash_array(upb_hashstate *s, const upb_msg *owner,
+                           const upb_array *arr,
+                           const upb_msglayout_fieldinit_v1 *field,
+                           const upb_msglayout_msginit_v1 *l, int depth) {
+  size_t len = arr ? arr->len : 0;
+  size_t i;
 
-  /* Initialize normal members. */
-  if (l->data.default_msg) {
-    memcpy(msg, l->data.default_msg, l->data.size);
-  } else {
-    memset(msg, 0, l->data.size);
+  upb_hash_u64(s, len);
+  if (len == 0) {
+    return;
   }
 
-  /* Initialize internal members. */
-  upb_msg_getinternal(msg)->alloc = a;
+  switch (arr->type) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      for (i = 0; i < len; i++) {
+        const upb_stringview *str = (const upb_stringview*)arr->data + i;
+        upb_hash_u64(s, str->size);
+        upb_hash_bytes(s, str->data, str->size);
+      }
+      break;
+    case UPB_TYPE_MESSAGE:
+      for (i = 0; i < len; i++) {
+        upb_hash_u64(s, upb_hash_submsg(owner, (void**)arr->data + i,
+                                        l->submsgs[field->submsg_index],
+                                        depth));
+      }
+      break;
+    default:
+      upb_hash_bytes(s, arr->data, len * arr->element_size);
+      break;
+  }
+}
 
-  if (l->data.extendable) {
-    upb_msg_getinternalwithext(msg, l)->extdict = NULL;
+/* Compares the values at |ofs_a| in |a| and |ofs_b| in |b| of a field that is
+ * set in both. */
+static bool upb_eq_field(const upb_msg *a, int64_t ofs_a,
+                         const upb_msg *b, int64_t ofs_b,
+                         const upb_msglayout_fieldinit_v1 *field,
+                         const upb_msglayout_msginit_v1 *l, int depth) {
+  const void *slot_a = PTR_AT(a, ofs_a, const char);
+  const void *slot_b = PTR_AT(b, ofs_b, const char);
+
+  if (upb_eq_ismap(field, l)) {
+    return upb_eq_map(*(const upb_map**)slot_a, *(const upb_map**)slot_b);
+  } else if (field->label == UPB_LABEL_REPEATED) {
+    return upb_eq_array(a, *(const upb_array**)slot_a,
+                        b, *(const upb_array**)slot_b, field, l, depth);
   }
 
-  return msg;
+  switch (upb_desctype_to_fieldtype[field->type]) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES:
+      return upb_eq_str(slot_a, slot_b);
+    case UPB_TYPE_MESSAGE:
+      return upb_eq_submsg(a, slot_a, b, slot_b,
+                           l->submsgs[field->submsg_index], depth);
+    default:
+      return memcmp(slot_a, slot_b, upb_msg_fieldsize(field)) == 0;
+  }
 }
 
-void *upb_msg_uninit(upb_msg *msg, const upb_msglayout *l) {
-  if (l->data.extendable) {
-    upb_inttable *ext_dict = upb_msg_getinternalwithext(msg, l)->extdict;
-    if (ext_dict) {
-      upb_inttable_uninit2(ext_dict, upb_msg_alloc(msg));
-      upb_free(upb_msg_alloc(msg), ext_dict);
-    }
+static void upb_hash_field(upb_hashstate *s, const upb_msg *msg, int64_t ofs,
+                           const upb_msglayout_fieldinit_v1 *field,
+                           const upb_msglayout_msginit_v1 *l, int depth) {
+  const void *slot = PTR_AT(msg, ofs, const char);
+
+  upb_hash_u64(s, field->number);
+
+  if (upb_eq_ismap(field, l)) {
+    upb_hash_map(s, *(const upb_map**)slot);
+    return;
+  } else if (field->label == UPB_LABEL_REPEATED) {
+    upb_hash_array(s, msg, *(const upb_array**)slot, field, l, depth);
+    return;
   }
 
-  return VOIDPTR_AT(msg, -upb_msg_internalsize(l));
+  switch (upb_desctype_to_fieldtype[field->type]) {
+    case UPB_TYPE_STRING:
+    case UPB_TYPE_BYTES: {
+      const upb_stringview *str = slot;
+      upb_hash_u64(s, str->size);
+      upb_hash_bytes(s, str->data, str->size);
+      break;
+    }
+    case UPB_TYPE_MESSAGE:
+      upb_hash_u64(s, upb_hash_submsg(msg, slot,
+                                      l->submsgs[field->submsg_index], depth));
+      break;
+    default:
+      upb_hash_bytes(s, slot, upb_msg_fieldsize(field));
+      break;
+  }
 }
 
-upb_msg *upb_msg_new(const upb_msglayout *l, upb_alloc *a) {
-  void *mem = upb_malloc(a, upb_msg_sizeof(l));
-  return mem ? upb_msg_init(mem, l, a) : NULL;
-}
+/* Unknown fields are compared as one stream of bytes, however it is split
+ * into ranges. */
+static bool upb_eq_unknown(const upb_msg *a, const upb_msg *b) {
+  size_t count_a, count_b, i = 0, j = 0, ofs_a = 0, ofs_b = 0;
+  const upb_stringview *ua = upb_msg_getunknown(a, &count_a);
+  const upb_stringview *ub = upb_msg_getunknown(b, &count_b);
 
-void upb_msg_free(upb_msg *msg, const upb_msglayout *l) {
-  upb_free(upb_msg_alloc(msg), upb_msg_uninit(msg, l));
-}
+  while (true) {
+    size_t n;
 
-upb_alloc *upb_msg_alloc(const upb_msg *msg) {
-  return upb_msg_getinternal_const(msg)->alloc;
+    while (i < count_a && ofs_a == ua[i].size) i++, ofs_a = 0;
+    while (j < count_b && ofs_b == ub[j].size) j++, ofs_b = 0;
+
+    if (i == count_a || j == count_b) {
+      return i == count_a && j == count_b;
+    }
+
+    n = UPB_MIN(ua[i].size - ofs_a, ub[j].size - ofs_b);
+    if (memcmp(ua[i].data + ofs_a, ub[j].data + ofs_b, n) != 0) {
+      return false;
+    }
+    ofs_a += n;
+    ofs_b += n;
+  }
 }
 
-bool upb_msg_has(const upb_msg *msg,
-                 int field_index,
-                 const upb_msglayout *l) {
-  const upb_msglayout_fieldinit_v1 *field = upb_msg_checkfield(field_index, l);
+static bool upb_msg_equal2(const upb_msg *a, const upb_msg *b,
+                           const upb_msglayout_msginit_v1 *l, int depth) {
+  int i;
 
-  UPB_ASSERT(l->data.is_proto2);
+  CHECK_TRUE(depth <= ENCODE_MAX_NESTING);
 
-  if (upb_msg_inoneof(field)) {
-    /* Oneofs are set when the oneof number is set to this field. */
-    return *upb_msg_oneofcase(msg, field_index, l) == field->number;
-  } else {
-    /* Other fields are set when their hasbit is set. */
-    uint32_t hasbit = l->data.fields[field_index].hasbit;
-    return DEREF(msg, hasbit / 8, char) | (1 << (hasbit % 8));
+  if (a == b) {
+    return true;
   }
-}
 
-upb_msgval upb_msg_get(const upb_msg *msg, int field_index,
-                       const upb_msglayout *l) {
-  const upb_msglayout_fieldinit_v1 *field = upb_msg_checkfield(field_index, l);
-  int size = upb_msg_fieldsize(field);
+  /* Identical data (as after a copy that shares strings) means identical
+   * fields, whatever they hold. */
+  if (memcmp(a, b, l->size) == 0) {
+    return upb_eq_unknown(a, b);
+  }
 
-  if (upb_msg_inoneof(field)) {
-    if (*upb_msg_oneofcase(msg, field_index, l) == field->number) {
-      size_t ofs = l->data.oneofs[field->oneof_index].data_offset;
-      return upb_msgval_read(msg, ofs, size);
-    } else {
-      /* Return default. */
-      return upb_msgval_read(l->data.default_msg, field->offset, size);
+  if (l->hasbit_bytes > 0 && memcmp(a, b, l->hasbit_bytes) != 0) {
+    return false;
+  }
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_fieldinit_v1 *field = &l->fields[i];
+    int64_t ofs_a = upb_copy_fieldofs(a, field, l);
+    int64_t ofs_b = upb_copy_fieldofs(b, field, l);
+
+    if (ofs_a < 0 || ofs_b < 0) {
+      /* Only one side can have a given member of a oneof. */
+      CHECK_TRUE(ofs_a == ofs_b);
+      continue;
     }
-  } else {
-    return upb_msgval_read(msg, field->offset, size);
+
+    if (field->hasbit != UPB_NO_HASBIT) {
+      bool set = upb_eq_isset(a, field);
+      CHECK_TRUE(set == upb_eq_isset(b, field));
+      if (!set) continue;
+    }
+
+    CHECK_TRUE(upb_eq_field(a, ofs_a, b, ofs_b, field, l, depth));
   }
+
+  return upb_eq_unknown(a, b);
 }
 
-void upb_msg_set(upb_msg *msg, int field_index, upb_msgval val,
-                 const upb_msglayout *l) {
-  const upb_msglayout_fieldinit_v1 *field = upb_msg_checkfield(field_index, l);
-  int size = upb_msg_fieldsize(field);
+static uint64_t upb_msg_hash2(const upb_msg *msg,
+                              const upb_msglayout_msginit_v1 *l, int depth) {
+  upb_hashstate s;
+  const upb_stringview *unknown;
+  size_t i, count;
 
-  if (upb_msg_inoneof(field)) {
-    size_t ofs = l->data.oneofs[field->oneof_index].data_offset;
-    *upb_msg_oneofcase(msg, field_index, l) = field->number;
-    upb_msgval_write(msg, ofs, val, size);
-  } else {
-    upb_msgval_write(msg, field->offset, val, size);
+  upb_hash_init(&s);
+
+  if (depth > ENCODE_MAX_NESTING) {
+    return upb_hash_finish(&s);
+  }
+
+  for (i = 0; i < l->field_count; i++) {
+    const upb_msglayout_fieldinit_v1 *field = &l->fields[i];
+    int64_t ofs = upb_copy_fieldofs(msg, field, l);
+
+    if (ofs < 0 ||
+        (field->hasbit != UPB_NO_HASBIT && !upb_eq_isset(msg, field))) {
+      continue;
+    }
+
+    upb_hash_field(&s, msg, ofs, field, l, depth);
+  }
+
+  unknown = upb_msg_getunknown(msg, &count);
+  for (i = 0; i < count; i++) {
+    upb_hash_bytes(&s, unknown[i].data, unknown[i].size);
   }
+
+  return upb_hash_finish(&s);
+}
+
+bool upb_msg_equal(const upb_msg *a, const upb_msg *b,
+                   const upb_msglayout *l) {
+  return upb_msg_equal2(a, b, &l->data, 0);
 }
 
+uint64_t upb_msg_hash(const upb_msg *msg, const upb_msglayout *l) {
+  return upb_msg_hash2(msg, &l->data, 0);
+}
 
 /** upb_array *****************************************************************/
 
@@ -804,15 +3184,18 @@ size_t upb_array_sizeof(upb_fieldtype_t type) {
 
 void upb_array_init(upb_array *arr, upb_fieldtype_t type, upb_alloc *alloc) {
   arr->type = type;
-  arr->data = NULL;
-  arr->len = 0;
-  arr->size = 0;
   arr->element_size = upb_msgval_sizeof(type);
+  arr->data = &arr->inline_data;
+  arr->len = 0;
+  arr->pooled = 0;
+  arr->size = sizeof(arr->inline_data) / arr->element_size;
   arr->alloc = alloc;
 }
 
 void upb_array_uninit(upb_array *arr) {
-  upb_free(arr->alloc, arr->data);
+  if (arr->data != &arr->inline_data) {
+    upb_free(arr->alloc, arr->data);
+  }
 }
 
 upb_array *upb_array_new(upb_fieldtype_t type, upb_alloc *a) {
@@ -838,31 +3221,51 @@ upb_fieldtype_t upb_array_type(const upb_array *arr) {
   return arr->type;
 }
 
+const void *upb_array_data(const upb_array *arr) {
+  return arr->data;
+}
+
 upb_msgval upb_array_get(const upb_array *arr, size_t i) {
   UPB_ASSERT(i < arr->len);
   return upb_msgval_read(arr->data, i * arr->element_size, arr->element_size);
 }
 
+bool upb_array_reserve(upb_array *arr, size_t size) {
+  size_t new_bytes = size * arr->element_size;
+  void *new_data;
+
+  if (size <= arr->size) {
+    return true;
+  }
+
+  if (arr->data == &arr->inline_data) {
+    /* Moving out of the inline storage. */
+    new_data = upb_malloc(arr->alloc, new_bytes);
+    if (new_data) {
+      /* All of it, to keep any pooled messages past len. */
+      memcpy(new_data, arr->data, arr->size * arr->element_size);
+    }
+  } else {
+    size_t old_bytes = arr->size * arr->element_size;
+    new_data = upb_realloc(arr->alloc, arr->data, old_bytes, new_bytes);
+  }
+
+  if (!new_data) {
+    return false;
+  }
+
+  arr->data = new_data;
+  arr->size = size;
+  return true;
+}
+
 bool upb_array_set(upb_array *arr, size_t i, upb_msgval val) {
   UPB_ASSERT(i <= arr->len);
 
   if (i == arr->len) {
     /* Extending the array. */
-
-    if (i == arr->size) {
-      /* Need to reallocate. */
-      size_t new_size = UPB_MAX(arr->size * 2, 8);
-      size_t new_bytes = new_size * arr->element_size;
-      size_t old_bytes = arr->size * arr->element_size;
-      upb_msgval *new_data =
-          upb_realloc(arr->alloc, arr->data, old_bytes, new_bytes);
-
-      if (!new_data) {
-        return false;
-      }
-
-      arr->data = new_data;
-      arr->size = new_size;
+    if (i == arr->size && !upb_array_reserve(arr, arr->size * 2)) {
+      return false;
     }
 
     arr->len = i + 1;
@@ -875,15 +3278,6 @@ bool upb_array_set(upb_array *arr, size_t i, upb_msgval val) {
 
 /** upb_map *******************************************************************/
 
-struct upb_map {
-  upb_fieldtype_t key_type;
-  upb_fieldtype_t val_type;
-  /* We may want to optimize this to use inttable where possible, for greater
-   * efficiency and lower memory footprint. */
-  upb_strtable strtab;
-  upb_alloc *alloc;
-};
-
 static void upb_map_tokey(upb_fieldtype_t type, upb_msgval *key,
                           const char **out_key, size_t *out_len) {
   switch (type) {
@@ -932,6 +3326,46 @@ static upb_msgval upb_map_fromkey(upb_fieldtype_t type, const char *key,
   UPB_UNREACHABLE();
 }
 
+/* Whether keys of this type can be stored directly in an inttable. */
+static bool upb_map_intkeys(upb_fieldtype_t type) {
+  return type != UPB_TYPE_STRING &&
+         upb_msgval_sizeof(type) <= sizeof(uintptr_t);
+}
+
+static uintptr_t upb_map_tointkey(upb_fieldtype_t type, upb_msgval key) {
+  switch (type) {
+    case UPB_TYPE_BOOL:
+      return upb_msgval_getbool(key);
+    case UPB_TYPE_INT32:
+      return (uintptr_t)upb_msgval_getint32(key);
+    case UPB_TYPE_UINT32:
+      return upb_msgval_getuint32(key);
+    case UPB_TYPE_INT64:
+      return (uintptr_t)upb_msgval_getint64(key);
+    case UPB_TYPE_UINT64:
+      return (uintptr_t)upb_msgval_getuint64(key);
+    default:
+      UPB_UNREACHABLE();
+  }
+}
+
+static upb_msgval upb_map_fromintkey(upb_fieldtype_t type, uintptr_t key) {
+  switch (type) {
+    case UPB_TYPE_BOOL:
+      return upb_msgval_bool(key != 0);
+    case UPB_TYPE_INT32:
+      return upb_msgval_int32((int32_t)key);
+    case UPB_TYPE_UINT32:
+      return upb_msgval_uint32((uint32_t)key);
+    case UPB_TYPE_INT64:
+      return upb_msgval_int64((int64_t)key);
+    case UPB_TYPE_UINT64:
+      return upb_msgval_uint64(key);
+    default:
+      UPB_UNREACHABLE();
+  }
+}
+
 size_t upb_map_sizeof(upb_fieldtype_t ktype, upb_fieldtype_t vtype) {
   /* Size does not currently depend on key/value type. */
   UPB_UNUSED(ktype);
@@ -945,17 +3379,33 @@ bool upb_map_init(upb_map *map, upb_fieldtype_t ktype, upb_fieldtype_t vtype,
   UPB_ASSERT(upb_fieldtype_mapkeyok(ktype));
   map->key_type = ktype;
   map->val_type = vtype;
+  map->intkeys = upb_map_intkeys(ktype);
   map->alloc = a;
 
-  if (!upb_strtable_init2(&map->strtab, vtabtype, a)) {
-    return false;
+  if (map->intkeys) {
+    return upb_inttable_init2(&map->t.inttab, vtabtype, a);
+  } else {
+    return upb_strtable_init2(&map->t.strtab, vtabtype, a);
   }
-
-  return true;
 }
 
 void upb_map_uninit(upb_map *map) {
-  upb_strtable_uninit2(&map->strtab, map->alloc);
+  if (map->val_type == UPB_TYPE_STRING || map->val_type == UPB_TYPE_BYTES) {
+    upb_mapiter i;
+    for (upb_mapiter_begin(&i, map);
+         !upb_mapiter_done(&i);
+         upb_mapiter_next(&i)) {
+      upb_map_freeval(map, map->intkeys ?
+          upb_inttable_iter_value(&i.iter.i) :
+          upb_strtable_iter_value(&i.iter.str));
+    }
+  }
+
+  if (map->intkeys) {
+    upb_inttable_uninit2(&map->t.inttab, map->alloc);
+  } else {
+    upb_strtable_uninit2(&map->t.strtab, map->alloc);
+  }
 }
 
 upb_map *upb_map_new(upb_fieldtype_t ktype, upb_fieldtype_t vtype,
@@ -967,6 +3417,7 @@ upb_map *upb_map_new(upb_fieldtype_t ktype, upb_fieldtype_t vtype,
   }
 
   if (!upb_map_init(map, ktype, vtype, a)) {
+    upb_free(a, map);
     return NULL;
   }
 
@@ -979,7 +3430,11 @@ void upb_map_free(upb_map *map) {
 }
 
 size_t upb_map_size(const upb_map *map) {
-  return upb_strtable_count(&map->strtab);
+  if (map->intkeys) {
+    return upb_inttable_count(&map->t.inttab);
+  } else {
+    return upb_strtable_count(&map->t.strtab);
+  }
 }
 
 upb_fieldtype_t upb_map_keytype(const upb_map *map) {
@@ -992,14 +3447,20 @@ upb_fieldtype_t upb_map_valuetype(const upb_map *map) {
 
 bool upb_map_get(const upb_map *map, upb_msgval key, upb_msgval *val) {
   upb_value tabval;
-  const char *key_str;
-  size_t key_len;
   bool ret;
 
-  upb_map_tokey(map->key_type, &key, &key_str, &key_len);
-  ret = upb_strtable_lookup2(&map->strtab, key_str, key_len, &tabval);
+  if (map->intkeys) {
+    uintptr_t intkey = upb_map_tointkey(map->key_type, key);
+    ret = upb_inttable_lookup(&map->t.inttab, intkey, &tabval);
+  } else {
+    const char *key_str;
+    size_t key_len;
+    upb_map_tokey(map->key_type, &key, &key_str, &key_len);
+    ret = upb_strtable_lookup2(&map->t.strtab, key_str, key_len, &tabval);
+  }
+
   if (ret) {
-    memcpy(val, &tabval, sizeof(tabval));
+    *val = upb_msgval_fromval(map->val_type, tabval);
   }
 
   return ret;
@@ -1009,45 +3470,87 @@ bool upb_map_set(upb_map *map, upb_msgval key, upb_msgval val,
                  upb_msgval *removed) {
   const char *key_str;
   size_t key_len;
-  upb_value tabval = upb_toval(val);
+  upb_value tabval;
   upb_value removedtabval;
   upb_alloc *a = map->alloc;
+  bool ok;
+
+  if (!upb_toval(map->val_type, val, a, &tabval)) {
+    return false;
+  }
 
-  upb_map_tokey(map->key_type, &key, &key_str, &key_len);
+  if (map->intkeys) {
+    /* The inttable can overwrite in place, which saves us a removal. */
+    uintptr_t intkey = upb_map_tointkey(map->key_type, key);
+    if (upb_inttable_lookup(&map->t.inttab, intkey, &removedtabval)) {
+      if (removed) {
+        *removed = upb_msgval_fromval(map->val_type, removedtabval);
+      }
+      upb_map_freeval(map, removedtabval);
+      return upb_inttable_replace(&map->t.inttab, intkey, tabval);
+    }
+    ok = upb_inttable_insert2(&map->t.inttab, intkey, tabval, a);
+  } else {
+    upb_map_tokey(map->key_type, &key, &key_str, &key_len);
+
+    /* TODO(haberman): add overwrite operation to minimize number of
+     * lookups. */
+    if (upb_strtable_lookup2(&map->t.strtab, key_str, key_len, NULL)) {
+      upb_strtable_remove3(&map->t.strtab, key_str, key_len, &removedtabval,
+                           a);
+      if (removed) {
+        *removed = upb_msgval_fromval(map->val_type, removedtabval);
+      }
+      upb_map_freeval(map, removedtabval);
+    }
 
-  /* TODO(haberman): add overwrite operation to minimize number of lookups. */
-  if (upb_strtable_lookup2(&map->strtab, key_str, key_len, NULL)) {
-    upb_strtable_remove3(&map->strtab, key_str, key_len, &removedtabval, a);
-    memcpy(&removed, &removedtabval, sizeof(removed));
+    ok = upb_strtable_insert3(&map->t.strtab, key_str, key_len, tabval, a);
   }
 
-  return upb_strtable_insert3(&map->strtab, key_str, key_len, tabval, a);
+  if (!ok) {
+    upb_map_freeval(map, tabval);
+  }
+  return ok;
 }
 
 bool upb_map_del(upb_map *map, upb_msgval key) {
   const char *key_str;
   size_t key_len;
+  upb_value removedtabval;
   upb_alloc *a = map->alloc;
+  bool ret;
+
+  if (map->intkeys) {
+    uintptr_t intkey = upb_map_tointkey(map->key_type, key);
+    ret = upb_inttable_remove(&map->t.inttab, intkey, &removedtabval);
+  } else {
+    upb_map_tokey(map->key_type, &key, &key_str, &key_len);
+    ret = upb_strtable_remove3(&map->t.strtab, key_str, key_len,
+                               &removedtabval, a);
+  }
 
-  upb_map_tokey(map->key_type, &key, &key_str, &key_len);
-  return upb_strtable_remove3(&map->strtab, key_str, key_len, NULL, a);
+  if (ret) {
+    upb_map_freeval(map, removedtabval);
+  }
+  return ret;
 }
 
 
 /** upb_mapiter ***************************************************************/
 
-struct upb_mapiter {
-  upb_strtable_iter iter;
-  upb_fieldtype_t key_type;
-};
-
 size_t upb_mapiter_sizeof() {
   return sizeof(upb_mapiter);
 }
 
 void upb_mapiter_begin(upb_mapiter *i, const upb_map *map) {
-  upb_strtable_begin(&i->iter, &map->strtab);
   i->key_type = map->key_type;
+  i->val_type = map->val_type;
+  i->intkeys = map->intkeys;
+  if (i->intkeys) {
+    upb_inttable_begin(&i->iter.i, &map->t.inttab);
+  } else {
+    upb_strtable_begin(&i->iter.str, &map->t.strtab);
+  }
 }
 
 upb_mapiter *upb_mapiter_new(const upb_map *t, upb_alloc *a) {
@@ -1066,28 +3569,56 @@ void upb_mapiter_free(upb_mapiter *i, upb_alloc *a) {
 }
 
 void upb_mapiter_next(upb_mapiter *i) {
-  upb_strtable_next(&i->iter);
+  if (i->intkeys) {
+    upb_inttable_next(&i->iter.i);
+  } else {
+    upb_strtable_next(&i->iter.str);
+  }
 }
 
 bool upb_mapiter_done(const upb_mapiter *i) {
-  return upb_strtable_done(&i->iter);
+  if (i->intkeys) {
+    return upb_inttable_done(&i->iter.i);
+  } else {
+    return upb_strtable_done(&i->iter.str);
+  }
 }
 
 upb_msgval upb_mapiter_key(const upb_mapiter *i) {
-  return upb_map_fromkey(i->key_type, upb_strtable_iter_key(&i->iter),
-                         upb_strtable_iter_keylength(&i->iter));
+  if (i->intkeys) {
+    return upb_map_fromintkey(i->key_type, upb_inttable_iter_key(&i->iter.i));
+  } else {
+    return upb_map_fromkey(i->key_type, upb_strtable_iter_key(&i->iter.str),
+                           upb_strtable_iter_keylength(&i->iter.str));
+  }
 }
 
 upb_msgval upb_mapiter_value(const upb_mapiter *i) {
-  return upb_msgval_fromval(upb_strtable_iter_value(&i->iter));
+  if (i->intkeys) {
+    return upb_msgval_fromval(i->val_type,
+                              upb_inttable_iter_value(&i->iter.i));
+  } else {
+    return upb_msgval_fromval(i->val_type,
+                              upb_strtable_iter_value(&i->iter.str));
+  }
 }
 
 void upb_mapiter_setdone(upb_mapiter *i) {
-  upb_strtable_iter_setdone(&i->iter);
+  if (i->intkeys) {
+    upb_inttable_iter_setdone(&i->iter.i);
+  } else {
+    upb_strtable_iter_setdone(&i->iter.str);
+  }
 }
 
 bool upb_mapiter_isequal(const upb_mapiter *i1, const upb_mapiter *i2) {
-  return upb_strtable_iter_isequal(&i1->iter, &i2->iter);
+  if (i1->intkeys != i2->intkeys) {
+    return false;
+  } else if (i1->intkeys) {
+    return upb_inttable_iter_isequal(&i1->iter.i, &i2->iter.i);
+  } else {
+    return upb_strtable_iter_isequal(&i1->iter.str, &i2->iter.str);
+  }
 }
 
 
@@ -1103,7 +3634,7 @@ typedef struct {
   bool upb_msg_set ## type (void *c, const void *hd, ctype val) {             \
     uint8_t *m = c;                                                           \
     const upb_msg_handlerdata *d = hd;                                        \
-    if (d->hasbit > 0)                                                        \
+    if (d->hasbit >= 0)                                                       \
       *(uint8_t*)&m[d->hasbit / 8] |= 1 << (d->hasbit % 8);                   \
     *(ctype*)&m[d->offset] = val;                                             \
     return true;                                                              \
@@ -1129,6 +3660,7 @@ bool upb_msg_setscalarhandler(upb_handlers *h, const upb_fielddef *f,
 
   upb_handlerattr_sethandlerdata(&attr, d);
   upb_handlerattr_setalwaysok(&attr, true);
+  upb_handlerattr_setstore(&attr, offset, hasbit);
   upb_handlers_addcleanup(h, d, upb_gfree);
 
 #define TYPE(u, l) \
@@ -32,12 +32,23 @@
 
 #ifdef __cplusplus
 
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
 namespace upb {
 class Array;
+template <class T> class ArrayView;
 class Map;
 class MapIterator;
+template <class V> class MessageArrayView;
 class MessageFactory;
 class MessageLayout;
+template <class V> class Owned;
+class StringView;
 class Visitor;
 class VisitorPlan;
 }
@@ -69,12 +80,24 @@ typedef void upb_msg;
 /** upb_visitor ***************************************************************/
 
 /* upb_visitor will visit all the fields of a message and its submessages.  It
- * uses a upb_visitorplan which you can obtain from a upb_msgfactory. */
+ * uses a upb_visitorplan which you can obtain from a upb_msgfactory.
+ *
+ * Fields are visited in the same order that upb_encode() writes them in,
+ * followed by the message's unknown fields.  Lazy submessages are parsed on
+ * the way, as by upb_msg_get(). */
 
 upb_visitor *upb_visitor_create(upb_env *e, const upb_visitorplan *vp,
                                 upb_sink *output);
 bool upb_visitor_visitmsg(upb_visitor *v, const upb_msg *msg);
 
+/* By default map entries are visited in the map's iteration order, which
+ * depends on its history, so equal messages can serialize differently.  A
+ * deterministic visitor visits them sorted by key instead, as protobuf's
+ * deterministic serialization does: numerically for integers, false before
+ * true, and bytewise for strings.  The keys are radix sorted in scratch space
+ * from the visitor's env, which costs a copy of each map's entries. */
+void upb_visitor_setdeterministic(upb_visitor *v, bool deterministic);
+
 
 /** upb_msgfactory ************************************************************/
 
@@ -92,16 +115,25 @@ void upb_msgfactory_free(upb_msgfactory *f);
 
 const upb_symtab *upb_msgfactory_symtab(const upb_msgfactory *f);
 
+/* Creates the layout, merge handlers and visitorplan of every message in the
+ * symtab up front.  After this the factory is never modified again, so the
+ * functions below only read it and may be called from any number of threads
+ * at once; they must only be passed messages from the symtab.  Returns false
+ * if creating handlers failed. */
+bool upb_msgfactory_freeze(upb_msgfactory *f);
+bool upb_msgfactory_isfrozen(const upb_msgfactory *f);
+
 /* The functions to get cached objects, lazily creating them on demand.  These
  * all require:
  *
  * - m is in upb_msgfactory_symtab(f)
  * - upb_msgdef_mapentry(m) == false (since map messages can't have layouts).
  *
- * The returned objects will live for as long as the msgfactory does.
+ * The returned objects will live for as long as the msgfactory does.  Each
+ * one is created once and cached, so calling these again for the same message
+ * returns the same object.
  *
- * TODO(haberman): consider making this thread-safe and take a const
- * upb_msgfactory. */
+ * These are not thread-safe unless the msgfactory is frozen. */
 const upb_msglayout *upb_msgfactory_getlayout(upb_msgfactory *f,
                                               const upb_msgdef *m);
 const upb_handlers *upb_msgfactory_getmergehandlers(upb_msgfactory *f,
@@ -237,6 +269,11 @@ void *upb_msg_pack(const upb_msg *msg, const upb_msglayout *l,
  *   - return upb_msg*, or upb_map* for msg/map.
  *     If the field is unset for these field types, returns NULL.
  *
+ * A submessage that upb_decode() left serialized (upb_decodeopts.lazy) is
+ * parsed into the message's allocator here, the first time it is read, and
+ * reads as NULL if it doesn't parse.  So this is only "read-only" in the
+ * sense that the field keeps its value.
+ *
  * TODO(haberman): should we let users store cached array/map/msg
  * pointers here for fields that are unset?  Could be useful for the
  * strongly-owned submessage model (ie. generated C API that doesn't use
@@ -273,14 +310,121 @@ bool upb_msg_clearfield(upb_msg *msg,
                         int field_index,
                         const upb_msglayout *l);
 
-/* TODO(haberman): copyfrom()/mergefrom()? */
+/* Clears every field of |msg|, like Clear() in other protobuf implementations,
+ * but keeps the memory it points to so that decoding into it again doesn't
+ * allocate it again.  Repeated fields keep their arrays, with their messages
+ * cleared in place for the decoder to reuse in order, and singular
+ * submessages with a hasbit are cleared in place too.  Maps, lazy
+ * submessages and the members of oneofs are dropped.  Unknown fields keep
+ * their list but not its entries.
+ *
+ * upb_msg_get() still returns a cleared submessage, as an empty message, so
+ * its presence has to be read from its hasbit (upb_msg_has() for proto2)
+ * rather than from the pointer.  Since submessages are
+ * cleared in place, none of them may be shared with another message. */
+void upb_msg_clear(upb_msg *msg, const upb_msglayout *l);
+
+/* Unknown fields.  These are kept as a list of ranges of serialized protobuf
+ * data that the message does not copy: the data must outlive the message, as
+ * the input buffer does when upb_decode() aliases it.  A range that starts
+ * where the previous one ends is merged into it, so a run of unknown fields
+ * costs a single entry.  The encoder writes the ranges back out verbatim
+ * after the known fields. */
+bool upb_msg_addunknown(upb_msg *msg, const char *data, size_t len);
+const upb_stringview *upb_msg_getunknown(const upb_msg *msg, size_t *count);
+
+/* For messages decoded with upb_decodeopts.cache: records that |msg| has
+ * changed, so that it and every message it is a submessage of are encoded
+ * from their fields again instead of from the bytes they were decoded from.
+ * upb_msg_set(), upb_msg_clearfield(), upb_msg_addunknown() and
+ * upb_msg_merge() call this themselves.  Code that changes a message any
+ * other way, such as through generated accessors or by changing one of its
+ * arrays or maps in place, must call it too.  Does nothing for other
+ * messages. */
+void upb_msg_markdirty(upb_msg *msg);
+
+/* Deep copy and merge.  These are driven by the layout alone: a copy starts
+ * with one memcpy() of the message's data, and only its strings, arrays,
+ * submessages and unknown fields are visited after that.
+ *
+ * New memory comes from |a| for upb_msg_copy() and from the allocator of |to|
+ * for upb_msg_merge().  It is not freed again on failure, so this allocator
+ * should normally be an arena.
+ *
+ * If |share_strings| is true, strings, unknown fields and lazy submessages
+ * point to the same data as in the source message, which must then outlive
+ * the result.  Otherwise that data is copied too. */
+
+/* Returns a new message, allocated like upb_msg_new(), with the same contents
+ * as |msg|.  Returns NULL if out of memory. */
+upb_msg *upb_msg_copy(const upb_msg *msg, const upb_msglayout *l,
+                      bool share_strings, upb_alloc *a);
+
+/* Merges |from| into |to| like MergeFrom() in other protobuf implementations.
+ * Singular fields that are set in |from| overwrite the ones in |to|, except
+ * that submessages are merged recursively.  Repeated fields and unknown fields
+ * are appended.  Returns false if out of memory, leaving |to| partly merged. */
+bool upb_msg_merge(upb_msg *to, const upb_msg *from, const upb_msglayout *l,
+                   bool share_strings);
+
+/* Equality and hashing, driven by the layout like copy and merge, so two
+ * messages can be compared without serializing them.  Two messages are equal
+ * if the same fields are set to the same values and their unknown fields are
+ * the same bytes; equal messages hash the same.  Floating-point values
+ * compare by their bits, as their serializations would.  Map values that are
+ * messages compare by identity, since map entries have no layout yet.
+ *
+ * Lazy submessages are parsed as upb_msg_get() parses them, so these write to
+ * the messages in the same way. */
+bool upb_msg_equal(const upb_msg *a, const upb_msg *b, const upb_msglayout *l);
+
+/* A 64-bit hash of the message's contents.  It doesn't depend on the order of
+ * map entries or on a random seed, nor on addresses except for those message
+ * map values, so it is the same in every process on the same platform. */
+uint64_t upb_msg_hash(const upb_msg *msg, const upb_msglayout *l);
+
+/* Frozen messages: a message tree laid out in one contiguous, read-only
+ * buffer that can be written to a file and later read in place after mmap(),
+ * with no parsing.  Each message in the buffer has the same layout as
+ * in memory, but every pointer is stored as the distance from its own slot to
+ * its target, so the buffer can be read at any address.
+ *
+ * Reading a frozen message needs the same layout it was frozen with, on a
+ * platform with the same pointer size and byte order.  Scalar fields and
+ * presence read as usual with upb_msg_get() and upb_msg_has(); strings,
+ * submessages and repeated fields have to be read with the upb_frozen_*()
+ * functions below.  The buffer is trusted: only its header is checked. */
+
+/* Returns a frozen copy of |msg| allocated from |env|, storing its size in
+ * |*size|, or NULL on failure.  Unknown fields are not kept, and messages with
+ * a map field set cannot be frozen yet. */
+char *upb_msg_freeze(const upb_msg *msg, const upb_msglayout *l, upb_env *env,
+                     size_t *size);
+
+/* Returns the root message of the frozen buffer [buf, buf+size), or NULL if it
+ * wasn't frozen with a layout like |l| on a platform like this one.  |buf|
+ * must be 8-byte aligned, as mmap() and malloc() return it. */
+const upb_msg *upb_frozen_root(const void *buf, size_t size,
+                               const upb_msglayout *l);
+
+/* Like upb_msg_get(), for a field of a frozen message that isn't repeated.
+ * Submessages are frozen messages too. */
+upb_msgval upb_frozen_get(const upb_msg *msg, int field_index,
+                          const upb_msglayout *l);
+
+/* The elements of a repeated field of a frozen message. */
+size_t upb_frozen_arraysize(const upb_msg *msg, int field_index,
+                            const upb_msglayout *l);
+upb_msgval upb_frozen_getelem(const upb_msg *msg, int field_index, size_t i,
+                              const upb_msglayout *l);
 
 
 /** upb_array *****************************************************************/
 
 /* A upb_array stores data for a repeated field.  The memory management
  * semantics are the same as upb_msg.  A upb_array allocates dynamic
- * memory internally for the array elements. */
+ * memory internally for the array elements, except for the first few, which
+ * are stored inside the upb_array itself. */
 
 size_t upb_array_sizeof(upb_fieldtype_t type);
 void upb_array_init(upb_array *arr, upb_fieldtype_t type, upb_alloc *a);
@@ -294,11 +438,20 @@ size_t upb_array_size(const upb_array *arr);
 upb_fieldtype_t upb_array_type(const upb_array *arr);
 upb_msgval upb_array_get(const upb_array *arr, size_t i);
 
+/* The elements as a C array of upb_array_size() elements: upb_stringview for
+ * strings and bytes, upb_msg* for messages, and the natural C type (int32_t
+ * for enums) for everything else.  Valid until the array is next modified. */
+const void *upb_array_data(const upb_array *arr);
+
 /* Write interface.  May only be called by the message's owner who can enforce
  * its memory management invariants. */
 
 bool upb_array_set(upb_array *arr, size_t i, upb_msgval val);
 
+/* Makes room for at least |size| elements, so that the array can grow to that
+ * size without reallocating.  Returns false on allocation failure. */
+bool upb_array_reserve(upb_array *arr, size_t size);
+
 
 /** upb_map *******************************************************************/
 
@@ -364,12 +517,14 @@ bool upb_mapiter_isequal(const upb_mapiter *i1, const upb_mapiter *i2);
  * They write scalar data to a known offset from the message pointer.
  *
  * These would be trivial for anyone to implement themselves, but it's better
- * to use these because some JITs will recognize and specialize these instead
- * of actually calling the function. */
+ * to use these because the pb decoder (both the bytecode interpreter and the
+ * JIT) will recognize and specialize these instead of actually calling the
+ * function. */
 
 /* Sets a handler for the given primitive field that will write the data at the
- * given offset.  If hasbit > 0, also sets a hasbit at the given bit offset
- * (addressing each byte low to high). */
+ * given offset.  If hasbit >= 0, also sets a hasbit at the given bit offset
+ * (addressing each byte low to high).  The handler carries a store attribute
+ * (see upb_handlerattr_setstore()) describing exactly this. */
 bool upb_msg_setscalarhandler(upb_handlers *h,
                               const upb_fielddef *f,
                               size_t offset,
@@ -389,6 +544,7 @@ bool upb_msg_getscalarhandlerdata(const upb_handlers *h,
 #define UPB_NOT_IN_ONEOF UINT16_MAX
 #define UPB_NO_HASBIT UINT16_MAX
 #define UPB_NO_SUBMSG UINT16_MAX
+#define UPB_NO_FIELD UINT16_MAX
 
 typedef struct {
   uint32_t number;
@@ -417,18 +573,281 @@ typedef struct upb_msglayout_msginit_v1 {
   uint16_t oneof_count;
   bool extendable;
   bool is_proto2;
+  /* Optional lookup from field number to index in |fields|, filled in by
+   * upb_msglayout_frominit_v1() and the msgfactory, and emitted statically by
+   * upbc.  For n < dense_below, field_lookup[n] is the index of field number
+   * n or UPB_NO_FIELD.  Larger field numbers, or all of them if this is NULL,
+   * are found by scanning. */
+  const uint16_t *field_lookup;
+  uint32_t dense_below;
+  /* Optional presence map, filled in along with field_lookup for proto2
+   * messages of up to UPB_PRESENCE_MAXFIELDS fields, so the encoder and the
+   * visitor only have to look at the fields that are present.  If
+   * check_fields isn't NULL, it is a bitmap of the fields without a hasbit
+   * (repeated fields and oneof members), which have to be checked one by one.
+   * The hasbits take up the first |hasbit_bytes| of the message, and
+   * hasbit_fields[n] is the index of the field whose hasbit is n, or
+   * UPB_NO_FIELD. */
+  const uint16_t *hasbit_fields;
+  const uint64_t *check_fields;
+  uint32_t hasbit_bytes;
 } upb_msglayout_msginit_v1;
 
+#define UPB_PRESENCE_MAXFIELDS 512
+
 #define UPB_ALIGN_UP_TO(val, align) ((val + (align - 1)) & -align)
 #define UPB_ALIGNED_SIZEOF(type) UPB_ALIGN_UP_TO(sizeof(type), sizeof(void*))
 
-/* Initialize/uninitialize a msglayout from a msginit.  If upb uses v1
- * internally, this will not allocate any memory.  Should only be used by
+/* Initialize/uninitialize a msglayout from a msginit.  The only memory this
+ * allocates is the field number lookup table.  Should only be used by
  * generated code. */
 upb_msglayout *upb_msglayout_frominit_v1(
     const upb_msglayout_msginit_v1 *init, upb_alloc *a);
 void upb_msglayout_uninit_v1(upb_msglayout *layout, upb_alloc *a);
 
+/* Lays out a msginit that is being built at runtime.  The caller sets its
+ * submsgs, field_count, oneof_count and is_proto2, and the number, type,
+ * label, oneof_index and submsg_index of each of the "fields"; this assigns
+ * hasbits and offsets the same way the msgfactory does, fills in the oneofs
+ * and the size, and builds the lookup tables with "a". */
+bool upb_msglayout_place_v1(upb_msglayout_msginit_v1 *init,
+                            upb_msglayout_fieldinit_v1 *fields,
+                            upb_msglayout_oneofinit_v1 *oneofs,
+                            upb_alloc *a);
+
+/* An extension of the message |extendee|, which must be extendable.  |submsg|
+ * is the extension's message type for UPB_DESCRIPTOR_TYPE_MESSAGE and
+ * UPB_DESCRIPTOR_TYPE_GROUP, and NULL otherwise. */
+typedef struct {
+  const upb_msglayout_msginit_v1 *extendee;
+  const upb_msglayout_msginit_v1 *submsg;
+  uint32_t number;
+  uint8_t type;
+  uint8_t label;
+} upb_msglayout_extinit_v1;
+
+
+/** upb_extreg ****************************************************************/
+
+/* A registry of the extensions that upb_decode() parses (see
+ * upb_decodeopts.extreg), keyed by extendee and field number.  Any other
+ * field that a message's layout doesn't have stays an unknown field, as
+ * before.
+ *
+ * A parsed extension's value is kept in the message, where
+ * upb_msg_getext() finds it with one hash lookup.  Its bytes are kept as an
+ * unknown field as well, so the message still encodes them, and the value is
+ * read-only: changing it does not change what upb_encode() writes. */
+
+typedef struct upb_extreg upb_extreg;
+typedef struct upb_msgext upb_msgext;
+
+upb_extreg *upb_extreg_new(upb_alloc *a);
+void upb_extreg_free(upb_extreg *r);
+
+/* Registers the extension |init|, and returns its handle for
+ * upb_msg_getext(), which lives as long as |r|.  Returns NULL if out of
+ * memory, if |init| is malformed, or if its extendee already has an
+ * extension with this number. */
+const upb_msgext *upb_extreg_add(upb_extreg *r,
+                                 const upb_msglayout_extinit_v1 *init);
+
+/* Returns extension |number| of |extendee|, or NULL if there is none.  This
+ * doesn't change |r|, so it is safe while other threads decode with it. */
+const upb_msgext *upb_extreg_lookup(const upb_extreg *r,
+                                    const upb_msglayout_msginit_v1 *extendee,
+                                    uint32_t number);
+
+const upb_msglayout_extinit_v1 *upb_msgext_init(const upb_msgext *ext);
+
+/* The value of extension |ext| in |msg|, whose layout |l| must be its
+ * extendee, as upb_msg_get() would return it for a field of the extension's
+ * type and label.  An extension that |msg| doesn't have reads as zero, or as
+ * NULL for strings, arrays and messages. */
+bool upb_msg_hasext(const upb_msg *msg, const upb_msglayout *l,
+                    const upb_msgext *ext);
+upb_msgval upb_msg_getext(const upb_msg *msg, const upb_msglayout *l,
+                          const upb_msgext *ext);
+
 UPB_END_EXTERN_C
 
+#ifdef __cplusplus
+
+/* Support for the C++ views that upbc generates alongside each message's
+ * struct (see tools/make_c_api.lua).  A view is a pointer to the generated
+ * struct with accessors that forward to the generated UPB_INLINE functions,
+ * so it compiles to the same field loads and stores as the C code.  FooView
+ * is read-only and FooMutView adds the setters; both can be copied freely
+ * and, like the structs they point to, own nothing. */
+
+/* upb::StringView is the value of a string or bytes field, like
+ * std::string_view (which it converts to and from in C++17).  The data
+ * belongs to the message's arena, or to the input buffer of a parsed
+ * message. */
+class upb::StringView {
+ public:
+  StringView() : view_(upb_stringview_make(NULL, 0)) {}
+  StringView(upb_stringview view) : view_(view) {}
+  StringView(const char *data, size_t size)
+      : view_(upb_stringview_make(data, size)) {}
+#if __cplusplus >= 201703L
+  StringView(std::string_view str)
+      : view_(upb_stringview_make(str.data(), str.size())) {}
+  operator std::string_view() const {
+    return std::string_view(view_.data, view_.size);
+  }
+#endif
+
+  operator upb_stringview() const { return view_; }
+
+  const char *data() const { return view_.data; }
+  size_t size() const { return view_.size; }
+  bool empty() const { return view_.size == 0; }
+  const char *begin() const { return view_.data; }
+  const char *end() const { return view_.data + view_.size; }
+  char operator[](size_t i) const { return view_.data[i]; }
+
+  std::string ToString() const { return std::string(view_.data, view_.size); }
+
+ private:
+  upb_stringview view_;
+};
+
+/* upb::ArrayView<T> is the value of a repeated scalar or string field: a span
+ * over the upb_array's elements (std::span<const T> in C++20).  A NULL array,
+ * as an unset repeated field has, is empty. */
+template <class T> class upb::ArrayView {
+ public:
+  typedef const T *iterator;
+
+  ArrayView() : data_(NULL), size_(0) {}
+  ArrayView(const T *data, size_t size) : data_(data), size_(size) {}
+  ArrayView(const upb_array *arr)
+      : data_(arr ? static_cast<const T *>(upb_array_data(arr)) : NULL),
+        size_(arr ? upb_array_size(arr) : 0) {}
+#if __cplusplus >= 202002L
+  operator std::span<const T>() const {
+    return std::span<const T>(data_, size_);
+  }
+#endif
+
+  const T *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  iterator begin() const { return data_; }
+  iterator end() const { return data_ + size_; }
+  const T& operator[](size_t i) const { return data_[i]; }
+
+ private:
+  const T *data_;
+  size_t size_;
+};
+
+/* upb::MessageArrayView<V> is the value of a repeated message field, whose
+ * elements it yields as views of type V. */
+template <class V> class upb::MessageArrayView {
+ public:
+  typedef typename V::CType CType;
+
+  class iterator {
+   public:
+    explicit iterator(CType *const *p) : p_(p) {}
+    V operator*() const { return V(*p_); }
+    iterator& operator++() { ++p_; return *this; }
+    bool operator==(const iterator& other) const { return p_ == other.p_; }
+    bool operator!=(const iterator& other) const { return p_ != other.p_; }
+
+   private:
+    CType *const *p_;
+  };
+
+  MessageArrayView() : data_(NULL), size_(0) {}
+  MessageArrayView(const upb_array *arr)
+      : data_(arr ? static_cast<CType *const *>(upb_array_data(arr)) : NULL),
+        size_(arr ? upb_array_size(arr) : 0) {}
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  iterator begin() const { return iterator(data_); }
+  iterator end() const { return iterator(data_ + size_); }
+  V operator[](size_t i) const { return V(data_[i]); }
+
+ private:
+  CType *const *data_;
+  size_t size_;
+};
+
+/* upb::Owned<V> is a message, of the type that view V refers to, bundled with
+ * the upb::Environment whose arena it and all of its strings, arrays and
+ * submessages are allocated from, so the whole tree is freed together when the
+ * Owned is destroyed.  It can be moved (in C++11) but not copied, and "->"
+ * reaches the message's accessors:
+ *
+ *   upb::Owned<google::protobuf::FileDescriptorSetView> set;
+ *   if (set.Parse(buf)) printf("%zu files\n", set->file().size());
+ */
+template <class V> class upb::Owned {
+ public:
+  typedef typename V::Mut Mut;
+
+  /* An empty message. */
+  Owned() : env_(new Environment()), view_(V::New(env_)) {}
+  ~Owned() { delete env_; }
+
+#ifdef UPB_CXX11
+  Owned(Owned&& other) : env_(other.env_), view_(other.view_) {
+    other.env_ = NULL;
+    other.view_ = Mut();
+  }
+  Owned& operator=(Owned&& other) {
+    Environment *env = env_;
+    Mut view = view_;
+    env_ = other.env_;
+    view_ = other.view_;
+    other.env_ = env;
+    other.view_ = view;
+    return *this;
+  }
+#endif
+
+  /* Replaces the message with one parsed from |buf|, freeing the old one.  The
+   * message's strings alias |buf|, which must outlive it.  On failure returns
+   * false and leaves an empty message. */
+  bool Parse(StringView buf) {
+    typename V::CType *msg;
+    bool ok;
+    env_->Reset();
+    msg = V::ParseNew(buf, env_);
+    ok = msg != NULL;
+    if (!ok) {
+      env_->Reset();
+      msg = V::New(env_);
+    }
+    view_ = Mut(msg);
+    return ok;
+  }
+
+  /* Serializes the message into a buffer from its arena, which is valid until
+   * the next Parse() or the Owned's destruction.  Returns NULL on failure. */
+  char *Serialize(size_t *len) { return V::Serialize(view_.ptr(), env_, len); }
+
+  /* For allocating the strings and arrays the setters take, which must come
+   * from this arena (or outlive the message). */
+  Environment *env() const { return env_; }
+  Arena *arena() const { return env_->arena(); }
+
+  V view() const { return view_; }
+  Mut mutable_view() { return view_; }
+  const V *operator->() const { return &view_; }
+  const Mut *operator->() { return &view_; }
+
+ private:
+  Environment *env_;
+  Mut view_;
+
+  UPB_DISALLOW_COPY_AND_ASSIGN(Owned)
+};
+
+#endif  /* __cplusplus */
+
 #endif /* UPB_MSG_H_ */
@@ -13,6 +13,7 @@
 */
 
 #include <stdarg.h>
+#include <stdlib.h>
 #include "upb/pb/decoder.int.h"
 #include "upb/pb/varint.int.h"
 
@@ -53,6 +54,10 @@ mgroup *newgroup(const void *owner) {
   upb_inttable_init(&g->methods, UPB_CTYPE_PTR);
   g->bytecode = NULL;
   g->bytecode_end = NULL;
+  g->profile = NULL;
+#ifdef UPB_USE_JIT_X64
+  g->jit_code = NULL;
+#endif
   return g;
 }
 
@@ -121,7 +126,7 @@ const upb_pbdecodermethod *upb_pbdecodermethod_new(
 
   upb_pbcodecache_init(&cache);
   ret = upb_pbcodecache_getdecodermethod(&cache, opts);
-  upb_pbdecodermethod_ref(ret, owner);
+  if (ret) upb_pbdecodermethod_ref(ret, owner);
   upb_pbcodecache_uninit(&cache);
   return ret;
 }
@@ -139,14 +144,48 @@ typedef struct {
 
   /* For fields marked "lazy", parse them lazily or eagerly? */
   bool lazy;
+
+  /* If set, either the profile to record into (with OP_PROFILE) or the one
+   * that decides the order of each message's fields. */
+  const upb_pbdecoderprofile *profile;
+  bool record;
+
+  /* Skip fields that no handler would see, with OP_SKIP?  "touched" caches
+   * whether the subtree under each upb_handlers has any handlers at all. */
+  bool projection;
+  upb_inttable touched;
+
+  /* Check the string fields of proto3 messages with OP_STRINGUTF8? */
+  bool utf8;
+
+  /* Turn handlers with a store attribute into OP_STORE?  Only for bytecode
+   * that will be interpreted; the JIT specializes OP_PARSE_* itself. */
+  bool store;
+
+  /* Set if we emitted OP_PARSE_ARRAY, which the JIT doesn't implement. */
+  bool arrays;
+
+  /* Set if an allocation failed, in which case the group is thrown away. */
+  bool oom;
 } compiler;
 
-static compiler *newcompiler(mgroup *group, bool lazy) {
+static compiler *newcompiler(mgroup *group, bool lazy,
+                             const upb_pbdecoderprofile *profile,
+                             bool record, bool projection, bool utf8,
+                             bool store) {
   compiler *ret = upb_gmalloc(sizeof(*ret));
   int i;
 
   ret->group = group;
   ret->lazy = lazy;
+  ret->profile = profile;
+  ret->record = record;
+  ret->projection = projection;
+  ret->utf8 = utf8;
+  ret->store = store;
+  ret->arrays = false;
+  ret->oom = false;
+  upb_inttable_init(&ret->touched, UPB_CTYPE_BOOL);
   for (i = 0; i < MAXLABEL; i++) {
     ret->fwd_labels[i] = EMPTYLABEL;
     ret->back_labels[i] = EMPTYLABEL;
@@ -155,6 +194,7 @@ static compiler *newcompiler(mgroup *group, bool lazy) {
 }
 
 static void freecompiler(compiler *c) {
+  upb_inttable_uninit(&c->touched);
   upb_gfree(c);
 }
 
@@ -164,6 +204,7 @@ const size_t ptr_words = sizeof(void*) / sizeof(uint32_t);
 static int instruction_len(uint32_t instr) {
   switch (getop(instr)) {
     case OP_SETDISPATCH: return 1 + ptr_words;
+    case OP_PROFILE: return 1 + ptr_words;
     case OP_TAGN: return 3;
     case OP_SETBIGGROUPNUM: return 2;
     default: return 1;
@@ -280,6 +321,15 @@ static void putop(compiler *c, int op, ...) {
         put32(c, (uint64_t)ptr >> 32);
       break;
     }
+    case OP_PROFILE: {
+      uint32_t start = va_arg(ap, int);
+      uintptr_t ptr = (uintptr_t)va_arg(ap, const void*);
+      put32(c, OP_PROFILE | start << 8);
+      put32(c, ptr);
+      if (sizeof(uintptr_t) > sizeof(uint32_t))
+        put32(c, (uint64_t)ptr >> 32);
+      break;
+    }
     case OP_STARTMSG:
     case OP_ENDMSG:
     case OP_PUSHLENDELIM:
@@ -309,14 +359,36 @@ static void putop(compiler *c, int op, ...) {
     case OP_ENDSUBMSG:
     case OP_STARTSTR:
     case OP_STRING:
+    case OP_STRINGUTF8:
     case OP_ENDSTR:
     case OP_PUSHTAGDELIM:
       put32(c, op | va_arg(ap, upb_selector_t) << 8);
       break;
+    case OP_SKIP:
+      put32(c, op | va_arg(ap, int) << 8);
+      break;
     case OP_SETBIGGROUPNUM:
       put32(c, op);
       put32(c, va_arg(ap, int));
       break;
+    case OP_PARSE_ARRAY: {
+      uint32_t parse_type = va_arg(ap, int);
+      uint32_t packed = va_arg(ap, int);
+      upb_selector_t sel = va_arg(ap, upb_selector_t);
+      put32(c, op | parse_type << 8 | packed << 16);
+      put32(c, sel);
+      break;
+    }
+    case OP_STORE: {
+      uint32_t parse_type = va_arg(ap, int);
+      size_t offset = va_arg(ap, size_t);
+      int32_t hasbit = va_arg(ap, int);
+      UPB_ASSERT(offset <= UINT32_MAX);
+      put32(c, op | parse_type << 8);
+      put32(c, offset);
+      put32(c, hasbit);
+      break;
+    }
     case OP_CALL: {
       const upb_pbdecodermethod *method = va_arg(ap, upb_pbdecodermethod *);
       put32(c, op | (method->code_base.ofs - (pcofs(c) + 1)) << 8);
@@ -371,7 +443,8 @@ const char *upb_pbdecoder_getopname(unsigned int op) {
     OP(ENDSUBMSG) OP(STARTSTR) OP(STRING) OP(ENDSTR) OP(CALL) OP(RET)
     OP(PUSHLENDELIM) OP(PUSHTAGDELIM) OP(SETDELIM) OP(CHECKDELIM)
     OP(BRANCH) OP(TAG1) OP(TAG2) OP(TAGN) OP(SETDISPATCH) OP(POP)
-    OP(SETBIGGROUPNUM) OP(DISPATCH) OP(HALT)
+    OP(SETBIGGROUPNUM) OP(DISPATCH) OP(HALT) OP(PROFILE) OP(SKIP) OP(STORE)
+    OP(PARSE_ARRAY) OP(STRINGUTF8)
   }
   return "<unknown op>";
 #undef OP
@@ -403,6 +476,14 @@ static void dumpbc(uint32_t *p, uint32_t *end, FILE *f) {
                               upb_handlers_msgdef(method->dest_handlers_)));
         break;
       }
+      case OP_PROFILE: {
+        const void *ptr;
+        memcpy(&ptr, p, sizeof(void*));
+        p += ptr_words;
+        fprintf(f, " %s", (instr >> 8) ? upb_msgdef_fullname(ptr)
+                                       : upb_fielddef_name(ptr));
+        break;
+      }
       case OP_DISPATCH:
       case OP_STARTMSG:
       case OP_ENDMSG:
@@ -431,13 +512,24 @@ static void dumpbc(uint32_t *p, uint32_t *end, FILE *f) {
       case OP_ENDSUBMSG:
       case OP_STARTSTR:
       case OP_STRING:
+      case OP_STRINGUTF8:
       case OP_ENDSTR:
       case OP_PUSHTAGDELIM:
+      case OP_SKIP:
         fprintf(f, " %d", instr >> 8);
         break;
       case OP_SETBIGGROUPNUM:
         fprintf(f, " %d", *p++);
         break;
+      case OP_STORE:
+        fprintf(f, " %s ofs:%u hasbit:%d",
+                upb_pbdecoder_getopname(instr >> 8), p[0], (int32_t)p[1]);
+        p += 2;
+        break;
+      case OP_PARSE_ARRAY:
+        fprintf(f, " %s%s %d", upb_pbdecoder_getopname((instr >> 8) & 0xff),
+                (instr >> 16) ? " packed" : "", *p++);
+        break;
       case OP_CHECKDELIM:
       case OP_CALL:
       case OP_BRANCH:
@@ -529,6 +621,11 @@ static void dispatchtarget(compiler *c, upb_pbdecodermethod *method,
     uint64_t val = upb_pbdecoder_packdispatch(ofs, wire_type, NO_WIRE_TYPE);
     upb_inttable_insert(d, fn, upb_value_uint64(val));
   }
+
+  /* Every way into this field's code passes through here. */
+  if (c->record) {
+    putop(c, OP_PROFILE, 0, f);
+  }
 }
 
 static void putpush(compiler *c, const upb_fielddef *f) {
@@ -579,6 +676,84 @@ static bool haslazyhandlers(const upb_handlers *h, const upb_fielddef *f) {
          upb_handlers_gethandler(h, getsel(f, UPB_HANDLER_ENDSTR));
 }
 
+/* Does "f" have any handlers of its own in "h"? */
+static bool hasfieldhandlers(const upb_handlers *h, const upb_fielddef *f) {
+  int type;
+  for (type = 0; type < UPB_HANDLER_MAX; type++) {
+    upb_selector_t sel;
+    if (upb_handlers_getselector(f, type, &sel) &&
+        upb_handlers_gethandler(h, sel)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool visittouched(const upb_handlers *h, upb_inttable *seen) {
+  const upb_msgdef *md = upb_handlers_msgdef(h);
+  upb_msg_field_iter i;
+  upb_selector_t sel;
+
+  /* A cycle can't reach anything we aren't already visiting. */
+  if (upb_inttable_lookupptr(seen, h, NULL)) return false;
+  upb_inttable_insertptr(seen, h, upb_value_bool(true));
+
+  for (sel = 0; sel < UPB_STATIC_SELECTOR_COUNT; sel++) {
+    if (upb_handlers_gethandler(h, sel)) return true;
+  }
+
+  for(upb_msg_field_begin(&i, md);
+      !upb_msg_field_done(&i);
+      upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    const upb_handlers *sub;
+    if (hasfieldhandlers(h, f)) return true;
+    if (upb_fielddef_issubmsg(f) &&
+        (sub = upb_handlers_getsubhandlers(h, f)) != NULL &&
+        visittouched(sub, seen)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* Could parsing a message with "h" call any handler at all, in it or in any
+ * of its submessages? */
+static bool subtreetouched(compiler *c, const upb_handlers *h) {
+  upb_value v;
+  upb_inttable seen;
+  bool ret;
+
+  if (upb_inttable_lookupptr(&c->touched, h, &v)) {
+    return upb_value_getbool(v);
+  }
+
+  upb_inttable_init(&seen, UPB_CTYPE_BOOL);
+  ret = visittouched(h, &seen);
+  upb_inttable_uninit(&seen);
+
+  upb_inttable_insertptr(&c->touched, h, upb_value_bool(ret));
+  return ret;
+}
+
+/* In a projection, should we skip "f" instead of parsing it?  Groups are
+ * never skipped, since we can only find their end by parsing them. */
+static bool skipfield(compiler *c, const upb_handlers *h,
+                      const upb_fielddef *f) {
+  const upb_handlers *sub;
+
+  if (!c->projection ||
+      upb_fielddef_descriptortype(f) == UPB_DESCRIPTOR_TYPE_GROUP ||
+      hasfieldhandlers(h, f)) {
+    return false;
+  }
+
+  return !upb_fielddef_issubmsg(f) ||
+         (sub = upb_handlers_getsubhandlers(h, f)) == NULL ||
+         !subtreetouched(c, sub);
+}
+
 
 /* bytecode compiler code generation ******************************************/
 
@@ -649,6 +824,16 @@ static void generate_msgfield(compiler *c, const upb_fielddef *f,
   }
 }
 
+/* The op that passes the data of string, bytes or lazy submessage field "f"
+ * to its handler. */
+static opcode stringop(const compiler *c, const upb_fielddef *f) {
+  if (c->utf8 && upb_fielddef_type(f) == UPB_TYPE_STRING &&
+      upb_msgdef_syntax(upb_fielddef_containingtype(f)) == UPB_SYNTAX_PROTO3) {
+    return OP_STRINGUTF8;
+  }
+  return OP_STRING;
+}
+
 /* Generates bytecode to parse a single string or lazy submessage field. */
 static void generate_delimfield(compiler *c, const upb_fielddef *f,
                                 upb_pbdecodermethod *method) {
@@ -665,7 +850,7 @@ static void generate_delimfield(compiler *c, const upb_fielddef *f,
     putop(c, OP_PUSHLENDELIM);
     putop(c, OP_STARTSTR, getsel(f, UPB_HANDLER_STARTSTR));
     /* Need to emit even if no handler to skip past the string. */
-    putop(c, OP_STRING, getsel(f, UPB_HANDLER_STRING));
+    putop(c, stringop(c, f), getsel(f, UPB_HANDLER_STRING));
     putop(c, OP_POP);
     maybeput(c, OP_ENDSTR, h, f, UPB_HANDLER_ENDSTR);
     putop(c, OP_SETDELIM);
@@ -681,7 +866,7 @@ static void generate_delimfield(compiler *c, const upb_fielddef *f,
    dispatchtarget(c, method, f, UPB_WIRE_TYPE_DELIMITED);
     putop(c, OP_PUSHLENDELIM);
     putop(c, OP_STARTSTR, getsel(f, UPB_HANDLER_STARTSTR));
-    putop(c, OP_STRING, getsel(f, UPB_HANDLER_STRING));
+    putop(c, stringop(c, f), getsel(f, UPB_HANDLER_STRING));
     putop(c, OP_POP);
     maybeput(c, OP_ENDSTR, h, f, UPB_HANDLER_ENDSTR);
     putop(c, OP_SETDELIM);
@@ -696,6 +881,9 @@ static void generate_primitivefield(compiler *c, const upb_fielddef *f,
   opcode parse_type;
   upb_selector_t sel;
   int wire_type;
+  upb_handlerattr attr = UPB_HANDLERATTR_INITIALIZER;
+  size_t offset;
+  int32_t hasbit;
 
   label(c, LABEL_FIELD);
 
@@ -713,20 +901,35 @@ static void generate_primitivefield(compiler *c, const upb_fielddef *f,
   sel = getsel(f, upb_handlers_getprimitivehandlertype(f));
   wire_type = upb_pb_native_wire_types[upb_fielddef_descriptortype(f)];
   if (upb_fielddef_isseq(f)) {
+    /* An array handler takes whole packed runs, and single non-packed values
+     * only if there is no value handler to take them. */
+    upb_selector_t arraysel = getsel(f, UPB_HANDLER_ARRAY);
+    bool array = upb_handlers_gethandler(h, arraysel) != NULL;
+    bool value = upb_handlers_gethandler(h, sel) != NULL;
+    if (array) c->arrays = true;
+
     putop(c, OP_CHECKDELIM, LABEL_ENDMSG);
     putchecktag(c, f, UPB_WIRE_TYPE_DELIMITED, LABEL_DISPATCH);
    dispatchtarget(c, method, f, UPB_WIRE_TYPE_DELIMITED);
     putop(c, OP_PUSHLENDELIM);
     putop(c, OP_STARTSEQ, getsel(f, UPB_HANDLER_STARTSEQ));  /* Packed */
    label(c, LABEL_LOOPSTART);
-    putop(c, parse_type, sel);
+    if (array) {
+      putop(c, OP_PARSE_ARRAY, parse_type, true, arraysel);
+    } else {
+      putop(c, parse_type, sel);
+    }
     putop(c, OP_CHECKDELIM, LABEL_LOOPBREAK);
     putop(c, OP_BRANCH, -LABEL_LOOPSTART);
    dispatchtarget(c, method, f, wire_type);
     putop(c, OP_PUSHTAGDELIM, 0);
     putop(c, OP_STARTSEQ, getsel(f, UPB_HANDLER_STARTSEQ));  /* Non-packed */
    label(c, LABEL_LOOPSTART);
-    putop(c, parse_type, sel);
+    if (array && !value) {
+      putop(c, OP_PARSE_ARRAY, parse_type, false, arraysel);
+    } else {
+      putop(c, parse_type, sel);
+    }
     putop(c, OP_CHECKDELIM, LABEL_LOOPBREAK);
     putchecktag(c, f, wire_type, LABEL_LOOPBREAK);
     putop(c, OP_BRANCH, -LABEL_LOOPSTART);
@@ -738,7 +941,62 @@ static void generate_primitivefield(compiler *c, const upb_fielddef *f,
     putop(c, OP_CHECKDELIM, LABEL_ENDMSG);
     putchecktag(c, f, wire_type, LABEL_DISPATCH);
    dispatchtarget(c, method, f, wire_type);
-    putop(c, parse_type, sel);
+    if (c->store && upb_handlers_getattr(h, sel, &attr) &&
+        upb_handlerattr_store(&attr, &offset, &hasbit)) {
+      putop(c, OP_STORE, parse_type, offset, hasbit);
+    } else {
+      putop(c, parse_type, sel);
+    }
+  }
+}
+
+/* Generates bytecode to skip over a field that nobody has handlers for, without
+ * pushing a frame or looking at its contents. */
+static void generate_skipfield(compiler *c, const upb_fielddef *f,
+                               upb_pbdecodermethod *method) {
+  int wire_type = upb_pb_native_wire_types[upb_fielddef_descriptortype(f)];
+
+  label(c, LABEL_FIELD);
+  putop(c, OP_CHECKDELIM, LABEL_ENDMSG);
+  putchecktag(c, f, wire_type, LABEL_DISPATCH);
+ dispatchtarget(c, method, f, wire_type);
+  putop(c, OP_SKIP, wire_type);
+
+  if (upb_fielddef_isseq(f) && wire_type != UPB_WIRE_TYPE_DELIMITED) {
+    /* Repeated primitives may arrive packed, too. */
+    putop(c, OP_BRANCH, LABEL_LOOPBREAK);
+   dispatchtarget(c, method, f, UPB_WIRE_TYPE_DELIMITED);
+    putop(c, OP_SKIP, UPB_WIRE_TYPE_DELIMITED);
+   label(c, LABEL_LOOPBREAK);
+  }
+}
+
+/* Sorts "fields" so that each one is the one that most often followed the
+ * field before it (or started the message, for the first one).  Fields the
+ * profile never saw keep their original order. */
+static void orderfields(const upb_pbdecoderprofile *p, const upb_msgdef *md,
+                        const upb_fielddef **fields, size_t n) {
+  const void *prev = md;
+  size_t i, j;
+
+  for (i = 0; i < n; i++) {
+    const upb_fielddef *best;
+    size_t best_j = i;
+    uint64_t best_count = 0;
+
+    for (j = i; j < n; j++) {
+      uint64_t count = upb_pbdecoderprofile_transitions(p, prev, fields[j]);
+      if (count > best_count) {
+        best_j = j;
+        best_count = count;
+      }
+    }
+
+    /* Shift rather than swap, so the rest stay in their original order. */
+    best = fields[best_j];
+    memmove(&fields[i + 1], &fields[i], (best_j - i) * sizeof(*fields));
+    fields[i] = best;
+    prev = best;
   }
 }
 
@@ -750,6 +1008,8 @@ static void compile_method(compiler *c, upb_pbdecodermethod *method) {
   uint32_t* start_pc;
   upb_msg_field_iter i;
   upb_value val;
+  const upb_fielddef **fields;
+  size_t j, n = 0;
 
   UPB_ASSERT(method);
 
@@ -763,15 +1023,36 @@ static void compile_method(compiler *c, upb_pbdecodermethod *method) {
  method->code_base.ofs = pcofs(c);
   putop(c, OP_SETDISPATCH, &method->dispatch);
   putsel(c, OP_STARTMSG, UPB_STARTMSG_SELECTOR, h);
+  if (c->record) {
+    putop(c, OP_PROFILE, 1, md);
+  }
  label(c, LABEL_FIELD);
   start_pc = c->pc;
+
+  fields = upb_gmalloc(sizeof(*fields) * UPB_MAX(upb_msgdef_numfields(md), 1));
+  if (!fields) {
+    c->oom = true;
+    return;
+  }
+
   for(upb_msg_field_begin(&i, md);
       !upb_msg_field_done(&i);
       upb_msg_field_next(&i)) {
-    const upb_fielddef *f = upb_msg_iter_field(&i);
+    fields[n++] = upb_msg_iter_field(&i);
+  }
+
+  if (c->profile && !c->record) {
+    orderfields(c->profile, md, fields, n);
+  }
+
+  for (j = 0; j < n; j++) {
+    const upb_fielddef *f = fields[j];
     upb_fieldtype_t type = upb_fielddef_type(f);
 
-    if (type == UPB_TYPE_MESSAGE && !(haslazyhandlers(h, f) && c->lazy)) {
+    if (skipfield(c, h, f)) {
+      generate_skipfield(c, f, method);
+    } else if (type == UPB_TYPE_MESSAGE &&
+               !(haslazyhandlers(h, f) && c->lazy)) {
       generate_msgfield(c, f, method);
     } else if (type == UPB_TYPE_STRING || type == UPB_TYPE_BYTES ||
                type == UPB_TYPE_MESSAGE) {
@@ -781,6 +1062,8 @@ static void compile_method(compiler *c, upb_pbdecodermethod *method) {
     }
   }
 
+  upb_gfree(fields);
+
   /* If there were no fields, or if no handlers were defined, we need to
    * generate a non-empty loop body so that we can at least dispatch for unknown
    * fields and check for the end of the message. */
@@ -827,9 +1110,10 @@ static void find_methods(compiler *c, const upb_handlers *h) {
     const upb_fielddef *f = upb_msg_iter_field(&i);
     const upb_handlers *sub_h;
     if (upb_fielddef_type(f) == UPB_TYPE_MESSAGE &&
-        (sub_h = upb_handlers_getsubhandlers(h, f)) != NULL) {
+        (sub_h = upb_handlers_getsubhandlers(h, f)) != NULL &&
+        !skipfield(c, h, f)) {
       /* We only generate a decoder method for submessages with handlers.
-       * Others will be parsed as unknown fields. */
+       * Others will be parsed as unknown fields (or skipped). */
       find_methods(c, sub_h);
     }
   }
@@ -894,15 +1178,28 @@ static void sethandlers(mgroup *g, bool allowjit) {
 /* TODO(haberman): allow this to be constructed for an arbitrary set of dest
  * handlers and other mgroups (but verify we have a transitive closure). */
 const mgroup *mgroup_new(const upb_handlers *dest, bool allowjit, bool lazy,
-                         const void *owner) {
+                         upb_pbdecoderprofile *profile, bool record,
+                         bool projection, bool utf8, const void *owner) {
   mgroup *g;
   compiler *c;
+  upb_refcounted *r;
 
-  UPB_UNUSED(allowjit);
   UPB_ASSERT(upb_handlers_isfrozen(dest));
 
   g = newgroup(owner);
-  c = newcompiler(g, lazy);
+  if (profile && record) {
+    /* The JIT doesn't implement OP_PROFILE. */
+    g->profile = profile;
+    allowjit = false;
+  }
+  if (projection || utf8) {
+    /* Nor OP_SKIP or OP_STRINGUTF8. */
+    allowjit = false;
+  }
+#ifndef UPB_USE_JIT_X64
+  allowjit = false;
+#endif
+  c = newcompiler(g, lazy, profile, record, projection, utf8, !allowjit);
   find_methods(c, dest);
 
   /* We compile in two passes:
@@ -915,6 +1212,16 @@ const mgroup *mgroup_new(const upb_handlers *dest, bool allowjit, bool lazy,
   compile_methods(c);
   compile_methods(c);
   g->bytecode_end = c->pc;
+  if (c->arrays) {
+    allowjit = false;
+  }
+
+  if (c->oom) {
+    freecompiler(c);
+    mgroup_unref(g, owner);
+    return NULL;
+  }
+
   freecompiler(c);
 
 #ifdef UPB_DUMP_BYTECODE
@@ -933,25 +1240,299 @@ const mgroup *mgroup_new(const upb_handlers *dest, bool allowjit, bool lazy,
 #endif
 
   sethandlers(g, allowjit);
+
+  /* The code cache hands out groups to any number of threads at once, so
+   * freeze the group here: refs on frozen objects are atomic, while the
+   * individual counts of unfrozen objects are not. */
+  r = mgroup_upcast_mutable(g);
+  if (!upb_refcounted_freeze(&r, 1, NULL, UPB_MAX_HANDLER_DEPTH)) {
+    mgroup_unref(g, owner);
+    return NULL;
+  }
   return g;
 }
 
 
 /* upb_pbcodecache ************************************************************/
 
+/* Atomic pointer operations for the lock-free buckets.  Loads acquire and
+ * stores release, so an entry is fully initialized before any reader can see
+ * it. */
+
+#ifdef UPB_THREAD_UNSAFE /*---------------------------------------------------*/
+
+static const void *atomic_load(const void *const *p) { return *p; }
+static void atomic_store(const void **p, const void *v) { *p = v; }
+static bool atomic_cas(const void **p, const void *old, const void *v) {
+  if (*p != old) return false;
+  *p = v;
+  return true;
+}
+static size_t atomic_loadsize(const size_t *p) { return *p; }
+static bool atomic_cassize(size_t *p, size_t old, size_t v) {
+  if (*p != old) return false;
+  *p = v;
+  return true;
+}
+
+#elif defined(__GNUC__) || defined(__clang__) /*------------------------------*/
+
+static const void *atomic_load(const void *const *p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static void atomic_store(const void **p, const void *v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+static bool atomic_cas(const void **p, const void *old, const void *v) {
+  return __sync_bool_compare_and_swap(p, old, v);
+}
+static size_t atomic_loadsize(const size_t *p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static bool atomic_cassize(size_t *p, size_t old, size_t v) {
+  return __sync_bool_compare_and_swap(p, old, v);
+}
+
+#elif defined(WIN32) /*-------------------------------------------------------*/
+
+#include <Windows.h>
+
+static const void *atomic_load(const void *const *p) {
+  const void *v = *(const void *volatile*)p;
+  MemoryBarrier();
+  return v;
+}
+static void atomic_store(const void **p, const void *v) {
+  InterlockedExchangePointer((PVOID volatile*)p, (PVOID)v);
+}
+static bool atomic_cas(const void **p, const void *old, const void *v) {
+  return InterlockedCompareExchangePointer((PVOID volatile*)p, (PVOID)v,
+                                           (PVOID)old) == old;
+}
+static size_t atomic_loadsize(const size_t *p) {
+  size_t v = *(const volatile size_t*)p;
+  MemoryBarrier();
+  return v;
+}
+static bool atomic_cassize(size_t *p, size_t old, size_t v) {
+  return InterlockedCompareExchangePointer((PVOID volatile*)p, (PVOID)v,
+                                           (PVOID)old) == (PVOID)old;
+}
+
+#else
+#error Atomic primitives not defined for your platform/CPU.  \
+       Implement them or compile with UPB_THREAD_UNSAFE.
+#endif
+
+static void atomic_addsize(size_t *p, size_t n) {
+  size_t old;
+  do {
+    old = atomic_loadsize(p);
+  } while (!atomic_cassize(p, old, old + n));
+}
+
+/* One cached method.  Entries are immutable once published, except for
+ * "method" and "jit_group", which change once when a deferred JIT compile
+ * finishes. */
+typedef struct cacheentry {
+  const struct cacheentry *next;
+  uintptr_t key;
+
+  /* The method to return, from one of the groups below. */
+  const void *method;
+
+  /* The group we first compiled, and the JIT-compiled one that replaces it.
+   * "jit_group" is set to the entry itself while that compile is running. */
+  const mgroup *group;
+  const void *jit_group;
+
+  /* The profile the methods were compiled with, if any, and whether they
+   * validate UTF-8.  Part of the key. */
+  upb_pbdecoderprofile *profile;
+  bool utf8;
+
+  /* True if "group" is interpreted and should be JIT-compiled later. */
+  bool pending;
+
+  /* Lookups of a pending entry, so CompilePending() can do the hot ones
+   * first.  Updated atomically, and no longer once the entry is claimed. */
+  size_t lookups;
+} cacheentry;
+
+#define KEY_LAZY 1
+#define KEY_RECORD 2
+#define KEY_PROJECTION 4
+#define KEY_OPTS (KEY_LAZY | KEY_RECORD | KEY_PROJECTION)
+
+/* Handlers come from malloc(), so they are always at least 8-byte aligned and
+ * the low bits are free to hold the boolean options. */
+static uintptr_t cachekey(const upb_pbdecodermethodopts *opts) {
+  UPB_ASSERT(((uintptr_t)opts->handlers & KEY_OPTS) == 0);
+  return (uintptr_t)opts->handlers | (opts->lazy ? KEY_LAZY : 0) |
+         (opts->profile && opts->record_profile ? KEY_RECORD : 0) |
+         (opts->projection ? KEY_PROJECTION : 0);
+}
+
+static const upb_handlers *keyhandlers(uintptr_t key) {
+  return (const upb_handlers*)(key & ~(uintptr_t)KEY_OPTS);
+}
+
+static size_t groupjitsize(const mgroup *g) {
+#ifdef UPB_USE_JIT_X64
+  return g->jit_code ? g->jit_size : 0;
+#else
+  UPB_UNUSED(g);
+  return 0;
+#endif
+}
+
+/* Claims "bytes" of the cache's JIT limit, if that much is left. */
+static bool reservejit(upb_pbcodecache *c, size_t bytes) {
+  if (bytes == 0) return true;
+  for (;;) {
+    size_t used = atomic_loadsize(&c->jit_bytes_);
+    if (bytes > c->jit_limit_ - used) return false;
+    if (atomic_cassize(&c->jit_bytes_, used, used + bytes)) return true;
+  }
+}
+
+static void unrefgroup(upb_pbcodecache *c, const mgroup *g) {
+  atomic_addsize(&c->jit_bytes_, -groupjitsize(g));
+  mgroup_unref(g, c);
+}
+
+/* JIT-compiles the group for "key", or returns NULL if its machine code does
+ * not fit in what is left of the cache's JIT limit, or on out-of-memory.
+ *
+ * The size is only known once the code is generated, and generating it
+ * consumes the bytecode, so a group that doesn't fit is thrown away whole.
+ * That costs one wasted compile per method, and only until the limit is
+ * reached. */
+static const mgroup *jitgroup(upb_pbcodecache *c, uintptr_t key,
+                              upb_pbdecoderprofile *profile) {
+  const mgroup *g;
+
+  if (atomic_loadsize(&c->jit_bytes_) >= c->jit_limit_) return NULL;
+
+  g = mgroup_new(keyhandlers(key), true, key & KEY_LAZY, profile,
+                 key & KEY_RECORD, key & KEY_PROJECTION, false, c);
+  if (!g) return NULL;
+  if (!reservejit(c, groupjitsize(g))) {
+    mgroup_unref(g, c);
+    return NULL;
+  }
+  return g;
+}
+
+static const mgroup *keygroup(upb_pbcodecache *c, uintptr_t key,
+                              upb_pbdecoderprofile *profile, bool utf8,
+                              bool allowjit) {
+  const mgroup *g = allowjit && !utf8 ? jitgroup(c, key, profile) : NULL;
+  if (g) return g;
+  return mgroup_new(keyhandlers(key), false, key & KEY_LAZY, profile,
+                    key & KEY_RECORD, key & KEY_PROJECTION, utf8, c);
+}
+
+/* Sorts the most looked-up entries first. */
+static int cmplookups(const void *a, const void *b) {
+  size_t x = (*(const cacheentry *const*)a)->lookups;
+  size_t y = (*(const cacheentry *const*)b)->lookups;
+  return x < y ? 1 : (x > y ? -1 : 0);
+}
+
+static const void **keybucket(upb_pbcodecache *c, uintptr_t key) {
+  /* Mix in the upper bits, since handlers are fairly well aligned. */
+  uintptr_t hash = (key >> 4) ^ (key >> 10);
+  return &c->buckets[hash % UPB_PBCODECACHE_BUCKETS];
+}
+
+/* Searches the list from "e" up to (but not including) "end". */
+static const cacheentry *findentry(const cacheentry *e, const cacheentry *end,
+                                   uintptr_t key,
+                                   const upb_pbdecoderprofile *profile,
+                                   bool utf8) {
+  for (; e != end; e = e->next) {
+    if (e->key == key && e->profile == profile && e->utf8 == utf8) return e;
+  }
+  return NULL;
+}
+
+static const upb_pbdecodermethod *groupmethod(const mgroup *g,
+                                              const upb_handlers *h) {
+  upb_value v;
+  bool ok = upb_inttable_lookupptr(&g->methods, h, &v);
+  UPB_ASSERT(ok);
+  UPB_UNUSED(ok);
+  return upb_value_getptr(v);
+}
+
+/* Finds the group of another entry with the same options that compiled a
+ * method for the handlers of "key" along the way, as it does for every
+ * submessage.  Entries still waiting to be JIT-compiled are passed over, since
+ * their methods are about to be replaced, and so are interpreted groups if
+ * we would JIT-compile our own. */
+static const mgroup *findsharedgroup(const upb_pbcodecache *c, uintptr_t key,
+                                     const upb_pbdecoderprofile *profile,
+                                     bool utf8, bool wantjit) {
+  size_t i;
+  upb_value v;
+
+  for (i = 0; i < UPB_PBCODECACHE_BUCKETS; i++) {
+    const cacheentry *e = atomic_load(&c->buckets[i]);
+    for (; e; e = e->next) {
+      const mgroup *g = e->group;
+      if ((e->key & KEY_OPTS) != (key & KEY_OPTS) || e->profile != profile ||
+          e->utf8 != utf8) {
+        continue;
+      }
+      if (e->pending) {
+        const void *jit = atomic_load(&e->jit_group);
+        if (jit == NULL || jit == e) continue;
+        g = jit;
+      }
+      if ((!wantjit || groupjitsize(g) > 0) &&
+          upb_inttable_lookupptr(&g->methods, keyhandlers(key), &v)) {
+        return g;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static bool isempty(const upb_pbcodecache *c) {
+  size_t i;
+  for (i = 0; i < UPB_PBCODECACHE_BUCKETS; i++) {
+    if (c->buckets[i]) return false;
+  }
+  return true;
+}
+
 void upb_pbcodecache_init(upb_pbcodecache *c) {
-  upb_inttable_init(&c->groups, UPB_CTYPE_CONSTPTR);
+  size_t i;
+  for (i = 0; i < UPB_PBCODECACHE_BUCKETS; i++) {
+    c->buckets[i] = NULL;
+  }
   c->allow_jit_ = true;
+  c->defer_jit_ = false;
+  c->jit_limit_ = (size_t)-1;
+  c->jit_bytes_ = 0;
 }
 
 void upb_pbcodecache_uninit(upb_pbcodecache *c) {
-  upb_inttable_iter i;
-  upb_inttable_begin(&i, &c->groups);
-  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
-    const mgroup *group = upb_value_getconstptr(upb_inttable_iter_value(&i));
-    mgroup_unref(group, c);
+  size_t i;
+  for (i = 0; i < UPB_PBCODECACHE_BUCKETS; i++) {
+    const cacheentry *e = c->buckets[i];
+    while (e) {
+      const cacheentry *next = e->next;
+      mgroup_unref(e->group, c);
+      if (e->jit_group && e->jit_group != e) {
+        mgroup_unref(e->jit_group, c);
+      }
+      upb_gfree((void*)e);
+      e = next;
+    }
   }
-  upb_inttable_uninit(&c->groups);
 }
 
 bool upb_pbcodecache_allowjit(const upb_pbcodecache *c) {
@@ -959,25 +1540,166 @@ bool upb_pbcodecache_allowjit(const upb_pbcodecache *c) {
 }
 
 bool upb_pbcodecache_setallowjit(upb_pbcodecache *c, bool allow) {
-  if (upb_inttable_count(&c->groups) > 0)
+  if (!isempty(c))
     return false;
   c->allow_jit_ = allow;
   return true;
 }
 
+bool upb_pbcodecache_deferjit(const upb_pbcodecache *c) {
+  return c->defer_jit_;
+}
+
+bool upb_pbcodecache_setdeferjit(upb_pbcodecache *c, bool defer) {
+  if (!isempty(c))
+    return false;
+  c->defer_jit_ = defer;
+  return true;
+}
+
+size_t upb_pbcodecache_jitlimit(const upb_pbcodecache *c) {
+  return c->jit_limit_;
+}
+
+bool upb_pbcodecache_setjitlimit(upb_pbcodecache *c, size_t bytes) {
+  if (!isempty(c))
+    return false;
+  c->jit_limit_ = bytes;
+  return true;
+}
+
+size_t upb_pbcodecache_jitbytes(const upb_pbcodecache *c) {
+  return atomic_loadsize(&c->jit_bytes_);
+}
+
+static bool isqueued(const cacheentry *e) {
+  return e->pending && atomic_load(&e->jit_group) == NULL;
+}
+
+size_t upb_pbcodecache_compilepending(upb_pbcodecache *c) {
+  cacheentry **queue;
+  size_t i, count = 0, queued = 0, n = 0;
+
+  for (i = 0; i < UPB_PBCODECACHE_BUCKETS; i++) {
+    const cacheentry *e = atomic_load(&c->buckets[i]);
+    for (; e; e = e->next) {
+      if (isqueued(e)) count++;
+    }
+  }
+
+  if (count == 0) return 0;
+  queue = upb_gmalloc(count * sizeof(*queue));
+  if (!queue) return 0;
+
+  /* Entries may be added meanwhile; they wait for the next call. */
+  for (i = 0; i < UPB_PBCODECACHE_BUCKETS && queued < count; i++) {
+    cacheentry *e = (cacheentry*)atomic_load(&c->buckets[i]);
+    for (; e && queued < count; e = (cacheentry*)e->next) {
+      if (isqueued(e)) queue[queued++] = e;
+    }
+  }
+
+  /* Hottest first, so whatever doesn't fit in the JIT limit is what runs
+   * least. */
+  qsort(queue, queued, sizeof(*queue), &cmplookups);
+
+  for (i = 0; i < queued; i++) {
+    cacheentry *e = queue[i];
+    const mgroup *g;
+
+    /* Claim the entry, so only one thread compiles it.  One that doesn't fit
+     * stays claimed, and interpreted, for good. */
+    if (!atomic_cas(&e->jit_group, NULL, e)) continue;
+
+    g = jitgroup(c, e->key, e->profile);
+    if (!g) continue;
+    atomic_store(&e->method, groupmethod(g, keyhandlers(e->key)));
+    atomic_store(&e->jit_group, g);
+    n++;
+  }
+
+  upb_gfree(queue);
+  return n;
+}
+
 const upb_pbdecodermethod *upb_pbcodecache_getdecodermethod(
     upb_pbcodecache *c, const upb_pbdecodermethodopts *opts) {
-  upb_value v;
-  bool ok;
+  uintptr_t key = cachekey(opts);
+  const void **bucket = keybucket(c, key);
+  const cacheentry *head = atomic_load(bucket);
+  const cacheentry *found;
+  const upb_pbdecodermethod *m;
+  bool defer = c->allow_jit_ && c->defer_jit_ &&
+               !(key & (KEY_RECORD | KEY_PROJECTION)) && !opts->validate_utf8;
+  const mgroup *shared;
+  cacheentry *e;
+
+  found = findentry(head, NULL, key, opts->profile, opts->validate_utf8);
+  if (found) {
+    if (isqueued(found)) {
+      atomic_addsize(&((cacheentry*)found)->lookups, 1);
+    }
+    return atomic_load(&found->method);
+  }
 
-  /* Right now we build a new DecoderMethod every time.
-   * TODO(haberman): properly cache methods by their true key. */
-  const mgroup *g = mgroup_new(opts->handlers, c->allow_jit_, opts->lazy, c);
-  upb_inttable_push(&c->groups, upb_value_constptr(g));
+#ifndef UPB_USE_JIT_X64
+  defer = false;  /* The JIT isn't compiled in, so there is nothing to wait for. */
+#endif
 
-  ok = upb_inttable_lookupptr(&g->methods, opts->handlers, &v);
-  UPB_ASSERT(ok);
-  return upb_value_getptr(v);
+  /* Compile without holding anything; if another thread beats us to it we
+   * throw this copy away. */
+  e = upb_gmalloc(sizeof(*e));
+  if (!e) return NULL;
+  e->key = key;
+  e->profile = opts->profile;
+  e->utf8 = opts->validate_utf8;
+
+  /* A submessage's handlers usually have a method already, compiled as part
+   * of their parent's group, which we can share instead of compiling them
+   * again. */
+  shared = findsharedgroup(c, key, opts->profile, opts->validate_utf8,
+                           c->allow_jit_ && !opts->validate_utf8);
+  if (shared) {
+    mgroup_ref(shared, c);
+    e->group = shared;
+    defer = false;
+  } else {
+    e->group = keygroup(c, key, opts->profile, opts->validate_utf8,
+                        c->allow_jit_ && !defer);
+    if (!e->group) {
+      upb_gfree(e);
+      return NULL;
+    }
+  }
+  m = groupmethod(e->group, opts->handlers);
+  e->method = m;
+  e->jit_group = NULL;
+  e->pending = defer;
+  e->lookups = 1;
+
+  for (;;) {
+    const cacheentry *newhead;
+    e->next = head;
+    if (atomic_cas(bucket, head, e)) {
+      /* Once published, another thread may JIT it and replace e->method. */
+      return m;
+    }
+
+    /* Only entries in front of our old head are new to us. */
+    newhead = atomic_load(bucket);
+    found = findentry(newhead, head, key, opts->profile,
+                      opts->validate_utf8);
+    if (found) {
+      if (shared) {
+        mgroup_unref(shared, c);
+      } else {
+        unrefgroup(c, e->group);
+      }
+      upb_gfree(e);
+      return atomic_load(&found->method);
+    }
+    head = newhead;
+  }
 }
 
 
@@ -987,8 +1709,90 @@ void upb_pbdecodermethodopts_init(upb_pbdecodermethodopts *opts,
                                   const upb_handlers *h) {
   opts->handlers = h;
   opts->lazy = false;
+  opts->profile = NULL;
+  opts->record_profile = false;
+  opts->projection = false;
+  opts->validate_utf8 = false;
 }
 
 void upb_pbdecodermethodopts_setlazy(upb_pbdecodermethodopts *opts, bool lazy) {
   opts->lazy = lazy;
 }
+
+void upb_pbdecodermethodopts_setprofile(upb_pbdecodermethodopts *opts,
+                                        upb_pbdecoderprofile *profile,
+                                        bool record) {
+  opts->profile = profile;
+  opts->record_profile = record;
+}
+
+void upb_pbdecodermethodopts_setprojection(upb_pbdecodermethodopts *opts,
+                                           bool projection) {
+  opts->projection = projection;
+}
+
+void upb_pbdecodermethodopts_setvalidateutf8(upb_pbdecodermethodopts *opts,
+                                             bool validate) {
+  opts->validate_utf8 = validate;
+}
+
+
+/* upb_pbdecoderprofile *******************************************************/
+
+/* Keys are the raw bytes of the (from, to) pointer pair.  The strtable copies
+ * one byte past the key's length, so the buffer has room for a NULL too. */
+#define TRANSITIONKEY_LEN (2 * sizeof(void*))
+
+static void transitionkey(char *key, const void *from, const void *to) {
+  memcpy(key, &from, sizeof(from));
+  memcpy(key + sizeof(from), &to, sizeof(to));
+  key[TRANSITIONKEY_LEN] = '\0';
+}
+
+upb_pbdecoderprofile *upb_pbdecoderprofile_new() {
+  upb_pbdecoderprofile *p = upb_gmalloc(sizeof(*p));
+  if (!p) return NULL;
+  if (!upb_strtable_init(&p->transitions, UPB_CTYPE_UINT64)) {
+    upb_gfree(p);
+    return NULL;
+  }
+  p->count = 0;
+  return p;
+}
+
+void upb_pbdecoderprofile_free(upb_pbdecoderprofile *p) {
+  upb_strtable_uninit(&p->transitions);
+  upb_gfree(p);
+}
+
+uint64_t upb_pbdecoderprofile_count(const upb_pbdecoderprofile *p) {
+  return p->count;
+}
+
+uint64_t upb_pbdecoderprofile_transitions(const upb_pbdecoderprofile *p,
+                                          const void *from, const void *to) {
+  char key[TRANSITIONKEY_LEN + 1];
+  upb_value v;
+  transitionkey(key, from, to);
+  return upb_strtable_lookup2(&p->transitions, key, TRANSITIONKEY_LEN, &v)
+             ? upb_value_getuint64(v)
+             : 0;
+}
+
+void upb_pbdecoderprofile_record(upb_pbdecoderprofile *p, const void *from,
+                                 const void *to) {
+  char key[TRANSITIONKEY_LEN + 1];
+  upb_value v;
+  uint64_t n = 0;
+
+  transitionkey(key, from, to);
+  if (upb_strtable_remove2(&p->transitions, key, TRANSITIONKEY_LEN, &v)) {
+    n = upb_value_getuint64(v);
+  }
+
+  /* If this fails we just lose the sample. */
+  if (upb_strtable_insert2(&p->transitions, key, TRANSITIONKEY_LEN,
+                           upb_value_uint64(n + 1))) {
+    p->count++;
+  }
+}
@@ -118,6 +118,8 @@ static int define_jmptarget(jitcompiler *jc, const void *key);
 static void asmlabel(jitcompiler *jc, const char *fmt, ...);
 static int pcofs(jitcompiler* jc);
 static int alloc_pclabel(jitcompiler *jc);
+static bool getstore(const upb_handlers *h, upb_selector_t sel, opcode op,
+                     upb_fieldtype_t *type, size_t *offset, int32_t *hasbit);
 
 #ifdef UPB_JIT_LOAD_SO
 static char *upb_vasprintf(const char *fmt, va_list ap);
@@ -167,6 +169,35 @@ static void freejitcompiler(jitcompiler *jc) {
   free(jc);
 }
 
+/* If the handler for "sel" has a store attribute, returns true and sets the
+ * type that "op" stores along with *offset and *hasbit. */
+static bool getstore(const upb_handlers *h, upb_selector_t sel, opcode op,
+                     upb_fieldtype_t *type, size_t *offset, int32_t *hasbit) {
+  upb_handlerattr attr = UPB_HANDLERATTR_INITIALIZER;
+  bool ret = h && upb_handlers_getattr(h, sel, &attr) &&
+             upb_handlerattr_store(&attr, offset, hasbit);
+
+  switch (op) {
+    case OP_PARSE_INT64:
+    case OP_PARSE_SFIXED64:
+    case OP_PARSE_SINT64:   *type = UPB_TYPE_INT64; break;
+    case OP_PARSE_UINT64:
+    case OP_PARSE_FIXED64:  *type = UPB_TYPE_UINT64; break;
+    case OP_PARSE_INT32:
+    case OP_PARSE_SFIXED32:
+    case OP_PARSE_SINT32:   *type = UPB_TYPE_INT32; break;
+    case OP_PARSE_UINT32:
+    case OP_PARSE_FIXED32:  *type = UPB_TYPE_UINT32; break;
+    case OP_PARSE_DOUBLE:   *type = UPB_TYPE_DOUBLE; break;
+    case OP_PARSE_FLOAT:    *type = UPB_TYPE_FLOAT; break;
+    case OP_PARSE_BOOL:     *type = UPB_TYPE_BOOL; break;
+    default: UPB_ASSERT(false); ret = false; break;
+  }
+
+  upb_handlerattr_uninit(&attr);
+  return ret;
+}
+
 #ifdef UPB_JIT_LOAD_SO
 
 /* Like sprintf except allocates the string, which is returned and owned by the
@@ -932,7 +932,7 @@ static void jitprimitive(jitcompiler *jc, opcode op,
     }
 
     /* Call callback (or specialize if we can). */
-    if (upb_msg_getscalarhandlerdata(h, sel, &ftype, &offset, &hasbit)) {
+    if (getstore(h, sel, op, &ftype, &offset, &hasbit)) {
       switch (ftype) {
         case UPB_TYPE_INT64:
         case UPB_TYPE_UINT64:
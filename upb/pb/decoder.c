@@ -17,6 +17,7 @@
 #include <stddef.h>
 #include "upb/pb/decoder.int.h"
 #include "upb/pb/varint.int.h"
+#include "upb/trace.h"
 
 #ifdef UPB_DUMP_BYTECODE
 #include <stdio.h>
@@ -61,6 +62,7 @@ static bool consumes_input(opcode op) {
     case OP_CALL:
     case OP_RET:
     case OP_BRANCH:
+    case OP_PROFILE:
       return false;
     default:
       return true;
@@ -218,6 +220,11 @@ int32_t upb_pbdecoder_resume(upb_pbdecoder *d, void *p, const char *buf,
                              size_t size, const upb_bufhandle *handle) {
   UPB_UNUSED(p);  /* Useless; just for the benefit of the JIT. */
 
+  if (d->stats && size > 0 &&
+      (d->bufstart_ofs > 0 || d->residual_end > d->residual)) {
+    d->stats->resumes++;
+  }
+
   /* d->skip and d->residual_end could probably elegantly be represented
    * as a single variable, to more easily represent this invariant. */
   UPB_ASSERT(!(d->skip && d->residual_end > d->residual));
@@ -281,6 +288,7 @@ int32_t upb_pbdecoder_resume(upb_pbdecoder *d, void *p, const char *buf,
  * bytes.  If there are any unconsumed bytes, returns a short byte count. */
 size_t upb_pbdecoder_suspend(upb_pbdecoder *d) {
   d->pc = d->last;
+  if (d->stats && upb_env_ok(d->env)) d->stats->suspends++;
   if (d->checkpoint == d->residual) {
     /* Checkpoint was in residual buf; no user bytes were consumed. */
     d->ptr = d->residual;
@@ -305,6 +313,7 @@ static size_t suspend_save(upb_pbdecoder *d) {
   /* We hit end-of-buffer before we could parse a full value.
    * Save any unconsumed bytes (if any) to the residual buffer. */
   d->pc = d->last;
+  if (d->stats) d->stats->suspends++;
 
   if (d->checkpoint == d->residual) {
     /* Checkpoint was in residual buf; append user byte(s) to residual buf. */
@@ -507,6 +516,9 @@ static bool decoder_push(upb_pbdecoder *d, uint64_t end) {
   fr->dispatch = NULL;
   fr->groupnum = 0;
   d->top = fr;
+  if (d->stats && (uint32_t)(fr - d->stack) > d->stats->max_depth) {
+    d->stats->max_depth = fr - d->stack;
+  }
   return true;
 }
 
@@ -596,6 +608,7 @@ have_tag:
 
     if (d->top->groupnum >= 0) {
       /* TODO: More code needed for handling unknown groups. */
+      if (d->stats) d->stats->unknown_fields++;
       upb_sink_putunknown(&d->top->sink, d->checkpoint, d->ptr - d->checkpoint);
       return DECODE_OK;
     }
@@ -630,6 +643,7 @@ static int32_t dispatch(upb_pbdecoder *d) {
   CHECK_RETURN(decode_v32(d, &tag));
   wire_type = tag & 0x7;
   fieldnum = tag >> 3;
+  if (d->stats) d->stats->dispatch_lookups++;
 
   /* Lookup tag.  Because of packed/non-packed compatibility, we have to
    * check the wire type against two possibilities. */
@@ -637,12 +651,14 @@ static int32_t dispatch(upb_pbdecoder *d) {
       upb_inttable_lookup32(dispatch, fieldnum, &val)) {
     uint64_t v = upb_value_getuint64(val);
     if (wire_type == (v & 0xff)) {
+      if (d->stats) d->stats->fields++;
       d->pc = d->top->base + (v >> 16);
       return DECODE_OK;
     } else if (wire_type == ((v >> 8) & 0xff)) {
       bool found =
           upb_inttable_lookup(dispatch, fieldnum + UPB_MAX_FIELDNUMBER, &val);
       UPB_ASSERT(found);
+      if (d->stats) d->stats->fields++;
       d->pc = d->top->base + upb_value_getuint64(val);
       return DECODE_OK;
     }
@@ -669,6 +685,14 @@ static int32_t dispatch(upb_pbdecoder *d) {
   return DECODE_OK;
 }
 
+/* Counts a field whose tag matched the one the bytecode expected next. */
+static void tag_hit(upb_pbdecoder *d) {
+  if (d->stats) {
+    d->stats->tag_hits++;
+    d->stats->fields++;
+  }
+}
+
 /* Callers know that the stack is more than one deep because the opcodes that
  * call this only occur after PUSH operations. */
 upb_pbdecoder_frame *outer_frame(upb_pbdecoder *d) {
@@ -676,49 +700,169 @@ upb_pbdecoder_frame *outer_frame(upb_pbdecoder *d) {
   return d->top - 1;
 }
 
+/* Whether the next value of the given wire format can be decoded without
+ * running off the current buffer (and so without suspending). */
+static bool haswhole(const upb_pbdecoder *d, int bytes) {
+  if (bytes) {
+    return curbufleft(d) >= (size_t)bytes;
+  } else {
+    return curbufleft(d) >= 10 || (curbufleft(d) > 0 && !(*d->ptr & 0x80));
+  }
+}
+
+/* Parses values for OP_PARSE_ARRAY and passes them to the array handler in one
+ * call.  Only the first value may suspend; later ones are only batched while
+ * they are known to be whole, since a suspend would lose the batch. */
+static int32_t decode_array(upb_pbdecoder *d, opcode op, bool packed,
+                            upb_selector_t sel) {
+  union {
+    int32_t i32[64];
+    int64_t i64[64];
+    uint32_t u32[64];
+    uint64_t u64[64];
+    bool b[64];
+    double dbl[64];
+    float flt[64];
+  } buf;
+  size_t n = 0;
+
+#define ARRAY_CASE(type, wt, convfunc, member, vtype, bytes) \
+  case OP_PARSE_ ## type: { \
+    vtype val; \
+    do { \
+      CHECK_RETURN(decode_ ## wt(d, &val)); \
+      buf.member[n++] = (convfunc)(val); \
+    } while (packed && n < 64 && haswhole(d, bytes)); \
+    break; \
+  }
+
+  switch (op) {
+    ARRAY_CASE(INT32,    varint,  int32_t,      i32, uint64_t, 0)
+    ARRAY_CASE(INT64,    varint,  int64_t,      i64, uint64_t, 0)
+    ARRAY_CASE(UINT32,   varint,  uint32_t,     u32, uint64_t, 0)
+    ARRAY_CASE(UINT64,   varint,  uint64_t,     u64, uint64_t, 0)
+    ARRAY_CASE(FIXED32,  fixed32, uint32_t,     u32, uint32_t, 4)
+    ARRAY_CASE(FIXED64,  fixed64, uint64_t,     u64, uint64_t, 8)
+    ARRAY_CASE(SFIXED32, fixed32, int32_t,      i32, uint32_t, 4)
+    ARRAY_CASE(SFIXED64, fixed64, int64_t,      i64, uint64_t, 8)
+    ARRAY_CASE(BOOL,     varint,  bool,         b,   uint64_t, 0)
+    ARRAY_CASE(DOUBLE,   fixed64, as_double,    dbl, uint64_t, 8)
+    ARRAY_CASE(FLOAT,    fixed32, as_float,     flt, uint32_t, 4)
+    ARRAY_CASE(SINT32,   varint,  upb_zzdec_32, i32, uint64_t, 0)
+    ARRAY_CASE(SINT64,   varint,  upb_zzdec_64, i64, uint64_t, 0)
+    default:
+      UPB_ASSERT(false);
+  }
+
+#undef ARRAY_CASE
+
+  upb_sink_putarray(&d->top->sink, sel, &buf, n);
+  return DECODE_OK;
+}
+
 
 /* The main decoding loop *****************************************************/
 
 /* The main decoder VM function.  Uses traditional bytecode dispatch loop with a
- * switch() statement. */
+ * switch() statement.  With GCC and Clang we instead dispatch through a table
+ * of label addresses, so that every opcode ends with its own indirect branch
+ * to the next one; these predict much better than the switch's single branch.
+ * Define UPB_NO_THREADED_VM to always use the switch. */
+#if defined(__GNUC__) && !defined(UPB_NO_THREADED_VM)
+#define UPB_THREADED_VM
+#endif
+
 size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
                       const upb_bufhandle* handle) {
+  int32_t instruction;
+  opcode op;
+  uint32_t arg;
+  int32_t longofs;
+
+#ifdef UPB_THREADED_VM
+#define L(op) __extension__ &&vm_ ## op
+  /* Indexed by opcode; unused opcodes go to vm_badop. */
+  static const void *const labels[OP_MAX + 1] = {
+    L(badop),
+    L(OP_PARSE_DOUBLE), L(OP_PARSE_FLOAT), L(OP_PARSE_INT64),
+    L(OP_PARSE_UINT64), L(OP_PARSE_INT32), L(OP_PARSE_FIXED64),
+    L(OP_PARSE_FIXED32), L(OP_PARSE_BOOL), L(OP_STARTMSG), L(OP_ENDMSG),
+    L(OP_STARTSEQ), L(OP_ENDSEQ), L(OP_PARSE_UINT32), L(OP_STARTSUBMSG),
+    L(OP_PARSE_SFIXED32), L(OP_PARSE_SFIXED64), L(OP_PARSE_SINT32),
+    L(OP_PARSE_SINT64), L(OP_ENDSUBMSG), L(OP_STARTSTR), L(OP_STRING),
+    L(OP_ENDSTR), L(OP_PUSHTAGDELIM), L(OP_PUSHLENDELIM), L(OP_POP),
+    L(OP_SETDELIM), L(OP_SETBIGGROUPNUM), L(OP_CHECKDELIM), L(OP_CALL),
+    L(OP_RET), L(OP_BRANCH), L(OP_TAG1), L(OP_TAG2), L(OP_TAGN),
+    L(OP_SETDISPATCH), L(OP_DISPATCH), L(OP_HALT), L(OP_PROFILE),
+    L(OP_SKIP), L(OP_STORE), L(OP_PARSE_ARRAY), L(OP_STRINGUTF8)
+  };
+#undef L
+#define VMLABEL(op) vm_ ## op:
+#define VMGOTO() __extension__ ({ goto *labels[op]; })
+#define VMNEXT() VMFETCH(); VMGOTO()
+#else
+#define VMLABEL(op)
+#define VMNEXT() break
+#endif
+
+#ifdef UPB_DUMP_BYTECODE
+#define VMDUMP() \
+    fprintf(stderr, "s_ofs=%d buf_ofs=%d data_rem=%d buf_rem=%d delim_rem=%d " \
+                    "%x %s (%d)\n", \
+            (int)offset(d), \
+            (int)(d->ptr - d->buf), \
+            (int)(d->data_end - d->ptr), \
+            (int)(d->end - d->ptr), \
+            (int)((d->top->end_ofs - d->bufstart_ofs) - (d->ptr - d->buf)), \
+            (int)(d->pc - 1 - group->bytecode), \
+            upb_pbdecoder_getopname(op), \
+            arg)
+#else
+#define VMDUMP()
+#endif
+
+#define VMFETCH() \
+    d->last = d->pc; \
+    instruction = *d->pc++; \
+    op = getop(instruction); \
+    arg = instruction >> 8; \
+    longofs = arg; \
+    UPB_ASSERT(d->ptr != d->residual_end); \
+    UPB_ASSERT(op <= OP_MAX); \
+    VMDUMP()
 
 #define VMCASE(op, code) \
-  case op: { code; if (consumes_input(op)) checkpoint(d); break; }
+  case op: VMLABEL(op) { \
+    code; \
+    if (consumes_input(op)) checkpoint(d); \
+    VMNEXT(); \
+  }
 #define PRIMITIVE_OP(type, wt, name, convfunc, ctype) \
   VMCASE(OP_PARSE_ ## type, { \
     ctype val; \
     CHECK_RETURN(decode_ ## wt(d, &val)); \
     upb_sink_put ## name(&d->top->sink, arg, (convfunc)(val)); \
   })
+#define STORE_OP(type, wt, convfunc, ctype, vtype) \
+  case OP_PARSE_ ## type: { \
+    vtype val; \
+    CHECK_RETURN(decode_ ## wt(d, &val)); \
+    *(ctype*)&m[ofs] = (convfunc)(val); \
+    break; \
+  }
 
   while(1) {
-    int32_t instruction;
-    opcode op;
-    uint32_t arg;
-    int32_t longofs;
-
-    d->last = d->pc;
-    instruction = *d->pc++;
-    op = getop(instruction);
-    arg = instruction >> 8;
-    longofs = arg;
-    UPB_ASSERT(d->ptr != d->residual_end);
-    UPB_UNUSED(group);
-#ifdef UPB_DUMP_BYTECODE
-    fprintf(stderr, "s_ofs=%d buf_ofs=%d data_rem=%d buf_rem=%d delim_rem=%d "
-                    "%x %s (%d)\n",
-            (int)offset(d),
-            (int)(d->ptr - d->buf),
-            (int)(d->data_end - d->ptr),
-            (int)(d->end - d->ptr),
-            (int)((d->top->end_ofs - d->bufstart_ofs) - (d->ptr - d->buf)),
-            (int)(d->pc - 1 - group->bytecode),
-            upb_pbdecoder_getopname(op),
-            arg);
+    VMFETCH();
+#ifdef UPB_THREADED_VM
+    VMGOTO();
 #endif
     switch (op) {
+#ifdef UPB_THREADED_VM
+      default:
+      vm_badop:
+        UPB_ASSERT(false);
+        break;
+#endif
       /* Technically, we are losing data if we see a 32-bit varint that is not
        * properly sign-extended.  We could detect this and error about the data
        * loss, but proto2 does not do this, so we pass. */
@@ -791,6 +935,36 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
           return upb_pbdecoder_suspend(d);
         }
       )
+      VMCASE(OP_STRINGUTF8,
+        uint32_t len = curbufleft(d);
+        size_t n = upb_sink_putstring(&d->top->sink, arg, d->ptr, len, handle);
+        if (n > len) {
+          /* The rest of the string is skipped unchecked. */
+          upb_utf8_init(&d->utf8);
+          if (n > delim_remaining(d)) {
+            seterr(d, "Tried to skip past end of string.");
+            return upb_pbdecoder_suspend(d);
+          } else {
+            int32_t ret = skip(d, n);
+            UPB_ASSERT(ret >= 0);
+            return ret;
+          }
+        }
+        if (!upb_utf8_check(&d->utf8, d->ptr, n)) {
+          seterr(d, "String field is not valid UTF-8.");
+          return upb_pbdecoder_suspend(d);
+        }
+        advance(d, n);
+        if (n < len || d->delim_end == NULL) {
+          d->pc--;  /* Repeat OP_STRINGUTF8. */
+          if (n > 0) checkpoint(d);
+          return upb_pbdecoder_suspend(d);
+        }
+        if (!upb_utf8_done(&d->utf8)) {
+          seterr(d, "String field is not valid UTF-8.");
+          return upb_pbdecoder_suspend(d);
+        }
+      )
       VMCASE(OP_ENDSTR,
         CHECK_SUSPEND(upb_sink_endstr(&d->top->sink, arg));
       )
@@ -838,6 +1012,7 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
         expected = (arg >> 8) & 0xff;
         if (*d->ptr == expected) {
           advance(d, 1);
+          tag_hit(d);
         } else {
           int8_t shortofs;
          badtag:
@@ -846,7 +1021,7 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
             CHECK_RETURN(dispatch(d));
           } else {
             d->pc += shortofs;
-            break; /* Avoid checkpoint(). */
+            VMNEXT(); /* Avoid checkpoint(). */
           }
         }
       )
@@ -867,6 +1042,7 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
           if (result == DECODE_MISMATCH) goto badtag;
           if (result >= 0) return result;
         }
+        tag_hit(d);
       )
       VMCASE(OP_TAGN, {
         uint64_t expected;
@@ -876,6 +1052,7 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
         result = upb_pbdecoder_checktag_slow(d, expected);
         if (result == DECODE_MISMATCH) goto badtag;
         if (result >= 0) return result;
+        tag_hit(d);
       })
       VMCASE(OP_DISPATCH, {
         CHECK_RETURN(dispatch(d));
@@ -883,8 +1060,88 @@ size_t run_decoder_vm(upb_pbdecoder *d, const mgroup *group,
       VMCASE(OP_HALT, {
         return d->size_param;
       })
+      VMCASE(OP_PROFILE, {
+        const void *p;
+        memcpy(&p, d->pc, sizeof(void*));
+        d->pc += sizeof(void*) / sizeof(uint32_t);
+        if (!arg) {
+          upb_pbdecoderprofile_record(group->profile, d->top->profile_prev, p);
+        }
+        d->top->profile_prev = p;
+      })
+      VMCASE(OP_STORE, {
+        /* Same decoding as the PRIMITIVE_OPs above, but the handler promised
+         * to be a plain store, so we do it ourselves. */
+        uint8_t *m = d->top->sink.closure;
+        uint32_t ofs = d->pc[0];
+        int32_t hasbit = (int32_t)d->pc[1];
+        switch (arg) {
+          STORE_OP(INT32,    varint,  int32_t,      int32_t,  uint64_t)
+          STORE_OP(INT64,    varint,  int64_t,      int64_t,  uint64_t)
+          STORE_OP(UINT32,   varint,  uint32_t,     uint32_t, uint64_t)
+          STORE_OP(UINT64,   varint,  uint64_t,     uint64_t, uint64_t)
+          STORE_OP(FIXED32,  fixed32, uint32_t,     uint32_t, uint32_t)
+          STORE_OP(FIXED64,  fixed64, uint64_t,     uint64_t, uint64_t)
+          STORE_OP(SFIXED32, fixed32, int32_t,      int32_t,  uint32_t)
+          STORE_OP(SFIXED64, fixed64, int64_t,      int64_t,  uint64_t)
+          STORE_OP(BOOL,     varint,  bool,         bool,     uint64_t)
+          STORE_OP(DOUBLE,   fixed64, as_double,    double,   uint64_t)
+          STORE_OP(FLOAT,    fixed32, as_float,     float,    uint32_t)
+          STORE_OP(SINT32,   varint,  upb_zzdec_32, int32_t,  uint64_t)
+          STORE_OP(SINT64,   varint,  upb_zzdec_64, int64_t,  uint64_t)
+          default:
+            UPB_ASSERT(false);
+        }
+        d->pc += 2;
+        if (hasbit >= 0) {
+          m[hasbit / 8] |= 1 << (hasbit % 8);
+        }
+      })
+      VMCASE(OP_PARSE_ARRAY,
+        CHECK_RETURN(decode_array(d, arg & 0xff, arg >> 8, *d->pc));
+        d->pc++;
+      )
+      VMCASE(OP_SKIP, {
+        /* Once we start skipping over bytes, a suspend must resume after this
+         * instruction instead of repeating it. */
+        switch (arg) {
+          case UPB_WIRE_TYPE_VARINT: {
+            uint64_t u64;
+            CHECK_RETURN(decode_varint(d, &u64));
+            break;
+          }
+          case UPB_WIRE_TYPE_64BIT:
+            d->last = d->pc;
+            CHECK_RETURN(skip(d, 8));
+            break;
+          case UPB_WIRE_TYPE_32BIT:
+            d->last = d->pc;
+            CHECK_RETURN(skip(d, 4));
+            break;
+          case UPB_WIRE_TYPE_DELIMITED: {
+            uint32_t len;
+            CHECK_RETURN(decode_v32(d, &len));
+            d->last = d->pc;
+            CHECK_RETURN(skip(d, len));
+            break;
+          }
+          default:
+            UPB_ASSERT(false);
+        }
+      })
     }
   }
+
+#undef VMCASE
+#undef PRIMITIVE_OP
+#undef STORE_OP
+#undef VMFETCH
+#undef VMDUMP
+#undef VMNEXT
+#undef VMLABEL
+#ifdef UPB_THREADED_VM
+#undef VMGOTO
+#endif
 }
 
 
@@ -899,6 +1156,10 @@ void *upb_pbdecoder_startbc(void *closure, const void *pc, size_t size_hint) {
   d->callstack[0] = &halt;
   d->pc = pc;
   d->skip = 0;
+  upb_utf8_init(&d->utf8);
+  d->stats_blocks = upb_arena_blockcount(upb_env_arena(d->env));
+  upb_trace(UPB_TRACE_PBDECODER, false, false,
+            upb_handlers_msgdef(d->stack->sink.handlers), NULL, 0);
   return d;
 }
 
@@ -910,14 +1171,16 @@ void *upb_pbdecoder_startjit(void *closure, const void *hd, size_t size_hint) {
   d->bufstart_ofs = 0;
   d->call_len = 0;
   d->skip = 0;
+  d->stats_blocks = upb_arena_blockcount(upb_env_arena(d->env));
+  upb_trace(UPB_TRACE_PBDECODER, false, false,
+            upb_handlers_msgdef(d->stack->sink.handlers), NULL, 0);
   return d;
 }
 
-bool upb_pbdecoder_end(void *closure, const void *handler_data) {
+static bool end_stream(void *closure, const void *handler_data) {
   upb_pbdecoder *d = closure;
   const upb_pbdecodermethod *method = handler_data;
   uint64_t end;
-  char dummy;
 
   if (d->residual_end > d->residual) {
     seterr(d, "Unexpected EOF: decoder still has buffered unparsed data");
@@ -943,7 +1206,7 @@ bool upb_pbdecoder_end(void *closure, const void *handler_data) {
     const mgroup *group = (const mgroup*)method->group;
     if (d->top != d->stack)
       d->stack->end_ofs = 0;
-    group->jit_code(closure, method->code_base.ptr, &dummy, 0, NULL);
+    group->jit_code(closure, method->code_base.ptr, &dummy_char, 0, NULL);
   } else
 #endif
   {
@@ -959,7 +1222,7 @@ bool upb_pbdecoder_end(void *closure, const void *handler_data) {
              getop(*d->pc) == OP_DISPATCH);
       d->pc = p;
     }
-    upb_pbdecoder_decode(closure, handler_data, &dummy, 0, NULL);
+    upb_pbdecoder_decode(closure, handler_data, &dummy_char, 0, NULL);
   }
 
   if (d->call_len != 0) {
@@ -967,9 +1230,23 @@ bool upb_pbdecoder_end(void *closure, const void *handler_data) {
     return false;
   }
 
+  if (d->stats) {
+    d->stats->bytes += end;
+    d->stats->arena_blocks +=
+        upb_arena_blockcount(upb_env_arena(d->env)) - d->stats_blocks;
+  }
+
   return true;
 }
 
+bool upb_pbdecoder_end(void *closure, const void *handler_data) {
+  upb_pbdecoder *d = closure;
+  bool ok = end_stream(closure, handler_data);
+  upb_trace(UPB_TRACE_PBDECODER, true, ok,
+            upb_handlers_msgdef(d->stack->sink.handlers), NULL, offset(d));
+  return ok;
+}
+
 size_t upb_pbdecoder_decode(void *decoder, const void *group, const char *buf,
                             size_t size, const upb_bufhandle *handle) {
   int32_t result = upb_pbdecoder_resume(decoder, NULL, buf, size, handle);
@@ -1013,6 +1290,8 @@ upb_pbdecoder *upb_pbdecoder_create(upb_env *e, const upb_pbdecodermethod *m,
   d->limit = d->stack + default_max_nesting - 1;
   d->stack_size = default_max_nesting;
   d->status = NULL;
+  d->stats = NULL;
+  d->stats_blocks = 0;
 
   upb_pbdecoder_reset(d);
   upb_bytessink_reset(&d->input_, &m->input_handler_, d);
@@ -1042,6 +1321,14 @@ upb_bytessink *upb_pbdecoder_input(upb_pbdecoder *d) {
   return &d->input_;
 }
 
+upb_decstats *upb_pbdecoder_stats(const upb_pbdecoder *d) {
+  return d->stats;
+}
+
+void upb_pbdecoder_setstats(upb_pbdecoder *d, upb_decstats *s) {
+  d->stats = s;
+}
+
 size_t upb_pbdecoder_maxnesting(const upb_pbdecoder *d) {
   return d->stack_size;
 }
@@ -1078,3 +1365,152 @@ bool upb_pbdecoder_setmaxnesting(upb_pbdecoder *d, size_t max) {
   d->limit = d->stack + max - 1;
   return true;
 }
+
+
+/* Stream decoder *************************************************************/
+
+/* Splits a stream of varint-length-prefixed records and feeds each one through
+ * a single upb_pbdecoder, resetting it between records. */
+struct upb_pbstreamdecoder {
+  upb_pbdecoder *decoder;
+
+  /* Our input sink, and the handler that backs it. */
+  upb_byteshandler input_handler_;
+  upb_bytessink input_;
+
+  /* Length prefix of the next record, accumulated a byte at a time since it
+   * may be split across buffers. */
+  uint64_t len;
+  int len_bits;
+
+  /* Bytes left in the record currently being decoded, if in_record. */
+  uint64_t remaining;
+  bool in_record;
+
+  /* Closure the inner decoder's input sink is started with. */
+  void *subc;
+
+  uint64_t count;
+};
+
+static bool stream_startrecord(upb_pbstreamdecoder *s) {
+  upb_bytessink *input = upb_pbdecoder_input(s->decoder);
+  s->subc = input->closure;
+  if (!upb_bytessink_start(input, (size_t)s->len, &s->subc)) return false;
+  s->remaining = s->len;
+  s->in_record = true;
+  s->len = 0;
+  s->len_bits = 0;
+  return true;
+}
+
+static bool stream_endrecord(upb_pbstreamdecoder *s) {
+  upb_bytessink *input = upb_pbdecoder_input(s->decoder);
+  if (!upb_bytessink_end(input)) return false;
+  upb_pbdecoder_reset(s->decoder);
+  s->in_record = false;
+  s->count++;
+  return true;
+}
+
+static void *stream_start(void *closure, const void *hd, size_t size_hint) {
+  upb_pbstreamdecoder *s = closure;
+  UPB_UNUSED(hd);
+  UPB_UNUSED(size_hint);
+  s->len = 0;
+  s->len_bits = 0;
+  s->remaining = 0;
+  s->in_record = false;
+  s->count = 0;
+  upb_pbdecoder_reset(s->decoder);
+  return s;
+}
+
+static size_t stream_putbuf(void *closure, const void *hd, const char *buf,
+                            size_t size, const upb_bufhandle *handle) {
+  upb_pbstreamdecoder *s = closure;
+  size_t ofs = 0;
+  UPB_UNUSED(hd);
+
+  while (ofs < size) {
+    if (!s->in_record) {
+      uint8_t byte = buf[ofs++];
+      if (s->len_bits >= 70) {
+        upb_pbdecoder_seterr(s->decoder, "Record length varint too long");
+        return ofs - 1;
+      }
+      s->len |= (uint64_t)(byte & 0x7f) << s->len_bits;
+      s->len_bits += 7;
+      if (byte & 0x80) continue;
+      if (!stream_startrecord(s)) {
+        /* Un-read the last byte so it is parsed again when resumed. */
+        s->len_bits -= 7;
+        s->len &= ~((uint64_t)0x7f << s->len_bits);
+        return ofs - 1;
+      }
+    } else {
+      size_t n = size - ofs;
+      size_t ret;
+      if (n > s->remaining) n = (size_t)s->remaining;
+      ret = upb_bytessink_putbuf(upb_pbdecoder_input(s->decoder), s->subc,
+                                 buf + ofs, n, handle);
+      if (ret < n) {
+        /* Error or suspend; the caller will resume at the first byte the
+         * decoder did not consume. */
+        s->remaining -= ret;
+        return ofs + ret;
+      }
+      /* A return value greater than n asks to skip bytes that extend past
+       * this buffer; the decoder also skips them when they are passed in, and
+       * they never extend past the record, so we simply keep feeding. */
+      ofs += n;
+      s->remaining -= n;
+    }
+
+    if (s->in_record && s->remaining == 0 && !stream_endrecord(s)) {
+      return ofs;
+    }
+  }
+
+  return size;
+}
+
+static bool stream_end(void *closure, const void *hd) {
+  upb_pbstreamdecoder *s = closure;
+  UPB_UNUSED(hd);
+  if (s->in_record || s->len_bits > 0) {
+    upb_pbdecoder_seterr(s->decoder, "Unexpected EOF inside delimited record");
+    return false;
+  }
+  return true;
+}
+
+upb_pbstreamdecoder *upb_pbstreamdecoder_create(
+    upb_env *e, const upb_pbdecodermethod *m, upb_sink *sink) {
+  upb_pbstreamdecoder *s = upb_env_malloc(e, sizeof(upb_pbstreamdecoder));
+  if (!s) return NULL;
+
+  s->decoder = upb_pbdecoder_create(e, m, sink);
+  if (!s->decoder) return NULL;
+
+  upb_byteshandler_init(&s->input_handler_);
+  upb_byteshandler_setstartstr(&s->input_handler_, stream_start, NULL);
+  upb_byteshandler_setstring(&s->input_handler_, stream_putbuf, NULL);
+  upb_byteshandler_setendstr(&s->input_handler_, stream_end, NULL);
+  upb_bytessink_reset(&s->input_, &s->input_handler_, s);
+
+  stream_start(s, NULL, 0);
+  return s;
+}
+
+upb_bytessink *upb_pbstreamdecoder_input(upb_pbstreamdecoder *s) {
+  return &s->input_;
+}
+
+upb_pbdecoder *upb_pbstreamdecoder_decoder(upb_pbstreamdecoder *s) {
+  return s->decoder;
+}
+
+uint64_t upb_pbstreamdecoder_count(const upb_pbstreamdecoder *s) {
+  return s->count;
+}
@@ -24,6 +24,8 @@ class CodeCache;
 class Decoder;
 class DecoderMethod;
 class DecoderMethodOptions;
+class DecoderProfile;
+class StreamDecoder;
 }  /* namespace pb */
 }  /* namespace upb */
 #endif
@@ -31,6 +33,8 @@ class DecoderMethodOptions;
 UPB_DECLARE_TYPE(upb::pb::CodeCache, upb_pbcodecache)
 UPB_DECLARE_TYPE(upb::pb::Decoder, upb_pbdecoder)
 UPB_DECLARE_TYPE(upb::pb::DecoderMethodOptions, upb_pbdecodermethodopts)
+UPB_DECLARE_TYPE(upb::pb::DecoderProfile, upb_pbdecoderprofile)
+UPB_DECLARE_TYPE(upb::pb::StreamDecoder, upb_pbstreamdecoder)
 
 UPB_DECLARE_DERIVED_TYPE(upb::pb::DecoderMethod, upb::RefCounted,
                          upb_pbdecodermethod, upb_refcounted)
@@ -42,6 +46,9 @@ UPB_DECLARE_DERIVED_TYPE(upb::pb::DecoderMethod, upb::RefCounted,
  * Should only be used by unit tests. */
 #define UPB_DECODER_MAX_RESIDUAL_BYTES 14
 
+/* The number of hash buckets in a upb_pbcodecache. */
+#define UPB_PBCODECACHE_BUCKETS 64
+
 #ifdef __cplusplus
 
 /* The parameters one uses to construct a DecoderMethod.
@@ -57,13 +64,57 @@ class upb::pb::DecoderMethodOptions {
    * them?  The caller should set this iff the lazy handlers expect data that is
    * in protobuf binary format and the caller wishes to lazy parse it. */
   void set_lazy(bool lazy);
+
+  /* Compiles the method using the given profile (which must outlive the
+   * method).  If "record" is true, the method records the order in which
+   * fields arrive into the profile, and is never JIT-compiled.  Otherwise the
+   * method checks for fields in the order the profile most often saw them,
+   * which lets more of them match without a dispatch table lookup. */
+  void set_profile(DecoderProfile* profile, bool record);
+
+  /* Should the decoder skip fields that have no handlers, and submessages
+   * whose handlers (transitively) have none?  Skipping them is much cheaper
+   * than parsing them, but they won't be checked for errors either.  A
+   * projection method is never JIT-compiled. */
+  void set_projection(bool projection);
+
+  /* Should the decoder fail on string fields of proto3 messages that aren't
+   * valid UTF-8, as upb_decode() does?  Only the data that reaches the string
+   * handlers is checked, not any that they skip.  A method that checks is
+   * never JIT-compiled. */
+  void set_validate_utf8(bool validate);
 #else
 struct upb_pbdecodermethodopts {
 #endif
   const upb_handlers *handlers;
   bool lazy;
+  upb_pbdecoderprofile *profile;
+  bool record_profile;
+  bool projection;
+  bool validate_utf8;
+};
+
+#ifdef __cplusplus
+
+/* Counts of which fields follow which, as seen by decoders for methods that
+ * were created to record them.  See DecoderMethodOptions::set_profile().
+ *
+ * This class is not thread-safe; only one decoder at a time may record into a
+ * given profile. */
+class upb::pb::DecoderProfile {
+ public:
+  static DecoderProfile* New();
+  static void Free(DecoderProfile* p);
+
+  /* The number of field transitions recorded so far. */
+  uint64_t count() const;
+
+ private:
+  UPB_DISALLOW_POD_OPS(DecoderProfile, upb::pb::DecoderProfile)
 };
 
+#endif
+
 #ifdef __cplusplus
 
 /* Represents the code to parse a protobuf according to a destination
@@ -98,7 +149,7 @@ class upb::pb::DecoderMethod {
  * constructed.  This hint may be an overestimate for some build configurations.
  * But if the decoder library is upgraded without recompiling the application,
  * it may be an underestimate. */
-#define UPB_PB_DECODER_SIZE 4416
+#define UPB_PB_DECODER_SIZE 4944
 
 #ifdef __cplusplus
 
@@ -139,6 +190,15 @@ class upb::pb::Decoder {
   size_t max_nesting() const;
   bool set_max_nesting(size_t max);
 
+  /* Gets/sets the counters this decoder updates, or NULL (the default) for
+   * none.  Suspends, resumes, bytes, unknown fields and arena blocks are
+   * counted by both the interpreter and the JIT; the rest only by the
+   * interpreter, and a field split across two buffers may be counted twice.
+   * The depth counts repeated fields as well as submessages, like
+   * max_nesting(). */
+  upb_decstats* stats() const;
+  void set_stats(upb_decstats* stats);
+
   void Reset();
 
   static const size_t kSize = UPB_PB_DECODER_SIZE;
@@ -151,10 +211,47 @@ class upb::pb::Decoder {
 
 #ifdef __cplusplus
 
+/* A StreamDecoder parses a stream of length-delimited messages, as written by
+ * writeDelimitedTo() in the other protobuf implementations: each record is a
+ * varint length followed by that many bytes of message.  Every record is fed
+ * through a single Decoder, so its stack and compiled method are reused from
+ * one message to the next; the output sink sees one startmsg/endmsg pair per
+ * record.
+ *
+ * Records and their length prefixes may be split across buffers arbitrarily.
+ * Ending the input in the middle of a record is an error. */
+class upb::pb::StreamDecoder {
+ public:
+  /* Like Decoder::Create(); the method and sink are passed to the Decoder that
+   * parses each record. */
+  static StreamDecoder* Create(Environment* env, const DecoderMethod* method,
+                               Sink* output);
+
+  /* The sink on which this decoder receives the record stream. */
+  BytesSink* input();
+
+  /* The Decoder that parses the records themselves. */
+  Decoder* decoder();
+
+  /* Returns the number of records fully decoded since the stream started. */
+  uint64_t count() const;
+
+ private:
+  UPB_DISALLOW_POD_OPS(StreamDecoder, upb::pb::StreamDecoder)
+};
+
+#endif  /* __cplusplus */
+
+#ifdef __cplusplus
+
 /* A class for caching protobuf processing code, whether bytecode for the
  * interpreted decoder or machine code for the JIT.
  *
- * This class is not thread-safe.
+ * GetDecoderMethod() and CompilePending() are thread-safe, so one cache can be
+ * shared by many threads, which then share a single compiled copy of each
+ * method.  Finding a method that is already cached takes no locks.  (If two
+ * threads miss on the same handlers at once, both compile them and one copy
+ * is discarded.)  The other functions are not thread-safe.
  *
  * TODO(haberman): move this to be heap allocated for ABI stability. */
 class upb::pb::CodeCache {
@@ -175,6 +272,42 @@ class upb::pb::CodeCache {
    * any code generation, otherwise returns false and does nothing. */
   bool set_allow_jit(bool allow);
 
+  /* Whether JIT compilation is deferred.  Defaults to false.  When true,
+   * GetDecoderMethod() returns an interpreted method right away instead of
+   * JIT-compiling it, and queues it for CompilePending().  This keeps the
+   * cost of the JIT off the path of the first request for each message type.
+   *
+   * Like set_allow_jit(), this may only be called prior to any code
+   * generation, otherwise returns false and does nothing. */
+  bool defer_jit() const;
+  bool set_defer_jit(bool defer);
+
+  /* The most machine code, in bytes, that the cache will hold.  Defaults to
+   * no limit.  A method whose machine code would take the total past the
+   * limit is interpreted instead, and compiled code is never evicted, so the
+   * methods compiled first keep the budget.  With defer_jit() the methods
+   * that were looked up most often while they were queued are compiled first,
+   * so the budget goes to the hot message types and the long tail stays in
+   * the interpreter.
+   *
+   * Like set_allow_jit(), this may only be called prior to any code
+   * generation, otherwise returns false and does nothing. */
+  size_t jit_limit() const;
+  bool set_jit_limit(size_t bytes);
+
+  /* The bytes of machine code the cache currently holds. */
+  size_t jit_bytes() const;
+
+  /* JIT-compiles every method queued since the last call, so that later calls
+   * to GetDecoderMethod() return native code.  Methods that were already
+   * returned stay valid (and interpreted) for as long as the cache is alive.
+   * Returns the number of methods that were compiled, which leaves out any
+   * that did not fit in jit_limit().
+   *
+   * Like the rest of this class this is not thread-safe, but it can be called
+   * from a background thread as long as access to the cache is serialized. */
+  size_t CompilePending();
+
   /* Returns a DecoderMethod that can push data to the given handlers.
    * If a suitable method already exists, it will be returned from the cache.
    *
@@ -182,7 +315,7 @@ class upb::pb::CodeCache {
    * statically bound to the destination handlers if possible, which can allow
    * more efficient decoding.  However the returned method may or may not
    * actually be statically bound.  But in all cases, the returned method can
-   * push data to the given handlers. */
+   * push data to the given handlers.  Returns NULL on out-of-memory. */
   const DecoderMethod *GetDecoderMethod(const DecoderMethodOptions& opts);
 
   /* If/when someone needs to explicitly create a dynamically-bound
@@ -194,9 +327,14 @@ class upb::pb::CodeCache {
 struct upb_pbcodecache {
 #endif
   bool allow_jit_;
-
-  /* Array of mgroups. */
-  upb_inttable groups;
+  bool defer_jit_;
+  size_t jit_limit_;
+  size_t jit_bytes_;  /* Updated atomically. */
+
+  /* Hash table of cache entries (see compile_decoder.c).  Each bucket is a
+   * linked list that is only ever prepended to, so it can be read without
+   * locks. */
+  const void *buckets[UPB_PBCODECACHE_BUCKETS];
 };
 
 UPB_BEGIN_EXTERN_C
@@ -209,11 +347,30 @@ upb_bytessink *upb_pbdecoder_input(upb_pbdecoder *d);
 uint64_t upb_pbdecoder_bytesparsed(const upb_pbdecoder *d);
 size_t upb_pbdecoder_maxnesting(const upb_pbdecoder *d);
 bool upb_pbdecoder_setmaxnesting(upb_pbdecoder *d, size_t max);
+upb_decstats *upb_pbdecoder_stats(const upb_pbdecoder *d);
+void upb_pbdecoder_setstats(upb_pbdecoder *d, upb_decstats *s);
 void upb_pbdecoder_reset(upb_pbdecoder *d);
 
+upb_pbstreamdecoder *upb_pbstreamdecoder_create(
+    upb_env *e, const upb_pbdecodermethod *method, upb_sink *output);
+upb_bytessink *upb_pbstreamdecoder_input(upb_pbstreamdecoder *d);
+upb_pbdecoder *upb_pbstreamdecoder_decoder(upb_pbstreamdecoder *d);
+uint64_t upb_pbstreamdecoder_count(const upb_pbstreamdecoder *d);
+
 void upb_pbdecodermethodopts_init(upb_pbdecodermethodopts *opts,
                                   const upb_handlers *h);
 void upb_pbdecodermethodopts_setlazy(upb_pbdecodermethodopts *opts, bool lazy);
+void upb_pbdecodermethodopts_setprofile(upb_pbdecodermethodopts *opts,
+                                        upb_pbdecoderprofile *profile,
+                                        bool record);
+void upb_pbdecodermethodopts_setprojection(upb_pbdecodermethodopts *opts,
+                                           bool projection);
+void upb_pbdecodermethodopts_setvalidateutf8(upb_pbdecodermethodopts *opts,
+                                             bool validate);
+
+upb_pbdecoderprofile *upb_pbdecoderprofile_new(void);
+void upb_pbdecoderprofile_free(upb_pbdecoderprofile *p);
+uint64_t upb_pbdecoderprofile_count(const upb_pbdecoderprofile *p);
 
 
 /* Include refcounted methods like upb_pbdecodermethod_ref(). */
@@ -231,6 +388,12 @@ void upb_pbcodecache_init(upb_pbcodecache *c);
 void upb_pbcodecache_uninit(upb_pbcodecache *c);
 bool upb_pbcodecache_allowjit(const upb_pbcodecache *c);
 bool upb_pbcodecache_setallowjit(upb_pbcodecache *c, bool allow);
+bool upb_pbcodecache_deferjit(const upb_pbcodecache *c);
+bool upb_pbcodecache_setdeferjit(upb_pbcodecache *c, bool defer);
+size_t upb_pbcodecache_jitlimit(const upb_pbcodecache *c);
+bool upb_pbcodecache_setjitlimit(upb_pbcodecache *c, size_t bytes);
+size_t upb_pbcodecache_jitbytes(const upb_pbcodecache *c);
+size_t upb_pbcodecache_compilepending(upb_pbcodecache *c);
 const upb_pbdecodermethod *upb_pbcodecache_getdecodermethod(
     upb_pbcodecache *c, const upb_pbdecodermethodopts *opts);
 
@@ -262,14 +425,55 @@ inline size_t Decoder::max_nesting() const {
 inline bool Decoder::set_max_nesting(size_t max) {
   return upb_pbdecoder_setmaxnesting(this, max);
 }
+inline upb_decstats* Decoder::stats() const {
+  return upb_pbdecoder_stats(this);
+}
+inline void Decoder::set_stats(upb_decstats* stats) {
+  upb_pbdecoder_setstats(this, stats);
+}
 inline void Decoder::Reset() { upb_pbdecoder_reset(this); }
 
+inline StreamDecoder* StreamDecoder::Create(Environment* env,
+                                            const DecoderMethod* m,
+                                            Sink* sink) {
+  return upb_pbstreamdecoder_create(env, m, sink);
+}
+inline BytesSink* StreamDecoder::input() {
+  return upb_pbstreamdecoder_input(this);
+}
+inline Decoder* StreamDecoder::decoder() {
+  return upb_pbstreamdecoder_decoder(this);
+}
+inline uint64_t StreamDecoder::count() const {
+  return upb_pbstreamdecoder_count(this);
+}
+
 inline DecoderMethodOptions::DecoderMethodOptions(const Handlers* h) {
   upb_pbdecodermethodopts_init(this, h);
 }
 inline void DecoderMethodOptions::set_lazy(bool lazy) {
   upb_pbdecodermethodopts_setlazy(this, lazy);
 }
+inline void DecoderMethodOptions::set_profile(DecoderProfile* profile,
+                                              bool record) {
+  upb_pbdecodermethodopts_setprofile(this, profile, record);
+}
+inline void DecoderMethodOptions::set_projection(bool projection) {
+  upb_pbdecodermethodopts_setprojection(this, projection);
+}
+inline void DecoderMethodOptions::set_validate_utf8(bool validate) {
+  upb_pbdecodermethodopts_setvalidateutf8(this, validate);
+}
+
+inline DecoderProfile* DecoderProfile::New() {
+  return upb_pbdecoderprofile_new();
+}
+inline void DecoderProfile::Free(DecoderProfile* p) {
+  upb_pbdecoderprofile_free(p);
+}
+inline uint64_t DecoderProfile::count() const {
+  return upb_pbdecoderprofile_count(this);
+}
 
 inline const Handlers* DecoderMethod::dest_handlers() const {
   return upb_pbdecodermethod_desthandlers(this);
@@ -299,6 +503,24 @@ inline bool CodeCache::allow_jit() const {
 inline bool CodeCache::set_allow_jit(bool allow) {
   return upb_pbcodecache_setallowjit(this, allow);
 }
+inline bool CodeCache::defer_jit() const {
+  return upb_pbcodecache_deferjit(this);
+}
+inline bool CodeCache::set_defer_jit(bool defer) {
+  return upb_pbcodecache_setdeferjit(this, defer);
+}
+inline size_t CodeCache::jit_limit() const {
+  return upb_pbcodecache_jitlimit(this);
+}
+inline bool CodeCache::set_jit_limit(size_t bytes) {
+  return upb_pbcodecache_setjitlimit(this, bytes);
+}
+inline size_t CodeCache::jit_bytes() const {
+  return upb_pbcodecache_jitbytes(this);
+}
+inline size_t CodeCache::CompilePending() {
+  return upb_pbcodecache_compilepending(this);
+}
 inline const DecoderMethod *CodeCache::GetDecoderMethod(
     const DecoderMethodOptions& opts) {
   return upb_pbcodecache_getdecodermethod(this, &opts);
@@ -11,6 +11,13 @@
 #include "upb/sink.h"
 #include "upb/structdefs.int.h"
 #include "upb/table.int.h"
+#include "upb/utf8.int.h"
+
+/* The only JIT backend is compile_decoder_x64.dasc; other CPUs use the
+ * bytecode interpreter. */
+#if defined(UPB_USE_JIT_X64) && !defined(__x86_64__)
+#error "UPB_USE_JIT_X64 requires an x86-64 target"
+#endif
 
 /* C++ names are not actually used since this type isn't exposed to users. */
 #ifdef __cplusplus
@@ -77,10 +84,42 @@ typedef enum {
 
   OP_DISPATCH       = 36,  /* No arg. */
 
-  OP_HALT           = 37   /* No arg. */
+  OP_HALT           = 37,  /* No arg. */
+
+  OP_PROFILE        = 38,  /* N words: */
+                           /*   | start (24)          | opc | */
+                           /*   | fielddef* or msgdef* (32 or 64) | */
+                           /* Only emitted when recording a profile, which is
+                            * never JIT-compiled. */
+
+  OP_SKIP           = 39,  /* | wire type (24) | opc | */
+                           /* Only emitted for projections, which are never
+                            * JIT-compiled. */
+
+  OP_STORE          = 40,  /* three words: */
+                           /*   | parse op (24)      | opc | */
+                           /*   |     closure offset (32)    | */
+                           /*   |  hasbit (32, -1 for none)  | */
+                           /* Parses like the given OP_PARSE_* op, but writes
+                            * the value into the closure directly, for
+                            * handlers with a store attribute.  Never
+                            * JIT-compiled. */
+
+  OP_PARSE_ARRAY    = 41,  /* two words: */
+                           /*   | packed (16) | parse op (8) | opc | */
+                           /*   |      array selector (32)        | */
+                           /* Parses values like the given OP_PARSE_* op and
+                            * passes them to the field's array handler.  If
+                            * "packed", parses as many as are available in the
+                            * current buffer, otherwise exactly one.  Never
+                            * JIT-compiled. */
+
+  OP_STRINGUTF8     = 42   /* Like OP_STRING, but fails unless the string is
+                            * valid UTF-8.  Only emitted for methods that
+                            * validate UTF-8, which are never JIT-compiled. */
 } opcode;
 
-#define OP_MAX OP_HALT
+#define OP_MAX OP_STRINGUTF8
 
 UPB_INLINE opcode getop(uint32_t instr) { return instr & 0xff; }
 
@@ -112,6 +151,9 @@ struct mgroup {
   uint32_t *bytecode;
   uint32_t *bytecode_end;
 
+  /* The profile that OP_PROFILE records into, if any.  Not owned. */
+  upb_pbdecoderprofile *profile;
+
 #ifdef UPB_USE_JIT_X64
   /* JIT-generated machine code, if any. */
   upb_string_handlerfunc *jit_code;
@@ -157,6 +199,9 @@ typedef struct {
    * A negative number indicates an unknown group. */
   int32_t groupnum;
   upb_inttable *dispatch;  /* Not used by the JIT. */
+
+  /* The last field (or the msgdef, at the start) seen by OP_PROFILE. */
+  const void *profile_prev;  /* Not used by the JIT. */
 } upb_pbdecoder_frame;
 
 struct upb_pbdecodermethod {
@@ -239,6 +284,15 @@ struct upb_pbdecoder {
 
   upb_status *status;
 
+  /* Counters to update, or NULL, and the arena's block count when the current
+   * message started. */
+  upb_decstats *stats;
+  size_t stats_blocks;
+
+  /* For OP_STRINGUTF8: how much of a character the string has so far.  Always
+   * at a character boundary between strings. */
+  upb_utf8state utf8;
+
 #ifdef UPB_USE_JIT_X64
   /* Used momentarily by the generated code to store a value while a user
    * function is called. */
@@ -274,6 +328,20 @@ extern const char *kPbDecoderSubmessageTooLong;
 /* Access to decoderplan members needed by the decoder. */
 const char *upb_pbdecoder_getopname(unsigned int op);
 
+struct upb_pbdecoderprofile {
+  /* How often each field followed another, keyed by the pair of pointers
+   * (from, to).  "from" is a fielddef, or the msgdef for the first field of a
+   * message; "to" is always a fielddef.  Values are uint64 counts. */
+  upb_strtable transitions;
+  uint64_t count;
+};
+
+/* Called by OP_PROFILE. */
+void upb_pbdecoderprofile_record(upb_pbdecoderprofile *p, const void *from,
+                                 const void *to);
+uint64_t upb_pbdecoderprofile_transitions(const upb_pbdecoderprofile *p,
+                                          const void *from, const void *to);
+
 /* JIT codegen entry point. */
 void upb_pbdecoder_jit(mgroup *group);
 void upb_pbdecoder_freejit(mgroup *group);
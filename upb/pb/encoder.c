@@ -44,8 +44,9 @@
 **   (1) makes you always pay for exactly one copy, but its implementation is
 **       the simplest and its performance is predictable.
 **
-** So for now, we implement (1) only.  If we wish to optimize later, we should
-** be able to do it without affecting users.
+** So by default we implement (1).  Users who don't need the optimal encoding
+** can instead choose (3) with a maximum length of 4GB, which fits in a 5-byte
+** varint, so every length can be reserved up front and patched in place.
 **
 ** The strategy is to buffer the segments of data that do *not* depend on
 ** unknown lengths in one buffer, and keep a separate buffer of segment pointers
@@ -110,17 +111,30 @@ struct upb_pb_encoder {
    * level. */
   char *runbegin;
 
+  /* At the top level, if the output sink lends us its memory, "ptr" and
+   * "limit" point into the region it lent, which starts at "region".  Our own
+   * buffer's limit is saved in "buflimit" meanwhile.  "region" is NULL when we
+   * are writing into our own buffer. */
+  char *region, *buflimit;
+
   /* The list of segments we are accumulating. */
   upb_pb_encoder_segment *segbuf, *segptr, *seglimit;
 
   /* The stack of enclosing submessages.  Each entry in the stack points to the
-   * segment where this submessage's length is being accumulated. */
+   * segment where this submessage's length is being accumulated, or with
+   * fixed_lengths, is the offset in "buf" of its reserved length. */
   int *stack, *top, *stacklimit;
 
   /* Depth of startmsg/endmsg calls. */
   int depth;
+
+  /* Reserve fixed-width lengths instead of accumulating segments. */
+  bool fixed_lengths;
 };
 
+/* The width of a length reserved with fixed_lengths. */
+#define FIXED_LENGTH_BYTES 5
+
 /* low-level buffering ********************************************************/
 
 /* Low-level functions for interacting with the output buffer. */
@@ -135,9 +149,52 @@ static upb_pb_encoder_segment *top(upb_pb_encoder *e) {
   return &e->segbuf[*e->top];
 }
 
+/* Passes everything written into the borrowed region to the output, and goes
+ * back to writing into our own buffer. */
+static void flush_region(upb_pb_encoder *e) {
+  if (e->region) {
+    putbuf(e, e->region, e->ptr - e->region);
+    e->ptr = e->buf;
+    e->limit = e->buflimit;
+    e->region = NULL;
+  }
+}
+
+/* Tries to borrow a region of at least "bytes" bytes from the output sink and
+ * write into it directly.  Returns false if the sink cannot lend us one. */
+static bool borrow_region(upb_pb_encoder *e, size_t bytes) {
+  size_t size;
+  char *region;
+
+  UPB_ASSERT(!e->top && !e->region && e->ptr == e->buf);
+  region = upb_bytessink_getbuf(e->output_, e->subc, bytes, &size);
+  if (!region) {
+    return false;
+  }
+
+  UPB_ASSERT(size >= bytes);
+  e->buflimit = e->limit;
+  e->region = region;
+  e->ptr = region;
+  e->limit = region + size;
+  return true;
+}
+
 /* Call to ensure that at least "bytes" bytes are available for writing at
  * e->ptr.  Returns false if the bytes could not be allocated. */
 static bool reserve(upb_pb_encoder *e, size_t bytes) {
+  if (!e->top && (e->region || e->ptr == e->buf)) {
+    /* At the top level nothing needs buffering, so write straight into the
+     * sink's memory if it will lend us some. */
+    if ((size_t)(e->limit - e->ptr) >= bytes && e->region) {
+      return true;
+    }
+    flush_region(e);
+    if (borrow_region(e, bytes)) {
+      return true;
+    }
+  }
+
   if ((size_t)(e->limit - e->ptr) < bytes) {
     /* Grow buffer. */
     char *new_buf;
@@ -175,12 +232,13 @@ static void encoder_advance(upb_pb_encoder *e, size_t bytes) {
 /* Call when all of the bytes for a handler have been written.  Flushes the
  * bytes if possible and necessary, returning false if this failed. */
 static bool commit(upb_pb_encoder *e) {
-  if (!e->top) {
+  if (!e->top && !e->region) {
     /* We aren't inside a delimited region.  Flush our accumulated bytes to
      * the output.
      *
      * TODO(haberman): in the future we may want to delay flushing for
-     * efficiency reasons. */
+     * efficiency reasons.  We already do when writing into a region
+     * borrowed from the output, which is flushed when it fills up. */
     putbuf(e, e->buf, e->ptr - e->buf);
     e->ptr = e->buf;
   }
@@ -214,6 +272,24 @@ static void accumulate(upb_pb_encoder *e) {
  * not yet known.  All data will be buffered until the length is known.
  * Delimited regions may be nested; their lengths will all be tracked properly. */
 static bool start_delim(upb_pb_encoder *e) {
+  if (e->fixed_lengths) {
+    if (e->top) {
+      if (++e->top == e->stacklimit) {
+        return false;
+      }
+    } else {
+      flush_region(e);
+      e->top = e->stack;
+    }
+
+    if (!reserve(e, FIXED_LENGTH_BYTES)) {
+      return false;
+    }
+    *e->top = e->ptr - e->buf;
+    encoder_advance(e, FIXED_LENGTH_BYTES);
+    return true;
+  }
+
   if (e->top) {
     /* We are already buffering, advance to the next segment and push it on the
      * stack. */
@@ -242,6 +318,7 @@ static bool start_delim(upb_pb_encoder *e) {
     }
   } else {
     /* We were previously at the top level, start buffering. */
+    flush_region(e);
     e->segptr = e->segbuf;
     e->top = e->stack;
     e->runbegin = e->ptr;
@@ -259,6 +336,30 @@ static bool start_delim(upb_pb_encoder *e) {
  * regions, we can now emit all of the buffered data we accumulated. */
 static bool end_delim(upb_pb_encoder *e) {
   size_t msglen;
+
+  if (e->fixed_lengths) {
+    char *len = e->buf + *e->top;
+    int i;
+    msglen = e->ptr - len - FIXED_LENGTH_BYTES;
+    if (msglen > UINT32_MAX) {
+      return false;
+    }
+
+    /* A varint padded out with continuation bits. */
+    for (i = 0; i < FIXED_LENGTH_BYTES - 1; i++) {
+      len[i] = (char)((msglen & 0x7f) | 0x80);
+      msglen >>= 7;
+    }
+    len[i] = (char)msglen;
+
+    if (e->top == e->stack) {
+      e->top = NULL;
+      return commit(e);
+    }
+    --e->top;
+    return true;
+  }
+
   accumulate(e);
   msglen = top(e)->msglen;
 
@@ -267,15 +368,32 @@ static bool end_delim(upb_pb_encoder *e) {
     char buf[UPB_PB_VARINT_MAX_LEN];
     upb_pb_encoder_segment *s;
     const char *ptr = e->buf;
+    size_t total = 0;
+
     for (s = e->segbuf; s <= e->segptr; s++) {
-      size_t lenbytes = upb_vencode64(s->msglen, buf);
-      putbuf(e, buf, lenbytes);
-      putbuf(e, ptr, s->seglen);
-      ptr += s->seglen;
+      total += upb_varint_size(s->msglen) + s->seglen;
     }
 
     e->ptr = e->buf;
     e->top = NULL;
+
+    if (borrow_region(e, total)) {
+      /* Assemble the lengths and segments in the sink's memory; we keep
+       * writing there after them until the region fills up. */
+      for (s = e->segbuf; s <= e->segptr; s++) {
+        e->ptr += upb_vencode64(s->msglen, e->ptr);
+        memcpy(e->ptr, ptr, s->seglen);
+        e->ptr += s->seglen;
+        ptr += s->seglen;
+      }
+    } else {
+      for (s = e->segbuf; s <= e->segptr; s++) {
+        size_t lenbytes = upb_vencode64(s->msglen, buf);
+        putbuf(e, buf, lenbytes);
+        putbuf(e, ptr, s->seglen);
+        ptr += s->seglen;
+      }
+    }
   } else {
     /* Need to keep buffering; propagate length info into enclosing
      * submessages. */
@@ -364,6 +482,7 @@ static bool endmsg(void *c, const void *hd, upb_status *status) {
   UPB_UNUSED(hd);
   UPB_UNUSED(status);
   if (--e->depth == 0) {
+    flush_region(e);
     upb_bytessink_end(e->output_);
   }
   return true;
@@ -518,6 +637,12 @@ static void newhandlers_callback(const void *closure, upb_handlers *h) {
 }
 
 void upb_pb_encoder_reset(upb_pb_encoder *e) {
+  if (e->region) {
+    /* Abandon the borrowed region without committing anything. */
+    e->ptr = e->buf;
+    e->limit = e->buflimit;
+    e->region = NULL;
+  }
   e->segptr = NULL;
   e->top = NULL;
   e->depth = 0;
@@ -531,6 +656,10 @@ const upb_handlers *upb_pb_encoder_newhandlers(const upb_msgdef *m,
   return upb_handlers_newfrozen(m, owner, newhandlers_callback, NULL);
 }
 
+upb_handlercache *upb_pb_encoder_newcache() {
+  return upb_handlercache_new(newhandlers_callback, NULL);
+}
+
 upb_pb_encoder *upb_pb_encoder_create(upb_env *env, const upb_handlers *h,
                                       upb_bytessink *output) {
   const size_t initial_bufsize = 256;
@@ -553,6 +682,8 @@ upb_pb_encoder *upb_pb_encoder_create(upb_env *env, const upb_handlers *h,
   }
 
   e->limit = e->buf + initial_bufsize;
+  e->region = NULL;
+  e->fixed_lengths = false;
   e->seglimit = e->segbuf + initial_segbufsize;
   e->stacklimit = e->stack + stack_size;
 
@@ -571,3 +702,12 @@ upb_pb_encoder *upb_pb_encoder_create(upb_env *env, const upb_handlers *h,
 }
 
 upb_sink *upb_pb_encoder_input(upb_pb_encoder *e) { return &e->input_; }
+
+bool upb_pb_encoder_fixedlengths(const upb_pb_encoder *e) {
+  return e->fixed_lengths;
+}
+
+void upb_pb_encoder_setfixedlengths(upb_pb_encoder *e, bool fixed) {
+  UPB_ASSERT(!e->top);
+  e->fixed_lengths = fixed;
+}
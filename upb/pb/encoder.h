@@ -7,6 +7,11 @@
 ** This encoder implementation does not have any access to any out-of-band or
 ** precomputed lengths for submessages, so it must buffer submessages internally
 ** before it can emit the first byte.
+**
+** If the output sink can lend out its own memory (see
+** upb_byteshandler_setgetbuf()), top-level fields and finished top-level
+** submessages are written straight into it, instead of being passed to the
+** sink a field at a time.
 */
 
 #ifndef UPB_ENCODER_H_
@@ -32,7 +37,7 @@ UPB_DECLARE_TYPE(upb::pb::Encoder, upb_pb_encoder)
  * constructed.  This hint may be an overestimate for some build configurations.
  * But if the decoder library is upgraded without recompiling the application,
  * it may be an underestimate. */
-#define UPB_PB_ENCODER_SIZE 768
+#define UPB_PB_ENCODER_SIZE 784
 
 #ifdef __cplusplus
 
@@ -46,6 +51,15 @@ class upb::pb::Encoder {
   /* The input to the encoder. */
   Sink* input();
 
+  /* If true, every submessage, string and packed field gets a five-byte
+   * length, written as a redundant varint and filled in once the field ends.
+   * The output is then no longer byte-for-byte what other encoders produce,
+   * and submessages are limited to 4GB, but no data is ever copied to insert
+   * lengths, however deeply messages are nested.  May only be changed
+   * between messages.  Defaults to false. */
+  bool fixed_lengths() const;
+  void set_fixed_lengths(bool fixed);
+
   /* Creates a new set of handlers for this MessageDef. */
   static reffed_ptr<const Handlers> NewHandlers(const MessageDef* msg);
 
@@ -61,9 +75,12 @@ UPB_BEGIN_EXTERN_C
 
 const upb_handlers *upb_pb_encoder_newhandlers(const upb_msgdef *m,
                                                const void *owner);
+upb_handlercache *upb_pb_encoder_newcache();
 upb_sink *upb_pb_encoder_input(upb_pb_encoder *p);
 upb_pb_encoder* upb_pb_encoder_create(upb_env* e, const upb_handlers* h,
                                       upb_bytessink* output);
+bool upb_pb_encoder_fixedlengths(const upb_pb_encoder *e);
+void upb_pb_encoder_setfixedlengths(upb_pb_encoder *e, bool fixed);
 
 UPB_END_EXTERN_C
 
@@ -78,6 +95,12 @@ inline Encoder* Encoder::Create(Environment* env, const Handlers* handlers,
 inline Sink* Encoder::input() {
   return upb_pb_encoder_input(this);
 }
+inline bool Encoder::fixed_lengths() const {
+  return upb_pb_encoder_fixedlengths(this);
+}
+inline void Encoder::set_fixed_lengths(bool fixed) {
+  upb_pb_encoder_setfixedlengths(this, fixed);
+}
 inline reffed_ptr<const Handlers> Encoder::NewHandlers(
     const upb::MessageDef *md) {
   const Handlers* h = upb_pb_encoder_newhandlers(md, &h);
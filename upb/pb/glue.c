@@ -1,6 +1,9 @@
 
 #include "upb/pb/glue.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "upb/descriptor/reader.h"
 #include "upb/pb/decoder.h"
 
@@ -8,7 +11,7 @@ upb_filedef **upb_loaddescriptor(const char *buf, size_t n, const void *owner,
                                  upb_status *status) {
   /* Create handlers. */
   const upb_pbdecodermethod *decoder_m;
-  const upb_handlers *reader_h = upb_descreader_newhandlers(&reader_h);
+  const upb_handlers *reader_h = NULL;
   upb_env env;
   upb_pbdecodermethodopts opts;
   upb_pbdecoder *decoder;
@@ -17,6 +20,8 @@ upb_filedef **upb_loaddescriptor(const char *buf, size_t n, const void *owner,
   size_t i;
   upb_filedef **ret = NULL;
 
+  /* Initialized above: GCC counts passing the owner's address as a read. */
+  reader_h = upb_descreader_newhandlers(&reader_h);
   upb_pbdecodermethodopts_init(&opts, reader_h);
   decoder_m = upb_pbdecodermethod_new(&opts, &decoder_m);
 
@@ -52,3 +57,750 @@ cleanup:
   upb_pbdecodermethod_unref(decoder_m, &decoder_m);
   return ret;
 }
+
+/* Lazy loading **************************************************************/
+
+/* We only need to find a handful of string and submessage fields, so rather
+ * than running the full decoder we scan the wire format directly. */
+
+typedef struct {
+  const char *buf;
+  size_t len;
+  bool loaded;
+} lazyfile;
+
+/* Scratch buffer for building full names. */
+typedef struct {
+  char *buf;
+  size_t size;
+} scratchname;
+
+typedef struct {
+  upb_strtable files;    /* File name -> lazyfile*. */
+  upb_strtable symbols;  /* Full symbol name -> lazyfile*. */
+  scratchname name;
+} lazyindex;
+
+typedef struct {
+  const char *ptr;
+  const char *end;
+} wirescan;
+
+static bool wire_varint(wirescan *w, uint64_t *val) {
+  int bitpos;
+  *val = 0;
+  for (bitpos = 0; w->ptr < w->end && bitpos < 70; bitpos += 7) {
+    uint8_t byte = *w->ptr++;
+    *val |= (uint64_t)(byte & 0x7F) << bitpos;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+/* Advances to the next field, returning its number.  Delimited fields are
+ * returned in "data"/"len" and varints in "val"; all other wire types are
+ * skipped over. */
+static bool wire_nextval(wirescan *w, uint32_t *fieldnum, uint64_t *val,
+                         const char **data, size_t *len) {
+  uint64_t tag;
+
+  if (!wire_varint(w, &tag)) return false;
+  *fieldnum = (uint32_t)(tag >> 3);
+  *val = 0;
+  *data = NULL;
+  *len = 0;
+
+  switch (tag & 7) {
+    case UPB_WIRE_TYPE_VARINT:
+      return wire_varint(w, val);
+    case UPB_WIRE_TYPE_64BIT:
+      if (w->end - w->ptr < 8) return false;
+      w->ptr += 8;
+      return true;
+    case UPB_WIRE_TYPE_32BIT:
+      if (w->end - w->ptr < 4) return false;
+      w->ptr += 4;
+      return true;
+    case UPB_WIRE_TYPE_DELIMITED:
+      if (!wire_varint(w, val) || *val > (uint64_t)(w->end - w->ptr)) {
+        return false;
+      }
+      *data = w->ptr;
+      *len = (size_t)*val;
+      w->ptr += *val;
+      *val = 0;
+      return true;
+    default:
+      /* Groups don't appear in descriptors. */
+      return false;
+  }
+}
+
+static bool wire_next(wirescan *w, uint32_t *fieldnum, const char **data,
+                      size_t *len) {
+  uint64_t val;
+  return wire_nextval(w, fieldnum, &val, data, len);
+}
+
+static void wirescan_init(wirescan *w, const char *buf, size_t len) {
+  w->ptr = buf;
+  w->end = buf + len;
+}
+
+/* Finds the (last) value of string field "num" in the given message. */
+static bool wire_findstr(const char *buf, size_t len, uint32_t num,
+                         const char **str, size_t *str_len) {
+  wirescan w;
+  uint32_t fieldnum;
+  const char *data;
+  size_t n;
+  bool found = false;
+
+  *str = NULL;
+  *str_len = 0;
+  wirescan_init(&w, buf, len);
+  while (w.ptr < w.end) {
+    if (!wire_next(&w, &fieldnum, &data, &n)) return false;
+    if (fieldnum == num && data) {
+      *str = data;
+      *str_len = n;
+      found = true;
+    }
+  }
+
+  return found;
+}
+
+/* Appends ".name" (or just "name" at the top level) to the scratch name at
+ * offset "base", returning the new length. */
+static bool scratchname_append(scratchname *n, size_t base, const char *name,
+                               size_t len, size_t *newlen) {
+  size_t need = base + len + 2;
+
+  if (need > n->size) {
+    size_t new_size = UPB_MAX(need, n->size * 2);
+    char *p = upb_grealloc(n->buf, n->size, new_size);
+    if (!p) return false;
+    n->buf = p;
+    n->size = new_size;
+  }
+
+  if (base > 0) n->buf[base++] = '.';
+  memcpy(n->buf + base, name, len);
+  *newlen = base + len;
+  n->buf[*newlen] = '\0';
+  return true;
+}
+
+static bool lazy_addsym(lazyindex *idx, size_t len, lazyfile *f,
+                        upb_status *s) {
+  if (upb_strtable_lookup2(&idx->symbols, idx->name.buf, len, NULL)) {
+    upb_status_seterrf(s, "duplicate symbol '%s'", idx->name.buf);
+    return false;
+  }
+
+  if (!upb_strtable_insert2(&idx->symbols, idx->name.buf, len,
+                            upb_value_ptr(f))) {
+    upb_upberr_setoom(s);
+    return false;
+  }
+
+  return true;
+}
+
+static bool lazy_indexenum(lazyindex *idx, size_t base, const char *buf,
+                           size_t len, lazyfile *f, upb_status *s) {
+  const char *name;
+  size_t name_len, full_len;
+
+  if (!wire_findstr(buf, len, 1, &name, &name_len)) {
+    upb_status_seterrmsg(s, "enum without a name");
+    return false;
+  }
+
+  return scratchname_append(&idx->name, base, name, name_len, &full_len) &&
+         lazy_addsym(idx, full_len, f, s);
+}
+
+static bool lazy_indexmsg(lazyindex *idx, size_t base, const char *buf,
+                          size_t len, lazyfile *f, upb_status *s) {
+  wirescan w;
+  uint32_t fieldnum;
+  const char *data, *name;
+  size_t n, name_len, full_len;
+
+  if (!wire_findstr(buf, len, 1, &name, &name_len)) {
+    upb_status_seterrmsg(s, "message without a name");
+    return false;
+  }
+
+  if (!scratchname_append(&idx->name, base, name, name_len, &full_len) ||
+      !lazy_addsym(idx, full_len, f, s)) {
+    return false;
+  }
+
+  wirescan_init(&w, buf, len);
+  while (w.ptr < w.end) {
+    bool ok = true;
+    if (!wire_next(&w, &fieldnum, &data, &n)) goto badwire;
+    if (!data) continue;
+    switch (fieldnum) {
+      case 3:  /* DescriptorProto.nested_type */
+        ok = lazy_indexmsg(idx, full_len, data, n, f, s);
+        break;
+      case 4:  /* DescriptorProto.enum_type */
+        ok = lazy_indexenum(idx, full_len, data, n, f, s);
+        break;
+    }
+    if (!ok) return false;
+  }
+
+  return true;
+
+badwire:
+  upb_status_seterrmsg(s, "malformed descriptor");
+  return false;
+}
+
+static bool lazy_indexfile(lazyindex *idx, const char *buf, size_t len,
+                           upb_status *s) {
+  wirescan w;
+  uint32_t fieldnum;
+  const char *data, *name, *package = NULL;
+  size_t n, name_len, package_len = 0, base = 0;
+  lazyfile *f;
+
+  if (!wire_findstr(buf, len, 1, &name, &name_len)) {
+    upb_status_seterrmsg(s, "file without a name");
+    return false;
+  }
+
+  if (upb_strtable_lookup2(&idx->files, name, name_len, NULL)) {
+    /* Already indexed, possibly by an earlier call. */
+    return true;
+  }
+
+  f = upb_gmalloc(sizeof(*f));
+  if (!f) goto oom;
+  f->buf = buf;
+  f->len = len;
+  f->loaded = false;
+
+  if (!upb_strtable_insert2(&idx->files, name, name_len, upb_value_ptr(f))) {
+    upb_gfree(f);
+    goto oom;
+  }
+
+  if (wire_findstr(buf, len, 2, &package, &package_len) && package_len > 0 &&
+      !scratchname_append(&idx->name, 0, package, package_len, &base)) {
+    goto oom;
+  }
+
+  wirescan_init(&w, buf, len);
+  while (w.ptr < w.end) {
+    bool ok = true;
+    if (!wire_next(&w, &fieldnum, &data, &n)) {
+      upb_status_seterrmsg(s, "malformed descriptor");
+      return false;
+    }
+    if (!data) continue;
+    /* Nested calls clobber the scratch name past "base", but never the
+     * package prefix itself. */
+    switch (fieldnum) {
+      case 4:  /* FileDescriptorProto.message_type */
+        ok = lazy_indexmsg(idx, base, data, n, f, s);
+        break;
+      case 5:  /* FileDescriptorProto.enum_type */
+        ok = lazy_indexenum(idx, base, data, n, f, s);
+        break;
+    }
+    if (!ok) return false;
+  }
+
+  return true;
+
+oom:
+  upb_upberr_setoom(s);
+  return false;
+}
+
+static void lazyindex_free(void *closure) {
+  lazyindex *idx = closure;
+  upb_strtable_iter i;
+
+  upb_strtable_begin(&i, &idx->files);
+  for (; !upb_strtable_done(&i); upb_strtable_next(&i)) {
+    upb_gfree(upb_value_getptr(upb_strtable_iter_value(&i)));
+  }
+
+  upb_strtable_uninit(&idx->files);
+  upb_strtable_uninit(&idx->symbols);
+  upb_gfree(idx->name.buf);
+  upb_gfree(idx);
+}
+
+static bool lazy_loadfile(lazyindex *idx, upb_symtab *symtab, lazyfile *f,
+                          upb_status *s) {
+  wirescan w;
+  uint32_t fieldnum;
+  const char *data;
+  size_t n, i, size;
+  uint64_t v;
+  char *wrapped, *p;
+  upb_filedef **files;
+  bool ok = true;
+
+  if (f->loaded) return true;
+
+  /* Set first, so that a cycle of dependencies can't recurse forever and a
+   * file that fails to load isn't retried on every lookup. */
+  f->loaded = true;
+
+  /* Dependencies have to be in the symtab before this file can be added. */
+  wirescan_init(&w, f->buf, f->len);
+  while (w.ptr < w.end) {
+    upb_value dep;
+    if (!wire_next(&w, &fieldnum, &data, &n)) return false;
+    if (fieldnum == 3 && data &&  /* FileDescriptorProto.dependency */
+        upb_strtable_lookup2(&idx->files, data, n, &dep) &&
+        !lazy_loadfile(idx, symtab, upb_value_getptr(dep), s)) {
+      return false;
+    }
+  }
+
+  /* upb_loaddescriptor() takes a FileDescriptorSet, so wrap the file in one:
+   * a single tag for field 1 followed by the length. */
+  size = 1 + 10 + f->len;
+  wrapped = upb_gmalloc(size);
+  if (!wrapped) {
+    upb_upberr_setoom(s);
+    return false;
+  }
+
+  p = wrapped;
+  *p++ = (1 << 3) | UPB_WIRE_TYPE_DELIMITED;
+  for (v = f->len; v >= 0x80; v >>= 7) {
+    *p++ = (char)((v & 0x7F) | 0x80);
+  }
+  *p++ = (char)v;
+  memcpy(p, f->buf, f->len);
+  p += f->len;
+
+  files = upb_loaddescriptor(wrapped, p - wrapped, &files, s);
+  upb_gfree(wrapped);
+
+  if (!files) return false;
+
+  for (i = 0; files[i]; i++) {
+    if (ok) ok = upb_symtab_addfile(symtab, files[i], s);
+    upb_filedef_unref(files[i], &files);
+  }
+
+  upb_gfree(files);
+  return ok;
+}
+
+static bool lazy_load(void *closure, upb_symtab *s, const char *sym) {
+  lazyindex *idx = closure;
+  upb_value v;
+  upb_status status = UPB_STATUS_INIT;
+
+  if (!upb_strtable_lookup(&idx->symbols, sym, &v)) {
+    return false;
+  }
+
+  return lazy_loadfile(idx, s, upb_value_getptr(v), &status);
+}
+
+bool upb_symtab_addlazy(upb_symtab *s, const char *buf, size_t n,
+                        upb_status *status) {
+  lazyindex *idx = upb_symtab_loaderclosure(s, &lazy_load);
+  wirescan w;
+  uint32_t fieldnum;
+  const char *data;
+  size_t len;
+
+  if (!idx) {
+    idx = upb_gmalloc(sizeof(*idx));
+    if (!idx) goto oom;
+    idx->name.buf = NULL;
+    idx->name.size = 0;
+    if (!upb_strtable_init(&idx->files, UPB_CTYPE_PTR)) {
+      upb_gfree(idx);
+      goto oom;
+    }
+    if (!upb_strtable_init(&idx->symbols, UPB_CTYPE_PTR)) {
+      upb_strtable_uninit(&idx->files);
+      upb_gfree(idx);
+      goto oom;
+    }
+    upb_symtab_setloader(s, &lazy_load, &lazyindex_free, idx);
+  }
+
+  wirescan_init(&w, buf, n);
+  while (w.ptr < w.end) {
+    if (!wire_next(&w, &fieldnum, &data, &len)) {
+      upb_status_seterrmsg(status, "malformed descriptor");
+      return false;
+    }
+    if (fieldnum == 1 && data &&  /* FileDescriptorSet.file */
+        !lazy_indexfile(idx, data, len, status)) {
+      return false;
+    }
+  }
+
+  return true;
+
+oom:
+  upb_upberr_setoom(status);
+  return false;
+}
+
+/* Layouts *******************************************************************/
+
+/* As with the lazy index, the descriptors are scanned straight from the wire
+ * format: a layout only needs each field's number, type, label, oneof and
+ * submessage, and the submessages are named by fully-qualified names that
+ * can be resolved with a single table of message names. */
+
+typedef struct {
+  const char *buf;  /* The DescriptorProto, only used while building. */
+  size_t len;
+  upb_msglayout_msginit_v1 init;
+} layoutmsg;
+
+struct upb_layoutset {
+  upb_arena arena;      /* Everything below is allocated from here. */
+  upb_strtable msgs;    /* Full message name -> layoutmsg*. */
+};
+
+typedef struct {
+  upb_layoutset *set;
+  scratchname name;
+  upb_status *status;
+} layoutloader;
+
+static upb_alloc *layoutset_alloc(upb_layoutset *set) {
+  return upb_arena_alloc(&set->arena);
+}
+
+static bool layout_indexmsg(layoutloader *ld, size_t base, const char *buf,
+                            size_t len, bool is_proto2) {
+  upb_alloc *a = layoutset_alloc(ld->set);
+  wirescan w;
+  uint32_t fieldnum;
+  const char *data, *name;
+  size_t n, name_len, full_len;
+  layoutmsg *m;
+
+  if (!wire_findstr(buf, len, 1, &name, &name_len)) {
+    upb_status_seterrmsg(ld->status, "message without a name");
+    return false;
+  }
+
+  if (!scratchname_append(&ld->name, base, name, name_len, &full_len)) {
+    goto oom;
+  }
+
+  if (upb_strtable_lookup2(&ld->set->msgs, ld->name.buf, full_len, NULL)) {
+    upb_status_seterrf(ld->status, "duplicate message '%s'", ld->name.buf);
+    return false;
+  }
+
+  m = upb_malloc(a, sizeof(*m));
+  if (!m) goto oom;
+  memset(m, 0, sizeof(*m));
+  m->buf = buf;
+  m->len = len;
+  m->init.is_proto2 = is_proto2;
+
+  if (!upb_strtable_insert3(&ld->set->msgs, ld->name.buf, full_len,
+                            upb_value_ptr(m), a)) {
+    goto oom;
+  }
+
+  wirescan_init(&w, buf, len);
+  while (w.ptr < w.end) {
+    if (!wire_next(&w, &fieldnum, &data, &n)) goto badwire;
+    if (fieldnum == 3 && data &&  /* DescriptorProto.nested_type */
+        !layout_indexmsg(ld, full_len, data, n, is_proto2)) {
+      return false;
+    }
+  }
+
+  return true;
+
+badwire:
+  upb_status_seterrmsg(ld->status, "malformed descriptor");
+  return false;
+
+oom:
+  upb_upberr_setoom(ld->status);
+  return false;
+}
+
+static bool layout_indexfile(layoutloader *ld, const char *buf, size_t len) {
+  wirescan w;
+  uint32_t fieldnum;
+  const char *data, *package, *syntax;
+  size_t n, package_len, syntax_len, base = 0;
+  bool is_proto2 = true;
+
+  if (wire_findstr(buf, len, 2, &package, &package_len) && package_len > 0 &&
+      !scratchname_append(&ld->name, 0, package, package_len, &base)) {
+    upb_upberr_setoom(ld->status);
+    return false;
+  }
+
+  if (wire_findstr(buf, len, 12, &syntax, &syntax_len) &&
+      syntax_len == 6 && memcmp(syntax, "proto3", 6) == 0) {
+    is_proto2 = false;
+  }
+
+  wirescan_init(&w, buf, len);
+  while (w.ptr < w.end) {
+    if (!wire_next(&w, &fieldnum, &data, &n)) {
+      upb_status_seterrmsg(ld->status, "malformed descriptor");
+      return false;
+    }
+    if (fieldnum == 4 && data &&  /* FileDescriptorProto.message_type */
+        !layout_indexmsg(ld, base, data, n, is_proto2)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Reads one FieldDescriptorProto into "f", resolving its submessage (if any)
+ * into "*sub". */
+static bool layout_parsefield(layoutloader *ld, const char *buf, size_t len,
+                              uint16_t oneof_count,
+                              upb_msglayout_fieldinit_v1 *f,
+                              const upb_msglayout_msginit_v1 **sub) {
+  wirescan w;
+  uint32_t fieldnum;
+  uint64_t val;
+  const char *data, *type_name = NULL;
+  size_t n, type_name_len = 0;
+  upb_value v;
+
+  f->number = 0;
+  f->type = 0;
+  f->label = UPB_LABEL_OPTIONAL;
+  f->oneof_index = UPB_NOT_IN_ONEOF;
+  *sub = NULL;
+
+  wirescan_init(&w, buf, len);
+  while (w.ptr < w.end) {
+    if (!wire_nextval(&w, &fieldnum, &val, &data, &n)) {
+      upb_status_seterrmsg(ld->status, "malformed descriptor");
+      return false;
+    }
+    switch (fieldnum) {
+      case 3:  /* FieldDescriptorProto.number */
+        if (val < 1 || val > UPB_MAX_FIELDNUMBER) goto bad;
+        f->number = (uint32_t)val;
+        break;
+      case 4:  /* FieldDescriptorProto.label */
+        if (val < UPB_LABEL_OPTIONAL || val > UPB_LABEL_REPEATED) goto bad;
+        f->label = (uint8_t)val;
+        break;
+      case 5:  /* FieldDescriptorProto.type */
+        if (val < UPB_DESCRIPTOR_TYPE_DOUBLE ||
+            val > UPB_DESCRIPTOR_TYPE_SINT64) {
+          goto bad;
+        }
+        f->type = (uint8_t)val;
+        break;
+      case 6:  /* FieldDescriptorProto.type_name */
+        type_name = data;
+        type_name_len = n;
+        break;
+      case 9:  /* FieldDescriptorProto.oneof_index */
+        if (val >= oneof_count) goto bad;
+        f->oneof_index = (uint16_t)val;
+        break;
+    }
+  }
+
+  if (f->number == 0 || f->type == 0) goto bad;
+
+  if (f->type != UPB_DESCRIPTOR_TYPE_MESSAGE &&
+      f->type != UPB_DESCRIPTOR_TYPE_GROUP) {
+    return true;
+  }
+
+  /* protoc always emits fully-qualified type names. */
+  if (!type_name || type_name_len < 2 || type_name[0] != '.' ||
+      !upb_strtable_lookup2(&ld->set->msgs, type_name + 1, type_name_len - 1,
+                            &v)) {
+    upb_status_seterrf(ld->status, "unresolved message type for field %u",
+                       (unsigned)f->number);
+    return false;
+  }
+
+  *sub = &((layoutmsg*)upb_value_getptr(v))->init;
+  return true;
+
+bad:
+  upb_status_seterrmsg(ld->status, "invalid field in descriptor");
+  return false;
+}
+
+static int layout_cmpfields(const void *p1, const void *p2) {
+  const upb_msglayout_fieldinit_v1 *f1 = p1;
+  const upb_msglayout_fieldinit_v1 *f2 = p2;
+  return f1->number < f2->number ? -1 : f1->number > f2->number;
+}
+
+static bool layout_build(layoutloader *ld, layoutmsg *m) {
+  upb_alloc *a = layoutset_alloc(ld->set);
+  wirescan w;
+  uint32_t fieldnum;
+  const char *data;
+  size_t n, field_count = 0, oneof_count = 0, submsg_count = 0, i;
+  upb_msglayout_fieldinit_v1 *fields;
+  upb_msglayout_oneofinit_v1 *oneofs;
+  const upb_msglayout_msginit_v1 **submsgs;
+
+  wirescan_init(&w, m->buf, m->len);
+  while (w.ptr < w.end) {
+    if (!wire_next(&w, &fieldnum, &data, &n)) goto badwire;
+    if (!data) continue;
+    if (fieldnum == 2) field_count++;  /* DescriptorProto.field */
+    if (fieldnum == 8) oneof_count++;  /* DescriptorProto.oneof_decl */
+    if (fieldnum == 5) {               /* DescriptorProto.extension_range */
+      m->init.extendable = true;
+    }
+  }
+
+  if (field_count >= UPB_NO_FIELD || oneof_count >= UPB_NOT_IN_ONEOF) {
+    upb_status_seterrmsg(ld->status, "too many fields in message");
+    return false;
+  }
+
+  /* Allocate one more of each, so nothing is zero-sized. */
+  fields = upb_malloc(a, (field_count + 1) * sizeof(*fields));
+  oneofs = upb_malloc(a, (oneof_count + 1) * sizeof(*oneofs));
+  submsgs = upb_malloc(a, (field_count + 1) * sizeof(*submsgs));
+  if (!fields || !oneofs || !submsgs) goto oom;
+
+  m->init.field_count = (uint16_t)field_count;
+  m->init.oneof_count = (uint16_t)oneof_count;
+  m->init.submsgs = submsgs;
+
+  i = 0;
+  wirescan_init(&w, m->buf, m->len);
+  while (w.ptr < w.end) {
+    const upb_msglayout_msginit_v1 *sub;
+    if (!wire_next(&w, &fieldnum, &data, &n)) goto badwire;
+    if (fieldnum != 2 || !data) continue;
+    if (!layout_parsefield(ld, data, n, (uint16_t)oneof_count, &fields[i],
+                           &sub)) {
+      return false;
+    }
+    if (sub) {
+      fields[i].submsg_index = (uint16_t)submsg_count;
+      submsgs[submsg_count++] = sub;
+    } else {
+      fields[i].submsg_index = UPB_NO_SUBMSG;
+    }
+    i++;
+  }
+
+  /* Like the defs, lay fields out in field number order. */
+  qsort(fields, field_count, sizeof(*fields), layout_cmpfields);
+  for (i = 1; i < field_count; i++) {
+    if (fields[i].number == fields[i - 1].number) {
+      upb_status_seterrf(ld->status, "duplicate field number %u",
+                         (unsigned)fields[i].number);
+      return false;
+    }
+  }
+
+  if (!upb_msglayout_place_v1(&m->init, fields, oneofs, a)) goto oom;
+  m->buf = NULL;
+  m->len = 0;
+  return true;
+
+badwire:
+  upb_status_seterrmsg(ld->status, "malformed descriptor");
+  return false;
+
+oom:
+  upb_upberr_setoom(ld->status);
+  return false;
+}
+
+upb_layoutset *upb_loadlayouts(const char *buf, size_t n,
+                               upb_status *status) {
+  upb_layoutset *set;
+  layoutloader ld;
+  upb_strtable_iter i;
+  wirescan w;
+  uint32_t fieldnum;
+  const char *data;
+  size_t len;
+
+  set = upb_gmalloc(sizeof(*set));
+  if (!set) {
+    upb_upberr_setoom(status);
+    return NULL;
+  }
+
+  upb_arena_init(&set->arena);
+  if (!upb_strtable_init2(&set->msgs, UPB_CTYPE_PTR, layoutset_alloc(set))) {
+    upb_arena_uninit(&set->arena);
+    upb_gfree(set);
+    upb_upberr_setoom(status);
+    return NULL;
+  }
+
+  ld.set = set;
+  ld.name.buf = NULL;
+  ld.name.size = 0;
+  ld.status = status;
+
+  /* All names have to be known before any field can be resolved. */
+  wirescan_init(&w, buf, n);
+  while (w.ptr < w.end) {
+    if (!wire_next(&w, &fieldnum, &data, &len)) {
+      upb_status_seterrmsg(status, "malformed descriptor");
+      goto err;
+    }
+    if (fieldnum == 1 && data &&  /* FileDescriptorSet.file */
+        !layout_indexfile(&ld, data, len)) {
+      goto err;
+    }
+  }
+
+  upb_strtable_begin(&i, &set->msgs);
+  for (; !upb_strtable_done(&i); upb_strtable_next(&i)) {
+    if (!layout_build(&ld, upb_value_getptr(upb_strtable_iter_value(&i)))) {
+      goto err;
+    }
+  }
+
+  upb_gfree(ld.name.buf);
+  return set;
+
+err:
+  upb_gfree(ld.name.buf);
+  upb_layoutset_free(set);
+  return NULL;
+}
+
+void upb_layoutset_free(upb_layoutset *set) {
+  if (!set) return;
+  /* The table and everything it points to live in the arena. */
+  upb_arena_uninit(&set->arena);
+  upb_gfree(set);
+}
+
+const upb_msglayout_msginit_v1 *upb_layoutset_lookup(const upb_layoutset *set,
+                                                     const char *name) {
+  upb_value v;
+  return upb_strtable_lookup(&set->msgs, name, &v) ?
+      &((layoutmsg*)upb_value_getptr(v))->init : NULL;
+}
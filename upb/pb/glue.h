@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 #include "upb/def.h"
+#include "upb/msg.h"
 
 #ifdef __cplusplus
 #include <vector>
@@ -32,10 +33,50 @@ extern "C" {
 
 /* Loads a binary descriptor and returns a NULL-terminated array of unfrozen
  * filedefs.  The caller owns the returned array, which must be freed with
- * upb_gfree(). */
+ * upb_gfree().
+ *
+ * This shares no mutable state between calls, so many descriptors can be
+ * loaded in parallel on different threads.  The results can then be linked
+ * together with a single call to upb_symtab_addfiles(). */
 upb_filedef **upb_loaddescriptor(const char *buf, size_t n, const void *owner,
                                  upb_status *status);
 
+/* Indexes the binary FileDescriptorSet in "buf" by the names of the messages
+ * and enums it defines, without building any defs.  The first time one of
+ * those names is looked up in "s", its file (and any indexed files it depends
+ * on) is loaded and added with upb_symtab_addfile().  This makes it cheap to
+ * register a huge schema when only a few of its types are used.
+ *
+ * May be called several times on the same symtab; a file that was already
+ * indexed is skipped.  "buf" must outlive "s".  Lookups on "s" are no longer
+ * threadsafe (see upb_symtab_setloader()), and a file that fails to load is
+ * reported as a failed lookup. */
+bool upb_symtab_addlazy(upb_symtab *s, const char *buf, size_t n,
+                        upb_status *status);
+
+/* Message layouts for processes that only need upb_decode() and upb_encode()
+ * for schemas they receive at runtime.  upb_loadlayouts() reads the binary
+ * FileDescriptorSet in "buf" straight into a layout for every message it
+ * defines, without building any defs: no names are kept apart from the
+ * message names, no enums are loaded, and the descriptor is checked only as
+ * far as laying out the messages requires.  Type names must be
+ * fully-qualified, as protoc emits them, and every message type that is
+ * referred to must be in "buf", though "buf" need not outlive the result.
+ *
+ * Offsets and hasbits are the same as the msgfactory would assign for the
+ * same schema, but no proto2 default values are set.  A const upb_layoutset
+ * may be used from several threads at once. */
+typedef struct upb_layoutset upb_layoutset;
+
+upb_layoutset *upb_loadlayouts(const char *buf, size_t n, upb_status *status);
+void upb_layoutset_free(upb_layoutset *s);
+
+/* Returns the layout of the message with the given full name (with no
+ * leading '.'), or NULL.  The layout lives as long as "s"; like generated
+ * layouts it can be cast to upb_msglayout for upb_msg_new(). */
+const upb_msglayout_msginit_v1 *upb_layoutset_lookup(const upb_layoutset *s,
+                                                     const char *name);
+
 #ifdef __cplusplus
 }  /* extern "C" */
 
@@ -65,6 +106,11 @@ bool LoadDescriptor(const T& desc, Status* status,
   return LoadDescriptor(desc.c_str(), desc.size(), status, files);
 }
 
+inline bool AddLazyDescriptor(SymbolTable* s, const char* buf, size_t n,
+                              Status* status) {
+  return upb_symtab_addlazy(s, buf, n, status);
+}
+
 }  /* namespace upb */
 
 #endif
@@ -0,0 +1,862 @@
+/*
+** upb::pb::TextParser
+**
+** A hand-written scanner over the whole input.  Text format has no length
+** prefixes and values are usually a few bytes long, so rather than keeping a
+** resumable state machine we accumulate the input and parse it in one pass
+** once the stream ends.  Character classes come from a 256-entry table, so
+** whitespace runs, identifiers and number tokens are each skipped with one
+** load and test per byte.
+**
+** Field names are resolved with one frozen strtable per message type, built
+** when the method is created.  As in upb_json_parsermethod, keys are the
+** field names plus, for groups, the group's type name, which is what
+** upb_textprinter writes for them.
+*/
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "upb/pb/textparser.h"
+
+#define UPB_TEXTPARSER_MAX_DEPTH 64
+
+typedef struct {
+  upb_sink sink;
+
+  /* The message we are parsing, and the table mapping its field names to
+   * fielddefs. */
+  const upb_msgdef *m;
+  const upb_frozentable *name_table;
+
+  /* The field of the enclosing message that this message is a value of, or
+   * NULL at the top level. */
+  const upb_fielddef *f;
+
+  /* The repeated field whose sequence is open, if any, and the sink for its
+   * values.  Repeated values that appear one after another, or in a "[...]"
+   * list, share one sequence. */
+  const upb_fielddef *seqf;
+  upb_sink seqsink;
+
+  /* The character that ends this message: '}' or '>', or 0 at the top
+   * level. */
+  char close;
+
+  /* This message is an element of a "field: [{...}, {...}]" list. */
+  bool inlist;
+} upb_textparser_frame;
+
+struct upb_textparser {
+  upb_env *env;
+  const upb_textparsermethod *method;
+  upb_bytessink input_;
+
+  /* Stack of the messages we are in. */
+  upb_textparser_frame stack[UPB_TEXTPARSER_MAX_DEPTH];
+  upb_textparser_frame *top;
+  upb_textparser_frame *limit;
+
+  upb_status status;
+
+  /* The accumulated input. */
+  char *buf;
+  size_t len;
+  size_t size;
+
+  /* Scan position within "buf". */
+  const char *ptr;
+  const char *end;
+
+  /* Unescaped contents of the current string value. */
+  char *str;
+  size_t str_len;
+  size_t str_size;
+};
+
+struct upb_textparsermethod {
+  upb_refcounted base;
+
+  upb_byteshandler input_handler_;
+
+  /* Mainly for the purposes of refcounting, so all the fielddefs we point
+   * to stay alive. */
+  const upb_msgdef *msg;
+
+  /* Keys are upb_msgdef*, values are frozen strtables (name -> fielddef). */
+  upb_inttable name_tables;
+};
+
+
+/* Scanning *******************************************************************/
+
+#define CHAR_SPACE 1  /* Whitespace. */
+#define CHAR_IDENT 2  /* Letters, digits and '_'. */
+#define CHAR_TOKEN 4  /* CHAR_IDENT and the rest of a number: ".+-". */
+
+static const unsigned char chartab[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 4, 4, 0,
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 0, 0, 0, 0, 0, 0,
+  0, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 0, 0, 0, 0, 6,
+  0, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/* Returns the next character without consuming it, or -1 at the end. */
+static int peek(const upb_textparser *p) {
+  return p->ptr < p->end ? (unsigned char)*p->ptr : -1;
+}
+
+/* Skips whitespace and "#" comments. */
+static void skipws(upb_textparser *p) {
+  const char *ptr = p->ptr;
+  const char *end = p->end;
+  for (;;) {
+    while (ptr < end && (chartab[(unsigned char)*ptr] & CHAR_SPACE)) ptr++;
+    if (ptr == end || *ptr != '#') break;
+    ptr = memchr(ptr, '\n', end - ptr);
+    if (!ptr) ptr = end;
+  }
+  p->ptr = ptr;
+}
+
+/* Consumes a run of characters in "mask" and returns its length. */
+static size_t scan(upb_textparser *p, unsigned char mask) {
+  const char *start = p->ptr;
+  while (p->ptr < p->end && (chartab[(unsigned char)*p->ptr] & mask)) {
+    p->ptr++;
+  }
+  return p->ptr - start;
+}
+
+static bool consume(upb_textparser *p, char ch) {
+  if (peek(p) != (unsigned char)ch) return false;
+  p->ptr++;
+  return true;
+}
+
+/* Case-insensitive comparison of a token with a lower-case literal. */
+static bool tokeq(const char *tok, size_t len, const char *lit) {
+  size_t i;
+  for (i = 0; i < len; i++) {
+    char ch = tok[i];
+    if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
+    if (ch != lit[i]) return false;
+  }
+  return lit[len] == '\0';
+}
+
+static bool parse_error(upb_textparser *p, const char *fmt, ...) {
+  char msg[256];
+  const char *ptr;
+  int line = 1;
+  va_list args;
+
+  /* Only computed on error, so scanning need not track lines. */
+  for (ptr = p->buf; ptr < p->ptr; ptr++) {
+    if (*ptr == '\n') line++;
+  }
+
+  va_start(args, fmt);
+  _upb_vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+
+  upb_status_seterrf(&p->status, "Parse error at line %d: %s", line, msg);
+  upb_env_reporterror(p->env, &p->status);
+  return false;
+}
+
+
+/* Sinks **********************************************************************/
+
+static upb_selector_t getsel(const upb_fielddef *f, upb_handlertype_t type) {
+  upb_selector_t sel;
+  bool ok = upb_handlers_getselector(f, type, &sel);
+  UPB_ASSERT(ok);
+  return sel;
+}
+
+static const upb_frozentable *get_name_table(const upb_textparser *p,
+                                             const upb_msgdef *m) {
+  upb_value v;
+  bool ok = upb_inttable_lookupptr(&p->method->name_tables, m, &v);
+  UPB_ASSERT(ok);
+  return upb_value_getptr(v);
+}
+
+static bool endseq(upb_textparser *p) {
+  upb_textparser_frame *top = p->top;
+  if (top->seqf) {
+    const upb_fielddef *f = top->seqf;
+    top->seqf = NULL;
+    return upb_sink_endseq(&top->sink, getsel(f, UPB_HANDLER_ENDSEQ));
+  }
+  return true;
+}
+
+/* Returns the sink that values of "f" go to, starting or ending a sequence
+ * as needed. */
+static upb_sink *valuesink(upb_textparser *p, const upb_fielddef *f) {
+  upb_textparser_frame *top = p->top;
+
+  if (top->seqf == f) {
+    return &top->seqsink;
+  } else if (!endseq(p)) {
+    return NULL;
+  } else if (!upb_fielddef_isseq(f)) {
+    return &top->sink;
+  } else if (!upb_sink_startseq(&top->sink, getsel(f, UPB_HANDLER_STARTSEQ),
+                                &top->seqsink)) {
+    return NULL;
+  }
+
+  top->seqf = f;
+  return &top->seqsink;
+}
+
+static bool startsubmsg(upb_textparser *p, const upb_fielddef *f,
+                        bool inlist) {
+  upb_textparser_frame *inner;
+  upb_sink *sink;
+  int open = peek(p);
+
+  if (open != '{' && open != '<') {
+    return parse_error(p, "expected '{' for field '%s'", upb_fielddef_name(f));
+  } else if (p->top + 1 == p->limit) {
+    return parse_error(p, "nesting too deep");
+  }
+  p->ptr++;
+
+  sink = valuesink(p, f);
+  if (!sink) return false;
+
+  inner = p->top + 1;
+  if (!upb_sink_startsubmsg(sink, getsel(f, UPB_HANDLER_STARTSUBMSG),
+                            &inner->sink)) {
+    return false;
+  }
+  inner->m = upb_fielddef_msgsubdef(f);
+  inner->name_table = get_name_table(p, inner->m);
+  inner->f = f;
+  inner->seqf = NULL;
+  inner->close = (open == '{') ? '}' : '>';
+  inner->inlist = inlist;
+  p->top = inner;
+
+  return upb_sink_startmsg(&inner->sink);
+}
+
+static bool endsubmsg(upb_textparser *p) {
+  const upb_fielddef *f = p->top->f;
+  bool inlist = p->top->inlist;
+  upb_sink *sink;
+
+  if (!endseq(p) || !upb_sink_endmsg(&p->top->sink, &p->status)) {
+    return false;
+  }
+  p->top--;
+
+  sink = upb_fielddef_isseq(f) ? &p->top->seqsink : &p->top->sink;
+  if (!upb_sink_endsubmsg(sink, getsel(f, UPB_HANDLER_ENDSUBMSG))) {
+    return false;
+  }
+
+  if (inlist) {
+    skipws(p);
+    if (consume(p, ',')) {
+      skipws(p);
+      return startsubmsg(p, f, true);
+    } else if (!consume(p, ']')) {
+      return parse_error(p, "expected ',' or ']'");
+    }
+  }
+
+  return true;
+}
+
+
+/* Values *********************************************************************/
+
+/* Parses a decimal, hex ("0x") or octal ("0") integer with an optional
+ * minus sign. */
+static bool parse_int(const char *tok, size_t len, bool *neg, uint64_t *val) {
+  const char *end = tok + len;
+  uint64_t u = 0;
+  unsigned base = 10;
+
+  *neg = (len > 0 && *tok == '-');
+  if (*neg) tok++;
+  if (tok == end) return false;
+
+  if (end - tok > 1 && tok[0] == '0') {
+    if (tok[1] == 'x' || tok[1] == 'X') {
+      base = 16;
+      tok += 2;
+      if (tok == end) return false;
+    } else {
+      base = 8;
+      tok++;
+    }
+  }
+
+  for (; tok < end; tok++) {
+    unsigned d;
+    char ch = *tok;
+    if (ch >= '0' && ch <= '9') {
+      d = ch - '0';
+    } else if (ch >= 'a' && ch <= 'f') {
+      d = ch - 'a' + 10;
+    } else if (ch >= 'A' && ch <= 'F') {
+      d = ch - 'A' + 10;
+    } else {
+      return false;
+    }
+    if (d >= base || u > (UINT64_MAX - d) / base) return false;
+    u = u * base + d;
+  }
+
+  *val = u;
+  return true;
+}
+
+static bool parse_float(const char *tok, size_t len, double *val) {
+  char buf[64];
+  char *end;
+  const char *t = tok;
+  size_t n = len;
+  double inf = 1.0 / 0.0;  /* C89 does not have an INFINITY macro. */
+
+  if (n > 0 && *t == '-') {
+    t++;
+    n--;
+  }
+
+  if (tokeq(t, n, "inf") || tokeq(t, n, "infinity")) {
+    *val = (t == tok) ? inf : -inf;
+    return true;
+  } else if (tokeq(t, n, "nan")) {
+    *val = inf - inf;
+    return true;
+  }
+
+  /* A trailing 'f' is allowed, as in "1.5f". */
+  if (len > 0 && (tok[len - 1] == 'f' || tok[len - 1] == 'F')) len--;
+  if (len == 0 || len >= sizeof(buf)) return false;
+
+  memcpy(buf, tok, len);
+  buf[len] = '\0';
+  *val = strtod(buf, &end);
+  return end == buf + len;
+}
+
+static bool parse_number(upb_textparser *p, const upb_fielddef *f,
+                         upb_sink *sink) {
+  upb_selector_t sel = getsel(f, upb_handlers_getprimitivehandlertype(f));
+  const char *tok = p->ptr;
+  size_t len = scan(p, CHAR_TOKEN);
+  uint64_t u;
+  double d;
+  bool neg;
+
+  if (len == 0) {
+    return parse_error(p, "expected value for field '%s'",
+                       upb_fielddef_name(f));
+  }
+
+  switch (upb_fielddef_type(f)) {
+    case UPB_TYPE_INT32:
+      if (!parse_int(tok, len, &neg, &u) ||
+          u > (neg ? (uint64_t)INT32_MAX + 1 : INT32_MAX)) {
+        break;
+      }
+      return upb_sink_putint32(sink, sel, neg ? (int32_t)(0 - u) : (int32_t)u);
+    case UPB_TYPE_INT64:
+      if (!parse_int(tok, len, &neg, &u) ||
+          u > (neg ? (uint64_t)INT64_MAX + 1 : INT64_MAX)) {
+        break;
+      }
+      return upb_sink_putint64(sink, sel, neg ? (int64_t)(0 - u) : (int64_t)u);
+    case UPB_TYPE_UINT32:
+      if (!parse_int(tok, len, &neg, &u) || neg || u > UINT32_MAX) break;
+      return upb_sink_putuint32(sink, sel, u);
+    case UPB_TYPE_UINT64:
+      if (!parse_int(tok, len, &neg, &u) || neg) break;
+      return upb_sink_putuint64(sink, sel, u);
+    case UPB_TYPE_FLOAT:
+      if (!parse_float(tok, len, &d)) break;
+      return upb_sink_putfloat(sink, sel, d);
+    case UPB_TYPE_DOUBLE:
+      if (!parse_float(tok, len, &d)) break;
+      return upb_sink_putdouble(sink, sel, d);
+    case UPB_TYPE_BOOL:
+      if (tokeq(tok, len, "true") || tokeq(tok, len, "t") ||
+          (len == 1 && *tok == '1')) {
+        return upb_sink_putbool(sink, sel, true);
+      } else if (tokeq(tok, len, "false") || tokeq(tok, len, "f") ||
+                 (len == 1 && *tok == '0')) {
+        return upb_sink_putbool(sink, sel, false);
+      }
+      break;
+    case UPB_TYPE_ENUM: {
+      const upb_enumdef *e = upb_fielddef_enumsubdef(f);
+      int32_t num;
+      if (upb_enumdef_ntoi(e, tok, len, &num)) {
+        return upb_sink_putint32(sink, sel, num);
+      } else if (parse_int(tok, len, &neg, &u) &&
+                 u <= (neg ? (uint64_t)INT32_MAX + 1 : INT32_MAX)) {
+        return upb_sink_putint32(sink, sel,
+                                 neg ? (int32_t)(0 - u) : (int32_t)u);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+
+  p->ptr = tok;
+  return parse_error(p, "invalid value '%.*s' for field '%s'", (int)len, tok,
+                     upb_fielddef_name(f));
+}
+
+static bool str_reserve(upb_textparser *p, size_t n) {
+  if (p->str_size - p->str_len < n) {
+    size_t size = UPB_MAX(p->str_size * 2, 128);
+    char *str;
+    while (size - p->str_len < n) size *= 2;
+    str = upb_env_realloc(p->env, p->str, p->str_size, size);
+    if (!str) return false;
+    p->str = str;
+    p->str_size = size;
+  }
+  return true;
+}
+
+static int hexdigit(int ch) {
+  if (ch >= '0' && ch <= '9') return ch - '0';
+  if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+  if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+  return -1;
+}
+
+/* Appends the value of the escape sequence after a backslash. */
+static bool unescape(upb_textparser *p) {
+  int ch = peek(p);
+  uint32_t val = 0;
+  int i;
+
+  if (ch < 0) return parse_error(p, "unterminated string");
+  p->ptr++;
+
+  switch (ch) {
+    case 'a': p->str[p->str_len++] = '\a'; return true;
+    case 'b': p->str[p->str_len++] = '\b'; return true;
+    case 'f': p->str[p->str_len++] = '\f'; return true;
+    case 'n': p->str[p->str_len++] = '\n'; return true;
+    case 'r': p->str[p->str_len++] = '\r'; return true;
+    case 't': p->str[p->str_len++] = '\t'; return true;
+    case 'v': p->str[p->str_len++] = '\v'; return true;
+    case '\\': case '\'': case '"': case '?':
+      p->str[p->str_len++] = ch;
+      return true;
+    case 'x': case 'X':
+      for (i = 0; i < 2 && hexdigit(peek(p)) >= 0; i++) {
+        val = val * 16 + hexdigit(*p->ptr++);
+      }
+      if (i == 0) return parse_error(p, "invalid \\x escape");
+      p->str[p->str_len++] = val;
+      return true;
+    case 'u': case 'U': {
+      /* A code point, written out as UTF-8. */
+      int digits = (ch == 'u') ? 4 : 8;
+      for (i = 0; i < digits; i++) {
+        int d = hexdigit(peek(p));
+        if (d < 0) return parse_error(p, "invalid \\%c escape", ch);
+        val = val * 16 + d;
+        p->ptr++;
+      }
+      if (val < 0x80) {
+        p->str[p->str_len++] = val;
+      } else if (val < 0x800) {
+        p->str[p->str_len++] = 0xc0 | (val >> 6);
+        p->str[p->str_len++] = 0x80 | (val & 0x3f);
+      } else if (val < 0x10000) {
+        p->str[p->str_len++] = 0xe0 | (val >> 12);
+        p->str[p->str_len++] = 0x80 | ((val >> 6) & 0x3f);
+        p->str[p->str_len++] = 0x80 | (val & 0x3f);
+      } else if (val < 0x110000) {
+        p->str[p->str_len++] = 0xf0 | (val >> 18);
+        p->str[p->str_len++] = 0x80 | ((val >> 12) & 0x3f);
+        p->str[p->str_len++] = 0x80 | ((val >> 6) & 0x3f);
+        p->str[p->str_len++] = 0x80 | (val & 0x3f);
+      } else {
+        return parse_error(p, "invalid \\%c escape", ch);
+      }
+      return true;
+    }
+    default:
+      if (ch >= '0' && ch <= '7') {
+        val = ch - '0';
+        for (i = 1; i < 3 && peek(p) >= '0' && peek(p) <= '7'; i++) {
+          val = val * 8 + (*p->ptr++ - '0');
+        }
+        p->str[p->str_len++] = val;
+        return true;
+      }
+      return parse_error(p, "invalid escape '\\%c'", ch);
+  }
+}
+
+/* Parses one or more adjacent quoted strings, which are concatenated. */
+static bool parse_string(upb_textparser *p, const upb_fielddef *f,
+                         upb_sink *sink) {
+  const char *buf;
+  size_t len;
+  upb_sink subsink;
+  int quote;
+
+  p->str_len = 0;
+
+  while ((quote = peek(p)) == '"' || quote == '\'') {
+    const char *start = ++p->ptr;
+    const char *end = start;
+
+    /* Copy runs without escapes in one go. */
+    for (;;) {
+      while (end < p->end && *end != quote && *end != '\\' && *end != '\n') {
+        end++;
+      }
+      if (!str_reserve(p, (end - p->ptr) + 4)) return false;
+      memcpy(p->str + p->str_len, p->ptr, end - p->ptr);
+      p->str_len += end - p->ptr;
+      p->ptr = end;
+
+      if (end == p->end || *end == '\n') {
+        return parse_error(p, "unterminated string");
+      } else if (*end == quote) {
+        break;
+      }
+
+      p->ptr++;
+      if (!unescape(p)) return false;
+      end = p->ptr;
+    }
+
+    p->ptr++;
+    skipws(p);
+  }
+
+  buf = p->str;
+  len = p->str_len;
+  return upb_sink_startstr(sink, getsel(f, UPB_HANDLER_STARTSTR), len,
+                           &subsink) &&
+         upb_sink_putstring(&subsink, getsel(f, UPB_HANDLER_STRING), buf, len,
+                            NULL) == len &&
+         upb_sink_endstr(sink, getsel(f, UPB_HANDLER_ENDSTR));
+}
+
+static bool parse_value(upb_textparser *p, const upb_fielddef *f) {
+  upb_sink *sink = valuesink(p, f);
+  int ch = peek(p);
+  if (!sink) return false;
+
+  if (upb_fielddef_isstring(f)) {
+    if (ch != '"' && ch != '\'') {
+      return parse_error(p, "expected string for field '%s'",
+                         upb_fielddef_name(f));
+    }
+    return parse_string(p, f, sink);
+  } else {
+    return parse_number(p, f, sink);
+  }
+}
+
+
+/* Messages *******************************************************************/
+
+static bool parse_field(upb_textparser *p) {
+  const char *name = p->ptr;
+  size_t len = scan(p, CHAR_IDENT);
+  const upb_fielddef *f;
+  upb_value v;
+
+  if (peek(p) == '[' && len == 0) {
+    return parse_error(p, "extensions are not supported");
+  } else if (len == 0) {
+    return parse_error(p, "expected field name");
+  } else if (!upb_frozentable_lookupstr(p->top->name_table, name, len, &v)) {
+    p->ptr = name;
+    return parse_error(p, "no field named '%.*s' in message %s", (int)len,
+                       name, upb_msgdef_fullname(p->top->m));
+  }
+
+  f = upb_value_getconstptr(v);
+  skipws(p);
+
+  if (upb_fielddef_issubmsg(f)) {
+    /* The ':' is optional before a message. */
+    if (consume(p, ':')) skipws(p);
+    if (upb_fielddef_isseq(f) && consume(p, '[')) {
+      skipws(p);
+      return consume(p, ']') || startsubmsg(p, f, true);
+    }
+    return startsubmsg(p, f, false);
+  }
+
+  if (!consume(p, ':')) {
+    return parse_error(p, "expected ':' after field '%s'",
+                       upb_fielddef_name(f));
+  }
+  skipws(p);
+
+  if (upb_fielddef_isseq(f) && consume(p, '[')) {
+    skipws(p);
+    if (consume(p, ']')) return true;
+    for (;;) {
+      if (!parse_value(p, f)) return false;
+      skipws(p);
+      if (consume(p, ']')) return true;
+      if (!consume(p, ',')) return parse_error(p, "expected ',' or ']'");
+      skipws(p);
+    }
+  }
+
+  return parse_value(p, f);
+}
+
+static bool parse_message(upb_textparser *p) {
+  for (;;) {
+    int ch;
+    skipws(p);
+    ch = peek(p);
+
+    if (ch < 0) {
+      if (p->top != p->stack) return parse_error(p, "unexpected end of input");
+      return endseq(p);
+    } else if (ch == p->top->close) {
+      p->ptr++;
+      if (!endsubmsg(p)) return false;
+    } else if (ch == ';' || ch == ',') {
+      /* Optional separator after a field. */
+      p->ptr++;
+    } else if (!parse_field(p)) {
+      return false;
+    }
+  }
+}
+
+
+/* Input handlers *************************************************************/
+
+static size_t putbuf(void *closure, const void *hd, const char *buf,
+                     size_t len, const upb_bufhandle *handle) {
+  upb_textparser *p = closure;
+  UPB_UNUSED(hd);
+  UPB_UNUSED(handle);
+
+  if (p->size - p->len < len) {
+    size_t size = UPB_MAX(p->size * 2, 1024);
+    char *newbuf;
+    while (size - p->len < len) size *= 2;
+    newbuf = upb_env_realloc(p->env, p->buf, p->size, size);
+    if (!newbuf) {
+      upb_status_seterrmsg(&p->status, "Out of memory");
+      upb_env_reporterror(p->env, &p->status);
+      return 0;
+    }
+    p->buf = newbuf;
+    p->size = size;
+  }
+
+  memcpy(p->buf + p->len, buf, len);
+  p->len += len;
+  return len;
+}
+
+static bool end(void *closure, const void *hd) {
+  upb_textparser *p = closure;
+  bool ok;
+  UPB_UNUSED(hd);
+
+  p->ptr = p->buf;
+  p->end = p->buf + p->len;
+  p->top = p->stack;
+  p->top->seqf = NULL;
+
+  ok = upb_sink_startmsg(&p->top->sink) && parse_message(p) &&
+       upb_sink_endmsg(&p->top->sink, &p->status);
+
+  /* Ready for the next message. */
+  p->len = 0;
+  return ok;
+}
+
+
+/* Method *********************************************************************/
+
+static void visit_textparsermethod(const upb_refcounted *r,
+                                   upb_refcounted_visit *visit,
+                                   void *closure) {
+  const upb_textparsermethod *method = (upb_textparsermethod*)r;
+  visit(r, upb_msgdef_upcast2(method->msg), closure);
+}
+
+static void free_textparsermethod(upb_refcounted *r) {
+  upb_textparsermethod *method = (upb_textparsermethod*)r;
+
+  upb_inttable_iter i;
+  upb_inttable_begin(&i, &method->name_tables);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_value val = upb_inttable_iter_value(&i);
+    upb_gfree(upb_value_getptr(val));
+  }
+
+  upb_inttable_uninit(&method->name_tables);
+
+  upb_gfree(r);
+}
+
+/* Returns false if memory allocation failed. */
+static bool add_name_table(upb_textparsermethod *m, const upb_msgdef *md) {
+  upb_msg_field_iter i;
+  upb_strtable t;
+  void *frozen;
+  size_t size;
+
+  if (upb_inttable_lookupptr(&m->name_tables, md, NULL)) {
+    return true;
+  }
+
+  if (!upb_strtable_init(&t, UPB_CTYPE_CONSTPTR)) {
+    return false;
+  }
+
+  for(upb_msg_field_begin(&i, md);
+      !upb_msg_field_done(&i);
+      upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    if (!upb_strtable_insert(&t, upb_fielddef_name(f),
+                             upb_value_constptr(f))) {
+      goto err;
+    }
+
+    if (upb_fielddef_istagdelim(f)) {
+      /* Groups are written with their type name. */
+      const char *name = upb_msgdef_fullname(upb_fielddef_msgsubdef(f));
+      const char *last = strrchr(name, '.');
+      if (last) name = last + 1;
+      if (!upb_strtable_lookup(&t, name, NULL) &&
+          !upb_strtable_insert(&t, name, upb_value_constptr(f))) {
+        goto err;
+      }
+    }
+  }
+
+  size = upb_strtable_frozensize(&t);
+  frozen = upb_gmalloc(size);
+  if (!frozen || !upb_strtable_freeze(&t, frozen, size, &upb_alloc_global)) {
+    upb_gfree(frozen);
+    goto err;
+  }
+  upb_strtable_uninit(&t);
+  if (!upb_inttable_insertptr(&m->name_tables, md, upb_value_ptr(frozen))) {
+    upb_gfree(frozen);
+    return false;
+  }
+
+  /* Recurse only now that |md| is in the table, in case of cycles. */
+  for(upb_msg_field_begin(&i, md);
+      !upb_msg_field_done(&i);
+      upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    if (upb_fielddef_issubmsg(f) &&
+        !add_name_table(m, upb_fielddef_msgsubdef(f))) {
+      return false;
+    }
+  }
+
+  return true;
+
+err:
+  upb_strtable_uninit(&t);
+  return false;
+}
+
+
+/* Public API *****************************************************************/
+
+upb_textparser *upb_textparser_create(upb_env *env,
+                                      const upb_textparsermethod *method,
+                                      upb_sink *output) {
+  upb_textparser *p = upb_env_malloc(env, sizeof(upb_textparser));
+  if (!p) return NULL;
+
+  p->env = env;
+  p->method = method;
+  p->limit = p->stack + UPB_TEXTPARSER_MAX_DEPTH;
+  p->buf = NULL;
+  p->len = 0;
+  p->size = 0;
+  p->str = NULL;
+  p->str_len = 0;
+  p->str_size = 0;
+  upb_status_clear(&p->status);
+  upb_bytessink_reset(&p->input_, &method->input_handler_, p);
+
+  p->top = p->stack;
+  upb_sink_reset(&p->top->sink, output->handlers, output->closure);
+  p->top->m = upb_handlers_msgdef(output->handlers);
+  p->top->name_table = get_name_table(p, p->top->m);
+  p->top->f = NULL;
+  p->top->seqf = NULL;
+  p->top->close = 0;
+  p->top->inlist = false;
+
+  return p;
+}
+
+upb_bytessink *upb_textparser_input(upb_textparser *p) {
+  return &p->input_;
+}
+
+upb_textparsermethod *upb_textparsermethod_new(const upb_msgdef *md,
+                                               const void *owner) {
+  static const struct upb_refcounted_vtbl vtbl = {visit_textparsermethod,
+                                                  free_textparsermethod};
+  upb_textparsermethod *ret = upb_gmalloc(sizeof(*ret));
+  upb_refcounted_init(upb_textparsermethod_upcast_mutable(ret), &vtbl, owner);
+
+  ret->msg = md;
+  upb_ref2(md, ret);
+
+  upb_byteshandler_init(&ret->input_handler_);
+  upb_byteshandler_setstring(&ret->input_handler_, putbuf, ret);
+  upb_byteshandler_setendstr(&ret->input_handler_, end, ret);
+
+  upb_inttable_init(&ret->name_tables, UPB_CTYPE_PTR);
+
+  if (!add_name_table(ret, md)) {
+    upb_textparsermethod_unref(ret, owner);
+    return NULL;
+  }
+
+  return ret;
+}
+
+const upb_byteshandler *upb_textparsermethod_inputhandler(
+    const upb_textparsermethod *m) {
+  return &m->input_handler_;
+}
@@ -0,0 +1,108 @@
+/*
+** upb::pb::TextParser (upb_textparser)
+**
+** Parses protobuf text format, the format written by upb::pb::TextPrinter,
+** and pushes the result to a sink.  Extensions ("[foo.bar]: ...") and
+** expanded Any messages are not supported.
+*/
+
+#ifndef UPB_PB_TEXTPARSER_H_
+#define UPB_PB_TEXTPARSER_H_
+
+#include "upb/sink.h"
+
+#ifdef __cplusplus
+namespace upb {
+namespace pb {
+class TextParser;
+class TextParserMethod;
+}  /* namespace pb */
+}  /* namespace upb */
+#endif
+
+UPB_DECLARE_TYPE(upb::pb::TextParser, upb_textparser)
+UPB_DECLARE_DERIVED_TYPE(upb::pb::TextParserMethod, upb::RefCounted,
+                         upb_textparsermethod, upb_refcounted)
+
+/* upb::pb::TextParser ********************************************************/
+
+#ifdef __cplusplus
+
+/* Parses an incoming BytesStream, pushing the results to the destination
+ * sink.  The text is buffered and parsed when the stream ends. */
+class upb::pb::TextParser {
+ public:
+  static TextParser* Create(Environment* env, const TextParserMethod* method,
+                            Sink* output);
+
+  BytesSink* input();
+
+ private:
+  UPB_DISALLOW_POD_OPS(TextParser, upb::pb::TextParser)
+};
+
+class upb::pb::TextParserMethod {
+ public:
+  /* Include base methods from upb::ReferenceCounted. */
+  UPB_REFCOUNTED_CPPMETHODS
+
+  /* Returns a method for parsing messages of the given type, and any message
+   * types it refers to. */
+  static reffed_ptr<const TextParserMethod> New(const upb::MessageDef* md);
+
+  /* The input handlers for this parser method. */
+  const BytesHandler* input_handler() const;
+
+ private:
+  UPB_DISALLOW_POD_OPS(TextParserMethod, upb::pb::TextParserMethod)
+};
+
+#endif
+
+UPB_BEGIN_EXTERN_C
+
+upb_textparser *upb_textparser_create(upb_env *e,
+                                      const upb_textparsermethod *m,
+                                      upb_sink *output);
+upb_bytessink *upb_textparser_input(upb_textparser *p);
+
+/* Returns NULL if memory allocation failed. */
+upb_textparsermethod *upb_textparsermethod_new(const upb_msgdef *md,
+                                               const void *owner);
+const upb_byteshandler *upb_textparsermethod_inputhandler(
+    const upb_textparsermethod *m);
+
+/* Include refcounted methods like upb_textparsermethod_ref(). */
+UPB_REFCOUNTED_CMETHODS(upb_textparsermethod, upb_textparsermethod_upcast)
+
+UPB_END_EXTERN_C
+
+#ifdef __cplusplus
+
+namespace upb {
+namespace pb {
+inline TextParser* TextParser::Create(Environment* env,
+                                      const TextParserMethod* method,
+                                      Sink* output) {
+  return upb_textparser_create(env, method, output);
+}
+inline BytesSink* TextParser::input() {
+  return upb_textparser_input(this);
+}
+
+inline const BytesHandler* TextParserMethod::input_handler() const {
+  return upb_textparsermethod_inputhandler(this);
+}
+/* static */
+inline reffed_ptr<const TextParserMethod> TextParserMethod::New(
+    const MessageDef* md) {
+  const upb_textparsermethod *m = upb_textparsermethod_new(md, &m);
+  return reffed_ptr<const TextParserMethod>(m, &m);
+}
+
+}  /* namespace pb */
+}  /* namespace upb */
+
+#endif
+
+#endif  /* UPB_PB_TEXTPARSER_H_ */
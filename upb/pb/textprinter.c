@@ -1,71 +1,175 @@
 /*
  * upb::pb::TextPrinter
  *
- * OPT: This is not optimized at all.  It uses printf() which parses the format
- * string every time, and it allocates memory for every put.
+ * Output is appended to a buffer owned by the printer and handed to the
+ * output sink only when the buffer fills or the top-level message ends.  Each
+ * field's "name: " prefix is computed once, when the handlers are built, so a
+ * scalar field costs one reserve() and a few memcpy()s.
  */
 
 #include "upb/pb/textprinter.h"
 
 #include <ctype.h>
-#include <float.h>
-#include <inttypes.h>
-#include <stdarg.h>
-#include <stdio.h>
 #include <string.h>
 
+#include "upb/fmt.int.h"
 #include "upb/sink.h"
 
+/* Initial size of the output buffer; it grows if a single line needs more. */
+#define UPB_TEXTPRINTER_BUFSIZE 4096
+
 struct upb_textprinter {
   upb_sink input_;
   upb_bytessink *output_;
+  upb_env *env_;
   int indent_depth_;
   bool single_line_;
   void *subc;
+
+  /* Pending output. */
+  char *buf_;
+  size_t len_;
+  size_t size_;
 };
 
-#define CHECK(x) if ((x) < 0) goto err;
+typedef struct {
+  const char *ptr;  /* NULL for an enum value with no name. */
+  size_t len;
+} enumname;
+
+/* Handler data for every field: the field and the text that starts its line,
+ * eg. 'name: ' for scalars, 'name: "' for strings or 'name {' for
+ * submessages.  Enum fields whose values are about contiguous also get their
+ * value names, indexed by value - enum_min. */
+typedef struct {
+  const upb_fielddef *f;
+  enumname *enum_names;
+  int32_t enum_min;
+  uint32_t enum_count;  /* 0 if there is no table. */
+  size_t len;
+  char prefix[1];  /* Allocated to actual length. */
+} fieldpc;
 
 static const char *shortname(const char *longname) {
   const char *last = strrchr(longname, '.');
   return last ? last + 1 : longname;
 }
 
-static int indent(upb_textprinter *p) {
-  int i;
-  if (!p->single_line_)
-    for (i = 0; i < p->indent_depth_; i++)
-      upb_bytessink_putbuf(p->output_, p->subc, "  ", 2, NULL);
-  return 0;
+static fieldpc *newfieldpc(upb_handlers *h, const upb_fielddef *f,
+                           const char *name, const char *suffix) {
+  size_t namelen = strlen(name);
+  size_t suffixlen = strlen(suffix);
+  fieldpc *ret = upb_gmalloc(sizeof(*ret) + namelen + suffixlen);
+  if (!ret) return NULL;
+  ret->f = f;
+  ret->enum_names = NULL;
+  ret->enum_min = 0;
+  ret->enum_count = 0;
+  ret->len = namelen + suffixlen;
+  memcpy(ret->prefix, name, namelen);
+  memcpy(ret->prefix + namelen, suffix, suffixlen + 1);
+  upb_handlers_addcleanup(h, ret, upb_gfree);
+  return ret;
 }
 
-static int endfield(upb_textprinter *p) {
-  const char ch = (p->single_line_ ? ' ' : '\n');
-  upb_bytessink_putbuf(p->output_, p->subc, &ch, 1, NULL);
-  return 0;
+/* Fills in the value names of an enum field whose enum spans at most twice as
+ * many numbers as it has values, the same test as build_enum_names() in
+ * upb/json/printer.c.  They point at the enumdef's own strings. */
+static void setenumnames(upb_handlers *h, fieldpc *pc) {
+  const upb_enumdef *e = upb_fielddef_enumsubdef(pc->f);
+  int numvals = upb_enumdef_numvals(e);
+  int64_t min = INT32_MAX;
+  int64_t max = INT32_MIN;
+  upb_enum_iter it;
+  uint32_t i;
+
+  for (upb_enum_begin(&it, e); !upb_enum_done(&it); upb_enum_next(&it)) {
+    int32_t num = upb_enum_iter_number(&it);
+    min = UPB_MIN(min, num);
+    max = UPB_MAX(max, num);
+  }
+
+  if (numvals == 0 || max - min + 1 > 2 * (int64_t)numvals) return;
+
+  pc->enum_names = upb_gmalloc((max - min + 1) * sizeof(*pc->enum_names));
+  if (!pc->enum_names) return;
+  upb_handlers_addcleanup(h, pc->enum_names, upb_gfree);
+
+  for (i = 0; i < max - min + 1; i++) {
+    const char *name = upb_enumdef_iton(e, (int32_t)(min + i));
+    pc->enum_names[i].ptr = name;
+    pc->enum_names[i].len = name ? strlen(name) : 0;
+  }
+
+  pc->enum_min = (int32_t)min;
+  pc->enum_count = (uint32_t)(max - min + 1);
 }
 
-static int putescaped(upb_textprinter *p, const char *buf, size_t len,
-                      bool preserve_utf8) {
-  /* Based on CEscapeInternal() from Google's protobuf release. */
-  char dstbuf[4096], *dst = dstbuf, *dstend = dstbuf + sizeof(dstbuf);
-  const char *end = buf + len;
+static bool flush(upb_textprinter *p) {
+  size_t len = p->len_;
+  if (len == 0) return true;
+  p->len_ = 0;
+  return upb_bytessink_putbuf(p->output_, p->subc, p->buf_, len, NULL) == len;
+}
 
-  /* I think hex is prettier and more useful, but proto2 uses octal; should
-   * investigate whether it can parse hex also. */
-  const bool use_hex = false;
-  bool last_hex_escape = false; /* true if last output char was \xNN */
+/* Returns a pointer with room for at least "n" bytes of output, flushing or
+ * growing the buffer as needed.  The caller advances p->len_ by the number of
+ * bytes it actually wrote. */
+static char *reserve(upb_textprinter *p, size_t n) {
+  if (p->size_ - p->len_ < n) {
+    if (!flush(p)) return NULL;
+    if (p->size_ < n) {
+      size_t size = p->size_;
+      char *buf;
+      while (size < n) size *= 2;
+      buf = upb_env_realloc(p->env_, p->buf_, p->size_, size);
+      if (!buf) return NULL;
+      p->buf_ = buf;
+      p->size_ = size;
+    }
+  }
+  return p->buf_ + p->len_;
+}
+
+static size_t indentlen(const upb_textprinter *p) {
+  return p->single_line_ ? 0 : p->indent_depth_ * 2;
+}
+
+/* Reserves room for the indent, the field's prefix, and "n" more bytes, and
+ * writes the first two.  Returns where the rest of the line goes. */
+static char *startline(upb_textprinter *p, const fieldpc *pc, size_t n) {
+  size_t ind = indentlen(p);
+  char *out = reserve(p, ind + pc->len + n);
+  if (!out) return NULL;
+  memset(out, ' ', ind);
+  out += ind;
+  memcpy(out, pc->prefix, pc->len);
+  return out + pc->len;
+}
+
+static void endline(upb_textprinter *p, char *out) {
+  *out++ = (p->single_line_ ? ' ' : '\n');
+  p->len_ = out - p->buf_;
+}
+
+static bool putescaped(upb_textprinter *p, const char *buf, size_t len,
+                       bool preserve_utf8) {
+  /* Based on CEscapeInternal() from Google's protobuf release.  proto2 uses
+   * octal escapes, so we do too. */
+  const char *end = buf + len;
+  char *dst = p->buf_ + p->len_;
+  char *dstend = p->buf_ + p->size_;
 
   for (; buf < end; buf++) {
-    bool is_hex_escape;
+    uint8_t ch = (uint8_t)*buf;
 
     if (dstend - dst < 4) {
-      upb_bytessink_putbuf(p->output_, p->subc, dstbuf, dst - dstbuf, NULL);
-      dst = dstbuf;
+      p->len_ = dst - p->buf_;
+      if (!flush(p)) return false;
+      dst = p->buf_;
     }
 
-    is_hex_escape = false;
-    switch (*buf) {
+    switch (ch) {
       case '\n': *(dst++) = '\\'; *(dst++) = 'n';  break;
       case '\r': *(dst++) = '\\'; *(dst++) = 'r';  break;
       case '\t': *(dst++) = '\\'; *(dst++) = 't';  break;
@@ -73,50 +177,19 @@ static int putescaped(upb_textprinter *p, const char *buf, size_t len,
       case '\'': *(dst++) = '\\'; *(dst++) = '\''; break;
       case '\\': *(dst++) = '\\'; *(dst++) = '\\'; break;
       default:
-        /* Note that if we emit \xNN and the buf character after that is a hex
-         * digit then that digit must be escaped too to prevent it being
-         * interpreted as part of the character code by C. */
-        if ((!preserve_utf8 || (uint8_t)*buf < 0x80) &&
-            (!isprint(*buf) || (last_hex_escape && isxdigit(*buf)))) {
-          sprintf(dst, (use_hex ? "\\x%02x" : "\\%03o"), (uint8_t)*buf);
-          is_hex_escape = use_hex;
-          dst += 4;
+        if ((!preserve_utf8 || ch < 0x80) && !isprint(ch)) {
+          *(dst++) = '\\';
+          *(dst++) = '0' + (ch >> 6);
+          *(dst++) = '0' + ((ch >> 3) & 7);
+          *(dst++) = '0' + (ch & 7);
         } else {
-          *(dst++) = *buf; break;
+          *(dst++) = *buf;
         }
     }
-    last_hex_escape = is_hex_escape;
   }
-  /* Flush remaining data. */
-  upb_bytessink_putbuf(p->output_, p->subc, dstbuf, dst - dstbuf, NULL);
-  return 0;
-}
 
-bool putf(upb_textprinter *p, const char *fmt, ...) {
-  va_list args;
-  va_list args_copy;
-  char *str;
-  int written;
-  int len;
-  bool ok;
-
-  va_start(args, fmt);
-
-  /* Run once to get the length of the string. */
-  _upb_va_copy(args_copy, args);
-  len = _upb_vsnprintf(NULL, 0, fmt, args_copy);
-  va_end(args_copy);
-
-  /* + 1 for NULL terminator (vsprintf() requires it even if we don't). */
-  str = upb_gmalloc(len + 1);
-  if (!str) return false;
-  written = vsprintf(str, fmt, args);
-  va_end(args);
-  UPB_ASSERT(written == len);
-
-  ok = upb_bytessink_putbuf(p->output_, p->subc, str, len, NULL);
-  upb_gfree(str);
-  return ok;
+  p->len_ = dst - p->buf_;
+  return true;
 }
 
 
@@ -127,6 +200,7 @@ static bool textprinter_startmsg(void *c, const void *hd) {
   UPB_UNUSED(hd);
   if (p->indent_depth_ == 0) {
     upb_bytessink_start(p->output_, 0, &p->subc);
+    p->len_ = 0;
   }
   return true;
 }
@@ -136,116 +210,125 @@ static bool textprinter_endmsg(void *c, const void *hd, upb_status *s) {
   UPB_UNUSED(hd);
   UPB_UNUSED(s);
   if (p->indent_depth_ == 0) {
+    if (!flush(p)) return false;
     upb_bytessink_end(p->output_);
   }
   return true;
 }
 
-#define TYPE(name, ctype, fmt) \
+#define TYPE(name, ctype, fmt_func) \
   static bool textprinter_put ## name(void *closure, const void *handler_data, \
                                       ctype val) {                             \
     upb_textprinter *p = closure;                                              \
-    const upb_fielddef *f = handler_data;                                      \
-    CHECK(indent(p));                                                          \
-    putf(p, "%s: " fmt, upb_fielddef_name(f), val);                            \
-    CHECK(endfield(p));                                                        \
+    char *out = startline(p, handler_data, UPB_FMT_BUFSIZE + 1);               \
+    if (!out) return false;                                                    \
+    out += fmt_func(val, out);                                                 \
+    endline(p, out);                                                           \
     return true;                                                               \
-  err:                                                                         \
-    return false;                                                              \
+}
+
+TYPE(int32,  int32_t,  upb_fmt_int64)
+TYPE(int64,  int64_t,  upb_fmt_int64)
+TYPE(uint32, uint32_t, upb_fmt_uint64)
+TYPE(uint64, uint64_t, upb_fmt_uint64)
+TYPE(float,  float,    upb_fmt_float)
+TYPE(double, double,   upb_fmt_double)
+
+#undef TYPE
+
+/* Puts a whole line whose value is the literal "str" of length "len". */
+static bool putliteral(upb_textprinter *p, const fieldpc *pc, const char *str,
+                       size_t len) {
+  char *out = startline(p, pc, len + 1);
+  if (!out) return false;
+  memcpy(out, str, len);
+  endline(p, out + len);
+  return true;
 }
 
 static bool textprinter_putbool(void *closure, const void *handler_data,
                                 bool val) {
   upb_textprinter *p = closure;
-  const upb_fielddef *f = handler_data;
-  CHECK(indent(p));
-  putf(p, "%s: %s", upb_fielddef_name(f), val ? "true" : "false");
-  CHECK(endfield(p));
-  return true;
-err:
-  return false;
+  return val ? putliteral(p, handler_data, "true", 4)
+             : putliteral(p, handler_data, "false", 5);
 }
 
-#define STRINGIFY_HELPER(x) #x
-#define STRINGIFY_MACROVAL(x) STRINGIFY_HELPER(x)
-
-TYPE(int32,  int32_t,  "%" PRId32)
-TYPE(int64,  int64_t,  "%" PRId64)
-TYPE(uint32, uint32_t, "%" PRIu32)
-TYPE(uint64, uint64_t, "%" PRIu64)
-TYPE(float,  float,    "%." STRINGIFY_MACROVAL(FLT_DIG) "g")
-TYPE(double, double,   "%." STRINGIFY_MACROVAL(DBL_DIG) "g")
-
-#undef TYPE
-
 /* Output a symbolic value from the enum if found, else just print as int32. */
 static bool textprinter_putenum(void *closure, const void *handler_data,
                                 int32_t val) {
   upb_textprinter *p = closure;
-  const upb_fielddef *f = handler_data;
-  const upb_enumdef *enum_def = upb_downcast_enumdef(upb_fielddef_subdef(f));
-  const char *label = upb_enumdef_iton(enum_def, val);
+  const fieldpc *pc = handler_data;
+  uint32_t i = (uint32_t)val - (uint32_t)pc->enum_min;
+  const upb_enumdef *enum_def;
+  const char *label;
+
+  if (i < pc->enum_count && pc->enum_names[i].ptr) {
+    return putliteral(p, pc, pc->enum_names[i].ptr, pc->enum_names[i].len);
+  }
+
+  enum_def = upb_downcast_enumdef(upb_fielddef_subdef(pc->f));
+  label = upb_enumdef_iton(enum_def, val);
   if (label) {
-    indent(p);
-    putf(p, "%s: %s", upb_fielddef_name(f), label);
-    endfield(p);
+    return putliteral(p, pc, label, strlen(label));
   } else {
-    if (!textprinter_putint32(closure, handler_data, val))
-      return false;
+    return textprinter_putint32(closure, handler_data, val);
   }
-  return true;
 }
 
 static void *textprinter_startstr(void *closure, const void *handler_data,
                       size_t size_hint) {
   upb_textprinter *p = closure;
-  const upb_fielddef *f = handler_data;
+  char *out = startline(p, handler_data, 0);
   UPB_UNUSED(size_hint);
-  indent(p);
-  putf(p, "%s: \"", upb_fielddef_name(f));
+  if (!out) return UPB_BREAK;
+  p->len_ = out - p->buf_;
   return p;
 }
 
 static bool textprinter_endstr(void *closure, const void *handler_data) {
   upb_textprinter *p = closure;
+  char *out = reserve(p, 2);
   UPB_UNUSED(handler_data);
-  putf(p, "\"");
-  endfield(p);
+  if (!out) return false;
+  *out++ = '"';
+  endline(p, out);
   return true;
 }
 
 static size_t textprinter_putstr(void *closure, const void *hd, const char *buf,
                                  size_t len, const upb_bufhandle *handle) {
   upb_textprinter *p = closure;
-  const upb_fielddef *f = hd;
+  const fieldpc *pc = hd;
   UPB_UNUSED(handle);
-  CHECK(putescaped(p, buf, len, upb_fielddef_type(f) == UPB_TYPE_STRING));
+  if (!putescaped(p, buf, len, upb_fielddef_type(pc->f) == UPB_TYPE_STRING)) {
+    return 0;
+  }
   return len;
-err:
-  return 0;
 }
 
 static void *textprinter_startsubmsg(void *closure, const void *handler_data) {
   upb_textprinter *p = closure;
-  const char *name = handler_data;
-  CHECK(indent(p));
-  putf(p, "%s {%c", name, p->single_line_ ? ' ' : '\n');
+  char *out = startline(p, handler_data, 1);
+  if (!out) return UPB_BREAK;
+  endline(p, out);
   p->indent_depth_++;
   return p;
-err:
-  return UPB_BREAK;
 }
 
 static bool textprinter_endsubmsg(void *closure, const void *handler_data) {
   upb_textprinter *p = closure;
+  size_t ind;
+  char *out;
   UPB_UNUSED(handler_data);
   p->indent_depth_--;
-  CHECK(indent(p));
-  upb_bytessink_putbuf(p->output_, p->subc, "}", 1, NULL);
-  CHECK(endfield(p));
+  ind = indentlen(p);
+  out = reserve(p, ind + 2);
+  if (!out) return false;
+  memset(out, ' ', ind);
+  out += ind;
+  *out++ = '}';
+  endline(p, out);
   return true;
-err:
-  return false;
 }
 
 static void onmreg(const void *c, upb_handlers *h) {
@@ -261,7 +344,23 @@ static void onmreg(const void *c, upb_handlers *h) {
       upb_msg_field_next(&i)) {
     upb_fielddef *f = upb_msg_iter_field(&i);
     upb_handlerattr attr = UPB_HANDLERATTR_INITIALIZER;
-    upb_handlerattr_sethandlerdata(&attr, f);
+    const char *name = upb_fielddef_name(f);
+    const char *suffix = ": ";
+    fieldpc *pc;
+
+    if (upb_fielddef_isstring(f)) {
+      suffix = ": \"";
+    } else if (upb_fielddef_issubmsg(f)) {
+      suffix = " {";
+      if (upb_fielddef_istagdelim(f)) {
+        name = shortname(upb_msgdef_fullname(upb_fielddef_msgsubdef(f)));
+      }
+    }
+
+    pc = newfieldpc(h, f, name, suffix);
+    if (!pc) return;
+    upb_handlerattr_sethandlerdata(&attr, pc);
+
     switch (upb_fielddef_type(f)) {
       case UPB_TYPE_INT32:
         upb_handlers_setint32(h, f, textprinter_putint32, &attr);
@@ -290,17 +389,12 @@ static void onmreg(const void *c, upb_handlers *h) {
         upb_handlers_setstring(h, f, textprinter_putstr, &attr);
         upb_handlers_setendstr(h, f, textprinter_endstr, &attr);
         break;
-      case UPB_TYPE_MESSAGE: {
-        const char *name =
-            upb_fielddef_istagdelim(f)
-                ? shortname(upb_msgdef_fullname(upb_fielddef_msgsubdef(f)))
-                : upb_fielddef_name(f);
-        upb_handlerattr_sethandlerdata(&attr, name);
+      case UPB_TYPE_MESSAGE:
         upb_handlers_setstartsubmsg(h, f, textprinter_startsubmsg, &attr);
         upb_handlers_setendsubmsg(h, f, textprinter_endsubmsg, &attr);
         break;
-      }
       case UPB_TYPE_ENUM:
+        setenumnames(h, pc);
         upb_handlers_setint32(h, f, textprinter_putenum, &attr);
         break;
     }
@@ -321,6 +415,11 @@ upb_textprinter *upb_textprinter_create(upb_env *env, const upb_handlers *h,
   if (!p) return NULL;
 
   p->output_ = output;
+  p->env_ = env;
+  p->len_ = 0;
+  p->size_ = UPB_TEXTPRINTER_BUFSIZE;
+  p->buf_ = upb_env_malloc(env, p->size_);
+  if (!p->buf_) return NULL;
   upb_sink_reset(&p->input_, h, p);
   textprinter_reset(p, false);
 
@@ -332,6 +431,10 @@ const upb_handlers *upb_textprinter_newhandlers(const upb_msgdef *m,
   return upb_handlers_newfrozen(m, owner, &onmreg, NULL);
 }
 
+upb_handlercache *upb_textprinter_newcache() {
+  return upb_handlercache_new(&onmreg, NULL);
+}
+
 upb_sink *upb_textprinter_input(upb_textprinter *p) { return &p->input_; }
 
 void upb_textprinter_setsingleline(upb_textprinter *p, bool single_line) {
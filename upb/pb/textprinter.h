@@ -49,6 +49,7 @@ upb_sink *upb_textprinter_input(upb_textprinter *p);
 
 const upb_handlers *upb_textprinter_newhandlers(const upb_msgdef *m,
                                                 const void *owner);
+upb_handlercache *upb_textprinter_newcache();
 
 UPB_END_EXTERN_C
 
@@ -101,26 +101,34 @@ UPB_INLINE int upb_value_size(uint64_t val) {
   return val == 0 ? 1 : high_bit / 8 + 1;
 }
 
-/* Encodes a 64-bit varint into buf (which must be >=UPB_PB_VARINT_MAX_LEN
- * bytes long), returning how many bytes were used.
- *
- * TODO: benchmark and optimize if necessary. */
+/* Returns how many bytes upb_vencode64() writes for "val": an extra byte for
+ * every 7 bits above the first 7, computed from the position of the highest
+ * set bit without a loop or a data-dependent branch. */
+UPB_INLINE size_t upb_varint_size(uint64_t val) {
+#ifdef __GNUC__
+  int high_bit = 63 - __builtin_clzll(val | 1);
+#else
+  int high_bit = 0;
+  uint64_t tmp = val;
+  while(tmp >>= 1) high_bit++;
+#endif
+  /* Equal to high_bit / 7 + 1 for every high_bit in [0, 63]. */
+  return (high_bit * 9 + 73) / 64;
+}
+
+/* Encodes a 64-bit varint into buf, returning how many bytes were used.  This
+ * writes exactly upb_varint_size(val) bytes, and at most
+ * UPB_PB_VARINT_MAX_LEN.  Since the length is known up front, the loop has
+ * a fixed trip count instead of testing each byte for the end. */
 UPB_INLINE size_t upb_vencode64(uint64_t val, char *buf) {
+  size_t len = upb_varint_size(val);
   size_t i;
-  if (val == 0) { buf[0] = 0; return 1; }
-  i = 0;
-  while (val) {
-    uint8_t byte = val & 0x7fU;
+  for (i = 0; i < len - 1; i++) {
+    buf[i] = (char)(val | 0x80U);
     val >>= 7;
-    if (val) byte |= 0x80U;
-    buf[i++] = byte;
   }
-  return i;
-}
-
-UPB_INLINE size_t upb_varint_size(uint64_t val) {
-  char buf[UPB_PB_VARINT_MAX_LEN];
-  return upb_vencode64(val, buf);
+  buf[len - 1] = (char)val;
+  return len;
 }
 
 /* Encodes a 32-bit varint, *not* sign-extended. */
@@ -30,11 +30,15 @@ const void *UPB_UNTRACKED_REF = &untracked_val;
 
 static void atomic_inc(uint32_t *a) { (*a)++; }
 static bool atomic_dec(uint32_t *a) { return --(*a) == 0; }
+static bool atomic_sub(uint32_t *a, uint32_t n) { return (*a -= n) == 0; }
 
 #elif defined(__GNUC__) || defined(__clang__) /*------------------------------*/
 
 static void atomic_inc(uint32_t *a) { __sync_fetch_and_add(a, 1); }
 static bool atomic_dec(uint32_t *a) { return __sync_sub_and_fetch(a, 1) == 0; }
+static bool atomic_sub(uint32_t *a, uint32_t n) {
+  return __sync_sub_and_fetch(a, n) == 0;
+}
 
 #elif defined(WIN32) /*-------------------------------------------------------*/
 
@@ -44,6 +48,9 @@ static void atomic_inc(upb_atomic_t *a) { InterlockedIncrement(&a->val); }
 static bool atomic_dec(upb_atomic_t *a) {
   return InterlockedDecrement(&a->val) == 0;
 }
+static bool atomic_sub(upb_atomic_t *a, uint32_t n) {
+  return InterlockedExchangeAdd(&a->val, -(LONG)n) == (LONG)n;
+}
 
 #else
 #error Atomic primitives not defined for your platform/CPU.  \
@@ -71,6 +78,14 @@ static bool unrefgroup(uint32_t *group) {
   }
 }
 
+static bool unrefgroupn(uint32_t *group, uint32_t n) {
+  if (group == &static_refcount) {
+    return false;
+  } else {
+    return atomic_sub(group, n);
+  }
+}
+
 
 /* Reference tracking (debug only) ********************************************/
 
@@ -339,9 +354,13 @@ typedef struct {
   int depth;
   int maxdepth;
   uint64_t index;
-  /* Maps upb_refcounted* -> attributes (color, etc).  attr layout varies by
-   * color. */
-  upb_inttable objattr;
+  /* Attributes (color, etc) of every object seen so far, in dense arrays
+   * indexed by upb_refcounted.freeze_idx.  attr layout varies by color.
+   * objs[i] is the object that owns attrs[i]. */
+  const upb_refcounted **objs;
+  uint64_t *attrs;
+  uint32_t count;
+  uint32_t size;
   upb_inttable stack;   /* stack of upb_refcounted* for Tarjan's algorithm. */
   upb_inttable groups;  /* array of uint32_t*, malloc'd refcounts for new groups */
   upb_status *status;
@@ -369,22 +388,52 @@ UPB_NORETURN static void oom(tarjan *t) {
   err(t);
 }
 
+/* Returns the index of r's attributes, or UINT32_MAX if this freeze has not
+ * seen r.  r->freeze_idx may be stale (left over from an earlier freeze), so
+ * it is only trusted if objs[] points back at r.  This lets us skip clearing
+ * it, and never write to objects that are already frozen. */
+static uint32_t attridx(const tarjan *t, const upb_refcounted *r) {
+  uint32_t i = r->freeze_idx;
+  return (i < t->count && t->objs[i] == r) ? i : UINT32_MAX;
+}
+
 static uint64_t trygetattr(const tarjan *t, const upb_refcounted *r) {
-  upb_value v;
-  return upb_inttable_lookupptr(&t->objattr, r, &v) ?
-      upb_value_getuint64(v) : 0;
+  uint32_t i = attridx(t, r);
+  return i == UINT32_MAX ? 0 : t->attrs[i];
 }
 
 static uint64_t getattr(const tarjan *t, const upb_refcounted *r) {
-  upb_value v;
-  bool found = upb_inttable_lookupptr(&t->objattr, r, &v);
-  UPB_ASSERT(found);
-  return upb_value_getuint64(v);
+  uint32_t i = attridx(t, r);
+  UPB_ASSERT(i != UINT32_MAX);
+  return t->attrs[i];
 }
 
 static void setattr(tarjan *t, const upb_refcounted *r, uint64_t attr) {
-  upb_inttable_removeptr(&t->objattr, r, NULL);
-  upb_inttable_insertptr(&t->objattr, r, upb_value_uint64(attr));
+  uint32_t i = attridx(t, r);
+
+  if (i == UINT32_MAX) {
+    if (t->count == t->size) {
+      uint32_t new_size = UPB_MAX(t->size * 2, 16);
+      void *p;
+
+      if (new_size < t->size) oom(t);
+      p = upb_grealloc(t->objs, t->size * sizeof(*t->objs),
+                       new_size * sizeof(*t->objs));
+      if (!p) oom(t);
+      t->objs = p;
+      p = upb_grealloc(t->attrs, t->size * sizeof(*t->attrs),
+                       new_size * sizeof(*t->attrs));
+      if (!p) oom(t);
+      t->attrs = p;
+      t->size = new_size;
+    }
+
+    i = t->count++;
+    t->objs[i] = r;
+    ((upb_refcounted*)r)->freeze_idx = i;
+  }
+
+  t->attrs[i] = attr;
 }
 
 static color_t color(tarjan *t, const upb_refcounted *r) {
@@ -544,6 +593,7 @@ static bool freeze(upb_refcounted *const*roots, int n, upb_status *s,
                    int maxdepth) {
   volatile bool ret = false;
   int i;
+  uint32_t j;
   upb_inttable_iter iter;
 
   /* We run in two passes so that we can allocate all memory before performing
@@ -554,10 +604,13 @@ static bool freeze(upb_refcounted *const*roots, int n, upb_status *s,
   t.depth = 0;
   t.maxdepth = maxdepth;
   t.status = s;
-  if (!upb_inttable_init(&t.objattr, UPB_CTYPE_UINT64)) goto err1;
-  if (!upb_inttable_init(&t.stack, UPB_CTYPE_PTR)) goto err2;
-  if (!upb_inttable_init(&t.groups, UPB_CTYPE_PTR)) goto err3;
-  if (setjmp(t.err) != 0) goto err4;
+  t.objs = NULL;
+  t.attrs = NULL;
+  t.count = 0;
+  t.size = 0;
+  if (!upb_inttable_init(&t.stack, UPB_CTYPE_PTR)) goto err1;
+  if (!upb_inttable_init(&t.groups, UPB_CTYPE_PTR)) goto err2;
+  if (setjmp(t.err) != 0) goto err3;
 
 
   for (i = 0; i < n; i++) {
@@ -581,9 +634,8 @@ static bool freeze(upb_refcounted *const*roots, int n, upb_status *s,
    * consist of only frozen objects.  None will be immediately collectible,
    * because WHITE objects are by definition reachable from one of "roots",
    * which the caller must own refs on. */
-  upb_inttable_begin(&iter, &t.objattr);
-  for(; !upb_inttable_done(&iter); upb_inttable_next(&iter)) {
-    upb_refcounted *obj = (upb_refcounted*)upb_inttable_iter_key(&iter);
+  for (j = 0; j < t.count; j++) {
+    upb_refcounted *obj = (upb_refcounted*)t.objs[j];
     /* Since removal from a singly-linked list requires access to the object's
      * predecessor, we consider obj->next instead of obj for moving.  With the
      * while() loop we guarantee that we will visit every node's predecessor.
@@ -633,9 +685,8 @@ static bool freeze(upb_refcounted *const*roots, int n, upb_status *s,
   /* Pass 2: GRAY and WHITE objects "obj" with ref2(to, obj) references must
    * increment count(to) if group(obj) != group(to) (which could now be the
    * case if "to" was just frozen). */
-  upb_inttable_begin(&iter, &t.objattr);
-  for(; !upb_inttable_done(&iter); upb_inttable_next(&iter)) {
-    upb_refcounted *obj = (upb_refcounted*)upb_inttable_iter_key(&iter);
+  for (j = 0; j < t.count; j++) {
+    upb_refcounted *obj = (upb_refcounted*)t.objs[j];
     visit(obj, crossref, &t);
   }
 
@@ -647,9 +698,8 @@ static bool freeze(upb_refcounted *const*roots, int n, upb_status *s,
    * It is important that we do this last, since the GRAY object's free()
    * function could call unref2() on just-frozen objects, which will decrement
    * refs that were added in pass 2. */
-  upb_inttable_begin(&iter, &t.objattr);
-  for(; !upb_inttable_done(&iter); upb_inttable_next(&iter)) {
-    upb_refcounted *obj = (upb_refcounted*)upb_inttable_iter_key(&iter);
+  for (j = 0; j < t.count; j++) {
+    upb_refcounted *obj = (upb_refcounted*)t.objs[j];
     if (obj->group == NULL || *obj->group == 0) {
       if (obj->group) {
         upb_refcounted *o;
@@ -673,18 +723,18 @@ static bool freeze(upb_refcounted *const*roots, int n, upb_status *s,
     }
   }
 
-err4:
+err3:
   if (!ret) {
     upb_inttable_begin(&iter, &t.groups);
     for(; !upb_inttable_done(&iter); upb_inttable_next(&iter))
       upb_gfree(upb_value_getptr(upb_inttable_iter_value(&iter)));
   }
   upb_inttable_uninit(&t.groups);
-err3:
-  upb_inttable_uninit(&t.stack);
 err2:
-  upb_inttable_uninit(&t.objattr);
+  upb_inttable_uninit(&t.stack);
 err1:
+  upb_gfree(t.objs);
+  upb_gfree(t.attrs);
   return ret;
 }
 
@@ -698,18 +748,32 @@ static bool merged(const upb_refcounted *r, const upb_refcounted *r2) {
 static void merge(upb_refcounted *r, upb_refcounted *from) {
   upb_refcounted *base;
   upb_refcounted *tmp;
+  upb_refcounted *a;
+  upb_refcounted *b;
 
   if (merged(r, from)) return;
+
+  /* We relabel all objects in the smaller of the two groups, which bounds the
+   * total cost of building a group one object at a time at O(n lg n) instead
+   * of O(n^2).  Walking both chains in lockstep finds the smaller one in time
+   * proportional to its size. */
+  a = r->next;
+  b = from->next;
+  while (a != r && b != from) {
+    a = a->next;
+    b = b->next;
+  }
+  if (a == r) {
+    tmp = r;
+    r = from;
+    from = tmp;
+  }
+
   *r->group += *from->group;
   upb_gfree(from->group);
   base = from;
 
-  /* Set all refcount pointers in the "from" chain to the merged refcount.
-   *
-   * TODO(haberman): this linear algorithm can result in an overall O(n^2) bound
-   * if the user continuously extends a group by one object.  Prevent this by
-   * using one of the techniques in this paper:
-   *     http://bioinfo.ict.ac.cn/~dbu/AlgorithmCourses/Lectures/Union-Find-Tarjan.pdf */
+  /* Set all refcount pointers in the "from" chain to the merged refcount. */
   do { from->group = r->group; } while ((from = from->next) != base);
 
   /* Merge the two circularly linked lists by swapping their next pointers. */
@@ -731,24 +795,29 @@ static void release_ref2(const upb_refcounted *obj,
   }
 }
 
+/* Frees every object in r's group, once the group's count has hit zero. */
+static void freegroup(const upb_refcounted *r) {
+  const upb_refcounted *o;
+
+  upb_gfree(r->group);
+
+  /* In two passes, since release_ref2 needs a guarantee that any subobjs
+   * are alive. */
+  o = r;
+  do { visit(o, release_ref2, NULL); } while((o = o->next) != r);
+
+  o = r;
+  do {
+    const upb_refcounted *next = o->next;
+    UPB_ASSERT(o->is_frozen || o->individual_count == 0);
+    freeobj((upb_refcounted*)o);
+    o = next;
+  } while(o != r);
+}
+
 static void unref(const upb_refcounted *r) {
   if (unrefgroup(r->group)) {
-    const upb_refcounted *o;
-
-    upb_gfree(r->group);
-
-    /* In two passes, since release_ref2 needs a guarantee that any subobjs
-     * are alive. */
-    o = r;
-    do { visit(o, release_ref2, NULL); } while((o = o->next) != r);
-
-    o = r;
-    do {
-      const upb_refcounted *next = o->next;
-      UPB_ASSERT(o->is_frozen || o->individual_count == 0);
-      freeobj((upb_refcounted*)o);
-      o = next;
-    } while(o != r);
+    freegroup(r);
   }
 }
 
@@ -779,6 +848,7 @@ bool upb_refcounted_init(upb_refcounted *r,
   r->vtbl = vtbl;
   r->individual_count = 0;
   r->is_frozen = false;
+  r->freeze_idx = 0;
   r->group = upb_gmalloc(sizeof(*r->group));
   if (!r->group) return false;
   *r->group = 0;
@@ -791,6 +861,28 @@ bool upb_refcounted_isfrozen(const upb_refcounted *r) {
   return r->is_frozen;
 }
 
+bool upb_refcounted_isimmortal(const upb_refcounted *r) {
+  return r->group == &static_refcount;
+}
+
+bool upb_refcounted_makeimmortal(const upb_refcounted *r) {
+  uint32_t *group = r->group;
+  const upb_refcounted *o;
+
+  if (!r->is_frozen) return false;
+  if (group == &static_refcount) return true;
+
+  /* Point the whole group at the shared static count; from here on refgroup()
+   * and unrefgroup() never touch a counter for any of these objects. */
+  o = r;
+  do {
+    ((upb_refcounted*)o)->group = &static_refcount;
+  } while ((o = o->next) != r);
+
+  upb_gfree(group);
+  return true;
+}
+
 void upb_refcounted_ref(const upb_refcounted *r, const void *owner) {
   track(r, owner, false);
   if (!r->is_frozen)
@@ -805,6 +897,52 @@ void upb_refcounted_unref(const upb_refcounted *r, const void *owner) {
   unref(r);
 }
 
+void upb_refbatch_init(upb_refbatch *b) {
+  b->count = 0;
+}
+
+void upb_refbatch_unref(upb_refbatch *b, const upb_refcounted *r,
+                        const void *owner) {
+  if (!r->is_frozen) {
+    /* Mutable groups may be merged or split by a later freeze, so their
+     * counts can't be deferred. */
+    upb_refcounted_unref(r, owner);
+    return;
+  }
+
+  untrack(r, owner, false);
+  if (b->count == UPB_REFBATCH_SIZE) {
+    upb_refbatch_flush(b);
+  }
+  b->objs[b->count++] = r;
+}
+
+void upb_refbatch_flush(upb_refbatch *b) {
+  size_t i, j;
+
+  /* Coalesce refs on the same group so that each distinct group is touched
+   * by a single atomic op.  The batch is small, so quadratic is fine. */
+  for (i = 0; i < b->count; i++) {
+    const upb_refcounted *r = b->objs[i];
+    uint32_t n = 1;
+
+    if (!r) continue;
+
+    for (j = i + 1; j < b->count; j++) {
+      if (b->objs[j] && b->objs[j]->group == r->group) {
+        b->objs[j] = NULL;
+        n++;
+      }
+    }
+
+    if (unrefgroupn(r->group, n)) {
+      freegroup(r);
+    }
+  }
+
+  b->count = 0;
+}
+
 void upb_refcounted_ref2(const upb_refcounted *r, upb_refcounted *from) {
   UPB_ASSERT(!from->is_frozen);  /* Non-const pointer implies this. */
   track(r, from, true);
@@ -67,6 +67,11 @@ class upb::RefCounted {
    * owner.  Only effective in UPB_DEBUG_REFS builds. */
   void CheckRef(const void *owner) const;
 
+  /* Immortal objects are never freed and ref/unref on them is free.  See
+   * upb_refcounted_makeimmortal() below. */
+  bool IsImmortal() const;
+  bool MakeImmortal() const;
+
  private:
   UPB_DISALLOW_POD_OPS(RefCounted, upb::RefCounted)
 #else
@@ -95,19 +100,26 @@ struct upb_refcounted {
 
   bool is_frozen;
 
+  /* Scratch space for upb_refcounted_freeze(): this object's index into the
+   * freeze's dense attribute arrays.  Only meaningful during a freeze. */
+  uint32_t freeze_idx;
+
 #ifdef UPB_DEBUG_REFS
   upb_inttable *refs;  /* Maps owner -> trackedref for incoming refs. */
   upb_inttable *ref2s; /* Set of targets for outgoing ref2s. */
 #endif
 };
 
+/* Statically-initialized objects (like the defs emitted by upbc) are immortal:
+ * they share the static refcount and ref/unref on them never touch a
+ * counter. */
 #ifdef UPB_DEBUG_REFS
 extern upb_alloc upb_alloc_debugrefs;
 #define UPB_REFCOUNT_INIT(vtbl, refs, ref2s) \
-    {&static_refcount, NULL, vtbl, 0, true, refs, ref2s}
+    {&static_refcount, NULL, vtbl, 0, true, 0, refs, ref2s}
 #else
 #define UPB_REFCOUNT_INIT(vtbl, refs, ref2s) \
-    {&static_refcount, NULL, vtbl, 0, true}
+    {&static_refcount, NULL, vtbl, 0, true, 0}
 #endif
 
 UPB_BEGIN_EXTERN_C
@@ -126,6 +138,19 @@ void upb_refcounted_donateref(
     const upb_refcounted *r, const void *from, const void *to);
 void upb_refcounted_checkref(const upb_refcounted *r, const void *owner);
 
+/* Immortal objects are never freed, and refs/unrefs on them are no-ops that
+ * touch no shared state, so they can be shared among threads without any
+ * contention.  All statically-initialized objects are immortal.
+ *
+ * upb_refcounted_makeimmortal() makes the whole (frozen) group of "r" immortal,
+ * for objects that are built at runtime but live for the rest of the process,
+ * like a schema loaded at startup or the handlers built for it.  Any refs the
+ * group holds on other groups are never released.  Returns false if "r" is
+ * not frozen.  This is not threadsafe with respect to refs/unrefs of objects
+ * in the group, so it should be called before the objects are shared. */
+bool upb_refcounted_isimmortal(const upb_refcounted *r);
+bool upb_refcounted_makeimmortal(const upb_refcounted *r);
+
 #define UPB_REFCOUNTED_CMETHODS(type, upcastfunc) \
   UPB_INLINE bool type ## _isfrozen(const type *v) { \
     return upb_refcounted_isfrozen(upcastfunc(v)); \
@@ -160,6 +185,30 @@ void upb_refcounted_checkref(const upb_refcounted *r, const void *owner);
     return upb::upcast_to<const upb::RefCounted>(this)->CheckRef(owner); \
   }
 
+/* Deferred unref batching ***************************************************/
+
+/* A upb_refbatch collects unrefs on frozen objects and releases them later,
+ * with one atomic decrement per distinct group instead of one per unref.  This
+ * cuts the traffic on hot group counts (like those of widely shared defs and
+ * handlers) when a thread drops many refs at once.
+ *
+ * A batch is not threadsafe; each thread should use its own.  Objects stay
+ * alive until the batch is flushed, so code must not depend on their being
+ * freed at the precise moment of the unref.  Unrefs of mutable objects are
+ * not deferred.  The batch must be flushed before it is discarded. */
+
+#define UPB_REFBATCH_SIZE 32
+
+typedef struct {
+  const upb_refcounted *objs[UPB_REFBATCH_SIZE];
+  size_t count;
+} upb_refbatch;
+
+void upb_refbatch_init(upb_refbatch *b);
+void upb_refbatch_unref(upb_refbatch *b, const upb_refcounted *r,
+                        const void *owner);
+void upb_refbatch_flush(upb_refbatch *b);
+
 /* Internal-to-upb Interface **************************************************/
 
 typedef void upb_refcounted_visit(const upb_refcounted *r,
@@ -210,6 +259,11 @@ void upb_refcounted_unref2(const upb_refcounted *r, upb_refcounted *from);
  * operations on frozen refcounteds are threadsafe, and objects will be freed
  * at the precise moment that they become unreachable.
  *
+ * Objects that are already frozen are never visited, so freezing a few new
+ * objects that point into a large frozen graph (like a new file whose
+ * dependencies were frozen earlier) costs time proportional to the new
+ * objects only.
+ *
  * Caller must own refs on each object in the "roots" list. */
 bool upb_refcounted_freeze(upb_refcounted *const*roots, int n, upb_status *s,
                            int maxdepth);
@@ -237,6 +291,12 @@ inline void RefCounted::DonateRef(const void *from, const void *to) const {
 inline void RefCounted::CheckRef(const void *owner) const {
   upb_refcounted_checkref(this, owner);
 }
+inline bool RefCounted::IsImmortal() const {
+  return upb_refcounted_isimmortal(this);
+}
+inline bool RefCounted::MakeImmortal() const {
+  return upb_refcounted_makeimmortal(this);
+}
 }  /* namespace upb */
 #endif
 
@@ -34,35 +34,59 @@ static void *upb_bufsink_start(void *_sink, const void *hd, size_t size_hint) {
   return sink;
 }
 
-static size_t upb_bufsink_string(void *_sink, const void *hd, const char *ptr,
-                                size_t len, const upb_bufhandle *handle) {
-  upb_bufsink *sink = _sink;
+/* Makes room for at least |len| more bytes. */
+static bool upb_bufsink_reserve(upb_bufsink *sink, size_t len) {
   size_t new_size = sink->size;
 
   UPB_ASSERT(new_size > 0);
-  UPB_UNUSED(hd);
-  UPB_UNUSED(handle);
 
   while (sink->len + len > new_size) {
     new_size *= 2;
   }
 
   if (new_size != sink->size) {
-    sink->ptr = upb_env_realloc(sink->env, sink->ptr, sink->size, new_size);
+    char *new_ptr = upb_env_realloc(sink->env, sink->ptr, sink->size, new_size);
+    if (!new_ptr) return false;
+    sink->ptr = new_ptr;
     sink->size = new_size;
   }
 
-  memcpy(sink->ptr + sink->len, ptr, len);
+  return true;
+}
+
+static size_t upb_bufsink_string(void *_sink, const void *hd, const char *ptr,
+                                size_t len, const upb_bufhandle *handle) {
+  upb_bufsink *sink = _sink;
+
+  UPB_UNUSED(hd);
+  UPB_UNUSED(handle);
+
+  /* Bytes written into a region from upb_bufsink_getbuf() are already in
+   * place. */
+  if (ptr != sink->ptr + sink->len) {
+    if (!upb_bufsink_reserve(sink, len)) return 0;
+    memcpy(sink->ptr + sink->len, ptr, len);
+  }
   sink->len += len;
 
   return len;
 }
 
+static char *upb_bufsink_getbuf(void *_sink, const void *hd, size_t min,
+                                size_t *size) {
+  upb_bufsink *sink = _sink;
+  UPB_UNUSED(hd);
+  if (!upb_bufsink_reserve(sink, min)) return NULL;
+  *size = sink->size - sink->len;
+  return sink->ptr + sink->len;
+}
+
 upb_bufsink *upb_bufsink_new(upb_env *env) {
   upb_bufsink *sink = upb_env_malloc(env, sizeof(upb_bufsink));
   upb_byteshandler_init(&sink->handler);
   upb_byteshandler_setstartstr(&sink->handler, upb_bufsink_start, NULL);
   upb_byteshandler_setstring(&sink->handler, upb_bufsink_string, NULL);
+  upb_byteshandler_setgetbuf(&sink->handler, upb_bufsink_getbuf, NULL);
 
   upb_bytessink_reset(&sink->sink, &sink->handler, sink);
 
@@ -87,3 +111,276 @@ const char *upb_bufsink_getdata(const upb_bufsink *sink, size_t *len) {
   *len = sink->len;
   return sink->ptr;
 }
+
+
+/* upb_tee ********************************************************************/
+
+struct upb_tee {
+  upb_sink input;
+  int n;  /* Number of outputs, ie. sinks per frame. */
+
+  /* A stack of frames, each with one sink per output.  The bottom frame holds
+   * the outputs themselves. */
+  upb_sink *stack, *top, *limit;
+};
+
+/* Every handler has its selector as handler data, so it can forward the event
+ * to the same selector on the outputs. */
+static upb_selector_t tee_sel(const void *hd) {
+  return *(const upb_selector_t*)hd;
+}
+
+static bool tee_startmsg(void *c, const void *hd) {
+  upb_tee *t = c;
+  int i;
+  UPB_UNUSED(hd);
+  for (i = 0; i < t->n; i++) {
+    if (!upb_sink_startmsg(&t->top[i])) return false;
+  }
+  return true;
+}
+
+static bool tee_endmsg(void *c, const void *hd, upb_status *status) {
+  upb_tee *t = c;
+  int i;
+  UPB_UNUSED(hd);
+  for (i = 0; i < t->n; i++) {
+    if (!upb_sink_endmsg(&t->top[i], status)) return false;
+  }
+  return true;
+}
+
+static bool tee_unknown(void *c, const void *hd, const char *buf, size_t len) {
+  upb_tee *t = c;
+  int i;
+  UPB_UNUSED(hd);
+  for (i = 0; i < t->n; i++) {
+    if (!upb_sink_putunknown(&t->top[i], buf, len)) return false;
+  }
+  return true;
+}
+
+#define PUTVAL(type, ctype)                                           \
+  static bool tee_put##type(void *c, const void *hd, ctype val) {     \
+    upb_tee *t = c;                                                   \
+    int i;                                                            \
+    for (i = 0; i < t->n; i++) {                                      \
+      if (!upb_sink_put##type(&t->top[i], tee_sel(hd), val)) {        \
+        return false;                                                 \
+      }                                                               \
+    }                                                                 \
+    return true;                                                      \
+  }
+
+PUTVAL(int32,  int32_t)
+PUTVAL(int64,  int64_t)
+PUTVAL(uint32, uint32_t)
+PUTVAL(uint64, uint64_t)
+PUTVAL(float,  float)
+PUTVAL(double, double)
+PUTVAL(bool,   bool)
+#undef PUTVAL
+
+static size_t tee_string(void *c, const void *hd, const char *buf, size_t len,
+                         const upb_bufhandle *handle) {
+  upb_tee *t = c;
+  size_t ret = len;
+  int i;
+  for (i = 0; i < t->n; i++) {
+    size_t n = upb_sink_putstring(&t->top[i], tee_sel(hd), buf, len, handle);
+    if (n < ret) ret = n;
+  }
+  return ret;
+}
+
+/* Pushes a frame, opening a string, sequence or submessage on every output. */
+static void *tee_push(upb_tee *t, upb_handlertype_t type, const void *hd,
+                      size_t size_hint) {
+  upb_sink *sub = t->top + t->n;
+  int i;
+
+  if (sub == t->limit) return UPB_BREAK;
+
+  for (i = 0; i < t->n; i++) {
+    bool ok;
+    switch (type) {
+      case UPB_HANDLER_STARTSTR:
+        ok = upb_sink_startstr(&t->top[i], tee_sel(hd), size_hint, &sub[i]);
+        break;
+      case UPB_HANDLER_STARTSEQ:
+        ok = upb_sink_startseq(&t->top[i], tee_sel(hd), &sub[i]);
+        break;
+      default:
+        ok = upb_sink_startsubmsg(&t->top[i], tee_sel(hd), &sub[i]);
+        break;
+    }
+    if (!ok) return UPB_BREAK;
+  }
+
+  t->top = sub;
+  return t;
+}
+
+static bool tee_pop(upb_tee *t, upb_handlertype_t type, const void *hd) {
+  int i;
+
+  UPB_ASSERT(t->top > t->stack);
+  t->top -= t->n;
+
+  for (i = 0; i < t->n; i++) {
+    bool ok;
+    switch (type) {
+      case UPB_HANDLER_ENDSTR:
+        ok = upb_sink_endstr(&t->top[i], tee_sel(hd));
+        break;
+      case UPB_HANDLER_ENDSEQ:
+        ok = upb_sink_endseq(&t->top[i], tee_sel(hd));
+        break;
+      default:
+        ok = upb_sink_endsubmsg(&t->top[i], tee_sel(hd));
+        break;
+    }
+    if (!ok) return false;
+  }
+
+  return true;
+}
+
+static void *tee_startstr(void *c, const void *hd, size_t size_hint) {
+  return tee_push(c, UPB_HANDLER_STARTSTR, hd, size_hint);
+}
+
+static bool tee_endstr(void *c, const void *hd) {
+  return tee_pop(c, UPB_HANDLER_ENDSTR, hd);
+}
+
+static void *tee_startseq(void *c, const void *hd) {
+  return tee_push(c, UPB_HANDLER_STARTSEQ, hd, 0);
+}
+
+static bool tee_endseq(void *c, const void *hd) {
+  return tee_pop(c, UPB_HANDLER_ENDSEQ, hd);
+}
+
+static void *tee_startsubmsg(void *c, const void *hd) {
+  return tee_push(c, UPB_HANDLER_STARTSUBMSG, hd, 0);
+}
+
+static bool tee_endsubmsg(void *c, const void *hd) {
+  return tee_pop(c, UPB_HANDLER_ENDSUBMSG, hd);
+}
+
+/* Sets attr's handler data to the selector for this field and type. */
+static void tee_attr(upb_handlers *h, const upb_fielddef *f,
+                     upb_handlertype_t type, upb_handlerattr *attr) {
+  upb_selector_t *sel = upb_gmalloc(sizeof(*sel));
+  bool ok = upb_handlers_getselector(f, type, sel);
+  UPB_ASSERT(ok);
+
+  upb_handlerattr_init(attr);
+  upb_handlerattr_sethandlerdata(attr, sel);
+  upb_handlers_addcleanup(h, sel, upb_gfree);
+}
+
+static void tee_sethandlers(const void *closure, upb_handlers *h) {
+  const upb_msgdef *m = upb_handlers_msgdef(h);
+  upb_msg_field_iter i;
+
+  UPB_UNUSED(closure);
+
+  upb_handlers_setstartmsg(h, tee_startmsg, NULL);
+  upb_handlers_setendmsg(h, tee_endmsg, NULL);
+  upb_handlers_setunknown(h, tee_unknown, NULL);
+
+#define SET(type, name, func)                  \
+  tee_attr(h, f, UPB_HANDLER_##type, &attr);   \
+  upb_handlers_set##name(h, f, func, &attr);   \
+  upb_handlerattr_uninit(&attr);
+
+/* Not written with SET(), which would expand "bool" before pasting it. */
+#define VALUE(upper, lower)                                 \
+  case UPB_TYPE_##upper:                                    \
+    tee_attr(h, f, UPB_HANDLER_##upper, &attr);             \
+    upb_handlers_set##lower(h, f, tee_put##lower, &attr);   \
+    upb_handlerattr_uninit(&attr);                          \
+    break;
+
+  for(upb_msg_field_begin(&i, m);
+      !upb_msg_field_done(&i);
+      upb_msg_field_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    upb_handlerattr attr;
+
+    if (upb_fielddef_isseq(f)) {
+      SET(STARTSEQ, startseq, tee_startseq);
+      SET(ENDSEQ, endseq, tee_endseq);
+    }
+
+    switch (upb_fielddef_type(f)) {
+      VALUE(INT64,  int64)
+      VALUE(UINT32, uint32)
+      VALUE(UINT64, uint64)
+      VALUE(FLOAT,  float)
+      VALUE(DOUBLE, double)
+      VALUE(BOOL,   bool)
+      case UPB_TYPE_INT32:
+      case UPB_TYPE_ENUM:
+        SET(INT32, int32, tee_putint32);
+        break;
+      case UPB_TYPE_STRING:
+      case UPB_TYPE_BYTES:
+        SET(STARTSTR, startstr, tee_startstr);
+        SET(STRING, string, tee_string);
+        SET(ENDSTR, endstr, tee_endstr);
+        break;
+      case UPB_TYPE_MESSAGE:
+        SET(STARTSUBMSG, startsubmsg, tee_startsubmsg);
+        SET(ENDSUBMSG, endsubmsg, tee_endsubmsg);
+        break;
+    }
+  }
+
+#undef VALUE
+#undef SET
+}
+
+upb_tee *upb_tee_create(upb_env *env, const upb_handlers *h,
+                        upb_sink *const *outputs, int n) {
+  upb_tee *t = upb_env_malloc(env, sizeof(upb_tee));
+  int i;
+  if (!t) return NULL;
+
+  UPB_ASSERT(n > 0);
+  t->n = n;
+  t->stack = upb_env_malloc(env, sizeof(*t->stack) * n * UPB_TEE_MAX_NESTING);
+  if (!t->stack) return NULL;
+  t->limit = t->stack + n * UPB_TEE_MAX_NESTING;
+
+  for (i = 0; i < n; i++) {
+    UPB_ASSERT(!outputs[i]->handlers ||
+               upb_handlers_msgdef(outputs[i]->handlers) ==
+                   upb_handlers_msgdef(h));
+    t->stack[i] = *outputs[i];
+  }
+
+  upb_tee_reset(t);
+  upb_sink_reset(&t->input, h, t);
+  return t;
+}
+
+upb_sink *upb_tee_input(upb_tee *t) {
+  return &t->input;
+}
+
+void upb_tee_reset(upb_tee *t) {
+  t->top = t->stack;
+}
+
+const upb_handlers *upb_tee_newhandlers(const upb_msgdef *m,
+                                        const void *owner) {
+  return upb_handlers_newfrozen(m, owner, tee_sethandlers, NULL);
+}
+
+upb_handlercache *upb_tee_newcache() {
+  return upb_handlercache_new(tee_sethandlers, NULL);
+}
@@ -26,6 +26,7 @@ class BufferSink;
 class BufferSource;
 class BytesSink;
 class Sink;
+class Tee;
 }
 #endif
 
@@ -33,6 +34,7 @@ UPB_DECLARE_TYPE(upb::BufferSink, upb_bufsink)
 UPB_DECLARE_TYPE(upb::BufferSource, upb_bufsrc)
 UPB_DECLARE_TYPE(upb::BytesSink, upb_bytessink)
 UPB_DECLARE_TYPE(upb::Sink, upb_sink)
+UPB_DECLARE_TYPE(upb::Tee, upb_tee)
 
 #ifdef __cplusplus
 
@@ -122,6 +124,11 @@ class upb::Sink {
   bool PutDouble(Handlers::Selector s, double val);
   bool PutBool(Handlers::Selector s, bool val);
 
+  /* Puts "n" consecutive values of a repeated primitive field at once, for
+   * its array handler (see Handlers::SetArrayHandler()).  Must also be wrapped
+   * in StartSequence()/EndSequence(). */
+  bool PutArray(Handlers::Selector s, const void *vals, size_t n);
+
   /* Putting of string/bytes values.  Each string can consist of zero or more
    * non-contiguous buffers of data.
    *
@@ -177,6 +184,11 @@ class upb::BytesSink {
   bool Start(size_t size_hint, void **subc);
   size_t PutBuffer(void *subc, const char *buf, size_t len,
                    const BufferHandle *handle);
+
+  /* Borrows a region of at least |min| bytes of the sink's own memory to
+   * write into, or returns NULL if the sink does not support this.  The bytes
+   * written are committed by passing them to PutBuffer(). */
+  char *GetBuffer(void *subc, size_t min, size_t *size);
   bool End();
 #else
 struct upb_bytessink {
@@ -223,6 +235,27 @@ void upb_bufsink_free(upb_bufsink *sink);
 upb_bytessink *upb_bufsink_sink(upb_bufsink *sink);
 const char *upb_bufsink_getdata(const upb_bufsink *sink, size_t *len);
 
+/* A tee forwards every event it receives to several sinks, so that one parse
+ * can feed several consumers.  The outputs' handlers must all be for the same
+ * msgdef as the tee's handlers; other than that they are independent.
+ *
+ * String buffers are passed to every output, which must each accept the whole
+ * buffer (the tee cannot resume an output that consumed only part of it).
+ * Parsers don't reset the tee, so call upb_tee_reset() before reusing it
+ * after a parse that failed midway. */
+
+#define UPB_TEE_MAX_NESTING 64
+
+upb_tee *upb_tee_create(upb_env *env, const upb_handlers *h,
+                        upb_sink *const *outputs, int n);
+upb_sink *upb_tee_input(upb_tee *t);
+void upb_tee_reset(upb_tee *t);
+
+/* The tee's handlers only depend on the msgdef, not on the outputs. */
+const upb_handlers *upb_tee_newhandlers(const upb_msgdef *m,
+                                        const void *owner);
+upb_handlercache *upb_tee_newcache();
+
 /* Inline definitions. */
 
 UPB_INLINE void upb_bytessink_reset(upb_bytessink *s, const upb_byteshandler *h,
@@ -240,8 +273,8 @@ UPB_INLINE bool upb_bytessink_start(upb_bytessink *s, size_t size_hint,
   start = (func *)s->handler->table[UPB_STARTSTR_SELECTOR].func;
 
   if (!start) return true;
-  *subc = start(s->closure, upb_handlerattr_handlerdata(
-                                &s->handler->table[UPB_STARTSTR_SELECTOR].attr),
+  *subc = start(s->closure,
+                s->handler->table[UPB_STARTSTR_SELECTOR].handler_data,
                 size_hint);
   return *subc != NULL;
 }
@@ -255,11 +288,22 @@ UPB_INLINE size_t upb_bytessink_putbuf(upb_bytessink *s, void *subc,
   putbuf = (func *)s->handler->table[UPB_STRING_SELECTOR].func;
 
   if (!putbuf) return true;
-  return putbuf(subc, upb_handlerattr_handlerdata(
-                          &s->handler->table[UPB_STRING_SELECTOR].attr),
+  return putbuf(subc, s->handler->table[UPB_STRING_SELECTOR].handler_data,
                 buf, size, handle);
 }
 
+UPB_INLINE char *upb_bytessink_getbuf(upb_bytessink *s, void *subc,
+                                      size_t min, size_t *size) {
+  typedef upb_getbuf_handlerfunc func;
+  func *getbuf;
+  if (!s->handler) return NULL;
+  getbuf = (func *)s->handler->table[UPB_GETBUF_SELECTOR].func;
+
+  if (!getbuf) return NULL;
+  return getbuf(subc, s->handler->table[UPB_GETBUF_SELECTOR].handler_data,
+                min, size);
+}
+
 UPB_INLINE bool upb_bytessink_end(upb_bytessink *s) {
   typedef upb_endfield_handlerfunc func;
   func *end;
@@ -267,9 +311,7 @@ UPB_INLINE bool upb_bytessink_end(upb_bytessink *s) {
   end = (func *)s->handler->table[UPB_ENDSTR_SELECTOR].func;
 
   if (!end) return true;
-  return end(s->closure,
-             upb_handlerattr_handlerdata(
-                 &s->handler->table[UPB_ENDSTR_SELECTOR].attr));
+  return end(s->closure, s->handler->table[UPB_ENDSTR_SELECTOR].handler_data);
 }
 
 bool upb_bufsrc_putbuf(const char *buf, size_t len, upb_bytessink *sink);
@@ -296,6 +338,19 @@ PUTVAL(double, double)
 PUTVAL(bool,   bool)
 #undef PUTVAL
 
+UPB_INLINE bool upb_sink_putarray(upb_sink *s, upb_selector_t sel,
+                                  const void *vals, size_t n) {
+  typedef upb_array_handlerfunc func;
+  func *handler;
+  const void *hd;
+  if (!s->handlers) return true;
+  handler = (func *)upb_handlers_gethandler(s->handlers, sel);
+
+  if (!handler) return true;
+  hd = upb_handlers_gethandlerdata(s->handlers, sel);
+  return handler(s->closure, hd, vals, n);
+}
+
 UPB_INLINE void upb_sink_reset(upb_sink *s, const upb_handlers *h, void *c) {
   s->handlers = h;
   s->closure = c;
@@ -478,6 +533,10 @@ inline bool Sink::PutDouble(Handlers::Selector sel, double val) {
 inline bool Sink::PutBool(Handlers::Selector sel, bool val) {
   return upb_sink_putbool(this, sel, val);
 }
+inline bool Sink::PutArray(Handlers::Selector sel, const void *vals,
+                           size_t n) {
+  return upb_sink_putarray(this, sel, vals, n);
+}
 inline bool Sink::StartString(Handlers::Selector sel, size_t size_hint,
                               Sink *sub) {
   return upb_sink_startstr(this, sel, size_hint, sub);
@@ -518,6 +577,9 @@ inline size_t BytesSink::PutBuffer(void *subc, const char *buf, size_t len,
                                    const BufferHandle *handle) {
   return upb_bytessink_putbuf(this, subc, buf, len, handle);
 }
+inline char *BytesSink::GetBuffer(void *subc, size_t min, size_t *size) {
+  return upb_bytessink_getbuf(this, subc, min, size);
+}
 inline bool BytesSink::End() {
   return upb_bytessink_end(this);
 }
@@ -67,21 +67,25 @@ struct upb_fielddef {
     const upb_def *def;  /* If !subdef_is_symbolic. */
     char *name;          /* If subdef_is_symbolic. */
   } sub;  /* The msgdef or enumdef for this field, if upb_hassubdef(f). */
-  bool subdef_is_symbolic;
-  bool msg_is_symbolic;
   const upb_oneofdef *oneof;
-  bool default_is_string;
-  bool type_is_set_;     /* False until type is explicitly set. */
-  bool is_extension_;
-  bool lazy_;
-  bool packed_;
-  upb_intfmt_t intfmt;
-  bool tagdelim;
-  upb_fieldtype_t type_;
-  upb_label_t label_;
   uint32_t number_;
   uint32_t selector_base;  /* Used to index into a upb::Handlers table. */
   uint32_t index_;
+
+  /* Large schemas have a great many fields, so the flags and small enums
+   * are packed into a single word.  Each enum's field is wide enough for all
+   * of its values. */
+  unsigned int type_ : 4;    /* upb_fieldtype_t */
+  unsigned int label_ : 2;   /* upb_label_t */
+  unsigned int intfmt : 2;   /* upb_intfmt_t */
+  unsigned int subdef_is_symbolic : 1;
+  unsigned int msg_is_symbolic : 1;
+  unsigned int default_is_string : 1;
+  unsigned int type_is_set_ : 1;  /* False until type is explicitly set. */
+  unsigned int is_extension_ : 1;
+  unsigned int lazy_ : 1;
+  unsigned int packed_ : 1;
+  unsigned int tagdelim : 1;
 };
 
 extern const struct upb_refcounted_vtbl upb_fielddef_vtbl;
@@ -91,9 +95,10 @@ extern const struct upb_refcounted_vtbl upb_fielddef_vtbl;
                           index, defaultval, refs, ref2s)                      \
   {                                                                            \
     UPB_DEF_INIT(name, UPB_DEF_FIELD, &upb_fielddef_vtbl, refs, ref2s),        \
-        defaultval, {msgdef}, {subdef}, NULL, false, false,                    \
+        defaultval, {msgdef}, {subdef}, NULL, num, selector_base, index, type, \
+        label, intfmt, false, false,                                           \
         type == UPB_TYPE_STRING || type == UPB_TYPE_BYTES, true, is_extension, \
-        lazy, packed, intfmt, tagdelim, type, label, num, selector_base, index \
+        lazy, packed, tagdelim                                                 \
   }
 
 
@@ -102,7 +107,7 @@ extern const struct upb_refcounted_vtbl upb_fielddef_vtbl;
 struct upb_msgdef {
   upb_def base;
 
-  size_t selector_count;
+  uint32_t selector_count;
   uint32_t submsg_field_count;
 
   /* Tables for looking up fields by number and name. */
@@ -110,10 +115,13 @@ struct upb_msgdef {
   upb_strtable ntof;  /* name to field/oneof */
 
   /* Is this a map-entry message? */
-  bool map_entry;
+  unsigned int map_entry : 1;
 
-  /* Whether this message has proto2 or proto3 semantics. */
-  upb_syntax_t syntax;
+  /* Whether this message has proto2 or proto3 semantics (a upb_syntax_t). */
+  unsigned int syntax : 2;
+
+  /* Does this message declare any extension ranges? */
+  unsigned int extendable : 1;
 
   /* TODO(haberman): proper extension ranges (there can be multiple). */
 };
@@ -126,7 +134,8 @@ extern const struct upb_refcounted_vtbl upb_msgdef_vtbl;
                         map_entry, syntax, refs, ref2s)                       \
   {                                                                           \
     UPB_DEF_INIT(name, UPB_DEF_MSG, &upb_fielddef_vtbl, refs, ref2s),         \
-        selector_count, submsg_field_count, itof, ntof, map_entry, syntax     \
+        selector_count, submsg_field_count, itof, ntof, map_entry, syntax,    \
+        false                                                                 \
   }
 
 
@@ -171,6 +180,11 @@ struct upb_symtab {
   upb_refcounted base;
 
   upb_strtable symtab;
+
+  /* Called on lookup misses; see upb_symtab_setloader(). */
+  upb_symtab_loadfunc *load;
+  upb_symtab_freeloaderfunc *freeloader;
+  void *loader_closure;
 };
 
 struct upb_filedef {
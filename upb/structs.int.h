@@ -11,8 +11,168 @@ struct upb_array {
   void *data;   /* Each element is element_size. */
   size_t len;   /* Measured in elements. */
   size_t size;  /* Measured in elements. */
+  /* For arrays of messages: the elements up to here are cleared messages that
+   * upb_msg_clear() left for the decoder to reuse once len gets to them. */
+  size_t pooled;
   upb_alloc *alloc;
+  /* Most repeated fields have only one or two elements, so these are stored
+   * here until they outgrow it, which saves a separate allocation.
+   * Big enough for at least one element of any type. */
+  union {
+    upb_stringview str;
+    uint64_t u64;
+    double dbl;
+    void *ptr;
+  } inline_data;
 };
 
+struct upb_map {
+  upb_fieldtype_t key_type;
+  upb_fieldtype_t val_type;
+  /* Bool and integer keys are stored directly in an inttable, unless they
+   * don't fit in a uintptr_t (64-bit keys on a 32-bit platform).  Other keys
+   * are stored in a strtable, keyed by their bytes. */
+  bool intkeys;
+  union {
+    upb_strtable strtab;
+    upb_inttable inttab;
+  } t;
+  upb_alloc *alloc;
+};
+
+struct upb_mapiter {
+  union {
+    upb_strtable_iter str;
+    upb_inttable_iter i;
+  } iter;
+  upb_fieldtype_t key_type;
+  upb_fieldtype_t val_type;
+  bool intkeys;
+};
+
+UPB_INLINE int upb_ctz64(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_ctzll(x);
+#else
+  int n = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+UPB_INLINE int upb_clz64(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_clzll(x);
+#else
+  int n = 0;
+  while (!(x >> 63)) {
+    x <<= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+#define UPB_PRESENCE_MAXWORDS ((UPB_PRESENCE_MAXFIELDS + 63) / 64)
+
+/* Fills |fields| with a bitmap of the field indexes of |m| that may be present
+ * in |msg|, using the layout's presence map (see upb_msglayout_msginit_v1):
+ * the fields whose hasbit is set, plus the ones that have to be checked one by
+ * one.  |fields| needs room for UPB_PRESENCE_MAXWORDS words.  Returns false,
+ * without touching |fields|, if the layout has no presence map. */
+UPB_INLINE bool upb_msg_presence(const char *msg,
+                                 const upb_msglayout_msginit_v1 *m,
+                                 uint64_t *fields) {
+  uint32_t i;
+
+  if (!m->check_fields) {
+    return false;
+  }
+
+  memcpy(fields, m->check_fields, (m->field_count + 63) / 64 * 8);
+
+  for (i = 0; i < m->hasbit_bytes; i += 8) {
+    uint64_t word = 0;
+    uint32_t j;
+
+    for (j = 0; j < 8 && i + j < m->hasbit_bytes; j++) {
+      word |= (uint64_t)(uint8_t)msg[i + j] << (8 * j);
+    }
+
+    while (word) {
+      uint16_t f = m->hasbit_fields[i * 8 + upb_ctz64(word)];
+      if (f != UPB_NO_FIELD) {
+        fields[f / 64] |= (uint64_t)1 << (f % 64);
+      }
+      word &= word - 1;
+    }
+  }
+
+  return true;
+}
+
+/* A singular submessage field that upb_decode() left serialized (see
+ * upb_decodeopts.lazy) holds a pointer to its bytes with the low bit set, in
+ * place of the upb_msg*.  upb_msg_get() parses it on first access, and the
+ * encoder writes the bytes back out unchanged. */
+UPB_INLINE bool upb_lazymsg_is(const void *submsg) {
+  return (uintptr_t)submsg & 1;
+}
+
+UPB_INLINE const upb_stringview *upb_lazymsg_data(const void *submsg) {
+  UPB_ASSERT(upb_lazymsg_is(submsg));
+  return (const upb_stringview*)((uintptr_t)submsg - 1);
+}
+
+UPB_INLINE void *upb_lazymsg_make(upb_stringview *data) {
+  UPB_ASSERT(((uintptr_t)data & 1) == 0);
+  return (void*)((uintptr_t)data | 1);
+}
+
+/* Parses a lazy submessage into a new message allocated from |a|, which
+ * should be the owning message's arena.  Returns NULL if the data doesn't
+ * parse.  If |parent| isn't NULL, the parse keeps its bytes as for
+ * upb_decodeopts.cache, as a submessage of |parent|.  Defined in decode.c. */
+upb_msg *upb_lazymsg_parse(const upb_stringview *data,
+                           const upb_msglayout_msginit_v1 *l, upb_alloc *a,
+                           upb_msg *parent);
+
+/* What upb_decodeopts.cache keeps for each message it decodes: the bytes it
+ * was decoded from, until upb_msg_markdirty() sets their data to NULL, and the
+ * message it is a submessage of, which becomes dirty with it.  A message that
+ * was not decoded that way has none, and is always encoded from its fields. */
+typedef struct {
+  upb_stringview bytes;
+  upb_msg *parent;
+} upb_msgcache;
+
+/* Gives |msg| a cache of |size| bytes at |data|, which may be NULL for a
+ * message whose bytes weren't kept but whose parent is.  Defined in msg.c. */
+bool upb_msg_setcache(upb_msg *msg, upb_msg *parent, const char *data,
+                      size_t size, upb_alloc *a);
+
+/* Returns the cached bytes of |msg|, or NULL if it has none or is dirty. */
+const upb_stringview *upb_msg_getcache(const upb_msg *msg);
+
+/* A registered extension.  Its value is stored in a message of its own, laid
+ * out by |layout| with the extension as its only field, so the decoder parses
+ * it like any other field and upb_msg_get() reads it back. */
+struct upb_msgext {
+  upb_msglayout_extinit_v1 init;
+  upb_msglayout_fieldinit_v1 field;
+  const upb_msglayout_msginit_v1 *submsgs[1];
+  upb_msglayout_msginit_v1 layout;
+};
+
+/* Returns the message that holds the value of |ext| in |msg|, whose layout
+ * |l| must be extendable, creating it from the message's allocator the first
+ * time.  Returns NULL if out of memory.  Defined in msg.c. */
+upb_msg *upb_msg_getorcreateext(upb_msg *msg,
+                                const upb_msglayout_msginit_v1 *l,
+                                const upb_msgext *ext);
+
 #endif  /* UPB_STRUCTS_H_ */
 
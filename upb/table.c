@@ -6,10 +6,20 @@
 
 #include "upb/table.int.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #define UPB_MAXARRSIZE 16  /* 64k. */
 
+/* Number of keys the batched lookups hash and prefetch at a time. */
+#define UPB_LOOKUPBATCH 16
+
+#if defined(__GNUC__) || defined(__clang__)
+#define UPB_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define UPB_PREFETCH(addr)
+#endif
+
 /* From Chromium. */
 #define ARRAY_SIZE(x) \
     ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
@@ -348,10 +358,47 @@ bool upb_strtable_insert3(upb_strtable *t, const char *k, size_t len,
 
 bool upb_strtable_lookup2(const upb_strtable *t, const char *key, size_t len,
                           upb_value *v) {
-  uint32_t hash = MurmurHash2(key, len, 0);
+  uint32_t hash;
+
+  /* Many static tables (like a msgdef's oneof names) are empty. */
+  if (t->t.size_lg2 == 0) return false;
+
+  hash = MurmurHash2(key, len, 0);
   return lookup(&t->t, strkey2(key, len), v, hash, &streql);
 }
 
+size_t upb_strtable_lookupbatch(const upb_strtable *t,
+                                const char *const *keys, const size_t *lens,
+                                size_t n, upb_value *vals, bool *found) {
+  uint32_t hashes[UPB_LOOKUPBATCH];
+  size_t ret = 0;
+  size_t i;
+
+  if (t->t.size_lg2 == 0) {
+    memset(found, 0, n * sizeof(*found));
+    return 0;
+  }
+
+  for (i = 0; i < n; i += UPB_LOOKUPBATCH) {
+    size_t batch = UPB_MIN(n - i, UPB_LOOKUPBATCH);
+    size_t j;
+
+    for (j = 0; j < batch; j++) {
+      hashes[j] = MurmurHash2(keys[i + j], lens[i + j], 0);
+      UPB_PREFETCH(upb_getentry(&t->t, hashes[j]));
+    }
+
+    for (j = 0; j < batch; j++) {
+      size_t k = i + j;
+      found[k] = lookup(&t->t, strkey2(keys[k], lens[k]),
+                        vals ? &vals[k] : NULL, hashes[j], &streql);
+      ret += found[k];
+    }
+  }
+
+  return ret;
+}
+
 bool upb_strtable_remove3(upb_strtable *t, const char *key, size_t len,
                          upb_value *val, upb_alloc *alloc) {
   uint32_t hash = MurmurHash2(key, len, 0);
@@ -542,6 +589,34 @@ bool upb_inttable_lookup(const upb_inttable *t, uintptr_t key, upb_value *v) {
   return true;
 }
 
+size_t upb_inttable_lookupbatch(const upb_inttable *t, const uintptr_t *keys,
+                                size_t n, upb_value *vals, bool *found) {
+  size_t ret = 0;
+  size_t i;
+
+  for (i = 0; i < n; i += UPB_LOOKUPBATCH) {
+    size_t batch = UPB_MIN(n - i, UPB_LOOKUPBATCH);
+    size_t j;
+
+    for (j = 0; j < batch; j++) {
+      uintptr_t key = keys[i + j];
+      if (key < t->array_size) {
+        UPB_PREFETCH(&t->array[key]);
+      } else if (t->t.size_lg2 > 0) {
+        UPB_PREFETCH(upb_getentry(&t->t, upb_inthash(key)));
+      }
+    }
+
+    for (j = 0; j < batch; j++) {
+      size_t k = i + j;
+      found[k] = upb_inttable_lookup(t, keys[k], vals ? &vals[k] : NULL);
+      ret += found[k];
+    }
+  }
+
+  return ret;
+}
+
 bool upb_inttable_replace(upb_inttable *t, uintptr_t key, upb_value val) {
   upb_tabval *table_v = inttable_val(t, key);
   if (!table_v) return false;
@@ -725,14 +800,396 @@ bool upb_inttable_iter_isequal(const upb_inttable_iter *i1,
          i1->array_part == i2->array_part;
 }
 
-#ifdef UPB_UNALIGNED_READS_OK
+
+/* Frozen tables **************************************************************/
+
+#define FROZEN_STRMAGIC 0x75706273  /* "upbs" */
+#define FROZEN_INTMAGIC 0x75706269  /* "upbi" */
+#define FROZEN_HEADERSIZE 64
+#define FROZEN_MAXSEEDS 64
+#define FROZEN_MAXDISP (1 << 16)
+
+typedef struct {
+  uint64_t key;  /* The integer key, or (string offset << 32) | length. */
+  uint64_t val;
+} frozen_slot;
+
+/* A key being frozen. */
+typedef struct {
+  const char *str;
+  size_t len;
+  uintptr_t num;
+  uint64_t val;
+  uint32_t hash;
+  uint32_t hash2;
+  uint32_t slot;
+} frozen_key;
+
+static uint32_t frozen_groups(size_t count) {
+  /* Two keys per group on average keeps placement fast and easy. */
+  uint32_t groups = 1;
+  while (groups * 2 < count) groups *= 2;
+  return groups;
+}
+
+/* Returns the primary hash in the low 32 bits and the secondary hash in the
+ * high 32 bits. */
+static uint64_t frozen_inthash(uint64_t key, uint32_t seed) {
+  /* MurmurHash3's 64-bit finalizer. */
+  key ^= seed;
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdU;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53U;
+  key ^= key >> 33;
+  return key;
+}
+
+/* A secondary hash for strings, to tell apart keys whose 32-bit hashes
+ * collide (which big tables are bound to have).  It costs no more than one
+ * load, of bytes the primary hash just read. */
+static uint32_t frozen_strhash2(const char *str, size_t len) {
+  uint32_t tail = 0;
+  size_t n = UPB_MIN(len, sizeof(tail));
+  memcpy(&tail, str + len - n, n);
+  return tail ^ (uint32_t)len;
+}
+
+/* The low bits of a key's hash pick its group.  Each group has a 32-bit
+ * displacement: groups with a single key store its slot directly (flagged with
+ * the top bit), other groups store the value to remix their hashes with so that
+ * none of their keys collide. */
+#define FROZEN_DIRECT 0x80000000U
+
+static uint32_t frozen_remix(uint32_t hash, uint32_t hash2, uint32_t disp,
+                             uint32_t count) {
+  /* MurmurHash3's 32-bit finalizer. */
+  uint32_t h = (hash ^ hash2 * 0x85ebca6bU) + disp * 0x9e3779b9U;
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35U;
+  h ^= h >> 16;
+  return h % count;
+}
+
+static const frozen_slot *frozen_getslot(const upb_frozentable *t,
+                                         uint32_t hash, uint32_t hash2) {
+  const char *base = (const char*)t;
+  const uint32_t *disps = (const uint32_t*)(base + t->disp_ofs);
+  uint32_t disp = disps[hash & (t->groups - 1)];
+  uint32_t slot = (disp & FROZEN_DIRECT)
+                      ? disp & ~FROZEN_DIRECT
+                      : frozen_remix(hash, hash2, disp, t->count);
+  return (const frozen_slot*)(base + t->slot_ofs) + slot;
+}
+
+typedef struct {
+  uint32_t group;
+  uint32_t size;
+} frozen_group;
+
+static int frozen_cmpgroup(const void *a, const void *b) {
+  const frozen_group *ga = a;
+  const frozen_group *gb = b;
+  /* Biggest first; ties broken by group for determinism. */
+  if (ga->size != gb->size) return ga->size < gb->size ? 1 : -1;
+  return ga->group < gb->group ? -1 : ga->group > gb->group;
+}
+
+/* Tries to find a displacement for every group that puts all keys in distinct
+ * slots, given each key's hash.  Big groups are placed first, while most slots
+ * are still free; groups of one at the end just take the next free slot.
+ * Fails only if two keys in a group have the same primary and secondary
+ * hashes. */
+static bool frozen_place(frozen_key *keys, uint32_t count, uint32_t groups,
+                         uint32_t *disp, frozen_group *order,
+                         uint32_t *bygroup, uint32_t *start, char *used) {
+  uint32_t i;
+  uint32_t free_pos = 0;
+
+  memset(start, 0, (groups + 1) * sizeof(*start));
+  memset(used, 0, count);
+
+  /* Bucket the keys by group. */
+  for (i = 0; i < count; i++) {
+    start[(keys[i].hash & (groups - 1)) + 1]++;
+  }
+  for (i = 0; i < groups; i++) {
+    order[i].group = i;
+    order[i].size = start[i + 1];
+    start[i + 1] += start[i];
+  }
+  for (i = 0; i < count; i++) {
+    bygroup[start[keys[i].hash & (groups - 1)]++] = i;
+  }
+  /* start[g] is now the end of group g, and the beginning of group g+1. */
+  for (i = groups; i > 0; i--) {
+    start[i] = start[i - 1];
+  }
+  start[0] = 0;
+
+  qsort(order, groups, sizeof(*order), &frozen_cmpgroup);
+
+  for (i = 0; i < groups; i++) {
+    uint32_t g = order[i].group;
+    const uint32_t *members = &bygroup[start[g]];
+    uint32_t size = order[i].size;
+    uint32_t d;
+    uint32_t j;
+
+    if (size == 0) {
+      break;
+    }
+
+    if (size == 1) {
+      while (used[free_pos]) free_pos++;
+      disp[g] = free_pos | FROZEN_DIRECT;
+      keys[members[0]].slot = free_pos;
+      used[free_pos] = 1;
+      continue;
+    }
+
+    for (d = 0; d < FROZEN_MAXDISP; d++) {
+      for (j = 0; j < size; j++) {
+        frozen_key *k = &keys[members[j]];
+        k->slot = frozen_remix(k->hash, k->hash2, d, count);
+        if (used[k->slot]) break;
+        used[k->slot] = 1;
+      }
+
+      if (j == size) {
+        break;
+      }
+
+      /* Collision; undo and try the next displacement. */
+      while (j > 0) {
+        used[keys[members[--j]].slot] = 0;
+      }
+    }
+
+    if (d == FROZEN_MAXDISP) {
+      return false;
+    }
+
+    disp[g] = d;
+  }
+
+  return true;
+}
+
+static const upb_frozentable *frozen_build(frozen_key *keys, uint32_t count,
+                                           bool is_str, upb_ctype_t ctype,
+                                           void *buf, size_t size,
+                                           upb_alloc *a) {
+  upb_frozentable *t = buf;
+  uint32_t groups = frozen_groups(count);
+  frozen_slot *slots;
+  uint32_t *disp;
+  frozen_group *order = NULL;
+  uint32_t *bygroup = NULL;
+  uint32_t *start = NULL;
+  char *used = NULL;
+  const upb_frozentable *ret = NULL;
+  size_t ofs;
+  uint32_t seed;
+  uint32_t i;
+
+  UPB_ASSERT(sizeof(upb_frozentable) <= FROZEN_HEADERSIZE);
+  UPB_ASSERT(((uintptr_t)buf & 7) == 0);
+
+  if (size > UINT32_MAX || count >= FROZEN_DIRECT) {
+    return NULL;
+  }
+
+  /* Zero everything, so that frozen tables are reproducible byte-for-byte. */
+  memset(buf, 0, size);
+  t->magic = is_str ? FROZEN_STRMAGIC : FROZEN_INTMAGIC;
+  t->size = size;
+  t->count = count;
+  t->groups = groups;
+  t->ctype = ctype;
+  t->slot_ofs = FROZEN_HEADERSIZE;
+  t->disp_ofs = t->slot_ofs + count * sizeof(frozen_slot);
+  slots = (frozen_slot*)((char*)buf + t->slot_ofs);
+  disp = (uint32_t*)((char*)buf + t->disp_ofs);
+
+  if (count == 0) {
+    return t;
+  }
+
+  order = upb_malloc(a, groups * sizeof(*order));
+  bygroup = upb_malloc(a, count * sizeof(*bygroup));
+  start = upb_malloc(a, (groups + 1) * sizeof(*start));
+  used = upb_malloc(a, count);
+  if (!order || !bygroup || !start || !used) {
+    goto done;
+  }
+
+  for (seed = 0; seed < FROZEN_MAXSEEDS; seed++) {
+    for (i = 0; i < count; i++) {
+      frozen_key *k = &keys[i];
+      if (is_str) {
+        k->hash = MurmurHash2(k->str, k->len, seed);
+        k->hash2 = frozen_strhash2(k->str, k->len);
+      } else {
+        uint64_t hash = frozen_inthash(k->num, seed);
+        k->hash = (uint32_t)hash;
+        k->hash2 = (uint32_t)(hash >> 32);
+      }
+    }
+
+    if (frozen_place(keys, count, groups, disp, order, bygroup, start, used)) {
+      break;
+    }
+  }
+
+  if (seed == FROZEN_MAXSEEDS) {
+    goto done;
+  }
+
+  t->seed = seed;
+
+  /* Copy keys, values and (after the displacements) strings. */
+  ofs = t->disp_ofs + groups * sizeof(uint32_t);
+  for (i = 0; i < count; i++) {
+    frozen_slot *slot = &slots[keys[i].slot];
+    slot->val = keys[i].val;
+    if (is_str) {
+      memcpy((char*)buf + ofs, keys[i].str, keys[i].len);
+      slot->key = ((uint64_t)ofs << 32) | keys[i].len;
+      ofs += keys[i].len + 1;
+    } else {
+      slot->key = keys[i].num;
+    }
+  }
+  UPB_ASSERT(ofs <= size);
+
+  ret = t;
+
+done:
+  upb_free(a, order);
+  upb_free(a, bygroup);
+  upb_free(a, start);
+  upb_free(a, used);
+  return ret;
+}
+
+size_t upb_strtable_frozensize(const upb_strtable *t) {
+  size_t count = upb_strtable_count(t);
+  size_t ret = FROZEN_HEADERSIZE + count * sizeof(frozen_slot) +
+               frozen_groups(count) * sizeof(uint32_t);
+  upb_strtable_iter i;
+
+  for (upb_strtable_begin(&i, t); !upb_strtable_done(&i);
+       upb_strtable_next(&i)) {
+    ret += upb_strtable_iter_keylength(&i) + 1;
+  }
+
+  return ret;
+}
+
+size_t upb_inttable_frozensize(const upb_inttable *t) {
+  size_t count = upb_inttable_count(t);
+  return FROZEN_HEADERSIZE + count * sizeof(frozen_slot) +
+         frozen_groups(count) * sizeof(uint32_t);
+}
+
+const upb_frozentable *upb_strtable_freeze(const upb_strtable *t, void *buf,
+                                           size_t size, upb_alloc *a) {
+  size_t count = upb_strtable_count(t);
+  frozen_key *keys;
+  const upb_frozentable *ret;
+  upb_strtable_iter i;
+  size_t n = 0;
+
+  UPB_ASSERT(size >= upb_strtable_frozensize(t));
+
+  keys = upb_malloc(a, UPB_MAX(count, 1) * sizeof(*keys));
+  if (!keys) return NULL;
+
+  for (upb_strtable_begin(&i, t); !upb_strtable_done(&i);
+       upb_strtable_next(&i), n++) {
+    keys[n].str = upb_strtable_iter_key(&i);
+    keys[n].len = upb_strtable_iter_keylength(&i);
+    keys[n].val = upb_strtable_iter_value(&i).val;
+  }
+
+  ret = frozen_build(keys, count, true, t->t.ctype, buf, size, a);
+  upb_free(a, keys);
+  return ret;
+}
+
+const upb_frozentable *upb_inttable_freeze(const upb_inttable *t, void *buf,
+                                           size_t size, upb_alloc *a) {
+  size_t count = upb_inttable_count(t);
+  frozen_key *keys;
+  const upb_frozentable *ret;
+  upb_inttable_iter i;
+  size_t n = 0;
+
+  UPB_ASSERT(size >= upb_inttable_frozensize(t));
+
+  keys = upb_malloc(a, UPB_MAX(count, 1) * sizeof(*keys));
+  if (!keys) return NULL;
+
+  for (upb_inttable_begin(&i, t); !upb_inttable_done(&i);
+       upb_inttable_next(&i), n++) {
+    keys[n].num = upb_inttable_iter_key(&i);
+    keys[n].val = upb_inttable_iter_value(&i).val;
+  }
+
+  ret = frozen_build(keys, count, false, t->t.ctype, buf, size, a);
+  upb_free(a, keys);
+  return ret;
+}
+
+bool upb_frozentable_lookupstr(const upb_frozentable *t, const char *key,
+                               size_t len, upb_value *v) {
+  const frozen_slot *slot;
+
+  UPB_ASSERT(t->magic == FROZEN_STRMAGIC);
+  if (t->count == 0) return false;
+
+  slot = frozen_getslot(t, MurmurHash2(key, len, t->seed),
+                        frozen_strhash2(key, len));
+  if ((uint32_t)slot->key != len ||
+      memcmp((const char*)t + (slot->key >> 32), key, len) != 0) {
+    return false;
+  }
+
+  if (v) _upb_value_setval(v, slot->val, t->ctype);
+  return true;
+}
+
+bool upb_frozentable_lookupint(const upb_frozentable *t, uintptr_t key,
+                               upb_value *v) {
+  const frozen_slot *slot;
+  uint64_t hash;
+
+  UPB_ASSERT(t->magic == FROZEN_INTMAGIC);
+  if (t->count == 0) return false;
+
+  hash = frozen_inthash(key, t->seed);
+  slot = frozen_getslot(t, (uint32_t)hash, (uint32_t)(hash >> 32));
+  if (slot->key != key) return false;
+
+  if (v) _upb_value_setval(v, slot->val, t->ctype);
+  return true;
+}
+
+
 /* -----------------------------------------------------------------------------
  * MurmurHash2, by Austin Appleby (released as public domain).
  * Reformatted and C99-ified by Joshua Haberman.
- * Note - This code makes a few assumptions about how your machine behaves -
- *   1. We can read a 4-byte value from any address without crashing
- *   2. sizeof(int) == 4 (in upb this limitation is removed by using uint32_t
- * And it has a few limitations -
+ *
+ * Input words are loaded with memcpy(), which compilers turn into a single
+ * (possibly unaligned) load where the platform allows it and safe byte loads
+ * elsewhere.  This replaces the old MurmurHashAligned2 fallback, which the
+ * default build always used, and produces exactly the same hashes; statically
+ * initialized tables (see upbc) depend on that.
+ *
+ * It has a few limitations -
  *   1. It will not work incrementally.
  *   2. It will not produce the same results on little-endian and big-endian
  *      machines. */
@@ -748,7 +1205,8 @@ uint32_t MurmurHash2(const void *key, size_t len, uint32_t seed) {
   /* Mix 4 bytes at a time into the hash */
   const uint8_t * data = (const uint8_t *)key;
   while(len >= 4) {
-    uint32_t k = *(uint32_t *)data;
+    uint32_t k;
+    memcpy(&k, data, sizeof(k));
 
     k *= m;
     k ^= k >> r;
@@ -776,129 +1234,3 @@ uint32_t MurmurHash2(const void *key, size_t len, uint32_t seed) {
 
   return h;
 }
-
-#else /* !UPB_UNALIGNED_READS_OK */
-
-/* -----------------------------------------------------------------------------
- * MurmurHashAligned2, by Austin Appleby
- * Same algorithm as MurmurHash2, but only does aligned reads - should be safer
- * on certain platforms.
- * Performance will be lower than MurmurHash2 */
-
-#define MIX(h,k,m) { k *= m; k ^= k >> r; k *= m; h *= m; h ^= k; }
-
-uint32_t MurmurHash2(const void * key, size_t len, uint32_t seed) {
-  const uint32_t m = 0x5bd1e995;
-  const int32_t r = 24;
-  const uint8_t * data = (const uint8_t *)key;
-  uint32_t h = seed ^ len;
-  uint8_t align = (uintptr_t)data & 3;
-
-  if(align && (len >= 4)) {
-    /* Pre-load the temp registers */
-    uint32_t t = 0, d = 0;
-    int32_t sl;
-    int32_t sr;
-
-    switch(align) {
-      case 1: t |= data[2] << 16;
-      case 2: t |= data[1] << 8;
-      case 3: t |= data[0];
-    }
-
-    t <<= (8 * align);
-
-    data += 4-align;
-    len -= 4-align;
-
-    sl = 8 * (4-align);
-    sr = 8 * align;
-
-    /* Mix */
-
-    while(len >= 4) {
-      uint32_t k;
-
-      d = *(uint32_t *)data;
-      t = (t >> sr) | (d << sl);
-
-      k = t;
-
-      MIX(h,k,m);
-
-      t = d;
-
-      data += 4;
-      len -= 4;
-    }
-
-    /* Handle leftover data in temp registers */
-
-    d = 0;
-
-    if(len >= align) {
-      uint32_t k;
-
-      switch(align) {
-        case 3: d |= data[2] << 16;
-        case 2: d |= data[1] << 8;
-        case 1: d |= data[0];
-      }
-
-      k = (t >> sr) | (d << sl);
-      MIX(h,k,m);
-
-      data += align;
-      len -= align;
-
-      /* ----------
-       * Handle tail bytes */
-
-      switch(len) {
-        case 3: h ^= data[2] << 16;
-        case 2: h ^= data[1] << 8;
-        case 1: h ^= data[0]; h *= m;
-      };
-    } else {
-      switch(len) {
-        case 3: d |= data[2] << 16;
-        case 2: d |= data[1] << 8;
-        case 1: d |= data[0];
-        case 0: h ^= (t >> sr) | (d << sl); h *= m;
-      }
-    }
-
-    h ^= h >> 13;
-    h *= m;
-    h ^= h >> 15;
-
-    return h;
-  } else {
-    while(len >= 4) {
-      uint32_t k = *(uint32_t *)data;
-
-      MIX(h,k,m);
-
-      data += 4;
-      len -= 4;
-    }
-
-    /* ----------
-     * Handle tail bytes */
-
-    switch(len) {
-      case 3: h ^= data[2] << 16;
-      case 2: h ^= data[1] << 8;
-      case 1: h ^= data[0]; h *= m;
-    };
-
-    h ^= h >> 13;
-    h *= m;
-    h ^= h >> 15;
-
-    return h;
-  }
-}
-#undef MIX
-
-#endif /* UPB_UNALIGNED_READS_OK */
@@ -384,13 +384,6 @@ UPB_INLINE size_t upb_strtable_count(const upb_strtable *t) {
   return t->t.count;
 }
 
-void upb_inttable_packedsize(const upb_inttable *t, size_t *size);
-void upb_strtable_packedsize(const upb_strtable *t, size_t *size);
-upb_inttable *upb_inttable_pack(const upb_inttable *t, void *p, size_t *ofs,
-                                size_t size);
-upb_strtable *upb_strtable_pack(const upb_strtable *t, void *p, size_t *ofs,
-                                size_t size);
-
 /* Inserts the given key into the hashtable with the given value.  The key must
  * not already exist in the hash table.  For string tables, the key must be
  * NULL-terminated, and the table will make an internal copy of the key.
@@ -431,6 +424,17 @@ UPB_INLINE bool upb_strtable_lookup(const upb_strtable *t, const char *key,
   return upb_strtable_lookup2(t, key, strlen(key), v);
 }
 
+/* Looks up n independent keys at once, setting found[i] and (if vals is
+ * non-NULL and the key was found) vals[i].  Returns the number of keys found.
+ * This is faster than n single lookups of keys that miss the cache: all
+ * buckets of a batch are hashed and prefetched before any are examined, so
+ * the cache misses overlap instead of happening one after the other. */
+size_t upb_inttable_lookupbatch(const upb_inttable *t, const uintptr_t *keys,
+                                size_t n, upb_value *vals, bool *found);
+size_t upb_strtable_lookupbatch(const upb_strtable *t,
+                                const char *const *keys, const size_t *lens,
+                                size_t n, upb_value *vals, bool *found);
+
 /* Removes an item from the table.  Returns true if the remove was successful,
  * and stores the removed item in *val if non-NULL. */
 bool upb_inttable_remove(upb_inttable *t, uintptr_t key, upb_value *val);
@@ -512,6 +516,56 @@ UPB_INLINE bool upb_inttable_lookup32(const upb_inttable *t, uint32_t key,
 /* Exposed for testing only. */
 bool upb_strtable_resize(upb_strtable *t, size_t size_lg2, upb_alloc *a);
 
+/* Frozen tables **************************************************************/
+
+/* A frozen table is a read-only copy of a finished inttable or strtable, laid
+ * out for lookups rather than updates:
+ *
+ *  - It is a single contiguous block containing offsets but no pointers, so it
+ *    can be used in place from .rodata or an mmap()ed file (on machines with
+ *    the byte order of the one that froze it).
+ *  - Keys are placed with a minimal perfect hash (hash and displace), so a
+ *    lookup is one hash, one displacement load and one slot load.
+ *  - Slots are 16 bytes and start on a 64-byte boundary of the block, so if
+ *    the block is cache-line aligned no slot straddles two lines.
+ *
+ * Values are copied bit-for-bit; pointer values are only meaningful in the
+ * process that froze them. */
+
+typedef struct {
+  uint32_t magic;     /* Distinguishes frozen strtables from inttables. */
+  uint32_t size;      /* Total size of the block in bytes. */
+  uint32_t count;     /* Number of keys, which is also the number of slots. */
+  uint32_t groups;    /* Number of displacement groups, a power of two. */
+  uint32_t seed;      /* Hash seed that yielded a perfect placement. */
+  uint32_t slot_ofs;  /* Offsets of the slot and displacement arrays. */
+  uint32_t disp_ofs;
+  uint8_t ctype;      /* upb_ctype_t of all values. */
+} upb_frozentable;
+
+/* Returns the number of bytes needed to freeze the table. */
+size_t upb_strtable_frozensize(const upb_strtable *t);
+size_t upb_inttable_frozensize(const upb_inttable *t);
+
+/* Freezes the table into "buf", which must be 8-byte aligned (64-byte aligned
+ * for best performance) and at least upb_*table_frozensize() bytes.  Temporary
+ * memory comes from "a".  Returns NULL if allocation fails or the table is too
+ * large for 32-bit offsets. */
+const upb_frozentable *upb_strtable_freeze(const upb_strtable *t, void *buf,
+                                           size_t size, upb_alloc *a);
+const upb_frozentable *upb_inttable_freeze(const upb_inttable *t, void *buf,
+                                           size_t size, upb_alloc *a);
+
+bool upb_frozentable_lookupstr(const upb_frozentable *t, const char *key,
+                               size_t len, upb_value *v);
+bool upb_frozentable_lookupint(const upb_frozentable *t, uintptr_t key,
+                               upb_value *v);
+
+UPB_INLINE size_t upb_frozentable_count(const upb_frozentable *t) {
+  return t->count;
+}
+
+
 /* Iterators ******************************************************************/
 
 /* Iterators for int and string tables.  We are subject to some kind of unusual
@@ -0,0 +1,51 @@
+/*
+** upb_trace implementation.
+*/
+
+/* clock_gettime() is POSIX. */
+#define _POSIX_C_SOURCE 199309L
+
+#include "upb/trace.h"
+
+#ifdef UPB_TRACING
+
+#include <time.h>
+
+upb_trace_func *upb_trace_func_ = NULL;
+static void *upb_trace_ud;
+
+void upb_trace_emit(upb_tracesource source, bool end, bool ok,
+                    const upb_msgdef *md,
+                    const upb_msglayout_msginit_v1 *layout, uint64_t bytes) {
+  upb_trace_func *func = upb_trace_func_;
+  upb_traceevent ev;
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  ev.source = source;
+  ev.end = end;
+  ev.ok = ok;
+  ev.md = md;
+  ev.layout = layout;
+  ev.bytes = bytes;
+  ev.time_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+  /* The callback may have been cleared since the caller checked. */
+  if (func) func(upb_trace_ud, &ev);
+}
+
+bool upb_settrace(upb_trace_func *func, void *ud) {
+  upb_trace_ud = ud;
+  upb_trace_func_ = func;
+  return true;
+}
+
+#else
+
+bool upb_settrace(upb_trace_func *func, void *ud) {
+  UPB_UNUSED(func);
+  UPB_UNUSED(ud);
+  return false;
+}
+
+#endif  /* UPB_TRACING */
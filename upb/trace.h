@@ -0,0 +1,94 @@
+/*
+** upb_trace: an optional global callback at the start and end of each
+** top-level message that upb_decode(), upb_encode(), upb_pbdecoder and
+** upb_json_printer process, for attributing latency to message types.
+**
+** Tracing is only compiled in when UPB_TRACING is defined (build with
+** "make WITH_TRACING=yes").  Without it the hooks compile to nothing; with it
+** each hook costs one branch on a global while no callback is set.
+*/
+
+#ifndef UPB_TRACE_H_
+#define UPB_TRACE_H_
+
+#include "upb/msg.h"
+
+typedef enum {
+  UPB_TRACE_DECODE,       /* upb_decode(), upb_decode2(), upb_decode_iov(). */
+  UPB_TRACE_ENCODE,       /* upb_encode(), upb_encode_withplan(). */
+  UPB_TRACE_PBDECODER,    /* Each message a upb_pbdecoder parses. */
+  UPB_TRACE_JSONPRINTER   /* Each message a upb_json_printer prints. */
+} upb_tracesource;
+
+typedef struct {
+  upb_tracesource source;
+
+  /* False for the event at the start of the message, true at its end. */
+  bool end;
+
+  /* At the end: whether the message was processed successfully.  The
+   * pbdecoder and JSON printer report their end when the stream ends, so a
+   * stream that is abandoned midway gets a start event but no end event. */
+  bool ok;
+
+  /* The message's type: |md| for the handler-based pbdecoder and JSON
+   * printer, |layout| for upb_decode() and upb_encode().  The other is NULL. */
+  const upb_msgdef *md;
+  const upb_msglayout_msginit_v1 *layout;
+
+  /* Input bytes for decoders, output bytes for encoders and printers.
+   * upb_decode() knows its input size at the start; the others report zero
+   * there. */
+  uint64_t bytes;
+
+  /* Nanoseconds on a monotonic clock with an arbitrary epoch. */
+  uint64_t time_ns;
+} upb_traceevent;
+
+typedef void upb_trace_func(void *ud, const upb_traceevent *ev);
+
+UPB_BEGIN_EXTERN_C
+
+/* Sets the global callback, or NULL to stop tracing.  The callback may be
+ * called from any thread that decodes or encodes, so it must be thread-safe;
+ * setting it is not, so set it before other threads start using upb.  Returns
+ * false, and does nothing, if upb was built without UPB_TRACING. */
+bool upb_settrace(upb_trace_func *func, void *ud);
+
+#ifdef UPB_TRACING
+
+/* Internal-only from here on: the hooks the decoders and encoders call. */
+extern upb_trace_func *upb_trace_func_;
+
+void upb_trace_emit(upb_tracesource source, bool end, bool ok,
+                    const upb_msgdef *md,
+                    const upb_msglayout_msginit_v1 *layout, uint64_t bytes);
+
+UPB_INLINE void upb_trace(upb_tracesource source, bool end, bool ok,
+                          const upb_msgdef *md,
+                          const upb_msglayout_msginit_v1 *layout,
+                          uint64_t bytes) {
+  if (UPB_UNLIKELY(upb_trace_func_ != NULL)) {
+    upb_trace_emit(source, end, ok, md, layout, bytes);
+  }
+}
+
+#else
+
+UPB_INLINE void upb_trace(upb_tracesource source, bool end, bool ok,
+                          const upb_msgdef *md,
+                          const upb_msglayout_msginit_v1 *layout,
+                          uint64_t bytes) {
+  UPB_UNUSED(source);
+  UPB_UNUSED(end);
+  UPB_UNUSED(ok);
+  UPB_UNUSED(md);
+  UPB_UNUSED(layout);
+  UPB_UNUSED(bytes);
+}
+
+#endif  /* UPB_TRACING */
+
+UPB_END_EXTERN_C
+
+#endif  /* UPB_TRACE_H_ */
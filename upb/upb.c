@@ -1,4 +1,9 @@
 
+#ifdef __linux__
+/* For mmap() flags in upb_alloc_hugepage. */
+#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -8,6 +13,10 @@
 #include <string.h>
 #include "upb/upb.h"
 
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
 bool upb_dumptostderr(void *closure, const upb_status* status) {
   UPB_UNUSED(closure);
   fprintf(stderr, "%s\n", upb_status_errmsg(status));
@@ -99,6 +108,113 @@ static void *upb_global_allocfunc(upb_alloc *alloc, void *ptr, size_t oldsize,
 upb_alloc upb_alloc_global = {&upb_global_allocfunc};
 
 
+/* upb_alloc_hugepage *********************************************************/
+
+/* Every allocation is preceded by a header recording how it was obtained,
+ * since upb_free() doesn't pass the size that munmap() needs. */
+typedef union {
+  size_t mapped;  /* Length of the mapping, or 0 if from malloc(). */
+  char align[UPB_HUGEPAGE_OVERHEAD];
+} hugepage_hdr;
+
+static hugepage_hdr *hugepage_new(size_t size) {
+  hugepage_hdr *hdr;
+
+  /* Leave room for the header, and for aligning the mapping below. */
+  if (size > SIZE_MAX - sizeof(hugepage_hdr) - 2 * UPB_HUGEPAGE_SIZE) {
+    return NULL;
+  }
+  size += sizeof(hugepage_hdr);
+
+#ifdef __linux__
+  /* Requests this big are rounded up to whole huge pages; smaller ones would
+   * waste too much of the page. */
+  if (size >= UPB_HUGEPAGE_SIZE / 2) {
+    size_t len = (size + UPB_HUGEPAGE_SIZE - 1) & ~(UPB_HUGEPAGE_SIZE - 1);
+    void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    /* Only succeeds if the administrator has reserved huge pages. */
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+    if (p == MAP_FAILED) {
+      /* Fall back to ordinary pages, and ask for transparent huge pages.
+       * Those can only back whole, aligned huge pages, so map one extra and
+       * trim the mapping back to an aligned start. */
+      char *start;
+      size_t lead;
+      p = mmap(NULL, len + UPB_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) {
+        return NULL;
+      }
+      start = (char*)(((uintptr_t)p + UPB_HUGEPAGE_SIZE - 1) &
+                      ~(uintptr_t)(UPB_HUGEPAGE_SIZE - 1));
+      lead = start - (char*)p;
+      if (lead > 0) {
+        munmap(p, lead);
+      }
+      munmap(start + len, UPB_HUGEPAGE_SIZE - lead);
+      p = start;
+#ifdef MADV_HUGEPAGE
+      madvise(p, len, MADV_HUGEPAGE);
+#endif
+    }
+
+    hdr = p;
+    hdr->mapped = len;
+    return hdr;
+  }
+#endif
+
+  hdr = malloc(size);
+  if (hdr) {
+    hdr->mapped = 0;
+  }
+  return hdr;
+}
+
+static void hugepage_free(hugepage_hdr *hdr) {
+#ifdef __linux__
+  if (hdr->mapped) {
+    munmap(hdr, hdr->mapped);
+    return;
+  }
+#endif
+  free(hdr);
+}
+
+static void *upb_hugepage_allocfunc(upb_alloc *alloc, void *ptr,
+                                    size_t oldsize, size_t size) {
+  hugepage_hdr *old = ptr ? (hugepage_hdr*)ptr - 1 : NULL;
+  hugepage_hdr *hdr;
+  UPB_UNUSED(alloc);
+
+  if (size == 0) {
+    if (old) {
+      hugepage_free(old);
+    }
+    return NULL;
+  }
+
+  hdr = hugepage_new(size);
+  if (!hdr) {
+    return NULL;
+  }
+
+  if (old) {
+    memcpy(hdr + 1, ptr, UPB_MIN(oldsize, size));
+    hugepage_free(old);
+  }
+
+  return hdr + 1;
+}
+
+upb_alloc upb_alloc_hugepage = {&upb_hugepage_allocfunc};
+
+
 /* upb_arena ******************************************************************/
 
 /* Be conservative and choose 16 in case anyone is using SSE. */
@@ -112,7 +228,7 @@ typedef struct mem_block {
   struct mem_block *next;
   size_t size;
   size_t used;
-  bool owned;
+  upb_alloc *alloc;  /* Frees this block, or NULL if the user owns it. */
   /* Data follows. */
 } mem_block;
 
@@ -122,16 +238,31 @@ typedef struct cleanup_ent {
   void *ud;
 } cleanup_ent;
 
+/* Arenas whose lifetimes have been fused share an arena_group.  Groups form a
+ * union-find forest, and the root holds the state of the whole set.  When an
+ * arena is uninitialized it donates its blocks and cleanups to the root, and
+ * the last one out frees everything. */
+typedef struct arena_group {
+  struct arena_group *parent;  /* NULL for the root. */
+  struct arena_group *next;    /* Root only: groups merged into this one. */
+  upb_alloc *alloc;            /* Allocator this group was allocated from. */
+  uint32_t refcount;           /* Root only: arenas still alive. */
+  mem_block *blocks;           /* Root only: blocks donated so far. */
+  cleanup_ent *cleanups;       /* Root only: cleanups donated so far. */
+} arena_group;
+
 static void upb_arena_addblock(upb_arena *a, void *ptr, size_t size,
-                               bool owned) {
+                               upb_alloc *alloc) {
   mem_block *block = ptr;
 
   block->next = a->block_head;
   block->size = size;
   block->used = align_up_max(sizeof(mem_block));
-  block->owned = owned;
+  block->alloc = alloc;
 
   a->block_head = block;
+  a->block_count++;
+  if (alloc) a->block_bytes += size;
 
   /* TODO(haberman): ASAN poison. */
 }
@@ -139,13 +270,27 @@ static void upb_arena_addblock(upb_arena *a, void *ptr, size_t size,
 
 static mem_block *upb_arena_allocblock(upb_arena *a, size_t size) {
   size_t block_size = UPB_MAX(size, a->next_block_size) + sizeof(mem_block);
-  mem_block *block = upb_malloc(a->block_alloc, block_size);
+  mem_block *block;
+
+  if (a->mem_limit) {
+    size_t left = a->mem_limit - UPB_MIN(a->block_bytes, a->mem_limit);
+    if (block_size > left) {
+      /* Settle for a block that only fits this allocation. */
+      block_size = size + sizeof(mem_block);
+      if (size > block_size || block_size > left) {
+        a->limit_failures++;
+        return NULL;
+      }
+    }
+  }
+
+  block = upb_malloc(a->block_alloc, block_size);
 
   if (!block) {
     return NULL;
   }
 
-  upb_arena_addblock(a, block, block_size, true);
+  upb_arena_addblock(a, block, block_size, a->block_alloc);
   a->next_block_size = UPB_MIN(block_size * 2, a->max_block_size);
 
   return block;
@@ -163,7 +308,17 @@ static void *upb_arena_doalloc(upb_alloc *alloc, void *ptr, size_t oldsize,
 
   size = align_up_max(size);
 
-  /* TODO(haberman): special-case if this is a realloc of the last alloc? */
+  if (oldsize > 0 && block) {
+    /* Grow or shrink the most recent allocation in place when it fits, so
+     * that repeatedly growing the last buffer is not quadratic. */
+    size_t old = align_up_max(oldsize);
+    char *top = (char*)block + block->used;
+    if ((char*)ptr + old == top && block->size - (block->used - old) >= size) {
+      block->used = block->used - old + size;
+      if (size > old) a->bytes_allocated += size - old;
+      return ptr;
+    }
+  }
 
   if (!block || block->size - block->used < size) {
     /* Slow path: have to allocate a new block. */
@@ -178,7 +333,8 @@ static void *upb_arena_doalloc(upb_alloc *alloc, void *ptr, size_t oldsize,
   block->used += size;
 
   if (oldsize > 0) {
-    memcpy(ret, ptr, oldsize);  /* Preserve existing data. */
+    memcpy(ret, ptr, UPB_MIN(oldsize, size));  /* Preserve existing data. */
+    a->realloc_waste += align_up_max(oldsize);
   }
 
   /* TODO(haberman): ASAN unpoison. */
@@ -197,13 +353,19 @@ void upb_arena_init(upb_arena *a) {
   a->max_block_size = 16384;
   a->cleanup_head = NULL;
   a->block_head = NULL;
+  a->block_count = 0;
+  a->block_bytes = 0;
+  a->mem_limit = 0;
+  a->limit_failures = 0;
+  a->realloc_waste = 0;
+  a->group = NULL;
 }
 
 void upb_arena_init2(upb_arena *a, void *mem, size_t size, upb_alloc *alloc) {
   upb_arena_init(a);
 
   if (size > sizeof(mem_block)) {
-    upb_arena_addblock(a, mem, size, false);
+    upb_arena_addblock(a, mem, size, NULL);
   }
 
   if (alloc) {
@@ -211,30 +373,220 @@ void upb_arena_init2(upb_arena *a, void *mem, size_t size, upb_alloc *alloc) {
   }
 }
 
-void upb_arena_uninit(upb_arena *a) {
-  cleanup_ent *ent = a->cleanup_head;
-  mem_block *block = a->block_head;
-
+static void upb_arena_runcleanups(cleanup_ent *ent) {
   while (ent) {
     ent->cleanup(ent->ud);
     ent = ent->next;
   }
+}
 
-  /* Must do this after running cleanup functions, because this will delete
-   * the memory we store our cleanup entries in! */
+/* Frees all blocks in the list except |keep|. */
+static void upb_arena_freeblocks(mem_block *block, const mem_block *keep) {
   while (block) {
     mem_block *next = block->next;
 
-    if (block->owned) {
-      upb_free(a->block_alloc, block);
+    if (block != keep && block->alloc) {
+      upb_free(block->alloc, block);
     }
 
     block = next;
   }
+}
+
+static arena_group *upb_arena_findroot(upb_arena *a) {
+  arena_group *g = a->group;
+  arena_group *root = g;
+
+  if (!root) {
+    return NULL;
+  }
+
+  while (root->parent) {
+    root = root->parent;
+  }
+
+  /* Path compression. */
+  while (g != root) {
+    arena_group *next = g->parent;
+    g->parent = root;
+    g = next;
+  }
+
+  a->group = root;
+  return root;
+}
+
+/* Moves the arena's blocks and cleanups to the group, which will free them
+ * once all of its arenas are gone. */
+static void upb_arena_donate(upb_arena *a, arena_group *root) {
+  mem_block *block = a->block_head;
+  cleanup_ent *ent = a->cleanup_head;
+
+  if (block) {
+    while (block->next) block = block->next;
+    block->next = root->blocks;
+    root->blocks = a->block_head;
+  }
+
+  if (ent) {
+    while (ent->next) ent = ent->next;
+    ent->next = root->cleanups;
+    root->cleanups = a->cleanup_head;
+  }
+
+  a->block_head = NULL;
+  a->block_count = 0;
+  a->block_bytes = 0;
+  a->realloc_waste = 0;
+  a->cleanup_head = NULL;
+}
+
+void upb_arena_uninit(upb_arena *a) {
+  arena_group *root = upb_arena_findroot(a);
+
+  if (root) {
+    upb_arena_donate(a, root);
+    a->group = NULL;
+
+    if (--root->refcount == 0) {
+      arena_group *g = root;
+      upb_arena_runcleanups(root->cleanups);
+      upb_arena_freeblocks(root->blocks, NULL);
+      while (g) {
+        arena_group *next = g->next;
+        upb_free(g->alloc, g);
+        g = next;
+      }
+    }
+  } else {
+    upb_arena_runcleanups(a->cleanup_head);
+
+    /* Must do this after running cleanup functions, because this will delete
+     * the memory we store our cleanup entries in! */
+    upb_arena_freeblocks(a->block_head, NULL);
+  }
 
   /* Protect against multiple-uninit. */
   a->cleanup_head = NULL;
   a->block_head = NULL;
+  a->block_count = 0;
+  a->block_bytes = 0;
+}
+
+void upb_arena_reset(upb_arena *a) {
+  arena_group *root = upb_arena_findroot(a);
+  mem_block *block = a->block_head;
+  mem_block *keep = NULL;
+
+  a->bytes_allocated = 0;
+
+  if (root) {
+    /* Other arenas in the group may point into our blocks, so we can only give
+     * them to the group and start over. */
+    upb_arena_donate(a, root);
+    return;
+  }
+
+  /* Keep the largest block, which is usually the last one allocated. */
+  while (block) {
+    if (!keep || block->size > keep->size) {
+      keep = block;
+    }
+    block = block->next;
+  }
+
+  upb_arena_runcleanups(a->cleanup_head);
+  upb_arena_freeblocks(a->block_head, keep);
+
+  a->cleanup_head = NULL;
+  a->block_head = NULL;
+  a->block_count = 0;
+  a->block_bytes = 0;
+  a->realloc_waste = 0;
+  if (keep) {
+    upb_arena_addblock(a, keep, keep->size, keep->alloc);
+  }
+}
+
+static bool upb_arena_hasuserblock(const upb_arena *a) {
+  const mem_block *block = a->block_head;
+
+  for (; block; block = block->next) {
+    if (!block->alloc) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static arena_group *upb_arena_getgroup(upb_arena *a) {
+  arena_group *g = upb_arena_findroot(a);
+
+  if (!g) {
+    g = upb_malloc(a->block_alloc, sizeof(arena_group));
+    if (!g) {
+      return NULL;
+    }
+
+    g->parent = NULL;
+    g->next = NULL;
+    g->alloc = a->block_alloc;
+    g->refcount = 1;
+    g->blocks = NULL;
+    g->cleanups = NULL;
+    a->group = g;
+  }
+
+  return g;
+}
+
+bool upb_arena_fuse(upb_arena *a, upb_arena *b) {
+  arena_group *ra;
+  arena_group *rb;
+  arena_group *tail;
+
+  /* We can't extend the life of memory that the user gave us. */
+  if (upb_arena_hasuserblock(a) || upb_arena_hasuserblock(b)) {
+    return false;
+  }
+
+  ra = upb_arena_getgroup(a);
+  rb = upb_arena_getgroup(b);
+
+  if (!ra || !rb) {
+    return false;
+  }
+
+  if (ra == rb) {
+    return true;
+  }
+
+  /* Merge rb's set into ra's. */
+  rb->parent = ra;
+  ra->refcount += rb->refcount;
+
+  for (tail = rb; tail->next; tail = tail->next) {}
+  tail->next = ra->next;
+  ra->next = rb;
+
+  if (rb->blocks) {
+    mem_block *block = rb->blocks;
+    while (block->next) block = block->next;
+    block->next = ra->blocks;
+    ra->blocks = rb->blocks;
+  }
+
+  if (rb->cleanups) {
+    cleanup_ent *ent = rb->cleanups;
+    while (ent->next) ent = ent->next;
+    ent->next = ra->cleanups;
+    ra->cleanups = rb->cleanups;
+  }
+
+  rb->blocks = NULL;
+  rb->cleanups = NULL;
+  return true;
 }
 
 bool upb_arena_addcleanup(upb_arena *a, upb_cleanup_func *func, void *ud) {
@@ -255,6 +607,193 @@ size_t upb_arena_bytesallocated(const upb_arena *a) {
   return a->bytes_allocated;
 }
 
+size_t upb_arena_blockcount(const upb_arena *a) {
+  return a->block_count;
+}
+
+void upb_arena_stats(const upb_arena *a, upb_arenastats *s) {
+  const mem_block *block = a->block_head;
+  const cleanup_ent *ent = a->cleanup_head;
+
+  memset(s, 0, sizeof(*s));
+  s->bytes_used = a->bytes_allocated;
+  s->realloc_waste = a->realloc_waste;
+  s->limit_failures = a->limit_failures;
+
+  for (; block; block = block->next) {
+    s->blocks++;
+    s->bytes_reserved += block->size;
+    s->largest_block = UPB_MAX(s->largest_block, block->size);
+    if (block != a->block_head) {
+      /* Only the head block is ever allocated from. */
+      s->tail_waste += block->size - block->used;
+    }
+  }
+
+  for (; ent; ent = ent->next) {
+    s->cleanups++;
+  }
+}
+
+void upb_arena_setmemlimit(upb_arena *a, size_t max) {
+  a->mem_limit = max;
+}
+
+void upb_arena_setnextblocksize(upb_arena *a, size_t size) {
+  a->next_block_size = size;
+}
+
+void upb_arena_setmaxblocksize(upb_arena *a, size_t size) {
+  a->max_block_size = size;
+}
+
+void upb_arenahint_record(upb_arenahint *h, const upb_arena *a) {
+  size_t used = upb_arena_bytesallocated(a);
+
+  if (h->avg == 0) {
+    h->avg = used;
+  } else {
+    /* Exponential moving average with a weight of 1/8 for the new run. */
+    h->avg = h->avg - h->avg / 8 + used / 8;
+  }
+}
+
+void upb_arenahint_apply(const upb_arenahint *h, upb_arena *a) {
+  if (h->avg > 0) {
+    /* Leave some headroom, so that a run a bit bigger than average still fits
+     * in one block. */
+    upb_arena_setnextblocksize(a, h->avg + h->avg / 8);
+  }
+}
+
+
+/* upb_concurrentarena ********************************************************/
+
+#ifdef UPB_THREAD_UNSAFE /*---------------------------------------------------*/
+
+static void *atomic_cas(void **p, void *old, void *val) {
+  void *ret = *p;
+  if (ret == old) *p = val;
+  return ret;
+}
+
+#elif defined(__GNUC__) || defined(__clang__) /*------------------------------*/
+
+static void *atomic_cas(void **p, void *old, void *val) {
+  return __sync_val_compare_and_swap(p, old, val);
+}
+
+#elif defined(WIN32) /*-------------------------------------------------------*/
+
+#include <Windows.h>
+
+static void *atomic_cas(void **p, void *old, void *val) {
+  return InterlockedCompareExchangePointer(p, val, old);
+}
+
+#else
+#error Atomic primitives not defined for your platform/CPU.  \
+       Implement them or compile with UPB_THREAD_UNSAFE.
+#endif
+
+/* Precedes every block and cleanup entry, linking it into one of the shared
+ * stacks.  Padded so that blocks keep their maximum alignment. */
+typedef union concurrent_hdr {
+  union concurrent_hdr *next;
+  char align[16];
+} concurrent_hdr;
+
+typedef struct {
+  upb_cleanup_func *cleanup;
+  void *ud;
+} concurrent_cleanup;
+
+/* Each failed compare-and-swap returns the current head, so we never need a
+ * separate (racy) read of it. */
+static void concurrent_push(void **head, concurrent_hdr *hdr) {
+  void *old = NULL;
+  void *cur;
+
+  for (;;) {
+    hdr->next = old;
+    cur = atomic_cas(head, old, hdr);
+    if (cur == old) break;
+    old = cur;
+  }
+}
+
+static void *upb_concurrentarena_allocfunc(upb_alloc *alloc, void *ptr,
+                                           size_t oldsize, size_t size) {
+  /* upb_alloc is initial member. */
+  upb_concurrentarena *a = (upb_concurrentarena*)alloc;
+  concurrent_hdr *hdr;
+
+  UPB_UNUSED(oldsize);
+
+  if (size == 0) {
+    return NULL;  /* Blocks are freed when the shared arena is. */
+  }
+
+  /* Arenas never realloc their blocks. */
+  UPB_ASSERT(ptr == NULL);
+  UPB_UNUSED(ptr);
+
+  hdr = upb_malloc(a->block_alloc, sizeof(concurrent_hdr) + size);
+  if (!hdr) {
+    return NULL;
+  }
+
+  concurrent_push(&a->block_head, hdr);
+  return hdr + 1;
+}
+
+void upb_concurrentarena_init(upb_concurrentarena *a, upb_alloc *block_alloc) {
+  a->alloc.func = &upb_concurrentarena_allocfunc;
+  a->block_alloc = block_alloc ? block_alloc : &upb_alloc_global;
+  a->block_head = NULL;
+  a->cleanup_head = NULL;
+}
+
+void upb_concurrentarena_uninit(upb_concurrentarena *a) {
+  concurrent_hdr *hdr = a->cleanup_head;
+
+  while (hdr) {
+    concurrent_hdr *next = hdr->next;
+    concurrent_cleanup *ent = (concurrent_cleanup*)(hdr + 1);
+    ent->cleanup(ent->ud);
+    upb_free(a->block_alloc, hdr);
+    hdr = next;
+  }
+
+  hdr = a->block_head;
+  while (hdr) {
+    concurrent_hdr *next = hdr->next;
+    upb_free(a->block_alloc, hdr);
+    hdr = next;
+  }
+
+  /* Protect against multiple-uninit. */
+  a->block_head = NULL;
+  a->cleanup_head = NULL;
+}
+
+bool upb_concurrentarena_addcleanup(upb_concurrentarena *a,
+                                    upb_cleanup_func *func, void *ud) {
+  concurrent_hdr *hdr = upb_malloc(
+      a->block_alloc, sizeof(concurrent_hdr) + sizeof(concurrent_cleanup));
+  concurrent_cleanup *ent;
+
+  if (!hdr) {
+    return false;  /* Out of memory. */
+  }
+
+  ent = (concurrent_cleanup*)(hdr + 1);
+  ent->cleanup = func;
+  ent->ud = ud;
+  concurrent_push(&a->cleanup_head, hdr);
+  return true;
+}
+
 
 /* Standard error functions ***************************************************/
 
@@ -293,6 +832,11 @@ void upb_env_uninit(upb_env *e) {
   upb_arena_uninit(&e->arena_);
 }
 
+void upb_env_reset(upb_env *e) {
+  upb_arena_reset(&e->arena_);
+  e->ok_ = true;
+}
+
 void upb_env_seterrorfunc(upb_env *e, upb_error_func *func, void *ud) {
   e->error_func_ = func;
   e->error_ud_ = ud;
@@ -308,6 +852,10 @@ bool upb_env_reporterror(upb_env *e, const upb_status *status) {
   return e->error_func_(e->error_ud_, status);
 }
 
+bool upb_env_ok(const upb_env *e) {
+  return e->ok_;
+}
+
 void *upb_env_malloc(upb_env *e, size_t size) {
   return upb_malloc(&e->arena_.alloc, size);
 }
@@ -324,6 +872,17 @@ bool upb_env_addcleanup(upb_env *e, upb_cleanup_func *func, void *ud) {
   return upb_arena_addcleanup(&e->arena_, func, ud);
 }
 
+void upb_env_setmemlimit(upb_env *e, size_t max) {
+  upb_arena_setmemlimit(&e->arena_, max);
+}
+
 size_t upb_env_bytesallocated(const upb_env *e) {
   return upb_arena_bytesallocated(&e->arena_);
 }
+
+
+/* upb_decstats ***************************************************************/
+
+void upb_decstats_clear(upb_decstats *s) {
+  memset(s, 0, sizeof(*s));
+}
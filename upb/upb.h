@@ -12,11 +12,13 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 namespace upb {
 class Allocator;
 class Arena;
+class ConcurrentArena;
 class Environment;
 class ErrorSpace;
 class Status;
@@ -36,6 +38,7 @@ template <int N> class InlinedEnvironment;
 
 /* Hints to the compiler about likely/unlikely branches. */
 #define UPB_LIKELY(x) __builtin_expect((x),1)
+#define UPB_UNLIKELY(x) __builtin_expect((x),0)
 
 /* Define UPB_BIG_ENDIAN manually if you're on big endian and your compiler
  * doesn't provide these preprocessor symbols. */
@@ -497,6 +500,24 @@ UPB_INLINE void upb_gfree(void *ptr) {
   upb_free(&upb_alloc_global, ptr);
 }
 
+/* An allocator for large, long-lived blocks such as arena blocks.  On Linux,
+ * requests of at least half a huge page are served by mmap() rounded up to
+ * whole 2MB huge pages (MAP_HUGETLB if pages are reserved, otherwise
+ * madvise(MADV_HUGEPAGE)), which cuts TLB misses when walking big messages.
+ * Smaller requests, and all requests on other platforms, use malloc().
+ *
+ * Each allocation carries UPB_HUGEPAGE_OVERHEAD bytes of bookkeeping.  An
+ * arena whose blocks should fill huge pages exactly can use:
+ *
+ *   upb_arena_init2(&arena, NULL, 0, &upb_alloc_hugepage);
+ *   upb_arena_setmaxblocksize(&arena, UPB_ARENA_HUGEPAGE_MAXBLOCKSIZE);
+ */
+
+#define UPB_HUGEPAGE_SIZE ((size_t)2 * 1024 * 1024)
+#define UPB_HUGEPAGE_OVERHEAD 16
+
+extern upb_alloc upb_alloc_hugepage;
+
 /* upb::Arena *****************************************************************/
 
 /* upb::Arena is a specific allocator implementation that uses arena allocation.
@@ -516,17 +537,78 @@ typedef void upb_cleanup_func(void *ud);
 
 #define UPB_ARENA_BLOCK_OVERHEAD (sizeof(size_t)*4)
 
+/* A max block size for arenas that allocate from upb_alloc_hugepage, so that
+ * each full-sized block occupies exactly one huge page. */
+#define UPB_ARENA_HUGEPAGE_MAXBLOCKSIZE \
+    (UPB_HUGEPAGE_SIZE - UPB_ARENA_BLOCK_OVERHEAD - UPB_HUGEPAGE_OVERHEAD)
+
 UPB_BEGIN_EXTERN_C
 
 void upb_arena_init(upb_arena *a);
 void upb_arena_init2(upb_arena *a, void *mem, size_t n, upb_alloc *alloc);
 void upb_arena_uninit(upb_arena *a);
+void upb_arena_reset(upb_arena *a);
+bool upb_arena_fuse(upb_arena *a, upb_arena *b);
 bool upb_arena_addcleanup(upb_arena *a, upb_cleanup_func *func, void *ud);
 size_t upb_arena_bytesallocated(const upb_arena *a);
+size_t upb_arena_blockcount(const upb_arena *a);
 void upb_arena_setnextblocksize(upb_arena *a, size_t size);
 void upb_arena_setmaxblocksize(upb_arena *a, size_t size);
 UPB_INLINE upb_alloc *upb_arena_alloc(upb_arena *a) { return (upb_alloc*)a; }
 
+/* upb_arenahint learns how much a recurring job, like decoding one kind of
+ * message, allocates from its arena, so that the arena for the next run can
+ * start with a single block big enough for a typical run.  It keeps a moving
+ * average of upb_arena_bytesallocated(), so keep one per kind of job, eg. per
+ * message layout.  It is not thread-safe.
+ *
+ *   upb_env_init(&env);
+ *   upb_arenahint_apply(&hint, upb_env_arena(&env));
+ *   ok = upb_decode(buf, msg, layout, &env);
+ *   upb_arenahint_record(&hint, upb_env_arena(&env));
+ *   upb_env_uninit(&env);
+ */
+typedef struct {
+  size_t avg;
+} upb_arenahint;
+
+#define UPB_ARENAHINT_INIT {0}
+
+/* Adds the bytes allocated so far from |a| to the average. */
+void upb_arenahint_record(upb_arenahint *h, const upb_arena *a);
+
+/* Sizes the next block of |a| for a typical run, if |h| has seen any. */
+void upb_arenahint_apply(const upb_arenahint *h, upb_arena *a);
+
+/* A snapshot of where an arena's memory has gone, from upb_arena_stats().
+ * Blocks donated to a fused group no longer count. */
+typedef struct {
+  size_t blocks;          /* Blocks held, including an initial user block. */
+  size_t bytes_reserved;  /* Total size of those blocks, with headers. */
+  size_t bytes_used;      /* Bytes handed out, as upb_arena_bytesallocated(). */
+  size_t largest_block;   /* Size of the largest block, with its header. */
+
+  /* Bytes the arena will never hand out: the unused ends of blocks that were
+   * retired when a new block was needed, and the old copies left behind when
+   * a realloc had to move an allocation. */
+  size_t tail_waste;
+  size_t realloc_waste;
+
+  size_t cleanups;        /* Cleanup functions registered. */
+  size_t limit_failures;  /* Allocations refused by upb_arena_setmemlimit(). */
+} upb_arenastats;
+
+/* Fills in |s| by walking the arena's block and cleanup lists, so the cost is
+ * linear in their length. */
+void upb_arena_stats(const upb_arena *a, upb_arenastats *s);
+
+/* Caps the bytes of blocks the arena requests from its block allocator, or 0
+ * (the default) for no limit.  An initial user block does not count.  Once
+ * the cap would be exceeded, allocations fail cleanly by returning NULL, as if
+ * the block allocator had run out of memory.  A reset arena keeps its
+ * largest block, which still counts. */
+void upb_arena_setmemlimit(upb_arena *a, size_t max);
+
 UPB_END_EXTERN_C
 
 #ifdef __cplusplus
@@ -548,6 +630,23 @@ class upb::Arena {
 
   ~Arena() { upb_arena_uninit(this); }
 
+  /* Frees everything allocated from the arena so it can be reused, as if it
+   * had been destroyed and recreated.  Cleanup functions are run.  The largest
+   * block is kept, so an arena that is reset between similar workloads
+   * (like per-request arenas in a server) stops calling the block allocator
+   * once it has warmed up.  The block size growth is not reset either. */
+  void Reset() { upb_arena_reset(this); }
+
+  /* Fuses the lifetime of this arena with another's, so that memory from
+   * either one stays alive until both have been destroyed.  Objects allocated
+   * in one may then point into the other, for example when grafting a
+   * submessage into a longer-lived message without copying it.  Fusing is
+   * transitive and cannot be undone.
+   *
+   * Returns false on out-of-memory, or if either arena was given an initial
+   * block, since we can't extend the lifetime of memory we don't own. */
+  bool Fuse(Arena* other) { return upb_arena_fuse(this, other); }
+
   /* Sets the size of the next block the Arena will request (unless the
    * requested allocation is larger).  Each block will double in size until the
    * max limit is reached. */
@@ -577,6 +676,14 @@ class upb::Arena {
     return upb_arena_bytesallocated(this);
   }
 
+  /* Number of blocks the arena currently holds, including an initial block
+   * given to the constructor. */
+  size_t BlockCount() const { return upb_arena_blockcount(this); }
+
+  /* See upb_arena_stats() and upb_arena_setmemlimit(). */
+  void GetStats(upb_arenastats* s) const { upb_arena_stats(this, s); }
+  void SetMemLimit(size_t max) { upb_arena_setmemlimit(this, max); }
+
  private:
   UPB_DISALLOW_COPY_AND_ASSIGN(Arena)
 
@@ -601,6 +708,98 @@ struct upb_arena {
   /* Cleanup entries.  Pointer to a cleanup_ent, defined in env.c */
   void *cleanup_head;
 
+  /* Lifetime group if fused with other arenas.  Points to an arena_group,
+   * defined in upb.c. */
+  void *group;
+
+  /* Number of blocks in the block list. */
+  size_t block_count;
+
+  /* Bytes of blocks from block_alloc, their cap (0 for none), allocations
+   * refused by the cap, and bytes abandoned by moving reallocs. */
+  size_t block_bytes;
+  size_t mem_limit;
+  size_t limit_failures;
+  size_t realloc_waste;
+};
+
+
+/* upb::ConcurrentArena *******************************************************/
+
+/* upb::ConcurrentArena lets several threads allocate into one logical arena
+ * without a lock.  Each thread allocates from its own upb::Arena, created
+ * with the ConcurrentArena's block allocator:
+ *
+ *   upb_arena local;
+ *   upb_arena_init2(&local, NULL, 0, upb_concurrentarena_blockalloc(&shared));
+ *
+ * The local arena is a private bump region for its thread.  Whenever it needs
+ * a new block, the block is pushed onto the shared block list with an atomic
+ * compare-and-swap.  Local arenas never free their blocks, so all memory stays
+ * alive until the ConcurrentArena is uninitialized, and objects built by
+ * different threads may point to each other.
+ *
+ * The underlying block allocator must itself be thread-safe (the default,
+ * upb_alloc_global, is).  Each local arena must be uninitialized before the
+ * ConcurrentArena, and its cleanup functions run when it is; cleanups that must
+ * wait for the shared memory to be freed should use
+ * upb_concurrentarena_addcleanup(), which may be called from any thread. */
+UPB_DECLARE_TYPE(upb::ConcurrentArena, upb_concurrentarena)
+
+UPB_BEGIN_EXTERN_C
+
+void upb_concurrentarena_init(upb_concurrentarena *a, upb_alloc *block_alloc);
+void upb_concurrentarena_uninit(upb_concurrentarena *a);
+bool upb_concurrentarena_addcleanup(upb_concurrentarena *a,
+                                    upb_cleanup_func *func, void *ud);
+UPB_INLINE upb_alloc *upb_concurrentarena_blockalloc(upb_concurrentarena *a) {
+  return (upb_alloc*)a;
+}
+
+UPB_END_EXTERN_C
+
+#ifdef __cplusplus
+
+class upb::ConcurrentArena {
+ public:
+  /* Blocks are allocated from upb_alloc_global. */
+  ConcurrentArena() { upb_concurrentarena_init(this, NULL); }
+
+  /* Blocks are allocated from the given allocator, which must be thread-safe
+   * and outlive the ConcurrentArena. */
+  explicit ConcurrentArena(Allocator* a) { upb_concurrentarena_init(this, a); }
+
+  ~ConcurrentArena() { upb_concurrentarena_uninit(this); }
+
+  /* The allocator to construct each thread's local Arena with:
+   *
+   *   upb::Arena local(NULL, 0, shared.block_allocator()); */
+  Allocator* block_allocator() { return upb_concurrentarena_blockalloc(this); }
+
+  /* Adds a cleanup function to run when the ConcurrentArena is destroyed.
+   * Thread-safe. */
+  bool AddCleanup(upb_cleanup_func* func, void* ud) {
+    return upb_concurrentarena_addcleanup(this, func, ud);
+  }
+
+ private:
+  UPB_DISALLOW_COPY_AND_ASSIGN(ConcurrentArena)
+
+#else
+struct upb_concurrentarena {
+#endif  /* __cplusplus */
+  /* The block allocator we give to local arenas.
+   * This must be the first member of upb_concurrentarena! */
+  upb_alloc alloc;
+
+  /* Allocator for the blocks themselves.  Must be thread-safe. */
+  upb_alloc *block_alloc;
+
+  /* Lock-free stacks of blocks and cleanups, pushed with compare-and-swap.
+   * Defined in upb.c. */
+  void *block_head;
+  void *cleanup_head;
+
   /* For future expansion, since the size of this struct is exposed to users. */
   void *future1;
   void *future2;
@@ -633,6 +832,7 @@ UPB_BEGIN_EXTERN_C
 void upb_env_init(upb_env *e);
 void upb_env_init2(upb_env *e, void *mem, size_t n, upb_alloc *alloc);
 void upb_env_uninit(upb_env *e);
+void upb_env_reset(upb_env *e);
 
 void upb_env_initonly(upb_env *e);
 
@@ -648,6 +848,7 @@ void *upb_env_realloc(upb_env *e, void *ptr, size_t oldsize, size_t size);
 void upb_env_free(upb_env *e, void *ptr);
 bool upb_env_addcleanup(upb_env *e, upb_cleanup_func *func, void *ud);
 size_t upb_env_bytesallocated(const upb_env *e);
+void upb_env_setmemlimit(upb_env *e, size_t max);
 
 UPB_END_EXTERN_C
 
@@ -664,6 +865,14 @@ class upb::Environment {
 
   Arena* arena() { return upb_env_arena(this); }
 
+  /* Caps the memory the environment's arena may request; see
+   * upb_arena_setmemlimit(). */
+  void SetMemLimit(size_t max) { upb_env_setmemlimit(this, max); }
+
+  /* Resets the arena (see Arena::Reset()) and clears the error state, so the
+   * environment can be reused for a new encode or decode. */
+  void Reset() { upb_env_reset(this); }
+
   /* Set a custom error reporting function. */
   void SetErrorFunction(upb_error_func* func, void* ud) {
     upb_env_seterrorfunc(this, func, ud);
@@ -697,6 +906,33 @@ struct upb_env {
 };
 
 
+/* upb_decstats ***************************************************************/
+
+/* Counters that a decoder updates as it runs, if the caller attaches one with
+ * upb_pbdecoder_setstats(), upb_decodeopts.stats or
+ * upb_json_parser_setstats().  With none attached the decoders only pay a
+ * branch on a NULL pointer.  Counters accumulate until cleared, so one struct
+ * can total many messages; each decoder leaves the counters it has no notion
+ * of at zero.  Not thread-safe: give each thread its own. */
+typedef struct {
+  uint64_t bytes;             /* Input bytes of successfully parsed messages. */
+  uint64_t fields;            /* Known field values decoded. */
+  uint64_t unknown_fields;    /* Unknown fields skipped or preserved. */
+  uint64_t suspends;          /* Returns to the caller to wait for input. */
+  uint64_t resumes;           /* Calls that continued a suspended message. */
+  uint64_t tag_hits;          /* Tags that matched the expected next field. */
+  uint64_t dispatch_lookups;  /* Tags that had to be looked up instead. */
+  uint64_t arena_blocks;      /* Blocks added to the env's arena. */
+  uint32_t max_depth;         /* Deepest submessage nesting seen. */
+} upb_decstats;
+
+UPB_BEGIN_EXTERN_C
+
+void upb_decstats_clear(upb_decstats *s);
+
+UPB_END_EXTERN_C
+
+
 /* upb::InlinedArena **********************************************************/
 /* upb::InlinedEnvironment ****************************************************/
 
@@ -0,0 +1,234 @@
+/*
+** UTF-8 validation, from John Keiser and Daniel Lemire, "Validating UTF-8 In
+** Less Than One Instruction Per Byte" (Software: Practice and Experience
+** 2021), as simdutf and simdjson do it.
+**
+** Every error in UTF-8 shows up in the first twelve bits of some pair of
+** consecutive bytes, except for a missing or extra continuation byte after a
+** three- or four-byte lead.  So each byte's possible errors are looked up by
+** the high and low nibbles of the byte before it and by its own high nibble,
+** three 16-entry tables whose entries are bitmasks of error classes; a byte is
+** bad if the three masks have a bit in common.  The continuation bytes that a
+** three- or four-byte lead needs are checked separately, from the bytes two
+** and three back.
+**
+** The vector loop only runs over whole 16-byte blocks, and stops short of a
+** character that the last block ends in the middle of.  The scalar loop does
+** the rest, and is all that runs without SSSE3.
+*/
+
+#include "upb/utf8.int.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__SSSE3__)
+#include <tmmintrin.h>
+#define UPB_UTF8_SSSE3
+#endif
+
+/* Checks |p| to |end| a byte at a time, after the state in |s|. */
+static bool upb_utf8_scalar(upb_utf8state *s, const uint8_t *p,
+                            const uint8_t *end) {
+  uint8_t need = s->need;
+  uint8_t lo = s->lo;
+  uint8_t hi = s->hi;
+
+  while (p < end) {
+    uint8_t c = *p;
+
+    if (need > 0) {
+      if (c < lo || c > hi) return false;
+      need--;
+      lo = 0x80;
+      hi = 0xbf;
+    } else if (c < 0x80) {
+      uint64_t word;
+      if (end - p >= 8) {
+        memcpy(&word, p, 8);
+        if ((word & 0x8080808080808080ULL) == 0) {
+          p += 8;
+          continue;
+        }
+      }
+    } else if (c >= 0xc2 && c <= 0xdf) {
+      need = 1;
+    } else if (c >= 0xe0 && c <= 0xef) {
+      /* No overlong forms, and no surrogates. */
+      need = 2;
+      if (c == 0xe0) lo = 0xa0;
+      if (c == 0xed) hi = 0x9f;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+      /* No overlong forms, and nothing past U+10FFFF. */
+      need = 3;
+      if (c == 0xf0) lo = 0x90;
+      if (c == 0xf4) hi = 0x8f;
+    } else {
+      return false;
+    }
+
+    p++;
+  }
+
+  s->need = need;
+  s->lo = lo;
+  s->hi = hi;
+  return true;
+}
+
+#if defined(UPB_UTF8_SSSE3)
+
+/* The error classes.  Each is an error that a pair of bytes can have. */
+#define TOO_SHORT      (1 << 0)  /* A lead byte, not a continuation byte. */
+#define TOO_LONG       (1 << 1)  /* A continuation byte after ASCII. */
+#define OVERLONG_3     (1 << 2)  /* 0xe0 0x80-0x9f. */
+#define TOO_LARGE      (1 << 3)  /* 0xf4 0x90-0xbf, or 0xf5-0xff. */
+#define SURROGATE      (1 << 4)  /* 0xed 0xa0-0xbf. */
+#define OVERLONG_2     (1 << 5)  /* 0xc0-0xc1. */
+#define TOO_LARGE_1000 (1 << 6)  /* 0xf5-0xff 0x80-0x8f. */
+#define OVERLONG_4     (1 << 6)  /* 0xf0 0x80-0x8f. */
+#define TWO_CONTS      (1 << 7)  /* Two continuation bytes. */
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+/* Returns a nonzero byte for each byte of |in| that can't follow the bytes
+ * before it.  |prev| is the block before |in|. */
+static __m128i upb_utf8_blockerrors(__m128i in, __m128i prev) {
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  const __m128i byte_1_high = _mm_setr_epi8(
+      /* 0xxx: ASCII. */
+      TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+      TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+      /* 10xx: continuation. */
+      (char)TWO_CONTS, (char)TWO_CONTS, (char)TWO_CONTS, (char)TWO_CONTS,
+      /* 1100, 1101: two-byte lead. */
+      TOO_SHORT | OVERLONG_2,
+      TOO_SHORT,
+      /* 1110: three-byte lead. */
+      TOO_SHORT | OVERLONG_3 | SURROGATE,
+      /* 1111: four-byte lead, or worse. */
+      TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+  const __m128i byte_1_low = _mm_setr_epi8(
+      (char)(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),
+      (char)(CARRY | OVERLONG_2),
+      (char)CARRY,
+      (char)CARRY,
+      (char)(CARRY | TOO_LARGE),
+      (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      (char)(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+      (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      (char)(CARRY | TOO_LARGE | TOO_LARGE_1000));
+  const __m128i byte_2_high = _mm_setr_epi8(
+      /* 0xxx: ASCII. */
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+      /* 1000, 1001, 101x: continuation. */
+      (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+             OVERLONG_4),
+      (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+      (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+      (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+      /* 11xx: lead. */
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+  __m128i prev1, prev2, prev3, special, must23;
+
+  prev1 = _mm_alignr_epi8(in, prev, 15);
+  special = _mm_and_si128(
+      _mm_and_si128(
+          _mm_shuffle_epi8(byte_1_high,
+                           _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+          _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+      _mm_shuffle_epi8(byte_2_high,
+                       _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+
+  /* TWO_CONTS is only an error when it isn't the second or third continuation
+   * byte after a three- or four-byte lead, and not having one there is. */
+  prev2 = _mm_alignr_epi8(in, prev, 14);
+  prev3 = _mm_alignr_epi8(in, prev, 13);
+  must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80)),
+                        _mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80)));
+  must23 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+  return _mm_xor_si128(must23, special);
+}
+
+#undef TOO_SHORT
+#undef TOO_LONG
+#undef OVERLONG_3
+#undef TOO_LARGE
+#undef SURROGATE
+#undef OVERLONG_2
+#undef TOO_LARGE_1000
+#undef OVERLONG_4
+#undef TWO_CONTS
+#undef CARRY
+
+/* Checks the whole blocks from |p|, which must start a character.  Returns
+ * where the scalar loop should carry on, the start of the last character the
+ * blocks reach, or NULL if they're invalid. */
+static const uint8_t *upb_utf8_ssse3(const uint8_t *p, const uint8_t *end) {
+  /* A block is incomplete if it ends with a lead byte that needs more than
+   * the bytes after it. */
+  const __m128i incomplete_max = _mm_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+  const uint8_t *start = p;
+  __m128i prev = _mm_setzero_si128();
+  __m128i prev_incomplete = _mm_setzero_si128();
+  __m128i error = _mm_setzero_si128();
+  int i;
+
+  while (end - p >= 16) {
+    __m128i in = _mm_loadu_si128((const __m128i*)p);
+    if (_mm_movemask_epi8(in) == 0) {
+      /* All ASCII: only an unfinished character before it can be wrong. */
+      error = _mm_or_si128(error, prev_incomplete);
+      prev_incomplete = _mm_setzero_si128();
+    } else {
+      error = _mm_or_si128(error, upb_utf8_blockerrors(in, prev));
+      prev_incomplete = _mm_subs_epu8(in, incomplete_max);
+    }
+    prev = in;
+    p += 16;
+  }
+
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) !=
+      0xffff) {
+    return NULL;
+  }
+
+  /* Back up to the lead byte of the last character, which may not have all of
+   * its continuation bytes yet. */
+  for (i = 0; i < 3 && p > start && (p[-1] & 0xc0) == 0x80; i++) {
+    p--;
+  }
+  if (p > start && p[-1] >= 0xc0) {
+    p--;
+  }
+  return p;
+}
+
+#endif  /* UPB_UTF8_SSSE3 */
+
+bool upb_utf8_check(upb_utf8state *s, const char *data, size_t len) {
+  const uint8_t *p = (const uint8_t*)data;
+  const uint8_t *end = p + len;
+
+#if defined(UPB_UTF8_SSSE3)
+  if (len >= 32) {
+    /* Finish the character that the last piece ended in the middle of, so the
+     * blocks start with a character. */
+    size_t n = s->need;
+    if (!upb_utf8_scalar(s, p, p + n)) return false;
+    p += n;
+    p = upb_utf8_ssse3(p, end);
+    if (!p) return false;
+  }
+#endif
+
+  return upb_utf8_scalar(s, p, end);
+}
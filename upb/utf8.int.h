@@ -0,0 +1,60 @@
+/*
+** UTF-8 validation for the decoders and the JSON parser.
+**
+** This header is INTERNAL-ONLY!  Its interfaces are not public or stable!
+**
+** Text is valid if it is well-formed UTF-8 as the Unicode standard defines
+** it: no overlong forms, no surrogates (U+D800 to U+DFFF) and nothing past
+** U+10FFFF.  When built with SSSE3 (eg. -mssse3 or -march=native), long text
+** is checked 16 bytes at a time with the table lookups of Keiser and Lemire's
+** "Validating UTF-8 In Less Than One Instruction Per Byte", as in simdutf;
+** otherwise runs of ASCII are skipped 8 bytes at a time.
+*/
+
+#ifndef UPB_UTF8_H_
+#define UPB_UTF8_H_
+
+#include <stdint.h>
+#include "upb/upb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* For text that arrives in pieces: the state between one piece and the next,
+ * which is in the middle of a character if |need| isn't zero. */
+typedef struct {
+  /* Continuation bytes still to come. */
+  uint8_t need;
+  /* The range that the next continuation byte must be in. */
+  uint8_t lo;
+  uint8_t hi;
+} upb_utf8state;
+
+UPB_INLINE void upb_utf8_init(upb_utf8state *s) {
+  s->need = 0;
+  s->lo = 0x80;
+  s->hi = 0xbf;
+}
+
+/* Checks the next |len| bytes of the text.  Returns false as soon as the text
+ * can't be valid, whatever follows. */
+bool upb_utf8_check(upb_utf8state *s, const char *data, size_t len);
+
+/* Whether the text so far ends with a whole character. */
+UPB_INLINE bool upb_utf8_done(const upb_utf8state *s) {
+  return s->need == 0;
+}
+
+/* Whether the |len| bytes at |data| are valid UTF-8 on their own. */
+UPB_INLINE bool upb_utf8_isvalid(const char *data, size_t len) {
+  upb_utf8state s;
+  upb_utf8_init(&s);
+  return upb_utf8_check(&s, data, len) && upb_utf8_done(&s);
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UPB_UTF8_H_ */